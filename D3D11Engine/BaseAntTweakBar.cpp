@@ -97,6 +97,8 @@ XRESULT BaseAntTweakBar::Init()
 	TwAddButton(Bar_General, "Save ZEN-Resources", (TwButtonCallback)SaveZENResourcesCallback, this, NULL); 
 	TwAddButton(Bar_General, "Load ZEN-Resources", (TwButtonCallback)LoadZENResourcesCallback, this, NULL); 
 	TwAddButton(Bar_General, "Open Settings Dialog", (TwButtonCallback)OpenSettingsCallback, this, NULL); 
+	TwAddButton(Bar_General, "Capture Scene", (TwButtonCallback)CaptureSceneCallback, this, NULL); 
+	TwAddButton(Bar_General, "Replay Scene", (TwButtonCallback)ReplaySceneCallback, this, NULL); 
 
 	TwAddVarRW(Bar_General, "DisableRendering", TW_TYPE_BOOLCPP, &Engine::GAPI->GetRendererState()->RendererSettings.DisableRendering, NULL);
 	TwAddVarRW(Bar_General, "Draw VOBs", TW_TYPE_BOOLCPP, &Engine::GAPI->GetRendererState()->RendererSettings.DrawVOBs, NULL);
@@ -122,6 +124,14 @@ XRESULT BaseAntTweakBar::Init()
 
 	TwType epls = TwDefineEnumFromString("PointlightShadowsEnum", "0 {Disabled}, 1 {Static}, 2 {Update Dynamic}, 3 {Full}");
 	TwAddVarRW(Bar_General, "PointlightShadows", epls, &Engine::GAPI->GetRendererState()->RendererSettings.EnablePointlightShadows, NULL);
+	TwAddVarRW(Bar_General, "PartialShadowUpdates", TW_TYPE_BOOLCPP, &Engine::GAPI->GetRendererState()->RendererSettings.PartialDynamicShadowUpdates, NULL);
+	TwAddVarRW(Bar_General, "ShadowUpdateBudgetMS", TW_TYPE_FLOAT, &Engine::GAPI->GetRendererState()->RendererSettings.ShadowUpdateBudgetMS, NULL);
+	TwDefine(" General/ShadowUpdateBudgetMS  step=0.1 min=0");
+	TwAddVarRW(Bar_General, "ShadowCubePoolMB", TW_TYPE_FLOAT, &Engine::GAPI->GetRendererState()->RendererSettings.ShadowCubePoolMemoryMB, NULL);
+	TwDefine(" General/ShadowCubePoolMB  step=1 min=1");
+	TwAddVarRW(Bar_General, "ClusteredLighting", TW_TYPE_BOOLCPP, &Engine::GAPI->GetRendererState()->RendererSettings.EnableClusteredLighting, NULL);
+	TwAddVarRO(Bar_General, "ShadowCubesResident", TW_TYPE_UINT32, &Engine::GAPI->GetRendererState()->RendererInfo.ShadowCubesResident, NULL);
+	TwAddVarRO(Bar_General, "ShadowCubeCapacity", TW_TYPE_UINT32, &Engine::GAPI->GetRendererState()->RendererInfo.ShadowCubeCapacity, NULL);
 
 	//TwAddVarRW(Bar_General, "FastShadows", TW_TYPE_BOOLCPP, &Engine::GAPI->GetRendererState()->RendererSettings.FastShadows, NULL);	
 	TwAddVarRW(Bar_General, "DrawShadowGeometry", TW_TYPE_BOOLCPP, &Engine::GAPI->GetRendererState()->RendererSettings.DrawShadowGeometry, NULL);
@@ -182,6 +192,13 @@ XRESULT BaseAntTweakBar::Init()
 
 	TwAddVarRW(Bar_General, "OutdoorSmallVobRadius", TW_TYPE_FLOAT, &Engine::GAPI->GetRendererState()->RendererSettings.OutdoorSmallVobDrawRadius, NULL);
 
+	TwAddVarRW(Bar_General, "EnableVobLODs", TW_TYPE_BOOLCPP, &Engine::GAPI->GetRendererState()->RendererSettings.EnableVobLODs, NULL);
+	TwAddVarRW(Bar_General, "VobLODScreenSize", TW_TYPE_FLOAT, &Engine::GAPI->GetRendererState()->RendererSettings.VobLODScreenSize, NULL);
+	TwDefine(" General/VobLODScreenSize  help='Size in pixels below which static vobs use their first LOD' step=10 min=0");
+
+	TwAddVarRW(Bar_General, "CompressTextures", TW_TYPE_BOOLCPP, &Engine::GAPI->GetRendererState()->RendererSettings.CompressTextures, NULL);
+	TwDefine(" General/CompressTextures  help='Compress converted and custom textures in the background and load them from the texture cache next time' ");
+
 	TwAddVarRW(Bar_General, "VisualFXDrawRadius", TW_TYPE_FLOAT, &Engine::GAPI->GetRendererState()->RendererSettings.VisualFXDrawRadius, NULL);
 
 	TwAddVarRW(Bar_General, "RainRadius", TW_TYPE_FLOAT, &Engine::GAPI->GetRendererState()->RendererSettings.RainRadiusRange, NULL);
@@ -258,6 +275,7 @@ XRESULT BaseAntTweakBar::Init()
 	TwAddVarRO(Bar_Info, "FPS", TW_TYPE_INT32, &Engine::GAPI->GetRendererState()->RendererInfo.FPS, NULL);
 	TwAddVarRO(Bar_Info, "StateChanges", TW_TYPE_UINT32, &Engine::GAPI->GetRendererState()->RendererInfo.StateChanges, NULL);
 	TwAddVarRO(Bar_Info, "DrawnVobs", TW_TYPE_INT32, &Engine::GAPI->GetRendererState()->RendererInfo.FrameDrawnVobs, NULL);
+	TwAddVarRO(Bar_Info, "VobLODInstances", TW_TYPE_UINT32, &Engine::GAPI->GetRendererState()->RendererInfo.FrameVobLODInstances, NULL);
 	TwAddVarRO(Bar_Info, "DrawnTriangles", TW_TYPE_INT32, &Engine::GAPI->GetRendererState()->RendererInfo.FrameDrawnTriangles, NULL);
 	TwAddVarRO(Bar_Info, "VobUpdates", TW_TYPE_INT32, &Engine::GAPI->GetRendererState()->RendererInfo.FrameVobUpdates, NULL);
 	TwAddVarRO(Bar_Info, "DrawnLights", TW_TYPE_INT32, &Engine::GAPI->GetRendererState()->RendererInfo.FrameDrawnLights, NULL);
@@ -291,6 +309,23 @@ XRESULT BaseAntTweakBar::Init()
 	TwAddVarRO(Bar_Info, "SC_DepthStencilState,", TW_TYPE_UINT32,		&Engine::GAPI->GetRendererState()->RendererInfo.StateChangesByState[GothicRendererInfo::SC_DSS], NULL);
 	TwAddVarRO(Bar_Info, "SC_SamplerState,", TW_TYPE_UINT32,	&Engine::GAPI->GetRendererState()->RendererInfo.StateChangesByState[GothicRendererInfo::SC_SMPL], NULL);
 	TwAddVarRO(Bar_Info, "SC_BlendState,", TW_TYPE_UINT32,		&Engine::GAPI->GetRendererState()->RendererInfo.StateChangesByState[GothicRendererInfo::SC_BS], NULL);
+	TwAddVarRO(Bar_Info, "SC_Redundant,", TW_TYPE_UINT32,		&Engine::GAPI->GetRendererState()->RendererInfo.RedundantStateChanges, NULL);
+	TwAddVarRO(Bar_Info, "CB_BytesUploaded,", TW_TYPE_UINT32,	&Engine::GAPI->GetRendererState()->RendererInfo.FrameConstantBufferBytesUploaded, NULL);
+	TwAddVarRO(Bar_Info, "CB_UploadsSkipped,", TW_TYPE_UINT32,	&Engine::GAPI->GetRendererState()->RendererInfo.FrameConstantBufferUploadsSkipped, NULL);
+	TwAddVarRO(Bar_Info, "ShadowUpdates", TW_TYPE_UINT32,	&Engine::GAPI->GetRendererState()->RendererInfo.FrameShadowUpdates, NULL);
+	TwAddVarRO(Bar_Info, "ShadowUpdatesDeferred", TW_TYPE_UINT32,	&Engine::GAPI->GetRendererState()->RendererInfo.FrameShadowUpdatesDeferred, NULL);
+	TwAddVarRO(Bar_Info, "ShadowUpdateMS", TW_TYPE_FLOAT,	&Engine::GAPI->GetRendererState()->RendererInfo.FrameShadowUpdateMS, NULL);
+	TwAddVarRO(Bar_Info, "ShadowMaxStaleness", TW_TYPE_UINT32,	&Engine::GAPI->GetRendererState()->RendererInfo.ShadowUpdateMaxStaleness, NULL);
+	TwAddVarRO(Bar_Info, "ShadowCubesResident", TW_TYPE_UINT32,	&Engine::GAPI->GetRendererState()->RendererInfo.ShadowCubesResident, NULL);
+	TwAddVarRO(Bar_Info, "ShadowCubesShared", TW_TYPE_UINT32,	&Engine::GAPI->GetRendererState()->RendererInfo.ShadowCubesShared, NULL);
+	TwAddVarRO(Bar_Info, "ShadowCubeCapacity", TW_TYPE_UINT32,	&Engine::GAPI->GetRendererState()->RendererInfo.ShadowCubeCapacity, NULL);
+	TwAddVarRO(Bar_Info, "ShadowCubePoolMB", TW_TYPE_FLOAT,	&Engine::GAPI->GetRendererState()->RendererInfo.ShadowCubePoolMB, NULL);
+	TwAddVarRO(Bar_Info, "ShadowCubeEvictions", TW_TYPE_UINT32,	&Engine::GAPI->GetRendererState()->RendererInfo.FrameShadowCubeEvictions, NULL);
+	TwAddVarRO(Bar_Info, "ClusteredLights", TW_TYPE_UINT32,	&Engine::GAPI->GetRendererState()->RendererInfo.FrameClusteredLights, NULL);
+	TwAddVarRO(Bar_Info, "LightClusterEntries", TW_TYPE_UINT32,	&Engine::GAPI->GetRendererState()->RendererInfo.FrameLightClusterEntries, NULL);
+	TwAddVarRO(Bar_Info, "Particles", TW_TYPE_UINT32,	&Engine::GAPI->GetRendererState()->RendererInfo.FrameParticles, NULL);
+	TwAddVarRO(Bar_Info, "ParticleBuildMS", TW_TYPE_FLOAT,	&Engine::GAPI->GetRendererState()->RendererInfo.FrameParticleBuildMS, NULL);
+	TwAddVarRO(Bar_Info, "ParticlesPerMS", TW_TYPE_FLOAT,	&Engine::GAPI->GetRendererState()->RendererInfo.FrameParticlesPerMS, NULL);
 					
 
 	Bar_HBAO = TwNewBar("HBAO+");
@@ -524,6 +559,16 @@ void TW_CALL BaseAntTweakBar::OpenSettingsCallback(void* clientdata)
 	Engine::GraphicsEngine->OnUIEvent(BaseGraphicsEngine::EUIEvent::UI_OpenSettings);
 }
 
+void TW_CALL BaseAntTweakBar::CaptureSceneCallback(void* clientdata)
+{
+	Engine::GAPI->StartSceneCapture();
+}
+
+void TW_CALL BaseAntTweakBar::ReplaySceneCallback(void* clientdata)
+{
+	Engine::GAPI->StartSceneReplay();
+}
+
 /** Resizes the anttweakbar */
 XRESULT BaseAntTweakBar::OnResize(INT2 newRes)
 {
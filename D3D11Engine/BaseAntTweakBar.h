@@ -63,6 +63,10 @@ protected:
 	/** Called on load ZEN resources */
 	static void TW_CALL OpenSettingsCallback(void* clientdata);
 
+	/** Called on capture/replay scene */
+	static void TW_CALL CaptureSceneCallback(void* clientdata);
+	static void TW_CALL ReplaySceneCallback(void* clientdata);
+
 	/** Tweak bars */
 	TwBar* Bar_Sky;
 
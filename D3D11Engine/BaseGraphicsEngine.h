@@ -49,6 +49,7 @@ struct ViewportInfo
 
 class zCTexture;
 class BaseShadowedPointLight;
+class ParticleFrameBuilder;
 
 /** Base graphics engine */
 class BaseGraphicsEngine
@@ -196,7 +197,7 @@ public:
 	/** Handles an UI-Event */
 	virtual void OnUIEvent(EUIEvent uiEvent){};
 
-	/** Draws particle effects */
-	virtual void DrawFrameParticles(std::map<zCTexture*, std::vector<ParticleInstanceInfo>>& particles, std::map<zCTexture*, ParticleRenderInfo>& info){};
+	/** Draws the particle effects of the frame, one range of the builders instance-buffer per texture */
+	virtual void DrawFrameParticles(ParticleFrameBuilder& particles){};
 };
 
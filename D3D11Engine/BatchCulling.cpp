@@ -0,0 +1,386 @@
+#include "pch.h"
+#include "BatchCulling.h"
+#include "Toolbox.h"
+#include <emmintrin.h>
+
+/** Grows the arrays to hold the given number of elements, padded up to the batch width */
+static void ResizeCullArrays(std::vector<float>** arrays, int numArrays, unsigned int count)
+{
+	unsigned int padded = (count + CULL_BATCH_WIDTH - 1) & ~(CULL_BATCH_WIDTH - 1);
+	if(arrays[0]->size() >= padded)
+		return;
+
+	for(int i=0;i<numArrays;i++)
+		arrays[i]->resize(padded, 0.0f);
+}
+
+/** Makes a mask big enough for the given number of elements, with all bits cleared */
+static void ResetCullMask(std::vector<unsigned int>& mask, unsigned int count)
+{
+	mask.assign((count + 31) / 32, 0);
+}
+
+/** Puts the result of one batch into the mask. The batch width divides 32, so a batch never spans two words. */
+static void StoreCullResult(std::vector<unsigned int>& mask, unsigned int first, unsigned int count, __m128 visible)
+{
+	unsigned int bits = (unsigned int)_mm_movemask_ps(visible);
+
+	// Padding at the end of the arrays is never visible
+	if(first + CULL_BATCH_WIDTH > count)
+		bits &= (1u << (count - first)) - 1;
+
+	mask[first >> 5] |= bits << (first & 31);
+}
+
+/** Adds a box to the end of the batch */
+void AABBBatch::Add(const D3DXVECTOR3& min, const D3DXVECTOR3& max)
+{
+	std::vector<float>* arrays[] = {&MinX, &MinY, &MinZ, &MaxX, &MaxY, &MaxZ};
+	ResizeCullArrays(arrays, 6, Count + 1);
+
+	MinX[Count] = min.x;
+	MinY[Count] = min.y;
+	MinZ[Count] = min.z;
+	MaxX[Count] = max.x;
+	MaxY[Count] = max.y;
+	MaxZ[Count] = max.z;
+	Count++;
+}
+
+/** Removes all boxes */
+void AABBBatch::Clear()
+{
+	MinX.clear(); MinY.clear(); MinZ.clear();
+	MaxX.clear(); MaxY.clear(); MaxZ.clear();
+	Count = 0;
+}
+
+/** Adds a point to the end of the batch */
+void PointBatch::Add(const D3DXVECTOR3& p, float radius)
+{
+	std::vector<float>* arrays[] = {&X, &Y, &Z, &Radius};
+	ResizeCullArrays(arrays, 4, Count + 1);
+
+	X[Count] = p.x;
+	Y[Count] = p.y;
+	Z[Count] = p.z;
+	Radius[Count] = radius;
+	Count++;
+}
+
+/** Removes all points */
+void PointBatch::Clear()
+{
+	X.clear(); Y.clear(); Z.clear(); Radius.clear();
+	Count = 0;
+}
+
+/** Takes the planes selected by clipFlags */
+void CullFrustum::Init(const zTPlane* planes, const byte* signBits, int clipFlags)
+{
+	NumPlanes = 0;
+	for(int i=0;i<6;i++)
+	{
+		if(!(clipFlags & (1 << i)))
+			continue;
+
+		NormalX[NumPlanes] = planes[i].Normal.x;
+		NormalY[NumPlanes] = planes[i].Normal.y;
+		NormalZ[NumPlanes] = planes[i].Normal.z;
+		Distance[NumPlanes] = planes[i].Distance;
+		SignBits[NumPlanes] = signBits[i];
+		NumPlanes++;
+	}
+}
+
+/** Tests the boxes against the frustum and, if wanted, the distance to a position */
+template<bool TestDistance>
+static void CullAABBBatch(const AABBBatch& boxes, const CullFrustum& frustum, const D3DXVECTOR3& position, float maxDistance, std::vector<unsigned int>& outMask)
+{
+	unsigned int count = boxes.Size();
+	ResetCullMask(outMask, count);
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 px = _mm_set1_ps(position.x);
+	const __m128 py = _mm_set1_ps(position.y);
+	const __m128 maxDist = _mm_set1_ps(maxDistance);
+
+	for(unsigned int i=0;i<count;i+=CULL_BATCH_WIDTH)
+	{
+		__m128 minX = _mm_loadu_ps(&boxes.MinX[i]);
+		__m128 minY = _mm_loadu_ps(&boxes.MinY[i]);
+		__m128 minZ = _mm_loadu_ps(&boxes.MinZ[i]);
+		__m128 maxX = _mm_loadu_ps(&boxes.MaxX[i]);
+		__m128 maxY = _mm_loadu_ps(&boxes.MaxY[i]);
+		__m128 maxZ = _mm_loadu_ps(&boxes.MaxZ[i]);
+
+		__m128 visible = _mm_cmpeq_ps(zero, zero);
+
+		if(TestDistance)
+		{
+			// Same as Toolbox::ComputePointAABBDistance, which only uses x and y
+			__m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minX, px), zero), _mm_sub_ps(px, maxX));
+			__m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minY, py), zero), _mm_sub_ps(py, maxY));
+			__m128 dist = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+			visible = _mm_cmplt_ps(dist, maxDist);
+		}
+
+		for(int p=0;p<frustum.NumPlanes;p++)
+		{
+			// Test the corner which is the furthest inside, as gothic does. If even that is behind the plane, the box is out.
+			byte sb = frustum.SignBits[p];
+			__m128 x = (sb & 1) ? maxX : minX;
+			__m128 y = (sb & 2) ? maxY : minY;
+			__m128 z = (sb & 4) ? maxZ : minZ;
+
+			__m128 dot = _mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(x, _mm_set1_ps(frustum.NormalX[p])),
+				_mm_mul_ps(y, _mm_set1_ps(frustum.NormalY[p]))),
+				_mm_mul_ps(z, _mm_set1_ps(frustum.NormalZ[p])));
+
+			visible = _mm_and_ps(visible, _mm_cmpnlt_ps(dot, _mm_set1_ps(frustum.Distance[p])));
+		}
+
+		StoreCullResult(outMask, i, count, visible);
+	}
+}
+
+/** Sets the bit of every box which isn't completely outside of the frustum */
+void BatchCulling::CullAABBs(const AABBBatch& boxes, const CullFrustum& frustum, std::vector<unsigned int>& outMask)
+{
+	CullAABBBatch<false>(boxes, frustum, D3DXVECTOR3(0, 0, 0), 0.0f, outMask);
+}
+
+/** Like above, but also requires the box to be closer than maxDistance to the given position */
+void BatchCulling::CullAABBs(const AABBBatch& boxes, const CullFrustum& frustum, const D3DXVECTOR3& position, float maxDistance, std::vector<unsigned int>& outMask)
+{
+	CullAABBBatch<true>(boxes, frustum, position, maxDistance, outMask);
+}
+
+/** Tests the distance of the points to the position against either one radius, or the radius of each point */
+template<bool PerPointRadius>
+static void CullPointBatch(const PointBatch& points, const D3DXVECTOR3& position, float maxDistance, std::vector<unsigned int>& outMask)
+{
+	unsigned int count = points.Size();
+	ResetCullMask(outMask, count);
+
+	const __m128 px = _mm_set1_ps(position.x);
+	const __m128 py = _mm_set1_ps(position.y);
+	const __m128 pz = _mm_set1_ps(position.z);
+	const __m128 maxDist = _mm_set1_ps(maxDistance);
+
+	for(unsigned int i=0;i<count;i+=CULL_BATCH_WIDTH)
+	{
+		__m128 dx = _mm_sub_ps(px, _mm_loadu_ps(&points.X[i]));
+		__m128 dy = _mm_sub_ps(py, _mm_loadu_ps(&points.Y[i]));
+		__m128 dz = _mm_sub_ps(pz, _mm_loadu_ps(&points.Z[i]));
+
+		// Take the root instead of comparing the squares, so the result matches D3DXVec3Length exactly
+		__m128 dist = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+
+		__m128 radius = PerPointRadius ? _mm_loadu_ps(&points.Radius[i]) : maxDist;
+		StoreCullResult(outMask, i, count, _mm_cmplt_ps(dist, radius));
+	}
+}
+
+/** Sets the bit of every point which is closer than maxDistance to the given position */
+void BatchCulling::CullPoints(const PointBatch& points, const D3DXVECTOR3& position, float maxDistance, std::vector<unsigned int>& outMask)
+{
+	CullPointBatch<false>(points, position, maxDistance, outMask);
+}
+
+/** Sets the bit of every point which is closer than its own radius to the given position */
+void BatchCulling::CullPointsInRadius(const PointBatch& points, const D3DXVECTOR3& position, std::vector<unsigned int>& outMask)
+{
+	CullPointBatch<true>(points, position, 0.0f, outMask);
+}
+
+/** Returns a random float between 0 and 1 */
+static float NextRandom(unsigned int& seed)
+{
+	seed = seed * 1664525 + 1013904223;
+	return (float)(seed >> 8) / (float)(1 << 24);
+}
+
+/** Makes random planes through the area the boxes are spread over. The signbits pick the corner furthest along the
+	normal, as gothic does. */
+static void MakeRandomPlanes(zTPlane* planes, byte* signBits, float extent, unsigned int& seed)
+{
+	for(int i=0;i<6;i++)
+	{
+		D3DXVECTOR3 n(NextRandom(seed) * 2.0f - 1.0f, NextRandom(seed) * 2.0f - 1.0f, NextRandom(seed) * 2.0f - 1.0f);
+		D3DXVec3Normalize(&planes[i].Normal, &n);
+		planes[i].Distance = (NextRandom(seed) * 2.0f - 1.0f) * extent * 0.5f;
+
+		signBits[i] = (planes[i].Normal.x > 0 ? 1 : 0) | (planes[i].Normal.y > 0 ? 2 : 0) | (planes[i].Normal.z > 0 ? 4 : 0);
+	}
+}
+
+/** Fills the batch with random boxes of up to the given size */
+static void MakeRandomBoxes(AABBBatch& boxes, unsigned int count, float extent, float maxSize, unsigned int& seed)
+{
+	boxes.Clear();
+	for(unsigned int i=0;i<count;i++)
+	{
+		D3DXVECTOR3 min((NextRandom(seed) * 2.0f - 1.0f) * extent, (NextRandom(seed) * 2.0f - 1.0f) * extent, (NextRandom(seed) * 2.0f - 1.0f) * extent);
+		D3DXVECTOR3 size(NextRandom(seed) * maxSize, NextRandom(seed) * maxSize, NextRandom(seed) * maxSize);
+		boxes.Add(min, min + size);
+	}
+}
+
+/** Culls the boxes one by one with Toolbox::BBox3DInFrustumCached, which tests the planes of CLIP_FLAGS_NO_FAR.
+	The distance is measured with Toolbox::ComputePointAABBDistance. */
+static void CullAABBsScalar(const AABBBatch& boxes, zTPlane* planes, byte* signBits, bool testDistance, const D3DXVECTOR3& position, float maxDistance, std::vector<bool>& outVisible)
+{
+	// Carried over from box to box, like the engine does
+	int cache = -1;
+
+	outVisible.resize(boxes.Size());
+	for(unsigned int i=0;i<boxes.Size();i++)
+	{
+		zTBBox3D box;
+		box.Min = D3DXVECTOR3(boxes.MinX[i], boxes.MinY[i], boxes.MinZ[i]);
+		box.Max = D3DXVECTOR3(boxes.MaxX[i], boxes.MaxY[i], boxes.MaxZ[i]);
+
+		outVisible[i] = (!testDistance || Toolbox::ComputePointAABBDistance(position, box.Min, box.Max) < maxDistance) &&
+			Toolbox::BBox3DInFrustumCached(box, planes, signBits, cache) != ZTCAM_CLIPTYPE_OUT;
+	}
+}
+
+/** Checks the mask against the scalar results, logs the first mismatch */
+static bool CompareCullResults(const char* what, const std::vector<unsigned int>& mask, const std::vector<bool>& reference)
+{
+	for(unsigned int i=0;i<reference.size();i++)
+	{
+		if(BatchCulling::IsVisible(mask, i) != reference[i])
+		{
+			LogWarn() << "BatchCulling self-test: " << what << " differs from the scalar test at element " << i << " of " << reference.size();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/** Compares the SSE-culling with the scalar tests on random boxes and points */
+bool BatchCulling::RunSelfTest()
+{
+	// Counts which aren't a multiple of the batch-width check the padding
+	static const unsigned int counts[] = {1, 3, 4, 33, 1000, 4097};
+
+	// BBox3DInFrustumCached always tests the planes of CLIP_FLAGS_NO_FAR. Planes left out here are replaced by one
+	// nothing is ever behind for the reference.
+	static const int clipFlags[] = {CLIP_FLAGS_NO_FAR, 1 | 4, 2 | 8, 0};
+	const float extent = 10000.0f;
+
+	bool passed = true;
+	unsigned int seed = 12345; // Fixed, so a failure can be reproduced
+	std::vector<unsigned int> mask;
+	std::vector<bool> reference;
+
+	for(unsigned int c=0;c<ARRAYSIZE(counts);c++)
+	{
+		AABBBatch boxes;
+		MakeRandomBoxes(boxes, counts[c], extent, 2000.0f, seed);
+
+		for(unsigned int f=0;f<ARRAYSIZE(clipFlags);f++)
+		{
+			zTPlane planes[6];
+			byte signBits[6];
+			MakeRandomPlanes(planes, signBits, extent, seed);
+
+			CullFrustum frustum;
+			frustum.Init(planes, signBits, clipFlags[f]);
+
+			for(int i=0;i<6;i++)
+			{
+				if(!(clipFlags[f] & (1 << i)))
+				{
+					planes[i].Normal = D3DXVECTOR3(0, 0, 0);
+					planes[i].Distance = -1.0f;
+				}
+			}
+
+			CullAABBs(boxes, frustum, mask);
+			CullAABBsScalar(boxes, planes, signBits, false, D3DXVECTOR3(0, 0, 0), 0.0f, reference);
+			passed &= CompareCullResults("CullAABBs", mask, reference);
+
+			D3DXVECTOR3 position(NextRandom(seed) * extent, NextRandom(seed) * extent, NextRandom(seed) * extent);
+			float maxDistance = NextRandom(seed) * extent;
+			CullAABBs(boxes, frustum, position, maxDistance, mask);
+			CullAABBsScalar(boxes, planes, signBits, true, position, maxDistance, reference);
+			passed &= CompareCullResults("CullAABBs with distance", mask, reference);
+		}
+
+		PointBatch points;
+		for(unsigned int i=0;i<counts[c];i++)
+			points.Add(D3DXVECTOR3((NextRandom(seed) * 2.0f - 1.0f) * extent, (NextRandom(seed) * 2.0f - 1.0f) * extent, (NextRandom(seed) * 2.0f - 1.0f) * extent), NextRandom(seed) * extent);
+
+		D3DXVECTOR3 position(NextRandom(seed) * extent, NextRandom(seed) * extent, NextRandom(seed) * extent);
+		float maxDistance = NextRandom(seed) * extent;
+
+		reference.resize(points.Size());
+		CullPoints(points, position, maxDistance, mask);
+		for(unsigned int i=0;i<points.Size();i++)
+		{
+			D3DXVECTOR3 d = position - D3DXVECTOR3(points.X[i], points.Y[i], points.Z[i]);
+			reference[i] = sqrtf(d.x * d.x + d.y * d.y + d.z * d.z) < maxDistance;
+		}
+		passed &= CompareCullResults("CullPoints", mask, reference);
+
+		CullPointsInRadius(points, position, mask);
+		for(unsigned int i=0;i<points.Size();i++)
+		{
+			D3DXVECTOR3 d = position - D3DXVECTOR3(points.X[i], points.Y[i], points.Z[i]);
+			reference[i] = sqrtf(d.x * d.x + d.y * d.y + d.z * d.z) < points.Radius[i];
+		}
+		passed &= CompareCullResults("CullPointsInRadius", mask, reference);
+	}
+
+	LogInfo() << "BatchCulling self-test " << (passed ? "passed" : "failed");
+	return passed;
+}
+
+/** Logs how many boxes per second the SSE-culling and Toolbox::BBox3DInFrustumCached get through */
+void BatchCulling::RunBenchmark()
+{
+	const unsigned int numBoxes = 1024 * 1024;
+	const unsigned int runs = 20;
+	const float extent = 10000.0f;
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+
+	unsigned int seed = 12345;
+	AABBBatch boxes;
+	MakeRandomBoxes(boxes, numBoxes, extent, 2000.0f, seed);
+
+	zTPlane planes[6];
+	byte signBits[6];
+	MakeRandomPlanes(planes, signBits, extent, seed);
+
+	CullFrustum frustum;
+	frustum.Init(planes, signBits, CLIP_FLAGS_NO_FAR);
+
+	D3DXVECTOR3 position(0, 0, 0);
+	float maxDistance = extent;
+
+	std::vector<unsigned int> mask;
+	std::vector<bool> reference;
+	LARGE_INTEGER start, end;
+
+	QueryPerformanceCounter(&start);
+	for(unsigned int r=0;r<runs;r++)
+		CullAABBs(boxes, frustum, position, maxDistance, mask);
+	QueryPerformanceCounter(&end);
+	double sseSeconds = (double)(end.QuadPart - start.QuadPart) / (double)frequency.QuadPart / runs;
+
+	QueryPerformanceCounter(&start);
+	for(unsigned int r=0;r<runs;r++)
+		CullAABBsScalar(boxes, planes, signBits, true, position, maxDistance, reference);
+	QueryPerformanceCounter(&end);
+	double scalarSeconds = (double)(end.QuadPart - start.QuadPart) / (double)frequency.QuadPart / runs;
+
+	LogInfo() << "BatchCulling benchmark: " << numBoxes << " boxes against 4 planes and a distance, single thread. SSE: "
+		<< numBoxes / sseSeconds / 1000000.0 << "M boxes/s, BBox3DInFrustumCached: " << numBoxes / scalarSeconds / 1000000.0 << "M boxes/s";
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include "pch.h"
+#include "zTypes.h"
+
+/** Number of boxes or points one SSE-iteration of the culling functions tests */
+const unsigned int CULL_BATCH_WIDTH = 4;
+
+/** Bounding boxes in structure-of-arrays layout, so they can be culled in batches.
+	The arrays are padded to a multiple of CULL_BATCH_WIDTH. */
+class AABBBatch
+{
+public:
+	AABBBatch(){Count = 0;}
+
+	/** Adds a box to the end of the batch */
+	void Add(const D3DXVECTOR3& min, const D3DXVECTOR3& max);
+
+	/** Removes all boxes */
+	void Clear();
+
+	/** Returns the number of boxes in this batch */
+	unsigned int Size() const {return Count;}
+
+	std::vector<float> MinX, MinY, MinZ;
+	std::vector<float> MaxX, MaxY, MaxZ;
+
+private:
+	unsigned int Count;
+};
+
+/** Points in structure-of-arrays layout, each with an own radius. Padded like AABBBatch. */
+class PointBatch
+{
+public:
+	PointBatch(){Count = 0;}
+
+	/** Adds a point to the end of the batch. The radius is only used by BatchCulling::CullPointsInRadius. */
+	void Add(const D3DXVECTOR3& p, float radius = 0.0f);
+
+	/** Removes all points */
+	void Clear();
+
+	/** Returns the number of points in this batch */
+	unsigned int Size() const {return Count;}
+
+	std::vector<float> X, Y, Z, Radius;
+
+private:
+	unsigned int Count;
+};
+
+/** Frustum-planes of a camera, prepared for the batch tests */
+struct CullFrustum
+{
+	/** Takes the planes selected by clipFlags, like zCCamera::BBox3DInFrustum does */
+	void Init(const zTPlane* planes, const byte* signBits, int clipFlags);
+
+	int NumPlanes;
+	float NormalX[6], NormalY[6], NormalZ[6];
+	float Distance[6];
+	byte SignBits[6]; // Which corner of a box to test against the plane, like gothic does
+};
+
+/** Culling of many boxes or points at once. The results are bitmasks, one bit per element, 32 elements per word. */
+namespace BatchCulling
+{
+	/** Returns whether element i is set in the given mask */
+	inline bool IsVisible(const std::vector<unsigned int>& mask, unsigned int i)
+	{
+		return (mask[i >> 5] & (1u << (i & 31))) != 0;
+	}
+
+	/** Sets the bit of every box which isn't completely outside of the frustum. Same result as zCCamera::BBox3DInFrustum != ZTCAM_CLIPTYPE_OUT. */
+	void CullAABBs(const AABBBatch& boxes, const CullFrustum& frustum, std::vector<unsigned int>& outMask);
+
+	/** Like above, but also requires the box to be closer than maxDistance to the given position, measured like Toolbox::ComputePointAABBDistance */
+	void CullAABBs(const AABBBatch& boxes, const CullFrustum& frustum, const D3DXVECTOR3& position, float maxDistance, std::vector<unsigned int>& outMask);
+
+	/** Sets the bit of every point which is closer than maxDistance to the given position */
+	void CullPoints(const PointBatch& points, const D3DXVECTOR3& position, float maxDistance, std::vector<unsigned int>& outMask);
+
+	/** Sets the bit of every point which is closer than its own radius to the given position */
+	void CullPointsInRadius(const PointBatch& points, const D3DXVECTOR3& position, std::vector<unsigned int>& outMask);
+
+	/** Compares the SSE-culling with Toolbox::BBox3DInFrustumCached and the scalar distance-tests on random boxes and points.
+		Returns false on any mismatch. */
+	bool RunSelfTest();
+
+	/** Logs how many boxes per second the SSE-culling and Toolbox::BBox3DInFrustumCached get through */
+	void RunBenchmark();
+};
@@ -179,7 +179,32 @@ struct DS_PointLightConstantBuffer
 	D3DXMATRIX PL_InvView;
 
 	float3 PL_LightScreenPos;
-	float PL_Pad3;
+	float PL_ShadowCubeIndex; // Cube of the shadow-cube array this light uses
+};
+
+struct DS_PointLightClusteredConstantBuffer
+{
+	D3DXMATRIX PLC_InvProj;
+	D3DXMATRIX PLC_InvView;
+
+	float2 PLC_ViewportSize;
+	float PLC_ClusterNear;
+	float PLC_ClusterSliceScale; // Turns log(z / near) into the slice
+
+	float2 PLC_NumTiles;
+	float PLC_NumSlices;
+	float PLC_Pad;
+};
+
+/** A pointlight as the clustered lighting pass reads it from its structured buffer */
+struct ClusteredPointLight
+{
+	float3 PositionView;
+	float Range;
+	float3 Color;
+	float ShadowCubeIndex; // -1 if the light has no shadow
+	float3 PositionWorld;
+	float Pad;
 };
 
 struct DS_ScreenQuadConstantBuffer
@@ -291,6 +316,12 @@ struct CubemapGSConstantBuffer
 	D3DXMATRIX PCR_ViewProj[6];
 };
 
+struct CubemapFaceMaskConstantBuffer
+{
+	UINT PCD_FaceMask; // Bit f is set if the drawcall can be seen in face f
+	float3 PCD_Pad;
+};
+
 struct ParticleGSInfoConstantBuffer
 {
 	float3 CameraPosition;
@@ -1247,7 +1247,7 @@ void D2DEditorView::OnDelete()
 			*Selection.SelectedMesh->Vertices[0].Position.toD3DXVECTOR3()) / 3.0f;
 
 		INT2 s = WorldConverter::GetSectionOfPos(avgPos);
-		WorldMeshSectionInfo* section = &Engine::GAPI->GetWorldSections()[s.x][s.y];
+		WorldMeshSectionInfo* section = &Engine::GAPI->GetWorldSections().GetSection(s.x, s.y);
 
 		// Remove the texture from rendering
 		Engine::GAPI->SupressTexture(section, Selection.SelectedMaterial->GetTexture()->GetNameWithoutExt());
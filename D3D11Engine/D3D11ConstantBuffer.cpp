@@ -25,6 +25,10 @@ D3D11ConstantBuffer::D3D11ConstantBuffer(int size, void* data)
 	HRESULT hr;
 	LE(engine->GetDevice()->CreateBuffer(&CD3D11_BUFFER_DESC(size, D3D11_BIND_CONSTANT_BUFFER, D3D11_USAGE_DYNAMIC, D3D11_CPU_ACCESS_WRITE), &d, &Buffer));
 
+	OriginalSize = size;
+	BufferContents = new char[size];
+	memcpy(BufferContents, dd, size);
+
 	if(!data)
 		delete[] dd;
 
@@ -35,9 +39,10 @@ D3D11ConstantBuffer::D3D11ConstantBuffer(int size, void* data)
 D3D11ConstantBuffer::~D3D11ConstantBuffer(void)
 {
 	if (Buffer)Buffer->Release();
+	delete[] BufferContents;
 }
 
-/** Updates the buffer */
+/** Updates the buffer. Does nothing if the data is the same as last time. */
 void D3D11ConstantBuffer::UpdateBuffer(void* data)
 {
 	D3D11GraphicsEngineBase* engine = (D3D11GraphicsEngineBase *)Engine::GraphicsEngine;
@@ -48,15 +53,26 @@ void D3D11ConstantBuffer::UpdateBuffer(void* data)
 		LogWarn() << "UpdateBuffer called from worker-thread! Please use UpdateBufferDeferred!";
 #endif
 
+	GothicRendererInfo& info = Engine::GAPI->GetRendererState()->RendererInfo;
+
+	// Most buffers get the same data for every pass, like the graphics-state or the sky
+	if(HasContents(data))
+	{
+		info.FrameConstantBufferUploadsSkipped++;
+		return;
+	}
+
 	D3D11_MAPPED_SUBRESOURCE res;
 	if(XR_SUCCESS == engine->GetContext()->Map(Buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &res))
 	{
 		// Copy data
-		memcpy(res.pData, data, res.DepthPitch);
+		memcpy(res.pData, data, OriginalSize);
+		memcpy(BufferContents, data, OriginalSize);
 
 		engine->GetContext()->Unmap(Buffer, 0);
 
 		BufferDirty = true;
+		info.FrameConstantBufferBytesUploaded += OriginalSize;
 	}
 
 	
@@ -6,7 +6,7 @@ public:
 	D3D11ConstantBuffer(int size, void* data);
 	~D3D11ConstantBuffer(void);
 
-	/** Updates the buffer */
+	/** Updates the buffer. Does nothing if the data is the same as last time. */
 	void UpdateBuffer(void* data);
 
 	/** Binds the buffer */
@@ -19,6 +19,12 @@ public:
 	/** Binds the constantbuffer */
 	ID3D11Buffer* Get(){ return Buffer; }
 
+	/** Returns the size of the data given to UpdateBuffer */
+	int GetSize(){ return OriginalSize; }
+
+	/** Returns true if the buffer already holds the given data, so UpdateBuffer would skip it */
+	bool HasContents(const void* data){ return memcmp(BufferContents, data, OriginalSize) == 0; }
+
 	/** Returns whether this buffer has been updated since the last bind */
 	bool IsDirty();
 
@@ -26,5 +32,8 @@ private:
 	ID3D11Buffer* Buffer;
 	int OriginalSize; // Buffersize must be a multiple of 16
 	bool BufferDirty;
+
+	/** What the GPU currently has in the buffer, so unchanged data doesn't need to be uploaded again */
+	char* BufferContents;
 };
 
@@ -38,9 +38,15 @@
 #include "zCParticleFX.h"
 #include "win32ClipboardWrapper.h"
 #include "D3D11OcclusionQuerry.h"
+#include "D3D11ReadbackRing.h"
+#include "D3D11ShadowUpdateScheduler.h"
+#include "D3D11ShadowCubePool.h"
+#include "LightClusterBinner.h"
+#include "lodepng.h"
 #include "ModSpecific.h"
 #include "D3D11Effect.h"
 #include "D3D11PointLight.h"
+#include "TextureConversion.h"
 
 //#include "MemoryTracker.h"
 
@@ -56,9 +62,6 @@ const float DEFAULT_NORMALMAP_STRENGTH = 0.10f;
 const float DEFAULT_FAR_PLANE = 50000.0f;
 const D3DXVECTOR4 UNDERWATER_COLOR_MOD = D3DXVECTOR4(0.5f, 0.7f, 1.0f, 1.0f);
 
-const float NUM_FRAME_SHADOW_UPDATES = 2; // Fraction of lights to update per frame
-const int NUM_MIN_FRAME_SHADOW_UPDATES = 4; // Minimum lights to update per frame
-const int MAX_IMPORTANT_LIGHT_UPDATES = 1;
 //#define DEBUG_D3D11
 
 #define RECORD_LAST_DRAWCALL
@@ -159,10 +162,31 @@ D3D11GraphicsEngine::D3D11GraphicsEngine(void)
 
 	PresentPending = false;
 	SaveScreenshotNextFrame = false;
+	ReadbackRing = NULL;
+	ScreenshotBuffer = NULL;
+	ThumbnailBuffer = NULL;
+	ThumbnailStagingTexture = NULL;
+	RenderingFullCube = false;
+	CubeFaceMask = 0;
+	ShadowUpdates = new D3D11ShadowUpdateScheduler;
+	ShadowCubes = NULL;
+	LightClusters = new LightClusterBinner;
+	ClusterLightBuffer = NULL;
+	ClusterRangeBuffer = NULL;
+	ClusterIndexBuffer = NULL;
+	ClusterLightCapacity = 0;
+	ClusterIndexCapacity = 0;
 
 	LineRenderer = new D3D11LineRenderer;
 	Occlusion = new D3D11OcclusionQuerry;
 
+	StateBackend = NULL;
+	StateCache = NULL;
+	RecordingBackend = NULL;
+
+	Headless = Engine::GAPI->HasCommandlineParameter("XHeadless");
+	ZeroMemory(&HeadlessReport, sizeof(HeadlessReport));
+
 
 	RECT desktopRect;
 	GetClientRect(GetDesktopWindow(), &desktopRect);
@@ -179,6 +203,18 @@ D3D11GraphicsEngine::~D3D11GraphicsEngine(void)
 
 	delete Effects; Effects = NULL;
 	delete Occlusion; Occlusion = NULL;
+	delete ReadbackRing; ReadbackRing = NULL; // Writes out the last screenshots
+	delete ShadowUpdates; ShadowUpdates = NULL;
+	delete ShadowCubes; ShadowCubes = NULL;
+	delete LightClusters; LightClusters = NULL;
+	delete ClusterLightBuffer; ClusterLightBuffer = NULL;
+	delete ClusterRangeBuffer; ClusterRangeBuffer = NULL;
+	delete ClusterIndexBuffer; ClusterIndexBuffer = NULL;
+	delete ScreenshotBuffer; ScreenshotBuffer = NULL;
+	delete ThumbnailBuffer; ThumbnailBuffer = NULL;
+	SAFE_RELEASE(ThumbnailStagingTexture);
+	delete StateCache; StateCache = NULL;
+	delete StateBackend; StateBackend = NULL;
 	delete InfiniteRangeConstantBuffer;InfiniteRangeConstantBuffer = NULL;
 	delete OutdoorSmallVobsConstantBuffer;OutdoorSmallVobsConstantBuffer = NULL;
 	delete OutdoorVobsConstantBuffer;OutdoorVobsConstantBuffer = NULL;
@@ -246,6 +282,10 @@ XRESULT D3D11GraphicsEngine::Init()
 {
 	HRESULT hr;
 
+	// Check the texture-conversion kernels of this CPU against the reference ones
+	if(Engine::GAPI->HasCommandlineParameter("XTestTextureConversion"))
+		TextureConversion::RunSelfTest();
+
 	LogInfo() << "Initializing Device...";
 
 	// Create DXGI factory
@@ -266,11 +306,19 @@ XRESULT D3D11GraphicsEngine::Init()
 	D3D_FEATURE_LEVEL featurelevel = D3D_FEATURE_LEVEL_11_0;
 
 	// Create D3D11-Device
+	if(Headless)
+	{
+		// Accepts all calls, but doesn't draw anything. Good enough to run the CPU-side of the renderer.
+		LogInfo() << "Running headless on a null-device";
+		LE(D3D11CreateDevice(NULL, D3D_DRIVER_TYPE_NULL, NULL, flags, &featurelevel, 1, D3D11_SDK_VERSION, &Device, NULL, &Context));
+	}else
+	{
 #ifndef DEBUG_D3D11
-	LE(D3D11CreateDevice(DXGIAdapter, D3D_DRIVER_TYPE_UNKNOWN, NULL, flags, &featurelevel, 1, D3D11_SDK_VERSION, &Device, NULL, &Context));
+		LE(D3D11CreateDevice(DXGIAdapter, D3D_DRIVER_TYPE_UNKNOWN, NULL, flags, &featurelevel, 1, D3D11_SDK_VERSION, &Device, NULL, &Context));
 #else
-	LE(D3D11CreateDevice(DXGIAdapter, D3D_DRIVER_TYPE_UNKNOWN, NULL, flags | D3D11_CREATE_DEVICE_DEBUG, &featurelevel, 1, D3D11_SDK_VERSION, &Device, NULL, &Context));
+		LE(D3D11CreateDevice(DXGIAdapter, D3D_DRIVER_TYPE_UNKNOWN, NULL, flags | D3D11_CREATE_DEVICE_DEBUG, &featurelevel, 1, D3D11_SDK_VERSION, &Device, NULL, &Context));
 #endif
+	}
 	
 	if(hr == DXGI_ERROR_UNSUPPORTED)
 	{
@@ -283,6 +331,20 @@ XRESULT D3D11GraphicsEngine::Init()
 	}
 	
 	LE(Device->CreateDeferredContext(0, &DeferredContext)); // Used for multithreaded texture loading
+
+	if(Headless)
+	{
+		// Still pass everything to the null-device, so the driver-calls are part of the timings
+		RecordingBackend = new RecordingRenderStateBackend(new D3D11RenderStateBackend(Context));
+		StateBackend = RecordingBackend;
+	}else
+	{
+		StateBackend = new D3D11RenderStateBackend(Context);
+	}
+
+	StateCache = new RenderStateCache(StateBackend, &Engine::GAPI->GetRendererState()->RendererInfo);
+	ReadbackRing = new D3D11ReadbackRing(Device, Context);
+	ShadowCubes = new D3D11ShadowCubePool(Device, Context);
 	
 	LogInfo() << "Creating ShaderManager";
 
@@ -498,7 +560,7 @@ XRESULT D3D11GraphicsEngine::OnResize(INT2 newSize)
 {
 	HRESULT hr;
 
-	if(memcmp(&Resolution, &newSize, sizeof(newSize)) == 0 && SwapChain)
+	if(memcmp(&Resolution, &newSize, sizeof(newSize)) == 0 && (SwapChain || (Headless && BackbufferRTV)))
 		return XR_SUCCESS; // Don't resize if we don't have to
 
 	Resolution = newSize;
@@ -518,7 +580,13 @@ XRESULT D3D11GraphicsEngine::OnResize(INT2 newSize)
 
 	if(UIView)UIView->PrepareResize();
 
-	if (!SwapChain)
+	if(Headless)
+	{
+		// There is no window to present to, but the tweakbar still needs to be there for drawing
+		if(!BackbufferRTV)
+			XLE(Engine::AntTweakBar->Init());
+	}
+	else if (!SwapChain)
 	{
 		LogInfo() << "Creating new swapchain! (Format: DXGI_FORMAT_R8G8B8A8_UNORM)";
 
@@ -578,7 +646,25 @@ XRESULT D3D11GraphicsEngine::OnResize(INT2 newSize)
 
 	// Successfully resized swapchain, re-get buffers
 	ID3D11Texture2D* backbuffer = NULL;
-	SwapChain->GetBuffer(0, __uuidof(ID3D11Texture2D), (void **)&backbuffer);
+	if(Headless)
+	{
+		// Render into a texture looking like the swapchain-buffer instead
+		D3D11_TEXTURE2D_DESC bbd;
+		ZeroMemory(&bbd, sizeof(bbd));
+		bbd.Width = bbres.x;
+		bbd.Height = bbres.y;
+		bbd.MipLevels = 1;
+		bbd.ArraySize = 1;
+		bbd.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+		bbd.SampleDesc.Count = 1;
+		bbd.Usage = D3D11_USAGE_DEFAULT;
+		bbd.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+
+		LE(Device->CreateTexture2D(&bbd, NULL, &backbuffer));
+	}else
+	{
+		SwapChain->GetBuffer(0, __uuidof(ID3D11Texture2D), (void **)&backbuffer);
+	}
 
 	// Recreate RenderTargetView
 	LE(Device->CreateRenderTargetView(backbuffer, nullptr, &BackbufferRTV));
@@ -633,6 +719,10 @@ XRESULT D3D11GraphicsEngine::OnResize(INT2 newSize)
 	delete HDRBackBuffer;
 	HDRBackBuffer = new RenderToTextureBuffer(Device, Resolution.x, Resolution.y, DXGI_FORMAT_R16G16B16A16_FLOAT);
 
+	// Gets recreated with the new size on the next screenshot
+	delete ScreenshotBuffer;
+	ScreenshotBuffer = NULL;
+
 	delete WorldShadowmap1;
 	int s = Engine::GAPI->GetRendererState()->RendererSettings.ShadowMapSize;
 	WorldShadowmap1 = new RenderToDepthStencilBuffer(Device, s, s, DXGI_FORMAT_R32_TYPELESS, NULL, DXGI_FORMAT_D32_FLOAT, DXGI_FORMAT_R32_FLOAT);
@@ -669,6 +759,9 @@ XRESULT D3D11GraphicsEngine::OnBeginFrame()
 
 	s_firstFrame = false;
 
+	// Instance-ranges of the last frame aren't needed anymore
+	Engine::GAPI->GetVobInstanceStore().BeginFrame();
+
 	// Check resolution
 	/*RECT desktopRect;
 	GetClientRect(GetDesktopWindow(), &desktopRect);
@@ -783,9 +876,43 @@ XRESULT D3D11GraphicsEngine::OnEndFrame()
 
 	Engine::GAPI->GetRendererState()->RendererInfo.Timing.StopTotal();
 
+	if(Headless)
+		UpdateHeadlessReport();
+
 	return XR_SUCCESS;
 }
 
+/** Adds the numbers of this frame to the headless-report and logs it every HEADLESS_REPORT_FRAMES frames */
+void D3D11GraphicsEngine::UpdateHeadlessReport()
+{
+	GothicRendererInfo& info = Engine::GAPI->GetRendererState()->RendererInfo;
+
+	HeadlessReport.NumFrames++;
+	HeadlessReport.FrameMS += info.Timing.TotalMS;
+	HeadlessReport.MaxFrameMS = std::max(HeadlessReport.MaxFrameMS, info.Timing.TotalMS);
+	HeadlessReport.Draws += RecordingBackend->GetNumDraws();
+	HeadlessReport.DrawnVobs += info.FrameDrawnVobs;
+	HeadlessReport.StateChanges += info.StateChanges;
+	HeadlessReport.RedundantStateChanges += info.RedundantStateChanges;
+	HeadlessReport.BytesUploaded += info.FrameConstantBufferBytesUploaded;
+
+	// Only keep one frame in memory
+	RecordingBackend->Clear();
+
+	if(HeadlessReport.NumFrames < HEADLESS_REPORT_FRAMES)
+		return;
+
+	float n = (float)HeadlessReport.NumFrames;
+	LogInfo() << "Headless: " << HeadlessReport.NumFrames << " frames, CPU avg " << HeadlessReport.FrameMS / n << "ms, max " << HeadlessReport.MaxFrameMS << "ms"
+		<< ", queue-draws " << HeadlessReport.Draws / n
+		<< ", vobs " << HeadlessReport.DrawnVobs / n
+		<< ", state-changes " << HeadlessReport.StateChanges / n
+		<< ", redundant " << HeadlessReport.RedundantStateChanges / n
+		<< ", CB-bytes " << HeadlessReport.BytesUploaded / n;
+
+	ZeroMemory(&HeadlessReport, sizeof(HeadlessReport));
+}
+
 /** Called when the game wants to clear the bound rendertarget */
 XRESULT D3D11GraphicsEngine::Clear(const float4& color)
 {
@@ -962,7 +1089,12 @@ XRESULT D3D11GraphicsEngine::Present()
 	bool vsync = Engine::GAPI->GetRendererState()->RendererSettings.EnableVSync;
 
 	Engine::GAPI->EnterResourceCriticalSection();
-	if(SwapChain->Present(vsync ? 1 : 0, 0) == DXGI_ERROR_DEVICE_REMOVED)
+	if(Headless)
+	{
+		// Nothing to show, but a real flush keeps the timings honest
+		Context->Flush();
+	}
+	else if(SwapChain->Present(vsync ? 1 : 0, 0) == DXGI_ERROR_DEVICE_REMOVED)
 	{
 		switch(Device->GetDeviceRemovedReason())
 		{
@@ -999,6 +1131,9 @@ XRESULT D3D11GraphicsEngine::Present()
 			LogWarnBox() << "Device Removed! (Unknown reason)";
 		}
 	}
+
+	// Pick up the screenshots the GPU is done with by now
+	ReadbackRing->Update();
 	Engine::GAPI->LeaveResourceCriticalSection();	
 
 	PresentPending = false;
@@ -2071,7 +2206,9 @@ XRESULT D3D11GraphicsEngine::DrawWorldMesh(bool noTextures)
 	DrawVertexBufferIndexedUINT(Engine::GAPI->GetWrappedWorldMesh()->MeshVertexBuffer, 
 				Engine::GAPI->GetWrappedWorldMesh()->MeshIndexBuffer, 0, 0);
 
-	std::list<std::pair<MeshKey, WorldMeshInfo *>> meshList;
+	std::vector<std::pair<MeshKey, WorldMeshInfo *>> meshList;
+	std::vector<float> meshDepths; // Distance of the section of each mesh to the camera
+	D3DXVECTOR3 camPos = Engine::GAPI->GetCameraPosition();
 
 	Context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 	Context->DSSetShader(NULL, NULL, NULL);
@@ -2082,6 +2219,9 @@ XRESULT D3D11GraphicsEngine::DrawWorldMesh(bool noTextures)
 	{
 		for(std::list<WorldMeshSectionInfo*>::iterator it = renderList.begin(); it != renderList.end(); it++)
 		{
+			D3DXVECTOR3 sectionCenter = ((*it)->BoundingBox.Min + (*it)->BoundingBox.Max) * 0.5f;
+			float sectionDepth = D3DXVec3Length(&(sectionCenter - camPos));
+
 			for(std::map<MeshKey, WorldMeshInfo*>::iterator itm = (*it)->WorldMeshes.begin(); itm != (*it)->WorldMeshes.end();itm++)
 			{
 				if((*itm).first.Material)
@@ -2127,6 +2267,7 @@ XRESULT D3D11GraphicsEngine::DrawWorldMesh(bool noTextures)
 						{
 							// Create a new pair using the animated texture
 							meshList.push_back(std::make_pair(key, (*itm).second));
+							meshDepths.push_back(sectionDepth);
 						}
 						
 					}else
@@ -2139,6 +2280,7 @@ XRESULT D3D11GraphicsEngine::DrawWorldMesh(bool noTextures)
 						{
 							// Push this texture/mesh combination
 							meshList.push_back((*itm));
+							meshDepths.push_back(sectionDepth);
 						}				
 					}			
 				}
@@ -2151,26 +2293,16 @@ XRESULT D3D11GraphicsEngine::DrawWorldMesh(bool noTextures)
 		// If we get here, there are many unloaded textures.
 		// Clear the list and try again, with forcing the textures to load
 		meshList.clear();
+		meshDepths.clear();
 	}
 
-	struct cmpstruct
-	{
-		static bool cmp(const std::pair<MeshKey, MeshInfo *>& a, const std::pair<MeshKey, MeshInfo *>& b)
-		{
-			return a.first.Texture < b.first.Texture;
-		}
-	};
-
-	// Sort by texture
-	meshList.sort(cmpstruct::cmp);
-
 	// Draw depth only
 	if(Engine::GAPI->GetRendererState()->RendererSettings.DoZPrepass)
 	{
 		INT2 camSection = WorldConverter::GetSectionOfPos(Engine::GAPI->GetCameraPosition());
 		Context->PSSetShader(NULL, NULL, NULL);
 
-		for(std::list<std::pair<MeshKey, WorldMeshInfo *>>::iterator it = meshList.begin(); it != meshList.end(); it++)
+		for(std::vector<std::pair<MeshKey, WorldMeshInfo *>>::iterator it = meshList.begin(); it != meshList.end(); it++)
 		{
 			if(!(*it).first.Material->GetAniTexture())
 				continue;
@@ -2196,189 +2328,47 @@ XRESULT D3D11GraphicsEngine::DrawWorldMesh(bool noTextures)
 	bool tesselationEnabled = Engine::GAPI->GetRendererState()->RendererSettings.EnableTesselation
 		&& Engine::GAPI->GetRendererState()->RendererSettings.AllowWorldMeshTesselation;
 
-	// Now draw the actual pixels
-	zCTexture* bound = NULL;
-	MaterialInfo* boundInfo = NULL;
-	ID3D11ShaderResourceView* boundNormalmap = NULL;
-	for(std::list<std::pair<MeshKey, WorldMeshInfo *>>::iterator it = meshList.begin(); it != meshList.end(); it++)
+	// Now queue the actual pixels. Sorting by shader and texture lets the state-cache drop most of the binds.
+	if(Engine::GAPI->GetRendererState()->RendererSettings.DrawWorldMesh > 2)
 	{
-		int indicesNumMod = 1;
-		if((*it).first.Texture != bound && Engine::GAPI->GetRendererState()->RendererSettings.DrawWorldMesh > 1)
+		for(unsigned int i=0;i<meshList.size();i++)
 		{
-			MyDirectDrawSurface7* surface = (*it).first.Texture->GetSurface();
-			ID3D11ShaderResourceView* srv[3];
-			MaterialInfo* info = (*it).first.Info;
-			
-			// Get diffuse and normalmap
-			srv[0] = ((D3D11Texture *)surface->GetEngineTexture())->GetShaderResourceView();
-			srv[1] = surface->GetNormalmap() ? ((D3D11Texture *)surface->GetNormalmap())->GetShaderResourceView() : NULL;
-			srv[2] = surface->GetFxMap() ? ((D3D11Texture *)surface->GetFxMap())->GetShaderResourceView() : NULL;
-
-			// Bind a default normalmap in case the scene is wet and we currently have none
-			if(/*Engine::GAPI->GetSceneWetness() > 0.0f && */!srv[1])
-			{
-				// Modify the strength of that default normalmap for the material info
-				if(info->buffer.NormalmapStrength/* * Engine::GAPI->GetSceneWetness()*/ != DEFAULT_NORMALMAP_STRENGTH)
-				{
-					info->buffer.NormalmapStrength = DEFAULT_NORMALMAP_STRENGTH;
-					info->UpdateConstantbuffer();
-				}
-				srv[1] = ((D3D11Texture*)DistortionTexture)->GetShaderResourceView();
-			}
-
-			boundNormalmap = srv[1];
-
-			// Bind both
-			Context->PSSetShaderResources(0,3, srv);
-
-			// Get the right shader for it
-
-			BindShaderForTexture((*it).first.Material->GetAniTexture(), false, (*it).first.Material->GetAlphaFunc());
-			
-			// No backfaceculling for alphatested materials, fixes forests looking stupid in G1
-			/*if((*it).first.Material->GetAlphaFunc() == zMAT_ALPHA_FUNC_TEST || (*it).first.Texture->HasAlphaChannel())
-			{
-				Engine::GAPI->GetRendererState()->RasterizerState.CullMode = GothicRasterizerStateInfo::CM_CULL_NONE;
-				Engine::GAPI->GetRendererState()->RasterizerState.SetDirty();
-
-				Engine::GAPI->GetRendererState()->DepthState.DepthBufferCompareFunc = GothicDepthBufferStateInfo::CF_COMPARISON_LESS_EQUAL;
-				Engine::GAPI->GetRendererState()->DepthState.SetDirty();
-
-				UpdateRenderStates();
-			}else
-			{
-				Engine::GAPI->GetRendererState()->RasterizerState.CullMode = GothicRasterizerStateInfo::CM_CULL_BACK;
-				Engine::GAPI->GetRendererState()->RasterizerState.SetDirty();
-
-				Engine::GAPI->GetRendererState()->DepthState.DepthBufferCompareFunc = GothicDepthBufferStateInfo::DEFAULT_DEPTH_COMP_STATE;
-				Engine::GAPI->GetRendererState()->DepthState.SetDirty();
-
-				UpdateRenderStates();
-			}*/
-
-			// Check for alphablending on world mesh
-			if(((*it).first.Material->GetAlphaFunc() == zMAT_ALPHA_FUNC_BLEND || (*it).first.Material->GetAlphaFunc() == zMAT_ALPHA_FUNC_ADD) && !Engine::GAPI->GetRendererState()->BlendState.BlendEnabled)
-			{
-				if((*it).first.Material->GetAlphaFunc() == zMAT_ALPHA_FUNC_BLEND)
-					Engine::GAPI->GetRendererState()->BlendState.SetAlphaBlending();
-
-				if((*it).first.Material->GetAlphaFunc() == zMAT_ALPHA_FUNC_ADD)
-					Engine::GAPI->GetRendererState()->BlendState.SetAdditiveBlending();
-
-				Engine::GAPI->GetRendererState()->BlendState.SetDirty();
-
-				Engine::GAPI->GetRendererState()->DepthState.DepthWriteEnabled = false;
-				Engine::GAPI->GetRendererState()->DepthState.SetDirty();
-
-				UpdateRenderStates();
-			}else if(Engine::GAPI->GetRendererState()->BlendState.BlendEnabled && (*it).first.Material->GetAlphaFunc() != zMAT_ALPHA_FUNC_BLEND)
-			{
-				Engine::GAPI->GetRendererState()->BlendState.SetDefault();
-				Engine::GAPI->GetRendererState()->BlendState.SetDirty();
-
-				Engine::GAPI->GetRendererState()->DepthState.DepthWriteEnabled = true;
-				Engine::GAPI->GetRendererState()->DepthState.SetDirty();
+			const MeshKey& key = meshList[i].first;
+			WorldMeshInfo* mesh = meshList[i].second;
+			zCTexture* texture = key.Material->GetAniTexture();
+			MaterialInfo* info = key.Info;
 
-				UpdateRenderStates();
-			}
+			// Blending materials went to the transparency-list, so the default blendstate works for everything here
+			RenderQueuePacket packet;
+			packet.PixelShader = GetShaderForTexture(texture, false, key.Material->GetAlphaFunc());
+			GetMaterialTextureViews(key.Texture->GetSurface(), info, packet.Textures);
 
-			
 			if(!info->Constantbuffer)
 				info->UpdateConstantbuffer();
-			
-			info->Constantbuffer->BindToPixelShader(2);
 
-			// Don't let the game unload the texture after some timep
-			(*it).first.Material->GetAniTexture()->CacheIn(0.6f);
-
-			boundInfo = info;
-			bound = (*it).first.Material->GetAniTexture();
+			packet.MaterialBuffer = info->Constantbuffer;
+			packet.VertexBuffer = mesh->MeshVertexBuffer;
+			packet.IndexBuffer = mesh->MeshIndexBuffer;
+			packet.NumIndices = mesh->Indices.size();
 
-			// Bind normalmap to HDS
-			if(!(*it).second->IndicesPNAEN.empty())
+			// Only allow tesselation for materials without alphablending
+			unsigned int pass = RQP_OPAQUE;
+			if(tesselationEnabled && info->TextureTesselationSettings.buffer.VT_TesselationFactor > 0.0f
+				&& !mesh->IndicesPNAEN.empty()
+				&& key.Material->GetAlphaFunc() <= zMAT_ALPHA_FUNC_FUNC_NONE && !texture->HasAlphaChannel())
 			{
-				Context->DSSetShaderResources(0,1, &boundNormalmap);
-				Context->HSSetShaderResources(0,1, &boundNormalmap);
+				pass = RQP_TESSELATED;
+				packet.TesselationBuffer = info->TextureTesselationSettings.Constantbuffer;
+				packet.IndexBuffer = mesh->MeshIndexBufferPNAEN;
+				packet.NumIndices = mesh->IndicesPNAEN.size();
 			}
 
-			/*if((*it).second->TesselationSettings.buffer.VT_TesselationFactor > 0.0f)
-			{
-				// Set normal/displacement map
-				Context->DSSetShaderResources(0,1, &srv[1]);
-				Context->HSSetShaderResources(0,1, &srv[1]);
-				Setup_PNAEN(PNAEN_Default);
-
-				(*it).second->TesselationSettings.Constantbuffer->BindToDomainShader(1);
-				(*it).second->TesselationSettings.Constantbuffer->BindToHullShader(1);
-			}else if(ActiveHDS)
-			{
-				Context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-				Context->DSSetShader(NULL, NULL, NULL);
-				Context->HSSetShader(NULL, NULL, NULL);
-				ActiveHDS = NULL;
-				SetActiveVertexShader("VS_Ex");
-				ActiveVS->Apply();
-			}*/
-		}
-
-		// Check for tesselated mesh
-		//if(tesselationEnabled && !ActiveHDS && (*it).second->TesselationSettings.buffer.VT_TesselationFactor > 0.0f)
-		if(tesselationEnabled && !ActiveHDS && boundInfo->TextureTesselationSettings.buffer.VT_TesselationFactor > 0.0f)
-		{
-			// Set normal/displacement map
-			Context->DSSetShaderResources(0,1, &boundNormalmap);
-			Context->HSSetShaderResources(0,1, &boundNormalmap);
-			Setup_PNAEN(PNAEN_Default);			
-		}
-
-		// Bind infos for this mesh
-		if(boundInfo && boundInfo->TextureTesselationSettings.buffer.VT_TesselationFactor > 0.0f 
-			&& !(*it).second->IndicesPNAEN.empty() 
-			&& (*it).first.Material->GetAlphaFunc() <= zMAT_ALPHA_FUNC_FUNC_NONE && !bound->HasAlphaChannel()) // Only allow tesselation for materials without alphablending
-		{
-			//(*it).second->TesselationSettings.Constantbuffer->BindToDomainShader(1);
-			//(*it).second->TesselationSettings.Constantbuffer->BindToHullShader(1);
-
-			boundInfo->TextureTesselationSettings.Constantbuffer->BindToDomainShader(1);
-			boundInfo->TextureTesselationSettings.Constantbuffer->BindToHullShader(1);
-		}else if(ActiveHDS) // Unbind tesselation-shaders if the mesh doesn't support it
-		{
-			Context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-			Context->DSSetShader(NULL, NULL, NULL);
-			Context->HSSetShader(NULL, NULL, NULL);
-			ActiveHDS = NULL;
-			SetActiveVertexShader("VS_Ex");
-			ActiveVS->Apply();
-
-			// Bind wrapped mesh again
-			DrawVertexBufferIndexedUINT(Engine::GAPI->GetWrappedWorldMesh()->MeshVertexBuffer, 
-				Engine::GAPI->GetWrappedWorldMesh()->MeshIndexBuffer, 0, 0);
-		}
-
-		if(Engine::GAPI->GetRendererState()->RendererSettings.DrawWorldMesh > 2)
-		{
-			if(!ActiveHDS)
-			{
-				// Draw the section-part
-				/*static bool test = false;
-
-				if(!test)
-				{
-					DrawVertexBufferIndexedUINT(NULL, NULL,
-						(*it).second->Indices.size(),
-						(*it).second->BaseIndexLocation);
-				}else*/ // TODO: FIXME!!
-				{
-					DrawVertexBufferIndexed((*it).second->MeshVertexBuffer, (*it).second->MeshIndexBuffer, (*it).second->Indices.size());
-				}
-			}
-			else
-			{
-				// Draw from mesh info
-				DrawVertexBufferIndexed((*it).second->MeshVertexBuffer, (*it).second->MeshIndexBufferPNAEN, (*it).second->IndicesPNAEN.size());
-			}
+			FrameRenderQueue.Add(RenderQueueKey::Make(pass, packet.PixelShader->GetID(), 
+				FrameRenderQueue.GetTextureID(key.Texture), 
+				FrameRenderQueue.GetMaterialID(info), meshDepths[i]), packet);
 		}
 
+		SubmitRenderQueue(FrameRenderQueue, PNAEN_Default);
 	}
 
 	SetDefaultStates();
@@ -2804,6 +2794,16 @@ void D3D11GraphicsEngine::DrawWaterSurfaces()
 }
 
 
+/** Returns the faces of a shadow-cube at the given position a skeletal vob can be seen in */
+static UINT GetSkeletalCasterFaceMask(const D3DXVECTOR3& position, float range, SkeletalVobInfo* vi)
+{
+	// Animated bounding boxes are relative to the vob, so a sphere around its origin covers them
+	zTBBox3D bb = vi->Vob->GetBBoxLocal();
+	float radius = std::max(D3DXVec3Length(&bb.Min), D3DXVec3Length(&bb.Max));
+
+	return Toolbox::ComputeCubeFaceMask(vi->Vob->GetPositionWorld() - position, radius, range);
+}
+
 /** Draws everything around the given position */
 void D3D11GraphicsEngine::DrawWorldAround(const D3DXVECTOR3& position, 
 										  float range, 
@@ -2812,7 +2812,9 @@ void D3D11GraphicsEngine::DrawWorldAround(const D3DXVECTOR3& position,
 										  bool noNPCs,
 										  std::list<VobInfo*>* renderedVobs, 
 										  std::list<SkeletalVobInfo*>* renderedMobs,
-										  std::map<MeshKey, WorldMeshInfo*, cmpMeshKey>* worldMeshCache)
+										  std::map<MeshKey, WorldMeshInfo*, cmpMeshKey>* worldMeshCache,
+										  bool onlyDynamic,
+										  float cacheRange)
 {
 	// Setup renderstates
 	Engine::GAPI->GetRendererState()->RasterizerState.SetDefault();
@@ -2871,22 +2873,32 @@ void D3D11GraphicsEngine::DrawWorldAround(const D3DXVECTOR3& position,
 	bool colorWritesEnabled = Engine::GAPI->GetRendererState()->BlendState.ColorWritesEnabled;
 	float alphaRef = Engine::GAPI->GetRendererState()->GraphicsState.FF_AlphaRef;
 
-	std::vector<WorldMeshSectionInfo*> drawnSections;
+	// Casters can be collected further out than they are drawn, so they stay valid while the light moves a bit
+	float collectRange = std::max(range, cacheRange);
 
-	if(Engine::GAPI->GetRendererState()->RendererSettings.DrawWorldMesh)
+	// Sections close enough to have casters in them
+	std::vector<WorldMeshSectionInfo*> drawnSections;
+	if(!onlyDynamic)
 	{
-		// Bind wrapped mesh vertex buffers
-		DrawVertexBufferIndexedUINT(Engine::GAPI->GetWrappedWorldMesh()->MeshVertexBuffer, Engine::GAPI->GetWrappedWorldMesh()->MeshIndexBuffer, 0, 0);
+		std::vector<WorldMeshSectionInfo*> sectionsInRange;
+		Engine::GAPI->GetWorldSections().GetSectionsInRange(s, 2, sectionsInRange);
+
+		for(std::vector<WorldMeshSectionInfo*>::const_iterator its = sectionsInRange.begin(); its != sectionsInRange.end(); its++)
+		{
+			D3DXVECTOR2 a = D3DXVECTOR2((float)((*its)->WorldCoordinates.x - s.x), (float)((*its)->WorldCoordinates.y - s.y));
+			if(D3DXVec2Length(&a) < 2)
+				drawnSections.push_back(*its);
+		}
+	}
 
+	if(Engine::GAPI->GetRendererState()->RendererSettings.DrawWorldMesh && !onlyDynamic)
+	{
 		D3DXMATRIX id;
 		D3DXMatrixIdentity(&id);
 		ActiveVS->GetConstantBuffer()[1]->UpdateBuffer(&id);
 		ActiveVS->GetConstantBuffer()[1]->BindToVertexShader(1);
 
-		// Only use cache if we haven't already collected the vobs
-		// TODO: Collect vobs in a different way than using the drawn sections!
-		//		 The current solution won't use the cache at all when there are no vobs near!
-		if(worldMeshCache && renderedVobs && !renderedVobs->empty())
+		if(worldMeshCache && !worldMeshCache->empty())
 		{
 			for(std::map<MeshKey, WorldMeshInfo*>::iterator it = worldMeshCache->begin(); it != worldMeshCache->end();it++)
 			{
@@ -2917,64 +2929,74 @@ void D3D11GraphicsEngine::DrawWorldAround(const D3DXVECTOR3& position,
 					}
 				}
 
-				// Draw from wrapped mesh
-				DrawVertexBufferIndexedUINT(Engine::GAPI->GetWrappedWorldMesh()->MeshVertexBuffer, Engine::GAPI->GetWrappedWorldMesh()->MeshIndexBuffer, (*it).second->Indices.size(), (*it).second->BaseIndexLocation);
+				// The cached meshes have buffers of their own. Draw them face-range by face-range.
+				WorldMeshInfo* mesh = (*it).second;
+				DrawVertexBufferIndexed(mesh->MeshVertexBuffer, mesh->MeshIndexBuffer, 0);
+
+				for(unsigned int i=0;i<mesh->CubeFaceRanges.size();i++)
+				{
+					const CubeFaceIndexRange& r = mesh->CubeFaceRanges[i];
+
+					// The light may have moved since the cache was built, so check the faces again
+					UINT faceMask = Toolbox::ComputeCubeFaceMask(r.Center - position, r.Radius, range);
+					if(!faceMask)
+						continue;
+
+					SetCubeFaceMask(faceMask);
+					DrawVertexBufferIndexed(NULL, NULL, r.NumIndices, r.IndexOffset);
+				}
 			}
 
+			SetCubeFaceMask(Toolbox::CUBEFACE_MASK_ALL);
 		}else
 		{
-			for(std::map<int, std::map<int, WorldMeshSectionInfo>>::iterator itx = Engine::GAPI->GetWorldSections().begin(); itx != Engine::GAPI->GetWorldSections().end(); itx++)
+			// Bind wrapped mesh vertex buffers
+			DrawVertexBufferIndexedUINT(Engine::GAPI->GetWrappedWorldMesh()->MeshVertexBuffer, Engine::GAPI->GetWrappedWorldMesh()->MeshIndexBuffer, 0, 0);
+
+			for(std::vector<WorldMeshSectionInfo*>::const_iterator its = drawnSections.begin(); its != drawnSections.end(); its++)
 			{
-				for(std::map<int, WorldMeshSectionInfo>::iterator ity = (*itx).second.begin(); ity != (*itx).second.end(); ity++)
+				WorldMeshSectionInfo& section = **its;
+
+				if(Engine::GAPI->GetRendererState()->RendererSettings.FastShadows)
 				{
-					D3DXVECTOR2 a = D3DXVECTOR2((float)((*itx).first - s.x), (float)((*ity).first - s.y));
-					if(D3DXVec2Length(&a) < 2)
+					// Draw world mesh
+					if(section.FullStaticMesh)
+						Engine::GAPI->DrawMeshInfo(NULL, section.FullStaticMesh);
+				}else
+				{
+					for(std::map<MeshKey, WorldMeshInfo*>::iterator it = section.WorldMeshes.begin(); it != section.WorldMeshes.end();it++)
 					{
-						WorldMeshSectionInfo& section = (*ity).second;
-						drawnSections.push_back(&section);
-
-						if(Engine::GAPI->GetRendererState()->RendererSettings.FastShadows)
+						// Check surface type
+						if((*it).first.Info->MaterialType == MaterialInfo::MT_Water)
 						{
-							// Draw world mesh
-							if(section.FullStaticMesh)
-								Engine::GAPI->DrawMeshInfo(NULL, section.FullStaticMesh);
-						}else
+							continue;
+						}
+
+						// Bind texture			
+						if((*it).first.Material && (*it).first.Material->GetTexture())
 						{
-							for(std::map<MeshKey, WorldMeshInfo*>::iterator it = section.WorldMeshes.begin(); it != section.WorldMeshes.end();it++)
+							if((*it).first.Material->GetTexture()->HasAlphaChannel() || colorWritesEnabled)
 							{
-								// Check surface type
-								if((*it).first.Info->MaterialType == MaterialInfo::MT_Water)
+								if(alphaRef > 0.0f && (*it).first.Material->GetTexture()->CacheIn(0.6f) == zRES_CACHED_IN)
 								{
-									continue;
-								}
-
-								// Bind texture			
-								if((*it).first.Material && (*it).first.Material->GetTexture())
+									(*it).first.Material->GetTexture()->Bind(0);
+									ActivePS->Apply();
+								}else
+									continue; // Don't render if not loaded
+							}else
+							{
+								if(!linearDepth) // Only unbind when not rendering linear depth
 								{
-									if((*it).first.Material->GetTexture()->HasAlphaChannel() || colorWritesEnabled)
-									{
-										if(alphaRef > 0.0f && (*it).first.Material->GetTexture()->CacheIn(0.6f) == zRES_CACHED_IN)
-										{
-											(*it).first.Material->GetTexture()->Bind(0);
-											ActivePS->Apply();
-										}else
-											continue; // Don't render if not loaded
-									}else
-									{
-										if(!linearDepth) // Only unbind when not rendering linear depth
-										{
-											// Unbind PS
-											Context->PSSetShader(NULL, NULL, NULL);
-										}
-									}
+									// Unbind PS
+									Context->PSSetShader(NULL, NULL, NULL);
 								}
-
-								// Draw from wrapped mesh
-								DrawVertexBufferIndexedUINT(Engine::GAPI->GetWrappedWorldMesh()->MeshVertexBuffer, Engine::GAPI->GetWrappedWorldMesh()->MeshIndexBuffer, (*it).second->Indices.size(), (*it).second->BaseIndexLocation);
-
-								//Engine::GAPI->DrawMeshInfo((*it).first.Material, (*it).second);
 							}
 						}
+
+						// Draw from wrapped mesh
+						DrawVertexBufferIndexedUINT(Engine::GAPI->GetWrappedWorldMesh()->MeshVertexBuffer, Engine::GAPI->GetWrappedWorldMesh()->MeshIndexBuffer, (*it).second->Indices.size(), (*it).second->BaseIndexLocation);
+
+						//Engine::GAPI->DrawMeshInfo((*it).first.Material, (*it).second);
 					}
 				}
 			}
@@ -2982,7 +3004,7 @@ void D3D11GraphicsEngine::DrawWorldAround(const D3DXVECTOR3& position,
 	}
 
 
-	if(Engine::GAPI->GetRendererState()->RendererSettings.DrawVOBs)
+	if(Engine::GAPI->GetRendererState()->RendererSettings.DrawVOBs && !onlyDynamic)
 	{
 		// Draw visible vobs here
 		std::list<VobInfo*> rndVob;
@@ -3002,7 +3024,7 @@ void D3D11GraphicsEngine::DrawWorldAround(const D3DXVECTOR3& position,
 
 					// Check vob range
 					float dist = D3DXVec3Length(&(position - (*it)->LastRenderPosition));
-					if(dist > range)
+					if(dist > collectRange)
 						continue;
 
 					// Check for inside vob. Don't render inside-vobs when the light is outside and vice-versa.
@@ -3021,7 +3043,13 @@ void D3D11GraphicsEngine::DrawWorldAround(const D3DXVECTOR3& position,
 		std::list<VobInfo*>& rl = renderedVobs != NULL ? *renderedVobs : rndVob;
 		for(std::list<VobInfo*>::iterator it = rl.begin(); it != rl.end(); it++)
 		{
-			
+			// Only draw into the faces the vob can be seen in. The sphere around its origin covers the mesh however it is rotated.
+			float radius = D3DXVec3Length(&(*it)->VisualInfo->MidPoint) + (*it)->VisualInfo->MeshSize * 0.5f;
+			UINT faceMask = Toolbox::ComputeCubeFaceMask((*it)->LastRenderPosition - position, radius, range);
+			if(!faceMask)
+				continue;
+
+			SetCubeFaceMask(faceMask);
 
 			// Bind per-instance buffer
 			((D3D11ConstantBuffer *)(*it)->VobConstantBuffer)->BindToVertexShader(1);
@@ -3063,7 +3091,7 @@ void D3D11GraphicsEngine::DrawWorldAround(const D3DXVECTOR3& position,
 	Engine::GAPI->GetRendererState()->RasterizerState.FrontCounterClockwise = true;
 	Engine::GAPI->GetRendererState()->RasterizerState.SetDirty();
 
-	if(Engine::GAPI->GetRendererState()->RendererSettings.DrawMobs)
+	if(Engine::GAPI->GetRendererState()->RendererSettings.DrawMobs && !onlyDynamic)
 	{
 		// Draw visible vobs here
 		std::list<SkeletalVobInfo*> rndVob;
@@ -3078,7 +3106,7 @@ void D3D11GraphicsEngine::DrawWorldAround(const D3DXVECTOR3& position,
 
 				// Check vob range
 				float dist = D3DXVec3Length(&(position - (*it)->Vob->GetPositionWorld()));
-				if(dist > range)
+				if(dist > collectRange)
 					continue;
 
 				// Check for inside vob. Don't render inside-vobs when the light is outside and vice-versa.
@@ -3101,6 +3129,11 @@ void D3D11GraphicsEngine::DrawWorldAround(const D3DXVECTOR3& position,
 		std::list<SkeletalVobInfo*>& rl = renderedMobs != NULL ? *renderedMobs : rndVob;
 		for(std::list<SkeletalVobInfo*>::iterator it = rl.begin(); it != rl.end(); it++)
 		{
+			UINT faceMask = GetSkeletalCasterFaceMask(position, range, (*it));
+			if(!faceMask)
+				continue;
+
+			SetCubeFaceMask(faceMask);
 			Engine::GAPI->DrawSkeletalMeshVob((*it), FLT_MAX);
 		}
 
@@ -3124,10 +3157,17 @@ void D3D11GraphicsEngine::DrawWorldAround(const D3DXVECTOR3& position,
 				if(!(*it)->Vob->IsIndoorVob() && indoor || (*it)->Vob->IsIndoorVob() && !indoor)
 					continue;
 
+				UINT faceMask = GetSkeletalCasterFaceMask(position, range, (*it));
+				if(!faceMask)
+					continue;
+
+				SetCubeFaceMask(faceMask);
 				Engine::GAPI->DrawSkeletalMeshVob((*it), FLT_MAX);
 			}
 		}
 	}
+
+	SetCubeFaceMask(Toolbox::CUBEFACE_MASK_ALL);
 }
 
 /** Draws everything around the given position */
@@ -3216,102 +3256,102 @@ void D3D11GraphicsEngine::DrawWorldAround(const D3DXVECTOR3& position, int secti
 		ActiveVS->GetConstantBuffer()[1]->UpdateBuffer(&id);
 		ActiveVS->GetConstantBuffer()[1]->BindToVertexShader(1);
 
-		for(std::map<int, std::map<int, WorldMeshSectionInfo>>::iterator itx = Engine::GAPI->GetWorldSections().begin(); itx != Engine::GAPI->GetWorldSections().end(); itx++)
+		std::vector<WorldMeshSectionInfo*> sectionsInRange;
+		Engine::GAPI->GetWorldSections().GetSectionsInRange(s, sectionRange, sectionsInRange);
+
+		for(std::vector<WorldMeshSectionInfo*>::const_iterator its = sectionsInRange.begin(); its != sectionsInRange.end(); its++)
 		{
-			for(std::map<int, WorldMeshSectionInfo>::iterator ity = (*itx).second.begin(); ity != (*itx).second.end(); ity++)
+			D3DXVECTOR2 a = D3DXVECTOR2((float)((*its)->WorldCoordinates.x - s.x), (float)((*its)->WorldCoordinates.y - s.y));
+			if(D3DXVec2Length(&a) < sectionRange)
 			{
-				D3DXVECTOR2 a = D3DXVECTOR2((float)((*itx).first - s.x), (float)((*ity).first - s.y));
-				if(D3DXVec2Length(&a) < sectionRange)
-				{
-					WorldMeshSectionInfo& section = (*ity).second;
+				WorldMeshSectionInfo& section = **its;
 
-					if(Engine::GAPI->GetRendererState()->RendererSettings.FastShadows)
-					{
-						// Draw world mesh
-						if(section.FullStaticMesh)
-							Engine::GAPI->DrawMeshInfo(NULL, section.FullStaticMesh);
-					}else
+				if(Engine::GAPI->GetRendererState()->RendererSettings.FastShadows)
+				{
+					// Draw world mesh
+					if(section.FullStaticMesh)
+						Engine::GAPI->DrawMeshInfo(NULL, section.FullStaticMesh);
+				}else
+				{
+					for(std::map<MeshKey, WorldMeshInfo*>::iterator it = section.WorldMeshes.begin(); it != section.WorldMeshes.end();it++)
 					{
-						for(std::map<MeshKey, WorldMeshInfo*>::iterator it = section.WorldMeshes.begin(); it != section.WorldMeshes.end();it++)
+						// Check surface type
+						if((*it).first.Info->MaterialType == MaterialInfo::MT_Water)
 						{
-							// Check surface type
-							if((*it).first.Info->MaterialType == MaterialInfo::MT_Water)
-							{
-								continue;
-							}
+							continue;
+						}
 
-							// Bind texture			
-							if((*it).first.Material && (*it).first.Material->GetTexture())
+						// Bind texture			
+						if((*it).first.Material && (*it).first.Material->GetTexture())
+						{
+							if((*it).first.Material->GetTexture()->HasAlphaChannel() || colorWritesEnabled)
 							{
-								if((*it).first.Material->GetTexture()->HasAlphaChannel() || colorWritesEnabled)
+								if(alphaRef > 0.0f && (*it).first.Material->GetTexture()->CacheIn(0.6f) == zRES_CACHED_IN)
 								{
-									if(alphaRef > 0.0f && (*it).first.Material->GetTexture()->CacheIn(0.6f) == zRES_CACHED_IN)
-									{
-										(*it).first.Material->GetTexture()->Bind(0);
-										ActivePS->Apply();
-									}else
-										continue; // Don't render if not loaded
+									(*it).first.Material->GetTexture()->Bind(0);
+									ActivePS->Apply();
 								}else
+									continue; // Don't render if not loaded
+							}else
+							{
+								if(!linearDepth) // Only unbind when not rendering linear depth
 								{
-									if(!linearDepth) // Only unbind when not rendering linear depth
-									{
-										// Unbind PS
-										Context->PSSetShader(NULL, NULL, NULL);
-									}
+									// Unbind PS
+									Context->PSSetShader(NULL, NULL, NULL);
 								}
 							}
-
-							// Draw from wrapped mesh
-							DrawVertexBufferIndexedUINT(Engine::GAPI->GetWrappedWorldMesh()->MeshVertexBuffer, Engine::GAPI->GetWrappedWorldMesh()->MeshIndexBuffer, (*it).second->Indices.size(), (*it).second->BaseIndexLocation);
-						
-							//Engine::GAPI->DrawMeshInfo((*it).first.Material, (*it).second);
 						}
 
-						// Draw all vobs here
-						/*for(std::list<VobInfo*>::iterator it = section.Vobs.begin(); it != section.Vobs.end(); it++)
-						{
-							D3DXVECTOR2 xz = D3DXVECTOR2((*it)->LastRenderPosition.x, (*it)->LastRenderPosition.z);
+						// Draw from wrapped mesh
+						DrawVertexBufferIndexedUINT(Engine::GAPI->GetWrappedWorldMesh()->MeshVertexBuffer, Engine::GAPI->GetWrappedWorldMesh()->MeshIndexBuffer, (*it).second->Indices.size(), (*it).second->BaseIndexLocation);
+					
+						//Engine::GAPI->DrawMeshInfo((*it).first.Material, (*it).second);
+					}
 
-							if(!(*it)->VisualInfo)
-								continue; // Seems to happen in Gothic 1
+					// Draw all vobs here
+					/*for(std::list<VobInfo*>::iterator it = section.Vobs.begin(); it != section.Vobs.end(); it++)
+					{
+						D3DXVECTOR2 xz = D3DXVECTOR2((*it)->LastRenderPosition.x, (*it)->LastRenderPosition.z);
 
-							// Check vob range
-							float range = D3DXVec2Length(&(camXZ - xz));
-							if(range > vobOutdoorDist || ((*it)->VisualInfo->MeshSize < vobSmallSize && range > vobOutdoorSmallDist))
-								continue;
+						if(!(*it)->VisualInfo)
+							continue; // Seems to happen in Gothic 1
 
-							// Check for inside vob
-							if((*it)->IsIndoorVob)
-								continue;
+						// Check vob range
+						float range = D3DXVec2Length(&(camXZ - xz));
+						if(range > vobOutdoorDist || ((*it)->VisualInfo->MeshSize < vobSmallSize && range > vobOutdoorSmallDist))
+							continue;
+
+						// Check for inside vob
+						if((*it)->IsIndoorVob)
+							continue;
 
-							// Bind per-instance buffer
-							((D3D11ConstantBuffer *)(*it)->VobConstantBuffer)->BindToVertexShader(1);
+						// Bind per-instance buffer
+						((D3D11ConstantBuffer *)(*it)->VobConstantBuffer)->BindToVertexShader(1);
 
-							// Draw the vob
-							for(std::map<zCMaterial *, std::vector<MeshInfo*>>::iterator itm = (*it)->VisualInfo->Meshes.begin(); itm != (*it)->VisualInfo->Meshes.end();itm++)
+						// Draw the vob
+						for(std::map<zCMaterial *, std::vector<MeshInfo*>>::iterator itm = (*it)->VisualInfo->Meshes.begin(); itm != (*it)->VisualInfo->Meshes.end();itm++)
+						{
+							if((*itm).first && (*itm).first->GetTexture())
 							{
-								if((*itm).first && (*itm).first->GetTexture())
+								if((*itm).first->GetAlphaFunc() != zMAT_ALPHA_FUNC_FUNC_NONE || 
+									(*itm).first->GetAlphaFunc() != zMAT_ALPHA_FUNC_FUNC_MAT_DEFAULT)
 								{
-									if((*itm).first->GetAlphaFunc() != zMAT_ALPHA_FUNC_FUNC_NONE || 
-										(*itm).first->GetAlphaFunc() != zMAT_ALPHA_FUNC_FUNC_MAT_DEFAULT)
+									if((*itm).first->GetTexture()->CacheIn(0.6f) == zRES_CACHED_IN)
 									{
-										if((*itm).first->GetTexture()->CacheIn(0.6f) == zRES_CACHED_IN)
-										{
-											(*itm).first->GetTexture()->Bind(0);
-										}
-									}else
-									{
-										DistortionTexture->BindToPixelShader(0);
+										(*itm).first->GetTexture()->Bind(0);
 									}
-								}
-
-								for(unsigned int i=0;i<(*itm).second.size();i++)
+								}else
 								{
-									Engine::GraphicsEngine->DrawVertexBufferIndexed((*itm).second[i]->MeshVertexBuffer, (*itm).second[i]->MeshIndexBuffer, (*itm).second[i]->Indices.size());
+									DistortionTexture->BindToPixelShader(0);
 								}
 							}
-						}*/
-					}
+
+							for(unsigned int i=0;i<(*itm).second.size();i++)
+							{
+								Engine::GraphicsEngine->DrawVertexBufferIndexed((*itm).second[i]->MeshVertexBuffer, (*itm).second[i]->MeshIndexBuffer, (*itm).second[i]->Indices.size());
+							}
+						}
+					}*/
 				}
 			}
 		}
@@ -3369,26 +3409,25 @@ void D3D11GraphicsEngine::DrawWorldAround(const D3DXVECTOR3& position, int secti
 		Engine::GAPI->GetRendererState()->RasterizerState.SetDirty();
 		UpdateRenderStates();
 
-		// Reset instances
-		const std::unordered_map<zCProgMeshProto*, MeshVisualInfo*>& vis = Engine::GAPI->GetStaticMeshVisuals();
-		/*for(std::unordered_map<zCProgMeshProto*, MeshVisualInfo*>::const_iterator it = vis.begin(); it != vis.end(); it++)
-		{
-		(*it).second->StartNewFrame();
-		}*/
-
+		// Group the vobs seen by the camera by their visual
 		D3DXVECTOR3 camPos = Engine::GAPI->GetCameraPosition();
 		float shadowRange = Engine::GAPI->GetRendererState()->RendererSettings.WorldShadowRangeScale * WorldShadowmap1->GetSizeX();
+		static std::vector<VobInfo *> s_ShadowVobs;
+		s_ShadowVobs.resize(0);
 		for(std::list<VobInfo*>::iterator it = RenderedVobs.begin(); it != RenderedVobs.end(); it++)
 		{
-			VobInstanceInfo vii;
-			vii.world = (*it)->WorldMatrix;
-
 			if(!(*it)->IsIndoorVob)// && D3DXVec3Length(&((*it)->LastRenderPosition - position)) < shadowRange)
-				((MeshVisualInfo *)(*it)->VisualInfo)->Instances.push_back(vii);
+				s_ShadowVobs.push_back(*it);
 		}
 
+		VobInstanceStore& instanceStore = Engine::GAPI->GetVobInstanceStore();
+		instanceStore.UploadDirtySlots();
+
+		static std::vector<VobInstanceBatch> s_Batches;
+		BatchVobInstances(s_ShadowVobs, s_Batches);
+
 		// Apply instancing shader
-		SetActiveVertexShader("VS_ExInstancedObj");
+		SetActiveVertexShader("VS_ExRemapInstancedObj");
 		//SetActivePixelShader("PS_DiffuseAlphaTest");
 		ActiveVS->Apply();
 
@@ -3398,55 +3437,24 @@ void D3D11GraphicsEngine::DrawWorldAround(const D3DXVECTOR3& position, int secti
 			Context->PSSetShader(NULL, NULL, NULL);
 		}
 
-		D3D11_BUFFER_DESC desc;
-		((D3D11VertexBuffer *)DynamicInstancingBuffer)->GetVertexBuffer()->GetDesc(&desc);
-
-		/*if(desc.ByteWidth < sizeof(VobInstanceInfo) * vobs.size())
-		{
-			LogInfo() << "Instancing buffer too small (" << desc.ByteWidth << "), need " << sizeof(VobInstanceInfo) * vobs.size() << " bytes. Recreating buffer.";
-
-			// Buffer too small, recreate it
-			delete DynamicInstancingBuffer;
-			DynamicInstancingBuffer = new D3D11VertexBuffer();
-			DynamicInstancingBuffer->Init(NULL, sizeof(VobInstanceInfo) * vobs.size(), D3D11VertexBuffer::B_VERTEXBUFFER, D3D11VertexBuffer::U_DYNAMIC, D3D11VertexBuffer::CA_WRITE);
-		}*/
-
-
-		// Update the vertexbuffer
-		//DynamicInstancingBuffer->UpdateBufferAligned16(&s_InstanceData[0], sizeof(VobInstanceInfo) * s_InstanceData.size());
-
-		byte* data;
-		UINT size;
-		UINT loc = 0;
-		DynamicInstancingBuffer->Map(D3D11VertexBuffer::M_WRITE_DISCARD, (void**)&data, &size);
-		static std::vector<VobInstanceInfo, AlignmentAllocator<VobInstanceInfo, 16> > s_InstanceData;
-		for(std::unordered_map<zCProgMeshProto*, MeshVisualInfo*>::const_iterator it = vis.begin(); it != vis.end(); it++)
+		if(!s_Batches.empty())
 		{
-			if((*it).second->Instances.empty())
-				continue;
-
-			if((loc + (*it).second->Instances.size()) * sizeof(VobInstanceInfo) >= desc.ByteWidth)
-				break; // Should never happen
-
-			(*it).second->StartInstanceNum = loc;
-			memcpy(data + loc * sizeof(VobInstanceInfo), &(*it).second->Instances[0], sizeof(VobInstanceInfo) * (*it).second->Instances.size());
-			loc += (*it).second->Instances.size();
+			ID3D11ShaderResourceView* instanceSRV = instanceStore.GetInstanceBuffer()->GetShaderResourceView();
+			Context->VSSetShaderResources(0, 1, &instanceSRV);
 		}
-		DynamicInstancingBuffer->Unmap();
 
 		{
 
 
 			// Draw all vobs the player currently sees
-			for(std::unordered_map<zCProgMeshProto*, MeshVisualInfo*>::const_iterator it = vis.begin(); it != vis.end(); it++)
+			for(unsigned int b=0;b<s_Batches.size();b++)
 			{
-				if((*it).second->Instances.empty())
-					continue;
+				const VobInstanceBatch& batch = s_Batches[b];
 
-				bool doReset = true;
-				for(std::map<MeshKey, std::vector<MeshInfo*>>::iterator itt = (*it).second->MeshesByTexture.begin(); itt != (*it).second->MeshesByTexture.end(); itt++)
+				bool alphaVisual = false;
+				for(std::map<MeshKey, std::vector<MeshInfo*>>::iterator itt = batch.Visual->MeshesByTexture.begin(); itt != batch.Visual->MeshesByTexture.end(); itt++)
 				{
-					std::vector<MeshInfo *>& mlist = (*it).second->MeshesByTexture[(*itt).first];
+					std::vector<MeshInfo *>& mlist = (*itt).second;
 					if(mlist.empty())
 						continue;
 
@@ -3457,9 +3465,9 @@ void D3D11GraphicsEngine::DrawWorldAround(const D3DXVECTOR3& position, int secti
 						// Check for alphablend
 						bool blendAdd = (*itt).first.Material->GetAlphaFunc() == zMAT_ALPHA_FUNC_ADD;
 						bool blendBlend = (*itt).first.Material->GetAlphaFunc() == zMAT_ALPHA_FUNC_BLEND;
-						if(!doReset || blendAdd || blendBlend) // FIXME: if one part of the mesh uses blending, all do. 
+						if(alphaVisual || blendAdd || blendBlend) // FIXME: if one part of the mesh uses blending, all do. 
 						{
-							doReset = false;
+							alphaVisual = true;
 							continue;
 						}
 
@@ -3485,16 +3493,12 @@ void D3D11GraphicsEngine::DrawWorldAround(const D3DXVECTOR3& position, int secti
 						MeshInfo* mi = mlist[i];
 
 						// Draw batch
-						DrawInstanced(mi->MeshVertexBuffer, mi->MeshIndexBuffer, mi->Indices.size(), DynamicInstancingBuffer, sizeof(VobInstanceInfo), (*it).second->Instances.size(), sizeof(ExVertexStruct), (*it).second->StartInstanceNum);
+						DrawInstanced(mi->MeshVertexBuffer, mi->MeshIndexBuffer, mi->Indices.size(), instanceStore.GetRemapBuffer(), sizeof(VobInstanceRemapInfo), batch.NumInstances, sizeof(ExVertexStruct), batch.StartInstance);
 
-						Engine::GAPI->GetRendererState()->RendererInfo.FrameDrawnVobs += (*it).second->Instances.size();
+						Engine::GAPI->GetRendererState()->RendererInfo.FrameDrawnVobs += batch.NumInstances;
 						//Engine::GraphicsEngine->DrawVertexBufferIndexed(mi->MeshVertexBuffer, mi->MeshIndexBuffer, mi->Indices.size());
 					}			
 				}
-
-				// Reset visual
-				if(doReset)
-					(*it).second->StartNewFrame();
 			}
 		}
 	}
@@ -3531,15 +3535,13 @@ XRESULT D3D11GraphicsEngine::DrawVOBsInstanced()
 {
 	START_TIMING();
 
-	const std::unordered_map<zCProgMeshProto*, MeshVisualInfo*>& vis = Engine::GAPI->GetStaticMeshVisuals();
-
 	SetDefaultStates();
 
 	SetActivePixelShader("PS_AtmosphereGround");
 	D3D11PShader* nrmPS = ActivePS;
 	SetActivePixelShader("PS_Diffuse");
 	D3D11PShader* defaultPS = ActivePS;
-	SetActiveVertexShader("VS_ExInstancedObj");
+	SetActiveVertexShader("VS_ExRemapInstancedObj");
 
 	// Set constant buffer
 	ActivePS->GetConstantBuffer()[0]->UpdateBuffer(&Engine::GAPI->GetRendererState()->GraphicsState);
@@ -3589,36 +3591,16 @@ XRESULT D3D11GraphicsEngine::DrawVOBsInstanced()
 	}
 
 	// Need to collect alpha-meshes to render them laterdy
-	std::list<std::pair<MeshKey, std::pair<MeshVisualInfo*, MeshInfo*>>> AlphaMeshes;
+	std::list<std::pair<MeshKey, std::pair<VobInstanceBatch, MeshInfo*>>> AlphaMeshes;
 	
 	if(Engine::GAPI->GetRendererState()->RendererSettings.DrawVOBs)
 	{
-		// Create instancebuffer for this frame
-		D3D11_BUFFER_DESC desc;
-		((D3D11VertexBuffer *)DynamicInstancingBuffer)->GetVertexBuffer()->GetDesc(&desc);
-
-		if(desc.ByteWidth < sizeof(VobInstanceInfo) * vobs.size())
-		{
-			LogInfo() << "Instancing buffer too small (" << desc.ByteWidth << "), need " << sizeof(VobInstanceInfo) * vobs.size() << " bytes. Recreating buffer.";
+		// Only the vobs which moved since the last frame need to go to the GPU
+		VobInstanceStore& instanceStore = Engine::GAPI->GetVobInstanceStore();
+		instanceStore.UploadDirtySlots();
 
-			// Buffer too small, recreate it
-			delete DynamicInstancingBuffer;
-			DynamicInstancingBuffer = new D3D11VertexBuffer();
-			DynamicInstancingBuffer->Init(NULL, sizeof(VobInstanceInfo) * vobs.size(), D3D11VertexBuffer::B_VERTEXBUFFER, D3D11VertexBuffer::U_DYNAMIC, D3D11VertexBuffer::CA_WRITE);
-		}
-
-		byte* data;
-		UINT size;
-		UINT loc = 0;
-		DynamicInstancingBuffer->Map(D3D11VertexBuffer::M_WRITE_DISCARD, (void**)&data, &size);
-		static std::vector<VobInstanceInfo, AlignmentAllocator<VobInstanceInfo, 16> > s_InstanceData;
-		for(std::unordered_map<zCProgMeshProto*, MeshVisualInfo*>::const_iterator it = vis.begin(); it != vis.end(); it++)
-		{
-			(*it).second->StartInstanceNum = loc;
-			memcpy(data + loc * sizeof(VobInstanceInfo), &(*it).second->Instances[0], sizeof(VobInstanceInfo) * (*it).second->Instances.size());
-			loc += (*it).second->Instances.size();
-		}
-		DynamicInstancingBuffer->Unmap();
+		static std::vector<VobInstanceBatch> s_Batches;
+		BatchVobInstances(vobs, s_Batches, true);
 
 		for(unsigned int i=0;i<vobs.size();i++)
 		{
@@ -3626,39 +3608,44 @@ XRESULT D3D11GraphicsEngine::DrawVOBsInstanced()
 			RenderedVobs.push_back(vobs[i]);
 		}
 
-		// Reset buffer
-		s_InstanceData.resize(0);
+		// The shader fetches the instance-data by the slots in the remap-buffer
+		ID3D11ShaderResourceView* instanceSRV = instanceStore.GetInstanceBuffer() ? instanceStore.GetInstanceBuffer()->GetShaderResourceView() : NULL;
+		Context->VSSetShaderResources(0, 1, &instanceSRV);
 
-		for(std::unordered_map<zCProgMeshProto*, MeshVisualInfo*>::const_iterator it = vis.begin(); it != vis.end(); it++)
+		for(unsigned int b=0;b<s_Batches.size();b++)
 		{
-			if((*it).second->Instances.empty())
-				continue;
+			const VobInstanceBatch& batch = s_Batches[b];
+			MeshVisualInfo* visual = batch.Visual;
 
-			if((*it).second->MeshSize < Engine::GAPI->GetRendererState()->RendererSettings.SmallVobSize)
+			// View-distance of this visual, put into the buffer by the state-cache when it changes
+			D3D11ConstantBuffer* rangeBuffer;
+			D3DXVECTOR4 range;
+			if(visual->MeshSize < Engine::GAPI->GetRendererState()->RendererSettings.SmallVobSize)
 			{
-				OutdoorSmallVobsConstantBuffer->UpdateBuffer(&D3DXVECTOR4(Engine::GAPI->GetRendererState()->RendererSettings.OutdoorSmallVobDrawRadius - (*it).second->MeshSize, 0, 0, 0));
-				OutdoorSmallVobsConstantBuffer->BindToPixelShader(3);
+				rangeBuffer = OutdoorSmallVobsConstantBuffer;
+				range = D3DXVECTOR4(Engine::GAPI->GetRendererState()->RendererSettings.OutdoorSmallVobDrawRadius - visual->MeshSize, 0, 0, 0);
 			}
 			else
 			{
-				OutdoorVobsConstantBuffer->UpdateBuffer(&D3DXVECTOR4(Engine::GAPI->GetRendererState()->RendererSettings.OutdoorVobDrawRadius - (*it).second->MeshSize, 0, 0, 0));
-				OutdoorVobsConstantBuffer->BindToPixelShader(3);
+				rangeBuffer = OutdoorVobsConstantBuffer;
+				range = D3DXVECTOR4(Engine::GAPI->GetRendererState()->RendererSettings.OutdoorVobDrawRadius - visual->MeshSize, 0, 0, 0);
 			}
 
-			bool doReset = true; // Don't reset alpha-vobs here
-			for(std::map<MeshKey, std::vector<MeshInfo*>>::iterator itt = (*it).second->MeshesByTexture.begin(); itt != (*it).second->MeshesByTexture.end(); itt++)
+			bool alphaVisual = false;
+			for(std::map<MeshKey, std::vector<MeshInfo*>>::iterator itt = visual->MeshesByTexture.begin(); itt != visual->MeshesByTexture.end(); itt++)
 			{
-				std::vector<MeshInfo *>& mlist = (*it).second->MeshesByTexture[(*itt).first];
+				std::vector<MeshInfo *>& mlist = (*itt).second;
 				if(mlist.empty())
 					continue;
 
-				// Bind buffers
-				DrawVertexBufferIndexed((*it).second->FullMesh->MeshVertexBuffer, (*it).second->FullMesh->MeshIndexBuffer, 0);
-
 				for(unsigned int i=0;i<mlist.size();i++)
 				{
 					zCTexture* tx = (*itt).first.Material->GetAniTexture();
-					MeshInfo* mi = mlist[i];
+					MeshInfo* mi = mlist[i]->GetLOD(batch.LOD);
+
+					RenderQueuePacket packet;
+					packet.PerDrawBuffer = rangeBuffer;
+					packet.PerDrawData = range;
 
 					if(!tx)
 					{
@@ -3666,79 +3653,43 @@ XRESULT D3D11GraphicsEngine::DrawVOBsInstanced()
 						continue; // Don't render meshes without texture if not in spacer
 #else
 						// This is most likely some spacer helper-vob
-						WhiteTexture->BindToPixelShader(0);
-						PS_Diffuse->Apply();
-
-						/*// Apply colors for these meshes
-						MaterialInfo::Buffer b;
-						ZeroMemory(&b, sizeof(b));
-						b.Color = (*itt).first.Material->GetColor();
-						PS_Diffuse->GetConstantBuffer()[2]->UpdateBuffer(&b);
-						PS_Diffuse->GetConstantBuffer()[2]->BindToPixelShader(2);*/
+						packet.Textures[0] = WhiteTexture->GetShaderResourceView();
+						packet.PixelShader = PS_Diffuse;
 #endif
 					}else
 					{
 						// Check for alphablending on world mesh
 						bool blendAdd = (*itt).first.Material->GetAlphaFunc() == zMAT_ALPHA_FUNC_ADD;
 						bool blendBlend = (*itt).first.Material->GetAlphaFunc() == zMAT_ALPHA_FUNC_BLEND;
-						if(!doReset || blendAdd || blendBlend) // FIXME: if one part of the mesh uses blending, all do. 
+						if(alphaVisual || blendAdd || blendBlend) // FIXME: if one part of the mesh uses blending, all do. 
 						{
-							MeshVisualInfo* info = (*it).second;
-							MeshInfo* mesh = mlist[i];
+							AlphaMeshes.push_back(std::make_pair((*itt).first, std::make_pair(batch, mi)));
 
-							AlphaMeshes.push_back(std::make_pair((*itt).first, std::make_pair(info, mesh)));
-
-							doReset = false;
+							alphaVisual = true;
 							continue;
 						}
 
-						// Bind texture
-
 						if(tx->CacheIn(0.6f) == zRES_CACHED_IN)
 						{
-							MyDirectDrawSurface7* surface = tx->GetSurface();
-							ID3D11ShaderResourceView* srv[3];
 							MaterialInfo* info = (*itt).first.Info;
-			
-							// Get diffuse and normalmap
-							srv[0] = ((D3D11Texture *)surface->GetEngineTexture())->GetShaderResourceView();
-							srv[1] = surface->GetNormalmap() ? ((D3D11Texture *)surface->GetNormalmap())->GetShaderResourceView() : NULL;
-							srv[2] = surface->GetFxMap() ? ((D3D11Texture *)surface->GetFxMap())->GetShaderResourceView() : NULL;
-
-							// Bind a default normalmap in case the scene is wet and we currently have none
-							if(!srv[1])
-							{
-								// Modify the strength of that default normalmap for the material info
-								if(info->buffer.NormalmapStrength/* * Engine::GAPI->GetSceneWetness()*/ != DEFAULT_NORMALMAP_STRENGTH)
-								{
-									info->buffer.NormalmapStrength = DEFAULT_NORMALMAP_STRENGTH;
-									info->UpdateConstantbuffer();
-								}
-								srv[1] = ((D3D11Texture*)DistortionTexture)->GetShaderResourceView();
-							}
-							// Bind both
-							Context->PSSetShaderResources(0,3, srv);
-
-							// Set normal/displacement map
-							Context->DSSetShaderResources(0,1, &srv[1]);
-							Context->HSSetShaderResources(0,1, &srv[1]);
+							GetMaterialTextureViews(tx->GetSurface(), info, packet.Textures);
 
 							// Force alphatest on vobs for now
-							BindShaderForTexture(tx, true, 0);
-									
-							
+							packet.PixelShader = GetShaderForTexture(tx, true, 0);
+
 							if(!info->Constantbuffer)
 								info->UpdateConstantbuffer();
 
-							info->Constantbuffer->BindToPixelShader(2);
+							packet.MaterialBuffer = info->Constantbuffer;
 						}
 						else
 						{
 #ifndef PUBLIC_RELEASE
-							for(size_t s=0;s<(*it).second->Instances.size();s++)
+							for(unsigned int s=0;s<batch.NumInstances;s++)
 							{
-								D3DXVECTOR3 pos = D3DXVECTOR3((*it).second->Instances[s].world._14, (*it).second->Instances[s].world._24, (*it).second->Instances[s].world._34); 
-								GetLineRenderer()->AddAABBMinMax(pos - (*it).second->BBox.Min, pos + (*it).second->BBox.Max, D3DXVECTOR4(1,0,0,1));
+								const VobInstanceInfo& inst = instanceStore.GetInstance(instanceStore.GetRemap(batch.StartInstance + s));
+								D3DXVECTOR3 pos = D3DXVECTOR3(inst.world._14, inst.world._24, inst.world._34); 
+								GetLineRenderer()->AddAABBMinMax(pos - visual->BBox.Min, pos + visual->BBox.Max, D3DXVECTOR4(1,0,0,1));
 							}
 #endif
 							continue;
@@ -3746,46 +3697,33 @@ XRESULT D3D11GraphicsEngine::DrawVOBsInstanced()
 
 					}
 
-					if(tesselationEnabled && !mi->IndicesPNAEN.empty() && RenderingStage == DES_MAIN && (*it).second->TesselationInfo.buffer.VT_TesselationFactor > 0.0f)
-					{
-						
-						Setup_PNAEN(PNAEN_Instanced);
-						(*it).second->TesselationInfo.Constantbuffer->BindToDomainShader(1);
-						(*it).second->TesselationInfo.Constantbuffer->BindToHullShader(1);
-					}else if(ActiveHDS)
-					{
-						Context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-						Context->DSSetShader(NULL, NULL, NULL);
-						Context->HSSetShader(NULL, NULL, NULL);
-						ActiveHDS = NULL;
-						SetActiveVertexShader("VS_ExInstancedObj");
-						ActiveVS->Apply();
-					}
+					packet.VertexBuffer = mi->MeshVertexBuffer;
+					packet.IndexBuffer = mi->MeshIndexBuffer;
+					packet.NumIndices = mi->Indices.size();
+					packet.InstanceBuffer = instanceStore.GetRemapBuffer();
+					packet.InstanceStride = sizeof(VobInstanceRemapInfo);
+					packet.NumInstances = batch.NumInstances;
+					packet.StartInstance = batch.StartInstance;
 
-					if(!ActiveHDS)
+					unsigned int pass = RQP_OPAQUE;
+					if(tesselationEnabled && !batch.LOD && !mi->IndicesPNAEN.empty() && RenderingStage == DES_MAIN && visual->TesselationInfo.buffer.VT_TesselationFactor > 0.0f)
 					{
-						// Draw batch
-						DrawInstanced(mi->MeshVertexBuffer, mi->MeshIndexBuffer, mi->Indices.size(), DynamicInstancingBuffer, sizeof(VobInstanceInfo), (*it).second->Instances.size(), sizeof(ExVertexStruct), (*it).second->StartInstanceNum);
-					}else
-					{
-						// Draw batch tesselated
-						DrawInstanced(mi->MeshVertexBuffer, mi->MeshIndexBufferPNAEN, mi->IndicesPNAEN.size(), DynamicInstancingBuffer, sizeof(VobInstanceInfo), (*it).second->Instances.size(), sizeof(ExVertexStruct), (*it).second->StartInstanceNum);
+						pass = RQP_TESSELATED;
+						packet.TesselationBuffer = visual->TesselationInfo.Constantbuffer;
+						packet.IndexBuffer = mi->MeshIndexBufferPNAEN;
+						packet.NumIndices = mi->IndicesPNAEN.size();
 					}
-						
-						
-					//DrawVertexBufferIndexed((*it).second->FullMesh->MeshVertexBuffer, (*it).second->FullMesh->MeshIndexBuffer, 0);
 
-					//Engine::GraphicsEngine->DrawVertexBufferIndexed(mi->MeshVertexBuffer, mi->MeshIndexBuffer, mi->Indices.size());
+					// Instances are spread out, so there is no useful depth for the key
+					FrameRenderQueue.Add(RenderQueueKey::Make(pass, packet.PixelShader->GetID(), 
+						FrameRenderQueue.GetTextureID(tx), 
+						FrameRenderQueue.GetMaterialID((*itt).first.Info), 0.0f), packet);
 				}
 
 			}
-
-			// Reset visual
-			if(doReset && !Engine::GAPI->GetRendererState()->RendererSettings.FixViewFrustum)
-			{
-				(*it).second->StartNewFrame();
-			}
 		}
+
+		SubmitRenderQueue(FrameRenderQueue, PNAEN_RemapInstanced);
 	}
 
 	// Draw mobs
@@ -3834,7 +3772,7 @@ XRESULT D3D11GraphicsEngine::DrawVOBsInstanced()
 	SetDefaultStates();
 
 	SetActivePixelShader("PS_Simple");
-	SetActiveVertexShader("VS_ExInstancedObj");
+	SetActiveVertexShader("VS_ExRemapInstancedObj");
 
 	Engine::GAPI->GetRendererState()->RasterizerState.FrontCounterClockwise = true;
 	Engine::GAPI->GetRendererState()->RasterizerState.SetDirty();
@@ -3844,6 +3782,14 @@ XRESULT D3D11GraphicsEngine::DrawVOBsInstanced()
 
 	Context->OMSetRenderTargets(1, HDRBackBuffer->GetRenderTargetViewPtr(), DepthStencilBuffer->GetDepthStencilView());
 
+	// Lighting had its own things bound in there
+	VobInstanceStore& instanceStore = Engine::GAPI->GetVobInstanceStore();
+	if(!AlphaMeshes.empty())
+	{
+		ID3D11ShaderResourceView* instanceSRV = instanceStore.GetInstanceBuffer()->GetShaderResourceView();
+		Context->VSSetShaderResources(0, 1, &instanceSRV);
+	}
+
 	for(auto itt = AlphaMeshes.begin(); itt != AlphaMeshes.end(); itt++)
 	{
 		zCTexture* tx = (*itt).first.Material->GetAniTexture();
@@ -3858,7 +3804,7 @@ XRESULT D3D11GraphicsEngine::DrawVOBsInstanced()
 		// Bind texture
 
 		MeshInfo* mi = (*itt).second.second;
-		MeshVisualInfo* vi = (*itt).second.first;
+		const VobInstanceBatch& batch = (*itt).second.first;
 
 		if(tx->CacheIn(0.6f) == zRES_CACHED_IN)
 		{
@@ -3896,19 +3842,9 @@ XRESULT D3D11GraphicsEngine::DrawVOBsInstanced()
 		}
 
 		// Draw batch
-		DrawInstanced(mi->MeshVertexBuffer, mi->MeshIndexBuffer, mi->Indices.size(), DynamicInstancingBuffer, sizeof(VobInstanceInfo), vi->Instances.size(), sizeof(ExVertexStruct), vi->StartInstanceNum);
-
+		DrawInstanced(mi->MeshVertexBuffer, mi->MeshIndexBuffer, mi->Indices.size(), instanceStore.GetRemapBuffer(), sizeof(VobInstanceRemapInfo), batch.NumInstances, sizeof(ExVertexStruct), batch.StartInstance);
 
-	}
-
-	// Loop again, now that all alpha-meshes have been rendered
-	// so we can reset their visuals, too.
-	for(auto itt = AlphaMeshes.begin(); itt != AlphaMeshes.end(); itt++)
-	{
-		MeshVisualInfo* vi = (*itt).second.first;
 
-		// Reset visual		
-		vi->StartNewFrame();	
 	}
 
 	if(!Engine::GAPI->GetRendererState()->RendererSettings.FixViewFrustum)
@@ -4145,6 +4081,185 @@ BaseLineRenderer* D3D11GraphicsEngine::GetLineRenderer()
 	return LineRenderer;
 }
 
+/** Lights closer than this all go into the first slice of the clusters */
+const float LIGHTCLUSTER_NEAR = 50.0f;
+
+/** Makes sure the dynamic structured buffer can hold the given number of elements */
+static void EnsureStructuredBuffer(D3D11VertexBuffer** buffer, unsigned int& capacity, unsigned int num, unsigned int stride, const std::string& name)
+{
+	if(*buffer && capacity >= num)
+		return;
+
+	capacity = std::max(capacity, 64U);
+	while(capacity < num)
+		capacity *= 2;
+
+	delete *buffer;
+	Engine::GraphicsEngine->CreateVertexBuffer(buffer);
+	(*buffer)->Init(NULL, capacity * stride, D3D11VertexBuffer::B_SHADER_RESOURCE, D3D11VertexBuffer::U_DYNAMIC, D3D11VertexBuffer::CA_WRITE, name, stride);
+}
+
+/** Collects the visible pointlights and starts binning them into the clusters of the camera on the worker-threads */
+void D3D11GraphicsEngine::BeginClusteredLighting(std::vector<VobLightInfo*>& lights)
+{
+	ClusterLightSpheres.Clear();
+	ClusterLightData.clear();
+	ClusterLightVobs.clear();
+
+	D3DXMATRIX view;
+	Engine::GAPI->GetViewMatrix(&view);
+	D3DXMatrixTranspose(&view, &view);
+
+	D3DXVECTOR3 cameraPosition = Engine::GAPI->GetCameraPosition();
+	float fadeEnd = Engine::GAPI->GetRendererState()->RendererSettings.VisualFXDrawRadius;
+	float zFar = LIGHTCLUSTER_NEAR * 2.0f;
+
+	for(std::vector<VobLightInfo*>::iterator itv = lights.begin(); itv != lights.end();itv++)
+	{
+		zCVobLight* vob = (*itv)->Vob;
+
+		// Reset state from CollectVisibleVobs
+		(*itv)->VisibleInRenderPass = false;
+
+		if(!vob->IsEnabled())
+			continue;
+
+		// Animate the light
+		vob->DoAnimation();
+
+		ClusteredPointLight light;
+		float4 color = float4(vob->GetLightColor());
+		light.Color = float3(color.x, color.y, color.z);
+		light.Range = vob->GetLightRange();
+		light.PositionWorld = vob->GetPositionWorld();
+		light.ShadowCubeIndex = -1.0f;
+		light.Pad = 0.0f;
+
+		// Gradually fade in the lights, like the light-volumes do
+		float dist = D3DXVec3Length(&(*light.PositionWorld.toD3DXVECTOR3() - cameraPosition));
+		if(dist + light.Range < fadeEnd)
+		{
+			float fadeFactor = std::min(1.0f, std::max(0.0f, ((fadeEnd - (dist + light.Range)) / light.Range)));
+			light.Color.x *= fadeFactor;
+			light.Color.y *= fadeFactor;
+			light.Color.z *= fadeFactor;
+		}
+
+		if(light.Color.x <= 0.0f && light.Color.y <= 0.0f && light.Color.z <= 0.0f)
+			continue;
+
+		// Make the lights a little bit brighter
+		float lightFactor = 1.2f;
+		light.Color.x *= lightFactor;
+		light.Color.y *= lightFactor;
+		light.Color.z *= lightFactor;
+
+		// Need that in view space
+		D3DXVec3TransformCoord(light.PositionView.toD3DXVECTOR3(), light.PositionWorld.toD3DXVECTOR3(), &view);
+
+		// Nothing to light behind the camera
+		if(light.PositionView.z + light.Range < 0.0f)
+			continue;
+
+		zFar = std::max(zFar, light.PositionView.z + light.Range);
+
+		ClusterLightSpheres.Add(*light.PositionView.toD3DXVECTOR3(), light.Range);
+		ClusterLightData.push_back(light);
+		ClusterLightVobs.push_back(*itv);
+	}
+
+	// Spread the slices only over the depth the lights can reach
+	D3DXMATRIX& proj = Engine::GAPI->GetProjectionMatrix();
+	LightClusters->SetProjection(proj._11, proj._22, LIGHTCLUSTER_NEAR, zFar);
+	LightClusters->Begin(&ClusterLightSpheres);
+}
+
+/** Waits for the binning and draws all pointlights in a single full-screen pass */
+void D3D11GraphicsEngine::DrawClusteredLighting()
+{
+	LightClusters->Finish();
+
+	const std::vector<LightClusterRange>& ranges = LightClusters->GetClusterRanges();
+	const std::vector<unsigned int>& indices = LightClusters->GetLightIndices();
+
+	Engine::GAPI->GetRendererState()->RendererInfo.FrameClusteredLights = ClusterLightData.size();
+	Engine::GAPI->GetRendererState()->RendererInfo.FrameLightClusterEntries = indices.size();
+
+	if(ClusterLightData.empty() || indices.empty())
+		return;
+
+	// The cubes are only known after the shadows were drawn
+	bool shadows = Engine::GAPI->GetRendererState()->RendererSettings.EnablePointlightShadows > 0;
+	for(unsigned int i=0;i<ClusterLightVobs.size();i++)
+	{
+		D3D11PointLight* shadowLight = (D3D11PointLight *)ClusterLightVobs[i]->LightShadowBuffers;
+		if(shadows && shadowLight && shadowLight->IsShadowResident())
+		{
+			ClusterLightData[i].ShadowCubeIndex = (float)shadowLight->GetShadowCubeIndex();
+			shadowLight->OnRenderLight();
+		}else
+		{
+			ClusterLightData[i].ShadowCubeIndex = -1.0f;
+		}
+	}
+
+	EnsureStructuredBuffer(&ClusterLightBuffer, ClusterLightCapacity, ClusterLightData.size(), sizeof(ClusteredPointLight), "D3D11GraphicsEngine::ClusterLightBuffer");
+	EnsureStructuredBuffer(&ClusterIndexBuffer, ClusterIndexCapacity, indices.size(), sizeof(unsigned int), "D3D11GraphicsEngine::ClusterIndexBuffer");
+	if(!ClusterRangeBuffer)
+	{
+		unsigned int rangeCapacity = 0;
+		EnsureStructuredBuffer(&ClusterRangeBuffer, rangeCapacity, LIGHTCLUSTER_NUM_CLUSTERS, sizeof(LightClusterRange), "D3D11GraphicsEngine::ClusterRangeBuffer");
+	}
+
+	ClusterLightBuffer->UpdateBuffer(&ClusterLightData[0], ClusterLightData.size() * sizeof(ClusteredPointLight));
+	ClusterIndexBuffer->UpdateBuffer((void *)&indices[0], indices.size() * sizeof(unsigned int));
+	ClusterRangeBuffer->UpdateBuffer((void *)&ranges[0], ranges.size() * sizeof(LightClusterRange));
+
+	SetActivePixelShader("PS_DS_PointLightClustered");
+	SetActiveVertexShader("VS_PFX");
+	SetupVS_ExMeshDrawCall();
+
+	DS_PointLightClusteredConstantBuffer cb;
+	D3DXMatrixInverse(&cb.PLC_InvProj, NULL, &Engine::GAPI->GetProjectionMatrix());
+	D3DXMatrixInverse(&cb.PLC_InvView, NULL, &Engine::GAPI->GetRendererState()->TransformState.TransformView);
+	cb.PLC_ViewportSize = float2((float)Resolution.x, (float)Resolution.y);
+	cb.PLC_ClusterNear = LightClusters->GetNear();
+	cb.PLC_ClusterSliceScale = LightClusters->GetSliceScale();
+	cb.PLC_NumTiles = float2((float)LIGHTCLUSTER_TILES_X, (float)LIGHTCLUSTER_TILES_Y);
+	cb.PLC_NumSlices = (float)LIGHTCLUSTER_SLICES;
+	cb.PLC_Pad = 0.0f;
+
+	ActivePS->GetConstantBuffer()[0]->UpdateBuffer(&cb);
+	ActivePS->GetConstantBuffer()[0]->BindToPixelShader(0);
+
+	PFXVS_ConstantBuffer vscb;
+	vscb.PFXVS_InvProj = cb.PLC_InvProj;
+	ActiveVS->GetConstantBuffer()[0]->UpdateBuffer(&vscb);
+	ActiveVS->GetConstantBuffer()[0]->BindToVertexShader(0);
+
+	ShadowCubes->BindToPixelShader(3);
+
+	ID3D11ShaderResourceView* srvs[] = {ClusterLightBuffer->GetShaderResourceView(), ClusterRangeBuffer->GetShaderResourceView(), ClusterIndexBuffer->GetShaderResourceView()};
+	Context->PSSetShaderResources(4, 3, srvs);
+
+	// The quad covers the whole screen, so the depth-buffer has nothing to reject
+	Engine::GAPI->GetRendererState()->DepthState.DepthBufferEnabled = false;
+	Engine::GAPI->GetRendererState()->DepthState.SetDirty();
+	Engine::GAPI->GetRendererState()->RasterizerState.CullMode = GothicRasterizerStateInfo::CM_CULL_BACK;
+	Engine::GAPI->GetRendererState()->RasterizerState.SetDirty();
+
+	PfxRenderer->DrawFullScreenQuad();
+
+	Engine::GAPI->GetRendererState()->DepthState.DepthBufferEnabled = true;
+	Engine::GAPI->GetRendererState()->DepthState.SetDirty();
+
+	// Don't leave the buffers bound to slots the following passes use for textures
+	ID3D11ShaderResourceView* nullSRVs[] = {NULL, NULL, NULL};
+	Context->PSSetShaderResources(4, 3, nullSRVs);
+
+	Engine::GAPI->GetRendererState()->RendererInfo.FrameDrawnLights += ClusterLightData.size();
+}
+
 /** Applys the lighting to the scene */
 XRESULT D3D11GraphicsEngine::DrawLighting(std::vector<VobLightInfo*>& lights)
 {
@@ -4155,14 +4270,19 @@ XRESULT D3D11GraphicsEngine::DrawLighting(std::vector<VobLightInfo*>& lights)
 	// ********************************
 	CameraReplacement cr;
 	D3DXVECTOR3 cameraPosition = Engine::GAPI->GetCameraPosition();
-	D3DXVECTOR3 playerPosition = Engine::GAPI->GetPlayerVob() != NULL ? Engine::GAPI->GetPlayerVob()->GetPositionWorld() : D3DXVECTOR3(FLT_MAX, FLT_MAX, FLT_MAX);
 
 	bool partialShadowUpdate = Engine::GAPI->GetRendererState()->RendererSettings.PartialDynamicShadowUpdates;
+	bool clustered = Engine::GAPI->GetRendererState()->RendererSettings.EnableClusteredLighting;
+
+	// Let the workers bin the lights while the shadows are being drawn
+	if(clustered)
+		BeginClusteredLighting(lights);
 
 	// Draw pointlight shadows
 	if(Engine::GAPI->GetRendererState()->RendererSettings.EnablePointlightShadows > 0)
 	{
-		std::list<VobLightInfo*> importantUpdates;
+		ShadowCubes->OnFrameStart(cameraPosition, Engine::GAPI->GetRendererState()->RendererSettings.ShadowCubePoolMemoryMB);
+
 		for(std::vector<VobLightInfo*>::iterator itv = lights.begin(); itv != lights.end();itv++)
 		{
 			// Create shadowmap in case we should have one but haven't got it yet
@@ -4173,75 +4293,18 @@ XRESULT D3D11GraphicsEngine::DrawLighting(std::vector<VobLightInfo*>& lights)
 			{
 				// Check if this lights even needs an update
 				bool needsUpdate = ((D3D11PointLight *)(*itv)->LightShadowBuffers)->NeedsUpdate();
-				bool wantsUpdate = ((D3D11PointLight *)(*itv)->LightShadowBuffers)->WantsUpdate();
 
-				// Add to the updatequeue if it does
+				// Queue it if it does. The forced flag (NPCs moving around, for example) stays with the queued update.
 				if(needsUpdate || (*itv)->UpdateShadows)
-				{
-					// Always update the light if the light itself moved
-					if(partialShadowUpdate && !needsUpdate)
-					{
-						// Only add once. This list should never be very big, so it should be ok to search it like this
-						// This needs to be done to make sure a light will get updated only once and won't block the queue
-						if(std::find(FrameShadowUpdateLights.begin(), FrameShadowUpdateLights.end(), (*itv)) == FrameShadowUpdateLights.end())
-						{
-							// Always render the closest light to the playervob, so the player doesn't flicker when moving
-							float d = D3DXVec3LengthSq(&((*itv)->Vob->GetPositionWorld() - playerPosition));
-
-							float range = (*itv)->Vob->GetLightRange();
-							if(d < range * range && importantUpdates.size() < MAX_IMPORTANT_LIGHT_UPDATES)
-							{
-								importantUpdates.push_back((*itv));
-							}else
-							{
-								FrameShadowUpdateLights.push_back((*itv));
-							}
-						}
-					}else
-					{
-						// Always render the closest light to the playervob, so the player doesn't flicker when moving
-						float d = D3DXVec3LengthSq(&((*itv)->Vob->GetPositionWorld() - playerPosition));
+					ShadowUpdates->RequestUpdate((*itv), (*itv)->UpdateShadows);
 
-						float range = (*itv)->Vob->GetLightRange() * 1.5f;
-
-						// If the engine said this light should be updated, then do so. If the light said this
-						if(needsUpdate || d < range * range)
-							importantUpdates.push_back((*itv));
-					}
-				}
+				(*itv)->UpdateShadows = false;
 			}
 		}
 
-		//FrameShadowUpdateLights.sort();
-		//FrameShadowUpdateLights.unique();
-
-		// Render the closest light
-		for(auto it = importantUpdates.begin(); it != importantUpdates.end();it++)
-		{
-			((D3D11PointLight *)(*it)->LightShadowBuffers)->RenderCubemap((*it)->UpdateShadows);
-			(*it)->UpdateShadows = false;
-		}
-		
-		// Update only a fraction of lights, but at least some
-		int n = std::max((UINT)NUM_MIN_FRAME_SHADOW_UPDATES, (UINT)(FrameShadowUpdateLights.size() / NUM_FRAME_SHADOW_UPDATES));
-		while(!FrameShadowUpdateLights.empty())
-		{
-			D3D11PointLight* l = (D3D11PointLight *)FrameShadowUpdateLights.front()->LightShadowBuffers;
-			
-			// Check if we have to force this light to update itself (NPCs moving around, for example)
-			bool force = FrameShadowUpdateLights.front()->UpdateShadows;
-			FrameShadowUpdateLights.front()->UpdateShadows = false;
-
-			l->RenderCubemap(force);
-			DebugPointlight = l;
-
-			FrameShadowUpdateLights.pop_front();
-
-			// Only update n lights
-			n--;
-			if(n <= 0)
-				break;
-		}
+		// Update the most important lights until the budget is used up
+		float budget = partialShadowUpdate ? Engine::GAPI->GetRendererState()->RendererSettings.ShadowUpdateBudgetMS : FLT_MAX;
+		ShadowUpdates->Update(cameraPosition, budget);
 	}
 
 	// Get shadow direction, but don't update every frame, to get around flickering
@@ -4291,7 +4354,7 @@ XRESULT D3D11GraphicsEngine::DrawLighting(std::vector<VobLightInfo*>& lights)
 
 	// Get the section we are currently in
 	INT2 cameraSection = WorldConverter::GetSectionOfPos(WorldShadowCP);
-	WorldMeshSectionInfo& section = Engine::GAPI->GetWorldSections()[cameraSection.x][cameraSection.y];
+	WorldMeshSectionInfo& section = Engine::GAPI->GetWorldSections().GetSection(cameraSection.x, cameraSection.y);
 	D3DXVECTOR3 p = WorldShadowCP;
 	// Set the camera height to the highest point in this section
 	//p.y = 0;
@@ -4380,8 +4443,11 @@ XRESULT D3D11GraphicsEngine::DrawLighting(std::vector<VobLightInfo*>& lights)
 
 	bool lastOutside = true;
 
+	if(clustered)
+		DrawClusteredLighting();
+
 	// Draw all lights
-	for(std::vector<VobLightInfo*>::iterator itv = lights.begin(); itv != lights.end();itv++)
+	for(std::vector<VobLightInfo*>::iterator itv = lights.begin(); !clustered && itv != lights.end();itv++)
 	{
 		zCVobLight* vob = (*itv)->Vob;
 
@@ -4391,15 +4457,23 @@ XRESULT D3D11GraphicsEngine::DrawLighting(std::vector<VobLightInfo*>& lights)
 		if(!vob->IsEnabled())
 			continue;
 
+		// Lights whose cube got evicted from the pool go without shadows until they are redrawn
+		D3D11PointLight* shadowLight = NULL;
+		if(Engine::GAPI->GetRendererState()->RendererSettings.EnablePointlightShadows > 0 && (*itv)->LightShadowBuffers)
+		{
+			if(((D3D11PointLight *)(*itv)->LightShadowBuffers)->IsShadowResident())
+				shadowLight = (D3D11PointLight *)(*itv)->LightShadowBuffers;
+		}
+
 		// Set right shader
 		if(Engine::GAPI->GetRendererState()->RendererSettings.EnablePointlightShadows > 0)
 		{
-			if((*itv)->LightShadowBuffers && ActivePS != psPointLightDynShadow)
+			if(shadowLight && ActivePS != psPointLightDynShadow)
 			{
 				// Need to update shader for shadowed pointlight
 				ActivePS = psPointLightDynShadow;
 				ActivePS->Apply();
-			}else if(!(*itv)->LightShadowBuffers && ActivePS != psPointLight)
+			}else if(!shadowLight && ActivePS != psPointLight)
 			{
 				// Need to update shader for usual pointlight
 				ActivePS = psPointLight;
@@ -4477,17 +4551,16 @@ XRESULT D3D11GraphicsEngine::DrawLighting(std::vector<VobLightInfo*>& lights)
 		plcb.PL_LightScreenPos.x = plcb.PL_LightScreenPos.x/2.0f +0.5f;
 		plcb.PL_LightScreenPos.y = plcb.PL_LightScreenPos.y/-2.0f +0.5f;
 
+		plcb.PL_ShadowCubeIndex = shadowLight ? (float)shadowLight->GetShadowCubeIndex() : 0.0f;
+
 		// Apply the constantbuffer to vs and PS
 		ActivePS->GetConstantBuffer()[0]->UpdateBuffer(&plcb);
 		ActivePS->GetConstantBuffer()[0]->BindToPixelShader(0);
 		ActivePS->GetConstantBuffer()[0]->BindToVertexShader(1); // Bind this instead of the usual per-instance buffer
 
-		if(Engine::GAPI->GetRendererState()->RendererSettings.EnablePointlightShadows > 0)
-		{
-			// Bind shadowmap, if possible
-			if((*itv)->LightShadowBuffers)
-				((D3D11PointLight *)(*itv)->LightShadowBuffers)->OnRenderLight();
-		}
+		// Bind shadowmap, if possible
+		if(shadowLight)
+			shadowLight->OnRenderLight();
 
 		// Draw the mesh
 		InverseUnitSphereMesh->DrawMesh();
@@ -4627,13 +4700,16 @@ XRESULT D3D11GraphicsEngine::DrawLighting(std::vector<VobLightInfo*>& lights)
 /** Renders the shadowmaps for a pointlight */
 void D3D11GraphicsEngine::RenderShadowCube(const D3DXVECTOR3& position, 
 										   float range, 
-										   RenderToDepthStencilBuffer* targetCube, 
+										   ID3D11DepthStencilView* targetCube, 
+										   UINT cubeSize,
 										   ID3D11DepthStencilView* face, 
 										   ID3D11RenderTargetView* debugRTV, 
 										   bool cullFront,
 										   bool indoor,
 										   bool noNPCs,
-										   std::list<VobInfo*>* renderedVobs, std::list<SkeletalVobInfo*>* renderedMobs, std::map<MeshKey, WorldMeshInfo*, cmpMeshKey>* worldMeshCache)
+										   std::list<VobInfo*>* renderedVobs, std::list<SkeletalVobInfo*>* renderedMobs, std::map<MeshKey, WorldMeshInfo*, cmpMeshKey>* worldMeshCache,
+										   bool onlyDynamic,
+										   float cacheRange)
 {
 	D3D11_VIEWPORT oldVP;
 	UINT n = 1;
@@ -4645,8 +4721,8 @@ void D3D11GraphicsEngine::RenderShadowCube(const D3DXVECTOR3& position,
 	vp.TopLeftY = 0;
 	vp.MinDepth = 0.0f;
 	vp.MaxDepth = 1.0f;
-	vp.Width = (float)targetCube->GetSizeX();
-	vp.Height = (float)targetCube->GetSizeX();
+	vp.Width = (float)cubeSize;
+	vp.Height = (float)cubeSize;
 	
 	Context->RSSetViewports(1, &vp);
 
@@ -4655,9 +4731,14 @@ void D3D11GraphicsEngine::RenderShadowCube(const D3DXVECTOR3& position,
 		// Set cubemap shader
 		SetActiveGShader("GS_Cubemap");
 		ActiveGS->Apply();
-		face = targetCube->GetDepthStencilView();
+		face = targetCube;
 
 		SetActiveVertexShader("VS_ExCube");
+
+		// Start out with all faces, the casters narrow it down
+		RenderingFullCube = true;
+		CubeFaceMask = 0;
+		SetCubeFaceMask(Toolbox::CUBEFACE_MASK_ALL);
 	}
 
 	// Set the rendering stage
@@ -4693,10 +4774,12 @@ void D3D11GraphicsEngine::RenderShadowCube(const D3DXVECTOR3& position,
 	if (Engine::GAPI->GetRendererState()->RendererSettings.DrawShadowGeometry &&
 		Engine::GAPI->GetRendererState()->RendererSettings.EnableShadows)
 	{
-		Context->ClearDepthStencilView(face, D3D11_CLEAR_DEPTH, 1.0f, 0);
+		// Dynamic casters go on top of what is already in the cube
+		if(!onlyDynamic)
+			Context->ClearDepthStencilView(face, D3D11_CLEAR_DEPTH, 1.0f, 0);
 
 		// Draw the world mesh without textures
-		DrawWorldAround(position, range, cullFront, indoor, noNPCs, renderedVobs, renderedMobs, worldMeshCache);
+		DrawWorldAround(position, range, cullFront, indoor, noNPCs, renderedVobs, renderedMobs, worldMeshCache, onlyDynamic, cacheRange);
 	}else
 	{
 		if(Engine::GAPI->GetSky()->GetAtmoshpereSettings().LightDirection.y <= 0)
@@ -4713,12 +4796,27 @@ void D3D11GraphicsEngine::RenderShadowCube(const D3DXVECTOR3& position,
 	Context->RSSetViewports(1, &oldVP);
 	Context->GSSetShader(NULL, NULL, NULL);
 	SetActiveVertexShader("VS_Ex");
+	RenderingFullCube = false;
 
 	Engine::GAPI->SetFarPlane(Engine::GAPI->GetRendererState()->RendererSettings.SectionDrawRadius * WORLD_SECTION_SIZE);
 
 	SetRenderingStage(DES_MAIN);
 }
 
+/** Sets which faces of the shadow-cube being rendered the next drawcalls can be seen in */
+void D3D11GraphicsEngine::SetCubeFaceMask(UINT mask)
+{
+	if(!RenderingFullCube || mask == CubeFaceMask)
+		return;
+
+	CubeFaceMask = mask;
+
+	CubemapFaceMaskConstantBuffer cb;
+	cb.PCD_FaceMask = mask;
+	ActiveGS->GetConstantBuffer()[1]->UpdateBuffer(&cb);
+	ActiveGS->GetConstantBuffer()[1]->BindToGeometryShader(3);
+}
+
 /** Renders the shadowmaps for the sun */
 void D3D11GraphicsEngine::RenderShadowmaps(const D3DXVECTOR3& cameraPosition, RenderToDepthStencilBuffer* target, bool cullFront, bool dontCull, ID3D11DepthStencilView* dsvOverwrite, ID3D11RenderTargetView* debugRTV)
 {
@@ -5139,48 +5237,50 @@ void D3D11GraphicsEngine::GetBackbufferData(byte** data, int& pixelsize)
 	
 	HRESULT hr;
 
-	// Buffer for scaling down the image
-	RenderToTextureBuffer* rt = new RenderToTextureBuffer(Device, 256, 256, DXGI_FORMAT_R8G8B8A8_UNORM);
+	// Buffer for scaling down the image. Gothic transforms the backbufferdata for savegamethumbs to 256x256-pictures anyways.
+	if(!ThumbnailBuffer)
+	{
+		ThumbnailBuffer = new RenderToTextureBuffer(Device, 256, 256, DXGI_FORMAT_R8G8B8A8_UNORM);
+
+		CD3D11_TEXTURE2D_DESC texDesc(DXGI_FORMAT_R8G8B8A8_UNORM, 256, 256, 1, 1, 0, D3D11_USAGE_STAGING, D3D11_CPU_ACCESS_READ);
+		LE(Device->CreateTexture2D(&texDesc, 0, &ThumbnailStagingTexture));
+	}
 
 	// Downscale to 256x256
-	PfxRenderer->CopyTextureToRTV(HDRBackBuffer->GetShaderResView(), rt->GetRenderTargetView(), INT2(256,256), true);
-
-	D3D11_TEXTURE2D_DESC texDesc;
-	texDesc.ArraySize = 1;
-	texDesc.BindFlags = 0;
-	texDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
-	texDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-	texDesc.Width = 256; // Gothic transforms the backbufferdata for savegamethumbs to 256x256-pictures anyways
-	texDesc.Height = 256;
-	texDesc.MipLevels = 1;
-	texDesc.MiscFlags = 0;
-	texDesc.SampleDesc.Count = 1;
-	texDesc.SampleDesc.Quality = 0;
-	texDesc.Usage = D3D11_USAGE_STAGING;
-
-	ID3D11Texture2D *texture;
-	LE(Device->CreateTexture2D(&texDesc, 0, &texture));
-	Context->CopyResource(texture, rt->GetTexture());
-
-	// Get data
+	PfxRenderer->CopyTextureToRTV(HDRBackBuffer->GetShaderResView(), ThumbnailBuffer->GetRenderTargetView(), INT2(256,256), true);
+
+	Context->CopyResource(ThumbnailStagingTexture, ThumbnailBuffer->GetTexture());
+
+	// Get data. Gothic needs it right now, so this one still waits for the GPU. It's only 256KB, though.
 	D3D11_MAPPED_SUBRESOURCE res;
-	if(SUCCEEDED(Context->Map(texture, 0, D3D11_MAP_READ, 0, &res)))
+	if(SUCCEEDED(Context->Map(ThumbnailStagingTexture, 0, D3D11_MAP_READ, 0, &res)))
 	{
-		memcpy(d, res.pData, 256 * 256 * 4);
-		Context->Unmap(texture, 0);
+		for(int y=0;y<256;y++)
+			memcpy(d + y * 256 * 4, (unsigned char*)res.pData + y * res.RowPitch, 256 * 4);
+
+		Context->Unmap(ThumbnailStagingTexture, 0);
 	}
 
 	pixelsize = 4;
 	*data = d;
-
-	texture->Release();
-	delete rt;
 }
 
 /** Binds the right shader for the given texture */
 void D3D11GraphicsEngine::BindShaderForTexture(zCTexture* texture, bool forceAlphaTest, int zMatAlphaFunc)
 {
-	D3D11PShader* active = ActivePS;
+	D3D11PShader* newShader = GetShaderForTexture(texture, forceAlphaTest, zMatAlphaFunc);
+
+	// Bind, if changed
+	if(ActivePS != newShader)
+	{
+		ActivePS = newShader;
+		ActivePS->Apply();
+	}
+}
+
+/** Returns the right shader for the given texture, without binding it */
+D3D11PShader* D3D11GraphicsEngine::GetShaderForTexture(zCTexture* texture, bool forceAlphaTest, int zMatAlphaFunc)
+{
 	D3D11PShader* newShader = ActivePS;
 
 	bool blendAdd = zMatAlphaFunc == zMAT_ALPHA_FUNC_ADD;
@@ -5227,12 +5327,169 @@ void D3D11GraphicsEngine::BindShaderForTexture(zCTexture* texture, bool forceAlp
 		//}
 	}
 
-	// Bind, if changed
-	if(active != newShader)
+	return newShader;
+}
+
+/** Gets diffuse-, normal- and fx-map of the given surface. Puts in a default normalmap if there is none. */
+void D3D11GraphicsEngine::GetMaterialTextureViews(MyDirectDrawSurface7* surface, MaterialInfo* info, ID3D11ShaderResourceView** srv)
+{
+	srv[0] = ((D3D11Texture *)surface->GetEngineTexture())->GetShaderResourceView();
+	srv[1] = surface->GetNormalmap() ? ((D3D11Texture *)surface->GetNormalmap())->GetShaderResourceView() : NULL;
+	srv[2] = surface->GetFxMap() ? ((D3D11Texture *)surface->GetFxMap())->GetShaderResourceView() : NULL;
+
+	// Bind a default normalmap in case the scene is wet and we currently have none
+	if(!srv[1])
 	{
-		ActivePS = newShader;
-		ActivePS->Apply();
+		// Modify the strength of that default normalmap for the material info
+		if(info->buffer.NormalmapStrength != DEFAULT_NORMALMAP_STRENGTH)
+		{
+			info->buffer.NormalmapStrength = DEFAULT_NORMALMAP_STRENGTH;
+			info->UpdateConstantbuffer();
+		}
+		srv[1] = ((D3D11Texture*)DistortionTexture)->GetShaderResourceView();
+	}
+}
+
+/** Groups the given vobs by their visual and appends their instance-slots to the remap-buffer.
+	With selectLODs, vobs which are small on screen go into extra batches for the LODs of their visual. */
+void D3D11GraphicsEngine::BatchVobInstances(const std::vector<VobInfo*>& vobs, std::vector<VobInstanceBatch>& batches, bool selectLODs)
+{
+	static std::vector<VobInstanceRemapInfo> s_Remaps;
+	static std::vector<unsigned char> s_LODs;
+	batches.resize(0);
+	s_LODs.assign(vobs.size(), 0);
+
+	// Size in pixels of something with size 1 at distance 1
+	GothicRendererSettings& settings = Engine::GAPI->GetRendererState()->RendererSettings;
+	selectLODs = selectLODs && settings.EnableVobLODs;
+	float pixelScale = Engine::GAPI->GetProjectionMatrix()._22 * 0.5f * GetResolution().y;
+	D3DXVECTOR3 camPos = Engine::GAPI->GetCameraPosition();
+
+	// Count the instances per visual. Visuals without visible vobs are never touched.
+	for(unsigned int i=0;i<vobs.size();i++)
+	{
+		MeshVisualInfo* visual = (MeshVisualInfo *)vobs[i]->VisualInfo;
+		if(!visual || vobs[i]->InstanceSlot == VOB_INSTANCE_NO_SLOT)
+			continue;
+
+		unsigned int lod = 0;
+		if(selectLODs && visual->NumLODs > 1)
+		{
+			float dist = D3DXVec3Length(&(vobs[i]->LastRenderPosition - camPos));
+			float screenSize = dist > 0.0f ? visual->MeshSize * pixelScale / dist : FLT_MAX;
+			float threshold = settings.VobLODScreenSize;
+			while(lod + 1 < visual->NumLODs && screenSize < threshold)
+			{
+				lod++;
+				threshold *= 0.5f;
+			}
+
+			s_LODs[i] = lod;
+		}
+
+		if(visual->InstanceBatch[lod] == VOB_INSTANCE_NO_SLOT)
+		{
+			visual->InstanceBatch[lod] = batches.size();
+
+			VobInstanceBatch batch;
+			batch.Visual = visual;
+			batch.LOD = lod;
+			batch.StartInstance = 0;
+			batch.NumInstances = 0;
+			batches.push_back(batch);
+		}
+
+		batches[visual->InstanceBatch[lod]].NumInstances++;
+	}
+
+	unsigned int numInstances = 0;
+	for(unsigned int i=0;i<batches.size();i++)
+	{
+		if(batches[i].LOD)
+			Engine::GAPI->GetRendererState()->RendererInfo.FrameVobLODInstances += batches[i].NumInstances;
+
+		batches[i].StartInstance = numInstances;
+		numInstances += batches[i].NumInstances;
+		batches[i].NumInstances = 0;
 	}
+
+	// Put the slots in place, same order as the vobs
+	s_Remaps.resize(numInstances);
+	for(unsigned int i=0;i<vobs.size();i++)
+	{
+		MeshVisualInfo* visual = (MeshVisualInfo *)vobs[i]->VisualInfo;
+		if(!visual || vobs[i]->InstanceSlot == VOB_INSTANCE_NO_SLOT)
+			continue;
+
+		VobInstanceBatch& batch = batches[visual->InstanceBatch[s_LODs[i]]];
+		s_Remaps[batch.StartInstance + batch.NumInstances].InstanceRemapIndex = vobs[i]->InstanceSlot;
+		batch.NumInstances++;
+	}
+
+	// Let the visuals be grouped again
+	for(unsigned int i=0;i<batches.size();i++)
+		batches[i].Visual->StartNewFrame();
+
+	if(!numInstances)
+		return;
+
+	unsigned int start = Engine::GAPI->GetVobInstanceStore().AppendRemaps(&s_Remaps[0], numInstances);
+	for(unsigned int i=0;i<batches.size();i++)
+		batches[i].StartInstance += start;
+}
+
+/** Sorts and draws the packets of the given queue */
+void D3D11GraphicsEngine::SubmitRenderQueue(RenderQueue& queue, EPNAENRenderMode tesselationMode)
+{
+	queue.Sort();
+
+	// Whatever ran before us bound its own things
+	StateCache->Invalidate();
+
+	D3D11VShader* vs = ActiveVS;
+	bool tesselated = false;
+	unsigned int maxIndices = Engine::GAPI->GetRendererState()->RendererSettings.MaxNumFaces * 3;
+	for(unsigned int i=0;i<queue.Size();i++)
+	{
+		const RenderQueuePacket& packet = queue.GetPacket(i);
+
+		if(!tesselated && queue.GetPass(i) == RQP_TESSELATED)
+		{
+			Setup_PNAEN(tesselationMode);
+			tesselated = true;
+		}
+
+		StateCache->BindPacket(packet, tesselated);
+
+		if(packet.NumInstances)
+		{
+			unsigned int numIndices = maxIndices != 0 ? std::min(packet.NumIndices, maxIndices) : packet.NumIndices;
+			StateBackend->DrawIndexedInstanced(numIndices, packet.NumInstances, packet.IndexOffset, packet.StartInstance);
+
+			Engine::GAPI->GetRendererState()->RendererInfo.FrameDrawnVobs++;
+		}else if(packet.NumIndices)
+		{
+			StateBackend->DrawIndexed(packet.NumIndices, packet.IndexOffset);
+
+			Engine::GAPI->GetRendererState()->RendererInfo.FrameDrawnTriangles += packet.NumIndices / 3;
+		}
+	}
+
+	// Leave the pipeline like the other draw-functions expect it
+	if(tesselated)
+	{
+		Context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+		Context->DSSetShader(NULL, NULL, NULL);
+		Context->HSSetShader(NULL, NULL, NULL);
+		ActiveHDS = NULL;
+		ActiveVS = vs;
+		ActiveVS->Apply();
+	}
+
+	if(StateCache->GetPixelShader())
+		ActivePS = StateCache->GetPixelShader();
+
+	queue.Clear();
 }
 
 /** Draws the given list of decals */
@@ -5525,6 +5782,8 @@ void D3D11GraphicsEngine::Setup_PNAEN(EPNAENRenderMode mode)
 
 	if(mode == PNAEN_Instanced)
 		SetActiveVertexShader("VS_PNAEN_Instanced");
+	else if(mode == PNAEN_RemapInstanced)
+		SetActiveVertexShader("VS_PNAEN_RemapInstanced");
 	else if(mode == PNAEN_Default)
 		SetActiveVertexShader("VS_PNAEN");
 	else if(mode == PNAEN_Skeletal)
@@ -5555,7 +5814,7 @@ void D3D11GraphicsEngine::Setup_PNAEN(EPNAENRenderMode mode)
 }
 
 /** Draws particle effects */
-void D3D11GraphicsEngine::DrawFrameParticles(std::map<zCTexture*, std::vector<ParticleInstanceInfo>>& particles, std::map<zCTexture*, ParticleRenderInfo>& info)
+void D3D11GraphicsEngine::DrawFrameParticles(ParticleFrameBuilder& particles)
 {
 	SetDefaultStates();
 
@@ -5594,27 +5853,8 @@ void D3D11GraphicsEngine::DrawFrameParticles(std::map<zCTexture*, std::vector<Pa
 	state.RasterizerState.CullMode = GothicRasterizerStateInfo::CM_CULL_NONE;
 	state.RasterizerState.SetDirty();
 
-	std::vector<std::tuple<zCTexture*, ParticleRenderInfo*, std::vector<ParticleInstanceInfo>*>> pvec;
-	for(std::map<zCTexture*, std::vector<ParticleInstanceInfo>>::iterator it = particles.begin(); it != particles.end();it++)
-	{
-		if((*it).second.empty())
-			continue;
-		
-		pvec.push_back(std::make_tuple((*it).first, &info[(*it).first], &(*it).second));
-	}
-
-	struct cmp
-	{
-		static bool cmppt(const std::tuple<zCTexture*, ParticleRenderInfo*, std::vector<ParticleInstanceInfo>*>& a,
-						  const std::tuple<zCTexture*, ParticleRenderInfo*, std::vector<ParticleInstanceInfo>*>& b)
-		{
-			// Sort additive before blend
-			return std::get<1>(a)->BlendMode > std::get<1>(b)->BlendMode;
-		}
-	};
-
-	// Sort additive before blend
-	std::sort(pvec.begin(), pvec.end(), cmp::cmppt);
+	// The ranges already come sorted additive before blend
+	const std::vector<ParticleDrawRange>& ranges = particles.GetDrawRanges();
 
 	SetActivePixelShader("PS_ParticleDistortion");
 	ActivePS->Apply();
@@ -5643,14 +5883,15 @@ void D3D11GraphicsEngine::DrawFrameParticles(std::map<zCTexture*, std::vector<Pa
 
 	UpdateRenderStates();
 
-	for(auto it = pvec.begin();it!=pvec.end();it++)
-	{
-		zCTexture* tx = std::get<0>((*it));
-		ParticleRenderInfo& info = *std::get<1>((*it));
-		std::vector<ParticleInstanceInfo>& instances = *std::get<2>((*it));
+	UINT offset = 0;
+	UINT stride = sizeof(ParticleInstanceInfo);
+	ID3D11Buffer* instanceBuffer = ranges.empty() ? NULL : particles.GetInstanceBuffer()->GetVertexBuffer();
+	Context->IASetVertexBuffers(0, 1, &instanceBuffer, &stride, &offset);
 
-		if(instances.empty())
-			continue;
+	for(auto it = ranges.begin();it!=ranges.end();it++)
+	{
+		zCTexture* tx = (*it).Texture;
+		const ParticleRenderInfo& info = (*it).Info;
 
 		if(tx)
 		{
@@ -5661,7 +5902,7 @@ void D3D11GraphicsEngine::DrawFrameParticles(std::map<zCTexture*, std::vector<Pa
 				continue;
 		}
 
-		GothicBlendStateInfo& blendState = info.BlendState;
+		const GothicBlendStateInfo& blendState = info.BlendState;
 
 		// This only happens once or twice, since the input list is sorted
 		if(info.BlendMode != lastBlendMode)
@@ -5690,24 +5931,9 @@ void D3D11GraphicsEngine::DrawFrameParticles(std::map<zCTexture*, std::vector<Pa
 			}
 		}
 
-		// Push data for the particles to the GPU
-		D3D11_BUFFER_DESC desc;
-		((D3D11VertexBuffer *)TempVertexBuffer)->GetVertexBuffer()->GetDesc(&desc);
-
-		if(desc.ByteWidth < sizeof(ParticleInstanceInfo) * instances.size())
-		{
-			LogInfo() << "(PARTICLE) TempVertexBuffer too small (" << desc.ByteWidth << "), need " << sizeof(ParticleInstanceInfo) * instances.size() << " bytes. Recreating buffer.";
-
-			// Buffer too small, recreate it
-			delete TempVertexBuffer;
-			TempVertexBuffer = new D3D11VertexBuffer();
-
-			TempVertexBuffer->Init(NULL, sizeof(ParticleInstanceInfo) * instances.size(), D3D11VertexBuffer::B_VERTEXBUFFER, D3D11VertexBuffer::U_DYNAMIC, D3D11VertexBuffer::CA_WRITE);
-		}
-
-		TempVertexBuffer->UpdateBuffer(&instances[0], sizeof(ParticleInstanceInfo) * instances.size());
-		
-		DrawVertexBuffer(TempVertexBuffer, instances.size(), sizeof(ParticleInstanceInfo));
+		// All particles are in one buffer already
+		Context->Draw((*it).Count, (*it).First);
+		Engine::GAPI->GetRendererState()->RendererInfo.FrameDrawnTriangles += (*it).Count;
 	}
 
 	Context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
@@ -5743,14 +5969,7 @@ XRESULT D3D11GraphicsEngine::OnVobRemovedFromWorld(zCVob* vob)
 
 	
 	// Take out of shadowupdate queue
-	for(auto it = FrameShadowUpdateLights.begin();it!=FrameShadowUpdateLights.end();it++)
-	{
-		if((*it)->Vob == vob)
-		{
-			FrameShadowUpdateLights.erase(it);
-			break;
-		}
-	}
+	ShadowUpdates->RemoveLight(vob);
 
 	DebugPointlight = NULL;
 
@@ -5791,30 +6010,11 @@ void D3D11GraphicsEngine::UpdateOcclusion()
 /** Saves a screenshot */
 void D3D11GraphicsEngine::SaveScreenshot()
 {
-	HRESULT hr;
-
-	// Buffer for scaling down the image
-	RenderToTextureBuffer* rt = new RenderToTextureBuffer(Device, Resolution.x, Resolution.y, DXGI_FORMAT_R8G8B8A8_UNORM);
+	if(!ScreenshotBuffer)
+		ScreenshotBuffer = new RenderToTextureBuffer(Device, Resolution.x, Resolution.y, DXGI_FORMAT_R8G8B8A8_UNORM);
 
-	// Downscale to 256x256
-	PfxRenderer->CopyTextureToRTV(HDRBackBuffer->GetShaderResView(), rt->GetRenderTargetView());
-
-	D3D11_TEXTURE2D_DESC texDesc;
-	texDesc.ArraySize = 1;
-	texDesc.BindFlags = 0;
-	texDesc.CPUAccessFlags = 0;
-	texDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-	texDesc.Width = Resolution.x;  // must be same as backbuffer
-	texDesc.Height = Resolution.y; // must be same as backbuffer
-	texDesc.MipLevels = 1;
-	texDesc.MiscFlags = 0;
-	texDesc.SampleDesc.Count = 1;
-	texDesc.SampleDesc.Quality = 0;
-	texDesc.Usage = D3D11_USAGE_DEFAULT;
-
-	ID3D11Texture2D *texture;
-	LE(Device->CreateTexture2D(&texDesc, 0, &texture));
-	Context->CopyResource(texture, rt->GetTexture());
+	// Resolve the HDR-buffer, the readback ring takes a copy of this
+	PfxRenderer->CopyTextureToRTV(HDRBackBuffer->GetShaderResView(), ScreenshotBuffer->GetRenderTargetView());
 
 	char date[50];
 	char time[50];
@@ -5826,14 +6026,24 @@ void D3D11GraphicsEngine::SaveScreenshot()
 	// Create new folder if needed
 	CreateDirectory("system\\Screenshots", NULL);
 
-	std::string name = "system\\screenshots\\G2D3D11_" + std::string(date) + "__" + std::string(time) + ".jpg";
+	std::string name = "system\\screenshots\\G2D3D11_" + std::string(date) + "__" + std::string(time) + ".png";
 
-	LogInfo() << "Saving screenshot to: " << name;
+	// The pixels arrive a few frames later on a worker thread, encode them right there
+	XRESULT xr = ReadbackRing->QueueReadback(ScreenshotBuffer->GetTexture(), [name](std::vector<unsigned char>& rgba, INT2 size)
+	{
+		// Alpha of the HDR-buffer has nothing to do with the picture
+		for(unsigned int i=3;i<rgba.size();i+=4)
+			rgba[i] = 255;
 
-	LE( D3DX11SaveTextureToFile(Context, texture, D3DX11_IFF_JPG, name.c_str()) );
-	texture->Release();
+		unsigned int error = lodepng::encode(name, rgba, size.x, size.y);
+		if(error)
+			LogWarn() << "Failed to save screenshot " << name << ": " << lodepng_error_text(error);
+		else
+			LogInfo() << "Saved screenshot to: " << name;
+	});
 
-	delete rt;
+	if(XR_SUCCESS != xr)
+		return;
 
 	// Inform the user that a screenshot has been taken
 	Engine::GAPI->PrintMessageTimed(INT2(30,30), "Screenshot taken: " + name);
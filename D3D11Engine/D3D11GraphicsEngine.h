@@ -1,5 +1,8 @@
 #pragma once
 #include "D3D11GraphicsEngineBase.h"
+#include "RenderQueue.h"
+#include "BatchCulling.h"
+#include "ConstantBufferStructs.h"
 
 struct RenderToDepthStencilBuffer;
 
@@ -21,6 +24,9 @@ const int INSTANCING_BUFFER_SIZE = sizeof(VobInstanceInfo) * 2048;
 
 const int POINTLIGHT_SHADOWMAP_SIZE = 64;
 
+/** Number of frames averaged for each log-line in headless mode */
+const int HEADLESS_REPORT_FRAMES = 300;
+
 class D3D11PointLight;
 class D3D11VShader;
 class D3D11PShader;
@@ -34,9 +40,26 @@ class GMesh;
 class GOcean;
 class D3D11HDShader;
 class D3D11OcclusionQuerry;
+class D3D11ReadbackRing;
+class D3D11ShadowUpdateScheduler;
+class D3D11ShadowCubePool;
+class LightClusterBinner;
 struct MeshInfo;
 struct RenderToTextureBuffer;
 class D3D11Effect;
+class MyDirectDrawSurface7;
+struct MaterialInfo;
+struct MeshVisualInfo;
+
+/** Visible vobs of one visual and LOD, as range in the remap-buffer of the VobInstanceStore */
+struct VobInstanceBatch
+{
+	MeshVisualInfo* Visual;
+	unsigned int LOD;
+	unsigned int StartInstance;
+	unsigned int NumInstances;
+};
+
 class D3D11GraphicsEngine : public D3D11GraphicsEngineBase
 {
 public:
@@ -107,6 +130,7 @@ public:
 	{
 		PNAEN_Default,
 		PNAEN_Instanced,
+		PNAEN_RemapInstanced,
 		PNAEN_Skeletal,
 
 	};
@@ -203,7 +227,9 @@ public:
 					     bool cullFront = true, 
 						 bool indoor = false,
 						 bool noNPCs = false,
-					     std::list<VobInfo*>* renderedVobs = NULL, std::list<SkeletalVobInfo*>* renderedMobs = NULL, std::map<MeshKey, WorldMeshInfo*, cmpMeshKey>* worldMeshCache = NULL);
+					     std::list<VobInfo*>* renderedVobs = NULL, std::list<SkeletalVobInfo*>* renderedMobs = NULL, std::map<MeshKey, WorldMeshInfo*, cmpMeshKey>* worldMeshCache = NULL,
+						 bool onlyDynamic = false,
+						 float cacheRange = 0.0f);
 					     
 	/** Draws the static vobs instanced */
 	XRESULT DrawVOBsInstanced();
@@ -211,6 +237,12 @@ public:
 	/** Applys the lighting to the scene */
 	XRESULT DrawLighting(std::vector<VobLightInfo*>& lights);
 
+	/** Collects the visible pointlights and starts binning them into the clusters of the camera on the worker-threads */
+	void BeginClusteredLighting(std::vector<VobLightInfo*>& lights);
+
+	/** Waits for the binning and draws all pointlights in a single full-screen pass */
+	void DrawClusteredLighting();
+
 	/** Called when we started to render the world */
 	virtual XRESULT OnStartWorldRendering();
 
@@ -223,13 +255,19 @@ public:
 	/** Renders the shadowmaps for a pointlight */
 	void RenderShadowCube(const D3DXVECTOR3& position, 
 		float range, 
-		RenderToDepthStencilBuffer* targetCube, 
+		ID3D11DepthStencilView* targetCube, 
+		UINT cubeSize,
 		ID3D11DepthStencilView* face,
 		ID3D11RenderTargetView* debugRTV = NULL, 
 		bool cullFront = true, 
 		bool indoor = false,
 		bool noNPCs = false,
-		std::list<VobInfo*>* renderedVobs = NULL, std::list<SkeletalVobInfo*>* renderedMobs = NULL, std::map<MeshKey, WorldMeshInfo*, cmpMeshKey>* worldMeshCache = NULL); 
+		std::list<VobInfo*>* renderedVobs = NULL, std::list<SkeletalVobInfo*>* renderedMobs = NULL, std::map<MeshKey, WorldMeshInfo*, cmpMeshKey>* worldMeshCache = NULL,
+		bool onlyDynamic = false,
+		float cacheRange = 0.0f); 
+
+	/** Sets which faces of the shadow-cube being rendered the next drawcalls can be seen in. Does nothing outside of full cube-renders. */
+	void SetCubeFaceMask(UINT mask);
 
 	/** Updates the occlusion for the bsp-tree */
 	void UpdateOcclusion();
@@ -273,11 +311,14 @@ public:
 	/** Binds the right shader for the given texture */
 	void BindShaderForTexture(zCTexture* texture, bool forceAlphaTest=false, int zMatAlphaFunc = 0);
 
+	/** Returns the right shader for the given texture, without binding it */
+	D3D11PShader* GetShaderForTexture(zCTexture* texture, bool forceAlphaTest=false, int zMatAlphaFunc = 0);
+
 	/** Copies the depth stencil buffer to DepthStencilBufferCopy */
 	void CopyDepthStencil();
 
 	/** Draws particle effects */
-	void DrawFrameParticles(std::map<zCTexture*, std::vector<ParticleInstanceInfo>>& particles, std::map<zCTexture*, ParticleRenderInfo>& info);
+	void DrawFrameParticles(ParticleFrameBuilder& particles);
 
 	/** Returns the UI-View */
 	D2DView* GetUIView(){return UIView;}
@@ -287,14 +328,48 @@ public:
 
 	/** Returns a dummy cube-rendertarget used for pointlight shadowmaps */
 	RenderToTextureBuffer* GetDummyCubeRT(){return DummyShadowCubemapTexture;}
+
+	/** Returns the pool the pointlight shadow-cubes live in */
+	D3D11ShadowCubePool* GetShadowCubePool(){return ShadowCubes;}
+
+	/** Returns true if we run on a null-device without a window (-XHeadless) */
+	bool IsHeadless(){return Headless;}
 protected:
 	/** Test draw world */
 	void TestDrawWorldMesh();
 
+	/** Gets diffuse-, normal- and fx-map of the given surface. Puts in a default normalmap if there is none. */
+	void GetMaterialTextureViews(MyDirectDrawSurface7* surface, MaterialInfo* info, ID3D11ShaderResourceView** srv);
+
+	/** Groups the given vobs by their visual and appends their instance-slots to the remap-buffer. One batch per visual,
+		or per visual and LOD if selectLODs is set. */
+	void BatchVobInstances(const std::vector<VobInfo*>& vobs, std::vector<VobInstanceBatch>& batches, bool selectLODs = false);
+
+	/** Sorts and draws the packets of the given queue. Tesselated packets are drawn last, using the given mode. */
+	void SubmitRenderQueue(RenderQueue& queue, EPNAENRenderMode tesselationMode);
+
 	D3D11PointLight* DebugPointlight;
 
-	// Using a list here to determine which lights to update, since we don't want to update every light every frame.
-	std::list<VobLightInfo*> FrameShadowUpdateLights;
+	/** Decides which pointlight shadows to update, since we don't want to update every light every frame */
+	D3D11ShadowUpdateScheduler* ShadowUpdates;
+
+	/** Memory for the pointlight shadow-cubes. Lights only borrow their cubes from here. */
+	D3D11ShadowCubePool* ShadowCubes;
+
+	/** Sorts the pointlights into the clusters of the view, for the clustered lighting-pass */
+	LightClusterBinner* LightClusters;
+
+	/** View-space spheres of the lights being binned, matching ClusterLightData */
+	PointBatch ClusterLightSpheres;
+	std::vector<ClusteredPointLight> ClusterLightData;
+	std::vector<VobLightInfo*> ClusterLightVobs;
+
+	/** Structured buffers the clustered lighting-pass reads the lights and the cluster-lists from */
+	D3D11VertexBuffer* ClusterLightBuffer;
+	D3D11VertexBuffer* ClusterRangeBuffer;
+	D3D11VertexBuffer* ClusterIndexBuffer;
+	unsigned int ClusterLightCapacity;
+	unsigned int ClusterIndexCapacity;
 
 	/** D3D11 Objects */
 	ID3D11SamplerState* ClampSamplerState;
@@ -372,4 +447,50 @@ protected:
 
 	/** If true, we will save a screenshot after the next frame */
 	bool SaveScreenshotNextFrame;
+
+	/** Reads screenshots back a few frames late, so the GPU never has to be waited for */
+	D3D11ReadbackRing* ReadbackRing;
+
+	/** Buffer the screenshot is resolved to before it goes into the readback ring. Matches the resolution. */
+	RenderToTextureBuffer* ScreenshotBuffer;
+
+	/** Downscaled frame for savegame-thumbnails and the buffer it is mapped through. Kept around, so saving doesn't recreate them. */
+	RenderToTextureBuffer* ThumbnailBuffer;
+	ID3D11Texture2D* ThumbnailStagingTexture;
+
+	/** True while all faces of a shadow-cube are rendered at once through the geometry shader */
+	bool RenderingFullCube;
+
+	/** Face-mask currently bound to the cubemap geometry shader */
+	UINT CubeFaceMask;
+
+	/** Queue for the world- and vob-draws of a frame */
+	RenderQueue FrameRenderQueue;
+
+	/** Drops binds of the render-queue which wouldn't change anything */
+	RenderStateBackend* StateBackend;
+	RenderStateCache* StateCache;
+
+	/** Adds the numbers of this frame to the headless-report and logs it every HEADLESS_REPORT_FRAMES frames */
+	void UpdateHeadlessReport();
+
+	/** If true, the device is a null-device and nothing is presented. Only the CPU-side of the frames runs,
+		which is what we want to profile there. */
+	bool Headless;
+
+	/** Records the binds and draws of the render-queue when headless. Same object as StateBackend then. */
+	RecordingRenderStateBackend* RecordingBackend;
+
+	/** Sums of the frames since the last headless-report */
+	struct HeadlessReportInfo
+	{
+		unsigned int NumFrames;
+		float FrameMS;
+		float MaxFrameMS;
+		unsigned int Draws;
+		unsigned int DrawnVobs;
+		unsigned int StateChanges;
+		unsigned int RedundantStateChanges;
+		unsigned int BytesUploaded;
+	} HeadlessReport;
 };
\ No newline at end of file
@@ -98,7 +98,7 @@ XRESULT D3D11PShader::LoadShader(const char* pixelShader, std::vector<D3D10_SHAD
 	File = pixelShader;
 
 	// Compile shaders
-	if(FAILED(CompileShaderFromFile(pixelShader, "PSMain", "ps_4_0", &psBlob, makros)))
+	if(FAILED(CompileShaderFromFile(pixelShader, "PSMain", "ps_4_1", &psBlob, makros)))
 	{
 		return XR_FAILED;
 	}
@@ -8,9 +8,19 @@
 #include "BaseLineRenderer.h"
 #include "WorldConverter.h"
 #include "ThreadPool.h"
+#include "D3D11ShadowCubePool.h"
 
 const float LIGHT_COLORCHANGE_POS_MOD = 0.1f;
 
+/** Fraction of its range a light can move before its caster-caches have to be collected again */
+const float POINTLIGHT_CACHE_MARGIN = 0.25f;
+
+/** Returns the pool the shadow-cubes are borrowed from */
+static D3D11ShadowCubePool* GetShadowCubePool()
+{
+	return ((D3D11GraphicsEngine *)Engine::GraphicsEngine)->GetShadowCubePool(); // TODO: Remove and use newer system!
+}
+
 
 D3D11PointLight::D3D11PointLight(VobLightInfo* info, bool dynamicLight)
 {
@@ -20,13 +30,23 @@ D3D11PointLight::D3D11PointLight(VobLightInfo* info, bool dynamicLight)
 
 	LastUpdatePosition = LightInfo->Vob->GetPositionWorld();
 
-	DepthCubemap = NULL;
 	ViewMatricesCB = NULL;
+	StaticCubemapDirty = true;
+	StaticCasterRemoved = false;
+	UseDynamicCubemap = false;
+	StaticCasterTriangles = 0;
+	DynamicCasterTriangles = 0;
+	CacheCenter = LastUpdatePosition;
+	WorldCacheCenter = LastUpdatePosition;
+	WorldCacheInvalid = true;
 
 	if(!dynamicLight)
 	{
 		InitDone = false;
 
+		// The sections may change while the worker builds the cache
+		WorldConverter::WorldMeshGetRangeSources(LastUpdatePosition, Engine::GAPI->GetWorldSections(), InitWorldMeshSources);
+
 		// Add to queue
 		Engine::WorkerThreadPool->enqueue( [this]{ InitResources(); });
 
@@ -44,11 +64,25 @@ D3D11PointLight::~D3D11PointLight(void)
 	// Make sure we are out of the init-queue
 	while(!InitDone);
 
-	delete DepthCubemap;
+	// The worker could still be filling the pending cache
+	if(WorldCacheJob.valid())
+		WorldCacheJob.wait();
+
+	// Give the cubes back, so other lights can use them
+	D3D11ShadowCubePool* pool = GetShadowCubePool();
+	if(pool)
+	{
+		pool->Release(StaticCube);
+		pool->Release(DynamicCube);
+	}
+
 	delete ViewMatricesCB;
 
 	for(auto it=WorldMeshCache.begin();it!=WorldMeshCache.end();it++)
 		delete (*it).second;
+
+	for(auto it=PendingWorldMeshCache.begin();it!=PendingWorldMeshCache.end();it++)
+		delete (*it).second;
 }
 
 /** Returns true if this is the first time that light is being rendered */
@@ -57,6 +91,95 @@ bool D3D11PointLight::NotYetDrawn()
 	return !DrawnOnce;
 }
 
+/** Returns the number of triangles the next update would draw, estimated from the cached casters */
+unsigned int D3D11PointLight::EstimateUpdateTriangles()
+{
+	// Nothing was drawn yet or the cube got evicted, so all we know is the world-cache
+	if(NotYetDrawn() || !IsShadowResident())
+		return CountStaticCasterTriangles();
+
+	// Only the NPCs have to be drawn again if the light didn't move
+	unsigned int n = DynamicCasterTriangles;
+	if(NeedsUpdate())
+		n += StaticCasterTriangles;
+
+	return n;
+}
+
+/** Returns the number of triangles of the given meshes */
+static unsigned int GetMeshTriangleCount(const std::map<zCMaterial *, std::vector<MeshInfo*>>& meshes)
+{
+	unsigned int n = 0;
+	for(auto it = meshes.begin(); it != meshes.end(); it++)
+	{
+		for(unsigned int i=0;i<(*it).second.size();i++)
+			n += (*it).second[i]->Indices.size() / 3;
+	}
+
+	return n;
+}
+
+/** Returns the number of triangles of the given skeletal vob and everything attached to it */
+static unsigned int GetSkeletalTriangleCount(SkeletalVobInfo* vi)
+{
+	SkeletalMeshVisualInfo* visual = (SkeletalMeshVisualInfo *)vi->VisualInfo;
+	if(!visual)
+		return 0;
+
+	unsigned int n = GetMeshTriangleCount(visual->Meshes);
+	for(auto it = visual->SkeletalMeshes.begin(); it != visual->SkeletalMeshes.end(); it++)
+	{
+		for(unsigned int i=0;i<(*it).second.size();i++)
+			n += (*it).second[i]->Indices.size() / 3;
+	}
+
+	for(auto it = vi->NodeAttachments.begin(); it != vi->NodeAttachments.end(); it++)
+	{
+		for(unsigned int i=0;i<(*it).second.size();i++)
+			n += GetMeshTriangleCount((*it).second[i]->Meshes);
+	}
+
+	return n;
+}
+
+/** Counts the triangles of the cached static casters */
+unsigned int D3D11PointLight::CountStaticCasterTriangles()
+{
+	unsigned int n = 0;
+	if(!WorldCacheInvalid)
+	{
+		for(auto it = WorldMeshCache.begin(); it != WorldMeshCache.end(); it++)
+			n += (*it).second->Indices.size() / 3;
+	}else
+	{
+		// The sections around were drawn, we don't know better than last time
+		n = StaticCasterTriangles;
+	}
+
+	for(auto it = VobCache.begin(); it != VobCache.end(); it++)
+		n += GetMeshTriangleCount((*it)->VisualInfo->Meshes);
+
+	for(auto it = SkeletalVobCache.begin(); it != SkeletalVobCache.end(); it++)
+		n += GetSkeletalTriangleCount(*it);
+
+	return n;
+}
+
+/** Counts the triangles of the NPCs in range */
+unsigned int D3D11PointLight::CountDynamicCasterTriangles()
+{
+	float range = LightInfo->Vob->GetLightRange() * 1.1f;
+
+	unsigned int n = 0;
+	for(auto it = Engine::GAPI->GetAnimatedSkeletalMeshVobs().begin(); it != Engine::GAPI->GetAnimatedSkeletalMeshVobs().end(); it++)
+	{
+		if(D3DXVec3Length(&((*it)->Vob->GetPositionWorld() - LightInfo->Vob->GetPositionWorld())) <= range)
+			n += GetSkeletalTriangleCount(*it);
+	}
+
+	return n;
+}
+
 /** Initializes the resources of this light */
 void D3D11PointLight::InitResources()
 {
@@ -64,23 +187,21 @@ void D3D11PointLight::InitResources()
 
 	InitMutex.lock();
 
-	// Create texture-cube for this light
-	DepthCubemap = new RenderToDepthStencilBuffer(engine->GetDevice(), 
-		POINTLIGHT_SHADOWMAP_SIZE,
-		POINTLIGHT_SHADOWMAP_SIZE,
-		DXGI_FORMAT_R32_TYPELESS,
-		NULL,
-		DXGI_FORMAT_D32_FLOAT,
-		DXGI_FORMAT_R32_FLOAT,
-		6);
+	// The cube itself is borrowed from the shadow-cube pool on the first update
 
 	// Create constantbuffer for the view-matrices
 	engine->CreateConstantBuffer(&ViewMatricesCB, NULL, sizeof(CubemapGSConstantBuffer));
 
-	// Generate worldmesh cache if we aren't a dynamically added light
+	// Generate worldmesh cache if we aren't a dynamically added light. Those get theirs on the first update.
 	if(!DynamicLight)
 	{
-		WorldConverter::WorldMeshCollectPolyRange(LightInfo->Vob->GetPositionWorld(), LightInfo->Vob->GetLightRange(), Engine::GAPI->GetWorldSections(), WorldMeshCache);
+		WorldCacheCenter = LightInfo->Vob->GetPositionWorld();
+		{
+			std::lock_guard<std::mutex> lock(Engine::GAPI->GetWorldMeshMutex());
+			WorldConverter::WorldMeshCollectPolyRange(WorldCacheCenter, LightInfo->Vob->GetLightRange() * (1.0f + POINTLIGHT_CACHE_MARGIN), InitWorldMeshSources, WorldMeshCache);
+		}
+
+		InitWorldMeshSources.clear();
 		WorldCacheInvalid = false;
 	}else
 	{
@@ -107,7 +228,7 @@ void D3D11PointLight::InitResources()
 /** Returns if this light needs an update */
 bool D3D11PointLight::NeedsUpdate()
 {
-	return LightInfo->Vob->GetPositionWorld() != LastUpdatePosition || NotYetDrawn();
+	return LightInfo->Vob->GetPositionWorld() != LastUpdatePosition || NotYetDrawn() || StaticCubemapDirty || !IsShadowResident();
 }
 
 /** Returns true if the light could need an update, but it's not very important */
@@ -153,24 +274,64 @@ void D3D11PointLight::RenderCubemap(bool forceUpdate)
 	{
 		if(!forceUpdate)
 			return; // Don't update when we don't need to
-	}else
+	}
+
+	float cacheMargin = LightInfo->Vob->GetLightRange() * POINTLIGHT_CACHE_MARGIN;
+
+	if(vEyePt != LastUpdatePosition)
 	{
-		if(LightInfo->Vob->GetPositionWorld() != LastUpdatePosition)
+		// Everything in the cube is relative to the light
+		StaticCubemapDirty = true;
+
+		// The casters were collected with a margin, so they only have to be refreshed once the light left it
+		if(D3DXVec3Length(&(vEyePt - CacheCenter)) > cacheMargin)
 		{
-			// Position changed, refresh our caches
 			VobCache.clear();
 			SkeletalVobCache.clear();
 
-			// Invalidate worldcache
-			WorldCacheInvalid = true;
+			CacheCenter = vEyePt;
 		}
 	}
 
-	
+	UpdateWorldCache(vEyePt);
+
+	// NPCs, colorchanges and forced updates only touch the dynamic casters. The first update only draws the static ones.
+	bool drawStatic = StaticCubemapDirty || NotYetDrawn();
+	bool drawDynamic = !NotYetDrawn();
 
 	// Update indoor/outdoor-state
 	LightInfo->IsIndoorVob = LightInfo->Vob->IsIndoorVob();
 
+	// Borrow the cubes from the pool. Lights at the same spot would draw the same static cube, so they share it.
+	D3D11ShadowCubePool* pool = engine->GetShadowCubePool();
+	switch(pool->Acquire(StaticCube, vEyePt, LightInfo->Vob->GetLightRange(), LightInfo->IsIndoorVob, true))
+	{
+	case D3D11ShadowCubePool::AR_FAILED:
+		return; // Everything in the pool is needed this frame, try again in the next one
+
+	case D3D11ShadowCubePool::AR_NEW:
+		drawStatic = true;
+		break;
+
+	case D3D11ShadowCubePool::AR_SHARED:
+		// The other light may have drawn it before one of the casters was removed. Draw it again then, which fixes it for
+		// everyone sharing it. Otherwise it already shows everything we would draw at this spot.
+		drawStatic = StaticCasterRemoved;
+		StaticCubemapDirty = StaticCasterRemoved;
+		break;
+	}
+
+	// Without NPCs around, the static cube is all there is to draw
+	DynamicCasterTriangles = drawDynamic ? CountDynamicCasterTriangles() : 0;
+	if(!DynamicCasterTriangles)
+	{
+		pool->Release(DynamicCube);
+		drawDynamic = false;
+	}else if(pool->Acquire(DynamicCube, vEyePt, LightInfo->Vob->GetLightRange(), LightInfo->IsIndoorVob, false) == D3D11ShadowCubePool::AR_FAILED)
+	{
+		drawDynamic = false;
+	}
+
 	D3DXMATRIX proj;
 
 	const bool dbg = false;
@@ -229,9 +390,7 @@ void D3D11PointLight::RenderCubemap(bool forceUpdate)
 	ViewMatricesCB->UpdateBuffer(&gcb);
 	ViewMatricesCB->BindToGeometryShader(2);
 
-	//for(int i=0;i<6;i++)
-	//	RenderCubemapFace(CubeMapViewMatrices[i], proj, i);
-	RenderFullCubemap();
+	RenderFullCubemap(drawStatic, drawDynamic);
 
 	if(dbg)
 	{
@@ -247,8 +406,47 @@ void D3D11PointLight::RenderCubemap(bool forceUpdate)
 	DrawnOnce = true;
 }
 
+/** Takes over a finished world-cache and starts building a new one if the light moved too far from the current one */
+void D3D11PointLight::UpdateWorldCache(const D3DXVECTOR3& position)
+{
+	float range = LightInfo->Vob->GetLightRange();
+
+	if(WorldCacheJob.valid() && WorldCacheJob.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+	{
+		WorldCacheJob.get();
+
+		for(auto it=WorldMeshCache.begin();it!=WorldMeshCache.end();it++)
+			delete (*it).second;
+
+		WorldMeshCache.clear();
+		WorldMeshCache.swap(PendingWorldMeshCache);
+		WorldCacheCenter = PendingWorldCacheCenter;
+		WorldCacheInvalid = false;
+	}
+
+	// Don't use the cache if we have moved out of its margin. Drawing the sections around is slower, but complete.
+	if(!WorldCacheInvalid && D3DXVec3Length(&(position - WorldCacheCenter)) > range * POINTLIGHT_CACHE_MARGIN)
+		WorldCacheInvalid = true;
+
+	if(WorldCacheInvalid && !WorldCacheJob.valid())
+	{
+		PendingWorldCacheCenter = position;
+		float cacheRange = range * (1.0f + POINTLIGHT_CACHE_MARGIN);
+
+		// Only the snapshot goes to the worker, the sections may change meanwhile
+		std::vector<WorldMeshRangeSource> sources;
+		WorldConverter::WorldMeshGetRangeSources(position, Engine::GAPI->GetWorldSections(), sources);
+
+		WorldCacheJob = Engine::WorkerThreadPool->enqueue([this, position, cacheRange, sources]()
+		{
+			std::lock_guard<std::mutex> lock(Engine::GAPI->GetWorldMeshMutex());
+			WorldConverter::WorldMeshCollectPolyRange(position, cacheRange, sources, PendingWorldMeshCache);
+		});
+	}
+}
+
 /** Renders all cubemap faces at once, using the geometry shader */
-void D3D11PointLight::RenderFullCubemap()
+void D3D11PointLight::RenderFullCubemap(bool drawStatic, bool drawDynamic)
 {
 	D3D11GraphicsEngineBase* engineBase = (D3D11GraphicsEngineBase *)Engine::GraphicsEngine;
 	D3D11GraphicsEngine* engine = (D3D11GraphicsEngine *) engineBase; // TODO: Remove and use newer system!
@@ -259,9 +457,7 @@ void D3D11PointLight::RenderFullCubemap()
 	//Engine::GAPI->GetRendererState()->RendererSettings.DrawSkeletalMeshes = false;
 
 	float range = LightInfo->Vob->GetLightRange() * 1.1f;
-
-	// Draw no npcs if this is a static light. This is archived by simply not drawing them in the first update
-	bool noNPCs = !DrawnOnce;//!LightInfo->Vob->IsStatic();
+	float cacheRange = range + LightInfo->Vob->GetLightRange() * POINTLIGHT_CACHE_MARGIN;
 
 	// Draw cubemap
 	std::map<MeshKey, WorldMeshInfo*, cmpMeshKey>* wc = &WorldMeshCache;
@@ -270,42 +466,27 @@ void D3D11PointLight::RenderFullCubemap()
 	if(WorldCacheInvalid)
 		wc = NULL;
 
-	engine->RenderShadowCube(LightInfo->Vob->GetPositionWorld(), range, DepthCubemap, NULL, NULL, false, LightInfo->IsIndoorVob, noNPCs, &VobCache, &SkeletalVobCache, wc);
-
-	//Engine::GAPI->GetRendererState()->RendererSettings.DrawSkeletalMeshes = oldDrawSkel;
-}
-
-/** Renders the scene with the given view-proj-matrices */
-void D3D11PointLight::RenderCubemapFace(const D3DXMATRIX& view, const D3DXMATRIX& proj, UINT faceIdx)
-{
-	D3D11GraphicsEngineBase* engineBase = (D3D11GraphicsEngineBase *)Engine::GraphicsEngine;
-	D3D11GraphicsEngine* engine = (D3D11GraphicsEngine *) engineBase; // TODO: Remove and use newer system!
-	CameraReplacement cr;
-	cr.PositionReplacement = LightInfo->Vob->GetPositionWorld();
-	cr.ProjectionReplacement = proj;
-	cr.ViewReplacement = view;
-
-	// Replace gothics camera
-	Engine::GAPI->SetCameraReplacementPtr(&cr);
+	D3D11ShadowCubePool* pool = engine->GetShadowCubePool();
 
-	if(engine->GetDummyCubeRT())
-		engine->GetContext()->ClearRenderTargetView(engine->GetDummyCubeRT()->GetRTVCubemapFace(faceIdx), (float *)&float4(0,0,0,0));
+	if(drawStatic)
+	{
+		// Static casters only, NPCs are composited on top
+		engine->RenderShadowCube(LightInfo->Vob->GetPositionWorld(), range, pool->GetCubeDSV(StaticCube), pool->GetCubeSize(), NULL, NULL, false, LightInfo->IsIndoorVob, true, &VobCache, &SkeletalVobCache, wc, false, cacheRange);
 
-	// Disable shadows for NPCs
-	// TODO: Only for the player himself, because his shadows look ugly when using a torch
-	bool oldDrawSkel = Engine::GAPI->GetRendererState()->RendererSettings.DrawSkeletalMeshes;
-	//Engine::GAPI->GetRendererState()->RendererSettings.DrawSkeletalMeshes = false;
+		StaticCubemapDirty = false;
+		StaticCasterRemoved = false;
+		StaticCasterTriangles = CountStaticCasterTriangles();
+	}
 
-	float range = LightInfo->Vob->GetLightRange() * 1.1f;
+	UseDynamicCubemap = drawDynamic;
+	if(!drawDynamic)
+		return;
 
-	// Draw cubemap face
-	ID3D11RenderTargetView* debugRTV = engine->GetDummyCubeRT() != NULL ? engine->GetDummyCubeRT()->GetRTVCubemapFace(faceIdx) : NULL;
-	engine->RenderShadowCube(cr.PositionReplacement, range, DepthCubemap, DepthCubemap->GetDSVCubemapFace(faceIdx), debugRTV, false);
+	// Start from the static casters and draw the NPCs on top of them
+	pool->CopyCube(DynamicCube, StaticCube);
+	engine->RenderShadowCube(LightInfo->Vob->GetPositionWorld(), range, pool->GetCubeDSV(DynamicCube), pool->GetCubeSize(), NULL, NULL, false, LightInfo->IsIndoorVob, false, NULL, NULL, NULL, true);
 
 	//Engine::GAPI->GetRendererState()->RendererSettings.DrawSkeletalMeshes = oldDrawSkel;
-
-	// Reset settings
-	Engine::GAPI->SetCameraReplacementPtr(NULL);
 }
 
 /** Binds the shadowmap to the pixelshader */
@@ -314,13 +495,36 @@ void D3D11PointLight::OnRenderLight()
 	if(!InitDone)
 		return;
 
-	DepthCubemap->BindToPixelShader(((D3D11GraphicsEngineBase *)Engine::GraphicsEngine)->GetContext(), 3);
+	// Keep the cubes from being evicted for a while
+	D3D11ShadowCubePool* pool = GetShadowCubePool();
+	pool->Touch(StaticCube);
+	if(UseDynamicCubemap)
+		pool->Touch(DynamicCube);
+
+	// The light picks its cube by GetShadowCubeIndex
+	pool->BindToPixelShader(3);
+}
+
+/** Returns true if this light has a drawn cube in the shadow-cube pool */
+bool D3D11PointLight::IsShadowResident()
+{
+	return InitDone && DrawnOnce && GetShadowCubePool()->IsResident(StaticCube);
+}
+
+/** Returns the index of the cube to sample in the shadow-cube array */
+int D3D11PointLight::GetShadowCubeIndex()
+{
+	if(UseDynamicCubemap && GetShadowCubePool()->IsResident(DynamicCube))
+		return DynamicCube.Slot;
+
+	return StaticCube.Slot;
 }
 
 /** Debug-draws the cubemap to the screen */
 void D3D11PointLight::DebugDrawCubeMap()
 {
-	if(!InitDone)
+	// Nothing to show until the light has its cube in the pool
+	if(!IsShadowResident())
 		return;
 
 	D3D11GraphicsEngineBase* engineBase = (D3D11GraphicsEngineBase *)Engine::GraphicsEngine;
@@ -363,7 +567,7 @@ void D3D11PointLight::DebugDrawCubeMap()
 
 		INT2 pSize = INT2(previewSize / previewDownscale,previewSize / previewDownscale);
 
-		ID3D11ShaderResourceView* srv = engine->GetDummyCubeRT()->GetSRVCubemapFace(i);
+		ID3D11ShaderResourceView* srv = engine->GetShadowCubePool()->GetFaceSRV(GetShadowCubeIndex(), i);
 		engine->GetContext()->PSSetShaderResources(0,1, &srv);
 		Engine::GraphicsEngine->DrawQuad(pPosition, pSize);
 	}
@@ -379,9 +583,11 @@ void D3D11PointLight::OnVobRemovedFromWorld(BaseVobInfo* vob)
 	if(std::find(VobCache.begin(), VobCache.end(), vob) != VobCache.end()
 		|| std::find(SkeletalVobCache.begin(), SkeletalVobCache.end(), vob) != SkeletalVobCache.end())
 	{
-		// Clear cache, if so
+		// Clear cache, if so. The vob is still in the static cube, so that has to be redrawn.
 		VobCache.clear();
 		SkeletalVobCache.clear();
+		StaticCubemapDirty = true;
+		StaticCasterRemoved = true;
 	}
 
 	InitMutex.unlock();
@@ -1,13 +1,13 @@
 #pragma once
 #include "BaseShadowedPointLight.h"
 #include "WorldConverter.h"
+#include "D3D11ShadowCubePool.h"
 #include <thread>
 #include <condition_variable>
 
 class D3D11PointLight;
 
 struct VobLightInfo;
-struct RenderToDepthStencilBuffer;
 struct RenderToTextureBuffer;
 struct VobInfo;
 struct SkeletalVobInfo;
@@ -24,9 +24,15 @@ public:
 	/** Draws the surrounding scene into the cubemap */
 	void RenderCubemap(bool forceUpdate = false);
 
-	/** Binds the shadowmap to the pixelshader */
+	/** Binds the shadowmap to the pixelshader. That is the one with the dynamic casters, if they were drawn. */
 	void OnRenderLight();
 
+	/** Returns true if this light has a drawn cube in the shadow-cube pool. It may have been evicted since the last update. */
+	bool IsShadowResident();
+
+	/** Returns the index of the cube to sample in the shadow-cube array */
+	int GetShadowCubeIndex();
+
 	/** Debug-draws the cubemap to the screen */
 	void DebugDrawCubeMap();
 
@@ -39,23 +45,59 @@ public:
 	/** Returns true if this is the first time that light is being rendered */
 	bool NotYetDrawn();
 
+	/** Returns the number of triangles the next update would draw, estimated from the cached casters */
+	unsigned int EstimateUpdateTriangles();
+
 	/** Called when a vob got removed from the world */
 	virtual void OnVobRemovedFromWorld(BaseVobInfo* vob);
 
 protected:
-	/** Renders the scene with the given view-proj-matrices */
-	void RenderCubemapFace(const D3DXMATRIX& view, const D3DXMATRIX& proj, UINT faceIdx);
+	/** Renders all cubemap faces at once, using the geometry shader. Draws the static casters into StaticCube if
+		they need an update, then composites the dynamic ones on top of a copy of it. */
+	void RenderFullCubemap(bool drawStatic, bool drawDynamic);
 
-	/** Renders all cubemap faces at once, using the geometry shader */
-	void RenderFullCubemap();
+	/** Takes over a finished world-cache and starts building a new one if the light moved too far from the current one */
+	void UpdateWorldCache(const D3DXVECTOR3& position);
 
+	/** Counts the triangles of the cached static casters */
+	unsigned int CountStaticCasterTriangles();
+
+	/** Counts the triangles of the NPCs in range */
+	unsigned int CountDynamicCasterTriangles();
+
+	/** Casters in range, collected with a margin around CacheCenter */
 	std::list<VobInfo*> VobCache;
 	std::list<SkeletalVobInfo*> SkeletalVobCache;
+	D3DXVECTOR3 CacheCenter;
+
+	/** World polygons in range, collected with a margin around WorldCacheCenter */
 	std::map<MeshKey, WorldMeshInfo*, cmpMeshKey> WorldMeshCache;
+	D3DXVECTOR3 WorldCacheCenter;
 	bool WorldCacheInvalid;
 
+	/** Cache being built on a worker thread */
+	std::future<void> WorldCacheJob;
+	std::map<MeshKey, WorldMeshInfo*, cmpMeshKey> PendingWorldMeshCache;
+	D3DXVECTOR3 PendingWorldCacheCenter;
+
+	/** Worldmeshes the first cache is built from, gathered in the constructor since InitResources runs on a worker */
+	std::vector<WorldMeshRangeSource> InitWorldMeshSources;
+
 	VobLightInfo* LightInfo;
-	RenderToDepthStencilBuffer* DepthCubemap;
+
+	/** Depth of the static casters only, borrowed from the shadow-cube pool. Redrawn only if the light moved,
+		static geometry changed or the pool took the cube away. Shared with lights at the same spot. */
+	ShadowCubeHandle StaticCube;
+	bool StaticCubemapDirty;
+	bool StaticCasterRemoved; // Dirty because a caster is gone, so a shared cube can't be taken as it is
+
+	/** Copy of StaticCube with the NPCs drawn on top. Only held while there are NPCs in range. */
+	ShadowCubeHandle DynamicCube;
+	bool UseDynamicCubemap;
+
+	/** Triangles drawn by the last updates of the cubes, for the shadow-update scheduler */
+	unsigned int StaticCasterTriangles;
+	unsigned int DynamicCasterTriangles;
 	D3DXMATRIX CubeMapViewMatrices[6];
 	D3DXVECTOR3 LastUpdatePosition;
 	DWORD LastUpdateColor;
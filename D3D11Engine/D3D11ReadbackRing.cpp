@@ -0,0 +1,171 @@
+#include "pch.h"
+#include "D3D11ReadbackRing.h"
+#include "Engine.h"
+#include "ThreadPool.h"
+
+D3D11ReadbackRing::D3D11ReadbackRing(ID3D11Device* device, ID3D11DeviceContext* context)
+{
+	Device = device;
+	Context = context;
+	FrameCounter = 0;
+
+	for(int i=0;i<READBACK_RING_SIZE;i++)
+	{
+		Slots[i].Staging = NULL;
+		Slots[i].Size = INT2(0,0);
+		Slots[i].InUse = false;
+		Slots[i].QueuedFrame = 0;
+	}
+}
+
+D3D11ReadbackRing::~D3D11ReadbackRing(void)
+{
+	Flush();
+
+	for(int i=0;i<READBACK_RING_SIZE;i++)
+		SAFE_RELEASE(Slots[i].Staging);
+}
+
+/** Copies the given R8G8B8A8-texture into a free staging buffer */
+XRESULT D3D11ReadbackRing::QueueReadback(ID3D11Texture2D* texture, const ReadbackCallback& callback)
+{
+	D3D11_TEXTURE2D_DESC desc;
+	texture->GetDesc(&desc);
+
+	if(desc.Format != DXGI_FORMAT_R8G8B8A8_UNORM || desc.SampleDesc.Count != 1)
+	{
+		LogWarn() << "Can only read back single sampled R8G8B8A8-textures!";
+		return XR_FAILED;
+	}
+
+	// Prefer a free slot which already has a buffer of the right size
+	ReadbackSlot* slot = NULL;
+	for(int i=0;i<READBACK_RING_SIZE;i++)
+	{
+		if(Slots[i].InUse)
+			continue;
+
+		if(!slot || (Slots[i].Size.x == (int)desc.Width && Slots[i].Size.y == (int)desc.Height))
+			slot = &Slots[i];
+	}
+
+	if(!slot)
+	{
+		LogWarn() << "All readback buffers are in use!";
+		return XR_FAILED;
+	}
+
+	if(!slot->Staging || slot->Size.x != (int)desc.Width || slot->Size.y != (int)desc.Height)
+	{
+		SAFE_RELEASE(slot->Staging);
+
+		CD3D11_TEXTURE2D_DESC stagingDesc(DXGI_FORMAT_R8G8B8A8_UNORM, desc.Width, desc.Height, 1, 1, 0, D3D11_USAGE_STAGING, D3D11_CPU_ACCESS_READ);
+		if(FAILED(Device->CreateTexture2D(&stagingDesc, NULL, &slot->Staging)))
+		{
+			LogWarn() << "Failed to create readback buffer!";
+			slot->Staging = NULL;
+			return XR_FAILED;
+		}
+
+		slot->Size = INT2(desc.Width, desc.Height);
+	}
+
+	Context->CopyResource(slot->Staging, texture);
+
+	slot->InUse = true;
+	slot->QueuedFrame = FrameCounter;
+	slot->Callback = callback;
+
+	return XR_SUCCESS;
+}
+
+/** Maps the buffers which are old enough and passes their data on */
+void D3D11ReadbackRing::Update()
+{
+	FrameCounter++;
+
+	for(int i=0;i<READBACK_RING_SIZE;i++)
+	{
+		if(Slots[i].InUse && FrameCounter - Slots[i].QueuedFrame >= READBACK_LATENCY_FRAMES)
+			ReadSlot(Slots[i], false);
+	}
+
+	// Forget about the callbacks which are done
+	for(auto it = Jobs.begin(); it != Jobs.end();)
+	{
+		if((*it).wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+			it = Jobs.erase(it);
+		else
+			it++;
+	}
+}
+
+/** Reads back everything that is still queued and waits for all callbacks to finish */
+void D3D11ReadbackRing::Flush()
+{
+	for(int i=0;i<READBACK_RING_SIZE;i++)
+	{
+		if(Slots[i].InUse)
+			ReadSlot(Slots[i], true);
+	}
+
+	for(auto it = Jobs.begin(); it != Jobs.end(); it++)
+		(*it).wait();
+
+	Jobs.clear();
+}
+
+/** Returns the number of readbacks still waiting for the GPU */
+unsigned int D3D11ReadbackRing::GetNumPending()
+{
+	unsigned int num = 0;
+	for(int i=0;i<READBACK_RING_SIZE;i++)
+	{
+		if(Slots[i].InUse)
+			num++;
+	}
+
+	return num;
+}
+
+/** Copies the data out of the given slot and frees it */
+bool D3D11ReadbackRing::ReadSlot(ReadbackSlot& slot, bool wait)
+{
+	D3D11_MAPPED_SUBRESOURCE res;
+	HRESULT hr = Context->Map(slot.Staging, 0, D3D11_MAP_READ, wait ? 0 : D3D11_MAP_FLAG_DO_NOT_WAIT, &res);
+	if(hr == DXGI_ERROR_WAS_STILL_DRAWING)
+		return false; // Try again next frame
+
+	std::shared_ptr<std::vector<unsigned char>> rgba = std::make_shared<std::vector<unsigned char>>();
+	INT2 size = slot.Size;
+	ReadbackCallback callback = slot.Callback;
+
+	slot.InUse = false;
+	slot.Callback = ReadbackCallback();
+
+	if(FAILED(hr))
+	{
+		LogWarn() << "Failed to map readback buffer!";
+		return false;
+	}
+
+	// Drop the row-padding of the driver
+	rgba->resize(size.x * size.y * 4);
+	for(int y=0;y<size.y;y++)
+		memcpy(&(*rgba)[y * size.x * 4], (unsigned char*)res.pData + y * res.RowPitch, size.x * 4);
+
+	Context->Unmap(slot.Staging, 0);
+
+	if(Engine::WorkerThreadPool)
+	{
+		Jobs.push_back(Engine::WorkerThreadPool->enqueue([rgba, size, callback]()
+		{
+			callback(*rgba, size);
+		}));
+	}else
+	{
+		callback(*rgba, size);
+	}
+
+	return true;
+}
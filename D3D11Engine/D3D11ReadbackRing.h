@@ -0,0 +1,54 @@
+#pragma once
+#include "pch.h"
+#include <functional>
+
+/** Number of staging buffers readbacks can be in flight with */
+const int READBACK_RING_SIZE = 4;
+
+/** Frames a copy gets before we try to map it. The GPU is usually done with it by then, so mapping doesn't stall. */
+const unsigned int READBACK_LATENCY_FRAMES = 2;
+
+/** Reads textures back to the CPU a few frames after their copy was queued and hands the pixels to a worker thread */
+class D3D11ReadbackRing
+{
+public:
+	/** Called on a worker thread with the tightly packed RGBA8-pixels of a readback */
+	typedef std::function<void(std::vector<unsigned char>& rgba, INT2 size)> ReadbackCallback;
+
+	D3D11ReadbackRing(ID3D11Device* device, ID3D11DeviceContext* context);
+	~D3D11ReadbackRing(void);
+
+	/** Copies the given R8G8B8A8-texture into a free staging buffer. Fails if all of them are in flight. */
+	XRESULT QueueReadback(ID3D11Texture2D* texture, const ReadbackCallback& callback);
+
+	/** Maps the buffers which are old enough and passes their data on. Call once per frame from the render-thread. */
+	void Update();
+
+	/** Reads back everything that is still queued and waits for all callbacks to finish */
+	void Flush();
+
+	/** Returns the number of readbacks still waiting for the GPU */
+	unsigned int GetNumPending();
+
+private:
+	struct ReadbackSlot
+	{
+		ID3D11Texture2D* Staging;
+		INT2 Size;
+		bool InUse;
+		unsigned int QueuedFrame;
+		ReadbackCallback Callback;
+	};
+
+	/** Copies the data out of the given slot and frees it. If wait is false, fails while the GPU isn't done with the copy. */
+	bool ReadSlot(ReadbackSlot& slot, bool wait);
+
+	ID3D11Device* Device;
+	ID3D11DeviceContext* Context;
+
+	ReadbackSlot Slots[READBACK_RING_SIZE];
+	unsigned int FrameCounter;
+
+	/** Callbacks running on the workers */
+	std::list<std::future<void>> Jobs;
+};
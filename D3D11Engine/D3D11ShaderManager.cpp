@@ -45,6 +45,9 @@ XRESULT D3D11ShaderManager::Init()
 	Shaders.back().cBufferSizes.push_back(sizeof(VS_ExConstantBuffer_PerFrame));
 	Shaders.back().cBufferSizes.push_back(sizeof(VS_ExConstantBuffer_PerInstance));
 
+	Shaders.push_back(ShaderInfo("VS_PNAEN_RemapInstanced", "VS_PNAEN_RemapInstanced.hlsl", "v", 12));
+	Shaders.back().cBufferSizes.push_back(sizeof(VS_ExConstantBuffer_PerFrame));
+
 	Shaders.push_back(ShaderInfo("VS_Decal", "VS_Decal.hlsl", "v", 1));
 	Shaders.back().cBufferSizes.push_back(sizeof(VS_ExConstantBuffer_PerFrame));
 	Shaders.back().cBufferSizes.push_back(sizeof(VS_ExConstantBuffer_PerInstance));
@@ -234,6 +237,9 @@ XRESULT D3D11ShaderManager::Init()
 	Shaders.push_back(ShaderInfo("PS_DS_PointLightDynShadow", "PS_DS_PointLightDynShadow.hlsl", "p"));
 	Shaders.back().cBufferSizes.push_back(sizeof(DS_PointLightConstantBuffer));
 
+	Shaders.push_back(ShaderInfo("PS_DS_PointLightClustered", "PS_DS_PointLightClustered.hlsl", "p"));
+	Shaders.back().cBufferSizes.push_back(sizeof(DS_PointLightClusteredConstantBuffer));
+
 	Shaders.push_back(ShaderInfo("PS_DS_AtmosphericScattering", "PS_DS_AtmosphericScattering.hlsl", "p"));
 	Shaders.back().cBufferSizes.push_back(sizeof(DS_ScreenQuadConstantBuffer));
 	Shaders.back().cBufferSizes.push_back(sizeof(AtmosphereConstantBuffer));
@@ -263,6 +269,7 @@ XRESULT D3D11ShaderManager::Init()
 
 	Shaders.push_back(ShaderInfo("GS_Cubemap", "GS_Cubemap.hlsl", "g"));
 	Shaders.back().cBufferSizes.push_back(sizeof(CubemapGSConstantBuffer));
+	Shaders.back().cBufferSizes.push_back(sizeof(CubemapFaceMaskConstantBuffer));
 
 	Shaders.push_back(ShaderInfo("GS_ParticleStreamOut", "VS_AdvanceRain.hlsl", "g", 11));
 	Shaders.back().cBufferSizes.push_back(sizeof(ParticleGSInfoConstantBuffer));
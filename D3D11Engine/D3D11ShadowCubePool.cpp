@@ -0,0 +1,326 @@
+#include "pch.h"
+#include "D3D11ShadowCubePool.h"
+#include "D3D11GraphicsEngine.h"
+#include "Engine.h"
+#include "GothicAPI.h"
+
+/** How many frames of not being used a cube is worth per unit of distance to the camera, when picking one to evict */
+const float SHADOW_CUBE_EVICTION_DISTANCE_WEIGHT = 1.0f / 100.0f;
+
+/** A texture-array can't have more slices than this */
+const unsigned int SHADOW_CUBE_POOL_MAX_CUBES = D3D11_REQ_TEXTURE2D_ARRAY_AXIS_DIMENSION / 6;
+
+/** Bytes a single cube takes: 6 faces of R32 */
+static float GetCubeSizeMB()
+{
+	return (float)(POINTLIGHT_SHADOWMAP_SIZE * POINTLIGHT_SHADOWMAP_SIZE * 6 * 4) / (1024.0f * 1024.0f);
+}
+
+D3D11ShadowCubePool::D3D11ShadowCubePool(ID3D11Device* device, ID3D11DeviceContext* context)
+{
+	Device = device;
+	Context = context;
+
+	Texture = NULL;
+	ShaderResView = NULL;
+	MemoryMB = 0.0f;
+	CameraPosition = D3DXVECTOR3(0,0,0);
+	FrameCounter = 0;
+	NextGeneration = 0;
+	FrameEvictions = 0;
+}
+
+D3D11ShadowCubePool::~D3D11ShadowCubePool(void)
+{
+	ReleaseArray();
+}
+
+/** Returns the size of a cube face in pixels */
+UINT D3D11ShadowCubePool::GetCubeSize()
+{
+	return POINTLIGHT_SHADOWMAP_SIZE;
+}
+
+/** Resizes the pool if the memory budget changed and advances the frame used for the LRU-eviction */
+void D3D11ShadowCubePool::OnFrameStart(const D3DXVECTOR3& cameraPosition, float memoryMB)
+{
+	// Acquire and Release run many times a frame, so only look at the pool once it's done
+	UpdateStats();
+
+	FrameCounter++;
+	FrameEvictions = 0;
+	CameraPosition = cameraPosition;
+
+	if(memoryMB != MemoryMB || !Texture)
+	{
+		unsigned int numCubes = (unsigned int)std::max(1.0f, memoryMB / GetCubeSizeMB());
+		numCubes = std::min(numCubes, SHADOW_CUBE_POOL_MAX_CUBES);
+
+		MemoryMB = memoryMB;
+
+		if(numCubes != Slots.size() || !Texture)
+			CreateArray(numCubes);
+	}
+}
+
+/** (Re)creates the texture-array with room for the given number of cubes */
+XRESULT D3D11ShadowCubePool::CreateArray(unsigned int numCubes)
+{
+	HRESULT hr = S_OK;
+
+	ReleaseArray();
+
+	CD3D11_TEXTURE2D_DESC desc(DXGI_FORMAT_R32_TYPELESS, POINTLIGHT_SHADOWMAP_SIZE, POINTLIGHT_SHADOWMAP_SIZE, numCubes * 6, 1,
+		D3D11_BIND_DEPTH_STENCIL | D3D11_BIND_SHADER_RESOURCE, D3D11_USAGE_DEFAULT, 0, 1, 0, D3D11_RESOURCE_MISC_TEXTURECUBE);
+
+	LE(Device->CreateTexture2D(&desc, NULL, &Texture));
+	if(FAILED(hr))
+	{
+		LogError() << "Failed to create shadow-cube array with " << numCubes << " cubes!";
+		Texture = NULL;
+		return XR_FAILED;
+	}
+
+	// One view for the lighting shader, which picks the cube by index
+	CD3D11_SHADER_RESOURCE_VIEW_DESC srvDesc(D3D11_SRV_DIMENSION_TEXTURECUBEARRAY, DXGI_FORMAT_R32_FLOAT, 0, 1, 0, numCubes);
+	LE(Device->CreateShaderResourceView(Texture, &srvDesc, &ShaderResView));
+
+	// One view per cube to render into it using the cubemap geometry-shader
+	Slots.resize(numCubes);
+	for(unsigned int i=0;i<numCubes;i++)
+	{
+		CD3D11_DEPTH_STENCIL_VIEW_DESC dsvDesc(D3D11_DSV_DIMENSION_TEXTURE2DARRAY, DXGI_FORMAT_D32_FLOAT, 0, i * 6, 6);
+
+		CubeSlot& s = Slots[i];
+		s.DSV = NULL;
+		LE(Device->CreateDepthStencilView(Texture, &dsvDesc, &s.DSV));
+		ZeroMemory(s.FaceSRVs, sizeof(s.FaceSRVs));
+
+		s.Generation = ++NextGeneration;
+		s.References = 0;
+		s.LastUsedFrame = 0;
+		s.Shareable = false;
+		s.Position = D3DXVECTOR3(0,0,0);
+		s.Range = 0.0f;
+		s.Indoor = false;
+	}
+
+	if(FAILED(hr))
+	{
+		LogError() << "Failed to create the views of the shadow-cube array!";
+		ReleaseArray();
+		return XR_FAILED;
+	}
+
+	LogInfo() << "Created shadow-cube pool with " << numCubes << " cubes (" << numCubes * GetCubeSizeMB() << " MB)";
+
+	return XR_SUCCESS;
+}
+
+/** Releases the texture-array and its views */
+void D3D11ShadowCubePool::ReleaseArray()
+{
+	for(unsigned int i=0;i<Slots.size();i++)
+	{
+		SAFE_RELEASE(Slots[i].DSV);
+
+		for(int f=0;f<6;f++)
+			SAFE_RELEASE(Slots[i].FaceSRVs[f]);
+	}
+
+	// Old handles can't match new slots anyway, since generations are never reused
+	Slots.clear();
+
+	SAFE_RELEASE(ShaderResView);
+	SAFE_RELEASE(Texture);
+}
+
+/** Returns true if the handle still points to the cube it was given */
+bool D3D11ShadowCubePool::IsResident(const ShadowCubeHandle& handle)
+{
+	return handle.Slot >= 0 && handle.Slot < (int)Slots.size() && Slots[handle.Slot].Generation == handle.Generation;
+}
+
+/** Marks the cube as used this frame */
+void D3D11ShadowCubePool::Touch(const ShadowCubeHandle& handle)
+{
+	if(IsResident(handle))
+		Slots[handle.Slot].LastUsedFrame = FrameCounter;
+}
+
+/** Makes sure handle points to a cube for a light at the given position */
+D3D11ShadowCubePool::EAcquireResult D3D11ShadowCubePool::Acquire(ShadowCubeHandle& handle, const D3DXVECTOR3& position, float range, bool indoor, bool shareable)
+{
+	if(IsResident(handle))
+	{
+		CubeSlot& s = Slots[handle.Slot];
+
+		// Private cubes don't care about where they are, shared ones have to match their key
+		if(!s.Shareable && !shareable)
+		{
+			s.LastUsedFrame = FrameCounter;
+			return AR_RESIDENT;
+		}
+
+		if(s.Shareable && shareable && s.Position == position && s.Range == range && s.Indoor == indoor)
+		{
+			s.LastUsedFrame = FrameCounter;
+			return AR_RESIDENT;
+		}
+	}
+
+	Release(handle);
+
+	// See if someone already drew this exact cube
+	if(shareable)
+	{
+		for(unsigned int i=0;i<Slots.size();i++)
+		{
+			CubeSlot& s = Slots[i];
+			if(s.References && s.Shareable && s.Position == position && s.Range == range && s.Indoor == indoor)
+			{
+				s.References++;
+				s.LastUsedFrame = FrameCounter;
+
+				handle.Slot = i;
+				handle.Generation = s.Generation;
+				return AR_SHARED;
+			}
+		}
+	}
+
+	int slot = FindFreeSlot();
+	if(slot < 0)
+		return AR_FAILED;
+
+	CubeSlot& s = Slots[slot];
+	s.Generation = ++NextGeneration;
+	s.References = 1;
+	s.LastUsedFrame = FrameCounter;
+	s.Shareable = shareable;
+	s.Position = position;
+	s.Range = range;
+	s.Indoor = indoor;
+
+	handle.Slot = slot;
+	handle.Generation = s.Generation;
+	return AR_NEW;
+}
+
+/** Gives the cube back */
+void D3D11ShadowCubePool::Release(ShadowCubeHandle& handle)
+{
+	if(IsResident(handle))
+	{
+		CubeSlot& s = Slots[handle.Slot];
+		s.References--;
+
+		// Make sure nobody keeps using it after it got handed out again
+		if(!s.References)
+			s.Generation = ++NextGeneration;
+	}
+
+	handle = ShadowCubeHandle();
+}
+
+/** Returns a free slot, evicting the least important one if needed */
+int D3D11ShadowCubePool::FindFreeSlot()
+{
+	int best = -1;
+	float bestScore = 0.0f;
+	for(unsigned int i=0;i<Slots.size();i++)
+	{
+		CubeSlot& s = Slots[i];
+		if(!s.References)
+			return i;
+
+		// Whatever was used this frame is needed for the lighting later on
+		if(s.LastUsedFrame == FrameCounter)
+			continue;
+
+		// Prefer cubes nobody looked at in a while, which are far away as well
+		float distance = D3DXVec3Length(&(s.Position - CameraPosition));
+		float score = (float)(FrameCounter - s.LastUsedFrame) + distance * SHADOW_CUBE_EVICTION_DISTANCE_WEIGHT;
+		if(best < 0 || score > bestScore)
+		{
+			best = i;
+			bestScore = score;
+		}
+	}
+
+	if(best >= 0)
+	{
+		// All lights still holding this cube will notice through the generation and draw their shadows again
+		Slots[best].References = 0;
+		Slots[best].Generation = ++NextGeneration;
+		FrameEvictions++;
+	}
+
+	return best;
+}
+
+/** Copies the contents of one cube into an other */
+void D3D11ShadowCubePool::CopyCube(const ShadowCubeHandle& target, const ShadowCubeHandle& source)
+{
+	if(!IsResident(target) || !IsResident(source))
+		return;
+
+	for(UINT i=0;i<6;i++)
+	{
+		Context->CopySubresourceRegion(Texture, D3D11CalcSubresource(0, target.Slot * 6 + i, 1), 0, 0, 0,
+			Texture, D3D11CalcSubresource(0, source.Slot * 6 + i, 1), NULL);
+	}
+}
+
+/** Returns the depth-stencil view over all 6 faces of the given cube */
+ID3D11DepthStencilView* D3D11ShadowCubePool::GetCubeDSV(const ShadowCubeHandle& handle)
+{
+	if(!IsResident(handle))
+		return NULL;
+
+	return Slots[handle.Slot].DSV;
+}
+
+/** Binds the whole cube-array to the pixelshader */
+void D3D11ShadowCubePool::BindToPixelShader(int slot)
+{
+	Context->PSSetShaderResources(slot, 1, &ShaderResView);
+}
+
+/** Returns a view on a single face of the cube in the given slot */
+ID3D11ShaderResourceView* D3D11ShadowCubePool::GetFaceSRV(int slot, int face)
+{
+	if(slot < 0 || slot >= (int)Slots.size() || face < 0 || face >= 6)
+		return NULL;
+
+	CubeSlot& s = Slots[slot];
+	if(!s.FaceSRVs[face])
+	{
+		HRESULT hr;
+		CD3D11_SHADER_RESOURCE_VIEW_DESC srvDesc(D3D11_SRV_DIMENSION_TEXTURE2DARRAY, DXGI_FORMAT_R32_FLOAT, 0, 1, slot * 6 + face, 1);
+		LE(Device->CreateShaderResourceView(Texture, &srvDesc, &s.FaceSRVs[face]));
+	}
+
+	return s.FaceSRVs[face];
+}
+
+/** Writes the residency statistics of the last frame to the renderer-info */
+void D3D11ShadowCubePool::UpdateStats()
+{
+	GothicRendererInfo& info = Engine::GAPI->GetRendererState()->RendererInfo;
+	info.ShadowCubesResident = 0;
+	info.ShadowCubesShared = 0;
+
+	for(unsigned int i=0;i<Slots.size();i++)
+	{
+		if(!Slots[i].References)
+			continue;
+
+		info.ShadowCubesResident++;
+		info.ShadowCubesShared += Slots[i].References - 1;
+	}
+
+	info.ShadowCubeCapacity = Slots.size();
+	info.ShadowCubePoolMB = Slots.size() * GetCubeSizeMB();
+	info.FrameShadowCubeEvictions = FrameEvictions;
+}
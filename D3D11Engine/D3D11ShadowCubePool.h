@@ -0,0 +1,109 @@
+#pragma once
+#include "pch.h"
+
+/** Handle to a cube of the pool. Goes stale once its slot got evicted or handed to someone else. */
+struct ShadowCubeHandle
+{
+	ShadowCubeHandle()
+	{
+		Slot = -1;
+		Generation = 0;
+	}
+
+	int Slot;
+	unsigned int Generation;
+};
+
+/** Fixed-size pool of pointlight shadow-cubes, living in a single texture-cube array. The size of the array is derived
+	from a memory budget. Cubes of lights which weren't used for the longest time and are furthest away from the camera
+	are evicted first. Lights drawing the exact same static cube can share it. */
+class D3D11ShadowCubePool
+{
+public:
+	enum EAcquireResult
+	{
+		AR_FAILED, // Pool is full of cubes needed this frame
+		AR_RESIDENT, // The handle was still valid, contents are untouched
+		AR_SHARED, // Got the cube of an other light with the same key, contents are ready to use
+		AR_NEW // Got a fresh cube, contents have to be drawn
+	};
+
+	D3D11ShadowCubePool(ID3D11Device* device, ID3D11DeviceContext* context);
+	~D3D11ShadowCubePool(void);
+
+	/** Resizes the pool if the memory budget changed and advances the frame used for the LRU-eviction */
+	void OnFrameStart(const D3DXVECTOR3& cameraPosition, float memoryMB);
+
+	/** Makes sure handle points to a cube for a light at the given position. If shareable is set, the cube is keyed by
+		position, range and indoor-state and an existing cube with the same key is handed out instead of a new one. */
+	EAcquireResult Acquire(ShadowCubeHandle& handle, const D3DXVECTOR3& position, float range, bool indoor, bool shareable);
+
+	/** Gives the cube back. The cube stays allocated as long as other lights share it. */
+	void Release(ShadowCubeHandle& handle);
+
+	/** Returns true if the handle still points to the cube it was given */
+	bool IsResident(const ShadowCubeHandle& handle);
+
+	/** Marks the cube as used this frame, so it won't be evicted until the next one */
+	void Touch(const ShadowCubeHandle& handle);
+
+	/** Copies the contents of one cube into an other */
+	void CopyCube(const ShadowCubeHandle& target, const ShadowCubeHandle& source);
+
+	/** Returns the depth-stencil view over all 6 faces of the given cube */
+	ID3D11DepthStencilView* GetCubeDSV(const ShadowCubeHandle& handle);
+
+	/** Binds the whole cube-array to the pixelshader */
+	void BindToPixelShader(int slot);
+
+	/** Returns a view on a single face of the cube in the given slot, for debugging. Created on first use. */
+	ID3D11ShaderResourceView* GetFaceSRV(int slot, int face);
+
+	/** Returns the size of a cube face in pixels */
+	UINT GetCubeSize();
+
+	/** Returns the number of cubes the pool can hold */
+	unsigned int GetCapacity(){return Slots.size();}
+
+private:
+	struct CubeSlot
+	{
+		ID3D11DepthStencilView* DSV;
+		ID3D11ShaderResourceView* FaceSRVs[6]; // NULL until GetFaceSRV needs them
+		unsigned int Generation; // Bumped whenever the slot changes its owner
+		unsigned int References; // 0 if free
+		unsigned int LastUsedFrame;
+
+		bool Shareable;
+		D3DXVECTOR3 Position;
+		float Range;
+		bool Indoor;
+	};
+
+	/** (Re)creates the texture-array with room for the given number of cubes. Invalidates every handle. */
+	XRESULT CreateArray(unsigned int numCubes);
+
+	/** Releases the texture-array and its views */
+	void ReleaseArray();
+
+	/** Returns a free slot, evicting the least important one if needed. Returns -1 if all are in use this frame. */
+	int FindFreeSlot();
+
+	/** Writes the residency statistics of the last frame to the renderer-info */
+	void UpdateStats();
+
+	ID3D11Device* Device;
+	ID3D11DeviceContext* Context;
+
+	ID3D11Texture2D* Texture;
+	ID3D11ShaderResourceView* ShaderResView;
+	std::vector<CubeSlot> Slots;
+
+	/** Memory budget the array was created with */
+	float MemoryMB;
+
+	D3DXVECTOR3 CameraPosition;
+	unsigned int FrameCounter;
+	unsigned int NextGeneration;
+	unsigned int FrameEvictions;
+};
@@ -0,0 +1,144 @@
+#include "pch.h"
+#include "D3D11ShadowUpdateScheduler.h"
+#include "Engine.h"
+#include "GothicAPI.h"
+#include "D3D11PointLight.h"
+#include "zCVobLight.h"
+
+/** Priority a light gains for every frame it had to wait */
+const float SHADOW_UPDATE_STALENESS_WEIGHT = 0.25f;
+
+/** Priority-factor of lights which moved. Their shadows are wrong, not just missing an NPC. */
+const float SHADOW_UPDATE_MOVED_PRIORITY = 4.0f;
+
+/** Fixed cost of an update in triangles, for setting up the states and clearing the cube */
+const float SHADOW_UPDATE_OVERHEAD_TRIANGLES = 2000.0f;
+
+/** How fast the measured time per triangle follows new measurements */
+const float SHADOW_UPDATE_COST_ADAPTION = 0.1f;
+
+D3D11ShadowUpdateScheduler::D3D11ShadowUpdateScheduler(void)
+{
+	MSPerTriangle = 1.0f / 50000.0f;
+	FrameCounter = 0;
+}
+
+D3D11ShadowUpdateScheduler::~D3D11ShadowUpdateScheduler(void)
+{
+}
+
+/** Queues an update of the given light */
+void D3D11ShadowUpdateScheduler::RequestUpdate(VobLightInfo* light, bool force)
+{
+	auto it = Pending.find(light);
+	if(it != Pending.end())
+	{
+		(*it).second.Force |= force;
+		return;
+	}
+
+	PendingUpdate p;
+	p.Force = force;
+	p.RequestFrame = FrameCounter;
+	Pending[light] = p;
+}
+
+/** Returns the estimated time in ms the given light takes to update */
+float D3D11ShadowUpdateScheduler::EstimateCost(VobLightInfo* light)
+{
+	D3D11PointLight* pl = (D3D11PointLight *)light->LightShadowBuffers;
+	return ((float)pl->EstimateUpdateTriangles() + SHADOW_UPDATE_OVERHEAD_TRIANGLES) * MSPerTriangle;
+}
+
+/** Updates the most important queued lights, until the next one wouldn't fit into budgetMS anymore */
+void D3D11ShadowUpdateScheduler::Update(const D3DXVECTOR3& cameraPosition, float budgetMS)
+{
+	FrameCounter++;
+
+	GothicRendererInfo& info = Engine::GAPI->GetRendererState()->RendererInfo;
+	info.FrameShadowUpdates = 0;
+	info.FrameShadowUpdatesDeferred = 0;
+	info.FrameShadowUpdateMS = 0.0f;
+	info.ShadowUpdateMaxStaleness = 0;
+
+	if(Pending.empty())
+		return;
+
+	// Rank the lights by the part of the screen they can shadow and by how long they have been waiting
+	std::vector<RankedUpdate> ranked;
+	ranked.reserve(Pending.size());
+	for(auto it = Pending.begin(); it != Pending.end(); it++)
+	{
+		VobLightInfo* light = (*it).first;
+		float range = light->Vob->GetLightRange();
+		float dist = D3DXVec3Length(&(light->Vob->GetPositionWorld() - cameraPosition));
+
+		// Roughly the solid angle of the lights sphere. Lights around the camera cover everything.
+		float contribution = dist > range ? (range * range) / (dist * dist) : 1.0f;
+		float staleness = (float)(FrameCounter - (*it).second.RequestFrame);
+
+		RankedUpdate r;
+		r.Light = light;
+		r.Priority = contribution * (1.0f + staleness * SHADOW_UPDATE_STALENESS_WEIGHT);
+
+		if(((D3D11PointLight *)light->LightShadowBuffers)->NeedsUpdate())
+			r.Priority *= SHADOW_UPDATE_MOVED_PRIORITY;
+
+		ranked.push_back(r);
+	}
+
+	std::sort(ranked.begin(), ranked.end());
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+
+	float spentMS = 0.0f;
+	for(unsigned int i=0;i<ranked.size();i++)
+	{
+		VobLightInfo* light = ranked[i].Light;
+		D3D11PointLight* pl = (D3D11PointLight *)light->LightShadowBuffers;
+
+		// Skip what doesn't fit anymore, something cheaper further down still might
+		float estimate = EstimateCost(light);
+		if(info.FrameShadowUpdates > 0 && spentMS + estimate > budgetMS)
+			continue;
+
+		unsigned int triangles = pl->EstimateUpdateTriangles();
+		bool force = Pending[light].Force;
+		Pending.erase(light);
+
+		LARGE_INTEGER start, end;
+		QueryPerformanceCounter(&start);
+
+		pl->RenderCubemap(force);
+
+		QueryPerformanceCounter(&end);
+		float ms = (float)((double)(end.QuadPart - start.QuadPart) * 1000.0 / (double)frequency.QuadPart);
+
+		// Learn how expensive triangles really are on this machine
+		float measured = ms / ((float)triangles + SHADOW_UPDATE_OVERHEAD_TRIANGLES);
+		MSPerTriangle += (measured - MSPerTriangle) * SHADOW_UPDATE_COST_ADAPTION;
+
+		spentMS += ms;
+		info.FrameShadowUpdates++;
+	}
+
+	info.FrameShadowUpdateMS = spentMS;
+	info.FrameShadowUpdatesDeferred = Pending.size();
+
+	for(auto it = Pending.begin(); it != Pending.end(); it++)
+		info.ShadowUpdateMaxStaleness = std::max(info.ShadowUpdateMaxStaleness, FrameCounter - (*it).second.RequestFrame);
+}
+
+/** Takes the light of the given vob out of the queue */
+void D3D11ShadowUpdateScheduler::RemoveLight(zCVob* vob)
+{
+	for(auto it = Pending.begin(); it != Pending.end(); it++)
+	{
+		if((*it).first->Vob == vob)
+		{
+			Pending.erase(it);
+			break;
+		}
+	}
+}
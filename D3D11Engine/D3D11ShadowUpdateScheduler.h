@@ -0,0 +1,54 @@
+#pragma once
+#include "pch.h"
+
+struct VobLightInfo;
+class zCVob;
+
+/** Decides which pointlight shadow-cubes get redrawn in a frame. Queued lights are ranked by how much of the screen they
+	cover and how long they have been waiting, then updated until the estimated cost would exceed the frame budget. */
+class D3D11ShadowUpdateScheduler
+{
+public:
+	D3D11ShadowUpdateScheduler(void);
+	~D3D11ShadowUpdateScheduler(void);
+
+	/** Queues an update of the given light. Requests for a light which is already queued are merged.
+		force makes the light redraw even if it thinks it doesn't need to, like when NPCs walked by. */
+	void RequestUpdate(VobLightInfo* light, bool force);
+
+	/** Updates the most important queued lights, until the next one wouldn't fit into budgetMS anymore.
+		At least one light is updated every frame, so nothing waits forever. */
+	void Update(const D3DXVECTOR3& cameraPosition, float budgetMS);
+
+	/** Takes the light of the given vob out of the queue */
+	void RemoveLight(zCVob* vob);
+
+	/** Returns the number of lights waiting for an update */
+	unsigned int GetNumPending(){return Pending.size();}
+
+private:
+	struct PendingUpdate
+	{
+		bool Force;
+		unsigned int RequestFrame; // Frame the light was queued in
+	};
+
+	struct RankedUpdate
+	{
+		VobLightInfo* Light;
+		float Priority;
+
+		bool operator < (const RankedUpdate& b) const {return Priority > b.Priority;}
+	};
+
+	/** Returns the estimated time in ms the given light takes to update */
+	float EstimateCost(VobLightInfo* light);
+
+	/** Lights waiting for an update */
+	std::unordered_map<VobLightInfo*, PendingUpdate> Pending;
+
+	/** Measured time a triangle of a shadow-cube takes to draw. Adjusted after every update. */
+	float MSPerTriangle;
+
+	unsigned int FrameCounter;
+};
@@ -5,6 +5,7 @@
 #include "GothicAPI.h"
 #include <D3DX11.h>
 #include "RenderToTextureBuffer.h"
+#include "TextureConversion.h"
 
 D3D11Texture::D3D11Texture(void)
 {
@@ -36,6 +37,10 @@ XRESULT D3D11Texture::Init(INT2 size, ETextureFormat format, UINT mipMapCount, v
 
 	//Engine::GAPI->EnterResourceCriticalSection();
 
+	// Textures may get re-initialized in a different format
+	SAFE_RELEASE(Texture);
+	SAFE_RELEASE(ShaderResourceView);
+
 	TextureFormat = (DXGI_FORMAT)format;
 	TextureSize = size;
 	MipMapCount = mipMapCount;
@@ -48,7 +53,24 @@ XRESULT D3D11Texture::Init(INT2 size, ETextureFormat format, UINT mipMapCount, v
 		mipMapCount,
 		D3D11_BIND_SHADER_RESOURCE, D3D11_USAGE_DEFAULT, 0, 1, 0, 0);
 
-	LE(engine->GetDevice()->CreateTexture2D(&textureDesc, nullptr, &Texture));
+	// Point the subresources at their part of the data
+	std::vector<D3D11_SUBRESOURCE_DATA> initData;
+	if(data)
+	{
+		initData.resize(mipMapCount);
+
+		unsigned char* mip = (unsigned char*)data;
+		for(UINT i=0;i<mipMapCount;i++)
+		{
+			initData[i].pSysMem = mip;
+			initData[i].SysMemPitch = GetRowPitchBytes(i);
+			initData[i].SysMemSlicePitch = GetSizeInBytes(i);
+
+			mip += GetSizeInBytes(i);
+		}
+	}
+
+	LE(engine->GetDevice()->CreateTexture2D(&textureDesc, initData.empty() ? nullptr : &initData[0], &Texture));
 
 #ifndef PUBLIC_RELEASE
 	Texture->SetPrivateData(WKPDID_D3DDebugObjectName, fileName.size(), fileName.c_str());
@@ -99,6 +121,46 @@ XRESULT D3D11Texture::Init(const std::string& file)
 	return XR_SUCCESS;
 }
 
+/** Initializes the texture from a file, using its BC-compressed version from the texture cache */
+XRESULT D3D11Texture::InitCached(const std::string& file, ETextureCacheUsage usage)
+{
+	if(!Engine::GAPI->GetRendererState()->RendererSettings.CompressTextures)
+		return Init(file);
+
+	// Only reads the file and hashes it, the pixels aren't touched until we know it's not cached
+	TextureCacheSource source;
+	if(XR_SUCCESS != TextureCacheFile::ReadDDS(file, usage, source))
+		return Init(file); // Already compressed or nothing we can read
+
+	INT2 size = INT2(source.Width, source.Height);
+
+	TextureCacheFile cache;
+	if(TextureCacheFile::CanCompress(source.Width, source.Height) && XR_SUCCESS == cache.Load(source.Key))
+		return Init(size, (ETextureFormat)cache.GetFormat(), cache.GetNumMips(), cache.GetData(), file);
+
+	// Not cached yet. Upload it uncompressed with mips from the CPU for now.
+	TextureCacheFile::DecodeDDS(source);
+
+	std::vector<unsigned int> mipOffsets(source.NumMips);
+	unsigned int totalSize = 0;
+	for(unsigned int i=0;i<source.NumMips;i++)
+	{
+		mipOffsets[i] = totalSize;
+		totalSize += std::max(1u, source.Width >> i) * std::max(1u, source.Height >> i) * 4;
+	}
+
+	std::vector<unsigned char> mips(totalSize);
+	memcpy(&mips[0], &source.RGBA[0], source.RGBA.size());
+
+	for(unsigned int i=1;i<source.NumMips;i++)
+		TextureConversion::GenerateMipRGBA8(&mips[mipOffsets[i - 1]], std::max(1u, source.Width >> (i - 1)), std::max(1u, source.Height >> (i - 1)), &mips[mipOffsets[i]]);
+
+	XRESULT xr = Init(size, TF_R8G8B8A8, source.NumMips, &mips[0], file);
+	TextureCacheFile::CompressInBackground(source, usage);
+
+	return xr;
+}
+
 /** Updates the Texture-Object */
 XRESULT D3D11Texture::UpdateData(void* data, int mip)
 {
@@ -1,4 +1,6 @@
 #pragma once
+#include "TextureCacheFile.h"
+
 class D3D11Texture
 {
 public:
@@ -14,12 +16,16 @@ public:
 		TF_DXT5 = DXGI_FORMAT_BC3_UNORM
 	};
 
-	/** Initializes the texture object */
+	/** Initializes the texture object. If data is given, it has to hold all mip-levels, tightly packed. */
 	XRESULT Init(INT2 size, ETextureFormat format, UINT mipMapCount = 1, void* data = NULL, const std::string& fileName = "");
 
 	/** Initializes the texture from a file */
 	XRESULT Init(const std::string& file);
 
+	/** Initializes the texture from a file, using its BC-compressed version from the texture cache.
+		Uncompressed DDS-files which aren't cached yet are loaded as they are and compressed in the background. */
+	XRESULT InitCached(const std::string& file, ETextureCacheUsage usage);
+
 	/** Updates the Texture-Object */
 	XRESULT UpdateData(void* data, int mip = 0);
 
@@ -32,6 +38,15 @@ public:
 	/** Returns the size of the texture in bytes */
 	UINT GetSizeInBytes(int mip);
 
+	/** Returns the size of the top mip-level */
+	INT2 GetSize(){return TextureSize;}
+
+	/** Returns the number of mip-levels */
+	int GetMipMapCount(){return MipMapCount;}
+
+	/** Returns the format of the texture */
+	ETextureFormat GetFormat(){return (ETextureFormat)TextureFormat;}
+
 	/** Binds this texture to a pixelshader */
 	XRESULT BindToPixelShader(int slot);
 
@@ -129,6 +129,27 @@ XRESULT D3D11VertexBuffer::UpdateBufferAligned16(void* data, UINT size)
 	return XR_FAILED;
 }
 
+/** Updates a part of the buffer. Only works on buffers without CPU-access. */
+XRESULT D3D11VertexBuffer::UpdateBufferRegion(void* data, UINT offset, UINT size)
+{
+	D3D11GraphicsEngineBase* engine = (D3D11GraphicsEngineBase *)Engine::GraphicsEngine;
+
+	if(offset + size > SizeInBytes)
+		return XR_FAILED;
+
+	D3D11_BOX box;
+	box.left = offset;
+	box.right = offset + size;
+	box.top = 0;
+	box.bottom = 1;
+	box.front = 0;
+	box.back = 1;
+
+	engine->GetContext()->UpdateSubresource(VertexBuffer, 0, &box, data, 0, 0);
+
+	return XR_SUCCESS;
+}
+
 /** Maps the buffer */
 XRESULT D3D11VertexBuffer::Map(int flags, void** dataPtr, UINT* size)
 {
@@ -8,11 +8,35 @@
 #include "../D3D11Texture.h"
 #include "../zCTexture.h"
 #include "../ModSpecific.h"
+#include "../TextureConversion.h"
+#include "../TextureCacheFile.h"
 
 #define DebugWriteTex(x)  DebugWrite(x)
 
 const std::string LEAF_SUBSTR[] = {"Treetop","Bush", "Leaf"};
 
+/** Returns the format of the given surface. 16-bit surfaces with masks we don't know are read as R5G6B5, as they always were. */
+static ETexturePixelFormat GetSurfacePixelFormat(const DDPIXELFORMAT& pf)
+{
+	ETexturePixelFormat format = TextureConversion::GetPixelFormat(pf.dwRBitMask, pf.dwGBitMask, pf.dwBBitMask, pf.dwRGBAlphaBitMask);
+	int maskBits = Toolbox::GetNumberOfBits(pf.dwRBitMask) + Toolbox::GetNumberOfBits(pf.dwGBitMask) 
+		+ Toolbox::GetNumberOfBits(pf.dwBBitMask) + Toolbox::GetNumberOfBits(pf.dwRGBAlphaBitMask);
+
+	if(format == TPF_UNKNOWN && (pf.dwRGBBitCount == 16 || maskBits == 16))
+	{
+		static bool s_warned = false;
+		if(!s_warned)
+		{
+			LogWarn() << "Unknown 16-bit surface format (R: " << pf.dwRBitMask << ", G: " << pf.dwGBitMask << ", B: " << pf.dwBBitMask << ", A: " << pf.dwRGBAlphaBitMask << "), reading it as R5G6B5";
+			s_warned = true;
+		}
+
+		format = TPF_R5G6B5;
+	}
+
+	return format;
+}
+
 MyDirectDrawSurface7::MyDirectDrawSurface7()
 {
 	refCount = 1;
@@ -142,7 +166,7 @@ void MyDirectDrawSurface7::LoadAdditionalResources(zCTexture* ownedTexture)
 		
 			Engine::GraphicsEngine->CreateTexture(&nrmmapTexture);
 	
-			if(XR_SUCCESS != nrmmapTexture->Init(normalmap))
+			if(XR_SUCCESS != nrmmapTexture->InitCached(normalmap, TCU_NORMALMAP))
 			{
 				delete nrmmapTexture;
 				nrmmapTexture = NULL;
@@ -166,7 +190,7 @@ void MyDirectDrawSurface7::LoadAdditionalResources(zCTexture* ownedTexture)
 			// Create the texture object this is linked with
 			Engine::GraphicsEngine->CreateTexture(&fxMapTexture);
 	
-			if(XR_SUCCESS != fxMapTexture->Init(fxMap))
+			if(XR_SUCCESS != fxMapTexture->InitCached(fxMap, TCU_COLOR))
 			{
 				delete fxMapTexture;
 				fxMapTexture = NULL;
@@ -407,25 +431,36 @@ HRESULT MyDirectDrawSurface7::Lock( LPRECT lpDestRect, LPDDSURFACEDESC2 lpDDSurf
 	int bpp = redBits + greenBits + blueBits + alphaBits;
 	int divisor = 1;
 
-	if(bpp == 16)
+	ETexturePixelFormat format = GetSurfacePixelFormat(OriginalSurfaceDesc.ddpfPixelFormat);
+
+	if(TextureConversion::GetBytesPerPixel(format) == 2)
 		divisor = 2;
 
+	UINT lockedSize = EngineTexture->GetSizeInBytes(0) / divisor;
+	UINT lockedPitch = EngineTexture->GetRowPitchBytes(0) / divisor;
+	if(divisor == 2)
+	{
+		// The texture may have been swapped for a compressed one from the texture cache, so go by the surface
+		lockedPitch = OriginalSurfaceDesc.dwWidth * 2;
+		lockedSize = lockedPitch * OriginalSurfaceDesc.dwHeight;
+	}
+
 	if(bpp == 24)
 	{
 		// Handle movie frame,
 		// don't deallocate the memory after unlock, since only the changing parts in videos will get updated
 		if(!LockedData)
-			LockedData = new unsigned char[EngineTexture->GetSizeInBytes(0) / divisor];
+			LockedData = new unsigned char[lockedSize];
 
 	}else
 	{
 		// Allocate some temporary data
 		delete[] LockedData; LockedData = NULL;
-		LockedData = new unsigned char[EngineTexture->GetSizeInBytes(0) / divisor];
+		LockedData = new unsigned char[lockedSize];
 	}
 
 	lpDDSurfaceDesc->lpSurface = LockedData;
-	lpDDSurfaceDesc->lPitch = EngineTexture->GetRowPitchBytes(0) / divisor;
+	lpDDSurfaceDesc->lPitch = lockedPitch;
 
 	return S_OK;
 }
@@ -462,42 +497,74 @@ HRESULT MyDirectDrawSurface7::Unlock( LPRECT lpRect )
 
 	int bpp = redBits + greenBits + blueBits + alphaBits;
 
-	if(bpp == 16)
+	ETexturePixelFormat format = GetSurfacePixelFormat(OriginalSurfaceDesc.ddpfPixelFormat);
+
+	if(TextureConversion::GetBytesPerPixel(format) == 2)
 	{
-		// Convert
-		unsigned char* dst = new unsigned char[EngineTexture->GetSizeInBytes(0)];
-		for(unsigned int i=0;i<EngineTexture->GetSizeInBytes(0) / 4;i++)
+		INT2 size = EngineTexture->GetSize();
+		int numMips = EngineTexture->GetMipMapCount();
+		bool mainThread = Engine::GAPI->GetMainThreadID() == GetCurrentThreadId();
+
+		// Look for a compressed version of this in the texture cache first
+		TextureCacheSource source;
+		TextureCacheFile cache;
+		bool compress = Engine::GAPI->GetRendererState()->RendererSettings.CompressTextures && TextureCacheFile::CanCompress(size.x, size.y);
+		if(compress)
 		{
-			unsigned char temp0 = LockedData[i * 2 + 0];
-			unsigned char temp1 = LockedData[i * 2 + 1];
-			unsigned pixel_data = temp1 << 8 | temp0;
-
-			unsigned char blueComponent  = (pixel_data & 0x1F);
-			unsigned char greenComponent = (pixel_data >> 5 ) & 0x3F;
-			unsigned char redComponent   = (pixel_data >> 11) & 0x1F;
-
-			// Extract red, green and blue components from the 16 bits
-			dst[4*i+0] = (unsigned char)((redComponent  / 32.0) * 255.0f);
-			dst[4*i+1] = (unsigned char)((greenComponent  / 64.0) * 255.0f);
-			dst[4*i+2] = (unsigned char)((blueComponent  / 32.0) * 255.0f);
-			dst[4*i+3] = 255;
+			source.Width = size.x;
+			source.Height = size.y;
+			source.NumMips = numMips;
+			source.Key = TextureCacheFile::ComputeKey(LockedData, size.x * size.y * 2, format, size.x, size.y, numMips, TCU_COLOR);
 		}
 
-		if(Engine::GAPI->GetMainThreadID() != GetCurrentThreadId())
+		if(compress && XR_SUCCESS == cache.Load(source.Key))
 		{
-			EngineTexture->UpdateDataDeferred(dst, 0);
-			Engine::GAPI->AddFrameLoadedTexture(this);
-		}
-		else
+			// Creating it with the data needs no context
+			EngineTexture->Init(size, (D3D11Texture::ETextureFormat)cache.GetFormat(), numMips, cache.GetData(), TextureName);
+		}else
 		{
-			EngineTexture->UpdateData(dst, 0);
-			Engine::GAPI->AddFrameLoadedTexture(this);
-			SetReady(true); // No need to load other stuff to get this ready
-		}
+			// A cached version may have replaced the texture before
+			if(EngineTexture->GetFormat() != D3D11Texture::TF_R8G8B8A8)
+				EngineTexture->Init(size, D3D11Texture::TF_R8G8B8A8, numMips, NULL, TextureName);
+
+			// Convert to RGBA8 and build the mipmaps from that on this thread, so only the upload is left for the device
+			std::vector<unsigned int> mipOffsets(numMips);
+			unsigned int totalSize = 0;
+			for(int i=0;i<numMips;i++)
+			{
+				mipOffsets[i] = totalSize;
+				totalSize += EngineTexture->GetSizeInBytes(i);
+			}
+
+			std::vector<unsigned char> dst(totalSize);
+			TextureConversion::ConvertToRGBA8(format, LockedData, size.x * 2, &dst[0], EngineTexture->GetRowPitchBytes(0), size.x, size.y);
+
+			for(int i=1;i<numMips;i++)
+			{
+				INT2 prevSize = INT2(std::max(1, size.x >> (i - 1)), std::max(1, size.y >> (i - 1)));
+				TextureConversion::GenerateMipRGBA8(&dst[mipOffsets[i - 1]], prevSize.x, prevSize.y, &dst[mipOffsets[i]]);
+			}
+
+			for(int i=0;i<numMips;i++)
+			{
+				if(mainThread)
+					EngineTexture->UpdateData(&dst[mipOffsets[i]], i);
+				else
+					EngineTexture->UpdateDataDeferred(&dst[mipOffsets[i]], i);
+			}
 
-		delete[] dst;
+			// Next time this gets loaded, it can come from the cache
+			if(compress)
+			{
+				dst.resize(size.x * size.y * 4);
+				source.RGBA.swap(dst);
+				TextureCacheFile::CompressInBackground(source, TCU_COLOR);
+			}
+		}
 
-		EngineTexture->GenerateMipMaps();
+		Engine::GAPI->AddFrameLoadedTexture(this);
+		if(mainThread)
+			SetReady(true); // No need to load other stuff to get this ready
 		
 		// We don't actuall load mipmaps for this type, so set this
 		// so that it says the texture is fully loaded
@@ -5,6 +5,11 @@
 #include "D3D11AntTweakBar.h"
 #include "HookExceptionFilter.h"
 #include "ThreadPool.h"
+#include "TextureCacheFile.h"
+#include "LightClusterBinner.h"
+#include "VertexWelder.h"
+#include "BatchCulling.h"
+#include "RenderQueue.h"
 
 //#define TESTING
 
@@ -34,6 +39,39 @@ namespace Engine
 		// Create threadpool
 		RenderingThreadPool = new ThreadPool;
 		WorkerThreadPool = new ThreadPool;
+
+		// Keep the texture cache from growing without bounds
+		TextureCacheFile::TrimInBackground();
+
+		// Compress all custom textures up front, so none of them has to wait for the background compression in-game
+		if(GAPI->HasCommandlineParameter("XBuildTextureCache"))
+			TextureCacheFile::BuildCacheForFolder("system\\GD3D11\\textures\\replacements");
+
+		// Check the light-binning against the reference and time it, needs the workers
+		if(GAPI->HasCommandlineParameter("XTestLightClusters"))
+		{
+			LightClusterBinner::RunSelfTest();
+			LightClusterBinner::RunBenchmark();
+		}
+
+		// Check the SSE-culling against the scalar tests and time it
+		if(GAPI->HasCommandlineParameter("XTestBatchCulling"))
+		{
+			BatchCulling::RunSelfTest();
+			BatchCulling::RunBenchmark();
+		}
+
+		// Check that sorting and caching the render-queue saves binds
+		if(GAPI->HasCommandlineParameter("XTestRenderQueue"))
+			RenderQueue::RunSelfTest();
+
+		// Time the job-system
+		if(GAPI->HasCommandlineParameter("XBenchThreadPool"))
+			WorkerThreadPool->runBenchmark();
+
+		// Compare the vertex-welding with the old std::set-indexing
+		if(GAPI->HasCommandlineParameter("XBenchVertexWelder"))
+			VertexWelding::RunBenchmark();
 	}
 
 	/** Creates the Global GAPI-Object */
@@ -16,6 +16,7 @@ using namespace Assimp;
 
 GMesh::GMesh(void)
 {
+	CacheFile = NULL;
 }
 
 
@@ -25,6 +26,8 @@ GMesh::~GMesh(void)
 	{
 		delete Meshes[i];
 	}
+
+	delete CacheFile;
 }
 
 
@@ -157,6 +160,8 @@ XRESULT GMesh::LoadMesh(const std::string& file, float scale)
 		//startIndex += s->mMeshes[i]->mNumFaces * 3;
 	}
 
+	BuildMeshSections();
+
 	return XR_SUCCESS;
 }
 
@@ -185,13 +190,52 @@ void GMesh::DrawMesh()
 	}
 }
 
+/** Makes the sections point to the loaded meshes */
+void GMesh::BuildMeshSections()
+{
+	MeshSections.resize(Meshes.size());
+	for(unsigned int i=0;i<Meshes.size();i++)
+	{
+		MeshCacheSection& s = MeshSections[i];
+		s.Texture = Textures[i];
+		s.Vertices = Meshes[i]->Vertices.empty() ? NULL : &Meshes[i]->Vertices[0];
+		s.NumVertices = Meshes[i]->Vertices.size();
+		s.Indices = Meshes[i]->Indices.empty() ? NULL : &Meshes[i]->Indices[0];
+		s.NumIndices = Meshes[i]->Indices.size();
+	}
+}
+
 /** Loads the cache-file-format */
 XRESULT GMesh::LoadCached(const std::string& file)
 {
-	FILE* f = fopen(file.c_str(), "rb");
-
 	LogInfo() << "Loading cached mesh: " << file;
 
+	delete CacheFile;
+	CacheFile = new MeshCacheFile;
+
+	XRESULT xr = CacheFile->Open(file);
+	if(xr == XR_SUCCESS)
+	{
+		// Keep the file mapped, the sections point into it
+		MeshSections = CacheFile->GetSections();
+		return XR_SUCCESS;
+	}
+
+	int version = CacheFile->GetVersion();
+	delete CacheFile;
+	CacheFile = NULL;
+
+	if(version == 1)
+		return LoadCachedV1(file);
+
+	return XR_FAILED;
+}
+
+/** Loads the old version 1 cache-format */
+XRESULT GMesh::LoadCachedV1(const std::string& file)
+{
+	FILE* f = fopen(file.c_str(), "rb");
+
 	if(!f)
 	{
 		LogWarn() << "Failed to find cache file: " << file;
@@ -243,5 +287,7 @@ XRESULT GMesh::LoadCached(const std::string& file)
 
 	fclose(f);
 
+	BuildMeshSections();
+
 	return XR_SUCCESS;
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 #include "WorldConverter.h"
+#include "MeshCacheFile.h"
 
 class GMesh
 {
@@ -22,15 +23,26 @@ public:
 	/** Draws all buffers this holds */
 	void DrawMesh();
 
-	/** Returns the meshes */
+	/** Returns the meshes. Empty if a version 2 cache-file was loaded, use GetMeshSections() for those. */
 	std::vector<MeshInfo *>& GetMeshes(){return Meshes;}
 	std::vector<std::string>& GetTextures(){return Textures;}
+
+	/** Returns the geometry of all submeshes. For cache-files, this points right into the mapped file. */
+	const std::vector<MeshCacheSection>& GetMeshSections(){return MeshSections;}
 private:
 
 	/** Loads the cache-file-format */
 	XRESULT LoadCached(const std::string& file);
+	XRESULT LoadCachedV1(const std::string& file);
+
+	/** Makes the sections point to the loaded meshes */
+	void BuildMeshSections();
 
 	std::vector<MeshInfo *> Meshes;
 	std::vector<std::string> Textures;
+
+	/** Mapped cache-file, if we loaded one */
+	MeshCacheFile* CacheFile;
+	std::vector<MeshCacheSection> MeshSections;
 };
 
@@ -39,6 +39,8 @@
 #include "zCSoundSystem.h"
 #include "ModSpecific.h"
 #include "zCView.h"
+#include "ThreadPool.h"
+#include "SceneCapture.h"
 
 // Duration how long the scene will stay wet, in MS
 const DWORD SCENE_WETNESS_DURATION_MS = 60 * 2 * 1000;
@@ -127,6 +129,8 @@ GothicAPI::GothicAPI(void)
 	ZeroMemory(BoundTextures, sizeof(BoundTextures));
 
 	CameraReplacementPtr = NULL;
+	ActiveSceneCapture = NULL;
+	ActiveSceneReplay = NULL;
 	WrappedWorldMesh = NULL;
 	Ocean = NULL;
 	CurrentCamera = NULL;
@@ -144,6 +148,8 @@ GothicAPI::~GothicAPI(void)
 {
 	//ResetWorld(); // Just let it leak for now. // FIXME: Do this properly
 
+	delete ActiveSceneCapture;
+	delete ActiveSceneReplay;
 	delete Ocean;
 	delete SkyRenderer;
 	delete Inventory;
@@ -210,6 +216,10 @@ void GothicAPI::OnWorldUpdate()
 		Engine::GAPI->OnWorldLoaded();
 #endif
 
+	// The timings of the last frame are still there
+	if(ActiveSceneReplay)
+		ActiveSceneReplay->OnFrameDone(RendererState.RendererInfo);
+
 	RendererState.RendererInfo.Reset();
 	RendererState.RendererInfo.FPS = GetFramesPerSecond();
 	RendererState.GraphicsState.FF_Time = GetTimeSeconds();
@@ -223,6 +233,8 @@ void GothicAPI::OnWorldUpdate()
 		SetViewTransform(zCCamera::GetCamera()->GetTransform(zCCamera::ETransformType::TT_VIEW));
 	}
 
+	UpdateSceneCapture();
+
 	// Apply the hints for the sound system to fix voices in indoor locations being quiet
 	// This was originally done in zCBspTree::Render 
 	if(IsCameraIndoor())
@@ -297,6 +309,9 @@ bool GothicAPI::IsCameraIndoor()
 /** Returns global time */
 float GothicAPI::GetTimeSeconds()
 {
+	if(ActiveSceneReplay && ActiveSceneReplay->IsPlaying())
+		return ActiveSceneReplay->GetFrame().Time;
+
 #ifdef BUILD_GOTHIC_1_08k
 	if(zCTimer::GetTimer())
 		return zCTimer::GetTimer()->totalTimeFloat / 1000.0f; // Gothic 1 has this in seconds
@@ -311,6 +326,9 @@ float GothicAPI::GetTimeSeconds()
 /** Returns the current frame time */
 float GothicAPI::GetFrameTimeSec()
 {
+	if(ActiveSceneReplay && ActiveSceneReplay->IsPlaying())
+		return ActiveSceneReplay->GetFrame().FrameTime;
+
 #ifdef BUILD_GOTHIC_1_08k
 	if(zCTimer::GetTimer())
 		return zCTimer::GetTimer()->frameTimeFloat / 1000.0f;
@@ -461,7 +479,7 @@ void GothicAPI::RemoveVegetationBox(GVegetationBox* box)
 /** Resets the object, like at level load */
 void GothicAPI::ResetWorld()
 {
-	WorldSections.clear();
+	WorldSections.Clear();
 	
 	ResetVobs();
 
@@ -475,14 +493,11 @@ void GothicAPI::ResetWorld()
 void GothicAPI::ResetVobs()
 {
 	// Clear sections
-	for(std::map<int, std::map<int, WorldMeshSectionInfo>>::iterator itx = Engine::GAPI->GetWorldSections().begin(); itx != Engine::GAPI->GetWorldSections().end(); itx++)
+	for(std::vector<WorldMeshSectionInfo*>::const_iterator its = Engine::GAPI->GetWorldSections().GetSections().begin(); its != Engine::GAPI->GetWorldSections().GetSections().end(); its++)
 	{
-		for(std::map<int, WorldMeshSectionInfo>::iterator ity = (*itx).second.begin(); ity != (*itx).second.end(); ity++)
-		{
-			WorldMeshSectionInfo& section = (*ity).second;
+		WorldMeshSectionInfo& section = **its;
 
-			section.Vobs.clear();
-		}
+		section.Vobs.clear();
 	}
 
 	// Remove vegetation
@@ -517,6 +532,7 @@ void GothicAPI::ResetVobs()
 		delete (*it).second;
 	}
 	VobMap.clear();
+	VobInstances.Clear();
 
 	// Delete skeletal mesh vobs
 	for(std::list<SkeletalVobInfo *>::iterator it = SkeletalMeshVobs.begin(); it != SkeletalMeshVobs.end(); it++)
@@ -560,6 +576,9 @@ void GothicAPI::OnGeometryLoaded(zCPolygon** polys, unsigned int numPolygons)
 		WorldConverter::ConvertWorldMesh(polys, numPolygons, &WorldSections, LoadedWorldInfo, &WrappedWorldMesh);
 	}
 #endif
+	// The bounding boxes are final now, remember how far they reach over the cells
+	WorldSections.UpdateSectionExtents();
+
 	LogInfo() << "Done extracting world!";
 
 
@@ -854,6 +873,8 @@ void GothicAPI::DrawParticlesSimple()
 
 	if(RendererState.RendererSettings.DrawParticleEffects)
 	{
+		ParticleBuilder.BeginFrame();
+
 		D3DXVECTOR3 camPos = GetCameraPosition();
 
 		std::vector<zCVob *> renderedParticleFXs;
@@ -901,8 +922,26 @@ void GothicAPI::DrawParticlesSimple()
 				DrawParticleFX((*it), (zCParticleFX *)(*it)->GetVisual(), data);
 			}
 		}		
+
+		bool replaying = ActiveSceneReplay && ActiveSceneReplay->IsPlaying();
+
+		// Capture and replay need the instances on the CPU, otherwise they go straight to the GPU
+		ParticleBuilder.Build(ActiveSceneCapture || replaying);
+
+		if(ActiveSceneCapture || replaying)
+			ParticleBuilder.GetInstancesByTexture(FrameParticles, FrameParticleInfo);
+
+		if(ActiveSceneCapture)
+			ActiveSceneCapture->AddParticles(FrameParticles, FrameParticleInfo);
+
+		// Draw the captured particles instead. The live ones are still simulated, to learn the textures.
+		if(replaying)
+		{
+			ActiveSceneReplay->GetParticles(FrameParticles, FrameParticleInfo);
+			ParticleBuilder.BuildFromInstances(FrameParticles, FrameParticleInfo);
+		}
 		
-		Engine::GraphicsEngine->DrawFrameParticles(FrameParticles, FrameParticleInfo);
+		Engine::GraphicsEngine->DrawFrameParticles(ParticleBuilder);
 	}
 }
 
@@ -1306,6 +1345,8 @@ void GothicAPI::OnRemovedVob(zCVob* vob, zCWorld* world)
 			BspInfo* node = (*nodes)[i];
 			if(vi)
 			{
+				node->VobPositionsDirty = true;
+
 				for(std::vector<VobInfo *>::iterator bit = node->IndoorVobs.begin(); bit != node->IndoorVobs.end(); bit++)
 				{
 					if((*bit) == vi)
@@ -1424,6 +1465,7 @@ void GothicAPI::OnRemovedVob(zCVob* vob, zCWorld* world)
 	std::unordered_map<zCVob*, VobInfo*>::iterator vit = VobMap.find(vob);
 	if(vit != VobMap.end())
 	{
+		VobInstances.FreeSlot((*vit).second->InstanceSlot);
 		delete (*vit).second;
 		VobMap.erase(vob);
 	}
@@ -1431,24 +1473,24 @@ void GothicAPI::OnRemovedVob(zCVob* vob, zCWorld* world)
 	// delete light info, if valid
 	delete li;
 
-	/*for(std::list<VobInfo *>::iterator it = WorldSections[s.x][s.y].Vobs.begin(); it != WorldSections[s.x][s.y].Vobs.end(); it++)
+	/*for(std::list<VobInfo *>::iterator it = WorldSections.GetSection(s.x, s.y).Vobs.begin(); it != WorldSections.GetSection(s.x, s.y).Vobs.end(); it++)
 	{
 		if((*it)->Vob == vob)
 		{
 			VobInfo* vi = (*it);
-			WorldSections[s.x][s.y].Vobs.remove((*it));
+			WorldSections.GetSection(s.x, s.y).Vobs.remove((*it));
 
 			delete vi;
 			break;
 		}
 	}
 
-	for(std::list<VobInfo *>::iterator it = WorldSections[s.x][s.y].Vobs.begin(); it != WorldSections[s.x][s.y].Vobs.end(); it++)
+	for(std::list<VobInfo *>::iterator it = WorldSections.GetSection(s.x, s.y).Vobs.begin(); it != WorldSections.GetSection(s.x, s.y).Vobs.end(); it++)
 	{
 		if((*it)->Vob == vob)
 		{
 			VobInfo* vi = (*it);
-			WorldSections[s.x][s.y].Vobs.remove((*it));
+			WorldSections.GetSection(s.x, s.y).Vobs.remove((*it));
 
 			delete vi;
 			break;
@@ -1562,12 +1604,13 @@ void GothicAPI::OnAddVob(zCVob* vob, zCWorld* world)
 			if(world == oCGame::GetGame()->_zCSession_world)
 			{
 				VobMap[vob] = vi;
-				WorldSections[section.x][section.y].Vobs.push_back(vi);
+				WorldSections.GetSection(section.x, section.y).Vobs.push_back(vi);
 
-				vi->VobSection = &WorldSections[section.x][section.y];
+				vi->VobSection = &WorldSections.GetSection(section.x, section.y);
 	
 				// Create this constantbuffer only for non-inventory vobs because it would be recreated for each vob every frame
 				Engine::GraphicsEngine->CreateConstantBuffer(&vi->VobConstantBuffer, NULL, sizeof(VS_ExConstantBuffer_PerInstance));
+				vi->InstanceSlot = VobInstances.AllocateSlot();
 				vi->UpdateVobConstantBuffer();
 
 				if(!BspLeafVobLists.empty()) // Check if this is the initial loading
@@ -2035,7 +2078,7 @@ void GothicAPI::OnParticleFXDeleted(zCParticleFX* pfx)
 }
 
 
-/** Draws a zCParticleFX */
+/** Simulates a zCParticleFX and gathers its particles for this frame */
 void GothicAPI::DrawParticleFX(zCVob* source, zCParticleFX* fx, ParticleFrameData& data)
 {	
 	// Get our view-matrix
@@ -2059,9 +2102,6 @@ void GothicAPI::DrawParticleFX(zCVob* source, zCParticleFX* fx, ParticleFrameDat
 
 	//fx->UpdateParticleFX();
 
-	D3DXMATRIX sw; source->GetWorldMatrix(&sw);
-	D3DXMatrixTranspose(&sw, &sw);
-
 	zTParticle* pfx = fx->GetFirstParticle();
 	if(pfx)
 	{
@@ -2101,8 +2141,26 @@ void GothicAPI::DrawParticleFX(zCVob* source, zCParticleFX* fx, ParticleFrameDat
 			break;
 		}
 
-		
-		std::vector<ParticleInstanceInfo>& part = FrameParticles[texture];
+		// Work out how the particles of this emitter turn into instances
+		ParticleEmitterInfo emitter;
+
+		int alignment = fx->GetEmitter()->GetVisAlignment();
+		if(alignment == zPARTICLE_ALIGNMENT_XY)
+			emitter.DrawMode = 2;
+		else if(alignment == zPARTICLE_ALIGNMENT_VELOCITY || alignment == zPARTICLE_ALIGNMENT_VELOCITY_3D)
+			emitter.DrawMode = 3; // TODO: Y-Locked!
+
+		if(!fx->GetEmitter()->GetVisIsQuadPoly())
+			emitter.ScaleFactor = 0.5f;
+
+		if(fx->GetEmitter()->GetVisTexAniIsLooping() == 2) // 2 seems to be some magic case with sinus smoothing
+		{
+			emitter.SmoothAlpha = true;
+			emitter.AlphaStart = fx->GetEmitter()->GetVisAlphaStart();
+			emitter.AlphaDist = fx->GetEmitter()->GetAlphaDist();
+		}
+
+		ParticleBuilder.BeginEmitter(texture, inf, emitter);
 
 		// Check for kill
 		zTParticle*	kill = NULL;
@@ -2158,63 +2216,13 @@ void GothicAPI::DrawParticleFX(zCVob* source, zCParticleFX* fx, ParticleFrameDat
 				continue;
 			}*/
 
-			// Generate instance info
-			ParticleInstanceInfo ii;
-			ii.scale = D3DXVECTOR2(p->Size.x, p->Size.y);
-			ii.drawMode = 0;
-
-			// Construct world matrix
-			int alignment = fx->GetEmitter()->GetVisAlignment();
-			if(alignment == zPARTICLE_ALIGNMENT_XY)
-			{
-				ii.drawMode = 2;
-			}else if(alignment == zPARTICLE_ALIGNMENT_VELOCITY || alignment == zPARTICLE_ALIGNMENT_VELOCITY_3D)
-			{
-				// Rotate velocity so it fits with the vob
-				D3DXVECTOR3 velNrm; 
-				D3DXVec3Normalize(&velNrm, &p->Vel);
-				
-				D3DXVec3TransformNormal(&velNrm, &velNrm, &sw);
-
-				ii.velocity = velNrm;
-
-				//if(alignment == zPARTICLE_ALIGNMENT_VELOCITY)
-					ii.drawMode = 3;
-
-			} // TODO: Y-Locked!
-
-			if(!fx->GetEmitter()->GetVisIsQuadPoly())
-			{
-				ii.scale.x *= 0.5f;
-				ii.scale.y *= 0.5f;
-			}
-
-			float4 color;
-			color.x = p->Color.x / 255.0f;
-			color.y = p->Color.y / 255.0f;
-			color.z = p->Color.z / 255.0f;
-
-			if(fx->GetEmitter()->GetVisTexAniIsLooping() != 2) // 2 seems to be some magic case with sinus smoothing
-			{
-				color.w = std::min(p->Alpha, 255.0f) / 255.0f;
-			}else
-			{
-				color.w = std::min((zCParticleFX::SinSmooth(fabs((p->Alpha - fx->GetEmitter()->GetVisAlphaStart()) * fx->GetEmitter()->GetAlphaDist())) * p->Alpha) / 255.0f, 255.0f);
-			}
-
-			color.w = std::max(color.w, 0.0f);
-
-			ii.position = p->PositionWS;
-			ii.color = color;
-			ii.velocity = p->Vel;
-			part.push_back(ii);
+			// Only gather the particle here, the workers turn it into an instance later
+			ParticleBuilder.AddParticle(p->PositionWS, p->Vel, p->Color, p->Alpha, p->Size);
 
 			fx->UpdateParticle(p);
 
 			i++;
 		}
-
-		FrameParticleInfo[texture] = inf;
 	}
 
 	// Create new particles?
@@ -2330,14 +2338,14 @@ MeshInfo* GothicAPI::GetWrappedWorldMesh()
 }
 
 /** Returns the loaded sections */
-std::map<int, std::map<int, WorldMeshSectionInfo>>& GothicAPI::GetWorldSections()
+WorldSectionGrid& GothicAPI::GetWorldSections()
 {
 	return WorldSections;
 }
 
 static bool TraceWorldMeshBoxCmp(const std::pair<WorldMeshSectionInfo*, float>& a, const std::pair<WorldMeshSectionInfo*, float>& b)
 {
-	return a.second > b.second;
+	return a.second < b.second;
 }
 
 /** Traces vobs with static mesh visual */
@@ -2427,115 +2435,87 @@ SkeletalVobInfo* GothicAPI::TraceSkeletalMeshVobsBB(const D3DXVECTOR3& origin, c
 
 float GothicAPI::TraceVisualInfo(const D3DXVECTOR3& origin, const D3DXVECTOR3& dir, BaseVisualInfo* visual, zCMaterial** hitMaterial)
 {
-	float u,v,t;
-	float closest = FLT_MAX;
-
-	for(auto it = visual->Meshes.begin(); it != visual->Meshes.end(); it++)
-	{
-		for(unsigned int m = 0; m < (*it).second.size(); m++)
-		{
-			MeshInfo* mesh = (*it).second[m];
-
-			for(unsigned int i=0;i<mesh->Indices.size();i+=3)
-			{
-				if(Toolbox::IntersectTri(*mesh->Vertices[mesh->Indices[i]].Position.toD3DXVECTOR3(), 
-					*mesh->Vertices[mesh->Indices[i+1]].Position.toD3DXVECTOR3(), 
-					*mesh->Vertices[mesh->Indices[i+2]].Position.toD3DXVECTOR3(),
-					origin, dir, u,v,t))
-				{
-					if(t > 0 && t < closest)
-					{
-						closest = t;
+	MeshBVHHit h;
+	if(!visual->GetTraceBVH()->TraceClosest(origin, dir, h))
+		return -1.0f;
 
-						if(hitMaterial)
-							*hitMaterial = (*it).first;
-					}
-				}
-			}
-		}
-	}
+	if(hitMaterial)
+		*hitMaterial = visual->TraceBVHMaterials[h.Triangle->Mesh];
 
-	return closest == FLT_MAX ? -1.0f : closest;
+	return h.T;
 }
 
 
 /** Traces the worldmesh and returns the hit-location */
 bool GothicAPI::TraceWorldMesh(const D3DXVECTOR3& origin, const D3DXVECTOR3& dir, D3DXVECTOR3& hit, std::string* hitTextureName, D3DXVECTOR3* hitTriangle, MeshInfo** hitMesh, zCMaterial** hitMaterial)
 {
-	const int maxSections = 2;
+	// Only sections the ray enters before this t along dir are traced. The BVH finds the closest hit
+	// in them, so there is no limit on how many of them get traced.
+	const float maxSectionDist = 2 * WORLD_SECTION_SIZE;
 	float closest = FLT_MAX;
 	std::list<std::pair<WorldMeshSectionInfo*, float>> hitSections;
 
+	// Only sections touching the box around the origin can be hit close enough
+	float maxDist = maxSectionDist * D3DXVec3Length(&dir);
+	D3DXVECTOR3 reach = D3DXVECTOR3(maxDist, maxDist, maxDist);
+	std::vector<WorldMeshSectionInfo*> sections;
+	WorldSections.GetSectionsNearBox(origin - reach, origin + reach, sections);
+
 	// Trace bounding-boxes first
-	for(std::map<int, std::map<int, WorldMeshSectionInfo>>::iterator itx = WorldSections.begin(); itx != WorldSections.end(); itx++)
+	for(std::vector<WorldMeshSectionInfo*>::const_iterator its = sections.begin(); its != sections.end(); its++)
 	{
-		for(std::map<int, WorldMeshSectionInfo>::iterator ity = (*itx).second.begin(); ity != (*itx).second.end(); ity++)
-		{
-			WorldMeshSectionInfo& section = (*ity).second;
+		WorldMeshSectionInfo& section = **its;
 
-			if(section.WorldMeshes.empty())
-				continue;
+		if(section.WorldMeshes.empty())
+			continue;
 
-			float t = 0;
-			if(Toolbox::PositionInsideBox(origin, section.BoundingBox.Min, section.BoundingBox.Max) || Toolbox::IntersectBox(section.BoundingBox.Min, section.BoundingBox.Max, origin, dir, t))
-			{
-				if(t < maxSections * WORLD_SECTION_SIZE)
-					hitSections.push_back(std::make_pair(&section, t));		
-			}
+		float t = 0;
+		if(Toolbox::PositionInsideBox(origin, section.BoundingBox.Min, section.BoundingBox.Max) || Toolbox::IntersectBox(section.BoundingBox.Min, section.BoundingBox.Max, origin, dir, t))
+		{
+			if(t < maxSectionDist)
+				hitSections.push_back(std::make_pair(&section, t));		
 		}
 	}
-	// Distance-sort
+	// Distance-sort, closest first
 	hitSections.sort(TraceWorldMeshBoxCmp);
 
-	int numProcessed = 0;
+	MeshBVHHit closestHit;
+	WorldMeshSectionInfo* closestSection = NULL;
 	for(std::list<std::pair<WorldMeshSectionInfo*, float>>::iterator bit = hitSections.begin(); bit != hitSections.end(); bit++)
 	{
-		for(std::map<MeshKey, WorldMeshInfo*>::iterator it = (*bit).first->WorldMeshes.begin(); it != (*bit).first->WorldMeshes.end();it++)
-		{
-			float u,v,t;
+		// Nothing in this or any following section can be closer than what we already have
+		if((*bit).second > closest)
+			break;
 
-			for(unsigned int i=0;i<(*it).second->Indices.size();i+=3)
-			{
-				if(Toolbox::IntersectTri(*(*it).second->Vertices[(*it).second->Indices[i]].Position.toD3DXVECTOR3(), 
-					*(*it).second->Vertices[(*it).second->Indices[i+1]].Position.toD3DXVECTOR3(), 
-					*(*it).second->Vertices[(*it).second->Indices[i+2]].Position.toD3DXVECTOR3(),
-					origin, dir, u,v,t))
-				{
-					if(t > 0 && t < closest)
-					{
-						closest = t;
+		MeshBVHHit h;
+		if((*bit).first->GetTraceBVH()->TraceClosest(origin, dir, h, closest))
+		{
+			closest = h.T;
+			closestHit = h;
+			closestSection = (*bit).first;
+		}
+	}
 
-						if(hitTriangle)
-						{
-							hitTriangle[0] = *(*it).second->Vertices[(*it).second->Indices[i]].Position.toD3DXVECTOR3();
-							hitTriangle[1] = *(*it).second->Vertices[(*it).second->Indices[i+1]].Position.toD3DXVECTOR3();
-							hitTriangle[2] = *(*it).second->Vertices[(*it).second->Indices[i+2]].Position.toD3DXVECTOR3();	 
-						}
+	if(!closestSection)
+		return false;
 
-						if(hitMesh)
-						{
-							*hitMesh = (*it).second;
-						}
+	const std::pair<MeshKey, WorldMeshInfo*>& mesh = closestSection->TraceBVHMeshes[closestHit.Triangle->Mesh];
 
-						if(hitMaterial)
-						{
-							*hitMaterial = (*it).first.Material;
-						}
+	if(hitTriangle)
+	{
+		hitTriangle[0] = closestHit.Triangle->V[0];
+		hitTriangle[1] = closestHit.Triangle->V[1];
+		hitTriangle[2] = closestHit.Triangle->V[2];
+	}
 
-						if(hitTextureName && (*it).first.Material && (*it).first.Material->GetTexture())
-							*hitTextureName = (*it).first.Material->GetTexture()->GetNameWithoutExt();
-					}
-				}
-			}
+	if(hitMesh)
+		*hitMesh = mesh.second;
 
-			numProcessed++;
+	if(hitMaterial)
+		*hitMaterial = mesh.first.Material;
 
-			if(numProcessed == maxSections && closest != FLT_MAX)
-				break;
-		}
-	}
-	if(closest == FLT_MAX)
-		return false;
+	if(hitTextureName && mesh.first.Material && mesh.first.Material->GetTexture())
+		*hitTextureName = mesh.first.Material->GetTexture()->GetNameWithoutExt();
 
 	hit = origin + dir * closest;
 
@@ -2901,29 +2881,96 @@ void GothicAPI::CollectVisibleVobs(std::vector<VobInfo *>& vobs, std::vector<Vob
 
 	return;*/
 
-	// Recursively go through the tree and draw all nodes
-	CollectVisibleVobsHelper(root, root->OriginalNode->BBox3D, 63, vobs, lights, mobs);
+	// Gather the settings once instead of at every node
+	VobCollectionContext ctx;
+	ctx.Camera = zCCamera::GetCamera();
+	ctx.CameraPosition = GetCameraPosition();
+	ctx.YMaxWorld = rootBsp->BBox3D.Max.y;
+	ctx.IndoorVobDrawRadius = RendererState.RendererSettings.IndoorVobDrawRadius;
+	ctx.OutdoorVobDrawRadius = RendererState.RendererSettings.OutdoorVobDrawRadius;
+	ctx.OutdoorSmallVobDrawRadius = RendererState.RendererSettings.OutdoorSmallVobDrawRadius;
+	ctx.SmallVobSize = RendererState.RendererSettings.SmallVobSize;
+	ctx.VisualFXDrawRadius = RendererState.RendererSettings.VisualFXDrawRadius;
+	ctx.EnableOcclusionCulling = RendererState.RendererSettings.EnableOcclusionCulling;
+	ctx.EnableDynamicLighting = RendererState.RendererSettings.EnableDynamicLighting;
+	ctx.DrawVOBs = RendererState.RendererSettings.DrawVOBs;
+	ctx.DrawMobs = RendererState.RendererSettings.DrawMobs;
+
+	// Go through the upper part of the tree here and split the rest into subtrees, in the order the serial traversal would visit them
+	VobCollectionTasks.clear();
+	if(Engine::WorkerThreadPool)
+	{
+		VobCollectionList unused;
+		CollectVisibleVobsHelper(ctx, root, root->OriginalNode->BBox3D, 63, 0, unused, &VobCollectionTasks);
+	}else
+	{
+		VobCollectionTask task;
+		task.Base = root;
+		task.BoxCell = root->OriginalNode->BBox3D;
+		task.ClipFlags = 63;
+		VobCollectionTasks.push_back(task);
+	}
 
-	D3DXVECTOR3 camPos = GetCameraPosition();
-	float vobIndoorDist = Engine::GAPI->GetRendererState()->RendererSettings.IndoorVobDrawRadius;
-	float vobOutdoorDist = Engine::GAPI->GetRendererState()->RendererSettings.OutdoorVobDrawRadius;
-	float vobOutdoorSmallDist = Engine::GAPI->GetRendererState()->RendererSettings.OutdoorSmallVobDrawRadius;
-	float vobSmallSize = Engine::GAPI->GetRendererState()->RendererSettings.SmallVobSize;
+	if(VobCollectionLists.size() < VobCollectionTasks.size())
+		VobCollectionLists.resize(VobCollectionTasks.size());
+
+	// Every subtree writes into its own list, so the result doesn't depend on which thread took it
+	auto collectSubtree = [&](unsigned int i)
+	{
+		const VobCollectionTask& task = VobCollectionTasks[i];
+		VobCollectionLists[i].Clear();
+		CollectVisibleVobsHelper(ctx, task.Base, task.BoxCell, task.ClipFlags, 0, VobCollectionLists[i], NULL);
+	};
+
+	if(Engine::WorkerThreadPool)
+		Engine::WorkerThreadPool->parallel_for(0, VobCollectionTasks.size(), 1, collectSubtree);
+	else
+		collectSubtree(0);
+
+	// Merge in traversal-order. Vobs can be in multiple leafs, the first one to reach them adds them, as before.
+	for(unsigned int i=0;i<VobCollectionTasks.size();i++)
+		MergeVisibleVobs(VobCollectionLists[i], vobs, lights, mobs);
+
+	D3DXVECTOR3 camPos = ctx.CameraPosition;
+	float vobIndoorDist = ctx.IndoorVobDrawRadius;
+	float vobOutdoorDist = ctx.OutdoorVobDrawRadius;
+	float vobOutdoorSmallDist = ctx.OutdoorSmallVobDrawRadius;
+	float vobSmallSize = ctx.SmallVobSize;
 
 	std::list<VobInfo*> removeList; // FIXME: This should not be needed!
 
-	// Add visible dynamically added vobs
-	for(std::list<VobInfo*>::iterator it = DynamicallyAddedVobs.begin(); it != DynamicallyAddedVobs.end(); it++)
+	// Gather the dynamic vobs with the largest radius they would be drawn in, so the distances can be checked in one batch
+	DynamicVobPositions.Clear();
+	if(ctx.DrawVOBs)
 	{
-		// Get distance to this vob
-		float dist = D3DXVec3Length(&(camPos - (*it)->Vob->GetPositionWorld()));
+		for(std::list<VobInfo*>::iterator it = DynamicallyAddedVobs.begin(); it != DynamicallyAddedVobs.end(); it++)
+		{
+			float radius = -1.0f; // Never drawn without visual
+			if((*it)->VisualInfo)
+			{
+				radius = vobOutdoorDist;
+
+				if((*it)->IsIndoorVob)
+					radius = std::max(radius, vobIndoorDist);
+
+				if((*it)->VisualInfo->MeshSize < vobSmallSize)
+					radius = std::max(radius, vobOutdoorSmallDist);
+			}
+
+			DynamicVobPositions.Add((*it)->Vob->GetPositionWorld(), radius);
+		}
 
-		if(Engine::GAPI->GetRendererState()->RendererSettings.DrawVOBs)
+		BatchCulling::CullPointsInRadius(DynamicVobPositions, camPos, CullMask);
+	}
+
+	// Add visible dynamically added vobs
+	unsigned int dynamicVobIndex = 0;
+	for(std::list<VobInfo*>::iterator it = DynamicallyAddedVobs.begin(); it != DynamicallyAddedVobs.end(); it++, dynamicVobIndex++)
+	{
+		if(ctx.DrawVOBs)
 		{
 			// Draw, if in range
-			if((*it)->VisualInfo && ((dist < vobIndoorDist && (*it)->IsIndoorVob) || 
-				(dist < vobOutdoorSmallDist && (*it)->VisualInfo->MeshSize < vobSmallSize) || 
-				(dist < vobOutdoorDist)))
+			if(BatchCulling::IsVisible(CullMask, dynamicVobIndex))
 			{
 #ifdef BUILD_GOTHIC_1_08k
 				// FIXME: This is sometimes NULL, suggesting that the Vob is invalid. Why does this happen?
@@ -2939,23 +2986,18 @@ void GothicAPI::CollectVisibleVobs(std::vector<VobInfo *>& vobs, std::vector<Vob
 
 				}
 
-				VobInstanceInfo vii;
-				vii.world = (*it)->WorldMatrix;
-				vii.color = (*it)->GroundColor;
-
-				/*if((*it)->IsIndoorVob)
-					vii.color = float4(DEFAULT_INDOOR_VOB_AMBIENT).ToDWORD();
-				else
-					vii.color = 0xFFFFFFFF;*/
-
-				((MeshVisualInfo *)(*it)->VisualInfo)->Instances.push_back(vii);
-
 				vobs.push_back(*it);
 				(*it)->VisibleInRenderPass = true;
 			}
 		}
 	}
 
+	if(ActiveSceneCapture)
+		ActiveSceneCapture->AddVisibleVobs(vobs, lights, mobs);
+
+	if(ActiveSceneReplay)
+		ActiveSceneReplay->ReplaceVisibleVobs(vobs, lights, mobs, VobMap, VobLightMap);
+
 #ifdef BUILD_GOTHIC_1_08k
 	// FIXME: See above for info on this
 	for(auto it = removeList.begin();it!=removeList.end();it++)
@@ -2972,28 +3014,35 @@ void GothicAPI::CollectVisibleSections(std::list<WorldMeshSectionInfo*>& section
 	D3DXVECTOR3 camPos = Engine::GAPI->GetCameraPosition();
 	INT2 camSection = WorldConverter::GetSectionOfPos(camPos);
 
-	// run through every section and check for range and frustum
+	// Get the sections in range, the frustum is checked for all of them at once afterwards
+	SectionCullBoxes.Clear();
+	SectionCullList.clear();
+
 	int sectionViewDist = Engine::GAPI->GetRendererState()->RendererSettings.SectionDrawRadius;
-	for(std::map<int, std::map<int, WorldMeshSectionInfo>>::iterator itx = WorldSections.begin(); itx != WorldSections.end(); itx++)
+	WorldSections.ForEachSectionInRange(camSection, sectionViewDist, [&](WorldMeshSectionInfo& section)
 	{
-		for(std::map<int, WorldMeshSectionInfo>::iterator ity = (*itx).second.begin(); ity != (*itx).second.end(); ity++)
-		{
-			WorldMeshSectionInfo& section = (*ity).second;
+		SectionCullBoxes.Add(section.BoundingBox.Min, section.BoundingBox.Max);
+		SectionCullList.push_back(&section);
+	});
 
-			// Simple range-check
-			if(abs((*itx).first - camSection.x) < sectionViewDist && 
-				abs((*ity).first - camSection.y) < sectionViewDist)
-			{
-				int flags = 15; // Frustum check, no farplane
-				if(zCCamera::GetCamera()->BBox3DInFrustum(section.BoundingBox, flags) == ZTCAM_CLIPTYPE_OUT)
-					continue;
+	// Frustum check, no farplane
+	CullFrustum frustum;
+	frustum.Init(zCCamera::GetCamera()->GetFrustumPlanes(), zCCamera::GetCamera()->GetFrustumSignBits(), 15);
+	BatchCulling::CullAABBs(SectionCullBoxes, frustum, CullMask);
 
-				sections.push_back(&section);
+	for(unsigned int i=0;i<SectionCullList.size();i++)
+	{
+		if(BatchCulling::IsVisible(CullMask, i))
+			sections.push_back(SectionCullList[i]);
 
-				//Engine::GraphicsEngine->GetLineRenderer()->AddAABBMinMax((*ity).second.BoundingBox.Min, (*ity).second.BoundingBox.Max, D3DXVECTOR4(0,0,1,0.5f));
-			}			
-		}
+		//Engine::GraphicsEngine->GetLineRenderer()->AddAABBMinMax(SectionCullList[i]->BoundingBox.Min, SectionCullList[i]->BoundingBox.Max, D3DXVECTOR4(0,0,1,0.5f));
 	}
+
+	if(ActiveSceneCapture)
+		ActiveSceneCapture->AddVisibleSections(sections);
+
+	if(ActiveSceneReplay)
+		ActiveSceneReplay->ReplaceVisibleSections(sections, WorldSections);
 }
 
 /** Moves the given vob from a BSP-Node to the dynamic vob list */
@@ -3026,6 +3075,7 @@ void GothicAPI::MoveVobFromBspToDynamic(VobInfo* vob)
 	for(size_t i=0;i<vob->ParentBSPNodes.size();i++)
 	{
 		BspInfo* node = vob->ParentBSPNodes[i];
+		node->VobPositionsDirty = true;
 
 		// Remove from possible lists
 		for(std::vector<VobInfo *>::iterator it = node->IndoorVobs.begin(); it != node->IndoorVobs.end(); it++)
@@ -3071,6 +3121,7 @@ std::vector<VobInfo *>::iterator GothicAPI::MoveVobFromBspToDynamic(VobInfo* vob
 	for(size_t i=0;i<vob->ParentBSPNodes.size();i++)
 	{
 		BspInfo* node = vob->ParentBSPNodes[i];
+		node->VobPositionsDirty = true;
 
 		// Remove from possible lists
 		for(std::vector<VobInfo *>::iterator it = node->IndoorVobs.begin(); it != node->IndoorVobs.end(); it++)
@@ -3116,53 +3167,33 @@ std::vector<VobInfo *>::iterator GothicAPI::MoveVobFromBspToDynamic(VobInfo* vob
 	return itn;
 }
 
-static void CVVH_AddNotDrawnVobToList(std::vector<VobInfo *>& target, std::vector<VobInfo *>& source, float dist)
+/** Adds the vobs of the source-list which are in range. Whether they were already drawn is checked when merging. */
+static void CVVH_AddVisibleVobsToList(const VobCollectionContext& ctx, std::vector<VobInfo *>& target, const std::vector<VobInfo *>& source, const PointBatch& positions, float dist, std::vector<unsigned int>& cullMask)
 {
-	std::vector<VobInfo *> remVobs;
+	// Check the distances in one go, only the vobs in range need to be looked at
+	BatchCulling::CullPoints(positions, ctx.CameraPosition, dist, cullMask);
 
-	for(std::vector<VobInfo *>::iterator it = source.begin(); it != source.end(); it++)
+	for(unsigned int i=0;i<source.size();i++)
 	{
-		if(!(*it)->VisibleInRenderPass)
-		{	
-			VobInstanceInfo vii;
-
-			float vd = D3DXVec3Length(&(Engine::GAPI->GetCameraPosition() - (*it)->LastRenderPosition));
-			if(vd < dist && (*it)->Vob->GetShowVisual())
-			{
-				// Update if near and moved
-				/*if(vd < dist / 4 && memcmp(&(*it)->LastRenderPosition, (*it)->Vob->GetPositionWorld(), sizeof(D3DXVECTOR3)) != 0)
-				{
-					(*it)->LastRenderPosition = (*it)->Vob->GetPositionWorld();
-					(*it)->UpdateVobConstantBuffer();				
-
-					Engine::GAPI->GetRendererState()->RendererInfo.FrameVobUpdates++;
-
-					remVobs.push_back((*it));
-			
-					continue; // Render with the other dynamic vobs
-				}*/
-
-				VobInstanceInfo vii;
-				vii.world = (*it)->WorldMatrix;
-				vii.color = (*it)->GroundColor;
+		if(BatchCulling::IsVisible(cullMask, i) && source[i]->Vob->GetShowVisual())
+			target.push_back(source[i]);
+	}
+}
 
-				//if((*it)->IsIndoorVob)
-				//	vii.color = float4(DEFAULT_INDOOR_VOB_AMBIENT).ToDWORD();
-				//else
-				//	vii.color = 0xFFFFFFFF;
+/** Copies the positions of the vobs into the batches of the node */
+static void CVVH_UpdateVobPositions(BspInfo* base)
+{
+	const std::vector<VobInfo *>* lists[] = {&base->IndoorVobs, &base->SmallVobs, &base->Vobs};
+	PointBatch* positions[] = {&base->IndoorVobPositions, &base->SmallVobPositions, &base->VobPositions};
 
-				((MeshVisualInfo *)(*it)->VisualInfo)->Instances.push_back(vii);
-				target.push_back((*it));
-				(*it)->VisibleInRenderPass = true;
-			}
-		}
+	for(int l=0;l<3;l++)
+	{
+		positions[l]->Clear();
+		for(unsigned int i=0;i<lists[l]->size();i++)
+			positions[l]->Add((*lists[l])[i]->LastRenderPosition);
 	}
 
-	/*for(std::vector<VobInfo *>::iterator it = remVobs.begin(); it != remVobs.end(); it++)
-	{
-		// Move to dynamic vob-list since these vobs have moved this frame
-		Engine::GAPI->MoveVobFromBspToDynamic((*it));
-	}*/
+	base->VobPositionsDirty = false;
 }
 
 static void CVVH_AddNotDrawnVobToList(std::vector<VobLightInfo *>& target, std::vector<VobLightInfo *>& source, float dist)
@@ -3185,39 +3216,34 @@ static void CVVH_AddNotDrawnVobToList(std::vector<VobLightInfo *>& target, std::
 	}
 }
 
-static void CVVH_AddNotDrawnVobToList(std::vector<SkeletalVobInfo *>& target, std::vector<SkeletalVobInfo *>& source, float dist)
+static void CVVH_AddVisibleVobsToList(const VobCollectionContext& ctx, std::vector<SkeletalVobInfo *>& target, const std::vector<SkeletalVobInfo *>& source, float dist)
 {
-	for(std::vector<SkeletalVobInfo *>::iterator it = source.begin(); it != source.end(); it++)
+	for(std::vector<SkeletalVobInfo *>::const_iterator it = source.begin(); it != source.end(); it++)
 	{
-		if(!(*it)->VisibleInRenderPass)
-		{
-			float vd = D3DXVec3Length(&(Engine::GAPI->GetCameraPosition() - (*it)->Vob->GetPositionWorld()));
-			if(vd < dist && (*it)->Vob->GetShowVisual())
-			{
-				//(*it)->VisualInfo->Instances.push_back((*it)->WorldMatrix);
-				target.push_back((*it));
-				(*it)->VisibleInRenderPass = true;
-
-
-			}
-		}
+		float vd = D3DXVec3Length(&(ctx.CameraPosition - (*it)->Vob->GetPositionWorld()));
+		if(vd < dist && (*it)->Vob->GetShowVisual())
+			target.push_back((*it));
 	}
 }
 
 /** Recursive helper function to draw collect the vobs */
-void GothicAPI::CollectVisibleVobsHelper(BspInfo* base, zTBBox3D boxCell, int clipFlags, std::vector<VobInfo *>& vobs, std::vector<VobLightInfo *>& lights, std::vector<SkeletalVobInfo *>& mobs)
+void GothicAPI::CollectVisibleVobsHelper(const VobCollectionContext& ctx, BspInfo* base, zTBBox3D boxCell, int clipFlags, int depth, VobCollectionList& out, std::vector<VobCollectionTask>* outTasks)
 {
-	float vobIndoorDist = Engine::GAPI->GetRendererState()->RendererSettings.IndoorVobDrawRadius;
-	float vobOutdoorDist = Engine::GAPI->GetRendererState()->RendererSettings.OutdoorVobDrawRadius;
-	float vobOutdoorSmallDist = Engine::GAPI->GetRendererState()->RendererSettings.OutdoorSmallVobDrawRadius;
-	float vobSmallSize = Engine::GAPI->GetRendererState()->RendererSettings.SmallVobSize;
-	float visualFXDrawRadius = Engine::GAPI->GetRendererState()->RendererSettings.VisualFXDrawRadius;
-	D3DXVECTOR3 camPos = Engine::GAPI->GetCameraPosition();
-
 	while(base->OriginalNode)
 	{
+		// Leave the rest of this subtree to a worker
+		if(outTasks && (depth >= BSP_PARALLEL_SPLIT_DEPTH || base->OriginalNode->IsLeaf()))
+		{
+			VobCollectionTask task;
+			task.Base = base;
+			task.BoxCell = boxCell;
+			task.ClipFlags = clipFlags;
+			outTasks->push_back(task);
+			return;
+		}
+
 		// Check for occlusion-culling
-		if(Engine::GAPI->GetRendererState()->RendererSettings.EnableOcclusionCulling && 
+		if(ctx.EnableOcclusionCulling && 
 			!base->OcclusionInfo.VisibleLastFrame)
 		{
 			return;
@@ -3225,23 +3251,20 @@ void GothicAPI::CollectVisibleVobsHelper(BspInfo* base, zTBBox3D boxCell, int cl
 
 		if (clipFlags>0) 
 		{
-			float yMaxWorld = Engine::GAPI->GetLoadedWorldInfo()->BspTree->GetRootNode()->BBox3D.Max.y;
-
 			zTBBox3D nodeBox = base->OriginalNode->BBox3D;
-			float nodeYMax = std::min(yMaxWorld, Engine::GAPI->GetCameraPosition().y);
+			float nodeYMax = std::min(ctx.YMaxWorld, ctx.CameraPosition.y);
 			nodeYMax = std::max(nodeYMax, base->OriginalNode->BBox3D.Max.y);
 			nodeBox.Max.y = nodeYMax;
 
-			float dist = Toolbox::ComputePointAABBDistance(camPos, base->OriginalNode->BBox3D.Min, base->OriginalNode->BBox3D.Max);
-			if(dist < vobOutdoorDist)
+			float dist = Toolbox::ComputePointAABBDistance(ctx.CameraPosition, base->OriginalNode->BBox3D.Min, base->OriginalNode->BBox3D.Max);
+			if(dist < ctx.OutdoorVobDrawRadius)
 			{
+				// The frustum-test only reads the planes of the activated camera, so this is fine on the workers
 				zTCam_ClipType nodeClip;
-				if(!Engine::GAPI->GetRendererState()->RendererSettings.EnableOcclusionCulling)
-					nodeClip = zCCamera::GetCamera()->BBox3DInFrustum(nodeBox, clipFlags);
+				if(!ctx.EnableOcclusionCulling)
+					nodeClip = ctx.Camera->BBox3DInFrustum(nodeBox, clipFlags);
 				else
 					nodeClip = (zTCam_ClipType)base->OcclusionInfo.LastCameraClipType; // If we are using occlusion-clipping, this test has already been done
-				
-				//float dist = D3DXVec3Length(&(base->BBox3D.Min - camPos));
 
 				if (nodeClip==ZTCAM_CLIPTYPE_OUT) 
 					return; // Nothig to see here. Discard this node and the subtree}
@@ -3252,129 +3275,41 @@ void GothicAPI::CollectVisibleVobsHelper(BspInfo* base, zTBBox3D boxCell, int cl
 			}
 		}
 
-
-
 		if(base->OriginalNode->IsLeaf())
 		{
-			//Engine::GraphicsEngine->GetLineRenderer()->AddAABBMinMax(base->OriginalNode->BBox3D.Min, base->OriginalNode->BBox3D.Max, D3DXVECTOR4(1,1,0,1));
-
-			// Check if this leaf is inside the frustum
-			bool insideFrustum = true;
-			if(clipFlags > 0) 
-			{
-				/*zTCam_ClipType nodeClip;
-				if(!Engine::GAPI->GetRendererState()->RendererSettings.EnableOcclusionCulling)
-					nodeClip = zCCamera::GetCamera()->BBox3DInFrustum(base->OriginalNode->BBox3D, clipFlags);
-				else
-					nodeClip = base->OcclusionInfo.LastCameraClipType; // If we are using occlusion-clipping, this test has already been done
-					*/
-
-				//if(zCCamera::GetCamera()->BBox3DInFrustum(base->OriginalNode->BBox3D, clipFlags) == ZTCAM_CLIPTYPE_OUT) 
-				//	insideFrustum = false; // TODO: Is this check even needed?
-			}
 			zCBspLeaf* leaf = (zCBspLeaf *)base->OriginalNode;
-			//BspInfo& bvi = BspLeafVobLists[leaf];
-			std::vector<VobInfo *>& listA = base->IndoorVobs;
-			std::vector<VobInfo *>& listB = base->SmallVobs;
-			std::vector<VobInfo *>& listC = base->Vobs;
-			std::vector<SkeletalVobInfo *>& listD = base->Mobs;
-			std::vector<VobLightInfo *>& listL = base->Lights;
-			std::vector<VobLightInfo *>& listL_Indoor = base->IndoorLights;
 
 			// Concat the lists
-			float dist = Toolbox::ComputePointAABBDistance(camPos, base->OriginalNode->BBox3D.Min, base->OriginalNode->BBox3D.Max);
-			// float dist = D3DXVec3Length(&(base->BBox3D.Min - camPos));
+			float dist = Toolbox::ComputePointAABBDistance(ctx.CameraPosition, base->OriginalNode->BBox3D.Min, base->OriginalNode->BBox3D.Max);
 
-			if(insideFrustum)
+			if(ctx.DrawVOBs)
 			{
-				if(Engine::GAPI->GetRendererState()->RendererSettings.DrawVOBs)
-				{
-					if(dist < vobIndoorDist)
-						CVVH_AddNotDrawnVobToList(vobs, listA, vobIndoorDist);
-
-					if(dist < vobOutdoorSmallDist)
-						CVVH_AddNotDrawnVobToList(vobs, listB, vobOutdoorSmallDist);
-				}
-
-				if(dist < vobOutdoorDist)
-				{
-					if(Engine::GAPI->GetRendererState()->RendererSettings.DrawVOBs)
-					{
-						CVVH_AddNotDrawnVobToList(vobs, listC, vobOutdoorDist);
-					}
+				// Every leaf belongs to exactly one task, so this doesn't race with the other workers
+				if(base->VobPositionsDirty)
+					CVVH_UpdateVobPositions(base);
 
-				}
-
-				if(Engine::GAPI->GetRendererState()->RendererSettings.DrawMobs && dist < vobOutdoorSmallDist)
-				{
-					CVVH_AddNotDrawnVobToList(mobs, listD, vobOutdoorDist);
+				if(dist < ctx.IndoorVobDrawRadius)
+					CVVH_AddVisibleVobsToList(ctx, out.Vobs, base->IndoorVobs, base->IndoorVobPositions, ctx.IndoorVobDrawRadius, out.CullMask);
 
-					/*if(RendererState.RendererSettings.EnableDynamicLighting)
-					{
-						if(!listL.empty() && Engine::GAPI->GetRendererState()->RendererSettings.EnableDynamicLighting)
-							CVVH_AddNotDrawnVobToList(lights, listL, vobOutdoorSmallDist);
+				if(dist < ctx.OutdoorSmallVobDrawRadius)
+					CVVH_AddVisibleVobsToList(ctx, out.Vobs, base->SmallVobs, base->SmallVobPositions, ctx.OutdoorSmallVobDrawRadius, out.CullMask);
 
-						if(dist < vobIndoorDist)
-							CVVH_AddNotDrawnVobToList(lights, listL_Indoor, vobIndoorDist);
-					}*/
-				}
+				if(dist < ctx.OutdoorVobDrawRadius)
+					CVVH_AddVisibleVobsToList(ctx, out.Vobs, base->Vobs, base->VobPositions, ctx.OutdoorVobDrawRadius, out.CullMask);
 			}
 
-			if(RendererState.RendererSettings.EnableDynamicLighting && insideFrustum)
-			{
-				// Add dynamic lights
-				float minDynamicUpdateLightRange = Engine::GAPI->GetRendererState()->RendererSettings.MinLightShadowUpdateRange;
-				D3DXVECTOR3 playerPosition = Engine::GAPI->GetPlayerVob() != NULL ? Engine::GAPI->GetPlayerVob()->GetPositionWorld() : D3DXVECTOR3(FLT_MAX, FLT_MAX, FLT_MAX);
-
-				// Take cameraposition if we are freelooking
-				if(zCCamera::IsFreeLookActive())
-					playerPosition = Engine::GAPI->GetCameraPosition();
+			if(ctx.DrawMobs && dist < ctx.OutdoorSmallVobDrawRadius)
+				CVVH_AddVisibleVobsToList(ctx, out.Mobs, base->Mobs, ctx.OutdoorVobDrawRadius);
 
+			if(ctx.EnableDynamicLighting)
+			{
+				// Only collect the lights in range here, registering them has to happen when merging
 				for(int i=0;i<leaf->LightVobList.NumInArray;i++)
 				{
-					float lightCameraDist = D3DXVec3Length(&(Engine::GAPI->GetCameraPosition() - leaf->LightVobList.Array[i]->GetPositionWorld()));
-					if(lightCameraDist + leaf->LightVobList.Array[i]->GetLightRange() < visualFXDrawRadius)
-					{
-						zCVobLight* v = leaf->LightVobList.Array[i];
-						VobLightInfo** vi = &VobLightMap[leaf->LightVobList.Array[i]];
-
-						// Check if we already have this light
-						if(!*vi)
-						{
-							// Add if not. This light must have been added during gameplay
-							*vi = new VobLightInfo;
-							(*vi)->Vob = leaf->LightVobList.Array[i];
-
-							// Create shadow-buffers for these lights since it was dynamically added to the world
-							if(RendererState.RendererSettings.EnablePointlightShadows >= GothicRendererSettings::PLS_STATIC_ONLY)
-								Engine::GraphicsEngine->CreateShadowedPointLight(&(*vi)->LightShadowBuffers, *vi, true); // Also flag as dynamic
-						}
-
-						if(!(*vi)->VisibleInRenderPass && (*vi)->Vob->IsEnabled())
-						{
-							(*vi)->VisibleInRenderPass = true;
-
-							//D3DXVECTOR3 mid = base->BBox3D.Min * 0.5f + base->BBox3D.Max * 0.5f;
-							//Engine::GraphicsEngine->GetLineRenderer()->AddLine(LineVertex((*vi)->Vob->GetPositionWorld()), LineVertex(mid));
-
-							float lightPlayerDist = D3DXVec3Length(&(playerPosition - leaf->LightVobList.Array[i]->GetPositionWorld()));
-
-							// Update the lights shadows if: Light is dynamic or full shadow-updates are set
-							if(RendererState.RendererSettings.EnablePointlightShadows >= GothicRendererSettings::PLS_FULL
-								|| (RendererState.RendererSettings.EnablePointlightShadows >= GothicRendererSettings::PLS_UPDATE_DYNAMIC && !(*vi)->Vob->IsStatic()))
-							{
-								// Now check for distances, etc
-								if( (*vi)->Vob->GetLightRange() > minDynamicUpdateLightRange 
-									&& lightPlayerDist < (*vi)->Vob->GetLightRange() * 1.5f)
-									(*vi)->UpdateShadows = true;
-							}
-							// Render it
-							lights.push_back(*vi);
-						}
-					}else
-					{
-						//Engine::GraphicsEngine->GetLineRenderer()->AddPointLocator(leaf->LightVobList.Array[i]->GetPositionWorld(), 10.0f, D3DXVECTOR4(0,1,0,1));
-					}
+					zCVobLight* light = leaf->LightVobList.Array[i];
+					float lightCameraDist = D3DXVec3Length(&(ctx.CameraPosition - light->GetPositionWorld()));
+					if(lightCameraDist + light->GetLightRange() < ctx.VisualFXDrawRadius)
+						out.Lights.push_back(light);
 				}
 			}
 			
@@ -3388,13 +3323,15 @@ void GothicAPI::CollectVisibleVobsHelper(BspInfo* base, zTBBox3D boxCell, int cl
 			boxCell.Min.y	= node->BBox3D.Min.y;
 			boxCell.Max.y	= node->BBox3D.Min.y;
 
+			depth++;
+
 			zTBBox3D tmpbox = boxCell;
-			if (D3DXVec3Dot(&node->Plane.Normal, &GetCameraPosition()) > node->Plane.Distance)
+			if (D3DXVec3Dot(&node->Plane.Normal, &ctx.CameraPosition) > node->Plane.Distance)
 			{ 
 				if(node->Front) 
 				{
 					((float *)&tmpbox.Min)[planeAxis] = node->Plane.Distance;
-					CollectVisibleVobsHelper(base->Front, tmpbox, clipFlags, vobs, lights, mobs);
+					CollectVisibleVobsHelper(ctx, base->Front, tmpbox, clipFlags, depth, out, outTasks);
 				}
 
 				((float *)&boxCell.Max)[planeAxis] = node->Plane.Distance;
@@ -3405,7 +3342,7 @@ void GothicAPI::CollectVisibleVobsHelper(BspInfo* base, zTBBox3D boxCell, int cl
 				if (node->Back ) 
 				{
 					((float *)&tmpbox.Max)[planeAxis] = node->Plane.Distance;
-					CollectVisibleVobsHelper(base->Back, tmpbox, clipFlags, vobs, lights, mobs);
+					CollectVisibleVobsHelper(ctx, base->Back, tmpbox, clipFlags, depth, out, outTasks);
 				}
 
 				((float *)&boxCell.Min)[planeAxis] = node->Plane.Distance;
@@ -3415,6 +3352,78 @@ void GothicAPI::CollectVisibleVobsHelper(BspInfo* base, zTBBox3D boxCell, int cl
 	}
 }
 
+/** Adds the collected vobs which weren't already drawn in this pass to the output-lists */
+void GothicAPI::MergeVisibleVobs(const VobCollectionList& list, std::vector<VobInfo *>& vobs, std::vector<VobLightInfo *>& lights, std::vector<SkeletalVobInfo *>& mobs)
+{
+	for(unsigned int i=0;i<list.Vobs.size();i++)
+	{
+		VobInfo* vi = list.Vobs[i];
+		if(vi->VisibleInRenderPass)
+			continue;
+
+		vobs.push_back(vi);
+		vi->VisibleInRenderPass = true;
+	}
+
+	for(unsigned int i=0;i<list.Mobs.size();i++)
+	{
+		SkeletalVobInfo* vi = list.Mobs[i];
+		if(vi->VisibleInRenderPass)
+			continue;
+
+		mobs.push_back(vi);
+		vi->VisibleInRenderPass = true;
+	}
+
+	if(list.Lights.empty())
+		return;
+
+	// Add dynamic lights
+	float minDynamicUpdateLightRange = RendererState.RendererSettings.MinLightShadowUpdateRange;
+	D3DXVECTOR3 playerPosition = GetPlayerVob() != NULL ? GetPlayerVob()->GetPositionWorld() : D3DXVECTOR3(FLT_MAX, FLT_MAX, FLT_MAX);
+
+	// Take cameraposition if we are freelooking
+	if(zCCamera::IsFreeLookActive())
+		playerPosition = GetCameraPosition();
+
+	for(unsigned int i=0;i<list.Lights.size();i++)
+	{
+		zCVobLight* light = list.Lights[i];
+		VobLightInfo** vi = &VobLightMap[light];
+
+		// Check if we already have this light
+		if(!*vi)
+		{
+			// Add if not. This light must have been added during gameplay
+			*vi = new VobLightInfo;
+			(*vi)->Vob = light;
+
+			// Create shadow-buffers for these lights since it was dynamically added to the world
+			if(RendererState.RendererSettings.EnablePointlightShadows >= GothicRendererSettings::PLS_STATIC_ONLY)
+				Engine::GraphicsEngine->CreateShadowedPointLight(&(*vi)->LightShadowBuffers, *vi, true); // Also flag as dynamic
+		}
+
+		if(!(*vi)->VisibleInRenderPass && (*vi)->Vob->IsEnabled())
+		{
+			(*vi)->VisibleInRenderPass = true;
+
+			float lightPlayerDist = D3DXVec3Length(&(playerPosition - light->GetPositionWorld()));
+
+			// Update the lights shadows if: Light is dynamic or full shadow-updates are set
+			if(RendererState.RendererSettings.EnablePointlightShadows >= GothicRendererSettings::PLS_FULL
+				|| (RendererState.RendererSettings.EnablePointlightShadows >= GothicRendererSettings::PLS_UPDATE_DYNAMIC && !(*vi)->Vob->IsStatic()))
+			{
+				// Now check for distances, etc
+				if( (*vi)->Vob->GetLightRange() > minDynamicUpdateLightRange 
+					&& lightPlayerDist < (*vi)->Vob->GetLightRange() * 1.5f)
+					(*vi)->UpdateShadows = true;
+			}
+			// Render it
+			lights.push_back(*vi);
+		}
+	}
+}
+
 /** Helper function for going through the bsp-tree */
 void GothicAPI::BuildBspVobMapCacheHelper(zCBspBase* base)
 {
@@ -3424,6 +3433,7 @@ void GothicAPI::BuildBspVobMapCacheHelper(zCBspBase* base)
 	// Put it into the cache
 	BspInfo& bvi = BspLeafVobLists[base];
 	bvi.OriginalNode = base;
+	bvi.VobPositionsDirty = true;
 
 	if(base->IsLeaf())
 	{
@@ -3825,6 +3835,126 @@ void GothicAPI::SaveCustomZENResources()
 	SaveSectionInfos();
 }
 
+/** Returns the capture-file of the loaded world */
+std::string GothicAPI::GetSceneCaptureFile()
+{
+	return "system\\GD3D11\\captures\\" + GetSceneCaptureName() + ".gcap";
+}
+
+/** Returns the name the capture- and report-files of the loaded world start with */
+std::string GothicAPI::GetSceneCaptureName()
+{
+	if(LoadedWorldInfo->WorldName.empty())
+		return "Unnamed";
+
+	return LoadedWorldInfo->WorldName;
+}
+
+/** Captures the next frames of the loaded world to its .gcap-file */
+void GothicAPI::StartSceneCapture()
+{
+	if(ActiveSceneCapture || ActiveSceneReplay)
+		return;
+
+	CreateDirectory("system\\GD3D11\\captures", NULL);
+	ActiveSceneCapture = new SceneCapture(GetSceneCaptureFile(), LoadedWorldInfo->WorldName, SCENECAPTURE_DEFAULT_FRAMES);
+}
+
+/** Plays back the .gcap-file of the loaded world and appends the timings to its report */
+void GothicAPI::StartSceneReplay()
+{
+	if(ActiveSceneCapture || ActiveSceneReplay)
+		return;
+
+	SceneReplay* replay = new SceneReplay;
+	if(XR_SUCCESS != replay->Open(GetSceneCaptureFile(), LoadedWorldInfo->WorldName))
+	{
+		LogWarn() << "Can't replay " << GetSceneCaptureFile();
+		delete replay;
+		return;
+	}
+
+	// Particle-textures are looked up by name, these are the ones we know so far
+	for(std::set<zCMaterial *>::iterator it = LoadedMaterials.begin(); it != LoadedMaterials.end(); it++)
+		replay->AddKnownTexture((*it)->GetTextureSingle());
+
+	// The captured vobs and lights are looked up by their transform
+	for(std::unordered_map<zCVob*, VobInfo*>::iterator it = VobMap.begin(); it != VobMap.end(); it++)
+		replay->AddKnownVob((*it).second);
+
+	for(std::unordered_map<zCVobLight*, VobLightInfo*>::iterator it = VobLightMap.begin(); it != VobLightMap.end(); it++)
+		replay->AddKnownLight((*it).second);
+
+	ActiveSceneReplay = replay;
+}
+
+/** Stops the running replay and writes its report */
+void GothicAPI::StopSceneReplay()
+{
+	ActiveSceneReplay->WriteReport("system\\GD3D11\\captures\\" + GetSceneCaptureName() + "_replays.txt");
+
+	if(CameraReplacementPtr == ActiveSceneReplay->GetCamera())
+		CameraReplacementPtr = NULL;
+
+	delete ActiveSceneReplay;
+	ActiveSceneReplay = NULL;
+}
+
+/** Starts the next frame of the running capture or replay */
+void GothicAPI::UpdateSceneCapture()
+{
+	// Can be started from the commandline, as soon as there is a world
+	static bool s_checkedCommandline = false;
+	if(!s_checkedCommandline && !LoadedWorldInfo->WorldName.empty())
+	{
+		s_checkedCommandline = true;
+
+		if(HasCommandlineParameter("XCaptureScene"))
+			StartSceneCapture();
+		else if(HasCommandlineParameter("XReplayScene"))
+			StartSceneReplay();
+	}
+
+	if(ActiveSceneCapture)
+	{
+		D3DXMATRIX view;
+		GetViewMatrix(&view);
+		ActiveSceneCapture->BeginFrame(view, GetProjectionMatrix(), GetCameraPosition(), GetTimeSeconds(), GetFrameTimeSec(), 
+			RendererState.RendererInfo.NearPlane, RendererState.RendererInfo.FarPlane);
+
+		if(ActiveSceneCapture->IsDone())
+		{
+			delete ActiveSceneCapture;
+			ActiveSceneCapture = NULL;
+		}
+	}
+
+	if(ActiveSceneReplay)
+	{
+		if(!ActiveSceneReplay->BeginFrame())
+		{
+			StopSceneReplay();
+			return;
+		}
+
+		const SceneCaptureFrame& frame = ActiveSceneReplay->GetFrame();
+
+		// The culling works on gothics camera, so make it look where the captured one did
+		if(zCCamera::GetCamera())
+		{
+			zCCamera::GetCamera()->SetTransform(zCCamera::ETransformType::TT_VIEW, frame.View);
+			zCCamera::GetCamera()->Activate();
+		}
+
+		SetViewTransform(frame.View);
+		CameraReplacementPtr = ActiveSceneReplay->GetCamera();
+
+		RendererState.RendererInfo.NearPlane = frame.NearPlane;
+		RendererState.RendererInfo.FarPlane = frame.FarPlane;
+		RendererState.GraphicsState.FF_Time = frame.Time;
+	}
+}
+
 /** Applys the suppressed textures */
 void GothicAPI::ApplySuppressedSectionTextures()
 {
@@ -3847,6 +3977,8 @@ void GothicAPI::ApplySuppressedSectionTextures()
 				}
 			}
 		}
+
+		section->InvalidateTraceBVH();
 	}
 }
 
@@ -3862,6 +3994,8 @@ void GothicAPI::ResetSupressedTextures()
 		{
 			section->WorldMeshes[(*mit).first] = (*mit).second;
 		}
+
+		section->InvalidateTraceBVH();
 	}
 
 	SuppressedTexturesBySection.clear();
@@ -3969,7 +4103,7 @@ XRESULT GothicAPI::LoadSuppressedTextures(const std::string& file)
 			fread(name, numChars, 1, f);
 
 			// Add to map
-			SuppressedTexturesBySection[&WorldSections[coords.x][coords.y]].push_back(std::string(name));
+			SuppressedTexturesBySection[&WorldSections.GetSection(coords.x, coords.y)].push_back(std::string(name));
 		}
 	}
 
@@ -4361,31 +4495,58 @@ bool GothicAPI::IsUnderWater()
 /** Saves all sections information */
 void GothicAPI::SaveSectionInfos()
 {
-	for(std::map<int, std::map<int, WorldMeshSectionInfo>>::iterator itx = Engine::GAPI->GetWorldSections().begin(); itx != Engine::GAPI->GetWorldSections().end(); itx++)
+	for(std::vector<WorldMeshSectionInfo*>::const_iterator its = Engine::GAPI->GetWorldSections().GetSections().begin(); its != Engine::GAPI->GetWorldSections().GetSections().end(); its++)
 	{
-		for(std::map<int, WorldMeshSectionInfo>::iterator ity = (*itx).second.begin(); ity != (*itx).second.end(); ity++)
-		{
-			WorldMeshSectionInfo& section = (*ity).second;
+		WorldMeshSectionInfo& section = **its;
 
-			// Save this section to file
-			section.SaveMeshInfos(LoadedWorldInfo->WorldName, INT2((*itx).first, (*ity).first));
-		}
+		// Save this section to file
+		section.SaveMeshInfos(LoadedWorldInfo->WorldName, section.WorldCoordinates);
 	}
 }
 
 /** Loads all sections information */
 void GothicAPI::LoadSectionInfos()
 {
-	for(std::map<int, std::map<int, WorldMeshSectionInfo>>::iterator itx = Engine::GAPI->GetWorldSections().begin(); itx != Engine::GAPI->GetWorldSections().end(); itx++)
+	for(std::vector<WorldMeshSectionInfo*>::const_iterator its = Engine::GAPI->GetWorldSections().GetSections().begin(); its != Engine::GAPI->GetWorldSections().GetSections().end(); its++)
+	{
+		WorldMeshSectionInfo& section = **its;
+
+		// Load this section from file
+		section.LoadMeshInfos(LoadedWorldInfo->WorldName, section.WorldCoordinates);
+	}
+
+	std::vector<WorldMeshInfo*> meshes;
+	std::vector<WorldMeshInfo*> tesselatedMeshes;
+	for(std::vector<WorldMeshSectionInfo*>::const_iterator its = Engine::GAPI->GetWorldSections().GetSections().begin(); its != Engine::GAPI->GetWorldSections().GetSections().end(); its++)
 	{
-		for(std::map<int, WorldMeshSectionInfo>::iterator ity = (*itx).second.begin(); ity != (*itx).second.end(); ity++)
+		for(std::map<MeshKey, WorldMeshInfo*, cmpMeshKey>::iterator it = (*its)->WorldMeshes.begin(); it != (*its)->WorldMeshes.end(); it++)
 		{
-			WorldMeshSectionInfo& section = (*ity).second;
+			meshes.push_back((*it).second);
 
-			// Load this section from file
-			section.LoadMeshInfos(LoadedWorldInfo->WorldName, INT2((*itx).first, (*ity).first));
+			if((*it).second->TesselationSettings.buffer.VT_TesselationFactor > 0.0f)
+				tesselatedMeshes.push_back((*it).second);
+		}
+	}
+
+	if(HasCommandlineParameter("XBenchPNAEN"))
+		WorldConverter::BenchmarkPNAEN(meshes);
+
+	// Trace random rays through the whole world and check them against testing every triangle
+	if(HasCommandlineParameter("XBenchMeshBVH"))
+	{
+		MeshBVH bvh;
+		for(unsigned int i=0;i<meshes.size();i++)
+		{
+			if(!meshes[i]->Indices.empty())
+				bvh.AddMesh(&meshes[i]->Vertices[0], &meshes[i]->Indices[0], meshes[i]->Indices.size(), i);
 		}
+
+		bvh.Build();
+		bvh.RunBenchmark(100000, 500);
 	}
+
+	// Create the PNAEN-info of all meshes which have tesselation turned on
+	WorldConverter::CreatePNAENInfoFor(tesselatedMeshes);
 }
 
 /** Returns if the given vob is registered in the world */
@@ -4541,16 +4702,17 @@ void GothicAPI::PutCustomPolygonsIntoBspTreeRec(BspInfo* base)
 /** Returns the sections intersecting the given boundingboxes */
 void GothicAPI::GetIntersectingSections(const D3DXVECTOR3& min, const D3DXVECTOR3& max, std::vector<WorldMeshSectionInfo*>& sections)
 {
-	for(std::map<int, std::map<int, WorldMeshSectionInfo>>::iterator itx = Engine::GAPI->GetWorldSections().begin(); itx != Engine::GAPI->GetWorldSections().end(); itx++)
+	// Only look at the cells around the box, the rest can't touch it
+	std::vector<WorldMeshSectionInfo*> nearSections;
+	WorldSections.GetSectionsNearBox(min, max, nearSections);
+
+	for(std::vector<WorldMeshSectionInfo*>::const_iterator its = nearSections.begin(); its != nearSections.end(); its++)
 	{
-		for(std::map<int, WorldMeshSectionInfo>::iterator ity = (*itx).second.begin(); ity != (*itx).second.end(); ity++)
-		{
-			WorldMeshSectionInfo& section = (*ity).second;
+		WorldMeshSectionInfo& section = **its;
 
-			if(Toolbox::AABBsOverlapping(section.BoundingBox.Min, section.BoundingBox.Max, min, max))
-			{
-				sections.push_back(&section);
-			}
+		if(Toolbox::AABBsOverlapping(section.BoundingBox.Min, section.BoundingBox.Max, min, max))
+		{
+			sections.push_back(&section);
 		}
 	}
 }
@@ -4558,22 +4720,19 @@ void GothicAPI::GetIntersectingSections(const D3DXVECTOR3& min, const D3DXVECTOR
 /** Generates zCPolygons for the loaded sections */
 void GothicAPI::CreatezCPolygonsForSections()
 {
-	for(std::map<int, std::map<int, WorldMeshSectionInfo>>::iterator itx = Engine::GAPI->GetWorldSections().begin(); itx != Engine::GAPI->GetWorldSections().end(); itx++)
+	for(std::vector<WorldMeshSectionInfo*>::const_iterator its = Engine::GAPI->GetWorldSections().GetSections().begin(); its != Engine::GAPI->GetWorldSections().GetSections().end(); its++)
 	{
-		for(std::map<int, WorldMeshSectionInfo>::iterator ity = (*itx).second.begin(); ity != (*itx).second.end(); ity++)
-		{
-			WorldMeshSectionInfo& section = (*ity).second;
+		WorldMeshSectionInfo& section = **its;
 
-			for(auto it = section.WorldMeshes.begin(); it != section.WorldMeshes.end();it++)
-			{
-				if(!(*it).first.Material ||
-					(*it).first.Material->HasAlphaTest())
-					continue;
+		for(auto it = section.WorldMeshes.begin(); it != section.WorldMeshes.end();it++)
+		{
+			if(!(*it).first.Material ||
+				(*it).first.Material->HasAlphaTest())
+				continue;
 
-				(*it).first.Material->SetAlphaFunc(zMAT_ALPHA_FUNC_FUNC_NONE);
+			(*it).first.Material->SetAlphaFunc(zMAT_ALPHA_FUNC_FUNC_NONE);
 
-				WorldConverter::ConvertExVerticesTozCPolygons((*it).second->Vertices, (*it).second->Indices, (*it).first.Material, section.SectionPolygons);
-			}
+			WorldConverter::ConvertExVerticesTozCPolygons((*it).second->Vertices, (*it).second->Indices, (*it).first.Material, section.SectionPolygons);
 		}
 	}
 }
@@ -4674,20 +4833,19 @@ void GothicAPI::PrintModInfo()
 /** Applies tesselation-settings for all mesh-parts using the given info */
 void GothicAPI::ApplyTesselationSettingsForAllMeshPartsUsing(MaterialInfo* info, int amount)
 {
-	for(std::map<int, std::map<int, WorldMeshSectionInfo>>::iterator itx = Engine::GAPI->GetWorldSections().begin(); itx != Engine::GAPI->GetWorldSections().end(); itx++)
+	for(std::vector<WorldMeshSectionInfo*>::const_iterator its = Engine::GAPI->GetWorldSections().GetSections().begin(); its != Engine::GAPI->GetWorldSections().GetSections().end(); its++)
 	{
-		for(std::map<int, WorldMeshSectionInfo>::iterator ity = (*itx).second.begin(); ity != (*itx).second.end(); ity++)
-		{
-			WorldMeshSectionInfo& section = (*ity).second;
+		WorldMeshSectionInfo& section = **its;
 
-			
-			for(auto it = section.WorldMeshes.begin(); it != section.WorldMeshes.end();it++)
+		
+		for(auto it = section.WorldMeshes.begin(); it != section.WorldMeshes.end();it++)
+		{
+			if((*it).first.Info == info && (*it).second->IndicesPNAEN.empty() && info->TextureTesselationSettings.buffer.VT_TesselationFactor > 0.5f)
 			{
-				if((*it).first.Info == info && (*it).second->IndicesPNAEN.empty() && info->TextureTesselationSettings.buffer.VT_TesselationFactor > 0.5f)
-				{
-					// Tesselate this mesh
-					WorldConverter::TesselateMesh((*it).second, amount);
-				}
+				// Tesselate this mesh. Pointlights may be collecting its polygons on a worker.
+				std::lock_guard<std::mutex> lock(WorldMeshMutex);
+				WorldConverter::TesselateMesh((*it).second, amount);
+				section.InvalidateTraceBVH();
 			}
 		}
 	}
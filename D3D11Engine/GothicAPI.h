@@ -4,6 +4,9 @@
 #include "WorldConverter.h"
 #include "zCTree.h"
 #include "zTypes.h"
+#include "BatchCulling.h"
+#include "VobInstanceStore.h"
+#include "ParticleFrameBuilder.h"
 
 #define START_TIMING Engine::GAPI->GetRendererState()->RendererInfo.Timing.Start
 #define STOP_TIMING Engine::GAPI->GetRendererState()->RendererInfo.Timing.Stop
@@ -29,6 +32,8 @@ struct BspInfo
 		OcclusionInfo.LastCameraClipType = 0;
 
 		OcclusionInfo.NodeMesh = NULL;
+
+		VobPositionsDirty = true;
 	}
 
 	~BspInfo()
@@ -48,6 +53,12 @@ struct BspInfo
 	std::vector<VobLightInfo *> IndoorLights;
 	std::vector<SkeletalVobInfo *> Mobs;
 
+	/** LastRenderPositions of the vobs in the lists above, for the batch-culling. Must be flagged dirty whenever a list or a position changes. */
+	PointBatch IndoorVobPositions;
+	PointBatch SmallVobPositions;
+	PointBatch VobPositions;
+	bool VobPositionsDirty;
+
 	// This is filled in case we have loaded a custom worldmesh
 	std::vector<zCPolygon *> NodePolygons;
 
@@ -78,6 +89,57 @@ struct CameraReplacement
 	D3DXVECTOR3 LookAtReplacement;
 };
 
+/** Depth of the bsp-tree at which the subtrees get traversed by the worker-threads */
+const int BSP_PARALLEL_SPLIT_DEPTH = 6;
+
+class zCCamera;
+
+/** Everything the vob-collection needs from the renderer-settings and the camera, gathered once per frame */
+struct VobCollectionContext
+{
+	zCCamera* Camera;
+	D3DXVECTOR3 CameraPosition;
+	float YMaxWorld;
+
+	float IndoorVobDrawRadius;
+	float OutdoorVobDrawRadius;
+	float OutdoorSmallVobDrawRadius;
+	float SmallVobSize;
+	float VisualFXDrawRadius;
+
+	bool EnableOcclusionCulling;
+	bool EnableDynamicLighting;
+	bool DrawVOBs;
+	bool DrawMobs;
+};
+
+/** Output of a part of the bsp-traversal. Holds everything that passed the culling in traversal-order.
+	VisibleInRenderPass isn't touched here, that only happens when the lists get merged. */
+struct VobCollectionList
+{
+	void Clear()
+	{
+		Vobs.clear();
+		Mobs.clear();
+		Lights.clear();
+	}
+
+	std::vector<VobInfo *> Vobs;
+	std::vector<SkeletalVobInfo *> Mobs;
+	std::vector<zCVobLight *> Lights;
+
+	/** Scratch-space for the culling results */
+	std::vector<unsigned int> CullMask;
+};
+
+/** Subtree of the bsp-tree to be traversed by one job */
+struct VobCollectionTask
+{
+	BspInfo* Base;
+	zTBBox3D BoxCell;
+	int ClipFlags;
+};
+
 /** Version of this struct */
 const int MATERIALINFO_VERSION = 5;
 
@@ -166,6 +228,8 @@ class GVegetationBox;
 class GOcean;
 class zCMorphMesh;
 class zCDecal;
+class SceneCapture;
+class SceneReplay;
 class GothicAPI
 {
 public:
@@ -262,7 +326,7 @@ public:
 	/** Draws a SkeletalMeshInfo */
 	void DrawSkeletalMeshInfo(zCMaterial* mat, SkeletalMeshInfo* msh, SkeletalMeshVisualInfo* vis, std::vector<D3DXMATRIX>& transforms, float fatness = 1.0f);
 
-	/** Draws a zCParticleFX */
+	/** Simulates a zCParticleFX and gathers its particles for this frame */
 	void DrawParticleFX(zCVob* source, zCParticleFX* fx, ParticleFrameData& data);
 
 	/** Gets a list of visible decals */
@@ -320,7 +384,10 @@ public:
 	const stdext::unordered_map<zCQuadMark*, QuadMarkInfo>& GetQuadMarks();
 
 	/** Returns the loaded sections */
-	std::map<int, std::map<int, WorldMeshSectionInfo>>& GetWorldSections();
+	WorldSectionGrid& GetWorldSections();
+
+	/** Locked while the geometry of worldmeshes is changed after loading, and by workers reading it */
+	std::mutex& GetWorldMeshMutex(){return WorldMeshMutex;}
 
 	/** Returns the wrapped world mesh */
 	MeshInfo* GetWrappedWorldMesh();
@@ -531,6 +598,9 @@ public:
 	/** Returns the map of static mesh visuals */
 	const std::unordered_map<zCProgMeshProto*, MeshVisualInfo*>& GetStaticMeshVisuals(){return StaticMeshVisuals;}
 
+	/** Returns the persistent instance-data of the static vobs */
+	VobInstanceStore& GetVobInstanceStore(){return VobInstances;}
+
 	/** Removes the given texture from the given section and stores the supression, so we can load it next time */
 	void SupressTexture(WorldMeshSectionInfo* section, const std::string& texture);
 
@@ -589,7 +659,7 @@ public:
 	/** Returns if the given vob is registered in the world */
 	SkeletalVobInfo* GetSkeletalVobByVob(zCVob* vob);
 
-	/** Returns the frame particle info collected from all DrawParticleFX-Calls */
+	/** Returns the frame particle info. Only filled while a scene is captured or replayed. */
 	std::map<zCTexture*, ParticleRenderInfo>& GetFrameParticleInfo();
 
 	/** Checks if the normalmaps are there */
@@ -622,7 +692,28 @@ public:
 	/** Prints information about the mod to the screen for a couple of seconds */
 	void PrintModInfo();
 
+	/** Captures the next frames of the loaded world to its .gcap-file */
+	void StartSceneCapture();
+
+	/** Plays back the .gcap-file of the loaded world and appends the timings to its report */
+	void StartSceneReplay();
+
+	/** Returns true while a capture is played back */
+	bool IsReplayingScene(){return ActiveSceneReplay != NULL;}
+
 private:
+	/** Returns the capture-file of the loaded world */
+	std::string GetSceneCaptureFile();
+
+	/** Returns the name the capture- and report-files of the loaded world start with. Worlds without a name get a default. */
+	std::string GetSceneCaptureName();
+
+	/** Starts the next frame of the running capture or replay */
+	void UpdateSceneCapture();
+
+	/** Stops the running replay and writes its report */
+	void StopSceneReplay();
+
 	/** Collects polygons in the given AABB */
 	void CollectPolygonsInAABBRec(BspInfo* base, const zTBBox3D& bbox, std::vector<zCPolygon *>& list);
 
@@ -632,8 +723,12 @@ private:
 	/** Helper function for going through the bsp-tree */
 	void BuildBspVobMapCacheHelper(zCBspBase* base);
 
-	/** Recursive helper function to draw collect the vobs */
-	void CollectVisibleVobsHelper(BspInfo* base, zTBBox3D boxCell, int clipFlags, std::vector<VobInfo *>& vobs, std::vector<VobLightInfo  *>& lights, std::vector<SkeletalVobInfo *>& mobs);
+	/** Recursive helper function to draw collect the vobs. Doesn't change any state, so it can run on any thread.
+		If outTasks is set, subtrees at BSP_PARALLEL_SPLIT_DEPTH and leafs are put in there instead of being traversed. */
+	void CollectVisibleVobsHelper(const VobCollectionContext& ctx, BspInfo* base, zTBBox3D boxCell, int clipFlags, int depth, VobCollectionList& out, std::vector<VobCollectionTask>* outTasks);
+
+	/** Adds the collected vobs which weren't already drawn in this pass to the output-lists */
+	void MergeVisibleVobs(const VobCollectionList& list, std::vector<VobInfo *>& vobs, std::vector<VobLightInfo *>& lights, std::vector<SkeletalVobInfo *>& mobs);
 
 	/** Applys the suppressed textures */
 	void ApplySuppressedSectionTextures();
@@ -667,8 +762,11 @@ private:
 	std::map<zCTexture*, std::vector<ParticleInstanceInfo>> FrameParticles;
 	std::map<zCTexture*, ParticleRenderInfo> FrameParticleInfo;
 
+	/** Turns the particles gathered by DrawParticleFX into the instances of this frame */
+	ParticleFrameBuilder ParticleBuilder;
+
 	/** Loaded game sections */
-	std::map<int, std::map<int, WorldMeshSectionInfo>> WorldSections;
+	WorldSectionGrid WorldSections;
 	MeshInfo* WrappedWorldMesh;
 
 	/** List of vobs with skeletal meshes (Having a zCModel-Visual) */
@@ -689,6 +787,9 @@ private:
 	/** Map for static mesh visuals */
 	std::unordered_map<zCProgMeshProto*, MeshVisualInfo*> StaticMeshVisuals;
 
+	/** Instance-slots of the static vobs of the main world */
+	VobInstanceStore VobInstances;
+
 	/** Map for skeletal mesh visuals */
 	std::unordered_map<std::string, SkeletalMeshVisualInfo*> SkeletalMeshVisuals;
 
@@ -707,6 +808,16 @@ private:
 	/** Map of VobInfo-Lists for zCBspLeafs */
 	std::unordered_map<zCBspBase *, BspInfo> BspLeafVobLists;
 
+	/** Per-frame storage of the parallel vob-collection, kept to save the allocations */
+	std::vector<VobCollectionTask> VobCollectionTasks;
+	std::vector<VobCollectionList> VobCollectionLists;
+
+	/** Per-frame storage of the batch-culling of the dynamic vobs and the sections */
+	PointBatch DynamicVobPositions;
+	AABBBatch SectionCullBoxes;
+	std::vector<WorldMeshSectionInfo *> SectionCullList;
+	std::vector<unsigned int> CullMask;
+
 	/** Map for the material infos */
 	std::unordered_map<zCTexture*, MaterialInfo> MaterialInfos;
 
@@ -723,6 +834,9 @@ private:
 	CRITICAL_SECTION ResourceCriticalSection;
 	std::mutex ResourceMutex;
 
+	/** See GetWorldMeshMutex */
+	std::mutex WorldMeshMutex;
+
 	/** Sky renderer */
 	GSky* SkyRenderer;
 
@@ -739,6 +853,10 @@ private:
 	/** Replacement values for the camera */
 	CameraReplacement* CameraReplacementPtr;
 
+	/** Running scene-capture and -replay, if any */
+	SceneCapture* ActiveSceneCapture;
+	SceneReplay* ActiveSceneReplay;
+
 	/** List of available GVegetationBoxes */
 	std::list<GVegetationBox*> VegetationBoxes;
 
@@ -511,6 +511,9 @@ struct GothicRendererSettings
 		VisualFXDrawRadius = 8000.0f;
 		OutdoorSmallVobDrawRadius = 10000.0f;
 		SmallVobSize = 1500.0f;
+		EnableVobLODs = true;
+		VobLODScreenSize = 300.0f;
+		CompressTextures = true;
 
 		
 
@@ -578,6 +581,9 @@ struct GothicRendererSettings
 		EnablePointlightShadows = PLS_UPDATE_DYNAMIC;
 		MinLightShadowUpdateRange = 300.0f;
 		PartialDynamicShadowUpdates = true;
+		ShadowUpdateBudgetMS = 2.0f;
+		ShadowCubePoolMemoryMB = 16.0f;
+		EnableClusteredLighting = true;
 
 		EnableGodRays = true;
 
@@ -679,6 +685,9 @@ struct GothicRendererSettings
 	EPointLightShadowMode EnablePointlightShadows;
 	float MinLightShadowUpdateRange;
 	bool PartialDynamicShadowUpdates;
+	float ShadowUpdateBudgetMS; // Time pointlight shadow updates may take per frame, if PartialDynamicShadowUpdates is set
+	float ShadowCubePoolMemoryMB; // Video memory all pointlight shadow-cubes together may take
+	bool EnableClusteredLighting; // Draws all pointlights in one full-screen pass instead of one volume per light
 
 	int MaxNumFaces;
 
@@ -691,6 +700,9 @@ struct GothicRendererSettings
 	float OutdoorSmallVobDrawRadius;
 	float VisualFXDrawRadius;
 	float SmallVobSize;
+	bool EnableVobLODs;
+	float VobLODScreenSize; // Vobs smaller than this on screen (in pixels) use their first LOD. Halves for each further LOD.
+	bool CompressTextures; // Compress converted and custom textures to BC-formats in the background and load them from the texture cache
 	float WorldShadowRangeScale;
 	float GammaValue;
 	float BrightnessValue;
@@ -828,7 +840,31 @@ struct GothicRendererInfo
 		FramePipelineStates = 0;
 
 		StateChanges = 0;
+		RedundantStateChanges = 0;
 		memset(StateChangesByState, 0, sizeof(StateChangesByState));
+
+		FrameConstantBufferBytesUploaded = 0;
+		FrameConstantBufferUploadsSkipped = 0;
+
+		FrameVobLODInstances = 0;
+
+		FrameShadowUpdates = 0;
+		FrameShadowUpdatesDeferred = 0;
+		FrameShadowUpdateMS = 0.0f;
+		ShadowUpdateMaxStaleness = 0;
+
+		ShadowCubesResident = 0;
+		ShadowCubesShared = 0;
+		ShadowCubeCapacity = 0;
+		ShadowCubePoolMB = 0.0f;
+		FrameShadowCubeEvictions = 0;
+
+		FrameClusteredLights = 0;
+		FrameLightClusterEntries = 0;
+
+		FrameParticles = 0;
+		FrameParticleBuildMS = 0.0f;
+		FrameParticlesPerMS = 0.0f;
 	}
 
 	enum EStateChange
@@ -853,8 +889,32 @@ struct GothicRendererInfo
 
 	unsigned int StateChanges;
 	unsigned int StateChangesByState[SC_NUM_STATES];
+	unsigned int RedundantStateChanges; // Binds the render-queue dropped, since the state was already set
 	unsigned int FramePipelineStates;
 
+	unsigned int FrameConstantBufferBytesUploaded;
+	unsigned int FrameConstantBufferUploadsSkipped; // Updates which were dropped, since the buffer already had that data
+
+	unsigned int FrameVobLODInstances; // Vob-instances drawn with one of their LODs instead of the full mesh
+
+	unsigned int FrameShadowUpdates; // Pointlight shadow-cubes redrawn this frame
+	unsigned int FrameShadowUpdatesDeferred; // Queued updates that didn't fit into the budget
+	float FrameShadowUpdateMS;
+	unsigned int ShadowUpdateMaxStaleness; // Frames the longest waiting update has been queued for
+
+	unsigned int ShadowCubesResident; // Slots of the shadow-cube pool in use
+	unsigned int ShadowCubesShared; // Lights using the cube of an other light at the same spot
+	unsigned int ShadowCubeCapacity;
+	float ShadowCubePoolMB;
+	unsigned int FrameShadowCubeEvictions; // Cubes taken away from lights this frame, because the pool was full
+
+	unsigned int FrameClusteredLights; // Lights binned into the clusters this frame
+	unsigned int FrameLightClusterEntries; // Length of the light index-list of all clusters together
+
+	unsigned int FrameParticles;
+	float FrameParticleBuildMS; // Gathering, simulating and evaluating all particles of the frame
+	float FrameParticlesPerMS;
+
 	int FrameDrawnTriangles;
 	int FrameDrawnVobs;
 	int FrameVobUpdates;
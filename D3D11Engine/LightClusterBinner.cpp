@@ -0,0 +1,324 @@
+#include "pch.h"
+#include "LightClusterBinner.h"
+#include "Engine.h"
+#include <emmintrin.h>
+
+/** How much the clusters are grown on each side, so lights touching a border are never missed because of rounding on the GPU */
+const float LIGHTCLUSTER_BORDER_EPSILON = 0.001f;
+
+LightClusterBinner::LightClusterBinner(void)
+{
+	ZNear = 0.0f;
+	ZFar = 0.0f;
+	Lights = NULL;
+	Binning = false;
+
+	ClusterLights.resize(LIGHTCLUSTER_NUM_CLUSTERS);
+	ClusterRanges.resize(LIGHTCLUSTER_NUM_CLUSTERS);
+}
+
+LightClusterBinner::~LightClusterBinner(void)
+{
+	// Don't leave the workers with a dangling this
+	if(Binning)
+		Engine::WorkerThreadPool->wait(BinJobs);
+}
+
+/** Returns the factor which turns log(z / near) into the slice-index */
+float LightClusterBinner::GetSliceScale()
+{
+	return (float)LIGHTCLUSTER_SLICES / logf(ZFar / ZNear);
+}
+
+/** Sets up the clusters for a projection */
+void LightClusterBinner::SetProjection(float xScale, float yScale, float zNear, float zFar)
+{
+	ZNear = zNear;
+	ZFar = zFar;
+
+	ClusterBoxes.Clear();
+	for(unsigned int s=0;s<LIGHTCLUSTER_SLICES;s++)
+	{
+		// Exponential slices, so the clusters stay about as deep as they are wide
+		float z0 = s == 0 ? 0.0f : zNear * powf(zFar / zNear, (float)s / LIGHTCLUSTER_SLICES);
+		float z1 = zNear * powf(zFar / zNear, (float)(s + 1) / LIGHTCLUSTER_SLICES);
+
+		SliceMinZ[s] = z0 * (1.0f - LIGHTCLUSTER_BORDER_EPSILON);
+		SliceMaxZ[s] = z1 * (1.0f + LIGHTCLUSTER_BORDER_EPSILON);
+
+		for(unsigned int y=0;y<LIGHTCLUSTER_TILES_Y;y++)
+		{
+			// Tile-rows go from the top of the screen to the bottom
+			float ndcTop = 1.0f - 2.0f * y / LIGHTCLUSTER_TILES_Y + LIGHTCLUSTER_BORDER_EPSILON;
+			float ndcBottom = 1.0f - 2.0f * (y + 1) / LIGHTCLUSTER_TILES_Y - LIGHTCLUSTER_BORDER_EPSILON;
+
+			for(unsigned int x=0;x<LIGHTCLUSTER_TILES_X;x++)
+			{
+				float ndcLeft = -1.0f + 2.0f * x / LIGHTCLUSTER_TILES_X - LIGHTCLUSTER_BORDER_EPSILON;
+				float ndcRight = -1.0f + 2.0f * (x + 1) / LIGHTCLUSTER_TILES_X + LIGHTCLUSTER_BORDER_EPSILON;
+
+				// The frustum of the tile widens with depth, so the box spans the corners at both ends of the slice
+				float xs[] = {ndcLeft * SliceMinZ[s] / xScale, ndcRight * SliceMinZ[s] / xScale, ndcLeft * SliceMaxZ[s] / xScale, ndcRight * SliceMaxZ[s] / xScale};
+				float ys[] = {ndcBottom * SliceMinZ[s] / yScale, ndcTop * SliceMinZ[s] / yScale, ndcBottom * SliceMaxZ[s] / yScale, ndcTop * SliceMaxZ[s] / yScale};
+
+				D3DXVECTOR3 min = D3DXVECTOR3(*std::min_element(xs, xs + 4), *std::min_element(ys, ys + 4), SliceMinZ[s]);
+				D3DXVECTOR3 max = D3DXVECTOR3(*std::max_element(xs, xs + 4), *std::max_element(ys, ys + 4), SliceMaxZ[s]);
+				ClusterBoxes.Add(min, max);
+			}
+		}
+	}
+}
+
+/** Starts binning the given spheres on the worker-threads */
+void LightClusterBinner::Begin(const PointBatch* lights)
+{
+	Lights = lights;
+
+	if(!Engine::WorkerThreadPool)
+	{
+		for(unsigned int s=0;s<LIGHTCLUSTER_SLICES;s++)
+			BinSlice(s);
+
+		return;
+	}
+
+	// The slices don't share any clusters, so they can be filled without locking
+	Binning = true;
+	for(unsigned int s=0;s<LIGHTCLUSTER_SLICES;s++)
+	{
+		Engine::WorkerThreadPool->run(BinJobs, [this, s]()
+		{
+			BinSlice(s);
+		});
+	}
+}
+
+/** Waits for the workers and builds the cluster-ranges and the index-list */
+void LightClusterBinner::Finish()
+{
+	if(Binning)
+	{
+		Engine::WorkerThreadPool->wait(BinJobs);
+		Binning = false;
+	}
+
+	CompactClusters();
+	Lights = NULL;
+}
+
+/** Tests all lights against the clusters of the given slice */
+void LightClusterBinner::BinSlice(unsigned int slice)
+{
+	unsigned int first = slice * LIGHTCLUSTER_TILES_PER_SLICE;
+	for(unsigned int i=0;i<LIGHTCLUSTER_TILES_PER_SLICE;i++)
+		ClusterLights[first + i].clear();
+
+	const __m128 zero = _mm_setzero_ps();
+	for(unsigned int l=0;l<Lights->Size();l++)
+	{
+		float z = Lights->Z[l];
+		float r = Lights->Radius[l];
+
+		// Most lights only reach a few slices
+		if(z + r < SliceMinZ[slice] || z - r > SliceMaxZ[slice])
+			continue;
+
+		const __m128 lx = _mm_set1_ps(Lights->X[l]);
+		const __m128 ly = _mm_set1_ps(Lights->Y[l]);
+		const __m128 lz = _mm_set1_ps(z);
+		const __m128 r2 = _mm_set1_ps(r * r);
+
+		for(unsigned int i=first;i<first + LIGHTCLUSTER_TILES_PER_SLICE;i+=CULL_BATCH_WIDTH)
+		{
+			// Distance from the center of the sphere to the closest point of the boxes
+			__m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&ClusterBoxes.MinX[i]), lx), zero), _mm_sub_ps(lx, _mm_loadu_ps(&ClusterBoxes.MaxX[i])));
+			__m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&ClusterBoxes.MinY[i]), ly), zero), _mm_sub_ps(ly, _mm_loadu_ps(&ClusterBoxes.MaxY[i])));
+			__m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&ClusterBoxes.MinZ[i]), lz), zero), _mm_sub_ps(lz, _mm_loadu_ps(&ClusterBoxes.MaxZ[i])));
+			__m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+			int bits = _mm_movemask_ps(_mm_cmple_ps(d2, r2));
+			if(!bits)
+				continue;
+
+			for(unsigned int b=0;b<CULL_BATCH_WIDTH;b++)
+			{
+				if(bits & (1 << b))
+					ClusterLights[i + b].push_back(l);
+			}
+		}
+	}
+}
+
+/** Bins on the calling thread without SSE */
+void LightClusterBinner::BinReference(const PointBatch& lights)
+{
+	for(unsigned int c=0;c<LIGHTCLUSTER_NUM_CLUSTERS;c++)
+	{
+		ClusterLights[c].clear();
+
+		for(unsigned int l=0;l<lights.Size();l++)
+		{
+			float dx = std::max(std::max(ClusterBoxes.MinX[c] - lights.X[l], 0.0f), lights.X[l] - ClusterBoxes.MaxX[c]);
+			float dy = std::max(std::max(ClusterBoxes.MinY[c] - lights.Y[l], 0.0f), lights.Y[l] - ClusterBoxes.MaxY[c]);
+			float dz = std::max(std::max(ClusterBoxes.MinZ[c] - lights.Z[l], 0.0f), lights.Z[l] - ClusterBoxes.MaxZ[c]);
+
+			if(dx * dx + dy * dy + dz * dz <= lights.Radius[l] * lights.Radius[l])
+				ClusterLights[c].push_back(l);
+		}
+	}
+
+	CompactClusters();
+}
+
+/** Puts the lists of the clusters after each other */
+void LightClusterBinner::CompactClusters()
+{
+	unsigned int offset = 0;
+	for(unsigned int c=0;c<LIGHTCLUSTER_NUM_CLUSTERS;c++)
+	{
+		ClusterRanges[c].Offset = offset;
+		ClusterRanges[c].Count = ClusterLights[c].size();
+		offset += ClusterLights[c].size();
+	}
+
+	LightIndices.resize(offset);
+	for(unsigned int c=0;c<LIGHTCLUSTER_NUM_CLUSTERS;c++)
+	{
+		if(!ClusterLights[c].empty())
+			memcpy(&LightIndices[ClusterRanges[c].Offset], &ClusterLights[c][0], ClusterLights[c].size() * sizeof(unsigned int));
+	}
+}
+
+/** Fills the batch with random view-space lights around a 90 degree frustum, some of them behind the camera */
+static void MakeSyntheticLights(PointBatch& lights, unsigned int count, float zFar, unsigned int& seed)
+{
+	lights.Clear();
+	for(unsigned int i=0;i<count;i++)
+	{
+		float r[4];
+		for(int j=0;j<4;j++)
+		{
+			seed = seed * 1664525 + 1013904223;
+			r[j] = (float)(seed >> 8) / (float)(1 << 24);
+		}
+
+		float z = -500.0f + r[2] * (zFar + 1000.0f);
+		float extent = std::max(z, 500.0f);
+		lights.Add(D3DXVECTOR3((r[0] * 2.0f - 1.0f) * extent * 1.2f, (r[1] * 2.0f - 1.0f) * extent * 1.2f, z), 50.0f + r[3] * 2000.0f);
+	}
+}
+
+/** Returns the cluster the lighting shader would look up for the given view-space point */
+static unsigned int GetClusterOfPoint(const D3DXVECTOR3& p, float xScale, float yScale, float zNear, float sliceScale)
+{
+	float u = (p.x * xScale / p.z) * 0.5f + 0.5f;
+	float v = 0.5f - (p.y * yScale / p.z) * 0.5f;
+
+	unsigned int tx = std::min((unsigned int)(u * LIGHTCLUSTER_TILES_X), LIGHTCLUSTER_TILES_X - 1);
+	unsigned int ty = std::min((unsigned int)(v * LIGHTCLUSTER_TILES_Y), LIGHTCLUSTER_TILES_Y - 1);
+	int slice = (int)floorf(logf(p.z / zNear) * sliceScale);
+	slice = std::max(0, std::min(slice, (int)LIGHTCLUSTER_SLICES - 1));
+
+	return (slice * LIGHTCLUSTER_TILES_Y + ty) * LIGHTCLUSTER_TILES_X + tx;
+}
+
+/** Bins random light-sets with the worker-threads and the reference and compares the results */
+bool LightClusterBinner::RunSelfTest()
+{
+	static const unsigned int counts[] = {0, 1, 3, 17, 256, 1024};
+	const float xScale = 0.75f, yScale = 1.0f, zNear = 50.0f, zFar = 20000.0f;
+
+	LightClusterBinner binner;
+	binner.SetProjection(xScale, yScale, zNear, zFar);
+
+	bool passed = true;
+	unsigned int seed = 12345; // Fixed, so a failure can be reproduced
+	for(unsigned int i=0;i<ARRAYSIZE(counts);i++)
+	{
+		PointBatch lights;
+		MakeSyntheticLights(lights, counts[i], zFar, seed);
+
+		binner.Begin(&lights);
+		binner.Finish();
+		std::vector<LightClusterRange> ranges = binner.GetClusterRanges();
+		std::vector<unsigned int> indices = binner.GetLightIndices();
+
+		binner.BinReference(lights);
+		if(indices != binner.GetLightIndices() || memcmp(&ranges[0], &binner.GetClusterRanges()[0], ranges.size() * sizeof(LightClusterRange)) != 0)
+		{
+			LogWarn() << "Light cluster self-test: SSE-result differs from the reference with " << counts[i] << " lights";
+			passed = false;
+		}
+
+		// Every point inside a light has to find that light in the cluster the shader picks for it
+		for(unsigned int p=0;p<2000 && lights.Size();p++)
+		{
+			seed = seed * 1664525 + 1013904223;
+			float u = (float)(seed >> 8) / (float)(1 << 24);
+			seed = seed * 1664525 + 1013904223;
+			float v = (float)(seed >> 8) / (float)(1 << 24);
+			seed = seed * 1664525 + 1013904223;
+			float z = 1.0f + (float)(seed >> 8) / (float)(1 << 24) * (zFar - 1.0f);
+
+			D3DXVECTOR3 point = D3DXVECTOR3((u * 2.0f - 1.0f) * z / xScale, (1.0f - v * 2.0f) * z / yScale, z);
+			const LightClusterRange& range = ranges[GetClusterOfPoint(point, xScale, yScale, zNear, binner.GetSliceScale())];
+
+			for(unsigned int l=0;l<lights.Size();l++)
+			{
+				if(D3DXVec3Length(&(point - D3DXVECTOR3(lights.X[l], lights.Y[l], lights.Z[l]))) >= lights.Radius[l])
+					continue;
+
+				if(std::find(indices.begin() + range.Offset, indices.begin() + range.Offset + range.Count, l) == indices.begin() + range.Offset + range.Count)
+				{
+					LogWarn() << "Light cluster self-test: Light " << l << " missing in the cluster of a point it reaches";
+					passed = false;
+					break;
+				}
+			}
+		}
+	}
+
+	LogInfo() << "Light cluster self-test " << (passed ? "passed" : "failed");
+	return passed;
+}
+
+/** Measures the binning of synthetic light-sets of growing size */
+void LightClusterBinner::RunBenchmark()
+{
+	static const unsigned int counts[] = {64, 256, 1024, 4096};
+	const unsigned int runs = 20;
+	const float zFar = 20000.0f;
+
+	LightClusterBinner binner;
+	binner.SetProjection(0.75f, 1.0f, 50.0f, zFar);
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+
+	unsigned int seed = 12345;
+	for(unsigned int i=0;i<ARRAYSIZE(counts);i++)
+	{
+		PointBatch lights;
+		MakeSyntheticLights(lights, counts[i], zFar, seed);
+
+		LARGE_INTEGER start, end;
+		QueryPerformanceCounter(&start);
+		for(unsigned int r=0;r<runs;r++)
+		{
+			binner.Begin(&lights);
+			binner.Finish();
+		}
+		QueryPerformanceCounter(&end);
+		double parallelMS = (double)(end.QuadPart - start.QuadPart) * 1000.0 / (double)frequency.QuadPart / runs;
+		unsigned int numIndices = binner.GetLightIndices().size();
+
+		QueryPerformanceCounter(&start);
+		for(unsigned int r=0;r<runs;r++)
+			binner.BinReference(lights);
+		QueryPerformanceCounter(&end);
+		double referenceMS = (double)(end.QuadPart - start.QuadPart) * 1000.0 / (double)frequency.QuadPart / runs;
+
+		LogInfo() << "Light cluster benchmark: " << counts[i] << " lights, " << numIndices << " cluster entries. SSE + workers: "
+			<< parallelMS << "ms, reference: " << referenceMS << "ms";
+	}
+}
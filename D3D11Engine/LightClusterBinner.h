@@ -0,0 +1,88 @@
+#pragma once
+#include "pch.h"
+#include "BatchCulling.h"
+#include "ThreadPool.h"
+
+/** Resolution of the cluster-grid. Tiles split the screen, slices split the view-space depth exponentially. */
+const unsigned int LIGHTCLUSTER_TILES_X = 16;
+const unsigned int LIGHTCLUSTER_TILES_Y = 8;
+const unsigned int LIGHTCLUSTER_SLICES = 24;
+const unsigned int LIGHTCLUSTER_TILES_PER_SLICE = LIGHTCLUSTER_TILES_X * LIGHTCLUSTER_TILES_Y;
+const unsigned int LIGHTCLUSTER_NUM_CLUSTERS = LIGHTCLUSTER_TILES_PER_SLICE * LIGHTCLUSTER_SLICES;
+
+/** Where the lights of a cluster start in the index-list and how many there are. Layed out like the shader reads it. */
+struct LightClusterRange
+{
+	unsigned int Offset;
+	unsigned int Count;
+};
+
+/** Sorts view-space light-spheres into the froxels of a camera, so one full-screen pass can light every pixel with only the
+	lights touching its cluster. Each slice is a job for the worker-threads, which tests the spheres against 4 clusters at a
+	time using SSE. Cluster c is at (slice * LIGHTCLUSTER_TILES_Y + tileY) * LIGHTCLUSTER_TILES_X + tileX, with tileY = 0 at
+	the top of the screen. */
+class LightClusterBinner
+{
+public:
+	LightClusterBinner(void);
+	~LightClusterBinner(void);
+
+	/** Sets up the clusters for a projection. xScale and yScale are _11 and _22 of the projection-matrix.
+		The slices are spread from zNear to zFar, everything closer than zNear belongs to the first one. */
+	void SetProjection(float xScale, float yScale, float zNear, float zFar);
+
+	/** Starts binning the given spheres, in view-space, on the worker-threads. The batch has to stay alive until Finish. */
+	void Begin(const PointBatch* lights);
+
+	/** Waits for the workers and builds the cluster-ranges and the index-list */
+	void Finish();
+
+	/** Bins on the calling thread without SSE. Gives the same result as Begin and Finish. */
+	void BinReference(const PointBatch& lights);
+
+	/** Offset and count into the index-list for every cluster */
+	const std::vector<LightClusterRange>& GetClusterRanges(){return ClusterRanges;}
+
+	/** Indices of the lights, grouped by cluster */
+	const std::vector<unsigned int>& GetLightIndices(){return LightIndices;}
+
+	float GetNear(){return ZNear;}
+	float GetFar(){return ZFar;}
+
+	/** Returns the factor which turns log(z / near) into the slice-index */
+	float GetSliceScale();
+
+	/** Bins random light-sets with the worker-threads and the reference and compares the results. Logs the result. */
+	static bool RunSelfTest();
+
+	/** Measures the binning of synthetic light-sets of growing size and logs the timings */
+	static void RunBenchmark();
+
+private:
+	/** Tests all lights against the clusters of the given slice */
+	void BinSlice(unsigned int slice);
+
+	/** Puts the lists of the clusters after each other */
+	void CompactClusters();
+
+	/** View-space boxes of all clusters, padded to the batch width */
+	AABBBatch ClusterBoxes;
+
+	/** Depth-range of each slice */
+	float SliceMinZ[LIGHTCLUSTER_SLICES];
+	float SliceMaxZ[LIGHTCLUSTER_SLICES];
+
+	float ZNear;
+	float ZFar;
+
+	/** Lights being binned */
+	const PointBatch* Lights;
+	JobGroup BinJobs;
+	bool Binning;
+
+	/** Lights of every cluster, filled by the workers. Kept around so they don't allocate every frame. */
+	std::vector<std::vector<unsigned int>> ClusterLights;
+
+	std::vector<LightClusterRange> ClusterRanges;
+	std::vector<unsigned int> LightIndices;
+};
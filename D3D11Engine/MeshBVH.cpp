@@ -0,0 +1,447 @@
+#include "pch.h"
+#include "MeshBVH.h"
+#include "Toolbox.h"
+
+/** Makes the slab-test conservative against rounding, so triangles touching a node-boundary are never missed */
+const float MESHBVH_SLAB_EPSILON = 1.0f + 2.0f * 3.6e-7f;
+
+/** Surface area of a box, for the SAH. Empty boxes have none. */
+static float MeshBVHBoxArea(const D3DXVECTOR3& min, const D3DXVECTOR3& max)
+{
+	D3DXVECTOR3 e = max - min;
+	if(e.x < 0 || e.y < 0 || e.z < 0)
+		return 0.0f;
+
+	return e.x * e.y + e.y * e.z + e.z * e.x;
+}
+
+/** Ray vs. node-box. tNear is where the ray enters the box, clamped to 0. */
+static bool MeshBVHIntersectNode(const MeshBVHNode& node, const D3DXVECTOR3& origin, const D3DXVECTOR3& invDir, float maxT, float& tNear)
+{
+	float t0 = 0.0f;
+	float t1 = maxT;
+	for(int i=0;i<3;i++)
+	{
+		float n = (((const float *)&node.Min)[i] - ((const float *)&origin)[i]) * ((const float *)&invDir)[i];
+		float f = (((const float *)&node.Max)[i] - ((const float *)&origin)[i]) * ((const float *)&invDir)[i];
+		if(n > f)
+			std::swap(n, f);
+
+		f *= MESHBVH_SLAB_EPSILON;
+
+		// Written like this, NaNs from zero-directions leave the interval alone
+		t0 = n > t0 ? n : t0;
+		t1 = f < t1 ? f : t1;
+		if(t0 > t1)
+			return false;
+	}
+
+	tNear = t0;
+	return true;
+}
+
+/** Adds the triangles of an indexed mesh */
+void MeshBVH::AddMesh(const ExVertexStruct* vertices, const VERTEX_INDEX* indices, unsigned int numIndices, unsigned int mesh)
+{
+	for(unsigned int i=0;i+2<numIndices;i+=3)
+	{
+		MeshBVHTriangle tri;
+		tri.V[0] = *vertices[indices[i]].Position.toD3DXVECTOR3();
+		tri.V[1] = *vertices[indices[i+1]].Position.toD3DXVECTOR3();
+		tri.V[2] = *vertices[indices[i+2]].Position.toD3DXVECTOR3();
+		tri.Mesh = mesh;
+		tri.Index = i;
+		Triangles.push_back(tri);
+	}
+}
+
+/** Builds the tree over all added triangles */
+void MeshBVH::Build()
+{
+	Nodes.clear();
+	if(Triangles.empty())
+		return;
+
+	std::vector<D3DXVECTOR3> centroids(Triangles.size());
+	for(unsigned int i=0;i<Triangles.size();i++)
+		centroids[i] = (Triangles[i].V[0] + Triangles[i].V[1] + Triangles[i].V[2]) / 3.0f;
+
+	// A binary tree has at most 2n-1 nodes
+	Nodes.reserve(Triangles.size() * 2);
+
+	MeshBVHNode root;
+	root.LeftOrFirst = 0;
+	root.NumTriangles = Triangles.size();
+	Nodes.push_back(root);
+	UpdateNodeBounds(Nodes[0]);
+
+	Subdivide(0, 1, centroids);
+}
+
+/** Computes the bounds of the triangles of the given node */
+void MeshBVH::UpdateNodeBounds(MeshBVHNode& node)
+{
+	node.Min = D3DXVECTOR3(FLT_MAX, FLT_MAX, FLT_MAX);
+	node.Max = D3DXVECTOR3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for(unsigned int i=0;i<node.NumTriangles;i++)
+	{
+		const MeshBVHTriangle& tri = Triangles[node.LeftOrFirst + i];
+		for(int v=0;v<3;v++)
+		{
+			D3DXVec3Minimize(&node.Min, &node.Min, &tri.V[v]);
+			D3DXVec3Maximize(&node.Max, &node.Max, &tri.V[v]);
+		}
+	}
+}
+
+/** Splits the given node, if that's worth it, and continues with its children */
+void MeshBVH::Subdivide(unsigned int nodeIndex, int depth, std::vector<D3DXVECTOR3>& centroids)
+{
+	unsigned int first = Nodes[nodeIndex].LeftOrFirst;
+	unsigned int count = Nodes[nodeIndex].NumTriangles;
+	if(count <= 2 || depth >= MESHBVH_MAX_DEPTH)
+		return;
+
+	// Bin by centroids, the triangle-bounds would make bins overlap
+	D3DXVECTOR3 cmin = D3DXVECTOR3(FLT_MAX, FLT_MAX, FLT_MAX);
+	D3DXVECTOR3 cmax = D3DXVECTOR3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for(unsigned int i=first;i<first+count;i++)
+	{
+		D3DXVec3Minimize(&cmin, &cmin, &centroids[i]);
+		D3DXVec3Maximize(&cmax, &cmax, &centroids[i]);
+	}
+
+	int bestAxis = -1;
+	int bestSplit = 0;
+	float bestCost = FLT_MAX;
+	for(int axis=0;axis<3;axis++)
+	{
+		float amin = ((float *)&cmin)[axis];
+		float amax = ((float *)&cmax)[axis];
+		if(amax <= amin)
+			continue; // All centroids on one plane
+
+		struct Bin
+		{
+			D3DXVECTOR3 Min, Max;
+			unsigned int Count;
+		} bins[MESHBVH_NUM_BINS];
+
+		for(int b=0;b<MESHBVH_NUM_BINS;b++)
+		{
+			bins[b].Min = D3DXVECTOR3(FLT_MAX, FLT_MAX, FLT_MAX);
+			bins[b].Max = D3DXVECTOR3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+			bins[b].Count = 0;
+		}
+
+		float scale = MESHBVH_NUM_BINS / (amax - amin);
+		for(unsigned int i=first;i<first+count;i++)
+		{
+			int b = std::min(MESHBVH_NUM_BINS - 1, (int)((((float *)&centroids[i])[axis] - amin) * scale));
+			const MeshBVHTriangle& tri = Triangles[i];
+			for(int v=0;v<3;v++)
+			{
+				D3DXVec3Minimize(&bins[b].Min, &bins[b].Min, &tri.V[v]);
+				D3DXVec3Maximize(&bins[b].Max, &bins[b].Max, &tri.V[v]);
+			}
+			bins[b].Count++;
+		}
+
+		// Sweep from both sides to get the cost of every split-plane
+		float leftArea[MESHBVH_NUM_BINS - 1];
+		unsigned int leftCount[MESHBVH_NUM_BINS - 1];
+		D3DXVECTOR3 bmin = D3DXVECTOR3(FLT_MAX, FLT_MAX, FLT_MAX);
+		D3DXVECTOR3 bmax = D3DXVECTOR3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		unsigned int sum = 0;
+		for(int b=0;b<MESHBVH_NUM_BINS-1;b++)
+		{
+			D3DXVec3Minimize(&bmin, &bmin, &bins[b].Min);
+			D3DXVec3Maximize(&bmax, &bmax, &bins[b].Max);
+			sum += bins[b].Count;
+			leftArea[b] = MeshBVHBoxArea(bmin, bmax);
+			leftCount[b] = sum;
+		}
+
+		bmin = D3DXVECTOR3(FLT_MAX, FLT_MAX, FLT_MAX);
+		bmax = D3DXVECTOR3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		sum = 0;
+		for(int b=MESHBVH_NUM_BINS-1;b>0;b--)
+		{
+			D3DXVec3Minimize(&bmin, &bmin, &bins[b].Min);
+			D3DXVec3Maximize(&bmax, &bmax, &bins[b].Max);
+			sum += bins[b].Count;
+
+			if(!sum || !leftCount[b - 1])
+				continue;
+
+			float cost = leftArea[b - 1] * leftCount[b - 1] + MeshBVHBoxArea(bmin, bmax) * sum;
+			if(cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = b;
+			}
+		}
+	}
+
+	if(bestAxis < 0)
+		return; // Can't be split
+
+	// Splitting costs one more box-test. Keep the leaf if that doesn't pay off.
+	float area = MeshBVHBoxArea(Nodes[nodeIndex].Min, Nodes[nodeIndex].Max);
+	if(area > 0 && count <= MESHBVH_MAX_LEAF_TRIANGLES && bestCost / area + 1.0f >= (float)count)
+		return;
+
+	// Partition the triangles
+	float amin = ((float *)&cmin)[bestAxis];
+	float scale = MESHBVH_NUM_BINS / (((float *)&cmax)[bestAxis] - amin);
+	unsigned int i = first;
+	unsigned int j = first + count;
+	while(i < j)
+	{
+		int b = std::min(MESHBVH_NUM_BINS - 1, (int)((((float *)&centroids[i])[bestAxis] - amin) * scale));
+		if(b < bestSplit)
+		{
+			i++;
+		}else
+		{
+			j--;
+			std::swap(Triangles[i], Triangles[j]);
+			std::swap(centroids[i], centroids[j]);
+		}
+	}
+
+	unsigned int leftCount = i - first;
+	if(leftCount == 0 || leftCount == count)
+		return;
+
+	unsigned int left = Nodes.size();
+	MeshBVHNode child;
+	child.LeftOrFirst = first;
+	child.NumTriangles = leftCount;
+	Nodes.push_back(child);
+
+	child.LeftOrFirst = i;
+	child.NumTriangles = count - leftCount;
+	Nodes.push_back(child);
+
+	UpdateNodeBounds(Nodes[left]);
+	UpdateNodeBounds(Nodes[left + 1]);
+
+	Nodes[nodeIndex].LeftOrFirst = left;
+	Nodes[nodeIndex].NumTriangles = 0;
+
+	Subdivide(left, depth + 1, centroids);
+	Subdivide(left + 1, depth + 1, centroids);
+}
+
+/** Walks the tree front to back. Any-hit stops at the first hit. */
+template<bool AnyHit>
+bool MeshBVH::Trace(const D3DXVECTOR3& origin, const D3DXVECTOR3& dir, MeshBVHHit* hit, float maxT) const
+{
+	if(Nodes.empty())
+		return false;
+
+	D3DXVECTOR3 invDir = D3DXVECTOR3(1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z);
+
+	float tNear;
+	if(!MeshBVHIntersectNode(Nodes[0], origin, invDir, maxT, tNear))
+		return false;
+
+	struct StackEntry
+	{
+		unsigned int Node;
+		float TNear;
+	} stack[MESHBVH_MAX_DEPTH];
+	int sp = 0;
+
+	float closest = maxT;
+	const MeshBVHTriangle* closestTri = NULL;
+	unsigned int nodeIndex = 0;
+	for(;;)
+	{
+		const MeshBVHNode& node = Nodes[nodeIndex];
+		if(node.NumTriangles)
+		{
+			for(unsigned int i=0;i<node.NumTriangles;i++)
+			{
+				const MeshBVHTriangle& tri = Triangles[node.LeftOrFirst + i];
+
+				float u, v, t;
+				if(Toolbox::IntersectTri(tri.V[0], tri.V[1], tri.V[2], origin, dir, u, v, t) && t > 0 && t < closest)
+				{
+					if(AnyHit)
+						return true;
+
+					closest = t;
+					closestTri = &tri;
+				}
+			}
+		}else
+		{
+			unsigned int left = node.LeftOrFirst;
+			unsigned int right = left + 1;
+
+			float tLeft, tRight;
+			bool hitLeft = MeshBVHIntersectNode(Nodes[left], origin, invDir, closest, tLeft);
+			bool hitRight = MeshBVHIntersectNode(Nodes[right], origin, invDir, closest, tRight);
+
+			if(hitLeft && hitRight)
+			{
+				// Go into the closer one first, the other one can often be skipped then
+				if(tRight < tLeft)
+				{
+					std::swap(left, right);
+					std::swap(tLeft, tRight);
+				}
+
+				stack[sp].Node = right;
+				stack[sp].TNear = tRight;
+				sp++;
+				nodeIndex = left;
+				continue;
+			}else if(hitLeft)
+			{
+				nodeIndex = left;
+				continue;
+			}else if(hitRight)
+			{
+				nodeIndex = right;
+				continue;
+			}
+		}
+
+		// Take the next node which could still hold something closer
+		for(;;)
+		{
+			if(sp == 0)
+			{
+				if(closestTri && hit)
+				{
+					hit->T = closest;
+					hit->Triangle = closestTri;
+				}
+
+				return closestTri != NULL;
+			}
+
+			sp--;
+			if(stack[sp].TNear <= closest)
+			{
+				nodeIndex = stack[sp].Node;
+				break;
+			}
+		}
+	}
+}
+
+/** Finds the closest hit with 0 < t < maxT */
+bool MeshBVH::TraceClosest(const D3DXVECTOR3& origin, const D3DXVECTOR3& dir, MeshBVHHit& hit, float maxT) const
+{
+	return Trace<false>(origin, dir, &hit, maxT);
+}
+
+/** Returns true if anything is hit with 0 < t < maxT */
+bool MeshBVH::TraceAny(const D3DXVECTOR3& origin, const D3DXVECTOR3& dir, float maxT) const
+{
+	return Trace<true>(origin, dir, NULL, maxT);
+}
+
+/** Returns a random float between 0 and 1 */
+static float MeshBVHRandom(unsigned int& seed)
+{
+	seed = seed * 1664525 + 1013904223;
+	return (float)(seed >> 8) / (float)(1 << 24);
+}
+
+/** Makes random rays starting inside the given box, going into any direction */
+static void MakeRandomRays(const D3DXVECTOR3& min, const D3DXVECTOR3& max, unsigned int numRays, std::vector<D3DXVECTOR3>& origins, std::vector<D3DXVECTOR3>& dirs)
+{
+	unsigned int seed = 12345; // Fixed, so a failure can be reproduced
+	origins.resize(numRays);
+	dirs.resize(numRays);
+	for(unsigned int i=0;i<numRays;i++)
+	{
+		origins[i] = D3DXVECTOR3(min.x + (max.x - min.x) * MeshBVHRandom(seed),
+			min.y + (max.y - min.y) * MeshBVHRandom(seed),
+			min.z + (max.z - min.z) * MeshBVHRandom(seed));
+
+		D3DXVECTOR3 d;
+		do
+		{
+			d = D3DXVECTOR3(MeshBVHRandom(seed) * 2.0f - 1.0f, MeshBVHRandom(seed) * 2.0f - 1.0f, MeshBVHRandom(seed) * 2.0f - 1.0f);
+		}while(D3DXVec3LengthSq(&d) < 0.01f || D3DXVec3LengthSq(&d) > 1.0f);
+
+		D3DXVec3Normalize(&dirs[i], &d);
+	}
+}
+
+/** Traces random rays through the bounds of the tree and checks the closest hits against testing every triangle */
+bool MeshBVH::RunBenchmark(unsigned int numRays, unsigned int numCheckedRays) const
+{
+	if(Nodes.empty())
+	{
+		LogWarn() << "MeshBVH benchmark: Nothing to trace";
+		return false;
+	}
+
+	std::vector<D3DXVECTOR3> origins;
+	std::vector<D3DXVECTOR3> dirs;
+	MakeRandomRays(Nodes[0].Min, Nodes[0].Max, std::max(numRays, numCheckedRays), origins, dirs);
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+
+	// Time the tree on all rays
+	std::vector<MeshBVHHit> hits(origins.size());
+	std::vector<bool> hasHit(origins.size());
+	unsigned int numHits = 0;
+
+	LARGE_INTEGER start, end;
+	QueryPerformanceCounter(&start);
+	for(unsigned int i=0;i<origins.size();i++)
+	{
+		hasHit[i] = TraceClosest(origins[i], dirs[i], hits[i]);
+		numHits += hasHit[i] ? 1 : 0;
+	}
+	QueryPerformanceCounter(&end);
+	double bvhSeconds = (double)(end.QuadPart - start.QuadPart) / (double)frequency.QuadPart;
+
+	// Testing every triangle is slow, so only check some of them
+	bool passed = true;
+	unsigned int numChecked = std::min(numCheckedRays, (unsigned int)origins.size());
+
+	QueryPerformanceCounter(&start);
+	for(unsigned int i=0;i<numChecked;i++)
+	{
+		float closest = FLT_MAX;
+		const MeshBVHTriangle* closestTri = NULL;
+		for(unsigned int n=0;n<Triangles.size();n++)
+		{
+			const MeshBVHTriangle& tri = Triangles[n];
+
+			float u, v, t;
+			if(Toolbox::IntersectTri(tri.V[0], tri.V[1], tri.V[2], origins[i], dirs[i], u, v, t) && t > 0 && t < closest)
+			{
+				closest = t;
+				closestTri = &tri;
+			}
+		}
+
+		// Different triangles at the same distance are fine, both are the closest hit
+		if((closestTri != NULL) != hasHit[i] || (closestTri && closest != hits[i].T))
+		{
+			if(passed)
+				LogWarn() << "MeshBVH benchmark: Ray " << i << " hits at " << (closestTri ? closest : -1.0f) << ", the tree says " << (hasHit[i] ? hits[i].T : -1.0f);
+
+			passed = false;
+		}
+	}
+	QueryPerformanceCounter(&end);
+	double bruteForceSeconds = (double)(end.QuadPart - start.QuadPart) / (double)frequency.QuadPart;
+
+	LogInfo() << "MeshBVH benchmark: " << Triangles.size() << " triangles, " << Nodes.size() << " nodes, " << numHits << " of " << origins.size() << " rays hit. "
+		<< "Tree: " << origins.size() / bvhSeconds << " rays/s, all triangles: " << numChecked / bruteForceSeconds << " rays/s";
+	LogInfo() << "MeshBVH benchmark " << (passed ? "passed" : "failed");
+	return passed;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include "pch.h"
+
+/** Maximum depth of the tree. Deeper nodes are turned into leafs, so the traversal-stack can't overflow. */
+const int MESHBVH_MAX_DEPTH = 64;
+
+/** Number of bins the SAH is evaluated at, per axis */
+const int MESHBVH_NUM_BINS = 16;
+
+/** Leafs with more triangles are always split, even if the SAH says otherwise */
+const unsigned int MESHBVH_MAX_LEAF_TRIANGLES = 16;
+
+/** Node of a MeshBVH. 32 bytes, so two siblings share a cacheline. */
+struct MeshBVHNode
+{
+	D3DXVECTOR3 Min;
+	unsigned int LeftOrFirst; // Index of the left child, the right one comes right after it. First triangle for leafs.
+	D3DXVECTOR3 Max;
+	unsigned int NumTriangles; // 0 for inner nodes
+};
+
+/** Triangle of a MeshBVH */
+struct MeshBVHTriangle
+{
+	D3DXVECTOR3 V[3];
+	unsigned int Mesh; // Number the mesh was added with
+	unsigned int Index; // Position of the first index of this triangle in its mesh
+};
+
+/** Result of a trace */
+struct MeshBVHHit
+{
+	float T;
+	const MeshBVHTriangle* Triangle;
+};
+
+/** Bounding volume hierarchy over the triangles of one or more meshes, for fast ray-tracing.
+	Built with the surface area heuristic. Hits are the same as testing all triangles with Toolbox::IntersectTri. */
+class MeshBVH
+{
+public:
+	/** Adds the triangles of an indexed mesh. "mesh" is handed back in the hits, so the caller can tell where they came from. */
+	void AddMesh(const ExVertexStruct* vertices, const VERTEX_INDEX* indices, unsigned int numIndices, unsigned int mesh);
+
+	/** Builds the tree over all added triangles */
+	void Build();
+
+	/** Finds the closest hit with 0 < t < maxT. Returns false if there is none. */
+	bool TraceClosest(const D3DXVECTOR3& origin, const D3DXVECTOR3& dir, MeshBVHHit& hit, float maxT = FLT_MAX) const;
+
+	/** Returns true if anything is hit with 0 < t < maxT. Cheaper than TraceClosest, since the first hit ends the search. */
+	bool TraceAny(const D3DXVECTOR3& origin, const D3DXVECTOR3& dir, float maxT = FLT_MAX) const;
+
+	/** Traces random rays through the bounds of the tree and checks the closest hits against testing every triangle.
+		Logs the rays per second of both. Returns false if a hit differs. */
+	bool RunBenchmark(unsigned int numRays, unsigned int numCheckedRays) const;
+
+	unsigned int GetNumTriangles() const {return Triangles.size();}
+	unsigned int GetNumNodes() const {return Nodes.size();}
+
+private:
+	/** Splits the given node, if that's worth it, and continues with its children */
+	void Subdivide(unsigned int node, int depth, std::vector<D3DXVECTOR3>& centroids);
+
+	/** Computes the bounds of the triangles of the given node */
+	void UpdateNodeBounds(MeshBVHNode& node);
+
+	template<bool AnyHit>
+	bool Trace(const D3DXVECTOR3& origin, const D3DXVECTOR3& dir, MeshBVHHit* hit, float maxT) const;
+
+	std::vector<MeshBVHNode> Nodes;
+	std::vector<MeshBVHTriangle> Triangles;
+};
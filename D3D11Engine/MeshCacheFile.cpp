@@ -0,0 +1,250 @@
+#include "pch.h"
+#include "MeshCacheFile.h"
+
+MeshCacheFile::MeshCacheFile(void)
+{
+	File = INVALID_HANDLE_VALUE;
+	Mapping = NULL;
+	View = NULL;
+	ViewSize = 0;
+	Header = NULL;
+	Version = 0;
+}
+
+MeshCacheFile::~MeshCacheFile(void)
+{
+	Close();
+}
+
+/** Writes the given geometry as a version 2 cache-file */
+XRESULT MeshCacheFile::Write(const std::map<std::string, std::vector<std::pair<std::vector<ExVertexStruct>, std::vector<VERTEX_INDEX>>>>& geometry, const std::string& file, unsigned __int64 sourceHash)
+{
+	MeshCacheHeader header;
+	ZeroMemory(&header, sizeof(header));
+	header.Version = MESHCACHE_VERSION;
+	header.Magic = MESHCACHE_MAGIC;
+	header.SourceHash = sourceHash;
+
+	// Flatten the geometry into sections and lay out the string table
+	std::vector<MeshCacheSectionEntry> entries;
+	std::vector<const std::pair<std::vector<ExVertexStruct>, std::vector<VERTEX_INDEX>>*> submeshes;
+	std::string strings;
+	for(auto it = geometry.begin(); it != geometry.end(); it++)
+	{
+		for(unsigned int i=0;i<(*it).second.size();i++)
+		{
+			MeshCacheSectionEntry e;
+			ZeroMemory(&e, sizeof(e));
+			e.NameOffset = strings.size(); // Submeshes of the same texture share the name
+			e.NameLength = (*it).first.size();
+			e.NumVertices = (*it).second[i].first.size();
+			e.NumIndices = (*it).second[i].second.size();
+
+			entries.push_back(e);
+			submeshes.push_back(&(*it).second[i]);
+		}
+
+		strings += (*it).first;
+	}
+
+	header.NumSections = entries.size();
+	header.SectionTableOffset = sizeof(MeshCacheHeader);
+	header.StringTableOffset = header.SectionTableOffset + entries.size() * sizeof(MeshCacheSectionEntry);
+	header.StringTableSize = strings.size();
+
+	// Put the blobs after the tables, each one aligned
+	unsigned int offset = Toolbox::AlignOffset(header.StringTableOffset + header.StringTableSize, MESHCACHE_ALIGNMENT);
+	for(unsigned int i=0;i<entries.size();i++)
+	{
+		entries[i].VertexOffset = offset;
+		offset = Toolbox::AlignOffset(offset + entries[i].NumVertices * sizeof(ExVertexStruct), MESHCACHE_ALIGNMENT);
+
+		entries[i].IndexOffset = offset;
+		offset = Toolbox::AlignOffset(offset + entries[i].NumIndices * sizeof(VERTEX_INDEX), MESHCACHE_ALIGNMENT);
+	}
+
+	header.FileSize = offset;
+
+	FILE* f = fopen(file.c_str(), "wb");
+	if(!f)
+	{
+		LogWarn() << "Failed to create cache file: " << file;
+		return XR_FAILED;
+	}
+
+	// Reserve space for the header, it gets written when the hash is known
+	unsigned __int64 hash = Toolbox::HASH_DATA_SEED;
+	fwrite(&header, sizeof(header), 1, f);
+	unsigned int pos = sizeof(header);
+
+	Toolbox::WriteHashedData(f, pos, header.SectionTableOffset, entries.empty() ? NULL : &entries[0], entries.size() * sizeof(MeshCacheSectionEntry), hash);
+	Toolbox::WriteHashedData(f, pos, header.StringTableOffset, strings.data(), strings.size(), hash);
+
+	for(unsigned int i=0;i<entries.size();i++)
+	{
+		Toolbox::WriteHashedData(f, pos, entries[i].VertexOffset, submeshes[i]->first.empty() ? NULL : &submeshes[i]->first[0], entries[i].NumVertices * sizeof(ExVertexStruct), hash);
+		Toolbox::WriteHashedData(f, pos, entries[i].IndexOffset, submeshes[i]->second.empty() ? NULL : &submeshes[i]->second[0], entries[i].NumIndices * sizeof(VERTEX_INDEX), hash);
+	}
+
+	Toolbox::WriteHashedData(f, pos, offset, NULL, 0, hash);
+
+	header.DataHash = hash;
+	fseek(f, 0, SEEK_SET);
+	fwrite(&header, sizeof(header), 1, f);
+
+	fclose(f);
+
+	return XR_SUCCESS;
+}
+
+/** Hashes the contents of the given file. Returns 0 if the file couldn't be read. */
+unsigned __int64 MeshCacheFile::HashFile(const std::string& file)
+{
+	FILE* f = fopen(file.c_str(), "rb");
+	if(!f)
+		return 0;
+
+	unsigned __int64 hash = Toolbox::HASH_DATA_SEED;
+	std::vector<unsigned char> buffer(1024 * 1024);
+
+	size_t read;
+	while((read = fread(&buffer[0], 1, buffer.size(), f)) > 0)
+		hash = Toolbox::HashData(&buffer[0], read, hash);
+
+	fclose(f);
+
+	return hash;
+}
+
+/** Returns true if the given cache-file was built from a source with the given hash */
+bool MeshCacheFile::IsUpToDate(const std::string& file, unsigned __int64 sourceHash)
+{
+	FILE* f = fopen(file.c_str(), "rb");
+	if(!f)
+		return false;
+
+	MeshCacheHeader header;
+	ZeroMemory(&header, sizeof(header));
+	size_t read = fread(&header, 1, sizeof(header), f);
+	fclose(f);
+
+	if(read < sizeof(header.Version))
+		return false;
+
+	// Old files don't know where they came from
+	if(header.Version == 1)
+		return true;
+
+	if(read < sizeof(header) || header.Magic != MESHCACHE_MAGIC || header.Version != MESHCACHE_VERSION)
+		return false;
+
+	return sourceHash == 0 || header.SourceHash == sourceHash;
+}
+
+/** Maps the given file and validates it */
+XRESULT MeshCacheFile::Open(const std::string& file)
+{
+	Close();
+
+	File = CreateFileA(file.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if(File == INVALID_HANDLE_VALUE)
+	{
+		LogWarn() << "Failed to find cache file: " << file;
+		return XR_FAILED;
+	}
+
+	LARGE_INTEGER size;
+	if(!GetFileSizeEx(File, &size) || size.QuadPart < sizeof(int))
+	{
+		LogWarn() << "Cache file is empty: " << file;
+		Close();
+		return XR_FAILED;
+	}
+
+	ViewSize = size.QuadPart;
+	Mapping = CreateFileMappingA(File, NULL, PAGE_READONLY, 0, 0, NULL);
+	View = Mapping ? (const unsigned char*)MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+	if(!View)
+	{
+		LogWarn() << "Failed to map cache file: " << file;
+		Close();
+		return XR_FAILED;
+	}
+
+	Version = *(const int*)View;
+	if(Version != MESHCACHE_VERSION)
+	{
+		// Let the caller decide what to do with old files
+		if(Version != 1)
+			LogWarn() << "Unknown cache file version " << Version << ": " << file;
+
+		return XR_INVALID_ARG;
+	}
+
+	// Validate header and tables before anything points into the file
+	Header = (const MeshCacheHeader*)View;
+	if(ViewSize < sizeof(MeshCacheHeader)
+		|| Header->Magic != MESHCACHE_MAGIC
+		|| Header->FileSize != ViewSize
+		|| Header->SectionTableOffset + (unsigned __int64)Header->NumSections * sizeof(MeshCacheSectionEntry) > ViewSize
+		|| Header->StringTableOffset + (unsigned __int64)Header->StringTableSize > ViewSize)
+	{
+		LogWarn() << "Cache file is corrupt: " << file;
+		Close();
+		return XR_FAILED;
+	}
+
+	if(Toolbox::HashData(View + sizeof(MeshCacheHeader), (size_t)(ViewSize - sizeof(MeshCacheHeader))) != Header->DataHash)
+	{
+		LogWarn() << "Cache file checksum mismatch: " << file;
+		Close();
+		return XR_FAILED;
+	}
+
+	const MeshCacheSectionEntry* entries = (const MeshCacheSectionEntry*)(View + Header->SectionTableOffset);
+	const char* strings = (const char*)(View + Header->StringTableOffset);
+
+	Sections.resize(Header->NumSections);
+	for(unsigned int i=0;i<Header->NumSections;i++)
+	{
+		const MeshCacheSectionEntry& e = entries[i];
+		if((unsigned __int64)e.NameOffset + e.NameLength > Header->StringTableSize
+			|| e.VertexOffset + (unsigned __int64)e.NumVertices * sizeof(ExVertexStruct) > ViewSize
+			|| e.IndexOffset + (unsigned __int64)e.NumIndices * sizeof(VERTEX_INDEX) > ViewSize)
+		{
+			LogWarn() << "Cache file has invalid section " << i << ": " << file;
+			Close();
+			return XR_FAILED;
+		}
+
+		MeshCacheSection& s = Sections[i];
+		s.Texture = std::string(strings + e.NameOffset, e.NameLength);
+		s.Vertices = (const ExVertexStruct*)(View + e.VertexOffset);
+		s.NumVertices = e.NumVertices;
+		s.Indices = (const VERTEX_INDEX*)(View + e.IndexOffset);
+		s.NumIndices = e.NumIndices;
+	}
+
+	return XR_SUCCESS;
+}
+
+/** Unmaps the file */
+void MeshCacheFile::Close()
+{
+	Sections.clear();
+	Header = NULL;
+
+	if(View)
+		UnmapViewOfFile(View);
+
+	if(Mapping)
+		CloseHandle(Mapping);
+
+	if(File != INVALID_HANDLE_VALUE)
+		CloseHandle(File);
+
+	View = NULL;
+	Mapping = NULL;
+	File = INVALID_HANDLE_VALUE;
+	ViewSize = 0;
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include "pch.h"
+
+/** Current version of the .mcache-format. Version 1 files are still loaded by GMesh::LoadCached. */
+const int MESHCACHE_VERSION = 2;
+
+/** "GMCH" */
+const unsigned int MESHCACHE_MAGIC = 0x48434D47;
+
+/** Alignment of the vertex- and index-blobs inside the file */
+const unsigned int MESHCACHE_ALIGNMENT = 16;
+
+/** Header of a version 2 cache-file. All offsets are relative to the start of the file. */
+struct MeshCacheHeader
+{
+	int Version; // Must stay the first field, version 1 files start with it as well
+	unsigned int Magic;
+	unsigned int NumSections;
+	unsigned int SectionTableOffset;
+	unsigned int StringTableOffset;
+	unsigned int StringTableSize;
+	unsigned __int64 SourceHash; // Hash of the file the cache was built from
+	unsigned __int64 DataHash; // Hash of everything after this header
+	unsigned __int64 FileSize;
+};
+
+/** Entry of the section table. One of these exists for every submesh. */
+struct MeshCacheSectionEntry
+{
+	unsigned int NameOffset; // Offset into the string table
+	unsigned int NameLength;
+	unsigned int VertexOffset;
+	unsigned int NumVertices;
+	unsigned int IndexOffset;
+	unsigned int NumIndices;
+};
+
+/** Submesh as seen by the users of a loaded cache. Vertices and indices point right into the mapped file. */
+struct MeshCacheSection
+{
+	std::string Texture;
+	const ExVertexStruct* Vertices;
+	unsigned int NumVertices;
+	const VERTEX_INDEX* Indices;
+	unsigned int NumIndices;
+};
+
+/** Reads and writes .mcache-files. Loaded files are memory-mapped, so the geometry can be used without copying it. */
+class MeshCacheFile
+{
+public:
+	MeshCacheFile(void);
+	~MeshCacheFile(void);
+
+	/** Writes the given geometry as a version 2 cache-file */
+	static XRESULT Write(const std::map<std::string, std::vector<std::pair<std::vector<ExVertexStruct>, std::vector<VERTEX_INDEX>>>>& geometry, const std::string& file, unsigned __int64 sourceHash);
+
+	/** Hashes the contents of the given file. Returns 0 if the file couldn't be read. */
+	static unsigned __int64 HashFile(const std::string& file);
+
+	/** Returns true if the given cache-file was built from a source with the given hash.
+		Version 1 files don't store a hash and are always considered up to date. */
+	static bool IsUpToDate(const std::string& file, unsigned __int64 sourceHash);
+
+	/** Maps the given file and validates it. Fails for version 1 files, check GetVersion() in that case. */
+	XRESULT Open(const std::string& file);
+
+	/** Unmaps the file. All pointers from GetSections() get invalid. */
+	void Close();
+
+	/** Returns the version of the opened file */
+	int GetVersion(){return Version;}
+
+	/** Returns the hash of the source this file was built from */
+	unsigned __int64 GetSourceHash(){return Header ? Header->SourceHash : 0;}
+
+	/** Returns the submeshes stored in the file */
+	const std::vector<MeshCacheSection>& GetSections(){return Sections;}
+
+private:
+	HANDLE File;
+	HANDLE Mapping;
+	const unsigned char* View;
+	unsigned __int64 ViewSize;
+
+	const MeshCacheHeader* Header;
+	int Version;
+
+	std::vector<MeshCacheSection> Sections;
+};
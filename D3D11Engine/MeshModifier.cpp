@@ -1,5 +1,10 @@
 #include "pch.h"
 #include "MeshModifier.h"
+#include "Engine.h"
+#include "ThreadPool.h"
+#include <queue>
+#include <algorithm>
+#include <iterator>
 /*#include "include\OpenMesh\Tools\Subdivider\Uniform\CatmullClarkT.hh"
 #include "include\OpenMesh\Tools\Subdivider\Uniform\LoopT.hh"
 #include "include\OpenMesh\Tools\Decimater\DecimaterT.hh"
@@ -196,40 +201,6 @@ void MeshModifier::DropTexcoords(const std::vector<ExVertexStruct>& inVertices,
         outVertices[it->second] = it->first;*/
 }
 
-/** Decimates the mesh, reducing its complexity */
-void MeshModifier::Decimate(const std::vector<ExVertexStruct>& inVertices, const std::vector<unsigned short>& inIndices, std::vector<ExVertexStruct>& outVertices, std::vector<VERTEX_INDEX>& outIndices)
-{
-	/*MyMesh mesh;
-
-	PutVertexData(mesh, inVertices, inIndices);
-
-	Decimater decimater(mesh); // a decimater object, connected to a mesh
-
-	//HModQuadric hModQuadric; // use a quadric module
-	HModRoundnessT hModRoundness;
-
-	decimater.add( hModRoundness ); // register module at the decimater
-
-	//
-	//since we need exactly one priority module (non-binary)
-	//we have to call set_binary(false) for our priority module
-	//in the case of HModQuadric, unset_max_err() calls set_binary(false) internally
-	//
-	//decimater.module( hModRoundness ).set_binary(false);//.unset_max_err();
-	decimater.module( hModRoundness ).set_min_roundness(0.05f);
-	//decimater.module( hModRoundness ).set_min_angle(
-	decimater.module( hModRoundness ).initialize();
-	decimater.initialize(); // let the decimater initialize the mesh and the
-	// modules
-	decimater.decimate(); // do decimation
-	
-	mesh.update_normals();
-	mesh.triangulate();
-
-	// Get data out of the openmesh
-	PullVertexData(mesh, outVertices, outIndices);*/
-}
-
 struct PNAENEdge
 {
 	// "An Edge should consist of the origin index, the destination index, the origin position and the destination position"
@@ -264,51 +235,173 @@ bool operator< (const PNAENEdge& lhs, const PNAENEdge& rhs)
 	return (lhs.iO < rhs.iO) || (lhs.iO == rhs.iO && lhs.iD < rhs.iD);
 }
 
-struct PNAENKeyHasher
+/** Bits of a coordinate, with -0 turned into 0 so both end up in the same place */
+static unsigned int PositionKeyBits(float f)
 {
-	static const size_t bucket_size = 10; // mean bucket size that the container should try not to exceed
-	static const size_t min_buckets = (1 << 10); // minimum number of buckets, power of 2, >0
+	if(f == 0.0f)
+		return 0;
 
-	static std::size_t hash_value(float value)
+	unsigned int bits;
+	memcpy(&bits, &f, sizeof(bits));
+	return bits;
+}
+
+/** Hash of a position, equal for all positions comparing equal with == */
+static unsigned int PositionHash(const float3& p)
+{
+	unsigned int h = PositionKeyBits(p.x) * 73856093u ^ PositionKeyBits(p.y) * 19349663u ^ PositionKeyBits(p.z) * 83492791u;
+
+	// Coordinates are often whole numbers, whose low bits are all zero. Mix the high bits down.
+	h ^= h >> 16;
+	h *= 0x85EBCA6Bu;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35u;
+	h ^= h >> 16;
+	return h;
+}
+
+/** Groups references to the vertices by their position. With indices being NULL, every vertex is referenced once.
+	Items of a group are listed in their original order, groups in the order of their first item. */
+static void GroupByPosition(const std::vector<ExVertexStruct>& vertices, const unsigned int* indices, unsigned int num, std::vector<unsigned int>& outGroupOf, std::vector<unsigned int>& outGroupStart, std::vector<unsigned int>& outGroupItems)
+{
+	// Flat open-addressing table, holding the vertex of the first item of each group
+	unsigned int tableSize = 1024;
+	while(tableSize < num * 2)
+		tableSize *= 2;
+
+	std::vector<unsigned int> table(tableSize, 0xFFFFFFFF);
+	std::vector<unsigned int> tableGroup(tableSize);
+	std::vector<unsigned int> groupSize;
+	groupSize.reserve(num / 4);
+	outGroupOf.resize(num);
+
+	for(unsigned int i=0;i<num;i++)
 	{
-		stdext::hash<float> hasher;
-		return hasher(value);
+		unsigned int vx = indices ? indices[i] : i;
+		const float3& p = vertices[vx].Position;
+		if(p.x != p.x || p.y != p.y || p.z != p.z)
+		{
+			// NaN never equals anything, not even itself
+			outGroupOf[i] = groupSize.size();
+			groupSize.push_back(1);
+			continue;
+		}
+
+		unsigned int slot = PositionHash(p) & (tableSize - 1);
+		for(;;)
+		{
+			unsigned int first = table[slot];
+			if(first == 0xFFFFFFFF)
+			{
+				table[slot] = vx;
+				tableGroup[slot] = groupSize.size();
+				outGroupOf[i] = groupSize.size();
+				groupSize.push_back(1);
+				break;
+			}
+
+			const float3& o = vertices[first].Position;
+			if(o.x == p.x && o.y == p.y && o.z == p.z)
+			{
+				outGroupOf[i] = tableGroup[slot];
+				groupSize[tableGroup[slot]]++;
+				break;
+			}
+
+			slot = (slot + 1) & (tableSize - 1);
+		}
 	}
 
-	static void hash_combine(std::size_t& seed, float value)
-	{	
-		seed ^= hash_value(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+	// Counting-sort the items into their groups, which keeps their order
+	outGroupStart.resize(groupSize.size() + 1);
+	outGroupStart[0] = 0;
+	for(unsigned int g=0;g<groupSize.size();g++)
+		outGroupStart[g + 1] = outGroupStart[g] + groupSize[g];
+
+	std::vector<unsigned int> fill(outGroupStart.begin(), outGroupStart.end() - 1);
+	outGroupItems.resize(num);
+	for(unsigned int i=0;i<num;i++)
+		outGroupItems[fill[outGroupOf[i]]++] = i;
+}
+
+/** Flat open-addressing table of the edges of a mesh, keyed by their positions. Finds the same edges as the
+	unordered_map of the reference implementation, without allocating a node per edge. */
+class PNAENEdgeTable
+{
+public:
+	PNAENEdgeTable(unsigned int numEdges)
+	{
+		TableSize = 1024;
+		while(TableSize < numEdges * 2)
+			TableSize *= 2;
+
+		Slots.assign(TableSize, 0xFFFFFFFF);
+		Edges.reserve(numEdges);
 	}
 
-	std::size_t operator()(const PNAENEdge& k) const
+	/** Stores the edge, unless an equal one is already there. The first one wins, like with unordered_map::emplace. */
+	void Add(const PNAENEdge& e)
 	{
-		// Start with a hash value of 0    .
-		std::size_t seed = 0;
+		unsigned int slot = Hash(e) & (TableSize - 1);
+		for(;;)
+		{
+			unsigned int idx = Slots[slot];
+			if(idx == 0xFFFFFFFF)
+			{
+				Slots[slot] = Edges.size();
+				Edges.push_back(e);
+				return;
+			}
 
-		// Modify 'seed' by XORing and bit-shifting in
-		// one member of 'Key' after the other:
+			if(IsSameEdge(Edges[idx], e))
+				return;
 
-		hash_combine(seed, k.pO.x);
-		hash_combine(seed, k.pO.y);
-		hash_combine(seed, k.pO.z);
-		//hash_combine(seed, hash_value(k.iO));
+			slot = (slot + 1) & (TableSize - 1);
+		}
+	}
 
-		hash_combine(seed, k.pD.x);
-		hash_combine(seed, k.pD.y);
-		hash_combine(seed, k.pD.z);
-		//hash_combine(seed, hash_value(k.iD));
+	/** Looks up the stored edge equal to the given one and returns its reverse */
+	bool FindReverse(const PNAENEdge& e, PNAENEdge& outReverse) const
+	{
+		unsigned int slot = Hash(e) & (TableSize - 1);
+		for(;;)
+		{
+			unsigned int idx = Slots[slot];
+			if(idx == 0xFFFFFFFF)
+				return false;
 
-		// Return the result.
-		return seed;
+			if(IsSameEdge(Edges[idx], e))
+			{
+				outReverse = Edges[idx];
+				outReverse.ReverseEdge();
+				return true;
+			}
+
+			slot = (slot + 1) & (TableSize - 1);
+		}
+	}
+
+private:
+	/** Only the positions go in, edges with equal indices always have equal positions */
+	static unsigned int Hash(const PNAENEdge& e)
+	{
+		return PositionHash(e.pO) * 31u + PositionHash(e.pD);
 	}
 
-	/*bool operator()(const PNAENEdge &left, const PNAENEdge &right) 
+	/** Exact version of PNAENEdge::operator==. That one is fuzzy on the positions, which would let the result depend
+		on which edges happen to share a slot. */
+	static bool IsSameEdge(const PNAENEdge& a, const PNAENEdge& b)
 	{
-		if(left.iD < right.iD || (left.iD == right.iD && left.iO < right.iO))
+		if(a.iO == b.iO && a.iD == b.iD)
 			return true;
 
-		return left.pD < right.pD || (left.pD == right.pD && left.pO < right.pO);
-    }*/
+		return a.pO.x == b.pO.x && a.pO.y == b.pO.y && a.pO.z == b.pO.z
+			&& a.pD.x == b.pD.x && a.pD.y == b.pD.y && a.pD.z == b.pD.z;
+	}
+
+	unsigned int TableSize;
+	std::vector<unsigned int> Slots;
+	std::vector<PNAENEdge> Edges;
 };
 
 void MeshModifier::ComputePNAENIndices(const std::vector<ExVertexStruct>& inVertices, const std::vector<unsigned short>& inIndices, std::vector<VERTEX_INDEX>& outIndices)
@@ -330,7 +423,7 @@ void MeshModifier::ComputePNAENIndices(const std::vector<ExVertexStruct>& inVert
 	
 	// "For each edge, store the reverse of that edge in an easily searchable data structure for the next step. 
 	//  The reference implementation uses an stdext::unordered_map<Edge,Edge> for this purpose"
-	std::unordered_map<PNAENEdge,PNAENEdge,PNAENKeyHasher> EdgeReverseMap;
+	PNAENEdgeTable EdgeReverseMap(inIndices.size());
 
 	// "Create an output IB that is 3 times the size of input IB"
 	outIndices.resize(inIndices.size() * 3);
@@ -360,34 +453,28 @@ void MeshModifier::ComputePNAENIndices(const std::vector<ExVertexStruct>& inVert
 		float3 p2 = inVertices[i2].Position;
 
 		// "Define 3 Edges, which consist of the two indices and two positions that make up the corresponding Edge"
-		PNAENEdge e0, r0;
+		PNAENEdge e0;
 		e0.iO = i0;
 		e0.iD = i1;
 		e0.pO = p0;
 		e0.pD = p1;
-		r0 = e0;
-		r0.ReverseEdge();
 
-		PNAENEdge e1, r1;
+		PNAENEdge e1;
 		e1.iO = i1;
 		e1.iD = i2;
 		e1.pO = p1;
 		e1.pD = p2;
-		r1 = e1;
-		r1.ReverseEdge();
 
-		PNAENEdge e2, r2;
+		PNAENEdge e2;
 		e2.iO = i2;
 		e2.iD = i0;
 		e2.pO = p2;
 		e2.pD = p0;
-		r2 = e2;
-		r2.ReverseEdge();
 
 		// "For each edge, store the reverse of that edge in an easily searchable data structure for the next step"
-		EdgeReverseMap.emplace(e0, r0);
-		EdgeReverseMap.emplace(e1, r1);
-		EdgeReverseMap.emplace(e2, r2);
+		EdgeReverseMap.Add(e0);
+		EdgeReverseMap.Add(e1);
+		EdgeReverseMap.Add(e2);
 	}
 
 	// "Walk the output index buffer (OB) constructed in step 2. "
@@ -403,10 +490,9 @@ void MeshModifier::ComputePNAENIndices(const std::vector<ExVertexStruct>& inVert
 			temp.pO = inVertices[i1].Position;
 			temp.pD = inVertices[i0].Position;
 
-			auto foundIt = EdgeReverseMap.find(temp);
-			if (foundIt != EdgeReverseMap.end()) //look up in edge vector
+			PNAENEdge second;
+			if (EdgeReverseMap.FindReverse(temp, second)) //look up in edge vector
 			{
-				const PNAENEdge& second = foundIt->second;
 				outIndices[i + k] = second.iO;
 				outIndices[i + k + 1] = second.iD;
 				
@@ -470,42 +556,6 @@ struct VertexKeyHasher
 	}
 };
 
-struct Float3KeyHasher
-{
-	static const size_t bucket_size = 10; // mean bucket size that the container should try not to exceed
-	static const size_t min_buckets = (1 << 10); // minimum number of buckets, power of 2, >0
-
-	static std::size_t hash_value(float value)
-	{
-		stdext::hash<float> hasher;
-		return hasher(value);
-	}
-
-	static void hash_combine(std::size_t& seed, float value)
-	{	
-		seed ^= hash_value(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-	}
-
-	std::size_t operator()(const float3& k) const
-	{
-		// Start with a hash value of 0    .
-		std::size_t seed = 0;
-
-		// Modify 'seed' by XORing and bit-shifting in
-		// one member of 'Key' after the other:
-		hash_combine(seed, k.x);
-		hash_combine(seed, k.y);
-		hash_combine(seed, k.z);
-							
-		hash_combine(seed, k.x);
-		hash_combine(seed, k.y);
-		hash_combine(seed, k.z);
-
-		// Return the result.
-		return seed;
-	}
-};
-
 void MeshModifier::ComputePNAEN18Indices(std::vector<ExVertexStruct>& inVertices, const std::vector<unsigned short>& inIndices, std::vector<VERTEX_INDEX>& outIndices, bool detectBorders, bool softNormals)
 {
 	std::vector<unsigned int> ix;
@@ -525,48 +575,46 @@ void MeshModifier::ComputePNAEN18Indices(std::vector<ExVertexStruct>& inVertices
 	
 	// "For each edge, store the reverse of that edge in an easily searchable data structure for the next step. 
 	//  The reference implementation uses an stdext::unordered_map<Edge,Edge> for this purpose"
-	std::unordered_map<PNAENEdge,PNAENEdge,PNAENKeyHasher> EdgeReverseMap;
+	PNAENEdgeTable EdgeReverseMap(inIndices.size());
 
 	// "Create an output IB that is 3 times the size of input IB"
 	outIndices.resize(inIndices.size() * 3 * 2);
 
-	// Map to store adj. vertices
-	std::unordered_map<float3, std::pair<std::vector<unsigned int>, std::vector<ExVertexStruct*>>, Float3KeyHasher> VertexMap;
-
-	for(unsigned int i = 0; i < inIndices.size(); i++)
-	{
-		// Put adj. vertices of this face together
-		VertexMap[inVertices[inIndices[i]].Position].first.push_back(inIndices[i]);
-		VertexMap[inVertices[inIndices[i]].Position].second.push_back(&inVertices[inIndices[i]]);
-	}
+	// Put adj. vertices together. Every use of a vertex by a face counts, in the order of the indices.
+	std::vector<unsigned int> groupOf;
+	std::vector<unsigned int> groupStart;
+	std::vector<unsigned int> groupItems;
+	GroupByPosition(inVertices, inIndices.empty() ? NULL : &inIndices[0], inIndices.size(), groupOf, groupStart, groupItems);
 
 	unsigned int num = 0;
-	for(auto it = VertexMap.begin(); it != VertexMap.end(); it++)
+	for(unsigned int g=0;g + 1<groupStart.size();g++)
 	{
-		std::vector<ExVertexStruct *>& vx = (*it).second.second;
+		const unsigned int* items = &groupItems[groupStart[g]];
+		unsigned int numItems = groupStart[g + 1] - groupStart[g];
 
 		D3DXVECTOR3 nrm = D3DXVECTOR3(0,0,0);
 		if(softNormals)
 		{
 			// Average normal of all adj. vertices			
-			for(unsigned int i=0;i<vx.size();i++)
+			for(unsigned int i=0;i<numItems;i++)
 			{
-				nrm += *vx[i]->Normal.toD3DXVECTOR3();
+				nrm += *inVertices[inIndices[items[i]]].Normal.toD3DXVECTOR3();
 			}
-			nrm /= vx.size();
+			nrm /= numItems;
 		}
 
 		// Set it to all of them
-		for(unsigned int i=0;i<vx.size();i++)
+		for(unsigned int i=0;i<numItems;i++)
 		{
+			ExVertexStruct& vx = inVertices[inIndices[items[i]]];
 			if(detectBorders)
 			{
-				vx[i]->TexCoord2.x = 0.0f;
-				vx[i]->TexCoord2.y = num / 1000.0f;
+				vx.TexCoord2.x = 0.0f;
+				vx.TexCoord2.y = num / 1000.0f;
 				num++;
 			}
 			if(softNormals)
-				vx[i]->Normal = nrm;
+				vx.Normal = nrm;
 		}
 	}
 
@@ -610,34 +658,28 @@ void MeshModifier::ComputePNAEN18Indices(std::vector<ExVertexStruct>& inVertices
 		float3 p2 = inVertices[i2].Position;
 
 		// "Define 3 Edges, which consist of the two indices and two positions that make up the corresponding Edge"
-		PNAENEdge e0, r0;
+		PNAENEdge e0;
 		e0.iO = i0;
 		e0.iD = i1;
 		e0.pO = p0;
 		e0.pD = p1;
-		r0 = e0;
-		r0.ReverseEdge();
 
-		PNAENEdge e1, r1;
+		PNAENEdge e1;
 		e1.iO = i1;
 		e1.iD = i2;
 		e1.pO = p1;
 		e1.pD = p2;
-		r1 = e1;
-		r1.ReverseEdge();
 
-		PNAENEdge e2, r2;
+		PNAENEdge e2;
 		e2.iO = i2;
 		e2.iD = i0;
 		e2.pO = p2;
 		e2.pD = p0;
-		r2 = e2;
-		r2.ReverseEdge();
 
 		// "For each edge, store the reverse of that edge in an easily searchable data structure for the next step"
-		EdgeReverseMap.emplace(e0, r0);
-		EdgeReverseMap.emplace(e1, r1);
-		EdgeReverseMap.emplace(e2, r2);
+		EdgeReverseMap.Add(e0);
+		EdgeReverseMap.Add(e1);
+		EdgeReverseMap.Add(e2);
 	}
 
 	// "Walk the output index buffer (OB) constructed in step 2. "
@@ -658,10 +700,9 @@ void MeshModifier::ComputePNAEN18Indices(std::vector<ExVertexStruct>& inVertices
 			domEdge.iO = 0;
 			domEdge.iD = 0;
 
-			auto foundIt = EdgeReverseMap.find(temp);
-			if (foundIt != EdgeReverseMap.end()) //look up in edge vector
+			PNAENEdge second;
+			if (EdgeReverseMap.FindReverse(temp, second)) //look up in edge vector
 			{
-				const PNAENEdge& second = foundIt->second;
 				outIndices[i + k] = second.iO;
 				outIndices[i + k + 1] = second.iD;
 
@@ -669,10 +710,8 @@ void MeshModifier::ComputePNAEN18Indices(std::vector<ExVertexStruct>& inVertices
 			}else
 			{
 				temp.ReverseEdge();
-				foundIt = EdgeReverseMap.find(temp);
-				if (foundIt != EdgeReverseMap.end()) 
+				if (EdgeReverseMap.FindReverse(temp, second)) 
 				{
-					const PNAENEdge& second = foundIt->second;
 					domEdge = second;
 					domEdge.ReverseEdge();
 				}else
@@ -733,31 +772,32 @@ void MeshModifier::ComputePNAEN18Indices(std::vector<ExVertexStruct>& inVertices
 			// Dom. UV-Coords
 			for(int k=0;k<3;k++)
 			{
-				float3 v = inVertices[outIndices[(i - 3) + k]].Position;
-				std::pair<std::vector<unsigned int>, std::vector<ExVertexStruct*>>& adj = VertexMap[v];
-
+				unsigned int g = groupOf[(i - 3) / 18 * 3 + k];
+				const unsigned int* adj = &groupItems[groupStart[g]];
+				unsigned int numAdj = groupStart[g + 1] - groupStart[g];
 
 				float2 smallest = float2(FLT_MAX, FLT_MAX);
 				int smallestIdx = outIndices[(i - 3) + k];
 				bool isBorder = false;
-				for(unsigned int j=0;j<adj.first.size();j++)
+				for(unsigned int j=0;j<numAdj;j++)
 				{
-					if(adj.second[j]->TexCoord < smallest)
+					const ExVertexStruct& vx = inVertices[inIndices[adj[j]]];
+					if(vx.TexCoord < smallest)
 					{
-						smallest = adj.second[j]->TexCoord;
-						smallestIdx = adj.first[j];
+						smallest = vx.TexCoord;
+						smallestIdx = inIndices[adj[j]];
 					}
 
-					if(adj.second[j]->TexCoord2.x == 1.0f)
+					if(vx.TexCoord2.x == 1.0f)
 						isBorder = true;
 				}
 
 				// If one vertex is a border vertex, apply that to all of them
 				if(isBorder)
 				{
-					for(unsigned int j=0;j<adj.first.size();j++)
+					for(unsigned int j=0;j<numAdj;j++)
 					{
-						adj.second[j]->TexCoord2.x = 1.0f;
+						inVertices[inIndices[adj[j]]].TexCoord2.x = 1.0f;
 					}
 				}
 
@@ -768,66 +808,833 @@ void MeshModifier::ComputePNAEN18Indices(std::vector<ExVertexStruct>& inVertices
 }
 
 
-bool TexcoordSame(float2 a, float2 b)
+/** Hashes edges like the unordered_map of the reference implementation did */
+struct PNAENKeyHasher
 {
-	if(( abs(a.x - 		b.x) > 0.001f &&
-		abs((a.x + 1) - b.x) > 0.001f &&
-		abs((a.x - 1) - b.x) > 0.001f) ||
-		(abs(a.y - 		b.y) > 0.001f &&
-		abs((a.y + 1) - b.y) > 0.001f &&
-		abs((a.y - 1) - b.y) > 0.001f))
-		return false;
-		
-	return true;
+	static const size_t bucket_size = 10; // mean bucket size that the container should try not to exceed
+	static const size_t min_buckets = (1 << 10); // minimum number of buckets, power of 2, >0
+
+	static std::size_t hash_value(float value)
+	{
+		stdext::hash<float> hasher;
+		return hasher(value);
+	}
+
+	static void hash_combine(std::size_t& seed, float value)
+	{	
+		seed ^= hash_value(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+	}
+
+	std::size_t operator()(const PNAENEdge& k) const
+	{
+		std::size_t seed = 0;
+		hash_combine(seed, k.pO.x);
+		hash_combine(seed, k.pO.y);
+		hash_combine(seed, k.pO.z);
+
+		hash_combine(seed, k.pD.x);
+		hash_combine(seed, k.pD.y);
+		hash_combine(seed, k.pD.z);
+		return seed;
+	}
 };
 
-/** Computes smooth normals for the given mesh */
-void MeshModifier::ComputeSmoothNormals(std::vector<ExVertexStruct>& inVertices)
+/** Hashes positions like the vertex-map of the reference implementation did */
+struct Float3KeyHasher
 {
+	static const size_t bucket_size = 10; // mean bucket size that the container should try not to exceed
+	static const size_t min_buckets = (1 << 10); // minimum number of buckets, power of 2, >0
+
+	std::size_t operator()(const float3& k) const
+	{
+		std::size_t seed = 0;
+		PNAENKeyHasher::hash_combine(seed, k.x);
+		PNAENKeyHasher::hash_combine(seed, k.y);
+		PNAENKeyHasher::hash_combine(seed, k.z);
+
+		PNAENKeyHasher::hash_combine(seed, k.x);
+		PNAENKeyHasher::hash_combine(seed, k.y);
+		PNAENKeyHasher::hash_combine(seed, k.z);
+		return seed;
+	}
+};
+
+/** ComputePNAENIndices as it was before PNAENEdgeTable, using an unordered_map of the edges */
+void MeshModifier::ComputePNAENIndicesReference(const std::vector<ExVertexStruct>& inVertices, const std::vector<unsigned int>& inIndices, std::vector<unsigned int>& outIndices)
+{
+	std::unordered_map<PNAENEdge,PNAENEdge,PNAENKeyHasher> EdgeReverseMap;
+
+	outIndices.resize(inIndices.size() * 3);
+
+	for(unsigned int i=0;i<inIndices.size();i+=3)
+	{
+		unsigned int i0 = inIndices[i + 0];
+		unsigned int i1 = inIndices[i + 1];
+		unsigned int i2 = inIndices[i + 2];
 
+		outIndices[i * 3 + 0] = i0;
+		outIndices[i * 3 + 1] = i1;
+		outIndices[i * 3 + 2] = i2;
+		outIndices[i * 3 + 3] = i0;
+		outIndices[i * 3 + 4] = i1;
+		outIndices[i * 3 + 5] = i1;
+		outIndices[i * 3 + 6] = i2;
+		outIndices[i * 3 + 7] = i2;
+		outIndices[i * 3 + 8] = i0;
 
-	// Map to store adj. vertices
-	std::unordered_map<Vertex, std::vector<ExVertexStruct*>, VertexKeyHasher> VertexMap;
+		unsigned int ix[3] = {i0, i1, i2};
+		for(int e=0;e<3;e++)
+		{
+			PNAENEdge edge, reverse;
+			edge.iO = ix[e];
+			edge.iD = ix[(e + 1) % 3];
+			edge.pO = inVertices[edge.iO].Position;
+			edge.pD = inVertices[edge.iD].Position;
+			reverse = edge;
+			reverse.ReverseEdge();
+
+			EdgeReverseMap.emplace(edge, reverse);
+		}
+	}
 
-	for(unsigned int i = 0; i < inVertices.size(); i+=3)
+	for(unsigned int i=3;i<outIndices.size();i+=9)
 	{
-		for(int x=0;x<3;x++)
+		for (int k = 0; k < 6; k += 2)
 		{
-			// Put adj. vertices of this face together
-			VertexMap[Vertex(&inVertices[i+x])].push_back(&inVertices[i+x]);
+			int i0 = outIndices[i + k];
+			int i1 = outIndices[i + k + 1];
+			PNAENEdge temp;
+			temp.iO = i1;
+			temp.iD = i0;
+			temp.pO = inVertices[i1].Position;
+			temp.pD = inVertices[i0].Position;
+
+			auto foundIt = EdgeReverseMap.find(temp);
+			if (foundIt != EdgeReverseMap.end())
+			{
+				outIndices[i + k] = foundIt->second.iO;
+				outIndices[i + k + 1] = foundIt->second.iD;
+			}
 		}
 	}
+}
+
+/** ComputePNAEN18Indices as it was before PNAENEdgeTable and GroupByPosition, using unordered_maps of the edges and
+	of the vertices sharing a position */
+void MeshModifier::ComputePNAEN18IndicesReference(std::vector<ExVertexStruct>& inVertices, const std::vector<unsigned int>& inIndices, std::vector<unsigned int>& outIndices, bool detectBorders, bool softNormals)
+{
+	std::unordered_map<PNAENEdge,PNAENEdge,PNAENKeyHasher> EdgeReverseMap;
+
+	outIndices.resize(inIndices.size() * 3 * 2);
+
+	std::unordered_map<float3, std::pair<std::vector<unsigned int>, std::vector<ExVertexStruct*>>, Float3KeyHasher> VertexMap;
+
+	for(unsigned int i = 0; i < inIndices.size(); i++)
+	{
+		VertexMap[inVertices[inIndices[i]].Position].first.push_back(inIndices[i]);
+		VertexMap[inVertices[inIndices[i]].Position].second.push_back(&inVertices[inIndices[i]]);
+	}
 
-	// Run through all the adj. vertices and average the normals between them
+	unsigned int num = 0;
 	for(auto it = VertexMap.begin(); it != VertexMap.end(); it++)
 	{
-		std::vector<ExVertexStruct *>& vx = (*it).second;
-		// Average all face normals
-		D3DXVECTOR3 avgNormal = D3DXVECTOR3(0,0,0);
-		for(unsigned int i=0;i<vx.size();i++)
+		std::vector<ExVertexStruct *>& vx = (*it).second.second;
+
+		D3DXVECTOR3 nrm = D3DXVECTOR3(0,0,0);
+		if(softNormals)
 		{
-			avgNormal += *vx[i]->Normal.toD3DXVECTOR3();
+			for(unsigned int i=0;i<vx.size();i++)
+			{
+				nrm += *vx[i]->Normal.toD3DXVECTOR3();
+			}
+			nrm /= vx.size();
 		}
-		avgNormal /= (float)vx.size();
 
-		// Lerp between the average and the face normal for every vertex
 		for(unsigned int i=0;i<vx.size();i++)
 		{
-			// Find out if we are a corner/border vertex
-			vx[i]->TexCoord2.x = 1.0f;
-			for(unsigned int n=0;n<vx.size();n++)
-			{				
-				if(!TexcoordSame(vx[i]->TexCoord, vx[n]->TexCoord))
-				{
-					vx[i]->TexCoord2.x = 0.0f;
-					break;
-				}
+			if(detectBorders)
+			{
+				vx[i]->TexCoord2.x = 0.0f;
+				vx[i]->TexCoord2.y = num / 1000.0f;
+				num++;
 			}
+			if(softNormals)
+				vx[i]->Normal = nrm;
+		}
+	}
+
+	for(unsigned int i=0;i<inIndices.size();i+=3)
+	{
+		unsigned int i0 = inIndices[i + 0];
+		unsigned int i1 = inIndices[i + 1];
+		unsigned int i2 = inIndices[i + 2];
+
+		outIndices[i * 6 + 0] = i0;
+		outIndices[i * 6 + 1] = i1;
+		outIndices[i * 6 + 2] = i2;
+
+		outIndices[i * 6 + 3] = i0;
+		outIndices[i * 6 + 4] = i1;
+		outIndices[i * 6 + 5] = i1;
+		outIndices[i * 6 + 6] = i2;
+		outIndices[i * 6 + 7] = i2;
+		outIndices[i * 6 + 8] = i0;
 
-			vx[i]->Normal = avgNormal;
-			//D3DXVec3Lerp(vx[i]->Normal.toD3DXVECTOR3(), &avgNormal, vx[i]->Normal.toD3DXVECTOR3(), 0.7f);
+		outIndices[i * 6 + 9] = i0;
+		outIndices[i * 6 + 10] = i1;
+		outIndices[i * 6 + 11] = i1;
+		outIndices[i * 6 + 12] = i2;
+		outIndices[i * 6 + 13] = i2;
+		outIndices[i * 6 + 14] = i0;
+
+		outIndices[i * 6 + 15] = i0;
+		outIndices[i * 6 + 16] = i1;
+		outIndices[i * 6 + 17] = i2;
+
+		unsigned int ix[3] = {i0, i1, i2};
+		for(int e=0;e<3;e++)
+		{
+			PNAENEdge edge, reverse;
+			edge.iO = ix[e];
+			edge.iD = ix[(e + 1) % 3];
+			edge.pO = inVertices[edge.iO].Position;
+			edge.pD = inVertices[edge.iD].Position;
+			reverse = edge;
+			reverse.ReverseEdge();
+
+			EdgeReverseMap.emplace(edge, reverse);
 		}
 	}
+
+	for(unsigned int i=3;i<outIndices.size();i+=18)
+	{
+		for (int k = 0; k < 6; k += 2)
+		{
+			int i0 = outIndices[i + k];
+			int i1 = outIndices[i + k + 1];
+			PNAENEdge temp;
+			temp.iO = i1;
+			temp.iD = i0;
+			temp.pO = inVertices[i1].Position;
+			temp.pD = inVertices[i0].Position;
+
+			PNAENEdge domEdge;
+			domEdge.iO = 0;
+			domEdge.iD = 0;
+
+			auto foundIt = EdgeReverseMap.find(temp);
+			if (foundIt != EdgeReverseMap.end())
+			{
+				const PNAENEdge& second = foundIt->second;
+				outIndices[i + k] = second.iO;
+				outIndices[i + k + 1] = second.iD;
+
+				domEdge = second;
+			}else
+			{
+				temp.ReverseEdge();
+				foundIt = EdgeReverseMap.find(temp);
+				if (foundIt != EdgeReverseMap.end()) 
+				{
+					domEdge = foundIt->second;
+					domEdge.ReverseEdge();
+				}
+			}
+
+			if(!(temp < domEdge) && !(domEdge < temp))
+			{
+				inVertices[i0].TexCoord2.x = 1.0f;
+				inVertices[i1].TexCoord2.x = 1.0f;
+			}
+
+			if(detectBorders)
+			{
+				outIndices[i + 6 + k] = i0;
+				outIndices[i + 6 + k + 1] = i1;
+
+				if(domEdge.iO != 0 && domEdge.iD != 0 && domEdge < temp)
+				{
+					outIndices[i + 6 + k] = domEdge.iO;
+					outIndices[i + 6 + k + 1] = domEdge.iD;
+				}
+			}
+		}
+
+		if(detectBorders)
+		{
+			for(int k=0;k<3;k++)
+			{
+				float3 v = inVertices[outIndices[(i - 3) + k]].Position;
+				std::pair<std::vector<unsigned int>, std::vector<ExVertexStruct*>>& adj = VertexMap[v];
+
+				float2 smallest = float2(FLT_MAX, FLT_MAX);
+				int smallestIdx = outIndices[(i - 3) + k];
+				bool isBorder = false;
+				for(unsigned int j=0;j<adj.first.size();j++)
+				{
+					if(adj.second[j]->TexCoord < smallest)
+					{
+						smallest = adj.second[j]->TexCoord;
+						smallestIdx = adj.first[j];
+					}
+
+					if(adj.second[j]->TexCoord2.x == 1.0f)
+						isBorder = true;
+				}
+
+				if(isBorder)
+				{
+					for(unsigned int j=0;j<adj.first.size();j++)
+					{
+						adj.second[j]->TexCoord2.x = 1.0f;
+					}
+				}
+
+				outIndices[(i - 3) + 15 + k] = smallestIdx;
+			}
+		}
+	}
+}
+
+bool TexcoordSame(float2 a, float2 b)
+{
+	if(( abs(a.x - 		b.x) > 0.001f &&
+		abs((a.x + 1) - b.x) > 0.001f &&
+		abs((a.x - 1) - b.x) > 0.001f) ||
+		(abs(a.y - 		b.y) > 0.001f &&
+		abs((a.y + 1) - b.y) > 0.001f &&
+		abs((a.y - 1) - b.y) > 0.001f))
+		return false;
+		
+	return true;
+};
+
+/** Number of position-groups one job of ComputeSmoothNormals works on */
+const unsigned int SMOOTH_NORMALS_GROUPS_PER_JOB = 4096;
+
+/** Averages the normals and sets the border-flags of the given groups */
+static void SmoothVertexGroups(std::vector<ExVertexStruct>& vertices, const std::vector<unsigned int>& groupStart, const std::vector<unsigned int>& groupVertices, unsigned int firstGroup, unsigned int lastGroup)
+{
+	std::vector<float2> texcoords;
+	std::vector<unsigned int> texcoordOf;
+	std::vector<bool> texcoordSameAsAll;
+
+	for(unsigned int g=firstGroup;g<lastGroup;g++)
+	{
+		const unsigned int* vx = &groupVertices[groupStart[g]];
+		unsigned int num = groupStart[g + 1] - groupStart[g];
+
+		// Average all face normals, summed up in the order of the vertices
+		D3DXVECTOR3 avgNormal = D3DXVECTOR3(0,0,0);
+		for(unsigned int i=0;i<num;i++)
+		{
+			avgNormal += *vertices[vx[i]].Normal.toD3DXVECTOR3();
+		}
+		avgNormal /= (float)num;
+
+		// A vertex is a border vertex if its texcoord is the same as all others. Only depends on the texcoord,
+		// so compare the distinct ones against each other. There are only a few of them per position.
+		texcoords.clear();
+		texcoordOf.resize(num);
+		for(unsigned int i=0;i<num;i++)
+		{
+			const float2& tx = vertices[vx[i]].TexCoord;
+			unsigned int t = 0;
+			while(t < texcoords.size() && memcmp(&texcoords[t], &tx, sizeof(float2)) != 0)
+				t++;
+
+			if(t == texcoords.size())
+				texcoords.push_back(tx);
+
+			texcoordOf[i] = t;
+		}
+
+		texcoordSameAsAll.assign(texcoords.size(), true);
+		for(unsigned int t=0;t<texcoords.size();t++)
+		{
+			for(unsigned int n=0;n<texcoords.size();n++)
+			{
+				if(!TexcoordSame(texcoords[t], texcoords[n]))
+				{
+					texcoordSameAsAll[t] = false;
+					break;
+				}
+			}
+		}
+
+		for(unsigned int i=0;i<num;i++)
+		{
+			ExVertexStruct& v = vertices[vx[i]];
+			v.TexCoord2.x = texcoordSameAsAll[texcoordOf[i]] ? 1.0f : 0.0f;
+			v.Normal = avgNormal;
+		}
+	}
+}
+
+/** Computes smooth normals for the given mesh */
+void MeshModifier::ComputeSmoothNormals(std::vector<ExVertexStruct>& inVertices)
+{
+	if(inVertices.empty())
+		return;
+
+	// Put adj. vertices together
+	std::vector<unsigned int> groupStart;
+	std::vector<unsigned int> groupVertices;
+	std::vector<unsigned int> groupOf;
+	GroupByPosition(inVertices, NULL, inVertices.size(), groupOf, groupStart, groupVertices);
+
+	// Groups don't share vertices, so they can be worked on in parallel
+	unsigned int numGroups = groupStart.size() - 1;
+	unsigned int numJobs = (numGroups + SMOOTH_NORMALS_GROUPS_PER_JOB - 1) / SMOOTH_NORMALS_GROUPS_PER_JOB;
+	auto smoothJob = [&](unsigned int job)
+	{
+		unsigned int first = job * SMOOTH_NORMALS_GROUPS_PER_JOB;
+		SmoothVertexGroups(inVertices, groupStart, groupVertices, first, std::min(first + SMOOTH_NORMALS_GROUPS_PER_JOB, numGroups));
+	};
+
+	if(Engine::WorkerThreadPool)
+	{
+		Engine::WorkerThreadPool->parallel_for(0, numJobs, 1, smoothJob);
+	}else
+	{
+		for(unsigned int i=0;i<numJobs;i++)
+			smoothJob(i);
+	}
+}
+
+/** Returns the unnormalized face-normal of the given triangle */
+static D3DXVECTOR3 DecimateFaceNormal(const float3& p0, const float3& p1, const float3& p2)
+{
+	D3DXVECTOR3 e1 = *p1.toD3DXVECTOR3() - *p0.toD3DXVECTOR3();
+	D3DXVECTOR3 e2 = *p2.toD3DXVECTOR3() - *p0.toD3DXVECTOR3();
+
+	D3DXVECTOR3 n;
+	D3DXVec3Cross(&n, &e1, &e2);
+	return n;
+}
+
+/** Quadric error metric of a position. Symmetric 4x4-matrix, only the upper triangle is stored. */
+struct DecimateQuadric
+{
+	DecimateQuadric()
+	{
+		memset(a, 0, sizeof(a));
+	}
+
+	/** Adds the squared distance to the given plane */
+	void AddPlane(double nx, double ny, double nz, double d)
+	{
+		a[0] += nx * nx; a[1] += nx * ny; a[2] += nx * nz; a[3] += nx * d;
+		a[4] += ny * ny; a[5] += ny * nz; a[6] += ny * d;
+		a[7] += nz * nz; a[8] += nz * d;
+		a[9] += d * d;
+	}
+
+	void Add(const DecimateQuadric& q)
+	{
+		for(int i=0;i<10;i++)
+			a[i] += q.a[i];
+	}
+
+	/** Returns the summed squared distance of the point to all planes */
+	double Evaluate(const float3& p) const
+	{
+		double x = p.x, y = p.y, z = p.z;
+		return x * x * a[0] + 2 * x * y * a[1] + 2 * x * z * a[2] + 2 * x * a[3]
+			+ y * y * a[4] + 2 * y * z * a[5] + 2 * y * a[6]
+			+ z * z * a[7] + 2 * z * a[8]
+			+ a[9];
+	}
+
+	double a[10];
+};
+
+/** Collapse of one position into a neighbour */
+struct DecimateCollapse
+{
+	double Cost;
+	unsigned int From;
+	unsigned int To;
+	unsigned int Version; // Version of From this was computed for
+
+	bool operator > (const DecimateCollapse& o) const
+	{
+		return Cost > o.Cost;
+	}
+};
+
+/** Mesh while it is being decimated. Collapses move one position onto a neighbouring one, so no new vertices are
+	made and all attributes stay as they were. */
+class MeshDecimator
+{
+public:
+	MeshDecimator(const std::vector<ExVertexStruct>& vertices, const std::vector<VERTEX_INDEX>& indices) : Vertices(vertices)
+	{
+		// Vertices on the same position are collapsed together
+		std::vector<unsigned int> groupStart;
+		std::vector<unsigned int> groupItems;
+		GroupByPosition(vertices, NULL, vertices.size(), PosOf, groupStart, groupItems);
+
+		unsigned int numPos = groupStart.size() - 1;
+		Positions.resize(numPos);
+		Quadrics.resize(numPos);
+		PosTris.resize(numPos);
+		PosAlive.assign(numPos, true);
+		Locked.assign(numPos, false);
+		Versions.assign(numPos, 0);
+
+		for(unsigned int p=0;p<numPos;p++)
+		{
+			Positions[p] = vertices[groupItems[groupStart[p]]].Position;
+
+			// Vertices with different attributes on the same position make a seam. Keep it where it is.
+			for(unsigned int i=groupStart[p] + 1;i<groupStart[p + 1];i++)
+			{
+				if(memcmp(&vertices[groupItems[i]], &vertices[groupItems[groupStart[p]]], sizeof(ExVertexStruct)) != 0)
+					Locked[p] = true;
+			}
+		}
+
+		Tris.assign(indices.begin(), indices.end());
+		TriAlive.assign(Tris.size() / 3, true);
+		NumAliveTris = 0;
+
+		for(unsigned int t=0;t<TriAlive.size();t++)
+		{
+			unsigned int p0 = PosOf[Tris[t * 3 + 0]];
+			unsigned int p1 = PosOf[Tris[t * 3 + 1]];
+			unsigned int p2 = PosOf[Tris[t * 3 + 2]];
+			if(p0 == p1 || p1 == p2 || p0 == p2)
+			{
+				TriAlive[t] = false;
+				continue;
+			}
+
+			NumAliveTris++;
+			PosTris[p0].push_back(t);
+			PosTris[p1].push_back(t);
+			PosTris[p2].push_back(t);
+
+			// Plane of the triangle goes into the quadrics of its corners
+			D3DXVECTOR3 nrm = DecimateFaceNormal(Positions[p0], Positions[p1], Positions[p2]);
+			if(D3DXVec3Length(&nrm) <= 0.0f)
+				continue;
+
+			D3DXVec3Normalize(&nrm, &nrm);
+			double d = -D3DXVec3Dot(&nrm, Positions[p0].toD3DXVECTOR3());
+			Quadrics[p0].AddPlane(nrm.x, nrm.y, nrm.z, d);
+			Quadrics[p1].AddPlane(nrm.x, nrm.y, nrm.z, d);
+			Quadrics[p2].AddPlane(nrm.x, nrm.y, nrm.z, d);
+		}
+
+		LockBorders();
+	}
+
+	/** Collapses positions until only targetTriangles are left, or the next collapse would cost more than maxError */
+	void Run(unsigned int targetTriangles, float maxError)
+	{
+		double maxCost = (double)maxError * maxError;
+
+		for(unsigned int p=0;p<Positions.size();p++)
+			PushCollapses(p);
+
+		while(NumAliveTris > targetTriangles && !Queue.empty())
+		{
+			DecimateCollapse c = Queue.top();
+			Queue.pop();
+
+			if(!PosAlive[c.From] || !PosAlive[c.To] || Versions[c.From] != c.Version)
+				continue; // Outdated
+
+			if(c.Cost > maxCost)
+				break;
+
+			// The other candidates of this position are still queued
+			unsigned int toVertex;
+			if(!CanCollapse(c.From, c.To, toVertex))
+				continue;
+
+			Collapse(c.From, c.To, toVertex);
+
+			// The neighbourhood of everything around the target changed
+			std::vector<unsigned int> ring;
+			GetRing(c.To, ring);
+			ring.push_back(c.To);
+			for(unsigned int i=0;i<ring.size();i++)
+			{
+				Versions[ring[i]]++;
+				PushCollapses(ring[i]);
+			}
+		}
+	}
+
+	/** Writes the remaining triangles. Vertices keep their order, unused ones are dropped. */
+	void GetResult(std::vector<ExVertexStruct>& outVertices, std::vector<VERTEX_INDEX>& outIndices)
+	{
+		std::vector<unsigned int> remap(Vertices.size(), 0xFFFFFFFF);
+		for(unsigned int t=0;t<TriAlive.size();t++)
+		{
+			if(!TriAlive[t])
+				continue;
+
+			for(int k=0;k<3;k++)
+				remap[Tris[t * 3 + k]] = 0;
+		}
+
+		outVertices.clear();
+		for(unsigned int i=0;i<Vertices.size();i++)
+		{
+			if(remap[i] == 0xFFFFFFFF)
+				continue;
+
+			remap[i] = outVertices.size();
+			outVertices.push_back(Vertices[i]);
+		}
+
+		outIndices.clear();
+		for(unsigned int t=0;t<TriAlive.size();t++)
+		{
+			if(!TriAlive[t])
+				continue;
+
+			for(int k=0;k<3;k++)
+				outIndices.push_back(remap[Tris[t * 3 + k]]);
+		}
+	}
+
+private:
+	/** Locks positions on edges which don't have exactly two triangles */
+	void LockBorders()
+	{
+		std::vector<unsigned int> others;
+		for(unsigned int p=0;p<Positions.size();p++)
+		{
+			others.clear();
+			for(unsigned int i=0;i<PosTris[p].size();i++)
+			{
+				unsigned int t = PosTris[p][i];
+				for(int k=0;k<3;k++)
+				{
+					if(PosOf[Tris[t * 3 + k]] != p)
+						others.push_back(PosOf[Tris[t * 3 + k]]);
+				}
+			}
+
+			// Every edge shows up once per triangle it is in
+			std::sort(others.begin(), others.end());
+			for(unsigned int i=0;i<others.size();)
+			{
+				unsigned int n = 1;
+				while(i + n < others.size() && others[i + n] == others[i])
+					n++;
+
+				if(n != 2)
+				{
+					Locked[p] = true;
+					Locked[others[i]] = true;
+				}
+
+				i += n;
+			}
+		}
+	}
+
+	/** Returns the positions sharing a triangle with p */
+	void GetRing(unsigned int p, std::vector<unsigned int>& ring)
+	{
+		ring.clear();
+		for(unsigned int i=0;i<PosTris[p].size();i++)
+		{
+			unsigned int t = PosTris[p][i];
+			if(!TriAlive[t])
+				continue;
+
+			for(int k=0;k<3;k++)
+			{
+				unsigned int o = PosOf[Tris[t * 3 + k]];
+				if(o != p)
+					ring.push_back(o);
+			}
+		}
+
+		std::sort(ring.begin(), ring.end());
+		ring.erase(std::unique(ring.begin(), ring.end()), ring.end());
+	}
+
+	/** Checks if from can be moved onto to without breaking the mesh. Returns the vertex of to the triangles of from
+		have to use then. */
+	bool CanCollapse(unsigned int from, unsigned int to, unsigned int& outToVertex)
+	{
+		if(Locked[from])
+			return false;
+
+		// All triangles on the edge must use the same vertex of the target, else there is a seam going through it
+		outToVertex = 0xFFFFFFFF;
+		std::vector<unsigned int>& tris = PosTris[from];
+		std::vector<unsigned int> opposite;
+		for(unsigned int i=0;i<tris.size();i++)
+		{
+			unsigned int t = tris[i];
+			if(!TriAlive[t])
+				continue;
+
+			int toCorner = -1;
+			for(int k=0;k<3;k++)
+			{
+				if(PosOf[Tris[t * 3 + k]] == to)
+					toCorner = k;
+			}
+
+			if(toCorner < 0)
+			{
+				// Triangle stays, must not flip
+				float3 p[3];
+				float3 moved[3];
+				for(int k=0;k<3;k++)
+				{
+					unsigned int pk = PosOf[Tris[t * 3 + k]];
+					p[k] = Positions[pk];
+					moved[k] = pk == from ? Positions[to] : Positions[pk];
+				}
+
+				D3DXVECTOR3 n0 = DecimateFaceNormal(p[0], p[1], p[2]);
+				D3DXVECTOR3 n1 = DecimateFaceNormal(moved[0], moved[1], moved[2]);
+				if(D3DXVec3Dot(&n0, &n1) <= 0.0f)
+					return false;
+
+				continue;
+			}
+
+			unsigned int v = Tris[t * 3 + toCorner];
+			if(outToVertex != 0xFFFFFFFF && outToVertex != v)
+				return false;
+
+			outToVertex = v;
+
+			for(int k=0;k<3;k++)
+			{
+				unsigned int pk = PosOf[Tris[t * 3 + k]];
+				if(pk != from && pk != to)
+					opposite.push_back(pk);
+			}
+		}
+
+		if(outToVertex == 0xFFFFFFFF)
+			return false; // Not connected
+
+		// Link condition: the only shared neighbours may be the ones of the triangles on the edge
+		std::vector<unsigned int> ringFrom, ringTo;
+		GetRing(from, ringFrom);
+		GetRing(to, ringTo);
+
+		std::sort(opposite.begin(), opposite.end());
+		opposite.erase(std::unique(opposite.begin(), opposite.end()), opposite.end());
+
+		std::vector<unsigned int> shared;
+		std::set_intersection(ringFrom.begin(), ringFrom.end(), ringTo.begin(), ringTo.end(), std::back_inserter(shared));
+		return shared == opposite;
+	}
+
+	/** Moves from onto to */
+	void Collapse(unsigned int from, unsigned int to, unsigned int toVertex)
+	{
+		std::vector<unsigned int>& tris = PosTris[from];
+		for(unsigned int i=0;i<tris.size();i++)
+		{
+			unsigned int t = tris[i];
+			if(!TriAlive[t])
+				continue;
+
+			bool onEdge = false;
+			for(int k=0;k<3;k++)
+			{
+				if(PosOf[Tris[t * 3 + k]] == to)
+					onEdge = true;
+			}
+
+			if(onEdge)
+			{
+				TriAlive[t] = false;
+				NumAliveTris--;
+				continue;
+			}
+
+			for(int k=0;k<3;k++)
+			{
+				if(PosOf[Tris[t * 3 + k]] == from)
+					Tris[t * 3 + k] = toVertex;
+			}
+
+			PosTris[to].push_back(t);
+		}
+
+		// Throw out the dead triangles of the target while we're at it
+		std::vector<unsigned int>& toTris = PosTris[to];
+		unsigned int n = 0;
+		for(unsigned int i=0;i<toTris.size();i++)
+		{
+			if(TriAlive[toTris[i]])
+				toTris[n++] = toTris[i];
+		}
+		toTris.resize(n);
+
+		Quadrics[to].Add(Quadrics[from]);
+		PosAlive[from] = false;
+		tris.clear();
+	}
+
+	/** Queues the collapses of p into each of its neighbours. Whether they are possible is checked once they come up. */
+	void PushCollapses(unsigned int p)
+	{
+		if(!PosAlive[p] || Locked[p])
+			return;
+
+		std::vector<unsigned int> ring;
+		GetRing(p, ring);
+
+		for(unsigned int i=0;i<ring.size();i++)
+		{
+			DecimateQuadric q = Quadrics[p];
+			q.Add(Quadrics[ring[i]]);
+
+			DecimateCollapse c;
+			c.Cost = q.Evaluate(Positions[ring[i]]);
+			c.From = p;
+			c.To = ring[i];
+			c.Version = Versions[p];
+			Queue.push(c);
+		}
+	}
+
+	const std::vector<ExVertexStruct>& Vertices;
+	std::vector<unsigned int> PosOf;
+	std::vector<float3> Positions;
+	std::vector<DecimateQuadric> Quadrics;
+	std::vector<std::vector<unsigned int>> PosTris;
+	std::vector<bool> PosAlive;
+	std::vector<bool> Locked;
+	std::vector<unsigned int> Versions;
+
+	std::vector<unsigned int> Tris;
+	std::vector<bool> TriAlive;
+	unsigned int NumAliveTris;
+
+	std::priority_queue<DecimateCollapse, std::vector<DecimateCollapse>, std::greater<DecimateCollapse>> Queue;
+};
+
+/** Decimates the mesh down to about the given number of triangles */
+void MeshModifier::Decimate(const std::vector<ExVertexStruct>& inVertices, const std::vector<VERTEX_INDEX>& inIndices, unsigned int targetTriangles, float maxError, std::vector<ExVertexStruct>& outVertices, std::vector<VERTEX_INDEX>& outIndices)
+{
+	if(inVertices.empty() || inIndices.size() < 3)
+	{
+		outVertices = inVertices;
+		outIndices = inIndices;
+		return;
+	}
+
+	MeshDecimator decimator(inVertices, inIndices);
+	decimator.Run(targetTriangles, maxError);
+	decimator.GetResult(outVertices, outIndices);
 }
 
 /** Fills an index array for a non-indexed mesh */
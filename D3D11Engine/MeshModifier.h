@@ -17,8 +17,9 @@ public:
 	/** Drops texcoords on the given mesh, making it crackless */
 	static void DropTexcoords(const std::vector<ExVertexStruct>& inVertices, const std::vector<unsigned short>& inIndices, std::vector<ExVertexStruct>& outVertices, std::vector<VERTEX_INDEX>& outIndices);
 
-	/** Decimates the mesh, reducing its complexity */
-	static void Decimate(const std::vector<ExVertexStruct>& inVertices, const std::vector<unsigned short>& inIndices, std::vector<ExVertexStruct>& outVertices, std::vector<VERTEX_INDEX>& outIndices);
+	/** Decimates the mesh down to about the given number of triangles, using quadric error metrics. Positions on borders
+		and seams stay where they are. Stops early once a collapse would move the surface by more than maxError. */
+	static void Decimate(const std::vector<ExVertexStruct>& inVertices, const std::vector<VERTEX_INDEX>& inIndices, unsigned int targetTriangles, float maxError, std::vector<ExVertexStruct>& outVertices, std::vector<VERTEX_INDEX>& outIndices);
 
 	/** Computes PNAEN-Indices for the given mesh */
 	static void ComputePNAENIndices(const std::vector<ExVertexStruct>& inVertices, const std::vector<unsigned short>& inIndices, std::vector<VERTEX_INDEX>& outIndices);
@@ -27,6 +28,11 @@ public:
 	static void ComputePNAEN18Indices(std::vector<ExVertexStruct>& inVertices, const std::vector<unsigned short>& inIndices, std::vector<VERTEX_INDEX>& outIndices, bool detectBorders = true, bool softNormals = false);
 	static void ComputePNAEN18Indices(std::vector<ExVertexStruct>& inVertices, const std::vector<unsigned int>& inIndices, std::vector<unsigned int>& outIndices, bool detectBorders = true, bool softNormals = false);
 
+	/** The unordered_map-based versions of the above, which hash positions and compare them with a tolerance.
+		Only kept for WorldConverter::BenchmarkPNAEN to compare against. */
+	static void ComputePNAENIndicesReference(const std::vector<ExVertexStruct>& inVertices, const std::vector<unsigned int>& inIndices, std::vector<unsigned int>& outIndices);
+	static void ComputePNAEN18IndicesReference(std::vector<ExVertexStruct>& inVertices, const std::vector<unsigned int>& inIndices, std::vector<unsigned int>& outIndices, bool detectBorders = true, bool softNormals = false);
+
 	/** Fills an index array for a non-indexed mesh */
 	static void FillIndexArrayFor(unsigned int numVertices, std::vector<VERTEX_INDEX>& outIndices);
 	static void FillIndexArrayFor(unsigned int numVertices, std::vector<unsigned int>& outIndices);
@@ -0,0 +1,398 @@
+#include "pch.h"
+#include "ParticleFrameBuilder.h"
+#include "Engine.h"
+#include "GothicAPI.h"
+#include "BaseGraphicsEngine.h"
+#include "D3D11VertexBuffer.h"
+#include "zCParticleFX.h"
+#include <emmintrin.h>
+
+ParticleFrameBuilder::ParticleFrameBuilder()
+{
+	InstanceBuffer = NULL;
+	InstanceCapacity = 0;
+	EmitterOpen = false;
+	FrameStart.QuadPart = 0;
+}
+
+ParticleFrameBuilder::~ParticleFrameBuilder()
+{
+	delete InstanceBuffer;
+}
+
+/** Forgets the particles of the last frame */
+void ParticleFrameBuilder::BeginFrame()
+{
+	QueryPerformanceCounter(&FrameStart);
+
+	PositionX.clear(); PositionY.clear(); PositionZ.clear();
+	VelocityX.clear(); VelocityY.clear(); VelocityZ.clear();
+	ColorR.clear(); ColorG.clear(); ColorB.clear();
+	Alpha.clear();
+	SizeX.clear(); SizeY.clear();
+
+	Emitters.clear();
+	DrawRanges.clear();
+	RangeOfTexture.clear();
+	InstanceCopy.clear();
+	EmitterOpen = false;
+}
+
+/** Starts a new emitter */
+void ParticleFrameBuilder::BeginEmitter(zCTexture* texture, const ParticleRenderInfo& info, const ParticleEmitterInfo& emitter)
+{
+	EndEmitter();
+
+	EmitterRun run;
+	run.Texture = texture;
+	run.RenderInfo = info;
+	run.Info = emitter;
+	run.First = PositionX.size();
+	run.Count = 0;
+	run.Range = 0;
+	run.Output = 0;
+	Emitters.push_back(run);
+
+	EmitterOpen = true;
+}
+
+/** Ends the current emitter-run and adds its particles to the range of its texture */
+void ParticleFrameBuilder::EndEmitter()
+{
+	if(!EmitterOpen)
+		return;
+
+	EmitterOpen = false;
+
+	EmitterRun& run = Emitters.back();
+	run.Count = PositionX.size() - run.First;
+
+	if(!run.Count)
+	{
+		Emitters.pop_back();
+		return;
+	}
+
+	// Emitters sharing a texture are drawn together
+	auto it = RangeOfTexture.find(run.Texture);
+	if(it == RangeOfTexture.end())
+	{
+		ParticleDrawRange r;
+		r.Texture = run.Texture;
+		r.First = 0;
+		r.Count = 0;
+		DrawRanges.push_back(r);
+
+		run.Range = DrawRanges.size() - 1;
+		RangeOfTexture[run.Texture] = run.Range;
+	}else
+	{
+		run.Range = (*it).second;
+	}
+
+	// The last emitter of a texture decides how it's blended
+	DrawRanges[run.Range].Info = run.RenderInfo;
+	DrawRanges[run.Range].Count += run.Count;
+}
+
+/** Sorts additive ranges before blended ones and puts them after each other. newIndex maps the old indices to the new ones. */
+static void SortDrawRanges(std::vector<ParticleDrawRange>& ranges, std::vector<unsigned int>& newIndex)
+{
+	std::vector<unsigned int> order(ranges.size());
+	for(unsigned int i=0;i<order.size();i++)
+		order[i] = i;
+
+	// Additive first, so the distortion-pass can be done before the usual rendering
+	std::stable_sort(order.begin(), order.end(), [&ranges](unsigned int a, unsigned int b)
+	{
+		return ranges[a].Info.BlendMode > ranges[b].Info.BlendMode;
+	});
+
+	std::vector<ParticleDrawRange> sorted(ranges.size());
+	newIndex.resize(ranges.size());
+
+	unsigned int first = 0;
+	for(unsigned int i=0;i<order.size();i++)
+	{
+		sorted[i] = ranges[order[i]];
+		sorted[i].First = first;
+		first += sorted[i].Count;
+
+		newIndex[order[i]] = i;
+	}
+
+	ranges.swap(sorted);
+}
+
+/** Orders the ranges and gives every emitter its place in the instance-buffer */
+void ParticleFrameBuilder::AssignOutputs()
+{
+	std::vector<unsigned int> newIndex;
+	SortDrawRanges(DrawRanges, newIndex);
+
+	// Emitters of a range follow each other in the order they were gathered
+	std::vector<unsigned int> cursor(DrawRanges.size(), 0);
+	for(unsigned int i=0;i<Emitters.size();i++)
+	{
+		EmitterRun& run = Emitters[i];
+		run.Range = newIndex[run.Range];
+		run.Output = DrawRanges[run.Range].First + cursor[run.Range];
+		cursor[run.Range] += run.Count;
+	}
+
+	RangeOfTexture.clear();
+}
+
+/** Alpha of a particle of an emitter with SmoothAlpha set */
+static float GetSmoothAlpha(const ParticleEmitterInfo& info, float alpha)
+{
+	float a = std::min((zCParticleFX::SinSmooth(fabs((alpha - info.AlphaStart) * info.AlphaDist)) * alpha) / 255.0f, 255.0f);
+	return std::max(a, 0.0f);
+}
+
+/** Fills a single instance. Goes through the members in order, since the output may be write-combined memory. */
+static inline void WriteInstance(ParticleInstanceInfo* out, float px, float py, float pz, float r, float g, float b, float a, float sx, float sy, int drawMode, float vx, float vy, float vz)
+{
+	out->position.x = px;
+	out->position.y = py;
+	out->position.z = pz;
+	out->color.x = r;
+	out->color.y = g;
+	out->color.z = b;
+	out->color.w = a;
+	out->scale.x = sx;
+	out->scale.y = sy;
+	out->drawMode = drawMode;
+	out->velocity.x = vx;
+	out->velocity.y = vy;
+	out->velocity.z = vz;
+}
+
+/** Evaluates the given emitters into the output */
+void ParticleFrameBuilder::EvaluateEmitters(unsigned int first, unsigned int last, ParticleInstanceInfo* output)
+{
+	const __m128 inv255 = _mm_set1_ps(1.0f / 255.0f);
+	const __m128 max255 = _mm_set1_ps(255.0f);
+	const __m128 zero = _mm_setzero_ps();
+
+	_MM_ALIGN16 float r[4], g[4], b[4], a[4], sx[4], sy[4];
+
+	for(unsigned int e=first;e<last;e++)
+	{
+		const EmitterRun& run = Emitters[e];
+		const ParticleEmitterInfo& info = run.Info;
+		ParticleInstanceInfo* out = output + run.Output;
+
+		const __m128 scale = _mm_set1_ps(info.ScaleFactor);
+
+		// Color, alpha and size of 4 particles at a time
+		unsigned int i = 0;
+		for(;i + 4 <= run.Count;i+=4)
+		{
+			unsigned int p = run.First + i;
+
+			_mm_store_ps(r, _mm_mul_ps(_mm_loadu_ps(&ColorR[p]), inv255));
+			_mm_store_ps(g, _mm_mul_ps(_mm_loadu_ps(&ColorG[p]), inv255));
+			_mm_store_ps(b, _mm_mul_ps(_mm_loadu_ps(&ColorB[p]), inv255));
+			_mm_store_ps(sx, _mm_mul_ps(_mm_loadu_ps(&SizeX[p]), scale));
+			_mm_store_ps(sy, _mm_mul_ps(_mm_loadu_ps(&SizeY[p]), scale));
+
+			if(!info.SmoothAlpha)
+			{
+				_mm_store_ps(a, _mm_max_ps(_mm_mul_ps(_mm_min_ps(_mm_loadu_ps(&Alpha[p]), max255), inv255), zero));
+			}else
+			{
+				for(int j=0;j<4;j++)
+					a[j] = GetSmoothAlpha(info, Alpha[p + j]);
+			}
+
+			for(int j=0;j<4;j++)
+			{
+				WriteInstance(&out[i + j], PositionX[p + j], PositionY[p + j], PositionZ[p + j], r[j], g[j], b[j], a[j], sx[j], sy[j], info.DrawMode,
+					VelocityX[p + j], VelocityY[p + j], VelocityZ[p + j]);
+			}
+		}
+
+		// Rest of the emitter
+		for(;i<run.Count;i++)
+		{
+			unsigned int p = run.First + i;
+
+			float alpha = info.SmoothAlpha ? GetSmoothAlpha(info, Alpha[p]) : std::max(std::min(Alpha[p], 255.0f) / 255.0f, 0.0f);
+
+			WriteInstance(&out[i], PositionX[p], PositionY[p], PositionZ[p], ColorR[p] / 255.0f, ColorG[p] / 255.0f, ColorB[p] / 255.0f, alpha,
+				SizeX[p] * info.ScaleFactor, SizeY[p] * info.ScaleFactor, info.DrawMode, VelocityX[p], VelocityY[p], VelocityZ[p]);
+		}
+	}
+}
+
+/** Assigns the draw-ranges and evaluates all gathered particles into the instance-buffer */
+XRESULT ParticleFrameBuilder::Build(bool keepCopy)
+{
+	EndEmitter();
+	AssignOutputs();
+
+	unsigned int numParticles = PositionX.size();
+	XRESULT xr = XR_SUCCESS;
+
+	if(numParticles)
+	{
+		ParticleInstanceInfo* output = NULL;
+		if(keepCopy)
+		{
+			InstanceCopy.resize(numParticles);
+			output = &InstanceCopy[0];
+		}else
+		{
+			// Let the workers write straight into the buffer the GPU reads from
+			void* data = NULL;
+			UINT size;
+			if(XR_SUCCESS != EnsureCapacity(numParticles) ||
+				XR_SUCCESS != InstanceBuffer->Map(D3D11VertexBuffer::M_WRITE_DISCARD, &data, &size))
+			{
+				DrawRanges.clear();
+				return XR_FAILED;
+			}
+
+			output = (ParticleInstanceInfo *)data;
+		}
+
+		if(Engine::WorkerThreadPool)
+		{
+			// Hand out runs of whole emitters, so every job has about the same amount of work
+			unsigned int first = 0;
+			unsigned int num = 0;
+			for(unsigned int e=0;e<Emitters.size();e++)
+			{
+				num += Emitters[e].Count;
+				if(num < PARTICLE_JOB_SIZE && e + 1 < Emitters.size())
+					continue;
+
+				unsigned int last = e + 1;
+				Engine::WorkerThreadPool->run(EvaluateJobs, [this, first, last, output]()
+				{
+					EvaluateEmitters(first, last, output);
+				});
+
+				first = last;
+				num = 0;
+			}
+
+			Engine::WorkerThreadPool->wait(EvaluateJobs);
+		}else
+		{
+			EvaluateEmitters(0, Emitters.size(), output);
+		}
+
+		if(keepCopy)
+		{
+			xr = EnsureCapacity(numParticles);
+			if(xr == XR_SUCCESS)
+				xr = InstanceBuffer->UpdateBuffer(&InstanceCopy[0], numParticles * sizeof(ParticleInstanceInfo));
+		}else
+		{
+			InstanceBuffer->Unmap();
+		}
+
+		if(xr != XR_SUCCESS)
+			DrawRanges.clear();
+	}
+
+	LARGE_INTEGER end, frequency;
+	QueryPerformanceCounter(&end);
+	QueryPerformanceFrequency(&frequency);
+	float ms = (float)((double)(end.QuadPart - FrameStart.QuadPart) * 1000.0 / (double)frequency.QuadPart);
+
+	GothicRendererInfo& rinfo = Engine::GAPI->GetRendererState()->RendererInfo;
+	rinfo.FrameParticles = numParticles;
+	rinfo.FrameParticleBuildMS = ms;
+	rinfo.FrameParticlesPerMS = ms > 0.0f ? numParticles / ms : 0.0f;
+
+	return xr;
+}
+
+/** Puts already finished instances into the instance-buffer, for replaying captured particles */
+XRESULT ParticleFrameBuilder::BuildFromInstances(const std::map<zCTexture*, std::vector<ParticleInstanceInfo>>& particles, const std::map<zCTexture*, ParticleRenderInfo>& info)
+{
+	Emitters.clear();
+	DrawRanges.clear();
+	RangeOfTexture.clear();
+	EmitterOpen = false;
+
+	for(auto it = particles.begin(); it != particles.end(); it++)
+	{
+		auto inf = info.find((*it).first);
+		if((*it).second.empty() || inf == info.end())
+			continue;
+
+		ParticleDrawRange r;
+		r.Texture = (*it).first;
+		r.Info = (*inf).second;
+		r.First = 0;
+		r.Count = (*it).second.size();
+		DrawRanges.push_back(r);
+	}
+
+	std::vector<unsigned int> newIndex;
+	SortDrawRanges(DrawRanges, newIndex);
+
+	unsigned int numParticles = DrawRanges.empty() ? 0 : DrawRanges.back().First + DrawRanges.back().Count;
+	if(!numParticles)
+		return XR_SUCCESS;
+
+	InstanceCopy.resize(numParticles);
+	for(unsigned int i=0;i<DrawRanges.size();i++)
+	{
+		const std::vector<ParticleInstanceInfo>& instances = (*particles.find(DrawRanges[i].Texture)).second;
+		memcpy(&InstanceCopy[DrawRanges[i].First], &instances[0], instances.size() * sizeof(ParticleInstanceInfo));
+	}
+
+	XRESULT xr = EnsureCapacity(numParticles);
+	if(xr == XR_SUCCESS)
+		xr = InstanceBuffer->UpdateBuffer(&InstanceCopy[0], numParticles * sizeof(ParticleInstanceInfo));
+
+	if(xr != XR_SUCCESS)
+		DrawRanges.clear();
+
+	return xr;
+}
+
+/** Returns the instances of the last Build(true), grouped by texture */
+void ParticleFrameBuilder::GetInstancesByTexture(std::map<zCTexture*, std::vector<ParticleInstanceInfo>>& particles, std::map<zCTexture*, ParticleRenderInfo>& info)
+{
+	if(InstanceCopy.empty())
+		return;
+
+	for(unsigned int i=0;i<DrawRanges.size();i++)
+	{
+		const ParticleDrawRange& r = DrawRanges[i];
+		particles[r.Texture].assign(InstanceCopy.begin() + r.First, InstanceCopy.begin() + r.First + r.Count);
+		info[r.Texture] = r.Info;
+	}
+}
+
+/** Recreates the instance-buffer, big enough for the given number of particles */
+XRESULT ParticleFrameBuilder::EnsureCapacity(unsigned int numParticles)
+{
+	if(InstanceBuffer && InstanceCapacity >= numParticles)
+		return XR_SUCCESS;
+
+	InstanceCapacity = std::max(InstanceCapacity, PARTICLE_MIN_CAPACITY);
+	while(InstanceCapacity < numParticles)
+		InstanceCapacity *= 2;
+
+	LogInfo() << "Growing particle instance buffer to " << InstanceCapacity << " particles";
+
+	delete InstanceBuffer;
+	Engine::GraphicsEngine->CreateVertexBuffer(&InstanceBuffer);
+
+	XRESULT xr = InstanceBuffer->Init(NULL, InstanceCapacity * sizeof(ParticleInstanceInfo), D3D11VertexBuffer::B_VERTEXBUFFER, D3D11VertexBuffer::U_DYNAMIC, D3D11VertexBuffer::CA_WRITE, "ParticleFrameBuilder::InstanceBuffer");
+	if(xr != XR_SUCCESS)
+	{
+		delete InstanceBuffer;
+		InstanceBuffer = NULL;
+		InstanceCapacity = 0;
+	}
+
+	return xr;
+}
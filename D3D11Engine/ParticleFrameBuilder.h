@@ -0,0 +1,143 @@
+#pragma once
+#include "pch.h"
+#include "WorldObjects.h"
+#include "ThreadPool.h"
+
+class D3D11VertexBuffer;
+class zCTexture;
+
+/** Minimum number of particles the instance-buffer is created with. It grows by doubling from there. */
+const unsigned int PARTICLE_MIN_CAPACITY = 4096;
+
+/** Emitters are handed to the workers in chunks of at least this many particles */
+const unsigned int PARTICLE_JOB_SIZE = 2048;
+
+/** Particles of one texture inside the instance-buffer. Drawn with one call. */
+struct ParticleDrawRange
+{
+	zCTexture* Texture;
+	ParticleRenderInfo Info;
+	unsigned int First;
+	unsigned int Count;
+};
+
+/** How the particles of an emitter turn into instances */
+struct ParticleEmitterInfo
+{
+	ParticleEmitterInfo()
+	{
+		DrawMode = 0;
+		ScaleFactor = 1.0f;
+		SmoothAlpha = false;
+		AlphaStart = 0.0f;
+		AlphaDist = 0.0f;
+	}
+
+	int DrawMode; // See ParticleInstanceInfo
+	float ScaleFactor; // Size of the particle is multiplied with this
+	bool SmoothAlpha; // Alpha goes through zCParticleFX::SinSmooth, using AlphaStart and AlphaDist
+	float AlphaStart;
+	float AlphaDist;
+};
+
+/** Builds the particle-instances of a frame. The particles of all emitters are gathered into contiguous
+	structure-of-arrays, then the workers turn them into instances using SSE and write them straight into a single
+	mapped instance-buffer, grouped by texture. The engine then only has to draw one range per texture. */
+class ParticleFrameBuilder
+{
+public:
+	ParticleFrameBuilder();
+	~ParticleFrameBuilder();
+
+	/** Forgets the particles of the last frame */
+	void BeginFrame();
+
+	/** Starts a new emitter. The following AddParticle-calls belong to it. */
+	void BeginEmitter(zCTexture* texture, const ParticleRenderInfo& info, const ParticleEmitterInfo& emitter);
+
+	/** Adds a particle to the current emitter. Color and alpha are in the 0..255 range gothic uses. */
+	void AddParticle(const D3DXVECTOR3& position, const D3DXVECTOR3& velocity, const D3DXVECTOR3& color, float alpha, const D3DXVECTOR2& size)
+	{
+		PositionX.push_back(position.x);
+		PositionY.push_back(position.y);
+		PositionZ.push_back(position.z);
+		VelocityX.push_back(velocity.x);
+		VelocityY.push_back(velocity.y);
+		VelocityZ.push_back(velocity.z);
+		ColorR.push_back(color.x);
+		ColorG.push_back(color.y);
+		ColorB.push_back(color.z);
+		Alpha.push_back(alpha);
+		SizeX.push_back(size.x);
+		SizeY.push_back(size.y);
+	}
+
+	/** Assigns the draw-ranges and evaluates all gathered particles into the instance-buffer.
+		If keepCopy is set, the instances are also kept on the CPU for GetInstancesByTexture. */
+	XRESULT Build(bool keepCopy = false);
+
+	/** Puts already finished instances into the instance-buffer, for replaying captured particles */
+	XRESULT BuildFromInstances(const std::map<zCTexture*, std::vector<ParticleInstanceInfo>>& particles, const std::map<zCTexture*, ParticleRenderInfo>& info);
+
+	/** Returns the instances of the last Build(true), grouped by texture */
+	void GetInstancesByTexture(std::map<zCTexture*, std::vector<ParticleInstanceInfo>>& particles, std::map<zCTexture*, ParticleRenderInfo>& info);
+
+	/** Ranges to draw, additive ones first */
+	const std::vector<ParticleDrawRange>& GetDrawRanges(){return DrawRanges;}
+
+	/** Vertexbuffer holding the instances of all ranges */
+	D3D11VertexBuffer* GetInstanceBuffer(){return InstanceBuffer;}
+
+	/** Number of particles gathered this frame */
+	unsigned int GetNumParticles() const {return PositionX.size();}
+
+private:
+	/** A run of particles in the arrays, sharing one emitter */
+	struct EmitterRun
+	{
+		zCTexture* Texture;
+		ParticleRenderInfo RenderInfo;
+		ParticleEmitterInfo Info;
+		unsigned int First;
+		unsigned int Count;
+		unsigned int Range; // Index into DrawRanges
+		unsigned int Output; // Where the instances go in the buffer
+	};
+
+	/** Ends the current emitter-run and adds its particles to the range of its texture */
+	void EndEmitter();
+
+	/** Orders the ranges and gives every emitter its place in the instance-buffer */
+	void AssignOutputs();
+
+	/** Evaluates the given emitters into the output */
+	void EvaluateEmitters(unsigned int first, unsigned int last, ParticleInstanceInfo* output);
+
+	/** Recreates the instance-buffer, big enough for the given number of particles */
+	XRESULT EnsureCapacity(unsigned int numParticles);
+
+	/** Particles of this frame, structure-of-arrays */
+	std::vector<float> PositionX, PositionY, PositionZ;
+	std::vector<float> VelocityX, VelocityY, VelocityZ;
+	std::vector<float> ColorR, ColorG, ColorB;
+	std::vector<float> Alpha;
+	std::vector<float> SizeX, SizeY;
+
+	std::vector<EmitterRun> Emitters;
+	std::vector<ParticleDrawRange> DrawRanges;
+	std::unordered_map<zCTexture*, unsigned int> RangeOfTexture;
+
+	/** CPU-copy of the instances, only filled by Build(true) */
+	std::vector<ParticleInstanceInfo> InstanceCopy;
+
+	D3D11VertexBuffer* InstanceBuffer;
+	unsigned int InstanceCapacity;
+
+	JobGroup EvaluateJobs;
+
+	/** Set between BeginEmitter and EndEmitter */
+	bool EmitterOpen;
+
+	/** When BeginFrame was called, for the particles per millisecond */
+	LARGE_INTEGER FrameStart;
+};
@@ -0,0 +1,666 @@
+#include "pch.h"
+#include "RenderQueue.h"
+#include "D3D11PShader.h"
+#include "D3D11ConstantBuffer.h"
+#include "D3D11VertexBuffer.h"
+#include "GothicGraphicsState.h"
+#include <algorithm>
+#include <tuple>
+
+void D3D11RenderStateBackend::SetPixelShader(D3D11PShader* shader)
+{
+	shader->Apply();
+}
+
+void D3D11RenderStateBackend::SetPixelShaderResources(ID3D11ShaderResourceView* const* views, int num)
+{
+	Context->PSSetShaderResources(0, num, views);
+}
+
+void D3D11RenderStateBackend::SetPixelShaderConstantBuffer(int slot, D3D11ConstantBuffer* buffer)
+{
+	buffer->BindToPixelShader(slot);
+}
+
+bool D3D11RenderStateBackend::HasConstantBufferContents(D3D11ConstantBuffer* buffer, const void* data, unsigned int size)
+{
+	// The buffer keeps a copy of what it holds, which also sees writes from outside the cache
+	return buffer->HasContents(data);
+}
+
+void D3D11RenderStateBackend::UpdateConstantBuffer(D3D11ConstantBuffer* buffer, const void* data, unsigned int size)
+{
+	buffer->UpdateBuffer((void *)data);
+}
+
+void D3D11RenderStateBackend::SetTesselationResources(ID3D11ShaderResourceView* texture, D3D11ConstantBuffer* buffer)
+{
+	Context->DSSetShaderResources(RQ_TESSELATION_TEXTURE_SLOT, 1, &texture);
+	Context->HSSetShaderResources(RQ_TESSELATION_TEXTURE_SLOT, 1, &texture);
+
+	if(buffer)
+	{
+		buffer->BindToDomainShader(RQ_TESSELATION_BUFFER_SLOT);
+		buffer->BindToHullShader(RQ_TESSELATION_BUFFER_SLOT);
+	}
+}
+
+void D3D11RenderStateBackend::SetVertexBuffer(int slot, D3D11VertexBuffer* buffer, unsigned int stride)
+{
+	UINT offset = 0;
+	UINT uStride = stride;
+	ID3D11Buffer* b = buffer->GetVertexBuffer();
+	Context->IASetVertexBuffers(slot, 1, &b, &uStride, &offset);
+}
+
+void D3D11RenderStateBackend::SetIndexBuffer(D3D11VertexBuffer* buffer)
+{
+	if(sizeof(VERTEX_INDEX) == sizeof(unsigned short))
+	{
+		Context->IASetIndexBuffer(buffer->GetVertexBuffer(), DXGI_FORMAT_R16_UINT, 0);
+	}else
+	{
+		Context->IASetIndexBuffer(buffer->GetVertexBuffer(), DXGI_FORMAT_R32_UINT, 0);
+	}
+}
+
+void D3D11RenderStateBackend::DrawIndexed(unsigned int numIndices, unsigned int indexOffset)
+{
+	Context->DrawIndexed(numIndices, indexOffset, 0);
+}
+
+void D3D11RenderStateBackend::DrawIndexedInstanced(unsigned int numIndices, unsigned int numInstances, unsigned int indexOffset, unsigned int startInstance)
+{
+	Context->DrawIndexedInstanced(numIndices, numInstances, indexOffset, 0, startInstance);
+}
+
+RecordingRenderStateBackend::RecordingRenderStateBackend(RenderStateBackend* forward)
+{
+	Forward = forward;
+	Clear();
+}
+
+RecordingRenderStateBackend::~RecordingRenderStateBackend()
+{
+	delete Forward;
+}
+
+/** Forgets the recorded commands. Keeps the memory. */
+void RecordingRenderStateBackend::Clear()
+{
+	Commands.clear();
+	BufferContents.clear();
+	NumDraws = 0;
+	NumUpdates = 0;
+	NumBytesUploaded = 0;
+}
+
+/** Appends a command and returns it */
+RecordedRenderCommand& RecordingRenderStateBackend::Record(RecordedRenderCommand::EType type, const void* object)
+{
+	RecordedRenderCommand c;
+	c.Type = type;
+	c.Object = object;
+	ZeroMemory(c.Args, sizeof(c.Args));
+
+	Commands.push_back(c);
+	return Commands.back();
+}
+
+void RecordingRenderStateBackend::SetPixelShader(D3D11PShader* shader)
+{
+	Record(RecordedRenderCommand::RC_PixelShader, shader);
+
+	if(Forward)
+		Forward->SetPixelShader(shader);
+}
+
+void RecordingRenderStateBackend::SetPixelShaderResources(ID3D11ShaderResourceView* const* views, int num)
+{
+	// Only the first one, to keep the commands small
+	Record(RecordedRenderCommand::RC_PixelShaderResources, views[0]).Args[0] = num;
+
+	if(Forward)
+		Forward->SetPixelShaderResources(views, num);
+}
+
+void RecordingRenderStateBackend::SetPixelShaderConstantBuffer(int slot, D3D11ConstantBuffer* buffer)
+{
+	Record(RecordedRenderCommand::RC_PixelShaderConstantBuffer, buffer).Args[0] = slot;
+
+	if(Forward)
+		Forward->SetPixelShaderConstantBuffer(slot, buffer);
+}
+
+bool RecordingRenderStateBackend::HasConstantBufferContents(D3D11ConstantBuffer* buffer, const void* data, unsigned int size)
+{
+	if(Forward)
+		return Forward->HasConstantBufferContents(buffer, data, size);
+
+	std::unordered_map<D3D11ConstantBuffer*, std::vector<char>>::iterator it = BufferContents.find(buffer);
+	return it != BufferContents.end() && (*it).second.size() == size && memcmp(&(*it).second[0], data, size) == 0;
+}
+
+void RecordingRenderStateBackend::UpdateConstantBuffer(D3D11ConstantBuffer* buffer, const void* data, unsigned int size)
+{
+	Record(RecordedRenderCommand::RC_UpdateConstantBuffer, buffer).Args[0] = size;
+	NumUpdates++;
+	NumBytesUploaded += size;
+
+	if(Forward)
+		Forward->UpdateConstantBuffer(buffer, data, size);
+	else
+		BufferContents[buffer].assign((const char *)data, (const char *)data + size);
+}
+
+void RecordingRenderStateBackend::SetTesselationResources(ID3D11ShaderResourceView* texture, D3D11ConstantBuffer* buffer)
+{
+	Record(RecordedRenderCommand::RC_TesselationResources, texture);
+
+	if(Forward)
+		Forward->SetTesselationResources(texture, buffer);
+}
+
+void RecordingRenderStateBackend::SetVertexBuffer(int slot, D3D11VertexBuffer* buffer, unsigned int stride)
+{
+	RecordedRenderCommand& c = Record(RecordedRenderCommand::RC_VertexBuffer, buffer);
+	c.Args[0] = slot;
+	c.Args[1] = stride;
+
+	if(Forward)
+		Forward->SetVertexBuffer(slot, buffer, stride);
+}
+
+void RecordingRenderStateBackend::SetIndexBuffer(D3D11VertexBuffer* buffer)
+{
+	Record(RecordedRenderCommand::RC_IndexBuffer, buffer);
+
+	if(Forward)
+		Forward->SetIndexBuffer(buffer);
+}
+
+void RecordingRenderStateBackend::DrawIndexed(unsigned int numIndices, unsigned int indexOffset)
+{
+	RecordedRenderCommand& c = Record(RecordedRenderCommand::RC_DrawIndexed, NULL);
+	c.Args[0] = numIndices;
+	c.Args[1] = indexOffset;
+	NumDraws++;
+
+	if(Forward)
+		Forward->DrawIndexed(numIndices, indexOffset);
+}
+
+void RecordingRenderStateBackend::DrawIndexedInstanced(unsigned int numIndices, unsigned int numInstances, unsigned int indexOffset, unsigned int startInstance)
+{
+	RecordedRenderCommand& c = Record(RecordedRenderCommand::RC_DrawIndexedInstanced, NULL);
+	c.Args[0] = numIndices;
+	c.Args[1] = indexOffset;
+	c.Args[2] = numInstances;
+	c.Args[3] = startInstance;
+	NumDraws++;
+
+	if(Forward)
+		Forward->DrawIndexedInstanced(numIndices, numInstances, indexOffset, startInstance);
+}
+
+RenderStateCache::RenderStateCache(RenderStateBackend* backend, GothicRendererInfo* info)
+{
+	Backend = backend;
+	Info = info;
+	Invalidate();
+}
+
+/** Forgets everything, so the next binds all go through */
+void RenderStateCache::Invalidate()
+{
+	PixelShader = NULL;
+	ZeroMemory(PixelShaderResources, sizeof(PixelShaderResources));
+	ZeroMemory(PixelShaderConstantBuffers, sizeof(PixelShaderConstantBuffers));
+	TesselationTexture = NULL;
+	TesselationBuffer = NULL;
+	ZeroMemory(VertexBuffers, sizeof(VertexBuffers));
+	IndexBuffer = NULL;
+}
+
+void RenderStateCache::CountChange(int state)
+{
+	if(!Info)
+		return;
+
+	Info->StateChanges++;
+	Info->StateChangesByState[state]++;
+}
+
+void RenderStateCache::CountRedundant()
+{
+	if(Info)
+		Info->RedundantStateChanges++;
+}
+
+/** Binds everything the packet needs */
+void RenderStateCache::BindPacket(const RenderQueuePacket& packet, bool tesselated)
+{
+	if(packet.PixelShader)
+		SetPixelShader(packet.PixelShader);
+
+	SetPixelShaderResources(packet.Textures);
+
+	if(packet.MaterialBuffer)
+		SetPixelShaderConstantBuffer(RQ_MATERIAL_SLOT, packet.MaterialBuffer);
+
+	if(packet.PerDrawBuffer)
+	{
+		SetConstantBufferData(packet.PerDrawBuffer, packet.PerDrawData);
+		SetPixelShaderConstantBuffer(RQ_PER_DRAW_SLOT, packet.PerDrawBuffer);
+	}
+
+	if(tesselated)
+		SetTesselationResources(packet.Textures[1], packet.TesselationBuffer);
+
+	SetVertexBuffer(0, packet.VertexBuffer, sizeof(ExVertexStruct));
+
+	if(packet.NumInstances)
+		SetVertexBuffer(1, packet.InstanceBuffer, packet.InstanceStride);
+
+	SetIndexBuffer(packet.IndexBuffer);
+}
+
+void RenderStateCache::SetPixelShader(D3D11PShader* shader)
+{
+	if(shader == PixelShader)
+	{
+		CountRedundant();
+		return;
+	}
+
+	PixelShader = shader;
+	Backend->SetPixelShader(shader);
+	CountChange(GothicRendererInfo::SC_PS);
+}
+
+void RenderStateCache::SetPixelShaderResources(ID3D11ShaderResourceView* const* views)
+{
+	if(memcmp(views, PixelShaderResources, sizeof(PixelShaderResources)) == 0)
+	{
+		CountRedundant();
+		return;
+	}
+
+	memcpy(PixelShaderResources, views, sizeof(PixelShaderResources));
+	Backend->SetPixelShaderResources(views, RQ_NUM_TEXTURES);
+	CountChange(GothicRendererInfo::SC_TX);
+}
+
+void RenderStateCache::SetPixelShaderConstantBuffer(int slot, D3D11ConstantBuffer* buffer)
+{
+	if(PixelShaderConstantBuffers[slot] == buffer)
+	{
+		CountRedundant();
+		return;
+	}
+
+	PixelShaderConstantBuffers[slot] = buffer;
+	Backend->SetPixelShaderConstantBuffer(slot, buffer);
+	CountChange(GothicRendererInfo::SC_CB);
+}
+
+void RenderStateCache::SetConstantBufferData(D3D11ConstantBuffer* buffer, const D3DXVECTOR4& data)
+{
+	if(Backend->HasConstantBufferContents(buffer, &data, sizeof(data)))
+	{
+		CountRedundant();
+		return;
+	}
+
+	Backend->UpdateConstantBuffer(buffer, &data, sizeof(data));
+}
+
+void RenderStateCache::SetTesselationResources(ID3D11ShaderResourceView* texture, D3D11ConstantBuffer* buffer)
+{
+	if(texture == TesselationTexture && buffer == TesselationBuffer)
+	{
+		CountRedundant();
+		return;
+	}
+
+	TesselationTexture = texture;
+	TesselationBuffer = buffer;
+	Backend->SetTesselationResources(texture, buffer);
+	CountChange(GothicRendererInfo::SC_DS);
+	CountChange(GothicRendererInfo::SC_HS);
+}
+
+void RenderStateCache::SetVertexBuffer(int slot, D3D11VertexBuffer* buffer, unsigned int stride)
+{
+	if(VertexBuffers[slot] == buffer)
+	{
+		CountRedundant();
+		return;
+	}
+
+	VertexBuffers[slot] = buffer;
+	Backend->SetVertexBuffer(slot, buffer, stride);
+	CountChange(GothicRendererInfo::SC_VB);
+}
+
+void RenderStateCache::SetIndexBuffer(D3D11VertexBuffer* buffer)
+{
+	if(IndexBuffer == buffer)
+	{
+		CountRedundant();
+		return;
+	}
+
+	IndexBuffer = buffer;
+	Backend->SetIndexBuffer(buffer);
+	CountChange(GothicRendererInfo::SC_IB);
+}
+
+/** Builds the key. The IDs are cut to their bits, depth is quantized. */
+unsigned __int64 RenderQueueKey::Make(unsigned int pass, unsigned int shader, unsigned int texture, unsigned int material, float depth)
+{
+	// Bits of positive floats sort like the floats themselves. Drop the lowest mantissa-bits to make it fit.
+	unsigned int depthBits = 0;
+	if(depth > 0.0f)
+		memcpy(&depthBits, &depth, sizeof(depthBits));
+
+	depthBits >>= 32 - DEPTH_BITS - 1; // Sign is always 0
+
+	unsigned __int64 key = pass & ((1 << PASS_BITS) - 1);
+	key = (key << SHADER_BITS) | (shader & ((1 << SHADER_BITS) - 1));
+	key = (key << TEXTURE_BITS) | (texture & ((1 << TEXTURE_BITS) - 1));
+	key = (key << MATERIAL_BITS) | (material & ((1 << MATERIAL_BITS) - 1));
+	key = (key << DEPTH_BITS) | (depthBits & ((1 << DEPTH_BITS) - 1));
+	return key;
+}
+
+/** Removes all packets and forgets the IDs */
+void RenderQueue::Clear()
+{
+	Packets.clear();
+	Entries.clear();
+	TextureIDs.clear();
+	MaterialIDs.clear();
+}
+
+/** Adds a packet with the given key */
+void RenderQueue::Add(unsigned __int64 key, const RenderQueuePacket& packet)
+{
+	Entry e;
+	e.Key = key;
+	e.Packet = Packets.size();
+	Entries.push_back(e);
+	Packets.push_back(packet);
+}
+
+/** Returns a small ID for the given object, in the order they were first seen */
+static unsigned int GetRenderQueueID(std::unordered_map<const void*, unsigned int>& ids, const void* object)
+{
+	std::unordered_map<const void*, unsigned int>::iterator it = ids.find(object);
+	if(it != ids.end())
+		return (*it).second;
+
+	unsigned int id = ids.size();
+	ids[object] = id;
+	return id;
+}
+
+unsigned int RenderQueue::GetTextureID(const void* texture)
+{
+	return GetRenderQueueID(TextureIDs, texture);
+}
+
+unsigned int RenderQueue::GetMaterialID(const void* material)
+{
+	return GetRenderQueueID(MaterialIDs, material);
+}
+
+/** Radix-sorts the packets by their keys */
+void RenderQueue::Sort()
+{
+	const int DIGIT_BITS = 8;
+	const unsigned int NUM_BUCKETS = 1 << DIGIT_BITS;
+
+	unsigned int num = Entries.size();
+	if(num < 2)
+		return;
+
+	// Digits which are the same for all keys don't need a pass. Usually the pass- and shader-bits.
+	unsigned __int64 differing = 0;
+	for(unsigned int i=1;i<num;i++)
+		differing |= Entries[i].Key ^ Entries[0].Key;
+
+	SortBuffer.resize(num);
+	unsigned int offsets[NUM_BUCKETS];
+
+	// LSD-radix sort is stable, so equal keys keep their order
+	for(int shift=0;shift<64;shift+=DIGIT_BITS)
+	{
+		if(((differing >> shift) & (NUM_BUCKETS - 1)) == 0)
+			continue;
+
+		memset(offsets, 0, sizeof(offsets));
+		for(unsigned int i=0;i<num;i++)
+			offsets[(unsigned int)(Entries[i].Key >> shift) & (NUM_BUCKETS - 1)]++;
+
+		unsigned int sum = 0;
+		for(unsigned int b=0;b<NUM_BUCKETS;b++)
+		{
+			unsigned int c = offsets[b];
+			offsets[b] = sum;
+			sum += c;
+		}
+
+		for(unsigned int i=0;i<num;i++)
+			SortBuffer[offsets[(unsigned int)(Entries[i].Key >> shift) & (NUM_BUCKETS - 1)]++] = Entries[i];
+
+		Entries.swap(SortBuffer);
+	}
+}
+
+/** Draws the packet, like D3D11GraphicsEngine::SubmitRenderQueue does */
+static void DrawRenderQueuePacket(RenderStateBackend* backend, const RenderQueuePacket& packet)
+{
+	if(packet.NumInstances)
+		backend->DrawIndexedInstanced(packet.NumIndices, packet.NumInstances, packet.IndexOffset, packet.StartInstance);
+	else if(packet.NumIndices)
+		backend->DrawIndexed(packet.NumIndices, packet.IndexOffset);
+}
+
+/** Collects the arguments of all draws, sorted, so two runs can be compared regardless of their order */
+static void GetRecordedDraws(const RecordingRenderStateBackend& recorder, std::vector<std::tuple<unsigned int, unsigned int, unsigned int, unsigned int>>& draws)
+{
+	draws.clear();
+	for(unsigned int i=0;i<recorder.GetCommands().size();i++)
+	{
+		const RecordedRenderCommand& c = recorder.GetCommands()[i];
+		if(c.Type == RecordedRenderCommand::RC_DrawIndexed || c.Type == RecordedRenderCommand::RC_DrawIndexedInstanced)
+			draws.push_back(std::make_tuple(c.Args[0], c.Args[1], c.Args[2], c.Args[3]));
+	}
+
+	std::sort(draws.begin(), draws.end());
+}
+
+/** Returns how often the per-draw buffers of the queue get data which differs from what they had before, in the queues order */
+static unsigned int CountPerDrawChanges(const RenderQueue& queue)
+{
+	std::unordered_map<D3D11ConstantBuffer*, D3DXVECTOR4> contents;
+	unsigned int changes = 0;
+	for(unsigned int i=0;i<queue.Size();i++)
+	{
+		const RenderQueuePacket& packet = queue.GetPacket(i);
+		if(!packet.PerDrawBuffer)
+			continue;
+
+		std::unordered_map<D3D11ConstantBuffer*, D3DXVECTOR4>::iterator it = contents.find(packet.PerDrawBuffer);
+		if(it != contents.end() && memcmp(&(*it).second, &packet.PerDrawData, sizeof(D3DXVECTOR4)) == 0)
+			continue;
+
+		contents[packet.PerDrawBuffer] = packet.PerDrawData;
+		changes++;
+	}
+
+	return changes;
+}
+
+/** Pushes a fixed set of packets through a RecordingRenderStateBackend, with and without sorting and caching */
+bool RenderQueue::RunSelfTest()
+{
+	const unsigned int numPackets = 4096;
+	const unsigned int numShaders = 8;
+	const unsigned int numTextures = 64;
+	const unsigned int numMaterials = 32;
+	const unsigned int numMeshes = 256;
+
+	// Only the recorder sees the objects and never touches them, so addresses are enough
+	static char objects[numShaders + numTextures * RQ_NUM_TEXTURES + numMaterials + numMeshes * 2 + 4];
+	char* next = objects;
+	D3D11PShader* shaders = (D3D11PShader *)next; next += numShaders;
+	ID3D11ShaderResourceView* textures = (ID3D11ShaderResourceView *)next; next += numTextures * RQ_NUM_TEXTURES;
+	D3D11ConstantBuffer* materials = (D3D11ConstantBuffer *)next; next += numMaterials;
+	D3D11VertexBuffer* meshes = (D3D11VertexBuffer *)next; next += numMeshes * 2;
+	D3D11ConstantBuffer* tesselationBuffer = (D3D11ConstantBuffer *)next; next++;
+	D3D11VertexBuffer* instanceBuffer = (D3D11VertexBuffer *)next; next++;
+	D3D11ConstantBuffer* perDrawBuffers = (D3D11ConstantBuffer *)next; next += 2;
+
+	RenderQueue queue;
+	unsigned int seed = 12345; // Fixed, so the counts are the same every run
+	for(unsigned int i=0;i<numPackets;i++)
+	{
+		seed = seed * 1664525 + 1013904223;
+		unsigned int shader = (seed >> 8) % numShaders;
+		seed = seed * 1664525 + 1013904223;
+		unsigned int texture = (seed >> 8) % numTextures;
+		seed = seed * 1664525 + 1013904223;
+		unsigned int mesh = (seed >> 8) % numMeshes;
+		seed = seed * 1664525 + 1013904223;
+		unsigned int pass = (seed >> 8) % 10 == 0 ? RQP_TESSELATED : RQP_OPAQUE;
+		seed = seed * 1664525 + 1013904223;
+		float depth = (float)(seed >> 8) / (float)(1 << 24) * 10000.0f;
+
+		// A material always uses the same texture, like in the game
+		unsigned int material = texture % numMaterials;
+
+		RenderQueuePacket packet;
+		packet.PixelShader = (D3D11PShader *)((char *)shaders + shader);
+		for(int t=0;t<RQ_NUM_TEXTURES;t++)
+			packet.Textures[t] = (ID3D11ShaderResourceView *)((char *)textures + texture * RQ_NUM_TEXTURES + t);
+
+		packet.MaterialBuffer = (D3D11ConstantBuffer *)((char *)materials + material);
+
+		// Like the vob draw-ranges: one of two buffers, with data which is the same for all meshes of a visual
+		packet.PerDrawBuffer = (D3D11ConstantBuffer *)((char *)perDrawBuffers + material % 2);
+		packet.PerDrawData = D3DXVECTOR4(1000.0f - (float)material, 0, 0, 0);
+
+		packet.TesselationBuffer = pass == RQP_TESSELATED ? tesselationBuffer : NULL;
+		packet.VertexBuffer = (D3D11VertexBuffer *)((char *)meshes + mesh * 2);
+		packet.IndexBuffer = (D3D11VertexBuffer *)((char *)meshes + mesh * 2 + 1);
+		packet.NumIndices = 3 * (i % 100 + 1);
+		packet.IndexOffset = i;
+
+		// Every fourth mesh is drawn instanced
+		if(mesh % 4 == 0)
+		{
+			packet.InstanceBuffer = instanceBuffer;
+			packet.InstanceStride = 64;
+			packet.NumInstances = i % 7 + 1;
+			packet.StartInstance = i;
+		}
+
+		queue.Add(RenderQueueKey::Make(pass, shader, queue.GetTextureID(packet.Textures[0]), queue.GetMaterialID(packet.MaterialBuffer), depth), packet);
+	}
+
+	RecordingRenderStateBackend recorder(NULL);
+
+	// Everything bound for every packet, in the order they were added
+	for(unsigned int i=0;i<queue.Size();i++)
+	{
+		const RenderQueuePacket& packet = queue.GetPacket(i);
+		bool tesselated = queue.GetPass(i) == RQP_TESSELATED;
+
+		recorder.SetPixelShader(packet.PixelShader);
+		recorder.SetPixelShaderResources(packet.Textures, RQ_NUM_TEXTURES);
+		recorder.SetPixelShaderConstantBuffer(RQ_MATERIAL_SLOT, packet.MaterialBuffer);
+		recorder.UpdateConstantBuffer(packet.PerDrawBuffer, &packet.PerDrawData, sizeof(D3DXVECTOR4));
+		recorder.SetPixelShaderConstantBuffer(RQ_PER_DRAW_SLOT, packet.PerDrawBuffer);
+		if(tesselated)
+			recorder.SetTesselationResources(packet.Textures[1], packet.TesselationBuffer);
+
+		recorder.SetVertexBuffer(0, packet.VertexBuffer, sizeof(ExVertexStruct));
+		if(packet.NumInstances)
+			recorder.SetVertexBuffer(1, packet.InstanceBuffer, packet.InstanceStride);
+
+		recorder.SetIndexBuffer(packet.IndexBuffer);
+		DrawRenderQueuePacket(&recorder, packet);
+	}
+
+	unsigned int uncachedBinds = recorder.GetNumBinds();
+	unsigned int uncachedUpdates = recorder.GetNumUpdates();
+	std::vector<std::tuple<unsigned int, unsigned int, unsigned int, unsigned int>> uncachedDraws;
+	GetRecordedDraws(recorder, uncachedDraws);
+
+	// Cached, in the order they were added
+	GothicRendererInfo unsortedInfo;
+	RenderStateCache unsortedCache(&recorder, &unsortedInfo);
+	recorder.Clear();
+	for(unsigned int i=0;i<queue.Size();i++)
+	{
+		unsortedCache.BindPacket(queue.GetPacket(i), queue.GetPass(i) == RQP_TESSELATED);
+		DrawRenderQueuePacket(&recorder, queue.GetPacket(i));
+	}
+
+	unsigned int unsortedBinds = recorder.GetNumBinds();
+	unsigned int unsortedUpdates = recorder.GetNumUpdates();
+	unsigned int unsortedChanges = CountPerDrawChanges(queue);
+
+	// Sorted and cached, as the engine does it
+	GothicRendererInfo sortedInfo;
+	RenderStateCache sortedCache(&recorder, &sortedInfo);
+	recorder.Clear();
+	queue.Sort();
+
+	bool passed = true;
+	for(unsigned int i=0;i<queue.Size();i++)
+	{
+		if(i > 0 && queue.GetPass(i) < queue.GetPass(i - 1))
+		{
+			LogWarn() << "RenderQueue self-test: Packet " << i << " is in an earlier pass than the one before it";
+			passed = false;
+		}
+
+		sortedCache.BindPacket(queue.GetPacket(i), queue.GetPass(i) == RQP_TESSELATED);
+		DrawRenderQueuePacket(&recorder, queue.GetPacket(i));
+	}
+
+	unsigned int sortedBinds = recorder.GetNumBinds();
+	unsigned int sortedUpdates = recorder.GetNumUpdates();
+	unsigned int sortedChanges = CountPerDrawChanges(queue);
+	std::vector<std::tuple<unsigned int, unsigned int, unsigned int, unsigned int>> sortedDraws;
+	GetRecordedDraws(recorder, sortedDraws);
+
+	if(sortedDraws != uncachedDraws)
+	{
+		LogWarn() << "RenderQueue self-test: The sorted queue doesn't draw the same as the unsorted one";
+		passed = false;
+	}
+
+	if(sortedBinds >= unsortedBinds || unsortedBinds >= uncachedBinds)
+	{
+		LogWarn() << "RenderQueue self-test: Sorting and caching didn't reduce the binds";
+		passed = false;
+	}
+
+	// The per-draw buffer has to be updated when its data changes, and only then
+	if(uncachedUpdates != numPackets || unsortedUpdates != unsortedChanges || sortedUpdates != sortedChanges || sortedUpdates >= uncachedUpdates)
+	{
+		LogWarn() << "RenderQueue self-test: Per-draw buffer updates don't match the data-changes. Uncached: " << uncachedUpdates 
+			<< ", cached: " << unsortedUpdates << " (expected " << unsortedChanges << "), sorted and cached: " << sortedUpdates << " (expected " << sortedChanges << ")";
+		passed = false;
+	}
+
+	LogInfo() << "RenderQueue self-test: " << numPackets << " packets. Uncached: " << uncachedBinds << " binds, " << uncachedUpdates << " updates, "
+		<< "cached: " << unsortedBinds << " binds, " << unsortedUpdates << " updates (" << unsortedInfo.StateChanges << " state-changes, " << unsortedInfo.RedundantStateChanges << " dropped), "
+		<< "sorted and cached: " << sortedBinds << " binds, " << sortedUpdates << " updates (" << sortedInfo.StateChanges << " state-changes, " << sortedInfo.RedundantStateChanges << " dropped)";
+	LogInfo() << "RenderQueue self-test " << (passed ? "passed" : "failed");
+	return passed;
+}
@@ -0,0 +1,273 @@
+#pragma once
+#include "pch.h"
+
+class D3D11PShader;
+class D3D11ConstantBuffer;
+class D3D11VertexBuffer;
+struct GothicRendererInfo;
+
+/** Passes of the render-queue. All packets of a pass are drawn before the ones of the next pass. */
+enum ERenderQueuePass
+{
+	RQP_OPAQUE = 0,
+	RQP_TESSELATED = 1,
+	RQP_NUM_PASSES = 8 // 3 bits in the sort-key
+};
+
+/** Number of pixel-shader textures a packet binds, starting at slot 0 */
+const int RQ_NUM_TEXTURES = 3;
+
+/** Pixel-shader constantbuffer-slots of the material and the per-draw buffer */
+const int RQ_MATERIAL_SLOT = 2;
+const int RQ_PER_DRAW_SLOT = 3;
+
+/** Domain/hull-shader slots of the tesselation-resources */
+const int RQ_TESSELATION_TEXTURE_SLOT = 0;
+const int RQ_TESSELATION_BUFFER_SLOT = 1;
+
+/** One drawcall and the state it needs */
+struct RenderQueuePacket
+{
+	RenderQueuePacket()
+	{
+		ZeroMemory(this, sizeof(RenderQueuePacket));
+	}
+
+	D3D11PShader* PixelShader;
+	ID3D11ShaderResourceView* Textures[RQ_NUM_TEXTURES];
+	D3D11ConstantBuffer* MaterialBuffer;
+
+	/** Optional buffer for RQ_PER_DRAW_SLOT. It's filled with PerDrawData before drawing, if its contents differ. */
+	D3D11ConstantBuffer* PerDrawBuffer;
+	D3DXVECTOR4 PerDrawData;
+
+	/** Only used in RQP_TESSELATED */
+	D3D11ConstantBuffer* TesselationBuffer;
+
+	D3D11VertexBuffer* VertexBuffer;
+	D3D11VertexBuffer* IndexBuffer;
+	unsigned int NumIndices;
+	unsigned int IndexOffset;
+
+	/** Instancing. The packet is drawn non-instanced if NumInstances is 0. */
+	D3D11VertexBuffer* InstanceBuffer;
+	unsigned int InstanceStride;
+	unsigned int NumInstances;
+	unsigned int StartInstance;
+};
+
+/** Receives the binds the RenderStateCache lets through */
+class RenderStateBackend
+{
+public:
+	virtual ~RenderStateBackend(){}
+
+	virtual void SetPixelShader(D3D11PShader* shader) = 0;
+	virtual void SetPixelShaderResources(ID3D11ShaderResourceView* const* views, int num) = 0;
+	virtual void SetPixelShaderConstantBuffer(int slot, D3D11ConstantBuffer* buffer) = 0;
+
+	/** Returns true if the buffer already holds the given data, so updating it would be redundant */
+	virtual bool HasConstantBufferContents(D3D11ConstantBuffer* buffer, const void* data, unsigned int size) = 0;
+	virtual void UpdateConstantBuffer(D3D11ConstantBuffer* buffer, const void* data, unsigned int size) = 0;
+	virtual void SetTesselationResources(ID3D11ShaderResourceView* texture, D3D11ConstantBuffer* buffer) = 0;
+	virtual void SetVertexBuffer(int slot, D3D11VertexBuffer* buffer, unsigned int stride) = 0;
+	virtual void SetIndexBuffer(D3D11VertexBuffer* buffer) = 0;
+
+	virtual void DrawIndexed(unsigned int numIndices, unsigned int indexOffset) = 0;
+	virtual void DrawIndexedInstanced(unsigned int numIndices, unsigned int numInstances, unsigned int indexOffset, unsigned int startInstance) = 0;
+};
+
+/** Binds to a D3D11-context */
+class D3D11RenderStateBackend : public RenderStateBackend
+{
+public:
+	D3D11RenderStateBackend(ID3D11DeviceContext* context){Context = context;}
+
+	virtual void SetPixelShader(D3D11PShader* shader);
+	virtual void SetPixelShaderResources(ID3D11ShaderResourceView* const* views, int num);
+	virtual void SetPixelShaderConstantBuffer(int slot, D3D11ConstantBuffer* buffer);
+	virtual bool HasConstantBufferContents(D3D11ConstantBuffer* buffer, const void* data, unsigned int size);
+	virtual void UpdateConstantBuffer(D3D11ConstantBuffer* buffer, const void* data, unsigned int size);
+	virtual void SetTesselationResources(ID3D11ShaderResourceView* texture, D3D11ConstantBuffer* buffer);
+	virtual void SetVertexBuffer(int slot, D3D11VertexBuffer* buffer, unsigned int stride);
+	virtual void SetIndexBuffer(D3D11VertexBuffer* buffer);
+
+	virtual void DrawIndexed(unsigned int numIndices, unsigned int indexOffset);
+	virtual void DrawIndexedInstanced(unsigned int numIndices, unsigned int numInstances, unsigned int indexOffset, unsigned int startInstance);
+
+private:
+	ID3D11DeviceContext* Context;
+};
+
+/** One call the RecordingRenderStateBackend received */
+struct RecordedRenderCommand
+{
+	enum EType
+	{
+		RC_PixelShader,
+		RC_PixelShaderResources,
+		RC_PixelShaderConstantBuffer,
+		RC_UpdateConstantBuffer,
+		RC_TesselationResources,
+		RC_VertexBuffer,
+		RC_IndexBuffer,
+		RC_DrawIndexed,
+		RC_DrawIndexedInstanced
+	};
+
+	EType Type;
+
+	/** Bound/updated object, if any */
+	const void* Object;
+
+	/** Slot for binds, stride for vertexbuffers, bytes for updates.
+		Draws: numIndices, indexOffset, numInstances, startInstance */
+	unsigned int Args[4];
+};
+
+/** Records everything into memory instead of binding it, so the CPU-side of a frame can be looked at without a GPU.
+	Optionally passes the calls on to another backend. Without one, it keeps the constantbuffer-contents itself. */
+class RecordingRenderStateBackend : public RenderStateBackend
+{
+public:
+	/** Takes ownership of the given backend, which may be NULL */
+	RecordingRenderStateBackend(RenderStateBackend* forward);
+	virtual ~RecordingRenderStateBackend();
+
+	virtual void SetPixelShader(D3D11PShader* shader);
+	virtual void SetPixelShaderResources(ID3D11ShaderResourceView* const* views, int num);
+	virtual void SetPixelShaderConstantBuffer(int slot, D3D11ConstantBuffer* buffer);
+	virtual bool HasConstantBufferContents(D3D11ConstantBuffer* buffer, const void* data, unsigned int size);
+	virtual void UpdateConstantBuffer(D3D11ConstantBuffer* buffer, const void* data, unsigned int size);
+	virtual void SetTesselationResources(ID3D11ShaderResourceView* texture, D3D11ConstantBuffer* buffer);
+	virtual void SetVertexBuffer(int slot, D3D11VertexBuffer* buffer, unsigned int stride);
+	virtual void SetIndexBuffer(D3D11VertexBuffer* buffer);
+
+	virtual void DrawIndexed(unsigned int numIndices, unsigned int indexOffset);
+	virtual void DrawIndexedInstanced(unsigned int numIndices, unsigned int numInstances, unsigned int indexOffset, unsigned int startInstance);
+
+	/** Forgets the recorded commands and the constantbuffer-contents. Keeps the memory. */
+	void Clear();
+
+	/** Returns what was recorded since the last Clear */
+	const std::vector<RecordedRenderCommand>& GetCommands() const {return Commands;}
+
+	unsigned int GetNumDraws() const {return NumDraws;}
+	unsigned int GetNumBinds() const {return Commands.size() - NumDraws - NumUpdates;}
+	unsigned int GetNumUpdates() const {return NumUpdates;}
+	unsigned int GetNumBytesUploaded() const {return NumBytesUploaded;}
+
+private:
+	/** Appends a command and returns it */
+	RecordedRenderCommand& Record(RecordedRenderCommand::EType type, const void* object);
+
+	RenderStateBackend* Forward;
+	std::vector<RecordedRenderCommand> Commands;
+
+	/** Last data each constantbuffer got, if there is no backend to forward to */
+	std::unordered_map<D3D11ConstantBuffer*, std::vector<char>> BufferContents;
+
+	unsigned int NumDraws;
+	unsigned int NumUpdates;
+	unsigned int NumBytesUploaded;
+};
+
+/** Remembers what is bound and only forwards binds to the backend which change something.
+	Counts the binds it forwards and the ones it drops in the given renderer-info. */
+class RenderStateCache
+{
+public:
+	RenderStateCache(RenderStateBackend* backend, GothicRendererInfo* info);
+
+	/** Forgets everything, so the next binds all go through. Must be called when someone else touched the pipeline. */
+	void Invalidate();
+
+	/** Binds everything the packet needs */
+	void BindPacket(const RenderQueuePacket& packet, bool tesselated);
+
+	void SetPixelShader(D3D11PShader* shader);
+	void SetPixelShaderResources(ID3D11ShaderResourceView* const* views);
+	void SetPixelShaderConstantBuffer(int slot, D3D11ConstantBuffer* buffer);
+	void SetConstantBufferData(D3D11ConstantBuffer* buffer, const D3DXVECTOR4& data);
+	void SetTesselationResources(ID3D11ShaderResourceView* texture, D3D11ConstantBuffer* buffer);
+	void SetVertexBuffer(int slot, D3D11VertexBuffer* buffer, unsigned int stride);
+	void SetIndexBuffer(D3D11VertexBuffer* buffer);
+
+	/** Returns the pixelshader which is currently bound */
+	D3D11PShader* GetPixelShader(){return PixelShader;}
+
+private:
+	/** Counts a forwarded bind of the given GothicRendererInfo::EStateChange */
+	void CountChange(int state);
+
+	/** Counts a dropped bind */
+	void CountRedundant();
+
+	RenderStateBackend* Backend;
+	GothicRendererInfo* Info;
+
+	D3D11PShader* PixelShader;
+	ID3D11ShaderResourceView* PixelShaderResources[RQ_NUM_TEXTURES];
+	D3D11ConstantBuffer* PixelShaderConstantBuffers[RQ_PER_DRAW_SLOT + 1];
+	ID3D11ShaderResourceView* TesselationTexture;
+	D3D11ConstantBuffer* TesselationBuffer;
+	D3D11VertexBuffer* VertexBuffers[2];
+	D3D11VertexBuffer* IndexBuffer;
+};
+
+/** Sort-key of a packet. From most to least significant: pass, shader, texture, material, depth. */
+namespace RenderQueueKey
+{
+	const int PASS_BITS = 3;
+	const int SHADER_BITS = 10;
+	const int TEXTURE_BITS = 16;
+	const int MATERIAL_BITS = 11;
+	const int DEPTH_BITS = 24;
+
+	/** Builds the key. The IDs are cut to their bits, depth is quantized. */
+	unsigned __int64 Make(unsigned int pass, unsigned int shader, unsigned int texture, unsigned int material, float depth);
+};
+
+/** Collects packets and sorts them by their key */
+class RenderQueue
+{
+public:
+	/** Removes all packets and forgets the IDs */
+	void Clear();
+
+	/** Adds a packet with the given key */
+	void Add(unsigned __int64 key, const RenderQueuePacket& packet);
+
+	/** Returns a small ID for the given texture or material, in the order they were first seen. Used to build the keys. */
+	unsigned int GetTextureID(const void* texture);
+	unsigned int GetMaterialID(const void* material);
+
+	/** Radix-sorts the packets by their keys. Packets with the same key stay in the order they were added. */
+	void Sort();
+
+	/** Returns the number of packets */
+	unsigned int Size() const {return Entries.size();}
+
+	/** Pushes a fixed set of packets through a RecordingRenderStateBackend, once bound in order without a
+		RenderStateCache and once sorted and cached. Logs the binds and fails if sorting and caching don't reduce them,
+		or if the per-draw buffer isn't updated exactly when its data changes. */
+	static bool RunSelfTest();
+
+	/** Returns the i-th packet in sorted order, and its pass */
+	const RenderQueuePacket& GetPacket(unsigned int i) const {return Packets[Entries[i].Packet];}
+	unsigned int GetPass(unsigned int i) const {return (unsigned int)(Entries[i].Key >> (64 - RenderQueueKey::PASS_BITS));}
+
+private:
+	struct Entry
+	{
+		unsigned __int64 Key;
+		unsigned int Packet;
+	};
+
+	std::vector<RenderQueuePacket> Packets;
+	std::vector<Entry> Entries;
+	std::vector<Entry> SortBuffer;
+
+	std::unordered_map<const void*, unsigned int> TextureIDs;
+	std::unordered_map<const void*, unsigned int> MaterialIDs;
+};
@@ -0,0 +1,483 @@
+#include "pch.h"
+#include "SceneCapture.h"
+#include "Engine.h"
+#include "GothicAPI.h"
+#include "WorldObjects.h"
+#include "zCVob.h"
+#include "zCVobLight.h"
+#include "zCTexture.h"
+#include <algorithm>
+
+SceneCapture::SceneCapture(const std::string& file, const std::string& worldName, unsigned int numFrames)
+{
+	File = file;
+	WorldName = worldName;
+	NumFrames = numFrames;
+	Done = false;
+	HasSections = false;
+
+	Frames.reserve(numFrames);
+
+	LogInfo() << "Capturing " << numFrames << " frames to " << file;
+}
+
+/** Starts a new frame with the given camera. Writes the file once all frames are there. */
+void SceneCapture::BeginFrame(const D3DXMATRIX& view, const D3DXMATRIX& proj, const D3DXVECTOR3& cameraPosition, float time, float frameTime, float nearPlane, float farPlane)
+{
+	if(Done)
+		return;
+
+	if(Frames.size() == NumFrames)
+	{
+		// The last frame is complete now
+		SceneCaptureFile::Write(File, WorldName, Names, Frames);
+		LogInfo() << "Scene capture done: " << File << " (" << Names.size() << " names)";
+
+		Frames.clear();
+		Done = true;
+		return;
+	}
+
+	Frames.push_back(SceneCaptureFrameData());
+	SceneCaptureFrame& f = Frames.back().Frame;
+	ZeroMemory(&f, sizeof(f));
+	f.View = view;
+	f.Projection = proj;
+	f.CameraPosition = cameraPosition;
+	f.Time = time;
+	f.FrameTime = frameTime;
+	f.NearPlane = nearPlane;
+	f.FarPlane = farPlane;
+
+	HasSections = false;
+}
+
+/** Adds the results of the vob-collection to the current frame */
+void SceneCapture::AddVisibleVobs(const std::vector<VobInfo*>& vobs, const std::vector<VobLightInfo*>& lights, const std::vector<SkeletalVobInfo*>& mobs)
+{
+	if(Done || Frames.empty())
+		return;
+
+	SceneCaptureFrameData& frame = Frames.back();
+
+	for(unsigned int i=0;i<vobs.size();i++)
+	{
+		SceneCaptureVob v;
+		v.World = vobs[i]->WorldMatrix;
+		v.Visual = GetNameIndex(vobs[i]->VisualInfo->VisualName);
+		v.GroundColor = vobs[i]->GroundColor;
+		frame.Vobs.push_back(v);
+	}
+
+	for(unsigned int i=0;i<mobs.size();i++)
+	{
+		SceneCaptureVob v;
+		v.World = mobs[i]->WorldMatrix;
+		v.Visual = GetNameIndex(mobs[i]->VisualInfo ? mobs[i]->VisualInfo->VisualName : "");
+		v.GroundColor = 0xFFFFFFFF;
+		frame.SkeletalVobs.push_back(v);
+	}
+
+	for(unsigned int i=0;i<lights.size();i++)
+	{
+		SceneCaptureLight l;
+		l.Position = lights[i]->Vob->GetPositionWorld();
+		l.Range = lights[i]->Vob->GetLightRange();
+		l.Color = lights[i]->Vob->GetLightColor();
+		frame.Lights.push_back(l);
+	}
+}
+
+/** Adds the sections of the main view */
+void SceneCapture::AddVisibleSections(const std::list<WorldMeshSectionInfo*>& sections)
+{
+	if(Done || Frames.empty() || HasSections)
+		return;
+
+	SceneCaptureFrameData& frame = Frames.back();
+	for(std::list<WorldMeshSectionInfo*>::const_iterator it = sections.begin(); it != sections.end(); it++)
+	{
+		SceneCaptureSection s;
+		s.X = (*it)->WorldCoordinates.x;
+		s.Y = (*it)->WorldCoordinates.y;
+		frame.Sections.push_back(s);
+	}
+
+	HasSections = true;
+}
+
+/** Adds the particles of the current frame */
+void SceneCapture::AddParticles(const std::map<zCTexture*, std::vector<ParticleInstanceInfo>>& particles, const std::map<zCTexture*, ParticleRenderInfo>& info)
+{
+	if(Done || Frames.empty())
+		return;
+
+	SceneCaptureFrameData& frame = Frames.back();
+	for(std::map<zCTexture*, std::vector<ParticleInstanceInfo>>::const_iterator it = particles.begin(); it != particles.end(); it++)
+	{
+		std::map<zCTexture*, ParticleRenderInfo>::const_iterator inf = info.find((*it).first);
+		if((*it).second.empty() || inf == info.end())
+			continue;
+
+		SceneCaptureParticleGroup g;
+		ZeroMemory(&g, sizeof(g));
+		g.Texture = GetNameIndex((*it).first->GetNameWithoutExt());
+		g.FirstParticle = frame.Particles.size();
+		g.NumParticles = (*it).second.size();
+		g.Info = (*inf).second;
+		frame.ParticleGroups.push_back(g);
+
+		frame.Particles.insert(frame.Particles.end(), (*it).second.begin(), (*it).second.end());
+	}
+}
+
+/** Returns the index of the given name in the name table, adds it if needed */
+unsigned int SceneCapture::GetNameIndex(const std::string& name)
+{
+	std::unordered_map<std::string, unsigned int>::iterator it = NameIndices.find(name);
+	if(it != NameIndices.end())
+		return (*it).second;
+
+	unsigned int idx = Names.size();
+	Names.push_back(name);
+	NameIndices[name] = idx;
+	return idx;
+}
+
+/** Identifies a vob by its visual and transform. Gothic has no vob-ids which would survive a restart. */
+static unsigned __int64 GetVobKey(const std::string& visual, const D3DXMATRIX& world)
+{
+	unsigned __int64 hash = Toolbox::HashData(visual.data(), visual.size());
+	return Toolbox::HashData(&world, sizeof(world), hash);
+}
+
+/** Identifies a light by its position and range */
+static unsigned __int64 GetLightKey(const D3DXVECTOR3& position, float range)
+{
+	unsigned __int64 hash = Toolbox::HashData(&position, sizeof(position));
+	return Toolbox::HashData(&range, sizeof(range), hash);
+}
+
+/** Identifies a section by its cell */
+static unsigned __int64 GetSectionKey(int x, int y)
+{
+	return ((unsigned __int64)(unsigned int)x << 32) | (unsigned int)y;
+}
+
+/** Returns the given percentile in ms. Sorts the times. */
+float SceneReplayStage::GetPercentile(float p)
+{
+	if(Times.empty())
+		return 0.0f;
+
+	std::sort(Times.begin(), Times.end());
+
+	// Nearest rank
+	unsigned int rank = (unsigned int)ceilf(p * Times.size());
+	return Times[std::max(rank, 1u) - 1];
+}
+
+SceneReplay::SceneReplay()
+{
+	CurrentFrame = -1;
+	Camera = new CameraReplacement;
+	LastMismatchFrame = -1;
+	NumMismatchedFrames = 0;
+	CheckedSections = false;
+	NumDroppedParticleGroups = 0;
+	NumDroppedVobs = 0;
+	NumDroppedLights = 0;
+	NumDroppedSections = 0;
+
+	Stages[STAGE_TOTAL].Name = "Total";
+	Stages[STAGE_WORLDMESH].Name = "WorldMesh";
+	Stages[STAGE_VOBS].Name = "Vobs";
+	Stages[STAGE_LIGHTING].Name = "Lighting";
+	Stages[STAGE_SKELETAL].Name = "SkeletalMeshes";
+}
+
+SceneReplay::~SceneReplay()
+{
+	delete Camera;
+}
+
+/** Loads the capture. Fails if it was made in a different world. */
+XRESULT SceneReplay::Open(const std::string& file, const std::string& worldName)
+{
+	XLE(Capture.Open(file));
+
+	if(_stricmp(Capture.GetWorldName().c_str(), worldName.c_str()) != 0)
+	{
+		LogWarn() << "Scene capture " << file << " was made in " << Capture.GetWorldName() << ", not in " << worldName;
+		Capture.Close();
+		return XR_INVALID_ARG;
+	}
+
+	File = file;
+	for(int i=0;i<STAGE_NUM;i++)
+		Stages[i].Times.reserve(Capture.GetNumFrames());
+
+	LogInfo() << "Replaying " << Capture.GetNumFrames() << " frames from " << file;
+
+	return XR_SUCCESS;
+}
+
+/** Takes the timings of the frame which just finished */
+void SceneReplay::OnFrameDone(const GothicRendererInfo& info)
+{
+	if(CurrentFrame < 0)
+		return;
+
+	Stages[STAGE_TOTAL].Times.push_back(info.Timing.TotalMS);
+	Stages[STAGE_WORLDMESH].Times.push_back(info.Timing.WorldMeshMS);
+	Stages[STAGE_VOBS].Times.push_back(info.Timing.VobsMS);
+	Stages[STAGE_LIGHTING].Times.push_back(info.Timing.LightingMS);
+	Stages[STAGE_SKELETAL].Times.push_back(info.Timing.SkeletalMeshesMS);
+}
+
+/** Moves to the next frame. Returns false when all frames were played. */
+bool SceneReplay::BeginFrame()
+{
+	if(CurrentFrame + 1 >= (int)Capture.GetNumFrames())
+		return false;
+
+	CurrentFrame++;
+	CheckedSections = false;
+
+	const SceneCaptureFrame& f = Capture.GetFrame(CurrentFrame);
+	Camera->ViewReplacement = f.View;
+	Camera->ProjectionReplacement = f.Projection;
+	Camera->PositionReplacement = f.CameraPosition;
+	Camera->LookAtReplacement = f.CameraPosition;
+
+	return true;
+}
+
+/** Counts the current frame as different from the capture */
+void SceneReplay::CountMismatch()
+{
+	if(LastMismatchFrame == CurrentFrame)
+		return;
+
+	LastMismatchFrame = CurrentFrame;
+	NumMismatchedFrames++;
+}
+
+/** Counts a mismatch if the given keys aren't the same as the captured ones */
+void SceneReplay::CompareKeys(std::vector<unsigned __int64>& collected, std::vector<unsigned __int64>& captured)
+{
+	std::sort(collected.begin(), collected.end());
+	std::sort(captured.begin(), captured.end());
+
+	if(collected != captured)
+		CountMismatch();
+}
+
+/** Compares the collected vobs, lights and skeletal vobs with the capture, then replaces the vobs and lights with the captured ones */
+void SceneReplay::ReplaceVisibleVobs(std::vector<VobInfo*>& vobs, std::vector<VobLightInfo*>& lights, const std::vector<SkeletalVobInfo*>& mobs,
+	const std::unordered_map<zCVob*, VobInfo*>& vobMap, const std::unordered_map<zCVobLight*, VobLightInfo*>& lightMap)
+{
+	if(CurrentFrame < 0)
+		return;
+
+	const SceneCaptureFrame& f = Capture.GetFrame(CurrentFrame);
+	const SceneCaptureVob* capturedVobs = Capture.GetVobs(f);
+	const SceneCaptureVob* capturedMobs = Capture.GetSkeletalVobs(f);
+	const SceneCaptureLight* capturedLights = Capture.GetLights(f);
+
+	// Compare entry by entry. The order doesn't matter, only what is drawn.
+	CollectedKeys.clear();
+	CapturedKeys.clear();
+	for(unsigned int i=0;i<vobs.size();i++)
+		CollectedKeys.push_back(GetVobKey(vobs[i]->VisualInfo->VisualName, vobs[i]->WorldMatrix));
+	for(unsigned int i=0;i<f.NumVobs;i++)
+		CapturedKeys.push_back(GetVobKey(Capture.GetName(capturedVobs[i].Visual), capturedVobs[i].World));
+	CompareKeys(CollectedKeys, CapturedKeys);
+
+	CollectedKeys.clear();
+	CapturedKeys.clear();
+	for(unsigned int i=0;i<mobs.size();i++)
+		CollectedKeys.push_back(GetVobKey(mobs[i]->VisualInfo ? mobs[i]->VisualInfo->VisualName : "", mobs[i]->WorldMatrix));
+	for(unsigned int i=0;i<f.NumSkeletalVobs;i++)
+		CapturedKeys.push_back(GetVobKey(Capture.GetName(capturedMobs[i].Visual), capturedMobs[i].World));
+	CompareKeys(CollectedKeys, CapturedKeys);
+
+	CollectedKeys.clear();
+	CapturedKeys.clear();
+	for(unsigned int i=0;i<lights.size();i++)
+		CollectedKeys.push_back(GetLightKey(lights[i]->Vob->GetPositionWorld(), lights[i]->Vob->GetLightRange()));
+	for(unsigned int i=0;i<f.NumLights;i++)
+		CapturedKeys.push_back(GetLightKey(capturedLights[i].Position, capturedLights[i].Range));
+	CompareKeys(CollectedKeys, CapturedKeys);
+
+	// Draw the captured vobs instead. The collected ones have to be collectable again in the next frame.
+	for(unsigned int i=0;i<vobs.size();i++)
+		vobs[i]->VisibleInRenderPass = false;
+	vobs.clear();
+
+	for(unsigned int i=0;i<f.NumVobs;i++)
+	{
+		const SceneCaptureVob& c = capturedVobs[i];
+		const char* visual = Capture.GetName(c.Visual);
+
+		// Vobs can have been removed since the start, and the same visual can be at the same place twice
+		VobInfo* found = NULL;
+		auto range = KnownVobs.equal_range(GetVobKey(visual, c.World));
+		for(auto it = range.first; !found && it != range.second; it++)
+		{
+			std::unordered_map<zCVob*, VobInfo*>::const_iterator vi = vobMap.find((*it).second);
+			if(vi != vobMap.end() && !(*vi).second->VisibleInRenderPass 
+				&& (*vi).second->VisualInfo && (*vi).second->VisualInfo->VisualName == visual
+				&& memcmp(&(*vi).second->WorldMatrix, &c.World, sizeof(D3DXMATRIX)) == 0)
+				found = (*vi).second;
+		}
+
+		if(!found)
+		{
+			NumDroppedVobs++;
+			continue;
+		}
+
+		found->VisibleInRenderPass = true;
+		vobs.push_back(found);
+	}
+
+	// Same for the lights
+	for(unsigned int i=0;i<lights.size();i++)
+		lights[i]->VisibleInRenderPass = false;
+	lights.clear();
+
+	for(unsigned int i=0;i<f.NumLights;i++)
+	{
+		const SceneCaptureLight& c = capturedLights[i];
+
+		VobLightInfo* found = NULL;
+		auto range = KnownLights.equal_range(GetLightKey(c.Position, c.Range));
+		for(auto it = range.first; !found && it != range.second; it++)
+		{
+			std::unordered_map<zCVobLight*, VobLightInfo*>::const_iterator vi = lightMap.find((*it).second);
+			if(vi != lightMap.end() && !(*vi).second->VisibleInRenderPass
+				&& (*vi).second->Vob->GetPositionWorld() == c.Position
+				&& (*vi).second->Vob->GetLightRange() == c.Range)
+				found = (*vi).second;
+		}
+
+		if(!found)
+		{
+			NumDroppedLights++;
+			continue;
+		}
+
+		found->VisibleInRenderPass = true;
+		lights.push_back(found);
+	}
+}
+
+/** Compares the collected sections with the capture and replaces them with the captured ones */
+void SceneReplay::ReplaceVisibleSections(std::list<WorldMeshSectionInfo*>& sections, const WorldSectionGrid& grid)
+{
+	if(CurrentFrame < 0 || CheckedSections)
+		return;
+
+	CheckedSections = true;
+
+	const SceneCaptureFrame& f = Capture.GetFrame(CurrentFrame);
+	const SceneCaptureSection* captured = Capture.GetSections(f);
+
+	CollectedKeys.clear();
+	CapturedKeys.clear();
+	for(std::list<WorldMeshSectionInfo*>::const_iterator it = sections.begin(); it != sections.end(); it++)
+		CollectedKeys.push_back(GetSectionKey((*it)->WorldCoordinates.x, (*it)->WorldCoordinates.y));
+	for(unsigned int i=0;i<f.NumSections;i++)
+		CapturedKeys.push_back(GetSectionKey(captured[i].X, captured[i].Y));
+	CompareKeys(CollectedKeys, CapturedKeys);
+
+	sections.clear();
+	for(unsigned int i=0;i<f.NumSections;i++)
+	{
+		WorldMeshSectionInfo* section = grid.FindSection(captured[i].X, captured[i].Y);
+		if(!section)
+		{
+			NumDroppedSections++;
+			continue;
+		}
+
+		sections.push_back(section);
+	}
+}
+
+/** Makes the given texture available for the captured particles */
+void SceneReplay::AddKnownTexture(zCTexture* texture)
+{
+	if(texture)
+		KnownTextures[texture->GetNameWithoutExt()] = texture;
+}
+
+/** Makes the given vob or light available for the captured frames */
+void SceneReplay::AddKnownVob(VobInfo* vob)
+{
+	if(vob->VisualInfo)
+		KnownVobs.insert(std::make_pair(GetVobKey(vob->VisualInfo->VisualName, vob->WorldMatrix), vob->Vob));
+}
+
+void SceneReplay::AddKnownLight(VobLightInfo* light)
+{
+	KnownLights.insert(std::make_pair(GetLightKey(light->Vob->GetPositionWorld(), light->Vob->GetLightRange()), light->Vob));
+}
+
+/** Replaces the given particles with the ones of the current frame */
+void SceneReplay::GetParticles(std::map<zCTexture*, std::vector<ParticleInstanceInfo>>& particles, std::map<zCTexture*, ParticleRenderInfo>& info)
+{
+	for(std::map<zCTexture*, std::vector<ParticleInstanceInfo>>::iterator it = particles.begin(); it != particles.end(); it++)
+		AddKnownTexture((*it).first);
+
+	particles.clear();
+	info.clear();
+
+	if(CurrentFrame < 0)
+		return;
+
+	const SceneCaptureFrame& f = Capture.GetFrame(CurrentFrame);
+	const SceneCaptureParticleGroup* groups = Capture.GetParticleGroups(f);
+	const ParticleInstanceInfo* p = Capture.GetParticles(f);
+	for(unsigned int i=0;i<f.NumParticleGroups;i++)
+	{
+		std::unordered_map<std::string, zCTexture*>::iterator tx = KnownTextures.find(Capture.GetName(groups[i].Texture));
+		if(tx == KnownTextures.end())
+		{
+			NumDroppedParticleGroups++;
+			continue;
+		}
+
+		std::vector<ParticleInstanceInfo>& part = particles[(*tx).second];
+		part.insert(part.end(), p + groups[i].FirstParticle, p + groups[i].FirstParticle + groups[i].NumParticles);
+		info[(*tx).second] = groups[i].Info;
+	}
+}
+
+/** Logs the percentiles of all stages and appends them to the given report-file */
+void SceneReplay::WriteReport(const std::string& reportFile)
+{
+	FILE* f = fopen(reportFile.c_str(), "a");
+
+	char line[256];
+	sprintf_s(line, "Replay of %s, %s, %u frames, %u differed from the capture, dropped: %u vobs, %u lights, %u sections, %u particle groups\n",
+		File.c_str(), VERSION_STRING, (unsigned int)Stages[STAGE_TOTAL].Times.size(), NumMismatchedFrames, 
+		NumDroppedVobs, NumDroppedLights, NumDroppedSections, NumDroppedParticleGroups);
+	LogInfo() << line;
+	if(f)
+		fputs(line, f);
+
+	for(int i=0;i<STAGE_NUM;i++)
+	{
+		SceneReplayStage& s = Stages[i];
+		sprintf_s(line, "  %-16s p50 %8.3fms  p90 %8.3fms  p99 %8.3fms  max %8.3fms\n",
+			s.Name, s.GetPercentile(0.5f), s.GetPercentile(0.9f), s.GetPercentile(0.99f), s.GetPercentile(1.0f));
+		LogInfo() << line;
+		if(f)
+			fputs(line, f);
+	}
+
+	if(f)
+		fclose(f);
+}
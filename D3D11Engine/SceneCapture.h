@@ -0,0 +1,160 @@
+#pragma once
+#include "pch.h"
+#include "SceneCaptureFile.h"
+
+struct VobInfo;
+struct VobLightInfo;
+struct SkeletalVobInfo;
+struct WorldMeshSectionInfo;
+struct GothicRendererInfo;
+struct CameraReplacement;
+class zCTexture;
+class zCVob;
+class zCVobLight;
+class WorldSectionGrid;
+
+/** Number of frames captured by default. About 10 seconds at 60fps. */
+const int SCENECAPTURE_DEFAULT_FRAMES = 600;
+
+/** Records what the renderer gets each frame: the camera, the visible vobs, lights and sections and the particles.
+	The file is written once all frames are there. */
+class SceneCapture
+{
+public:
+	SceneCapture(const std::string& file, const std::string& worldName, unsigned int numFrames);
+
+	/** Starts a new frame with the given camera. Writes the file once all frames are there. */
+	void BeginFrame(const D3DXMATRIX& view, const D3DXMATRIX& proj, const D3DXVECTOR3& cameraPosition, float time, float frameTime, float nearPlane, float farPlane);
+
+	/** Adds the results of the vob-collection to the current frame */
+	void AddVisibleVobs(const std::vector<VobInfo*>& vobs, const std::vector<VobLightInfo*>& lights, const std::vector<SkeletalVobInfo*>& mobs);
+
+	/** Adds the sections of the main view. Only the first call per frame is taken, the others are from the shadow-passes. */
+	void AddVisibleSections(const std::list<WorldMeshSectionInfo*>& sections);
+
+	/** Adds the particles of the current frame */
+	void AddParticles(const std::map<zCTexture*, std::vector<ParticleInstanceInfo>>& particles, const std::map<zCTexture*, ParticleRenderInfo>& info);
+
+	/** Returns true once the file is written */
+	bool IsDone(){return Done;}
+
+private:
+	/** Returns the index of the given name in the name table, adds it if needed */
+	unsigned int GetNameIndex(const std::string& name);
+
+	std::string File;
+	std::string WorldName;
+	unsigned int NumFrames;
+	bool Done;
+
+	std::vector<SceneCaptureFrameData> Frames;
+	bool HasSections;
+
+	std::vector<std::string> Names;
+	std::unordered_map<std::string, unsigned int> NameIndices;
+};
+
+/** Timings of the replayed frames for one stage of the renderer */
+struct SceneReplayStage
+{
+	const char* Name;
+	std::vector<float> Times;
+
+	/** Returns the given percentile in ms. Sorts the times. */
+	float GetPercentile(float p);
+};
+
+/** Plays a capture back on the loaded world. The camera and time are taken from the capture, so culling and batching
+	see the same views as in the capture. The vobs, lights, sections and particles the renderer collects are compared
+	entry by entry with the capture and then replaced by the captured ones, so every frame draws the captured scene.
+	Skeletal vobs are moved by the game, so they are only compared.
+	The renderer-timings of each frame are kept and written as percentiles at the end. */
+class SceneReplay
+{
+public:
+	SceneReplay();
+	~SceneReplay();
+
+	/** Loads the capture. Fails if it was made in a different world. */
+	XRESULT Open(const std::string& file, const std::string& worldName);
+
+	/** Takes the timings of the frame which just finished */
+	void OnFrameDone(const GothicRendererInfo& info);
+
+	/** Moves to the next frame. Returns false when all frames were played. */
+	bool BeginFrame();
+
+	/** Returns true once the first frame started */
+	bool IsPlaying(){return CurrentFrame >= 0;}
+
+	/** Returns the camera of the current frame */
+	CameraReplacement* GetCamera(){return Camera;}
+	const SceneCaptureFrame& GetFrame(){return Capture.GetFrame(CurrentFrame);}
+
+	/** Compares the collected vobs, lights and skeletal vobs with the capture, then replaces the vobs and lights with the
+		captured ones. The maps are used to find out if a vob seen at the start still exists. */
+	void ReplaceVisibleVobs(std::vector<VobInfo*>& vobs, std::vector<VobLightInfo*>& lights, const std::vector<SkeletalVobInfo*>& mobs,
+		const std::unordered_map<zCVob*, VobInfo*>& vobMap, const std::unordered_map<zCVobLight*, VobLightInfo*>& lightMap);
+
+	/** Compares the collected sections with the capture and replaces them with the captured ones. Only the first sections of a frame
+		are from the main view, the others are left alone. */
+	void ReplaceVisibleSections(std::list<WorldMeshSectionInfo*>& sections, const WorldSectionGrid& grid);
+
+	/** Makes the given texture available for the captured particles */
+	void AddKnownTexture(zCTexture* texture);
+
+	/** Makes the given vob or light available for the captured frames */
+	void AddKnownVob(VobInfo* vob);
+	void AddKnownLight(VobLightInfo* light);
+
+	/** Replaces the given particles with the ones of the current frame. Their textures are learned first.
+		Groups whose texture wasn't seen yet are left out. */
+	void GetParticles(std::map<zCTexture*, std::vector<ParticleInstanceInfo>>& particles, std::map<zCTexture*, ParticleRenderInfo>& info);
+
+	/** Logs the percentiles of all stages and appends them to the given report-file */
+	void WriteReport(const std::string& reportFile);
+
+private:
+	/** Counts the current frame as different from the capture */
+	void CountMismatch();
+
+	/** Counts a mismatch if the given keys aren't the same as the captured ones, in any order. Sorts both. */
+	void CompareKeys(std::vector<unsigned __int64>& collected, std::vector<unsigned __int64>& captured);
+
+	SceneCaptureFile Capture;
+	std::string File;
+	int CurrentFrame;
+	CameraReplacement* Camera;
+
+	/** Frame the mismatch was counted for, so a frame is only counted once */
+	int LastMismatchFrame;
+	unsigned int NumMismatchedFrames;
+	bool CheckedSections;
+
+	/** Textures seen in the loaded world, by name */
+	std::unordered_map<std::string, zCTexture*> KnownTextures;
+	unsigned int NumDroppedParticleGroups;
+
+	/** Vobs and lights seen in the loaded world, by the key of their visual and transform */
+	std::unordered_multimap<unsigned __int64, zCVob*> KnownVobs;
+	std::unordered_multimap<unsigned __int64, zCVobLight*> KnownLights;
+	unsigned int NumDroppedVobs;
+	unsigned int NumDroppedLights;
+	unsigned int NumDroppedSections;
+
+	/** Keys of the current frame, kept to save the allocations */
+	std::vector<unsigned __int64> CollectedKeys;
+	std::vector<unsigned __int64> CapturedKeys;
+
+	enum EStage
+	{
+		STAGE_TOTAL,
+		STAGE_WORLDMESH,
+		STAGE_VOBS,
+		STAGE_LIGHTING,
+		STAGE_SKELETAL,
+		STAGE_NUM
+	};
+
+	SceneReplayStage Stages[STAGE_NUM];
+};
@@ -0,0 +1,222 @@
+#include "pch.h"
+#include "SceneCaptureFile.h"
+
+/** Places an array of num elements at the given offset and moves it past the array. Empty arrays get offset 0. */
+static unsigned int PlaceSceneCaptureArray(unsigned int& offset, unsigned int num, unsigned int elementSize)
+{
+	if(!num)
+		return 0;
+
+	unsigned int start = offset;
+	offset = Toolbox::AlignOffset(offset + num * elementSize, SCENECAPTURE_ALIGNMENT);
+	return start;
+}
+
+/** Returns true if num elements at offset fit into the file */
+static bool IsSceneCaptureArrayValid(unsigned int offset, unsigned int num, unsigned int elementSize, unsigned __int64 size)
+{
+	return offset + (unsigned __int64)num * elementSize <= size;
+}
+
+SceneCaptureFile::SceneCaptureFile(void)
+{
+	Header = NULL;
+}
+
+SceneCaptureFile::~SceneCaptureFile(void)
+{
+	Close();
+}
+
+/** Writes the given frames */
+XRESULT SceneCaptureFile::Write(const std::string& file,
+	const std::string& worldName,
+	const std::vector<std::string>& names,
+	const std::vector<SceneCaptureFrameData>& frames)
+{
+	SceneCaptureHeader header;
+	ZeroMemory(&header, sizeof(header));
+	header.Version = SCENECAPTURE_VERSION;
+	header.Magic = SCENECAPTURE_MAGIC;
+	strncpy(header.WorldName, worldName.c_str(), SCENECAPTURE_NAME_LENGTH - 1);
+	header.NumFrames = frames.size();
+	header.NumNames = names.size();
+
+	std::vector<SceneCaptureName> nameEntries(names.size());
+	for(unsigned int i=0;i<names.size();i++)
+	{
+		ZeroMemory(&nameEntries[i], sizeof(SceneCaptureName));
+		strncpy(nameEntries[i].Name, names[i].c_str(), SCENECAPTURE_NAME_LENGTH - 1);
+	}
+
+	header.FrameTableOffset = sizeof(SceneCaptureHeader);
+	header.NameTableOffset = Toolbox::AlignOffset(header.FrameTableOffset + frames.size() * sizeof(SceneCaptureFrame), SCENECAPTURE_ALIGNMENT);
+
+	// Put the arrays of all frames after the tables
+	unsigned int offset = Toolbox::AlignOffset(header.NameTableOffset + names.size() * sizeof(SceneCaptureName), SCENECAPTURE_ALIGNMENT);
+
+	std::vector<SceneCaptureFrame> frameEntries(frames.size());
+	for(unsigned int i=0;i<frames.size();i++)
+	{
+		const SceneCaptureFrameData& d = frames[i];
+		SceneCaptureFrame& e = frameEntries[i];
+		e = d.Frame;
+
+		e.NumVobs = d.Vobs.size();
+		e.VobOffset = PlaceSceneCaptureArray(offset, e.NumVobs, sizeof(SceneCaptureVob));
+		e.NumSkeletalVobs = d.SkeletalVobs.size();
+		e.SkeletalVobOffset = PlaceSceneCaptureArray(offset, e.NumSkeletalVobs, sizeof(SceneCaptureVob));
+		e.NumLights = d.Lights.size();
+		e.LightOffset = PlaceSceneCaptureArray(offset, e.NumLights, sizeof(SceneCaptureLight));
+		e.NumParticleGroups = d.ParticleGroups.size();
+		e.ParticleGroupOffset = PlaceSceneCaptureArray(offset, e.NumParticleGroups, sizeof(SceneCaptureParticleGroup));
+		e.NumParticles = d.Particles.size();
+		e.ParticleOffset = PlaceSceneCaptureArray(offset, e.NumParticles, sizeof(ParticleInstanceInfo));
+		e.NumSections = d.Sections.size();
+		e.SectionOffset = PlaceSceneCaptureArray(offset, e.NumSections, sizeof(SceneCaptureSection));
+	}
+
+	header.FileSize = offset;
+
+	FILE* f = fopen(file.c_str(), "wb");
+	if(!f)
+	{
+		LogWarn() << "Failed to create scene capture file: " << file;
+		return XR_FAILED;
+	}
+
+	// Reserve space for the header, it gets written when the hash is known
+	unsigned __int64 hash = Toolbox::HASH_DATA_SEED;
+	fwrite(&header, sizeof(header), 1, f);
+	unsigned int pos = sizeof(header);
+
+	Toolbox::WriteHashedData(f, pos, header.FrameTableOffset, frameEntries.empty() ? NULL : &frameEntries[0], frameEntries.size() * sizeof(SceneCaptureFrame), hash);
+	Toolbox::WriteHashedData(f, pos, header.NameTableOffset, nameEntries.empty() ? NULL : &nameEntries[0], nameEntries.size() * sizeof(SceneCaptureName), hash);
+
+	for(unsigned int i=0;i<frames.size();i++)
+	{
+		const SceneCaptureFrameData& d = frames[i];
+		const SceneCaptureFrame& e = frameEntries[i];
+
+		Toolbox::WriteHashedData(f, pos, e.VobOffset, d.Vobs.empty() ? NULL : &d.Vobs[0], d.Vobs.size() * sizeof(SceneCaptureVob), hash);
+		Toolbox::WriteHashedData(f, pos, e.SkeletalVobOffset, d.SkeletalVobs.empty() ? NULL : &d.SkeletalVobs[0], d.SkeletalVobs.size() * sizeof(SceneCaptureVob), hash);
+		Toolbox::WriteHashedData(f, pos, e.LightOffset, d.Lights.empty() ? NULL : &d.Lights[0], d.Lights.size() * sizeof(SceneCaptureLight), hash);
+		Toolbox::WriteHashedData(f, pos, e.ParticleGroupOffset, d.ParticleGroups.empty() ? NULL : &d.ParticleGroups[0], d.ParticleGroups.size() * sizeof(SceneCaptureParticleGroup), hash);
+		Toolbox::WriteHashedData(f, pos, e.ParticleOffset, d.Particles.empty() ? NULL : &d.Particles[0], d.Particles.size() * sizeof(ParticleInstanceInfo), hash);
+		Toolbox::WriteHashedData(f, pos, e.SectionOffset, d.Sections.empty() ? NULL : &d.Sections[0], d.Sections.size() * sizeof(SceneCaptureSection), hash);
+	}
+
+	Toolbox::WriteHashedData(f, pos, offset, NULL, 0, hash);
+
+	header.DataHash = hash;
+	fseek(f, 0, SEEK_SET);
+	fwrite(&header, sizeof(header), 1, f);
+
+	fclose(f);
+
+	return XR_SUCCESS;
+}
+
+/** Reads and validates the given file */
+XRESULT SceneCaptureFile::Open(const std::string& file)
+{
+	Close();
+
+	FILE* f = fopen(file.c_str(), "rb");
+	if(!f)
+		return XR_FAILED;
+
+	SceneCaptureHeader header;
+	if(fread(&header, sizeof(header), 1, f) != 1
+		|| header.Magic != SCENECAPTURE_MAGIC
+		|| header.Version != SCENECAPTURE_VERSION
+		|| header.FileSize <= sizeof(SceneCaptureHeader))
+	{
+		LogWarn() << "Not a scene capture of this version: " << file;
+		fclose(f);
+		return XR_FAILED;
+	}
+
+	Data.resize((size_t)header.FileSize);
+	memcpy(&Data[0], &header, sizeof(header));
+	size_t read = fread(&Data[sizeof(header)], 1, Data.size() - sizeof(header), f);
+	fclose(f);
+
+	if(read != Data.size() - sizeof(header))
+	{
+		LogWarn() << "Scene capture file is truncated: " << file;
+		Close();
+		return XR_FAILED;
+	}
+
+	if(Toolbox::HashData(&Data[sizeof(header)], Data.size() - sizeof(header)) != header.DataHash)
+	{
+		LogWarn() << "Scene capture file checksum mismatch: " << file;
+		Close();
+		return XR_FAILED;
+	}
+
+	Header = (const SceneCaptureHeader*)&Data[0];
+
+	// Validate the tables before anything points into the data
+	unsigned __int64 size = Data.size();
+	if(!IsSceneCaptureArrayValid(Header->FrameTableOffset, Header->NumFrames, sizeof(SceneCaptureFrame), size)
+		|| !IsSceneCaptureArrayValid(Header->NameTableOffset, Header->NumNames, sizeof(SceneCaptureName), size)
+		|| Header->WorldName[SCENECAPTURE_NAME_LENGTH - 1] != 0)
+	{
+		LogWarn() << "Scene capture file is corrupt: " << file;
+		Close();
+		return XR_FAILED;
+	}
+
+	for(unsigned int i=0;i<Header->NumFrames;i++)
+	{
+		const SceneCaptureFrame& e = GetFrame(i);
+		bool valid = IsSceneCaptureArrayValid(e.VobOffset, e.NumVobs, sizeof(SceneCaptureVob), size)
+			&& IsSceneCaptureArrayValid(e.SkeletalVobOffset, e.NumSkeletalVobs, sizeof(SceneCaptureVob), size)
+			&& IsSceneCaptureArrayValid(e.LightOffset, e.NumLights, sizeof(SceneCaptureLight), size)
+			&& IsSceneCaptureArrayValid(e.ParticleGroupOffset, e.NumParticleGroups, sizeof(SceneCaptureParticleGroup), size)
+			&& IsSceneCaptureArrayValid(e.ParticleOffset, e.NumParticles, sizeof(ParticleInstanceInfo), size)
+			&& IsSceneCaptureArrayValid(e.SectionOffset, e.NumSections, sizeof(SceneCaptureSection), size);
+
+		// Indices into the name table and the particle array
+		for(unsigned int v=0;valid && v<e.NumVobs;v++)
+			valid = GetVobs(e)[v].Visual < Header->NumNames;
+
+		for(unsigned int v=0;valid && v<e.NumSkeletalVobs;v++)
+			valid = GetSkeletalVobs(e)[v].Visual < Header->NumNames;
+
+		for(unsigned int g=0;valid && g<e.NumParticleGroups;g++)
+		{
+			const SceneCaptureParticleGroup& group = GetParticleGroups(e)[g];
+			valid = group.Texture < Header->NumNames
+				&& (unsigned __int64)group.FirstParticle + group.NumParticles <= e.NumParticles;
+		}
+
+		if(!valid)
+		{
+			LogWarn() << "Scene capture file has invalid frame " << i << ": " << file;
+			Close();
+			return XR_FAILED;
+		}
+	}
+
+	for(unsigned int i=0;i<Header->NumNames;i++)
+	{
+		if(GetName(i)[SCENECAPTURE_NAME_LENGTH - 1] != 0)
+		{
+			LogWarn() << "Scene capture file has invalid name " << i << ": " << file;
+			Close();
+			return XR_FAILED;
+		}
+	}
+
+	return XR_SUCCESS;
+}
+
+/** Frees the loaded data */
+void SceneCaptureFile::Close()
+{
+	Data.clear();
+	Header = NULL;
+}
@@ -0,0 +1,150 @@
+#pragma once
+#include "pch.h"
+#include "WorldObjects.h"
+
+/** Current version of the .gcap-format. Bump this whenever one of the structs below changes. */
+const int SCENECAPTURE_VERSION = 1;
+
+/** "GCAP" */
+const unsigned int SCENECAPTURE_MAGIC = 0x50414347;
+
+/** Alignment of the arrays inside the file */
+const unsigned int SCENECAPTURE_ALIGNMENT = 16;
+
+/** Maximum length of world-, visual- and texture-names, including the terminating zero */
+const int SCENECAPTURE_NAME_LENGTH = 64;
+
+/** Header of a scene-capture file. All offsets are relative to the start of the file. */
+struct SceneCaptureHeader
+{
+	int Version;
+	unsigned int Magic;
+	char WorldName[SCENECAPTURE_NAME_LENGTH];
+	unsigned int NumFrames;
+	unsigned int NumNames;
+	unsigned int FrameTableOffset;
+	unsigned int NameTableOffset;
+	unsigned __int64 DataHash; // Hash of everything after this header
+	unsigned __int64 FileSize;
+};
+
+/** Entry of the frame table. Holds the camera and timing of the frame, and where its arrays are. */
+struct SceneCaptureFrame
+{
+	D3DXMATRIX View;
+	D3DXMATRIX Projection;
+	D3DXVECTOR3 CameraPosition;
+	float Time;
+	float FrameTime;
+	float NearPlane;
+	float FarPlane;
+
+	unsigned int NumVobs;
+	unsigned int VobOffset;
+	unsigned int NumSkeletalVobs;
+	unsigned int SkeletalVobOffset;
+	unsigned int NumLights;
+	unsigned int LightOffset;
+	unsigned int NumParticleGroups;
+	unsigned int ParticleGroupOffset;
+	unsigned int NumParticles;
+	unsigned int ParticleOffset;
+	unsigned int NumSections;
+	unsigned int SectionOffset;
+};
+
+/** Entry of the name table */
+struct SceneCaptureName
+{
+	char Name[SCENECAPTURE_NAME_LENGTH];
+};
+
+/** A visible vob or skeletal vob */
+struct SceneCaptureVob
+{
+	D3DXMATRIX World;
+	unsigned int Visual; // Index into the name table
+	DWORD GroundColor;
+};
+
+/** A visible light */
+struct SceneCaptureLight
+{
+	D3DXVECTOR3 Position;
+	float Range;
+	DWORD Color;
+};
+
+/** Particles of one texture. The particles of a group are stored next to each other. */
+struct SceneCaptureParticleGroup
+{
+	unsigned int Texture; // Index into the name table
+	unsigned int FirstParticle;
+	unsigned int NumParticles;
+	ParticleRenderInfo Info;
+};
+
+/** A visible world-section */
+struct SceneCaptureSection
+{
+	int X;
+	int Y;
+};
+
+/** A frame while it is being captured, see SceneCaptureFile::Write */
+struct SceneCaptureFrameData
+{
+	/** Counts and offsets are filled in on write */
+	SceneCaptureFrame Frame;
+
+	std::vector<SceneCaptureVob> Vobs;
+	std::vector<SceneCaptureVob> SkeletalVobs;
+	std::vector<SceneCaptureLight> Lights;
+	std::vector<SceneCaptureParticleGroup> ParticleGroups;
+	std::vector<ParticleInstanceInfo> Particles;
+	std::vector<SceneCaptureSection> Sections;
+};
+
+/** Reads and writes .gcap-files, which hold what the renderer got for a number of frames */
+class SceneCaptureFile
+{
+public:
+	SceneCaptureFile(void);
+	~SceneCaptureFile(void);
+
+	/** Writes the given frames. Names longer than SCENECAPTURE_NAME_LENGTH get cut. */
+	static XRESULT Write(const std::string& file,
+		const std::string& worldName,
+		const std::vector<std::string>& names,
+		const std::vector<SceneCaptureFrameData>& frames);
+
+	/** Reads and validates the given file */
+	XRESULT Open(const std::string& file);
+
+	/** Frees the loaded data. All pointers returned by this get invalid. */
+	void Close();
+
+	/** Returns the world the capture was made in */
+	std::string GetWorldName(){return Header->WorldName;}
+
+	/** Returns the table of frames */
+	const SceneCaptureFrame& GetFrame(unsigned int i){return ((const SceneCaptureFrame*)&Data[Header->FrameTableOffset])[i];}
+	unsigned int GetNumFrames(){return Header->NumFrames;}
+
+	/** Returns the i-th entry of the name table */
+	const char* GetName(unsigned int i){return ((const SceneCaptureName*)&Data[Header->NameTableOffset])[i].Name;}
+	unsigned int GetNumNames(){return Header->NumNames;}
+
+	/** Returns the arrays of the given frame */
+	const SceneCaptureVob* GetVobs(const SceneCaptureFrame& frame){return (const SceneCaptureVob*)&Data[frame.VobOffset];}
+	const SceneCaptureVob* GetSkeletalVobs(const SceneCaptureFrame& frame){return (const SceneCaptureVob*)&Data[frame.SkeletalVobOffset];}
+	const SceneCaptureLight* GetLights(const SceneCaptureFrame& frame){return (const SceneCaptureLight*)&Data[frame.LightOffset];}
+	const SceneCaptureParticleGroup* GetParticleGroups(const SceneCaptureFrame& frame){return (const SceneCaptureParticleGroup*)&Data[frame.ParticleGroupOffset];}
+	const ParticleInstanceInfo* GetParticles(const SceneCaptureFrame& frame){return (const ParticleInstanceInfo*)&Data[frame.ParticleOffset];}
+	const SceneCaptureSection* GetSections(const SceneCaptureFrame& frame){return (const SceneCaptureSection*)&Data[frame.SectionOffset];}
+
+private:
+	/** Whole file, read at once */
+	std::vector<unsigned char> Data;
+	const SceneCaptureHeader* Header;
+};
@@ -6,6 +6,12 @@ cbuffer cbPerCubeRender : register( b2 )
 	matrix PCR_ViewProj[6];
 };
 
+cbuffer cbPerCubeDraw : register( b3 )
+{
+	uint PCD_FaceMask; // Bit f is set if the drawcall can be seen in face f
+	float3 PCD_Pad;
+};
+
 struct PS_INPUT
 {
 	float2 vTexcoord		: TEXCOORD0;
@@ -26,17 +32,39 @@ struct PS_INPUT
 	float4 vWorldPosition	: TEXCOORD5;
 }; */
 
+/** Returns true if the triangle lies completely outside one of the side-planes of a face */
+bool IsOutsideFace(float4 p0, float4 p1, float4 p2)
+{
+	float3 x = float3(p0.x, p1.x, p2.x);
+	float3 y = float3(p0.y, p1.y, p2.y);
+	float3 w = float3(p0.w, p1.w, p2.w);
+	
+	return all(x > w) || all(x < -w) || all(y > w) || all(y < -w);
+}
+
 [maxvertexcount(18)]
 void GSMain(triangle VS_OUTPUT input[3], inout TriangleStream<PS_INPUT> OutputStream)
 {
     for( int f = 0; f < 6; ++f )
     {
+		// Skip the faces the drawcall can't be seen in
+		if((PCD_FaceMask & (1u << f)) == 0)
+			continue;
+	
+		float4 clipPosition[3];
+		for( int c = 0; c < 3; c++ )
+			clipPosition[c] = mul( float4(input[c].vWorldPosition, 1), PCR_ViewProj[f] );
+			
+		// Don't emit triangles the face can't see
+		if(IsOutsideFace(clipPosition[0], clipPosition[1], clipPosition[2]))
+			continue;
+	
         // Compute screen coordinates
         PS_INPUT output;
         output.RTIndex = f;
         for( int v = 0; v < 3; v++ )
         {
-            output.vPosition = mul( float4(input[v].vWorldPosition, 1), PCR_ViewProj[f] );
+            output.vPosition = clipPosition[v];
             output.vTexcoord = input[v].vTexcoord;
 			output.vTexcoord2 = input[v].vTexcoord2;
 			output.vDiffuse = input[v].vDiffuse;
@@ -47,4 +75,4 @@ void GSMain(triangle VS_OUTPUT input[3], inout TriangleStream<PS_INPUT> OutputSt
         }
         OutputStream.RestartStrip();
     }
-}
\ No newline at end of file
+}
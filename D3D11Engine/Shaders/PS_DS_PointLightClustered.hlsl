@@ -0,0 +1,200 @@
+//--------------------------------------------------------------------------------------
+// Full-screen pass applying all pointlights, using the lights binned into the clusters of the view
+//--------------------------------------------------------------------------------------
+#include <DS_Defines.h>
+
+cbuffer DS_PointLightClusteredConstantBuffer : register( b0 )
+{
+	matrix PLC_InvProj;
+	matrix PLC_InvView;
+
+	float2 PLC_ViewportSize;
+	float PLC_ClusterNear;
+	float PLC_ClusterSliceScale; // Turns log(z / near) into the slice
+
+	float2 PLC_NumTiles;
+	float PLC_NumSlices;
+	float PLC_Pad;
+};
+
+/** Same layout as ClusteredPointLight */
+struct ClusteredPointLight
+{
+	float3 PositionView;
+	float Range;
+	float3 Color;
+	float ShadowCubeIndex; // -1 if the light has no shadow
+	float3 PositionWorld;
+	float Pad;
+};
+
+static const float BLUR_SCALE = 0.029f;
+static const int BLUR_COUNT = 8;
+static const float3 BLUR_OFFSETS[] =
+{
+float3(	0.054426466605825*2-1	,
+		0.057144871008184*2-1	,
+		0.57025665350736*2-1	),
+float3(	0.32904030165125*2-1	,
+		0.22406590786952*2-1	,
+		0.76940122329136*2-1	),
+float3(	0.90462177475198*2-1	,
+		0.091382070021416*2-1	,
+		0.0065345494107038*2-1	),
+float3(	0.93540243382352*2-1	,
+		0.61764284391778*2-1	,
+		0.103979589466*2-1		),
+float3(	0.44626536287659*2-1	,
+		0.19266830440269*2-1	,
+		0.73062449308607*2-1	),
+float3(	0.0084832706528172*2-1	,
+		0.83200742948428*2-1	,
+		0.43927977813374*2-1	),
+float3(	0.28579624476181*2-1	,
+		0.57096250149001*2-1	,
+		0.0095401159532089*2-1	),
+float3(	0.55814247604373*2-1	,
+		0.59385285228205*2-1	,
+		0.44374119743879*2-1	)
+};
+
+//--------------------------------------------------------------------------------------
+// Textures and Samplers
+//--------------------------------------------------------------------------------------
+SamplerState SS_Linear : register( s0 );
+SamplerState SS_samMirror : register( s1 );
+SamplerComparisonState SS_Comp : register( s2 );
+Texture2D	TX_Diffuse : register( t0 );
+Texture2D	TX_Nrm_SI_SP : register( t1 );
+Texture2D	TX_Depth : register( t2 );
+TextureCubeArray	TX_ShadowCubes : register( t3 );
+StructuredBuffer<ClusteredPointLight> SB_Lights : register( t4 );
+StructuredBuffer<uint2> SB_ClusterRanges : register( t5 ); // Offset and count into SB_LightIndices
+StructuredBuffer<uint> SB_LightIndices : register( t6 );
+
+//--------------------------------------------------------------------------------------
+// Input / Output structures
+//--------------------------------------------------------------------------------------
+struct PS_INPUT
+{
+	float2 vTexCoord 		: TEXCOORD0;
+	float3 vEyeRay			: TEXCOORD1;
+	float4 vPosition		: SV_POSITION;
+};
+
+float3 VSPositionFromDepth(float depth, float2 vTexCoord)
+{
+    // Get the depth value for this pixel
+    float z = depth;
+    // Get x/w and y/w from the viewport position
+    float x = vTexCoord.x * 2 - 1;
+    float y = (1 - vTexCoord.y) * 2 - 1;
+    float4 vProjectedPos = float4(x, y, z, 1.0f);
+    // Transform by the inverse projection matrix
+    float4 vPositionVS = mul(vProjectedPos, PLC_InvProj); //invViewProj == invProjection here
+    // Divide by w to get the view-space position
+    return vPositionVS.xyz / vPositionVS.w;
+}
+
+//--------------------------------------------------------------------------------------
+// Blinn-Phong Lighting Reflection Model
+//--------------------------------------------------------------------------------------
+float CalcBlinnPhongLighting(float3 N, float3 H )
+{
+    return saturate(dot(N,H));
+}
+
+/** Same as in PS_DS_PointLightDynShadow */
+float IsInShadow(float3 wsPosition, ClusteredPointLight light, float bias = 0.01f)
+{
+	float3 dir = normalize(wsPosition - light.PositionWorld);
+	float distance = length(wsPosition - light.PositionWorld) / (light.Range * 2.0f);
+
+	float shd = 0;
+	for(int i=0;i<BLUR_COUNT;i++)
+	{
+		shd += TX_ShadowCubes.SampleCmpLevelZero(SS_Comp, float4(dir + BLUR_OFFSETS[i] * BLUR_SCALE, light.ShadowCubeIndex), distance - bias);
+	}
+
+	return shd / BLUR_COUNT;
+}
+
+/** Lighting of a single light, like PS_DS_PointLight computes it */
+float3 ApplyPointLight(ClusteredPointLight light, float3 vsPosition, float3 wsPosition, float3 normal, float4 diffuse, float specIntensity, float specPower)
+{
+	// Get direction and distance from the light to that position
+	float3 lightDir = light.PositionView - vsPosition;
+	float distance = length(lightDir);
+	lightDir /= distance; // Normalize the direction
+
+	// Do some simple NdL-Lighting
+	float ndl = max(0, dot(lightDir, normal));
+
+	// Compute range falloff
+	float falloff = pow(saturate(1.0f - (distance / light.Range)), 1.2f);
+
+	// Compute specular lighting
+	float3 V = normalize(-light.PositionView);
+	float3 H = normalize(lightDir + V );
+	float spec = CalcBlinnPhongLighting(normal, H);
+	float specMod = pow(dot(float3(0.333f,0.333f,0.333f), diffuse.rgb), 2);
+	float3 specBare = pow(spec, specPower) * specIntensity * light.Color * falloff;
+	float3 specColored = lerp(specBare, specBare * diffuse.rgb, specMod);
+
+	float3 color = falloff * ndl * light.Color;
+	color = saturate(color);
+
+	// Blend this with the lights color and the worlds diffuse color
+	// Also apply specular lighting
+	float3 lighting = color * diffuse.rgb + specColored;
+
+	if(light.ShadowCubeIndex >= 0.0f)
+		lighting *= IsInShadow(wsPosition, light);
+
+	// Every light-volume used to be blended on its own
+	return saturate(lighting);
+}
+
+//--------------------------------------------------------------------------------------
+// Pixel Shader
+//--------------------------------------------------------------------------------------
+float4 PSMain( PS_INPUT Input ) : SV_TARGET
+{
+	// Get screen UV
+	float2 uv = Input.vPosition.xy / PLC_ViewportSize;
+
+	// Reconstruct VS World Position from depth
+	float expDepth = TX_Depth.Sample(SS_Linear, uv).r;
+	float3 vsPosition = VSPositionFromDepth(expDepth, uv);
+
+	// Find the cluster of this pixel
+	uint2 tile = min(uint2(uv * PLC_NumTiles), uint2(PLC_NumTiles) - 1);
+	uint slice = (uint)clamp(floor(log(vsPosition.z / PLC_ClusterNear) * PLC_ClusterSliceScale), 0, PLC_NumSlices - 1);
+	uint2 range = SB_ClusterRanges[(slice * (uint)PLC_NumTiles.y + tile.y) * (uint)PLC_NumTiles.x + tile.x];
+
+	if(range.y == 0)
+		discard;
+
+	// Look up the diffuse color
+	float4 diffuse = TX_Diffuse.Sample(SS_Linear, uv);
+
+	// Get the second GBuffer
+	float4 gb2 = TX_Nrm_SI_SP.Sample(SS_Linear, uv);
+
+	// Decode the view-space normal back
+	float3 normal = normalize(DecodeNormal(gb2.xy));
+
+	// Get specular parameters
+	float specIntensity = gb2.z;
+	float specPower = gb2.w;
+
+	float3 wsPosition = mul(float4(vsPosition,1), PLC_InvView).xyz;
+
+	float3 lighting = 0;
+	for(uint i=0;i<range.y;i++)
+	{
+		lighting += ApplyPointLight(SB_Lights[SB_LightIndices[range.x + i]], vsPosition, wsPosition, normal, diffuse, specIntensity, specPower);
+	}
+
+	return float4(lighting,1);
+}
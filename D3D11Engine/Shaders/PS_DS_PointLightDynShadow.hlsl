@@ -20,7 +20,7 @@ cbuffer DS_PointLightConstantBuffer : register( b0 )
 	matrix PL_InvView; // Optimize out!
 	
 	float3 PL_LightScreenPos;
-	float PL_Pad3;
+	float PL_ShadowCubeIndex;
 	
 	matrix PL_ShadowView; // Optimize out!
 	matrix PL_ShadowProj; // Optimize out!
@@ -76,7 +76,7 @@ SamplerComparisonState SS_Comp : register( s2 );
 Texture2D	TX_Diffuse : register( t0 );
 Texture2D	TX_Nrm_SI_SP : register( t1 );
 Texture2D	TX_Depth : register( t2 );
-TextureCube	TX_ShadowCube : register( t3 );
+TextureCubeArray	TX_ShadowCubes : register( t3 ); // All pointlight shadows, PL_ShadowCubeIndex selects ours
 
 //--------------------------------------------------------------------------------------
 // Input / Output structures
@@ -108,7 +108,7 @@ float CalcBlinnPhongLighting(float3 N, float3 H )
     return saturate(dot(N,H));
 }
 
-float IsInShadow(float3 wsPosition, TextureCube shadowCube, SamplerComparisonState samplerState, float bias = 0.01f)
+float IsInShadow(float3 wsPosition, TextureCubeArray shadowCubes, float cubeIndex, SamplerComparisonState samplerState, float bias = 0.01f)
 {
 	float4 vShadowSamplingPos = mul(float4(wsPosition, 1), mul(PL_ShadowView, PL_ShadowProj));
 	
@@ -136,7 +136,7 @@ float IsInShadow(float3 wsPosition, TextureCube shadowCube, SamplerComparisonSta
 	float shd = 0;
 	for(int i=0;i<BLUR_COUNT;i++)
 	{
-		shd += shadowCube.SampleCmpLevelZero(samplerState, dir + BLUR_OFFSETS[i] * BLUR_SCALE, distance - bias);
+		shd += shadowCubes.SampleCmpLevelZero(samplerState, float4(dir + BLUR_OFFSETS[i] * BLUR_SCALE, cubeIndex), distance - bias);
 	}
 	shd /= BLUR_COUNT;
 	return shd;
@@ -190,7 +190,7 @@ float4 PSMain( PS_INPUT Input ) : SV_TARGET
 	float ndl = max(0, dot(lightDir, normal));
 	
 	// Apply dynamic shadow
-	float shadow = IsInShadow(wsPosition, TX_ShadowCube, SS_Comp);
+	float shadow = IsInShadow(wsPosition, TX_ShadowCubes, PL_ShadowCubeIndex, SS_Comp);
 	//return float4(ndl.rrr,1);
 	
 	// Get rid of lighting on the backfaces of normalmapped surfaces
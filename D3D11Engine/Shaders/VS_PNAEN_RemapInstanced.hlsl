@@ -0,0 +1,73 @@
+//--------------------------------------------------------------------------------------
+// Simple vertex shader
+//--------------------------------------------------------------------------------------
+
+cbuffer Matrices_PerFrame : register( b0 )
+{
+	matrix M_View;
+	matrix M_Proj;
+	matrix M_ViewProj;
+};
+
+//--------------------------------------------------------------------------------------
+// Input / Output structures
+//--------------------------------------------------------------------------------------
+struct VS_INPUT
+{
+	float3 vPosition	: POSITION;
+	float3 vNormal		: NORMAL;
+	float2 vTex1		: TEXCOORD0;
+	float2 vTex2		: TEXCOORD1;
+	float4 vDiffuse		: DIFFUSE;
+	uint InstanceRemapIndex : INSTANCE_REMAP_INDEX;
+};
+
+struct InstanceData
+{
+	float4x4 InstanceWorldMatrix;
+	uint InstanceColor;
+	uint pad[3];
+};
+
+struct VS_OUTPUT
+{
+	float3 vViewPosition	: TEXCOORD0;
+	float3 vNormalWS		: TEXCOORD1;
+	float3 vNormalVS		: TEXCOORD2;
+	float2 vTexcoord		: TEXCOORD3;
+	float2 vTexcoord2		: TEXCOORD4;
+	float4 vDiffuse			: TEXCOORD5;
+};
+
+/** Structured buffer for the remapped instances */
+StructuredBuffer<InstanceData> InstanceSB : register(t0);
+
+float4 DWORDToFloat4(uint color)
+{
+	float a = (color >> 24) / 255.0f;
+	float r = ((color >> 16) & 0xFF) / 255.0f;
+	float g = ((color >> 8 ) & 0xFF) / 255.0f;
+	float b = (color & 0xFF) / 255.0f;
+
+	return float4(r,g,b,a);
+}
+
+//--------------------------------------------------------------------------------------
+// Vertex Shader
+//--------------------------------------------------------------------------------------
+VS_OUTPUT VSMain( VS_INPUT Input )
+{
+	VS_OUTPUT Output;
+
+	// Get instancedata from our buffer
+	InstanceData inst = InstanceSB[Input.InstanceRemapIndex];
+
+	Output.vTexcoord = Input.vTex1;
+	Output.vTexcoord2 = Input.vTex2;
+	Output.vNormalVS = normalize(mul(Input.vNormal, (float3x3)mul(inst.InstanceWorldMatrix, M_View)));
+	Output.vNormalWS = normalize(mul(Input.vNormal, (float3x3)inst.InstanceWorldMatrix));
+	Output.vViewPosition = mul(float4(Input.vPosition,1), mul(inst.InstanceWorldMatrix, M_View)).xyz;
+	Output.vDiffuse = DWORDToFloat4(inst.InstanceColor);
+
+	return Output;
+}
@@ -0,0 +1,573 @@
+#include "pch.h"
+#include "TextureCacheFile.h"
+#include "TextureConversion.h"
+#include "Engine.h"
+#include "ThreadPool.h"
+#include <squish.h>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+
+/** Folder all cache-files go to */
+static const char* TEXCACHE_FOLDER = "system\\GD3D11\\textures\\cache";
+
+/** Header of a DDS-file, right after the "DDS " magic */
+struct TextureCacheDDSHeader
+{
+	DWORD Size;
+	DWORD Flags;
+	DWORD Height;
+	DWORD Width;
+	DWORD PitchOrLinearSize;
+	DWORD Depth;
+	DWORD MipMapCount;
+	DWORD Reserved1[11];
+	DWORD PFSize;
+	DWORD PFFlags;
+	DWORD PFFourCC;
+	DWORD PFRGBBitCount;
+	DWORD PFRBitMask;
+	DWORD PFGBitMask;
+	DWORD PFBBitMask;
+	DWORD PFABitMask;
+	DWORD Caps;
+	DWORD Caps2;
+	DWORD Caps3;
+	DWORD Caps4;
+	DWORD Reserved2;
+};
+
+const unsigned int DDS_MAGIC = 0x20534444; // "DDS "
+const DWORD DDS_PF_ALPHAPIXELS = 0x1;
+const DWORD DDS_PF_FOURCC = 0x4;
+const DWORD DDS_CAPS2_CUBEMAP = 0x200;
+const DWORD DDS_CAPS2_VOLUME = 0x200000;
+
+/** Keys which are currently compressed on a worker thread */
+static std::mutex PendingKeysMutex;
+static std::set<unsigned __int64> PendingKeys;
+
+/** Bytes in the cache-folder as of the last trim, plus everything saved since */
+static std::atomic<unsigned __int64> CacheSize(0);
+
+/** Set while a trim is running */
+static std::atomic<bool> TrimPending(false);
+
+/** Returns the size of the blocks of the given mip-level */
+static unsigned int GetCacheMipSize(unsigned int width, unsigned int height, unsigned int mip, bool dxt1)
+{
+	return Toolbox::GetDDSStorageRequirements(std::max(1u, width >> mip), std::max(1u, height >> mip), dxt1);
+}
+
+/** Compresses one mip-level. Every block-row is a work-item for the worker threads. */
+static void CompressCacheMip(const unsigned char* rgba, unsigned int width, unsigned int height, unsigned char* dst, int flags)
+{
+	unsigned int blocksX = (width + 3) / 4;
+	unsigned int blocksY = (height + 3) / 4;
+	unsigned int blockSize = (flags & squish::kDxt1) ? 8 : 16;
+
+	auto compressRow = [&](unsigned int by)
+	{
+		for(unsigned int bx=0;bx<blocksX;bx++)
+		{
+			// Gather the 4x4 pixels of this block. Pixels outside of small mip-levels are masked out.
+			unsigned char block[16 * 4];
+			int mask = 0;
+			for(unsigned int py=0;py<4;py++)
+			{
+				for(unsigned int px=0;px<4;px++)
+				{
+					unsigned int x = bx * 4 + px;
+					unsigned int y = by * 4 + py;
+					unsigned int i = py * 4 + px;
+
+					if(x < width && y < height)
+					{
+						memcpy(&block[i * 4], &rgba[(y * width + x) * 4], 4);
+						mask |= 1 << i;
+					}else
+					{
+						memset(&block[i * 4], 0, 4);
+					}
+				}
+			}
+
+			squish::CompressMasked(block, mask, dst + (by * blocksX + bx) * blockSize, flags);
+		}
+	};
+
+	// Don't bother the workers for the tiny levels
+	if(Engine::WorkerThreadPool && blocksY > 4)
+	{
+		Engine::WorkerThreadPool->parallel_for(0, blocksY, 0, compressRow);
+	}else
+	{
+		for(unsigned int by=0;by<blocksY;by++)
+			compressRow(by);
+	}
+}
+
+/** Collects all DDS-files in the given folder and its subfolders */
+static void FindCacheDDSFiles(const std::string& folder, std::vector<std::string>& files)
+{
+	WIN32_FIND_DATAA data;
+	HANDLE h = FindFirstFileA((folder + "\\*").c_str(), &data);
+	if(h == INVALID_HANDLE_VALUE)
+		return;
+
+	do
+	{
+		std::string name = data.cFileName;
+		if(name == "." || name == "..")
+			continue;
+
+		if(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+		{
+			FindCacheDDSFiles(folder + "\\" + name, files);
+		}else if(name.size() > 4 && _stricmp(name.c_str() + name.size() - 4, ".dds") == 0)
+		{
+			files.push_back(folder + "\\" + name);
+		}
+	}while(FindNextFileA(h, &data));
+
+	FindClose(h);
+}
+
+/** Marks the given cache-file as used just now. Trimming deletes the files with the oldest write-time first. */
+static void TouchCacheFile(const std::string& file)
+{
+	HANDLE h = CreateFileA(file.c_str(), FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+	if(h == INVALID_HANDLE_VALUE)
+		return;
+
+	FILETIME now;
+	GetSystemTimeAsFileTime(&now);
+	SetFileTime(h, NULL, NULL, &now);
+	CloseHandle(h);
+}
+
+TextureCacheFile::TextureCacheFile(void)
+{
+	ZeroMemory(&Header, sizeof(Header));
+}
+
+TextureCacheFile::~TextureCacheFile(void)
+{
+}
+
+/** Returns the key of a texture built from the given source-data */
+unsigned __int64 TextureCacheFile::ComputeKey(const void* source, unsigned int sourceSize, unsigned int sourceFormat, unsigned int width, unsigned int height, unsigned int numMips, ETextureCacheUsage usage)
+{
+	// Everything which changes the output goes into the key
+	unsigned int params[] = {TEXCACHE_VERSION, sourceFormat, width, height, numMips, (unsigned int)usage};
+
+	unsigned __int64 key = Toolbox::HashData(params, sizeof(params));
+	return Toolbox::HashData(source, sourceSize, key);
+}
+
+/** Returns the path of the cache-file for the given key */
+std::string TextureCacheFile::GetCachePath(unsigned __int64 key)
+{
+	char name[32];
+	sprintf_s(name, "%016llx.gtc", key);
+
+	return std::string(TEXCACHE_FOLDER) + "\\" + name;
+}
+
+/** Returns true if the given size can be stored as BC-blocks */
+bool TextureCacheFile::CanCompress(unsigned int width, unsigned int height)
+{
+	// D3D11 wants the top level of block-compressed textures to be made of whole blocks
+	return width && height && (width % 4) == 0 && (height % 4) == 0;
+}
+
+/** Returns the number of mip-levels of a full chain for the given size */
+unsigned int TextureCacheFile::GetFullMipCount(unsigned int width, unsigned int height)
+{
+	unsigned int numMips = 1;
+	while(width > 1 || height > 1)
+	{
+		width = std::max(1u, width / 2);
+		height = std::max(1u, height / 2);
+		numMips++;
+	}
+
+	return numMips;
+}
+
+/** Reads an uncompressed DDS-file and computes its key from the raw bytes */
+XRESULT TextureCacheFile::ReadDDS(const std::string& file, ETextureCacheUsage usage, TextureCacheSource& source)
+{
+	FILE* f = fopen(file.c_str(), "rb");
+	if(!f)
+		return XR_FAILED;
+
+	fseek(f, 0, SEEK_END);
+	long fileSize = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	if(fileSize < (long)(sizeof(unsigned int) + sizeof(TextureCacheDDSHeader)))
+	{
+		fclose(f);
+		return XR_FAILED;
+	}
+
+	std::vector<unsigned char>& bytes = source.File;
+	bytes.resize(fileSize);
+	size_t read = fread(&bytes[0], 1, bytes.size(), f);
+	fclose(f);
+
+	if(read != bytes.size() || *(unsigned int*)&bytes[0] != DDS_MAGIC)
+		return XR_FAILED;
+
+	const TextureCacheDDSHeader* dds = (const TextureCacheDDSHeader*)&bytes[sizeof(unsigned int)];
+
+	// Already compressed files and the ones with a DX10-header are left to D3DX, as well as cubemaps and volumes
+	if((dds->PFFlags & DDS_PF_FOURCC) || (dds->Caps2 & (DDS_CAPS2_CUBEMAP | DDS_CAPS2_VOLUME)))
+		return XR_FAILED;
+
+	DWORD alphaMask = (dds->PFFlags & DDS_PF_ALPHAPIXELS) ? dds->PFABitMask : 0;
+	ETexturePixelFormat format = TextureConversion::GetPixelFormat(dds->PFRBitMask, dds->PFGBitMask, dds->PFBBitMask, alphaMask);
+	if(format == TPF_X8R8G8B8 && dds->PFRGBBitCount == 24)
+		format = TPF_R8G8B8;
+
+	if(format == TPF_UNKNOWN || TextureConversion::GetBytesPerPixel(format) * 8 != dds->PFRGBBitCount)
+		return XR_FAILED;
+
+	unsigned int srcPitch = dds->Width * TextureConversion::GetBytesPerPixel(format);
+	unsigned int dataOffset = sizeof(unsigned int) + sizeof(TextureCacheDDSHeader);
+	if(!dds->Width || !dds->Height || (unsigned __int64)srcPitch * dds->Height > bytes.size() - dataOffset)
+		return XR_FAILED;
+
+	source.Width = dds->Width;
+	source.Height = dds->Height;
+	source.NumMips = GetFullMipCount(source.Width, source.Height);
+	source.FileFormat = format;
+	source.FileDataOffset = dataOffset;
+
+	// ABGR-files without alpha may have anything in there
+	source.FileForceOpaque = format == TPF_A8B8G8R8 && !alphaMask;
+
+	// The whole file is the source, so a changed header changes the key as well
+	source.Key = ComputeKey(&bytes[0], bytes.size(), 0, source.Width, source.Height, source.NumMips, usage);
+
+	return XR_SUCCESS;
+}
+
+/** Turns the file read by ReadDDS into RGBA8 */
+void TextureCacheFile::DecodeDDS(TextureCacheSource& source)
+{
+	if(source.File.empty())
+		return;
+
+	source.RGBA.resize(source.Width * source.Height * 4);
+
+	// Mips stored in the file are ignored, the cache builds its own
+	unsigned int srcPitch = source.Width * TextureConversion::GetBytesPerPixel(source.FileFormat);
+	TextureConversion::ConvertToRGBA8(source.FileFormat, &source.File[source.FileDataOffset], srcPitch, &source.RGBA[0], source.Width * 4, source.Width, source.Height);
+
+	if(source.FileForceOpaque)
+	{
+		for(unsigned int i=3;i<source.RGBA.size();i+=4)
+			source.RGBA[i] = 255;
+	}
+
+	// Not needed anymore, the RGBA-data may live on in a background job
+	std::vector<unsigned char>().swap(source.File);
+}
+
+/** Compresses the given RGBA8-image and all its mip-levels */
+XRESULT TextureCacheFile::Compress(const unsigned char* rgba, unsigned int width, unsigned int height, unsigned int numMips, ETextureCacheUsage usage, unsigned __int64 key)
+{
+	if(!CanCompress(width, height) || !numMips)
+		return XR_FAILED;
+
+	// BC1 has no room for smooth alpha, take BC3 if any pixel needs it
+	bool hasAlpha = false;
+	for(unsigned int i=3;i<width * height * 4;i+=4)
+	{
+		if(rgba[i] != 255)
+		{
+			hasAlpha = true;
+			break;
+		}
+	}
+
+	int flags = hasAlpha ? squish::kDxt5 : squish::kDxt1;
+	flags |= squish::kColourClusterFit;
+	flags |= usage == TCU_NORMALMAP ? squish::kColourMetricUniform : squish::kColourMetricPerceptual;
+
+	ZeroMemory(&Header, sizeof(Header));
+	Header.Magic = TEXCACHE_MAGIC;
+	Header.Version = TEXCACHE_VERSION;
+	Header.Format = hasAlpha ? DXGI_FORMAT_BC3_UNORM : DXGI_FORMAT_BC1_UNORM;
+	Header.Width = width;
+	Header.Height = height;
+	Header.NumMips = numMips;
+	Header.Key = key;
+
+	for(unsigned int i=0;i<numMips;i++)
+		Header.DataSize += GetCacheMipSize(width, height, i, !hasAlpha);
+
+	Data.resize(Header.DataSize);
+
+	// Compress a level, then filter it down for the next one
+	std::vector<unsigned char> level;
+	std::vector<unsigned char> nextLevel;
+	const unsigned char* src = rgba;
+	unsigned int offset = 0;
+	for(unsigned int i=0;i<numMips;i++)
+	{
+		unsigned int w = std::max(1u, width >> i);
+		unsigned int h = std::max(1u, height >> i);
+
+		CompressCacheMip(src, w, h, &Data[offset], flags);
+		offset += GetCacheMipSize(width, height, i, !hasAlpha);
+
+		if(i + 1 < numMips)
+		{
+			nextLevel.resize(std::max(1u, w / 2) * std::max(1u, h / 2) * 4);
+			TextureConversion::GenerateMipRGBA8(src, w, h, &nextLevel[0]);
+
+			level.swap(nextLevel);
+			src = &level[0];
+		}
+	}
+
+	Header.DataHash = Toolbox::HashData(&Data[0], Data.size());
+
+	return XR_SUCCESS;
+}
+
+/** Compresses the given source on a worker thread and saves it to the cache */
+void TextureCacheFile::CompressInBackground(TextureCacheSource& source, ETextureCacheUsage usage)
+{
+	if(!Engine::WorkerThreadPool || !CanCompress(source.Width, source.Height))
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(PendingKeysMutex);
+		if(!PendingKeys.insert(source.Key).second)
+			return; // Someone else already loaded the same data
+	}
+
+	// Move the image into the job, the caller is done with it
+	std::shared_ptr<TextureCacheSource> job = std::make_shared<TextureCacheSource>();
+	job->RGBA.swap(source.RGBA);
+	job->Width = source.Width;
+	job->Height = source.Height;
+	job->NumMips = source.NumMips;
+	job->Key = source.Key;
+
+	Engine::WorkerThreadPool->enqueue([job, usage]()
+	{
+		TextureCacheFile cache;
+		if(XR_SUCCESS == cache.Compress(&job->RGBA[0], job->Width, job->Height, job->NumMips, usage, job->Key))
+			cache.Save();
+
+		std::lock_guard<std::mutex> lock(PendingKeysMutex);
+		PendingKeys.erase(job->Key);
+	});
+}
+
+/** Compresses every uncompressed DDS-file in the given folder and its subfolders which isn't cached yet */
+void TextureCacheFile::BuildCacheForFolder(const std::string& folder)
+{
+	LogInfo() << "Building texture cache for: " << folder;
+
+	std::vector<std::string> files;
+	FindCacheDDSFiles(folder, files);
+
+	unsigned int numCompressed = 0;
+	unsigned int numCached = 0;
+	unsigned __int64 sourceBytes = 0;
+	unsigned __int64 cacheBytes = 0;
+	DWORD start = timeGetTime();
+
+	// Files one after another, the blocks of each one are spread over the workers
+	for(unsigned int i=0;i<files.size();i++)
+	{
+		std::string lower = files[i];
+		std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+		ETextureCacheUsage usage = lower.find("_normal.dds") != std::string::npos ? TCU_NORMALMAP : TCU_COLOR;
+
+		TextureCacheSource source;
+		if(XR_SUCCESS != ReadDDS(files[i], usage, source))
+			continue;
+
+		TextureCacheFile cache;
+		if(XR_SUCCESS == cache.Load(source.Key))
+		{
+			numCached++;
+			continue;
+		}
+
+		DecodeDDS(source);
+
+		if(XR_SUCCESS != cache.Compress(&source.RGBA[0], source.Width, source.Height, source.NumMips, usage, source.Key) ||
+			XR_SUCCESS != cache.Save())
+		{
+			LogWarn() << "Failed to compress texture: " << files[i];
+			continue;
+		}
+
+		numCompressed++;
+		sourceBytes += source.RGBA.size();
+		cacheBytes += cache.Header.DataSize;
+	}
+
+	LogInfo() << "Texture cache: Compressed " << numCompressed << " textures (" << numCached << " were cached already) in "
+		<< (timeGetTime() - start) << "ms, " << (sourceBytes / 1024) << "KB of top-levels went to " << (cacheBytes / 1024) << "KB with all mips";
+}
+
+/** Reads and validates the cache-file of the given key */
+XRESULT TextureCacheFile::Load(unsigned __int64 key)
+{
+	FILE* f = fopen(GetCachePath(key).c_str(), "rb");
+	if(!f)
+		return XR_FAILED;
+
+	ZeroMemory(&Header, sizeof(Header));
+	size_t read = fread(&Header, 1, sizeof(Header), f);
+
+	bool dxt1 = Header.Format == DXGI_FORMAT_BC1_UNORM;
+	bool valid = read == sizeof(Header) &&
+		Header.Magic == TEXCACHE_MAGIC &&
+		Header.Version == TEXCACHE_VERSION &&
+		Header.Key == key &&
+		(dxt1 || Header.Format == DXGI_FORMAT_BC3_UNORM) &&
+		CanCompress(Header.Width, Header.Height) &&
+		Header.NumMips && Header.NumMips <= GetFullMipCount(Header.Width, Header.Height);
+
+	// The size has to match what the header describes
+	unsigned int expectedSize = 0;
+	for(unsigned int i=0;valid && i<Header.NumMips;i++)
+		expectedSize += GetCacheMipSize(Header.Width, Header.Height, i, dxt1);
+
+	valid = valid && expectedSize == Header.DataSize;
+
+	if(valid)
+	{
+		Data.resize(Header.DataSize);
+		valid = fread(&Data[0], 1, Data.size(), f) == Data.size() &&
+			Toolbox::HashData(&Data[0], Data.size()) == Header.DataHash;
+	}
+
+	fclose(f);
+
+	if(!valid)
+	{
+		LogWarn() << "Texture cache file is invalid, rebuilding it: " << GetCachePath(key);
+		Data.clear();
+		ZeroMemory(&Header, sizeof(Header));
+		return XR_FAILED;
+	}
+
+	TouchCacheFile(GetCachePath(key));
+
+	return XR_SUCCESS;
+}
+
+/** Writes this to the cache */
+XRESULT TextureCacheFile::Save()
+{
+	if(Data.empty())
+		return XR_FAILED;
+
+	CreateDirectory("system\\GD3D11\\textures", NULL);
+	CreateDirectory(TEXCACHE_FOLDER, NULL);
+
+	// Write to a file of our own first, so nobody ever reads a half-written entry
+	std::string file = GetCachePath(Header.Key);
+	std::string tmp = file + "." + std::to_string(GetCurrentThreadId()) + ".tmp";
+
+	FILE* f = fopen(tmp.c_str(), "wb");
+	if(!f)
+	{
+		LogWarn() << "Failed to create texture cache file: " << tmp;
+		return XR_FAILED;
+	}
+
+	bool written = fwrite(&Header, sizeof(Header), 1, f) == 1 &&
+		fwrite(&Data[0], Data.size(), 1, f) == 1;
+
+	fclose(f);
+
+	if(!written || !MoveFileExA(tmp.c_str(), file.c_str(), MOVEFILE_REPLACE_EXISTING))
+	{
+		LogWarn() << "Failed to write texture cache file: " << file;
+		DeleteFileA(tmp.c_str());
+		return XR_FAILED;
+	}
+
+	if((CacheSize += sizeof(Header) + Data.size()) > (unsigned __int64)TEXCACHE_MAX_SIZE_MB * 1024 * 1024)
+		TrimInBackground();
+
+	return XR_SUCCESS;
+}
+
+/** Deletes the least recently used entries until the cache is below TEXCACHE_MAX_SIZE_MB again */
+void TextureCacheFile::TrimInBackground()
+{
+	if(!Engine::WorkerThreadPool || TrimPending.exchange(true))
+		return;
+
+	Engine::WorkerThreadPool->enqueue([]()
+	{
+		struct CacheEntry
+		{
+			std::string File;
+			unsigned __int64 Size;
+			unsigned __int64 LastUsed;
+		};
+
+		std::vector<CacheEntry> entries;
+		unsigned __int64 totalSize = 0;
+
+		WIN32_FIND_DATAA data;
+		HANDLE h = FindFirstFileA((std::string(TEXCACHE_FOLDER) + "\\*.gtc").c_str(), &data);
+		if(h != INVALID_HANDLE_VALUE)
+		{
+			do
+			{
+				if(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+					continue;
+
+				CacheEntry e;
+				e.File = std::string(TEXCACHE_FOLDER) + "\\" + data.cFileName;
+				e.Size = ((unsigned __int64)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+				e.LastUsed = ((unsigned __int64)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+				entries.push_back(e);
+
+				totalSize += e.Size;
+			}while(FindNextFileA(h, &data));
+
+			FindClose(h);
+		}
+
+		unsigned __int64 maxSize = (unsigned __int64)TEXCACHE_MAX_SIZE_MB * 1024 * 1024;
+		if(totalSize > maxSize)
+		{
+			// Go a bit further down, so the next few saves don't need a trim right away
+			unsigned __int64 targetSize = maxSize / 10 * 9;
+
+			std::sort(entries.begin(), entries.end(), [](const CacheEntry& a, const CacheEntry& b){ return a.LastUsed < b.LastUsed; });
+
+			unsigned int numDeleted = 0;
+			for(unsigned int i=0;i<entries.size() && totalSize > targetSize;i++)
+			{
+				// Files being read right now can't be deleted, they just stay
+				if(DeleteFileA(entries[i].File.c_str()))
+				{
+					totalSize -= entries[i].Size;
+					numDeleted++;
+				}
+			}
+
+			LogInfo() << "Texture cache: Deleted " << numDeleted << " least recently used entries, " << (totalSize / (1024 * 1024)) << "MB left";
+		}
+
+		CacheSize = totalSize;
+		TrimPending = false;
+	});
+}
@@ -0,0 +1,112 @@
+#pragma once
+#include "pch.h"
+#include "TextureConversion.h"
+
+/** Current version of the .gtc-format. Part of every key, so bumping it makes all old entries unreachable. */
+const int TEXCACHE_VERSION = 1;
+
+/** Size the cache-folder may grow to. The least recently used entries are deleted once it gets bigger. */
+const unsigned int TEXCACHE_MAX_SIZE_MB = 1024;
+
+/** "GTCH" */
+const unsigned int TEXCACHE_MAGIC = 0x48435447;
+
+/** What a cached texture is used for. Decides how squish weighs the color-channels. */
+enum ETextureCacheUsage
+{
+	TCU_COLOR, // Perceptual metric
+	TCU_NORMALMAP, // Uniform metric, all channels carry data
+};
+
+/** Header of a cache-file. The blocks of all mip-levels follow it, from the largest to the smallest. */
+struct TextureCacheHeader
+{
+	unsigned int Magic;
+	int Version;
+	unsigned int Format; // DXGI_FORMAT of the blocks
+	unsigned int Width;
+	unsigned int Height;
+	unsigned int NumMips;
+	unsigned int DataSize;
+	unsigned int Reserved;
+	unsigned __int64 Key; // Key the file is stored under
+	unsigned __int64 DataHash; // Hash of everything after this header
+};
+
+/** Uncompressed image that can be put into the cache */
+struct TextureCacheSource
+{
+	std::vector<unsigned char> RGBA; // Top mip-level only
+	unsigned int Width;
+	unsigned int Height;
+	unsigned int NumMips;
+	unsigned __int64 Key;
+
+	// Set by ReadDDS, until DecodeDDS turned the file into RGBA
+	std::vector<unsigned char> File;
+	ETexturePixelFormat FileFormat;
+	unsigned int FileDataOffset;
+	bool FileForceOpaque; // Alpha-bits of the file carry no data
+};
+
+/** Content-addressed on-disk cache of BC-compressed, mipmapped textures. Every entry is stored under the hash of the
+	data it was built from, so equal textures share one file and changed sources never hit a stale entry. */
+class TextureCacheFile
+{
+public:
+	TextureCacheFile(void);
+	~TextureCacheFile(void);
+
+	/** Returns the key of a texture built from the given source-data. sourceFormat tells apart sources with equal bytes but different layouts. */
+	static unsigned __int64 ComputeKey(const void* source, unsigned int sourceSize, unsigned int sourceFormat, unsigned int width, unsigned int height, unsigned int numMips, ETextureCacheUsage usage);
+
+	/** Returns the path of the cache-file for the given key */
+	static std::string GetCachePath(unsigned __int64 key);
+
+	/** Reads an uncompressed DDS-file and computes its key from the raw bytes, without decoding the pixels. Fails for
+		everything the cache can't take, like block-compressed files or unknown pixel-formats. Those should be loaded as they are. */
+	static XRESULT ReadDDS(const std::string& file, ETextureCacheUsage usage, TextureCacheSource& source);
+
+	/** Turns the file read by ReadDDS into RGBA8. Only needed if the texture wasn't in the cache. */
+	static void DecodeDDS(TextureCacheSource& source);
+
+	/** Returns true if the given size can be stored as BC-blocks */
+	static bool CanCompress(unsigned int width, unsigned int height);
+
+	/** Returns the number of mip-levels of a full chain for the given size */
+	static unsigned int GetFullMipCount(unsigned int width, unsigned int height);
+
+	/** Compresses the given RGBA8-image and all its mip-levels. Spreads the blocks over the worker threads.
+		Picks BC1, or BC3 if the image isn't fully opaque. */
+	XRESULT Compress(const unsigned char* rgba, unsigned int width, unsigned int height, unsigned int numMips, ETextureCacheUsage usage, unsigned __int64 key);
+
+	/** Compresses the given source on a worker thread and saves it to the cache. Does nothing if the key is already being worked on.
+		Takes the RGBA-data of the source. */
+	static void CompressInBackground(TextureCacheSource& source, ETextureCacheUsage usage);
+
+	/** Compresses every uncompressed DDS-file in the given folder and its subfolders which isn't cached yet */
+	static void BuildCacheForFolder(const std::string& folder);
+
+	/** Reads and validates the cache-file of the given key */
+	XRESULT Load(unsigned __int64 key);
+
+	/** Writes this to the cache. Safe to call from multiple threads, even for the same key. */
+	XRESULT Save();
+
+	/** Deletes the least recently used entries until the cache is below TEXCACHE_MAX_SIZE_MB again.
+		Runs on a worker thread, only one trim at a time. */
+	static void TrimInBackground();
+
+	/** Returns the format of the blocks */
+	DXGI_FORMAT GetFormat(){return (DXGI_FORMAT)Header.Format;}
+
+	/** Returns the number of mip-levels stored */
+	unsigned int GetNumMips(){return Header.NumMips;}
+
+	/** Returns the blocks of all mip-levels, tightly packed */
+	unsigned char* GetData(){return Data.empty() ? NULL : &Data[0];}
+
+private:
+	TextureCacheHeader Header;
+	std::vector<unsigned char> Data;
+};
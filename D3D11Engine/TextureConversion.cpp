@@ -0,0 +1,497 @@
+#include "pch.h"
+#include "TextureConversion.h"
+#include <intrin.h>
+#include <emmintrin.h>
+#include <immintrin.h>
+
+/** Kernels used right now. Picked on first use. */
+static ETextureConversionISA s_ISA = (ETextureConversionISA)-1;
+
+/** Returns the kernels to use */
+static ETextureConversionISA GetActiveISA()
+{
+	if(s_ISA == (ETextureConversionISA)-1)
+		s_ISA = TextureConversion::GetSupportedISA();
+
+	return s_ISA;
+}
+
+/** Expands the low bits of v to the full byte, so the highest value becomes 255 */
+static inline unsigned char Expand5(unsigned int v){return (unsigned char)((v << 3) | (v >> 2));}
+static inline unsigned char Expand6(unsigned int v){return (unsigned char)((v << 2) | (v >> 4));}
+static inline unsigned char Expand4(unsigned int v){return (unsigned char)((v << 4) | v);}
+
+/** Converts one row with plain C++. This is the reference the other kernels have to match. */
+static void ConvertRowScalar(ETexturePixelFormat format, const unsigned char* src, unsigned char* dst, unsigned int x, unsigned int width)
+{
+	for(;x<width;x++)
+	{
+		unsigned char* d = &dst[x * 4];
+		switch(format)
+		{
+		case TPF_R5G6B5:
+			{
+				unsigned int p = src[x * 2 + 0] | (src[x * 2 + 1] << 8);
+				d[0] = Expand5((p >> 11) & 0x1F);
+				d[1] = Expand6((p >> 5) & 0x3F);
+				d[2] = Expand5(p & 0x1F);
+				d[3] = 255;
+			}
+			break;
+
+		case TPF_X1R5G5B5:
+		case TPF_A1R5G5B5:
+			{
+				unsigned int p = src[x * 2 + 0] | (src[x * 2 + 1] << 8);
+				d[0] = Expand5((p >> 10) & 0x1F);
+				d[1] = Expand5((p >> 5) & 0x1F);
+				d[2] = Expand5(p & 0x1F);
+				d[3] = format == TPF_X1R5G5B5 || (p & 0x8000) ? 255 : 0;
+			}
+			break;
+
+		case TPF_X4R4G4B4:
+		case TPF_A4R4G4B4:
+			{
+				unsigned int p = src[x * 2 + 0] | (src[x * 2 + 1] << 8);
+				d[0] = Expand4((p >> 8) & 0xF);
+				d[1] = Expand4((p >> 4) & 0xF);
+				d[2] = Expand4(p & 0xF);
+				d[3] = format == TPF_X4R4G4B4 ? 255 : Expand4(p >> 12);
+			}
+			break;
+
+		case TPF_R8G8B8:
+			d[0] = src[x * 3 + 2];
+			d[1] = src[x * 3 + 1];
+			d[2] = src[x * 3 + 0];
+			d[3] = 255;
+			break;
+
+		case TPF_X8R8G8B8:
+		case TPF_A8R8G8B8:
+			d[0] = src[x * 4 + 2];
+			d[1] = src[x * 4 + 1];
+			d[2] = src[x * 4 + 0];
+			d[3] = format == TPF_X8R8G8B8 ? 255 : src[x * 4 + 3];
+			break;
+
+		default:
+			memcpy(d, &src[x * 4], 4);
+			break;
+		}
+	}
+}
+
+/** Expands 16-bit lanes holding 5, 6, 4 or 1 bits to 8 bits */
+static inline __m128i Expand5SSE2(__m128i v){return _mm_or_si128(_mm_slli_epi16(v, 3), _mm_srli_epi16(v, 2));}
+static inline __m128i Expand6SSE2(__m128i v){return _mm_or_si128(_mm_slli_epi16(v, 2), _mm_srli_epi16(v, 4));}
+static inline __m128i Expand4SSE2(__m128i v){return _mm_or_si128(_mm_slli_epi16(v, 4), v);}
+static inline __m128i Expand1SSE2(__m128i v){return _mm_and_si128(_mm_sub_epi16(_mm_setzero_si128(), v), _mm_set1_epi16(0xFF));}
+
+/** Interleaves the channels of 8 pixels, given as 16-bit lanes, into RGBA8 */
+static inline void StoreRGBA8SSE2(__m128i r, __m128i g, __m128i b, __m128i a, unsigned char* dst)
+{
+	__m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+	__m128i ba = _mm_or_si128(b, _mm_slli_epi16(a, 8));
+	_mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi16(rg, ba));
+	_mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi16(rg, ba));
+}
+
+/** Swaps red and blue of 4 32-bit pixels */
+static inline __m128i SwizzleBGRASSE2(__m128i p, __m128i alpha)
+{
+	__m128i ga = _mm_and_si128(p, _mm_set1_epi32(0xFF00FF00));
+	__m128i r = _mm_and_si128(_mm_srli_epi32(p, 16), _mm_set1_epi32(0xFF));
+	__m128i b = _mm_slli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xFF)), 16);
+	return _mm_or_si128(_mm_or_si128(ga, alpha), _mm_or_si128(r, b));
+}
+
+/** Converts as much of one row as fits into whole SSE2-blocks. Returns the number of pixels done. */
+static unsigned int ConvertRowSSE2(ETexturePixelFormat format, const unsigned char* src, unsigned char* dst, unsigned int width)
+{
+	const __m128i mask4 = _mm_set1_epi16(0xF);
+	const __m128i mask5 = _mm_set1_epi16(0x1F);
+	const __m128i mask6 = _mm_set1_epi16(0x3F);
+	const __m128i opaque = _mm_set1_epi16(0xFF);
+
+	unsigned int x = 0;
+	switch(format)
+	{
+	case TPF_R5G6B5:
+		for(;x + 8 <= width;x += 8)
+		{
+			__m128i p = _mm_loadu_si128((const __m128i *)&src[x * 2]);
+			StoreRGBA8SSE2(Expand5SSE2(_mm_srli_epi16(p, 11)),
+				Expand6SSE2(_mm_and_si128(_mm_srli_epi16(p, 5), mask6)),
+				Expand5SSE2(_mm_and_si128(p, mask5)),
+				opaque, &dst[x * 4]);
+		}
+		break;
+
+	case TPF_X1R5G5B5:
+	case TPF_A1R5G5B5:
+		for(;x + 8 <= width;x += 8)
+		{
+			__m128i p = _mm_loadu_si128((const __m128i *)&src[x * 2]);
+			__m128i a = format == TPF_X1R5G5B5 ? opaque : Expand1SSE2(_mm_srli_epi16(p, 15));
+			StoreRGBA8SSE2(Expand5SSE2(_mm_and_si128(_mm_srli_epi16(p, 10), mask5)),
+				Expand5SSE2(_mm_and_si128(_mm_srli_epi16(p, 5), mask5)),
+				Expand5SSE2(_mm_and_si128(p, mask5)),
+				a, &dst[x * 4]);
+		}
+		break;
+
+	case TPF_X4R4G4B4:
+	case TPF_A4R4G4B4:
+		for(;x + 8 <= width;x += 8)
+		{
+			__m128i p = _mm_loadu_si128((const __m128i *)&src[x * 2]);
+			__m128i a = format == TPF_X4R4G4B4 ? opaque : Expand4SSE2(_mm_srli_epi16(p, 12));
+			StoreRGBA8SSE2(Expand4SSE2(_mm_and_si128(_mm_srli_epi16(p, 8), mask4)),
+				Expand4SSE2(_mm_and_si128(_mm_srli_epi16(p, 4), mask4)),
+				Expand4SSE2(_mm_and_si128(p, mask4)),
+				a, &dst[x * 4]);
+		}
+		break;
+
+	case TPF_X8R8G8B8:
+	case TPF_A8R8G8B8:
+		{
+			__m128i alpha = format == TPF_X8R8G8B8 ? _mm_set1_epi32(0xFF000000) : _mm_setzero_si128();
+			for(;x + 4 <= width;x += 4)
+			{
+				__m128i p = _mm_loadu_si128((const __m128i *)&src[x * 4]);
+				_mm_storeu_si128((__m128i *)&dst[x * 4], SwizzleBGRASSE2(p, alpha));
+			}
+		}
+		break;
+
+	default:
+		break; // SSE2 has no byte-shuffle for 24-bit, the scalar kernel does those
+	}
+
+	return x;
+}
+
+/** AVX2-versions of the helpers above, for 16 pixels at once */
+static inline __m256i Expand5AVX2(__m256i v){return _mm256_or_si256(_mm256_slli_epi16(v, 3), _mm256_srli_epi16(v, 2));}
+static inline __m256i Expand6AVX2(__m256i v){return _mm256_or_si256(_mm256_slli_epi16(v, 2), _mm256_srli_epi16(v, 4));}
+static inline __m256i Expand4AVX2(__m256i v){return _mm256_or_si256(_mm256_slli_epi16(v, 4), v);}
+static inline __m256i Expand1AVX2(__m256i v){return _mm256_and_si256(_mm256_sub_epi16(_mm256_setzero_si256(), v), _mm256_set1_epi16(0xFF));}
+
+static inline void StoreRGBA8AVX2(__m256i r, __m256i g, __m256i b, __m256i a, unsigned char* dst)
+{
+	__m256i rg = _mm256_or_si256(r, _mm256_slli_epi16(g, 8));
+	__m256i ba = _mm256_or_si256(b, _mm256_slli_epi16(a, 8));
+
+	// The unpacks work inside the 128-bit halves, so put the pixels back in order
+	__m256i lo = _mm256_unpacklo_epi16(rg, ba);
+	__m256i hi = _mm256_unpackhi_epi16(rg, ba);
+	_mm256_storeu_si256((__m256i *)dst, _mm256_permute2x128_si256(lo, hi, 0x20));
+	_mm256_storeu_si256((__m256i *)(dst + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+
+static unsigned int ConvertRowAVX2(ETexturePixelFormat format, const unsigned char* src, unsigned char* dst, unsigned int width)
+{
+	const __m256i mask4 = _mm256_set1_epi16(0xF);
+	const __m256i mask5 = _mm256_set1_epi16(0x1F);
+	const __m256i mask6 = _mm256_set1_epi16(0x3F);
+	const __m256i opaque = _mm256_set1_epi16(0xFF);
+
+	unsigned int x = 0;
+	switch(format)
+	{
+	case TPF_R5G6B5:
+		for(;x + 16 <= width;x += 16)
+		{
+			__m256i p = _mm256_loadu_si256((const __m256i *)&src[x * 2]);
+			StoreRGBA8AVX2(Expand5AVX2(_mm256_srli_epi16(p, 11)),
+				Expand6AVX2(_mm256_and_si256(_mm256_srli_epi16(p, 5), mask6)),
+				Expand5AVX2(_mm256_and_si256(p, mask5)),
+				opaque, &dst[x * 4]);
+		}
+		break;
+
+	case TPF_X1R5G5B5:
+	case TPF_A1R5G5B5:
+		for(;x + 16 <= width;x += 16)
+		{
+			__m256i p = _mm256_loadu_si256((const __m256i *)&src[x * 2]);
+			__m256i a = format == TPF_X1R5G5B5 ? opaque : Expand1AVX2(_mm256_srli_epi16(p, 15));
+			StoreRGBA8AVX2(Expand5AVX2(_mm256_and_si256(_mm256_srli_epi16(p, 10), mask5)),
+				Expand5AVX2(_mm256_and_si256(_mm256_srli_epi16(p, 5), mask5)),
+				Expand5AVX2(_mm256_and_si256(p, mask5)),
+				a, &dst[x * 4]);
+		}
+		break;
+
+	case TPF_X4R4G4B4:
+	case TPF_A4R4G4B4:
+		for(;x + 16 <= width;x += 16)
+		{
+			__m256i p = _mm256_loadu_si256((const __m256i *)&src[x * 2]);
+			__m256i a = format == TPF_X4R4G4B4 ? opaque : Expand4AVX2(_mm256_srli_epi16(p, 12));
+			StoreRGBA8AVX2(Expand4AVX2(_mm256_and_si256(_mm256_srli_epi16(p, 8), mask4)),
+				Expand4AVX2(_mm256_and_si256(_mm256_srli_epi16(p, 4), mask4)),
+				Expand4AVX2(_mm256_and_si256(p, mask4)),
+				a, &dst[x * 4]);
+		}
+		break;
+
+	case TPF_R8G8B8:
+		{
+			// Move the 12 bytes of 4 pixels into each half, then spread them out to 4 bytes per pixel
+			const __m256i dwords = _mm256_setr_epi32(0, 1, 2, 0, 3, 4, 5, 0);
+			const __m256i shuffle = _mm256_setr_epi8(
+				2, 1, 0, -128, 5, 4, 3, -128, 8, 7, 6, -128, 11, 10, 9, -128,
+				2, 1, 0, -128, 5, 4, 3, -128, 8, 7, 6, -128, 11, 10, 9, -128);
+			const __m256i alpha = _mm256_set1_epi32(0xFF000000);
+
+			// The load reads 32 bytes for 8 pixels, stay inside the row
+			for(;(x + 8) * 3 + 8 <= width * 3;x += 8)
+			{
+				__m256i p = _mm256_loadu_si256((const __m256i *)&src[x * 3]);
+				p = _mm256_permutevar8x32_epi32(p, dwords);
+				_mm256_storeu_si256((__m256i *)&dst[x * 4], _mm256_or_si256(_mm256_shuffle_epi8(p, shuffle), alpha));
+			}
+		}
+		break;
+
+	case TPF_X8R8G8B8:
+	case TPF_A8R8G8B8:
+		{
+			const __m256i shuffle = _mm256_setr_epi8(
+				2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+				2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+			const __m256i alpha = format == TPF_X8R8G8B8 ? _mm256_set1_epi32(0xFF000000) : _mm256_setzero_si256();
+
+			for(;x + 8 <= width;x += 8)
+			{
+				__m256i p = _mm256_loadu_si256((const __m256i *)&src[x * 4]);
+				_mm256_storeu_si256((__m256i *)&dst[x * 4], _mm256_or_si256(_mm256_shuffle_epi8(p, shuffle), alpha));
+			}
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	// Don't pay for the switch back to SSE-code
+	_mm256_zeroupper();
+
+	return x;
+}
+
+/** Averages the 2x2-blocks of two RGBA8 rows with SSE2. Returns the number of destination pixels done. */
+static unsigned int DownsampleRowSSE2(const unsigned char* row0, const unsigned char* row1, unsigned char* dst, unsigned int dstWidth)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi16(2);
+
+	unsigned int x = 0;
+	for(;x + 2 <= dstWidth;x += 2)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *)&row0[x * 8]);
+		__m128i b = _mm_loadu_si128((const __m128i *)&row1[x * 8]);
+
+		// Sum the rows, pixels 0 and 1 in lo, 2 and 3 in hi
+		__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+		__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+
+		// Then the columns: 0 + 1 and 2 + 3
+		__m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+		sum = _mm_srli_epi16(_mm_add_epi16(sum, round), 2);
+
+		_mm_storel_epi64((__m128i *)&dst[x * 4], _mm_packus_epi16(sum, zero));
+	}
+
+	return x;
+}
+
+/** Returns the format described by the given bitmasks, or TPF_UNKNOWN */
+ETexturePixelFormat TextureConversion::GetPixelFormat(DWORD redMask, DWORD greenMask, DWORD blueMask, DWORD alphaMask)
+{
+	if(redMask == 0xF800 && greenMask == 0x07E0 && blueMask == 0x001F)
+		return TPF_R5G6B5;
+
+	if(redMask == 0x7C00 && greenMask == 0x03E0 && blueMask == 0x001F)
+		return alphaMask == 0x8000 ? TPF_A1R5G5B5 : TPF_X1R5G5B5;
+
+	if(redMask == 0x0F00 && greenMask == 0x00F0 && blueMask == 0x000F)
+		return alphaMask == 0xF000 ? TPF_A4R4G4B4 : TPF_X4R4G4B4;
+
+	if(redMask == 0x00FF0000 && greenMask == 0x0000FF00 && blueMask == 0x000000FF)
+	{
+		if(alphaMask == 0xFF000000)
+			return TPF_A8R8G8B8;
+
+		return TPF_X8R8G8B8;
+	}
+
+	if(redMask == 0x000000FF && greenMask == 0x0000FF00 && blueMask == 0x00FF0000)
+		return TPF_A8B8G8R8;
+
+	return TPF_UNKNOWN;
+}
+
+/** Returns the size of one pixel of the given format in bytes */
+unsigned int TextureConversion::GetBytesPerPixel(ETexturePixelFormat format)
+{
+	switch(format)
+	{
+	case TPF_R5G6B5:
+	case TPF_X1R5G5B5:
+	case TPF_A1R5G5B5:
+	case TPF_X4R4G4B4:
+	case TPF_A4R4G4B4:
+		return 2;
+
+	case TPF_R8G8B8:
+		return 3;
+
+	default:
+		return 4;
+	}
+}
+
+/** Converts the given image into RGBA8, using the best kernels the CPU supports */
+void TextureConversion::ConvertToRGBA8(ETexturePixelFormat format, const unsigned char* src, unsigned int srcPitch, unsigned char* dst, unsigned int dstPitch, unsigned int width, unsigned int height)
+{
+	ETextureConversionISA isa = GetActiveISA();
+	for(unsigned int y=0;y<height;y++)
+	{
+		const unsigned char* s = src + y * srcPitch;
+		unsigned char* d = dst + y * dstPitch;
+
+		unsigned int x = 0;
+		if(isa == TCI_AVX2)
+			x = ConvertRowAVX2(format, s, d, width);
+
+		// SSE2 takes what AVX2 left over, the scalar kernel does the rest
+		if(isa >= TCI_SSE2)
+			x += ConvertRowSSE2(format, s + x * GetBytesPerPixel(format), d + x * 4, width - x);
+
+		ConvertRowScalar(format, s, d, x, width);
+	}
+}
+
+/** Box-filters the given RGBA8 image down to the next mip-level */
+void TextureConversion::GenerateMipRGBA8(const unsigned char* src, unsigned int width, unsigned int height, unsigned char* dst)
+{
+	unsigned int dstWidth = std::max(1u, width / 2);
+	unsigned int dstHeight = std::max(1u, height / 2);
+	bool simd = GetActiveISA() >= TCI_SSE2;
+
+	for(unsigned int y=0;y<dstHeight;y++)
+	{
+		// Images which are only one pixel wide or high average the same pixel twice on that axis
+		const unsigned char* row0 = src + std::min(y * 2, height - 1) * width * 4;
+		const unsigned char* row1 = src + std::min(y * 2 + 1, height - 1) * width * 4;
+		unsigned char* d = dst + y * dstWidth * 4;
+
+		unsigned int x = 0;
+		if(simd && width > 1)
+			x = DownsampleRowSSE2(row0, row1, d, dstWidth);
+
+		for(;x<dstWidth;x++)
+		{
+			unsigned int x0 = std::min(x * 2, width - 1) * 4;
+			unsigned int x1 = std::min(x * 2 + 1, width - 1) * 4;
+			for(int c=0;c<4;c++)
+				d[x * 4 + c] = (unsigned char)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2);
+		}
+	}
+}
+
+/** Returns the best kernels the CPU supports */
+ETextureConversionISA TextureConversion::GetSupportedISA()
+{
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+
+	__cpuid(info, 1);
+	if(!(info[3] & (1 << 26)))
+		return TCI_SCALAR;
+
+	// AVX2 needs the OS to save the YMM-registers
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	if(maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6)
+	{
+		__cpuidex(info, 7, 0);
+		if(info[1] & (1 << 5))
+			return TCI_AVX2;
+	}
+
+	return TCI_SSE2;
+}
+
+/** Limits the kernels to the given ones */
+void TextureConversion::SetISA(ETextureConversionISA isa)
+{
+	s_ISA = std::min(isa, GetSupportedISA());
+}
+
+/** Compares all supported kernels with the scalar ones */
+bool TextureConversion::RunSelfTest()
+{
+	static const ETexturePixelFormat formats[] = {TPF_R5G6B5, TPF_X1R5G5B5, TPF_A1R5G5B5, TPF_X4R4G4B4, TPF_A4R4G4B4, TPF_R8G8B8, TPF_X8R8G8B8, TPF_A8R8G8B8, TPF_A8B8G8R8};
+	static const char* formatNames[] = {"R5G6B5", "X1R5G5B5", "A1R5G5B5", "X4R4G4B4", "A4R4G4B4", "R8G8B8", "X8R8G8B8", "A8R8G8B8", "A8B8G8R8"};
+	static const unsigned int sizes[][2] = {{1, 1}, {1, 7}, {7, 1}, {3, 5}, {17, 9}, {37, 19}, {64, 64}, {255, 3}};
+	static const unsigned int numSizes = sizeof(sizes) / sizeof(sizes[0]);
+
+	ETextureConversionISA supported = GetSupportedISA();
+	ETextureConversionISA previous = GetActiveISA();
+	bool passed = true;
+
+	// Fixed seed, so a failure can be reproduced
+	unsigned int seed = 12345;
+	for(unsigned int f=0;f<ARRAYSIZE(formats);f++)
+	{
+		for(unsigned int s=0;s<numSizes;s++)
+		{
+			unsigned int w = sizes[s][0], h = sizes[s][1];
+
+			// Pad the rows, so the kernels have to use the pitch
+			unsigned int srcPitch = w * GetBytesPerPixel(formats[f]) + 5;
+			std::vector<unsigned char> src(srcPitch * h);
+			for(unsigned int i=0;i<src.size();i++)
+			{
+				seed = seed * 1664525 + 1013904223;
+				src[i] = (unsigned char)(seed >> 24);
+			}
+
+			std::vector<unsigned char> reference(w * h * 4);
+			SetISA(TCI_SCALAR);
+			ConvertToRGBA8(formats[f], &src[0], srcPitch, &reference[0], w * 4, w, h);
+
+			std::vector<unsigned char> refMip(std::max(1u, w / 2) * std::max(1u, h / 2) * 4);
+			GenerateMipRGBA8(&reference[0], w, h, &refMip[0]);
+
+			for(int isa=TCI_SSE2;isa<=supported;isa++)
+			{
+				SetISA((ETextureConversionISA)isa);
+
+				std::vector<unsigned char> result(reference.size());
+				ConvertToRGBA8(formats[f], &src[0], srcPitch, &result[0], w * 4, w, h);
+
+				std::vector<unsigned char> mip(refMip.size());
+				GenerateMipRGBA8(&reference[0], w, h, &mip[0]);
+
+				if(result != reference || mip != refMip)
+				{
+					LogWarn() << "Texture conversion self-test failed for " << formatNames[f] << " at " << w << "x" << h << " with kernels " << isa;
+					passed = false;
+				}
+			}
+		}
+	}
+
+	s_ISA = previous;
+
+	LogInfo() << "Texture conversion self-test " << (passed ? "passed" : "failed") << ", kernels: " << (supported == TCI_AVX2 ? "AVX2" : (supported == TCI_SSE2 ? "SSE2" : "scalar"));
+	return passed;
+}
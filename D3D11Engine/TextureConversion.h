@@ -0,0 +1,52 @@
+#pragma once
+#include "pch.h"
+
+/** Uncompressed pixel formats the game hands us in its surfaces. Named like the D3D7-formats, from high to low bit. */
+enum ETexturePixelFormat
+{
+	TPF_UNKNOWN,
+	TPF_R5G6B5,
+	TPF_X1R5G5B5,
+	TPF_A1R5G5B5,
+	TPF_X4R4G4B4,
+	TPF_A4R4G4B4,
+	TPF_R8G8B8, // 24-bit, bytes are B, G, R
+	TPF_X8R8G8B8,
+	TPF_A8R8G8B8,
+	TPF_A8B8G8R8, // Same layout as our textures, no conversion needed
+};
+
+/** Kernels the conversion can run with */
+enum ETextureConversionISA
+{
+	TCI_SCALAR,
+	TCI_SSE2,
+	TCI_AVX2,
+};
+
+/** Converts uncompressed surface-data into the RGBA8-layout of our textures and builds mipmaps for it on the CPU,
+	so textures loaded on a worker thread don't need the device for anything but the upload */
+namespace TextureConversion
+{
+	/** Returns the format described by the given bitmasks, or TPF_UNKNOWN */
+	ETexturePixelFormat GetPixelFormat(DWORD redMask, DWORD greenMask, DWORD blueMask, DWORD alphaMask);
+
+	/** Returns the size of one pixel of the given format in bytes */
+	unsigned int GetBytesPerPixel(ETexturePixelFormat format);
+
+	/** Converts the given image into RGBA8, using the best kernels the CPU supports */
+	void ConvertToRGBA8(ETexturePixelFormat format, const unsigned char* src, unsigned int srcPitch, unsigned char* dst, unsigned int dstPitch, unsigned int width, unsigned int height);
+
+	/** Box-filters the given RGBA8 image down to the next mip-level, which is max(1, size / 2) large */
+	void GenerateMipRGBA8(const unsigned char* src, unsigned int width, unsigned int height, unsigned char* dst);
+
+	/** Returns the best kernels the CPU supports */
+	ETextureConversionISA GetSupportedISA();
+
+	/** Limits the kernels to the given ones. Asking for more than the CPU supports gives the supported ones. */
+	void SetISA(ETextureConversionISA isa);
+
+	/** Converts every format and builds mips of odd-sized images with all supported kernels and compares the results
+		with the scalar ones. Logs the result. */
+	bool RunSelfTest();
+};
@@ -0,0 +1,555 @@
+#include "pch.h"
+#include "ThreadPool.h"
+#include <queue>
+
+/** Owner only. Returns false if the deque is full. */
+bool JobDeque::push(Job* job)
+{
+	unsigned int b = bottom.load(std::memory_order_relaxed);
+	unsigned int t = top.load(std::memory_order_acquire);
+	if(b - t >= JOB_DEQUE_SIZE)
+		return false;
+
+	jobs[b & (JOB_DEQUE_SIZE - 1)].store(job, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	bottom.store(b + 1, std::memory_order_relaxed);
+	return true;
+}
+
+/** Owner only. Takes the most recently pushed job. */
+Job* JobDeque::pop()
+{
+	unsigned int b = bottom.load(std::memory_order_relaxed) - 1;
+	bottom.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	unsigned int t = top.load(std::memory_order_relaxed);
+
+	if((int)(b - t) < 0)
+	{
+		// Was empty
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return NULL;
+	}
+
+	Job* job = jobs[b & (JOB_DEQUE_SIZE - 1)].load(std::memory_order_relaxed);
+	if(b != t)
+		return job;
+
+	// Last job, race the thieves for it
+	if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		job = NULL;
+
+	bottom.store(b + 1, std::memory_order_relaxed);
+	return job;
+}
+
+/** Any thread. Takes the oldest job. */
+Job* JobDeque::steal()
+{
+	unsigned int t = top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	unsigned int b = bottom.load(std::memory_order_acquire);
+
+	if((int)(b - t) <= 0)
+		return NULL;
+
+	Job* job = jobs[t & (JOB_DEQUE_SIZE - 1)].load(std::memory_order_relaxed);
+	if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		return NULL; // Someone else was faster
+
+	return job;
+}
+
+// the constructor just launches some amount of workers
+ThreadPool::ThreadPool(size_t threads)
+	: numThreads(threads), sharedCount(0), nextSharedJob(0), numSleeping(0), stop(false)
+{
+	// Hold the lock until every worker knows its id, the workers wait for it before doing anything
+	std::unique_lock<std::mutex> lock(sleepMutex);
+
+	for(size_t i=0;i<threads;i++)
+	{
+		Worker* w = new Worker;
+		w->nextJob = 0;
+		workers.push_back(w);
+	}
+
+	for(size_t i=0;i<threads;i++)
+	{
+		workers[i]->thread = std::thread(&ThreadPool::workerLoop, this, (int)i);
+		workers[i]->id = workers[i]->thread.get_id();
+	}
+}
+
+// the destructor lets the workers finish all jobs and joins them
+ThreadPool::~ThreadPool()
+{
+	{
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		stop = true;
+	}
+	condition.notify_all();
+
+	for(size_t i=0;i<workers.size();i++)
+		workers[i]->thread.join();
+
+	// Only now, the others might still have been stealing from them
+	for(size_t i=0;i<workers.size();i++)
+		delete workers[i];
+}
+
+/** One thread per core, leaving one for the thread feeding the pool */
+size_t ThreadPool::defaultNumThreads()
+{
+	unsigned int cores = std::thread::hardware_concurrency();
+	return cores > 1 ? cores - 1 : 1;
+}
+
+/** Returns the index of the calling thread in the workers, or -1 if it doesn't belong to this pool */
+int ThreadPool::currentWorker() const
+{
+	std::thread::id id = std::this_thread::get_id();
+	for(size_t i=0;i<workers.size();i++)
+	{
+		if(workers[i]->id == id)
+			return (int)i;
+	}
+
+	return -1;
+}
+
+/** Takes a job from the pool of the given worker, or the shared pool for -1 */
+Job* ThreadPool::allocJob(int worker)
+{
+	if(worker >= 0)
+	{
+		// Only the worker itself allocates from its pool
+		Worker* w = workers[worker];
+		for(unsigned int i=0;i<JOB_POOL_SCAN;i++)
+		{
+			Job* job = &w->jobs[w->nextJob++ % JOB_POOL_SIZE];
+			if(job->free.load(std::memory_order_acquire))
+			{
+				job->free.store(false, std::memory_order_relaxed);
+				job->heap = false;
+				return job;
+			}
+		}
+	}else
+	{
+		std::lock_guard<std::mutex> lock(sharedMutex);
+		for(unsigned int i=0;i<JOB_POOL_SCAN;i++)
+		{
+			Job* job = &sharedJobs[nextSharedJob++ % JOB_POOL_SIZE];
+			if(job->free.load(std::memory_order_acquire))
+			{
+				job->free.store(false, std::memory_order_relaxed);
+				job->heap = false;
+				return job;
+			}
+		}
+	}
+
+	// Too many jobs in flight
+	Job* job = new Job;
+	job->free = false;
+	job->heap = true;
+	return job;
+}
+
+/** Schedules the job and wakes up a sleeping worker */
+void ThreadPool::submit(Job* job, int worker)
+{
+	if(worker < 0 || !workers[worker]->deque.push(job))
+	{
+		std::lock_guard<std::mutex> lock(sharedMutex);
+		sharedQueue.push_back(job);
+		sharedCount.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// Pairs with the fence in workerLoop: Either the worker sees the job before sleeping, or we see it sleeping
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if(numSleeping.load(std::memory_order_relaxed) > 0)
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		condition.notify_one();
+	}
+}
+
+/** Looks for a job in the own deque, the shared queue and the other workers, in that order */
+Job* ThreadPool::findJob(int worker)
+{
+	if(worker >= 0)
+	{
+		Job* job = workers[worker]->deque.pop();
+		if(job)
+			return job;
+	}
+
+	if(sharedCount.load(std::memory_order_relaxed) > 0)
+	{
+		std::lock_guard<std::mutex> lock(sharedMutex);
+		if(!sharedQueue.empty())
+		{
+			Job* job = sharedQueue.front();
+			sharedQueue.pop_front();
+			sharedCount.fetch_sub(1, std::memory_order_relaxed);
+			return job;
+		}
+	}
+
+	// Start with the neighbour, so thieves don't all go for the first worker
+	size_t n = workers.size();
+	for(size_t i=1;i<=n;i++)
+	{
+		size_t victim = (worker + i) % n;
+		if((int)victim == worker)
+			continue;
+
+		Job* job = workers[victim]->deque.steal();
+		if(job)
+			return job;
+	}
+
+	return NULL;
+}
+
+/** Runs and frees the given job */
+void ThreadPool::execute(Job* job)
+{
+	JobGroup* group = job->group;
+
+	// An exception leaving a worker would terminate the game, hand it to whoever waits for the group instead
+	try
+	{
+		job->invoke(job);
+	}catch(...)
+	{
+		bool expected = false;
+		if(group && group->failed.compare_exchange_strong(expected, true, std::memory_order_relaxed))
+			group->error = std::current_exception();
+	}
+
+	job->destroy(job);
+
+	if(job->heap)
+		delete job;
+	else
+		job->free.store(true, std::memory_order_release);
+
+	if(group)
+		group->pending.fetch_sub(1, std::memory_order_release);
+}
+
+/** Executes jobs until all jobs of the group are done */
+void ThreadPool::wait(JobGroup& group)
+{
+	int worker = currentWorker();
+	while(!group.isDone())
+	{
+		Job* job = findJob(worker);
+		if(job)
+			execute(job);
+		else
+			std::this_thread::yield();
+	}
+
+	if(group.failed.load(std::memory_order_relaxed))
+	{
+		// Reset the group, so it can be used again
+		std::exception_ptr error = group.error;
+		group.error = std::exception_ptr();
+		group.failed.store(false, std::memory_order_relaxed);
+		std::rethrow_exception(error);
+	}
+}
+
+void ThreadPool::workerLoop(int index)
+{
+	// Wait for the constructor to finish setting up the ids
+	{
+		std::unique_lock<std::mutex> lock(sleepMutex);
+	}
+
+	unsigned int idle = 0;
+	for(;;)
+	{
+		Job* job = findJob(index);
+		if(job)
+		{
+			execute(job);
+			idle = 0;
+			continue;
+		}
+
+		// New jobs often come in bursts, so don't go to sleep right away
+		if(++idle < JOB_IDLE_SPINS)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		{
+			std::unique_lock<std::mutex> lock(sleepMutex);
+			numSleeping.fetch_add(1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+
+			job = findJob(index);
+			if(!job)
+			{
+				if(stop)
+				{
+					numSleeping.fetch_sub(1, std::memory_order_relaxed);
+					return;
+				}
+
+				condition.wait(lock);
+			}
+
+			numSleeping.fetch_sub(1, std::memory_order_relaxed);
+		}
+
+		idle = 0;
+		if(job)
+			execute(job);
+	}
+}
+
+/** The thread pool the engine used before the job system: one std::queue of std::function under a single mutex,
+	every task wrapped in a shared packaged_task. Kept to benchmark against. */
+class ReferenceThreadPool
+{
+public:
+	ReferenceThreadPool(size_t threads) : stop(false)
+	{
+		for(size_t i=0;i<threads;i++)
+		{
+			workers.emplace_back([this]
+			{
+				for(;;)
+				{
+					std::function<void()> task;
+
+					{
+						std::unique_lock<std::mutex> lock(queueMutex);
+						condition.wait(lock, [this] { return stop || !tasks.empty(); });
+						if(stop && tasks.empty())
+							return;
+						task = std::move(tasks.front());
+						tasks.pop();
+					}
+
+					task();
+				}
+			});
+		}
+	}
+
+	~ReferenceThreadPool()
+	{
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			stop = true;
+		}
+		condition.notify_all();
+		for(std::thread& worker : workers)
+			worker.join();
+	}
+
+	template<class F>
+	std::future<void> enqueue(F&& f)
+	{
+		auto task = std::make_shared<std::packaged_task<void()>>(std::forward<F>(f));
+		std::future<void> res = task->get_future();
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			tasks.emplace([task]() { (*task)(); });
+		}
+		condition.notify_one();
+		return res;
+	}
+
+private:
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> tasks;
+	std::mutex queueMutex;
+	std::condition_variable condition;
+	bool stop;
+};
+
+/** Milliseconds between two performance-counter values */
+static double GetElapsedMS(const LARGE_INTEGER& start, const LARGE_INTEGER& end, const LARGE_INTEGER& frequency)
+{
+	return (double)(end.QuadPart - start.QuadPart) * 1000.0 / (double)frequency.QuadPart;
+}
+
+/** Times the same workloads on this pool and on the old queue-based one, and checks that exceptions reach wait */
+bool ThreadPool::runBenchmark()
+{
+	const unsigned int numJobs = 100000;
+	const unsigned int numRoundTrips = 10000;
+	const unsigned int numElements = 4 * 1024 * 1024;
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+
+	bool passed = true;
+	LARGE_INTEGER start, end;
+	std::atomic<unsigned int> counter(0);
+	std::vector<std::future<void>> futures;
+	futures.reserve(numJobs);
+
+	// Same number of threads for both, so only the scheduling differs
+	double refBatchMS, refRoundTripMS, refParallelMS;
+	{
+		ReferenceThreadPool reference(numThreads);
+
+		// Batch of tiny jobs, waited for through their futures
+		QueryPerformanceCounter(&start);
+		for(unsigned int i=0;i<numJobs;i++)
+			futures.push_back(reference.enqueue([&counter](){ counter.fetch_add(1, std::memory_order_relaxed); }));
+		for(unsigned int i=0;i<numJobs;i++)
+			futures[i].wait();
+		QueryPerformanceCounter(&end);
+		refBatchMS = GetElapsedMS(start, end, frequency);
+		futures.clear();
+
+		// Handing a single job to a worker and waiting for it
+		QueryPerformanceCounter(&start);
+		for(unsigned int i=0;i<numRoundTrips;i++)
+			reference.enqueue([&counter](){ counter.fetch_add(1, std::memory_order_relaxed); }).wait();
+		QueryPerformanceCounter(&end);
+		refRoundTripMS = GetElapsedMS(start, end, frequency);
+	}
+
+	if(counter.load() != numJobs + numRoundTrips)
+	{
+		LogWarn() << "ThreadPool benchmark: Only " << counter.load() << " of " << numJobs + numRoundTrips << " jobs ran on the old pool";
+		passed = false;
+	}
+
+	// Batch of tiny jobs through enqueue, like on the old pool
+	counter = 0;
+	QueryPerformanceCounter(&start);
+	for(unsigned int i=0;i<numJobs;i++)
+		futures.push_back(enqueue([&counter](){ counter.fetch_add(1, std::memory_order_relaxed); }));
+	for(unsigned int i=0;i<numJobs;i++)
+		futures[i].wait();
+	QueryPerformanceCounter(&end);
+	double enqueueMS = GetElapsedMS(start, end, frequency);
+	futures.clear();
+
+	// Same batch through run, the way the engine schedules most of its work now
+	JobGroup group;
+	QueryPerformanceCounter(&start);
+	for(unsigned int i=0;i<numJobs;i++)
+		run(group, [&counter](){ counter.fetch_add(1, std::memory_order_relaxed); });
+	wait(group);
+	QueryPerformanceCounter(&end);
+	double runMS = GetElapsedMS(start, end, frequency);
+
+	// Single job round trips
+	QueryPerformanceCounter(&start);
+	for(unsigned int i=0;i<numRoundTrips;i++)
+	{
+		run(group, [&counter](){ counter.fetch_add(1, std::memory_order_relaxed); });
+		wait(group);
+	}
+	QueryPerformanceCounter(&end);
+	double roundTripMS = GetElapsedMS(start, end, frequency);
+
+	if(counter.load() != numJobs * 2 + numRoundTrips)
+	{
+		LogWarn() << "ThreadPool benchmark: Only " << counter.load() << " of " << numJobs * 2 + numRoundTrips << " jobs ran";
+		passed = false;
+	}
+
+	// Data-parallel loop: Plain, split into futures on the old pool and through parallel_for
+	std::vector<float> values(numElements);
+	std::vector<float> results(numElements);
+	for(unsigned int i=0;i<numElements;i++)
+		values[i] = (float)(i % 1000);
+
+	QueryPerformanceCounter(&start);
+	for(unsigned int i=0;i<numElements;i++)
+		results[i] = sqrtf(values[i]) * 2.0f + 1.0f;
+	QueryPerformanceCounter(&end);
+	double serialMS = GetElapsedMS(start, end, frequency);
+
+	// Ranges the way the engine split its loops before, one per thread
+	{
+		ReferenceThreadPool reference(numThreads);
+		unsigned int grain = (numElements + (unsigned int)numThreads - 1) / (unsigned int)numThreads;
+
+		std::fill(results.begin(), results.end(), 0.0f);
+		QueryPerformanceCounter(&start);
+		for(unsigned int s=0;s<numElements;s+=grain)
+		{
+			unsigned int e = std::min(s + grain, numElements);
+			futures.push_back(reference.enqueue([&values, &results, s, e]()
+			{
+				for(unsigned int i=s;i<e;i++)
+					results[i] = sqrtf(values[i]) * 2.0f + 1.0f;
+			}));
+		}
+		for(unsigned int i=0;i<futures.size();i++)
+			futures[i].wait();
+		QueryPerformanceCounter(&end);
+		refParallelMS = GetElapsedMS(start, end, frequency);
+		futures.clear();
+	}
+
+	std::fill(results.begin(), results.end(), 0.0f);
+	QueryPerformanceCounter(&start);
+	parallel_for(0, numElements, 0, [&values, &results](unsigned int i)
+	{
+		results[i] = sqrtf(values[i]) * 2.0f + 1.0f;
+	});
+	QueryPerformanceCounter(&end);
+	double parallelMS = GetElapsedMS(start, end, frequency);
+
+	for(unsigned int i=0;i<numElements;i++)
+	{
+		if(results[i] != sqrtf(values[i]) * 2.0f + 1.0f)
+		{
+			LogWarn() << "ThreadPool benchmark: parallel_for missed index " << i;
+			passed = false;
+			break;
+		}
+	}
+
+	// A throwing job must not take down the worker, wait has to rethrow it
+	bool caught = false;
+	try
+	{
+		for(unsigned int i=0;i<64;i++)
+		{
+			run(group, [i]()
+			{
+				if(i == 13)
+					throw std::runtime_error("ThreadPool benchmark");
+			});
+		}
+		wait(group);
+	}catch(const std::runtime_error&)
+	{
+		caught = true;
+	}
+
+	if(!caught || !group.isDone())
+	{
+		LogWarn() << "ThreadPool benchmark: Exception of a job didn't reach wait";
+		passed = false;
+	}
+
+	LogInfo() << "ThreadPool benchmark: " << numThreads << " workers, " << numJobs << " jobs per batch, " << numRoundTrips << " round trips";
+	LogInfo() << "ThreadPool benchmark: Old pool: " << numJobs / refBatchMS << " jobs/ms (" << refBatchMS * 1000.0 / numJobs << "us per job), "
+		<< "enqueue + wait: " << refRoundTripMS * 1000.0 / numRoundTrips << "us";
+	LogInfo() << "ThreadPool benchmark: New pool: enqueue " << numJobs / enqueueMS << " jobs/ms (" << enqueueMS * 1000.0 / numJobs << "us per job), "
+		<< "run " << numJobs / runMS << " jobs/ms (" << runMS * 1000.0 / numJobs << "us per job), "
+		<< "run + wait: " << roundTripMS * 1000.0 / numRoundTrips << "us";
+	LogInfo() << "ThreadPool benchmark: " << numElements << " elements. Plain loop: " << serialMS << "ms, old pool: " << refParallelMS
+		<< "ms, parallel_for: " << parallelMS << "ms";
+	LogInfo() << "ThreadPool benchmark " << (passed ? "passed" : "failed");
+	return passed;
+}
@@ -1,73 +1,202 @@
 #pragma once
-#include <iostream>
-#include <deque>
-#include <functional>
 #include <thread>
 #include <condition_variable>
 #include <mutex>
-#include <random>
 #include <atomic>
 #include <vector>
-#include <queue>
+#include <deque>
 #include <memory>
-#include <thread>
-#include <mutex>
-#include <condition_variable>
 #include <future>
 #include <functional>
+#include <type_traits>
 #include <stdexcept>
+#include <algorithm>
+#include <exception>
+
+/** Size of the buffer a job keeps its callable in. Bigger callables get one heap-allocation. */
+const size_t JOB_INLINE_SIZE = 64;
+
+/** Number of jobs a worker can hold in its own deque. Must be a power of two. */
+const unsigned int JOB_DEQUE_SIZE = 4096;
+
+/** Number of preallocated jobs per worker, and for the shared queue */
+const unsigned int JOB_POOL_SIZE = 1024;
+
+/** How many pool-slots are tried before falling back to the heap */
+const unsigned int JOB_POOL_SCAN = 16;
+
+/** How often an idle worker looks for work before it goes to sleep */
+const unsigned int JOB_IDLE_SPINS = 64;
+
+class ThreadPool;
+
+/** Counts the unfinished jobs started with ThreadPool::run. Wait for them with ThreadPool::wait.
+	If a job throws, the first exception is kept and rethrown by wait. */
+class JobGroup
+{
+public:
+	JobGroup() : pending(0), failed(false) {}
+
+	/** Returns true if all jobs of this group have finished */
+	bool isDone() const { return pending.load(std::memory_order_acquire) == 0; }
+
+private:
+	friend class ThreadPool;
+	JobGroup(const JobGroup&);
+	JobGroup& operator=(const JobGroup&);
+
+	std::atomic<int> pending;
+	std::atomic<bool> failed;
+	std::exception_ptr error; // Only written by the job which set failed
+};
+
+/** A single unit of work. Small callables are stored inside the job, so scheduling one doesn't allocate. */
+struct Job
+{
+	Job() : invoke(NULL), destroy(NULL), group(NULL), free(true), heap(false) {}
+
+	void (*invoke)(Job* job);
+	void (*destroy)(Job* job);
+	JobGroup* group;
+	std::atomic<bool> free;
+	bool heap; // Allocated because the pool was exhausted
+	std::aligned_storage<JOB_INLINE_SIZE, 8>::type storage;
+};
+
+/** Puts a callable into the storage of a job */
+template<class Fn, bool Inline = (sizeof(Fn) <= JOB_INLINE_SIZE && std::alignment_of<Fn>::value <= 8)>
+struct JobCallable
+{
+	template<class F> static void store(Job* job, F&& f)
+	{
+		new(&job->storage) Fn(std::forward<F>(f));
+		job->invoke = &invoke;
+		job->destroy = &destroy;
+	}
+
+	static void invoke(Job* job) { (*(Fn*)&job->storage)(); }
+	static void destroy(Job* job) { ((Fn*)&job->storage)->~Fn(); }
+};
+
+/** Callables too big for the job only store a pointer */
+template<class Fn>
+struct JobCallable<Fn, false>
+{
+	template<class F> static void store(Job* job, F&& f)
+	{
+		*(Fn**)&job->storage = new Fn(std::forward<F>(f));
+		job->invoke = &invoke;
+		job->destroy = &destroy;
+	}
+
+	static void invoke(Job* job) { (**(Fn**)&job->storage)(); }
+	static void destroy(Job* job) { delete *(Fn**)&job->storage; }
+};
+
+/** Lock-free work-stealing deque (Chase-Lev). Only the owning worker pushes and pops at the bottom,
+	everyone else steals from the top. The counters are allowed to wrap around. */
+class JobDeque
+{
+public:
+	JobDeque() : top(0), bottom(0)
+	{
+		for(unsigned int i=0;i<JOB_DEQUE_SIZE;i++)
+			jobs[i].store(NULL, std::memory_order_relaxed);
+	}
+
+	/** Owner only. Returns false if the deque is full. */
+	bool push(Job* job);
 
+	/** Owner only. Takes the most recently pushed job. */
+	Job* pop();
+
+	/** Any thread. Takes the oldest job. */
+	Job* steal();
+
+private:
+	std::atomic<unsigned int> top;
+	std::atomic<unsigned int> bottom;
+	std::atomic<Job*> jobs[JOB_DEQUE_SIZE];
+};
+
+/** Job system with one work-stealing deque per worker. Jobs from threads outside the pool go into a shared queue.
+	Threads waiting for a group or a parallel_for help out with executing jobs instead of blocking. */
 class ThreadPool {
 public:
-	ThreadPool(size_t threads = std::thread::hardware_concurrency() / 2);
+	ThreadPool(size_t threads = defaultNumThreads());
+	~ThreadPool();
+
+	/** Runs the given function on the pool and returns a future for its result. Exceptions end up in the future. */
 	template<class F, class... Args>
 	auto enqueue(F&& f, Args&&... args)
 		->std::future<typename std::result_of<F(Args...)>::type>;
-	~ThreadPool();
+
+	/** Runs the given function on the pool as part of the group */
+	template<class F>
+	void run(JobGroup& group, F&& f);
+
+	/** Executes jobs until all jobs of the group are done. Waiting inside a job runs the other jobs on the same stack, so keep nesting shallow.
+		Rethrows the first exception thrown by a job of the group, after all of them have finished. */
+	void wait(JobGroup& group);
+
+	/** Calls f(i) for every i in [begin, end), in ranges of "grain" indices. Pass 0 to pick a grain by the number of threads.
+		The calling thread takes part and the function returns when all indices are done. If f throws, the first exception is
+		rethrown here once the other ranges are done. */
+	template<class F>
+	void parallel_for(unsigned int begin, unsigned int end, unsigned int grain, const F& f);
 
 	size_t getNumThreads(){return numThreads;}
+
+	/** One thread per core, leaving one for the thread feeding the pool */
+	static size_t defaultNumThreads();
+
+	/** Times batches of tiny jobs, single run/wait round trips and parallel_for on this pool and on the old queue-based one,
+		and checks that exceptions reach wait. Returns false if a check failed. */
+	bool runBenchmark();
+
 private:
-	// need to keep track of threads so we can join them
-	std::vector< std::thread > workers;
-	// the task queue
-	std::queue< std::function<void()> > tasks;
+	struct Worker
+	{
+		JobDeque deque;
+		Job jobs[JOB_POOL_SIZE];
+		unsigned int nextJob;
+		std::thread::id id;
+		std::thread thread;
+	};
 
-	// synchronization
-	std::mutex queue_mutex;
-	std::condition_variable condition;
-	bool stop;
+	/** Returns the index of the calling thread in the workers, or -1 if it doesn't belong to this pool */
+	int currentWorker() const;
+
+	/** Takes a job from the pool of the given worker, or the shared pool for -1 */
+	Job* allocJob(int worker);
+
+	/** Schedules the job and wakes up a sleeping worker */
+	void submit(Job* job, int worker);
+
+	/** Looks for a job in the own deque, the shared queue and the other workers, in that order */
+	Job* findJob(int worker);
+
+	/** Runs and frees the given job */
+	void execute(Job* job);
+
+	void workerLoop(int index);
+
+	std::vector<Worker*> workers;
 	size_t numThreads;
-};
 
-// the constructor just launches some amount of workers
-inline ThreadPool::ThreadPool(size_t threads)
-	: stop(false)
-{
-	numThreads = threads;
+	// Jobs from threads outside the pool
+	std::mutex sharedMutex;
+	std::deque<Job*> sharedQueue;
+	std::atomic<unsigned int> sharedCount;
+	Job sharedJobs[JOB_POOL_SIZE];
+	unsigned int nextSharedJob;
 
-	for (size_t i = 0; i<threads; ++i)
-		workers.emplace_back(
-			[this]
-	{
-		for (;;)
-		{
-			std::function<void()> task;
-
-			{
-				std::unique_lock<std::mutex> lock(this->queue_mutex);
-				this->condition.wait(lock,
-					[this] { return this->stop || !this->tasks.empty(); });
-				if (this->stop && this->tasks.empty())
-					return;
-				task = std::move(this->tasks.front());
-				this->tasks.pop();
-			}
-
-			task();
-		}
-	}
-	);
-}
+	// Sleeping workers
+	std::mutex sleepMutex;
+	std::condition_variable condition;
+	std::atomic<int> numSleeping;
+	std::atomic<bool> stop;
+};
 
 // add new work item to the pool
 template<class F, class... Args>
@@ -76,32 +205,56 @@ auto ThreadPool::enqueue(F&& f, Args&&... args)
 {
 	using return_type = typename std::result_of<F(Args...)>::type;
 
-	auto task = std::make_shared< std::packaged_task<return_type()> >(
-		std::bind(std::forward<F>(f), std::forward<Args>(args)...)
-		);
+	// don't allow enqueueing after stopping the pool
+	if (stop)
+		throw std::runtime_error("enqueue on stopped ThreadPool");
 
-	std::future<return_type> res = task->get_future();
-	{
-		std::unique_lock<std::mutex> lock(queue_mutex);
+	// The task is moved right into the job, only the shared state of the future gets allocated
+	std::packaged_task<return_type()> task(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+	std::future<return_type> res = task.get_future();
 
-		// don't allow enqueueing after stopping the pool
-		if (stop)
-			throw std::runtime_error("enqueue on stopped ThreadPool");
+	int worker = currentWorker();
+	Job* job = allocJob(worker);
+	JobCallable<std::packaged_task<return_type()>>::store(job, std::move(task));
+	job->group = NULL;
 
-		tasks.emplace([task]() { (*task)(); });
-	}
-	condition.notify_one();
+	submit(job, worker);
 	return res;
 }
 
-// the destructor joins all threads
-inline ThreadPool::~ThreadPool()
+template<class F>
+void ThreadPool::run(JobGroup& group, F&& f)
 {
+	group.pending.fetch_add(1, std::memory_order_relaxed);
+
+	int worker = currentWorker();
+	Job* job = allocJob(worker);
+	JobCallable<typename std::decay<F>::type>::store(job, std::forward<F>(f));
+	job->group = &group;
+
+	submit(job, worker);
+}
+
+template<class F>
+void ThreadPool::parallel_for(unsigned int begin, unsigned int end, unsigned int grain, const F& f)
+{
+	if(begin >= end)
+		return;
+
+	// Some ranges per thread, so stealing can even out uneven work
+	if(grain == 0)
+		grain = std::max(1u, (end - begin) / (unsigned int)((numThreads + 1) * 4));
+
+	JobGroup group;
+	for(unsigned int s = begin; s < end; s = (end - s > grain) ? s + grain : end)
 	{
-		std::unique_lock<std::mutex> lock(queue_mutex);
-		stop = true;
+		unsigned int e = (end - s > grain) ? s + grain : end;
+		run(group, [&f, s, e]()
+		{
+			for(unsigned int i=s;i<e;i++)
+				f(i);
+		});
 	}
-	condition.notify_all();
-	for (std::thread &worker : workers)
-		worker.join();
-}
\ No newline at end of file
+
+	wait(group);
+}
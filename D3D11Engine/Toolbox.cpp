@@ -158,6 +158,37 @@ namespace Toolbox
 		return sqrtf(dx*dx + dy*dy);
 	}
 
+	/** Returns the faces of a shadow-cube a sphere can be seen in */
+	unsigned int ComputeCubeFaceMask(const D3DXVECTOR3& delta, float radius, float range)
+	{
+		if(D3DXVec3Length(&delta) - radius > range)
+			return 0;
+
+		// Each face is bounded by the four 45 degree planes between its axis and the two others.
+		// The sphere can be seen in the face if it isn't fully behind any of them.
+		const float d = -radius * 1.41421356f;
+		const float v[3] = {delta.x, delta.y, delta.z};
+
+		unsigned int mask = 0;
+		for(int f=0;f<6;f++)
+		{
+			int axis = f / 2;
+			float a = (f & 1) ? -v[axis] : v[axis];
+
+			bool visible = true;
+			for(int o=0;o<3;o++)
+			{
+				if(o != axis && (a - v[o] < d || a + v[o] < d))
+					visible = false;
+			}
+
+			if(visible)
+				mask |= 1 << f;
+		}
+
+		return mask;
+	}
+
 	/** Computes the Normal of a triangle */
 	D3DXVECTOR3 ComputeNormal(const D3DXVECTOR3& v0, const D3DXVECTOR3& v1, const D3DXVECTOR3& v2)
 	{
@@ -329,6 +360,47 @@ namespace Toolbox
 		return false;
 	}
 
+	/** Computes a 64-bit FNV-1a hash of the given data. Pass a previous result as seed to continue hashing. */
+	unsigned __int64 HashData(const void* data, size_t size, unsigned __int64 seed)
+	{
+		const unsigned char* b = (const unsigned char*)data;
+		unsigned __int64 h = seed;
+
+		for(size_t i=0;i<size;i++)
+		{
+			h ^= b[i];
+			h *= 1099511628211ULL;
+		}
+
+		return h;
+	}
+
+	/** Rounds the given offset up to the given alignment, which must be a power of two */
+	unsigned int AlignOffset(unsigned int offset, unsigned int alignment)
+	{
+		return (offset + alignment - 1) & ~(alignment - 1);
+	}
+
+	/** Writes data to the file at the given offset, padding with zeros up to it. Feeds everything into the running hash. */
+	void WriteHashedData(FILE* f, unsigned int& pos, unsigned int offset, const void* data, size_t size, unsigned __int64& hash)
+	{
+		static const unsigned char zeros[64] = {0};
+		while(offset > pos)
+		{
+			unsigned int pad = std::min(offset - pos, (unsigned int)sizeof(zeros));
+			fwrite(zeros, pad, 1, f);
+			hash = HashData(zeros, pad, hash);
+			pos += pad;
+		}
+
+		if(!size)
+			return;
+
+		fwrite(data, size, 1, f);
+		hash = HashData(data, size, hash);
+		pos += size;
+	}
+
 	/** Saves a std::string to a FILE* */
 	void SaveStringToFILE(FILE* f, const std::string& str)
 	{
@@ -4,6 +4,7 @@
 #include <string>
 #include <map>
 #include <unordered_map>
+#include <float.h>
 #include "Types.h"
 
 
@@ -140,6 +141,13 @@ namespace Toolbox
 	/** Computes the distance of a point to an AABB */
 	float ComputePointAABBDistance(const D3DXVECTOR3& p, const D3DXVECTOR3& min, const D3DXVECTOR3& max);
 
+	/** Mask with all six faces of a shadow-cube set. Faces are ordered +X, -X, +Y, -Y, +Z, -Z. */
+	const unsigned int CUBEFACE_MASK_ALL = (1 << 6) - 1;
+
+	/** Returns the faces of a shadow-cube a sphere can be seen in. delta is the position of the sphere relative to the cube.
+		Returns 0 if the sphere is further away than range. */
+	unsigned int ComputeCubeFaceMask(const D3DXVECTOR3& delta, float radius, float range = FLT_MAX);
+
 	/** Returns whether the given file exists */
 	bool FileExists(const std::string& file);
 
@@ -151,4 +159,17 @@ namespace Toolbox
 
 	/** Loads a std::string from a FILE* */
 	std::string LoadStringFromFILE(FILE* f);
+
+	/** Start value for HashData */
+	const unsigned __int64 HASH_DATA_SEED = 14695981039346656037ULL;
+
+	/** Computes a 64-bit FNV-1a hash of the given data. Pass a previous result as seed to continue hashing. */
+	unsigned __int64 HashData(const void* data, size_t size, unsigned __int64 seed = HASH_DATA_SEED);
+
+	/** Rounds the given offset up to the given alignment, which must be a power of two */
+	unsigned int AlignOffset(unsigned int offset, unsigned int alignment);
+
+	/** Writes data to the file at the given offset, padding with zeros up to it. pos is the current end of the file
+		and is moved past the data. Feeds everything into the running hash. Used by the binary cache-files. */
+	void WriteHashedData(FILE* f, unsigned int& pos, unsigned int offset, const void* data, size_t size, unsigned __int64& hash);
 };
\ No newline at end of file
@@ -0,0 +1,183 @@
+#include "pch.h"
+#include "VertexWelder.h"
+#include "WorldConverter.h"
+#include <set>
+#include <tuple>
+
+/** Compares vertices like the std::set-indexing did before VertexWelder */
+struct ReferenceVertexCmp
+{
+	bool operator() (const std::pair<ExVertexStruct, int>& p1, const std::pair<ExVertexStruct, int>& p2) const
+	{
+		const float eps = VERTEX_WELD_EPSILON;
+		if (fabs(p1.first.Position.x-p2.first.Position.x) > eps) return p1.first.Position.x < p2.first.Position.x;
+		if (fabs(p1.first.Position.y-p2.first.Position.y) > eps) return p1.first.Position.y < p2.first.Position.y;
+		if (fabs(p1.first.Position.z-p2.first.Position.z) > eps) return p1.first.Position.z < p2.first.Position.z;
+
+		if (fabs(p1.first.TexCoord.x-p2.first.TexCoord.x) > eps) return p1.first.TexCoord.x < p2.first.TexCoord.x;
+		if (fabs(p1.first.TexCoord.y-p2.first.TexCoord.y) > eps) return p1.first.TexCoord.y < p2.first.TexCoord.y;
+
+		return false;
+	}
+};
+
+/** The indexing WorldConverter::IndexVertices did before VertexWelder, kept to compare against */
+static void IndexVerticesReference(const ExVertexStruct* input, unsigned int numInputVertices, std::vector<ExVertexStruct>& outVertices, std::vector<VERTEX_INDEX>& outIndices)
+{
+	std::set<std::pair<ExVertexStruct, int>, ReferenceVertexCmp> vertices;
+	int index = 0;
+
+	for(unsigned int i=0;i<numInputVertices;i++)
+	{
+		auto it = vertices.find(std::make_pair(input[i], 0));
+		if(it != vertices.end())
+		{
+			outIndices.push_back(it->second);
+		}else
+		{
+			vertices.insert(std::make_pair(input[i], index));
+			outIndices.push_back(index++);
+		}
+	}
+
+	// Throw out overlaying triangles
+	std::set<std::tuple<VERTEX_INDEX,VERTEX_INDEX,VERTEX_INDEX>> triangles;
+	for(size_t i=0;i<outIndices.size();i+=3)
+		triangles.insert(std::make_tuple(outIndices[i+0], outIndices[i+1], outIndices[i+2]));
+
+	outIndices.clear();
+	for(auto it = triangles.begin(); it != triangles.end(); it++)
+	{
+		outIndices.push_back(std::get<0>((*it)));
+		outIndices.push_back(std::get<1>((*it)));
+		outIndices.push_back(std::get<2>((*it)));
+	}
+
+	outVertices.clear();
+	outVertices.resize(vertices.size());
+	for(auto it = vertices.begin(); it != vertices.end(); it++)
+		outVertices[it->second] = it->first;
+}
+
+/** Returns a random float between 0 and 1 */
+static float NextRandom(unsigned int& seed)
+{
+	seed = seed * 1664525 + 1013904223;
+	return (float)(seed >> 8) / (float)(1 << 24);
+}
+
+/** Makes a triangle-soup out of a bumpy grid, like the worldmesh comes from gothic. Shared corners are jittered by
+	less than the weld-epsilon and some triangles are put in twice. */
+static void MakePolygonSoup(unsigned int gridSize, std::vector<ExVertexStruct>& soup, unsigned int& seed)
+{
+	std::vector<ExVertexStruct> corners((gridSize + 1) * (gridSize + 1));
+	for(unsigned int y=0;y<=gridSize;y++)
+	{
+		for(unsigned int x=0;x<=gridSize;x++)
+		{
+			ExVertexStruct& v = corners[y * (gridSize + 1) + x];
+			ZeroMemory(&v, sizeof(v));
+			v.Position = float3(x * 100.0f, NextRandom(seed) * 300.0f, y * 100.0f);
+			v.Normal = float3(0, 1, 0);
+			v.TexCoord = float2(x * 0.25f, y * 0.25f);
+			v.Color = 0xFFFFFFFF;
+		}
+	}
+
+	soup.clear();
+	for(unsigned int y=0;y<gridSize;y++)
+	{
+		for(unsigned int x=0;x<gridSize;x++)
+		{
+			unsigned int c[] = {y * (gridSize + 1) + x, y * (gridSize + 1) + x + 1, (y + 1) * (gridSize + 1) + x, (y + 1) * (gridSize + 1) + x + 1};
+			unsigned int tris[] = {c[0], c[2], c[1], c[1], c[2], c[3]};
+
+			int copies = NextRandom(seed) < 0.02f ? 2 : 1;
+			for(int n=0;n<copies;n++)
+			{
+				for(int i=0;i<6;i++)
+				{
+					ExVertexStruct v = corners[tris[i]];
+
+					// Stay well inside the epsilon, so both implementations have to weld it
+					v.Position.x += (NextRandom(seed) - 0.5f) * VERTEX_WELD_EPSILON * 0.25f;
+					v.Position.z += (NextRandom(seed) - 0.5f) * VERTEX_WELD_EPSILON * 0.25f;
+					soup.push_back(v);
+				}
+			}
+		}
+	}
+}
+
+/** Returns true if both welded meshes are the same, within the epsilon the welding allows */
+static bool IsSameMesh(const std::vector<ExVertexStruct>& va, const std::vector<VERTEX_INDEX>& ia, const std::vector<ExVertexStruct>& vb, const std::vector<VERTEX_INDEX>& ib)
+{
+	if(va.size() != vb.size() || ia != ib)
+		return false;
+
+	for(unsigned int i=0;i<va.size();i++)
+	{
+		if(!VertexWeldTraits<ExVertexStruct>::IsLike(va[i], vb[i], VERTEX_WELD_EPSILON))
+			return false;
+	}
+
+	return true;
+}
+
+namespace VertexWelding
+{
+	/** Welds generated polygon soups with the old std::set-indexing and with WorldConverter::IndexVertices */
+	bool RunBenchmark()
+	{
+		// The biggest grid still fits into 16-bit indices
+		static const unsigned int gridSizes[] = {8, 32, 96, 180};
+		const unsigned int runs = 5;
+
+		LARGE_INTEGER frequency;
+		QueryPerformanceFrequency(&frequency);
+
+		bool passed = true;
+		unsigned int seed = 12345; // Fixed, so a failure can be reproduced
+		for(unsigned int g=0;g<ARRAYSIZE(gridSizes);g++)
+		{
+			std::vector<ExVertexStruct> soup;
+			MakePolygonSoup(gridSizes[g], soup, seed);
+
+			std::vector<ExVertexStruct> refVertices, vertices;
+			std::vector<VERTEX_INDEX> refIndices, indices;
+
+			LARGE_INTEGER start, end;
+			QueryPerformanceCounter(&start);
+			for(unsigned int r=0;r<runs;r++)
+			{
+				refVertices.clear();
+				refIndices.clear();
+				IndexVerticesReference(&soup[0], soup.size(), refVertices, refIndices);
+			}
+			QueryPerformanceCounter(&end);
+			double referenceMS = (double)(end.QuadPart - start.QuadPart) * 1000.0 / (double)frequency.QuadPart / runs;
+
+			QueryPerformanceCounter(&start);
+			for(unsigned int r=0;r<runs;r++)
+			{
+				vertices.clear();
+				indices.clear();
+				WorldConverter::IndexVertices(&soup[0], soup.size(), vertices, indices);
+			}
+			QueryPerformanceCounter(&end);
+			double welderMS = (double)(end.QuadPart - start.QuadPart) * 1000.0 / (double)frequency.QuadPart / runs;
+
+			if(!IsSameMesh(refVertices, refIndices, vertices, indices))
+			{
+				LogWarn() << "Vertex welder benchmark: Result differs from the std::set-indexing with " << soup.size() << " input vertices";
+				passed = false;
+			}
+
+			LogInfo() << "Vertex welder benchmark: " << soup.size() << " input vertices, " << vertices.size() << " welded, "
+				<< indices.size() / 3 << " triangles. std::set: " << referenceMS << "ms, welder: " << welderMS << "ms";
+		}
+
+		LogInfo() << "Vertex welder benchmark " << (passed ? "passed" : "failed");
+		return passed;
+	}
+};
@@ -0,0 +1,321 @@
+#pragma once
+#include "pch.h"
+#include <algorithm>
+
+/** Tolerance used when welding vertices. Components closer than this are treated as equal. */
+const float VERTEX_WELD_EPSILON = 0.001f;
+
+/** Size of a quantization cell, relative to the epsilon. Must be at least 2, so a value can only
+	be close to one of the two borders of its cell. Bigger values make neighbour-lookups rarer. */
+const float VERTEX_WELD_CELL_SCALE = 64.0f;
+
+/** Describes which components of a vertex get quantized into the hash-key and how two vertices are compared.
+	Only the first NUM_KEYS components are used to find the cell, the full compare is done in IsLike. */
+template<typename T> struct VertexWeldTraits;
+
+template<> struct VertexWeldTraits<ExVertexStruct>
+{
+	enum { NUM_KEYS = 5 };
+
+	static void GetKeys(const ExVertexStruct& v, float* keys)
+	{
+		keys[0] = v.Position.x;
+		keys[1] = v.Position.y;
+		keys[2] = v.Position.z;
+		keys[3] = v.TexCoord.x;
+		keys[4] = v.TexCoord.y;
+	}
+
+	/** Same components as the old set-comparator in WorldConverter */
+	static bool IsLike(const ExVertexStruct& a, const ExVertexStruct& b, float eps)
+	{
+		return fabs(a.Position.x - b.Position.x) <= eps
+			&& fabs(a.Position.y - b.Position.y) <= eps
+			&& fabs(a.Position.z - b.Position.z) <= eps
+			&& fabs(a.TexCoord.x - b.TexCoord.x) <= eps
+			&& fabs(a.TexCoord.y - b.TexCoord.y) <= eps;
+	}
+};
+
+template<> struct VertexWeldTraits<ExSkelVertexStruct>
+{
+	enum { NUM_KEYS = 5 };
+
+	/** Only the first bone-position goes into the key, the others are checked in IsLike */
+	static void GetKeys(const ExSkelVertexStruct& v, float* keys)
+	{
+		keys[0] = v.Position[0].x;
+		keys[1] = v.Position[0].y;
+		keys[2] = v.Position[0].z;
+		keys[3] = v.TexCoord.x;
+		keys[4] = v.TexCoord.y;
+	}
+
+	static bool IsLike(const ExSkelVertexStruct& a, const ExSkelVertexStruct& b, float eps)
+	{
+		for(int i=0;i<4;i++)
+		{
+			if(fabs(a.Position[i].x - b.Position[i].x) > eps
+				|| fabs(a.Position[i].y - b.Position[i].y) > eps
+				|| fabs(a.Position[i].z - b.Position[i].z) > eps)
+				return false;
+		}
+
+		return fabs(a.TexCoord.x - b.TexCoord.x) <= eps
+			&& fabs(a.TexCoord.y - b.TexCoord.y) <= eps;
+	}
+};
+
+/** Welds vertices which are equal within an epsilon, in linear time.
+
+	Every vertex gets quantized into a grid-cell which is hashed into a flat open-addressing table.
+	Since two vertices closer than epsilon can still lie in different cells, the neighbouring cell
+	is also searched for every component that lies within epsilon of a cell border. */
+template<typename T>
+class VertexWelder
+{
+public:
+	enum { NUM_KEYS = VertexWeldTraits<T>::NUM_KEYS };
+
+	VertexWelder(float epsilon = VERTEX_WELD_EPSILON)
+	{
+		Epsilon = epsilon;
+		CellSize = epsilon * VERTEX_WELD_CELL_SCALE;
+		InvCellSize = 1.0f / CellSize;
+	}
+
+	/** Welds the given vertices. Writes the unique vertices in order of first appearance and
+		one index per input-vertex, like the old std::set-implementation did */
+	template<typename I>
+	void Weld(const T* input, unsigned int numInputVertices, std::vector<T>& outVertices, std::vector<I>& outIndices)
+	{
+		outVertices.clear();
+		outVertices.reserve(numInputVertices);
+		outIndices.reserve(outIndices.size() + numInputVertices);
+
+		// Keep the load factor at or below 0.5
+		unsigned int tableSize = 16;
+		while(tableSize < numInputVertices * 2)
+			tableSize <<= 1;
+
+		Mask = tableSize - 1;
+		Table.assign(tableSize, Entry());
+
+		for(unsigned int i=0;i<numInputVertices;i++)
+		{
+			float keys[NUM_KEYS];
+			int cell[NUM_KEYS];
+			int neighbour[NUM_KEYS];
+			VertexWeldTraits<T>::GetKeys(input[i], keys);
+			Quantize(keys, cell, neighbour);
+
+			unsigned int homeHash = HashCell(cell);
+			unsigned int found = FindInCell(homeHash, input[i], outVertices);
+
+			// Fall back to the neighbouring cells if we are close to a border
+			if(found == INVALID_INDEX)
+				found = FindInNeighbours(cell, neighbour, input[i], outVertices);
+
+			if(found == INVALID_INDEX)
+			{
+				found = outVertices.size();
+				outVertices.push_back(input[i]);
+				Insert(homeHash, found);
+			}
+
+			outIndices.push_back((I)found);
+		}
+
+		Table.clear();
+	}
+
+private:
+	static const unsigned int INVALID_INDEX = 0xFFFFFFFF;
+
+	struct Entry
+	{
+		Entry()
+		{
+			Hash = 0;
+			Index = INVALID_INDEX;
+		}
+
+		unsigned int Hash;
+		unsigned int Index;
+	};
+
+	/** Computes the cell of the given keys and which neighbour (-1, 0, 1) could hold a matching vertex */
+	void Quantize(const float* keys, int* cell, int* neighbour) const
+	{
+		for(int k=0;k<NUM_KEYS;k++)
+		{
+			float s = keys[k] * InvCellSize;
+			float f = floor(s);
+			float d = (s - f) * CellSize; // Distance to the lower border
+
+			cell[k] = (int)f;
+
+			if(d <= Epsilon)
+				neighbour[k] = -1;
+			else if(CellSize - d <= Epsilon)
+				neighbour[k] = 1;
+			else
+				neighbour[k] = 0;
+		}
+	}
+
+	/** Hashes a quantized cell */
+	static unsigned int HashCell(const int* cell)
+	{
+		unsigned int h = 2166136261u;
+		for(int k=0;k<NUM_KEYS;k++)
+		{
+			h ^= (unsigned int)cell[k];
+			h *= 16777619u;
+			h ^= h >> 15;
+		}
+
+		// Finalizer, spreads the bits so linear probing stays short
+		h ^= h >> 16;
+		h *= 0x85ebca6b;
+		h ^= h >> 13;
+		h *= 0xc2b2ae35;
+		h ^= h >> 16;
+		return h;
+	}
+
+	/** Searches all vertices in the cell with the given hash. Returns the smallest matching index. */
+	unsigned int FindInCell(unsigned int hash, const T& v, const std::vector<T>& vertices) const
+	{
+		unsigned int best = INVALID_INDEX;
+		for(unsigned int s = hash & Mask; Table[s].Index != INVALID_INDEX; s = (s + 1) & Mask)
+		{
+			const Entry& e = Table[s];
+			if(e.Hash == hash && e.Index < best && VertexWeldTraits<T>::IsLike(vertices[e.Index], v, Epsilon))
+				best = e.Index;
+		}
+
+		return best;
+	}
+
+	/** Searches every combination of neighbouring cells flagged by Quantize */
+	unsigned int FindInNeighbours(const int* cell, const int* neighbour, const T& v, const std::vector<T>& vertices) const
+	{
+		int dims[NUM_KEYS];
+		int numDims = 0;
+		for(int k=0;k<NUM_KEYS;k++)
+		{
+			if(neighbour[k] != 0)
+				dims[numDims++] = k;
+		}
+
+		unsigned int best = INVALID_INDEX;
+
+		// Bit n of the combination moves the cell into the neighbour of dimension dims[n]. 0 is the home-cell, which we already checked.
+		for(unsigned int c = 1; c < (1u << numDims); c++)
+		{
+			int n[NUM_KEYS];
+			memcpy(n, cell, sizeof(n));
+
+			for(int d=0;d<numDims;d++)
+			{
+				if(c & (1u << d))
+					n[dims[d]] += neighbour[dims[d]];
+			}
+
+			unsigned int f = FindInCell(HashCell(n), v, vertices);
+			best = f < best ? f : best;
+		}
+
+		return best;
+	}
+
+	/** Puts the given vertex-index into the table */
+	void Insert(unsigned int hash, unsigned int index)
+	{
+		unsigned int s = hash & Mask;
+		while(Table[s].Index != INVALID_INDEX)
+			s = (s + 1) & Mask;
+
+		Table[s].Hash = hash;
+		Table[s].Index = index;
+	}
+
+	/** Flat hashtable, allocated once per weld */
+	std::vector<Entry> Table;
+	unsigned int Mask;
+
+	float Epsilon;
+	float CellSize;
+	float InvCellSize;
+};
+
+/** Removes duplicate triangles from the given index-list. The remaining triangles are sorted
+	by their indices, the same order a std::set of index-tuples would produce. */
+inline void RemoveDuplicateTriangles(std::vector<VERTEX_INDEX>& indices)
+{
+	size_t numTris = indices.size() / 3;
+	if(!numTris)
+	{
+		indices.clear();
+		return;
+	}
+
+	// Pack the three 16-bit indices into one key. Sorting these is the same as sorting the tuples.
+	std::vector<unsigned __int64> keys(numTris);
+	for(size_t i=0;i<numTris;i++)
+	{
+		keys[i] = ((unsigned __int64)indices[i * 3 + 0] << 32)
+				| ((unsigned __int64)indices[i * 3 + 1] << 16)
+				| (unsigned __int64)indices[i * 3 + 2];
+	}
+
+	// Small meshes aren't worth the histograms
+	if(numTris < 4096)
+	{
+		std::sort(keys.begin(), keys.end());
+	}else
+	{
+		// LSD-Radixsort, one pass per index
+		std::vector<unsigned __int64> tmp(numTris);
+		std::vector<unsigned int> histogram(0x10000);
+		for(int pass=0;pass<3;pass++)
+		{
+			int shift = pass * 16;
+			std::fill(histogram.begin(), histogram.end(), 0);
+
+			for(size_t i=0;i<numTris;i++)
+				histogram[(keys[i] >> shift) & 0xFFFF]++;
+
+			unsigned int sum = 0;
+			for(unsigned int b=0;b<0x10000;b++)
+			{
+				unsigned int c = histogram[b];
+				histogram[b] = sum;
+				sum += c;
+			}
+
+			for(size_t i=0;i<numTris;i++)
+				tmp[histogram[(keys[i] >> shift) & 0xFFFF]++] = keys[i];
+
+			keys.swap(tmp);
+		}
+	}
+
+	keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+	indices.resize(keys.size() * 3);
+	for(size_t i=0;i<keys.size();i++)
+	{
+		indices[i * 3 + 0] = (VERTEX_INDEX)(keys[i] >> 32);
+		indices[i * 3 + 1] = (VERTEX_INDEX)(keys[i] >> 16);
+		indices[i * 3 + 2] = (VERTEX_INDEX)keys[i];
+	}
+}
+
+namespace VertexWelding
+{
+	/** Welds generated polygon soups with the old std::set-indexing and with WorldConverter::IndexVertices, checks that
+		both give the same mesh and logs the timings */
+	bool RunBenchmark();
+};
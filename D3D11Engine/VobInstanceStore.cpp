@@ -0,0 +1,190 @@
+#include "pch.h"
+#include "VobInstanceStore.h"
+#include "Engine.h"
+#include "BaseGraphicsEngine.h"
+#include "D3D11VertexBuffer.h"
+
+/** Doubles the capacity until "num" fits */
+static unsigned int GetGrownCapacity(unsigned int capacity, unsigned int num)
+{
+	capacity = std::max(capacity, VOB_INSTANCE_MIN_CAPACITY);
+	while(capacity < num)
+		capacity *= 2;
+
+	return capacity;
+}
+
+VobInstanceStore::VobInstanceStore()
+{
+	NumUploadedRemaps = 0;
+	InstanceBuffer = NULL;
+	InstanceCapacity = 0;
+	RemapBuffer = NULL;
+	RemapCapacity = 0;
+}
+
+VobInstanceStore::~VobInstanceStore()
+{
+	delete InstanceBuffer;
+	delete RemapBuffer;
+}
+
+/** Returns a free slot. Its data is undefined until SetInstance was called. */
+unsigned int VobInstanceStore::AllocateSlot()
+{
+	if(!FreeSlots.empty())
+	{
+		unsigned int slot = FreeSlots.back();
+		FreeSlots.pop_back();
+		return slot;
+	}
+
+	Instances.push_back(VobInstanceInfo());
+	SlotIsDirty.push_back(false);
+	return Instances.size() - 1;
+}
+
+/** Gives the slot back, so it can be reused */
+void VobInstanceStore::FreeSlot(unsigned int slot)
+{
+	if(slot == VOB_INSTANCE_NO_SLOT)
+		return;
+
+	FreeSlots.push_back(slot);
+}
+
+/** Sets the data of the slot. It's uploaded with the next UploadDirtySlots. */
+void VobInstanceStore::SetInstance(unsigned int slot, const VobInstanceInfo& instance)
+{
+	Instances[slot] = instance;
+
+	if(!SlotIsDirty[slot])
+	{
+		SlotIsDirty[slot] = true;
+		DirtySlots.push_back(slot);
+	}
+}
+
+/** Frees all slots */
+void VobInstanceStore::Clear()
+{
+	Instances.clear();
+	FreeSlots.clear();
+	DirtySlots.clear();
+	SlotIsDirty.clear();
+}
+
+/** Uploads the slots which changed since the last call. Grows the buffer if needed. */
+XRESULT VobInstanceStore::UploadDirtySlots()
+{
+	if(Instances.empty())
+		return XR_SUCCESS;
+
+	if(Instances.size() > InstanceCapacity)
+	{
+		// Puts in all slots, so nothing is dirty afterwards
+		GrowInstanceBuffer();
+	}else if(!DirtySlots.empty())
+	{
+		// Upload close slots together, that saves a lot of calls when a whole group of vobs was added
+		std::sort(DirtySlots.begin(), DirtySlots.end());
+
+		unsigned int start = DirtySlots[0];
+		unsigned int end = start + 1;
+		for(unsigned int i=1;i<=DirtySlots.size();i++)
+		{
+			if(i < DirtySlots.size() && DirtySlots[i] - end <= VOB_INSTANCE_MAX_UPLOAD_GAP)
+			{
+				end = DirtySlots[i] + 1;
+				continue;
+			}
+
+			InstanceBuffer->UpdateBufferRegion(&Instances[start], start * sizeof(VobInstanceInfo), (end - start) * sizeof(VobInstanceInfo));
+
+			if(i < DirtySlots.size())
+			{
+				start = DirtySlots[i];
+				end = start + 1;
+			}
+		}
+	}
+
+	for(unsigned int i=0;i<DirtySlots.size();i++)
+		SlotIsDirty[DirtySlots[i]] = false;
+
+	DirtySlots.clear();
+
+	return XR_SUCCESS;
+}
+
+/** Starts a new remap-list. Ranges of the last frame are invalid after this. */
+void VobInstanceStore::BeginFrame()
+{
+	FrameRemaps.clear();
+	NumUploadedRemaps = 0;
+}
+
+/** Appends slot-indices to the remap-buffer of this frame and returns where they start */
+unsigned int VobInstanceStore::AppendRemaps(const VobInstanceRemapInfo* remaps, unsigned int num)
+{
+	unsigned int start = FrameRemaps.size();
+	if(!num)
+		return start;
+
+	FrameRemaps.insert(FrameRemaps.end(), remaps, remaps + num);
+
+	if(FrameRemaps.size() > RemapCapacity)
+	{
+		// Puts in everything of this frame, so the earlier ranges are still there
+		GrowRemapBuffer();
+		return start;
+	}
+
+	// Only discard on the first write, the ranges from before may still be needed
+	byte* data;
+	UINT size;
+	if(XR_SUCCESS != RemapBuffer->Map(NumUploadedRemaps == 0 ? D3D11VertexBuffer::M_WRITE_DISCARD : D3D11VertexBuffer::M_WRITE_NO_OVERWRITE, (void**)&data, &size))
+		return start;
+
+	memcpy(data + NumUploadedRemaps * sizeof(VobInstanceRemapInfo), &FrameRemaps[NumUploadedRemaps], (FrameRemaps.size() - NumUploadedRemaps) * sizeof(VobInstanceRemapInfo));
+	RemapBuffer->Unmap();
+
+	NumUploadedRemaps = FrameRemaps.size();
+
+	return start;
+}
+
+/** Recreates the instance-buffer, big enough for all slots, and puts them in */
+void VobInstanceStore::GrowInstanceBuffer()
+{
+	InstanceCapacity = GetGrownCapacity(InstanceCapacity, Instances.size());
+
+	LogInfo() << "Growing vob instance buffer to " << InstanceCapacity << " slots";
+
+	delete InstanceBuffer;
+	Engine::GraphicsEngine->CreateVertexBuffer(&InstanceBuffer);
+	InstanceBuffer->Init(NULL, InstanceCapacity * sizeof(VobInstanceInfo), D3D11VertexBuffer::B_SHADER_RESOURCE, D3D11VertexBuffer::U_DEFAULT, D3D11VertexBuffer::CA_NONE, "VobInstanceStore::InstanceBuffer", sizeof(VobInstanceInfo));
+	InstanceBuffer->UpdateBufferRegion(&Instances[0], 0, Instances.size() * sizeof(VobInstanceInfo));
+}
+
+/** Recreates the remap-buffer, big enough for all remap-indices of this frame, and puts them in */
+void VobInstanceStore::GrowRemapBuffer()
+{
+	RemapCapacity = GetGrownCapacity(RemapCapacity, FrameRemaps.size());
+
+	LogInfo() << "Growing vob remap buffer to " << RemapCapacity << " instances";
+
+	delete RemapBuffer;
+	Engine::GraphicsEngine->CreateVertexBuffer(&RemapBuffer);
+	RemapBuffer->Init(NULL, RemapCapacity * sizeof(VobInstanceRemapInfo), D3D11VertexBuffer::B_VERTEXBUFFER, D3D11VertexBuffer::U_DYNAMIC, D3D11VertexBuffer::CA_WRITE, "VobInstanceStore::RemapBuffer");
+
+	byte* data;
+	UINT size;
+	if(XR_SUCCESS == RemapBuffer->Map(D3D11VertexBuffer::M_WRITE_DISCARD, (void**)&data, &size))
+	{
+		memcpy(data, &FrameRemaps[0], FrameRemaps.size() * sizeof(VobInstanceRemapInfo));
+		RemapBuffer->Unmap();
+	}
+
+	NumUploadedRemaps = FrameRemaps.size();
+}
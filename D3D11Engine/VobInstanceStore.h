@@ -0,0 +1,88 @@
+#pragma once
+#include "pch.h"
+#include "ConstantBufferStructs.h"
+
+class D3D11VertexBuffer;
+
+/** Slot of vobs which aren't in the store */
+const unsigned int VOB_INSTANCE_NO_SLOT = 0xFFFFFFFF;
+
+/** Minimum number of slots/remap-indices the buffers are created with. They grow by doubling from there. */
+const unsigned int VOB_INSTANCE_MIN_CAPACITY = 2048;
+
+/** Dirty slots closer together than this are uploaded in one go, together with the clean ones between them */
+const unsigned int VOB_INSTANCE_MAX_UPLOAD_GAP = 8;
+
+/** Persistent instance-data of the static vobs. Every vob gets a fixed slot in a structured buffer, which is only
+	re-uploaded where the vob changed. The vobs visible in a frame are then just a list of slot-indices,
+	which is fed to the shaders as per-instance vertexbuffer (see VS_ExRemapInstancedObj). */
+class VobInstanceStore
+{
+public:
+	VobInstanceStore();
+	~VobInstanceStore();
+
+	/** Returns a free slot. Its data is undefined until SetInstance was called. */
+	unsigned int AllocateSlot();
+
+	/** Gives the slot back, so it can be reused */
+	void FreeSlot(unsigned int slot);
+
+	/** Sets the data of the slot. It's uploaded with the next UploadDirtySlots. */
+	void SetInstance(unsigned int slot, const VobInstanceInfo& instance);
+
+	/** Returns the data of the slot */
+	const VobInstanceInfo& GetInstance(unsigned int slot) const {return Instances[slot];}
+
+	/** Frees all slots */
+	void Clear();
+
+	/** Uploads the slots which changed since the last call. Grows the buffer if needed. */
+	XRESULT UploadDirtySlots();
+
+	/** Starts a new remap-list. Ranges of the last frame are invalid after this. */
+	void BeginFrame();
+
+	/** Appends slot-indices to the remap-buffer of this frame and returns where they start.
+		Ranges appended earlier in the frame stay valid. */
+	unsigned int AppendRemaps(const VobInstanceRemapInfo* remaps, unsigned int num);
+
+	/** Structured buffer holding all slots */
+	D3D11VertexBuffer* GetInstanceBuffer(){return InstanceBuffer;}
+
+	/** Returns the i-th slot-index appended this frame */
+	unsigned int GetRemap(unsigned int i) const {return FrameRemaps[i].InstanceRemapIndex;}
+
+	/** Per-instance vertexbuffer with the remap-indices of this frame */
+	D3D11VertexBuffer* GetRemapBuffer(){return RemapBuffer;}
+
+	/** Number of slots in use */
+	unsigned int GetNumUsedSlots() const {return Instances.size() - FreeSlots.size();}
+
+private:
+	/** Recreates the buffers, big enough for all slots/remap-indices, and puts them in */
+	void GrowInstanceBuffer();
+	void GrowRemapBuffer();
+
+	/** CPU-copy of all slots */
+	std::vector<VobInstanceInfo> Instances;
+
+	/** Slots which were freed and can be reused */
+	std::vector<unsigned int> FreeSlots;
+
+	/** Slots which changed since the last upload. Each is only in here once. */
+	std::vector<unsigned int> DirtySlots;
+	std::vector<bool> SlotIsDirty;
+
+	/** Remap-indices of this frame. Kept so the buffer can be recreated without losing them. */
+	std::vector<VobInstanceRemapInfo> FrameRemaps;
+
+	/** Number of remap-indices already in the buffer */
+	unsigned int NumUploadedRemaps;
+
+	D3D11VertexBuffer* InstanceBuffer;
+	unsigned int InstanceCapacity;
+
+	D3D11VertexBuffer* RemapBuffer;
+	unsigned int RemapCapacity;
+};
@@ -0,0 +1,215 @@
+#include "pch.h"
+#include "WorldCacheFile.h"
+#include "WorldObjects.h"
+
+WorldCacheFile::WorldCacheFile(void)
+{
+	Header = NULL;
+}
+
+WorldCacheFile::~WorldCacheFile(void)
+{
+	Close();
+}
+
+/** Writes the converted world */
+XRESULT WorldCacheFile::Write(const std::string& file,
+	unsigned __int64 polygonHash,
+	const WorldSectionGrid& sections,
+	const std::unordered_map<WorldMeshInfo*, unsigned int>& firstPolygons,
+	const std::vector<ExVertexStruct>& wrappedVertices,
+	const std::vector<unsigned int>& wrappedIndices)
+{
+	WorldCacheHeader header;
+	ZeroMemory(&header, sizeof(header));
+	header.Version = WORLDCACHE_VERSION;
+	header.Magic = WORLDCACHE_MAGIC;
+	header.PolygonHash = polygonHash;
+
+	// Flatten the sections and their meshes into the tables
+	std::vector<WorldCacheSectionEntry> sectionEntries;
+	std::vector<WorldCacheMeshEntry> meshEntries;
+	std::vector<const WorldMeshInfo*> meshes;
+	for(std::vector<WorldMeshSectionInfo*>::const_iterator its = sections.GetSections().begin(); its != sections.GetSections().end(); its++)
+	{
+		const WorldMeshSectionInfo& section = **its;
+
+		WorldCacheSectionEntry s;
+		ZeroMemory(&s, sizeof(s));
+		s.X = section.WorldCoordinates.x;
+		s.Y = section.WorldCoordinates.y;
+		s.BoundingBoxMin = section.BoundingBox.Min;
+		s.BoundingBoxMax = section.BoundingBox.Max;
+		s.FirstMesh = meshEntries.size();
+		s.NumMeshes = section.WorldMeshes.size();
+		sectionEntries.push_back(s);
+
+		for(auto it = section.WorldMeshes.begin(); it != section.WorldMeshes.end(); it++)
+		{
+			auto fp = firstPolygons.find((*it).second);
+			if(fp == firstPolygons.end())
+			{
+				LogWarn() << "Can't cache world, mesh without source-polygon";
+				return XR_INVALID_ARG;
+			}
+
+			WorldCacheMeshEntry m;
+			ZeroMemory(&m, sizeof(m));
+			m.FirstPolygon = (*fp).second;
+			m.BaseIndexLocation = (*it).second->BaseIndexLocation;
+			m.NumVertices = (*it).second->Vertices.size();
+			m.NumIndices = (*it).second->Indices.size();
+			meshEntries.push_back(m);
+			meshes.push_back((*it).second);
+		}
+	}
+
+	header.NumSections = sectionEntries.size();
+	header.NumMeshes = meshEntries.size();
+	header.SectionTableOffset = sizeof(WorldCacheHeader);
+	header.MeshTableOffset = header.SectionTableOffset + sectionEntries.size() * sizeof(WorldCacheSectionEntry);
+
+	// Put the blobs after the tables, each one aligned
+	unsigned int offset = Toolbox::AlignOffset(header.MeshTableOffset + meshEntries.size() * sizeof(WorldCacheMeshEntry), WORLDCACHE_ALIGNMENT);
+	header.WrappedVertexOffset = offset;
+	header.NumWrappedVertices = wrappedVertices.size();
+	offset = Toolbox::AlignOffset(offset + wrappedVertices.size() * sizeof(ExVertexStruct), WORLDCACHE_ALIGNMENT);
+
+	header.WrappedIndexOffset = offset;
+	header.NumWrappedIndices = wrappedIndices.size();
+	offset = Toolbox::AlignOffset(offset + wrappedIndices.size() * sizeof(unsigned int), WORLDCACHE_ALIGNMENT);
+
+	for(unsigned int i=0;i<meshEntries.size();i++)
+	{
+		meshEntries[i].VertexOffset = offset;
+		offset = Toolbox::AlignOffset(offset + meshEntries[i].NumVertices * sizeof(ExVertexStruct), WORLDCACHE_ALIGNMENT);
+
+		meshEntries[i].IndexOffset = offset;
+		offset = Toolbox::AlignOffset(offset + meshEntries[i].NumIndices * sizeof(VERTEX_INDEX), WORLDCACHE_ALIGNMENT);
+	}
+
+	header.FileSize = offset;
+
+	FILE* f = fopen(file.c_str(), "wb");
+	if(!f)
+	{
+		LogWarn() << "Failed to create world cache file: " << file;
+		return XR_FAILED;
+	}
+
+	// Reserve space for the header, it gets written when the hash is known
+	unsigned __int64 hash = Toolbox::HASH_DATA_SEED;
+	fwrite(&header, sizeof(header), 1, f);
+	unsigned int pos = sizeof(header);
+
+	Toolbox::WriteHashedData(f, pos, header.SectionTableOffset, sectionEntries.empty() ? NULL : &sectionEntries[0], sectionEntries.size() * sizeof(WorldCacheSectionEntry), hash);
+	Toolbox::WriteHashedData(f, pos, header.MeshTableOffset, meshEntries.empty() ? NULL : &meshEntries[0], meshEntries.size() * sizeof(WorldCacheMeshEntry), hash);
+	Toolbox::WriteHashedData(f, pos, header.WrappedVertexOffset, wrappedVertices.empty() ? NULL : &wrappedVertices[0], wrappedVertices.size() * sizeof(ExVertexStruct), hash);
+	Toolbox::WriteHashedData(f, pos, header.WrappedIndexOffset, wrappedIndices.empty() ? NULL : &wrappedIndices[0], wrappedIndices.size() * sizeof(unsigned int), hash);
+
+	for(unsigned int i=0;i<meshEntries.size();i++)
+	{
+		Toolbox::WriteHashedData(f, pos, meshEntries[i].VertexOffset, meshes[i]->Vertices.empty() ? NULL : &meshes[i]->Vertices[0], meshEntries[i].NumVertices * sizeof(ExVertexStruct), hash);
+		Toolbox::WriteHashedData(f, pos, meshEntries[i].IndexOffset, meshes[i]->Indices.empty() ? NULL : &meshes[i]->Indices[0], meshEntries[i].NumIndices * sizeof(VERTEX_INDEX), hash);
+	}
+
+	Toolbox::WriteHashedData(f, pos, offset, NULL, 0, hash);
+
+	header.DataHash = hash;
+	fseek(f, 0, SEEK_SET);
+	fwrite(&header, sizeof(header), 1, f);
+
+	fclose(f);
+
+	return XR_SUCCESS;
+}
+
+/** Reads and validates the given file */
+XRESULT WorldCacheFile::Open(const std::string& file, unsigned __int64 polygonHash)
+{
+	Close();
+
+	FILE* f = fopen(file.c_str(), "rb");
+	if(!f)
+		return XR_FAILED;
+
+	// Check the header first, so stale caches don't get read completely
+	WorldCacheHeader header;
+	if(fread(&header, sizeof(header), 1, f) != 1
+		|| header.Magic != WORLDCACHE_MAGIC
+		|| header.Version != WORLDCACHE_VERSION
+		|| header.PolygonHash != polygonHash
+		|| header.FileSize <= sizeof(WorldCacheHeader))
+	{
+		fclose(f);
+		return XR_FAILED;
+	}
+
+	Data.resize((size_t)header.FileSize);
+	memcpy(&Data[0], &header, sizeof(header));
+	size_t read = fread(&Data[sizeof(header)], 1, Data.size() - sizeof(header), f);
+	fclose(f);
+
+	if(read != Data.size() - sizeof(header))
+	{
+		LogWarn() << "World cache file is truncated: " << file;
+		Close();
+		return XR_FAILED;
+	}
+
+	if(Toolbox::HashData(&Data[sizeof(header)], Data.size() - sizeof(header)) != header.DataHash)
+	{
+		LogWarn() << "World cache file checksum mismatch: " << file;
+		Close();
+		return XR_FAILED;
+	}
+
+	Header = (const WorldCacheHeader*)&Data[0];
+
+	// Validate the tables before anything points into the data
+	unsigned __int64 size = Data.size();
+	if(Header->SectionTableOffset + (unsigned __int64)Header->NumSections * sizeof(WorldCacheSectionEntry) > size
+		|| Header->MeshTableOffset + (unsigned __int64)Header->NumMeshes * sizeof(WorldCacheMeshEntry) > size
+		|| Header->WrappedVertexOffset + (unsigned __int64)Header->NumWrappedVertices * sizeof(ExVertexStruct) > size
+		|| Header->WrappedIndexOffset + (unsigned __int64)Header->NumWrappedIndices * sizeof(unsigned int) > size)
+	{
+		LogWarn() << "World cache file is corrupt: " << file;
+		Close();
+		return XR_FAILED;
+	}
+
+	const WorldCacheSectionEntry* sections = GetSections();
+	for(unsigned int i=0;i<Header->NumSections;i++)
+	{
+		if((unsigned __int64)sections[i].FirstMesh + sections[i].NumMeshes > Header->NumMeshes)
+		{
+			LogWarn() << "World cache file has invalid section " << i << ": " << file;
+			Close();
+			return XR_FAILED;
+		}
+	}
+
+	const WorldCacheMeshEntry* meshes = GetMeshes();
+	for(unsigned int i=0;i<Header->NumMeshes;i++)
+	{
+		const WorldCacheMeshEntry& m = meshes[i];
+		if(m.VertexOffset + (unsigned __int64)m.NumVertices * sizeof(ExVertexStruct) > size
+			|| m.IndexOffset + (unsigned __int64)m.NumIndices * sizeof(VERTEX_INDEX) > size
+			|| (unsigned __int64)m.BaseIndexLocation + m.NumIndices > Header->NumWrappedIndices)
+		{
+			LogWarn() << "World cache file has invalid mesh " << i << ": " << file;
+			Close();
+			return XR_FAILED;
+		}
+	}
+
+	return XR_SUCCESS;
+}
+
+/** Frees the loaded data */
+void WorldCacheFile::Close()
+{
+	Header = NULL;
+	Data.clear();
+	Data.shrink_to_fit();
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include "pch.h"
+
+/** Current version of the .wcache-format. Bump this whenever the output of WorldConverter::ConvertWorldMesh changes. */
+const int WORLDCACHE_VERSION = 1;
+
+/** "GWCH" */
+const unsigned int WORLDCACHE_MAGIC = 0x48435747;
+
+/** Alignment of the vertex- and index-blobs inside the file */
+const unsigned int WORLDCACHE_ALIGNMENT = 16;
+
+/** Header of a world-cache file. All offsets are relative to the start of the file. */
+struct WorldCacheHeader
+{
+	int Version;
+	unsigned int Magic;
+	unsigned int NumSections;
+	unsigned int NumMeshes;
+	unsigned int SectionTableOffset;
+	unsigned int MeshTableOffset;
+	unsigned int WrappedVertexOffset;
+	unsigned int NumWrappedVertices;
+	unsigned int WrappedIndexOffset;
+	unsigned int NumWrappedIndices;
+	unsigned __int64 PolygonHash; // Hash of the polygon-stream the cache was built from
+	unsigned __int64 DataHash; // Hash of everything after this header
+	unsigned __int64 FileSize;
+};
+
+/** Entry of the section table. The meshes of a section are stored next to each other in the mesh table. */
+struct WorldCacheSectionEntry
+{
+	int X;
+	int Y;
+	float3 BoundingBoxMin;
+	float3 BoundingBoxMax;
+	unsigned int FirstMesh;
+	unsigned int NumMeshes;
+};
+
+/** Entry of the mesh table */
+struct WorldCacheMeshEntry
+{
+	unsigned int FirstPolygon; // Index of the first polygon using this mesh. Its material makes the MeshKey on load.
+	unsigned int BaseIndexLocation; // Offset into the wrapped index-buffer
+	unsigned int VertexOffset;
+	unsigned int NumVertices;
+	unsigned int IndexOffset;
+	unsigned int NumIndices;
+};
+
+class WorldSectionGrid;
+struct WorldMeshInfo;
+
+/** Reads and writes .wcache-files, which hold the fully converted worldmesh of a level */
+class WorldCacheFile
+{
+public:
+	WorldCacheFile(void);
+	~WorldCacheFile(void);
+
+	/** Writes the converted world. firstPolygons must hold an entry for every mesh of the given sections. */
+	static XRESULT Write(const std::string& file,
+		unsigned __int64 polygonHash,
+		const WorldSectionGrid& sections,
+		const std::unordered_map<WorldMeshInfo*, unsigned int>& firstPolygons,
+		const std::vector<ExVertexStruct>& wrappedVertices,
+		const std::vector<unsigned int>& wrappedIndices);
+
+	/** Reads and validates the given file. Fails if it wasn't built from the polygons with the given hash. */
+	XRESULT Open(const std::string& file, unsigned __int64 polygonHash);
+
+	/** Frees the loaded data. All pointers returned by this get invalid. */
+	void Close();
+
+	/** Returns the table of sections */
+	const WorldCacheSectionEntry* GetSections(){return (const WorldCacheSectionEntry*)&Data[Header->SectionTableOffset];}
+	unsigned int GetNumSections(){return Header->NumSections;}
+
+	/** Returns the table of meshes */
+	const WorldCacheMeshEntry* GetMeshes(){return (const WorldCacheMeshEntry*)&Data[Header->MeshTableOffset];}
+	unsigned int GetNumMeshes(){return Header->NumMeshes;}
+
+	/** Returns the geometry of the given mesh */
+	const ExVertexStruct* GetMeshVertices(const WorldCacheMeshEntry& mesh){return (const ExVertexStruct*)&Data[mesh.VertexOffset];}
+	const VERTEX_INDEX* GetMeshIndices(const WorldCacheMeshEntry& mesh){return (const VERTEX_INDEX*)&Data[mesh.IndexOffset];}
+
+	/** Returns the wrapped, smoothed geometry of the whole world */
+	const ExVertexStruct* GetWrappedVertices(){return (const ExVertexStruct*)&Data[Header->WrappedVertexOffset];}
+	unsigned int GetNumWrappedVertices(){return Header->NumWrappedVertices;}
+	const unsigned int* GetWrappedIndices(){return (const unsigned int*)&Data[Header->WrappedIndexOffset];}
+	unsigned int GetNumWrappedIndices(){return Header->NumWrappedIndices;}
+
+private:
+	/** Whole file, read at once */
+	std::vector<unsigned char> Data;
+	const WorldCacheHeader* Header;
+};
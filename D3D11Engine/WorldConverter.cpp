@@ -22,6 +22,10 @@
 #include "D3D11Texture.h"
 #include "D3D7\MyDirectDrawSurface7.h"
 #include "zCQuadMark.h"
+#include "VertexWelder.h"
+#include "MeshCacheFile.h"
+#include "WorldCacheFile.h"
+#include "ThreadPool.h"
 
 
 WorldConverter::WorldConverter(void)
@@ -35,10 +39,32 @@ WorldConverter::~WorldConverter(void)
 
 
 
-/** Collects all world-polys in the specific range. Drops all materials that have no alphablending */
-void WorldConverter::WorldMeshCollectPolyRange(const D3DXVECTOR3& position, float range, std::map<int, std::map<int, WorldMeshSectionInfo>>& inSections, std::map<MeshKey, WorldMeshInfo*, cmpMeshKey>& outMeshes)
+/** Gathers the worldmeshes WorldMeshCollectPolyRange needs for the given position */
+void WorldConverter::WorldMeshGetRangeSources(const D3DXVECTOR3& position, WorldSectionGrid& inSections, std::vector<WorldMeshRangeSource>& outSources)
 {
 	INT2 s = GetSectionOfPos(position);
+
+	std::vector<WorldMeshSectionInfo*> sections;
+	inSections.GetSectionsInRange(s, 2, sections);
+
+	for(std::vector<WorldMeshSectionInfo*>::const_iterator its = sections.begin(); its != sections.end(); its++)
+	{
+		WorldMeshSectionInfo& section = **its;
+
+		for(std::map<MeshKey, WorldMeshInfo*>::const_iterator it = section.WorldMeshes.begin(); it != section.WorldMeshes.end();it++)
+		{
+			WorldMeshRangeSource source;
+			source.Key = (*it).first;
+			source.Mesh = (*it).second;
+			source.AlphaTested = (*it).first.Texture && (*it).first.Texture->HasAlphaChannel();
+			outSources.push_back(source);
+		}
+	}
+}
+
+/** Collects all world-polys in the specific range. Drops all materials that have no alphablending */
+void WorldConverter::WorldMeshCollectPolyRange(const D3DXVECTOR3& position, float range, const std::vector<WorldMeshRangeSource>& inSources, std::map<MeshKey, WorldMeshInfo*, cmpMeshKey>& outMeshes)
+{
 	MeshKey opaqueKey;
 	opaqueKey.Material = NULL;
 	opaqueKey.Info = NULL;
@@ -47,54 +73,43 @@ void WorldConverter::WorldMeshCollectPolyRange(const D3DXVECTOR3& position, floa
 	WorldMeshInfo* opaqueMesh = new WorldMeshInfo;
 	outMeshes[opaqueKey] = opaqueMesh;
 
-	// Generate the meshes
-	for(std::map<int, std::map<int, WorldMeshSectionInfo>>::iterator itx = Engine::GAPI->GetWorldSections().begin(); itx != Engine::GAPI->GetWorldSections().end(); itx++)
+	// Check all polys from all meshes around the position
+	for(std::vector<WorldMeshRangeSource>::const_iterator it = inSources.begin(); it != inSources.end(); it++)
 	{
-		for(std::map<int, WorldMeshSectionInfo>::iterator ity = (*itx).second.begin(); ity != (*itx).second.end(); ity++)
-		{
-			D3DXVECTOR2 a = D3DXVECTOR2((float)((*itx).first - s.x), (float)((*ity).first - s.y));
-			if(D3DXVec2Length(&a) < 2)
-			{
-				WorldMeshSectionInfo& section = (*ity).second;
+		const WorldMeshInfo* source = (*it).Mesh;
+		WorldMeshInfo* m;
 
-				// Check all polys from all meshes
-				for(std::map<MeshKey, WorldMeshInfo*>::const_iterator it = section.WorldMeshes.begin(); it != section.WorldMeshes.end();it++)
-				{
-					WorldMeshInfo* m;
-					
-					// Create new mesh-part for alphatested surfaces
-					if((*it).first.Texture && (*it).first.Texture->HasAlphaChannel())
-					{
-						m = new WorldMeshInfo;
-						outMeshes[(*it).first] = m;
-					}else
-					{
-						// Just use the same mesh for opaque surfaces
-						m = opaqueMesh;
-					}
+		// Create new mesh-part for alphatested surfaces
+		if((*it).AlphaTested)
+		{
+			m = new WorldMeshInfo;
+			outMeshes[(*it).Key] = m;
+		}else
+		{
+			// Just use the same mesh for opaque surfaces
+			m = opaqueMesh;
+		}
 
-					for(unsigned int i=0;i<(*it).second->Indices.size();i+=3)
-					{
-						// Check if one of them is in range
-						float range2 = range*range;
-						if(D3DXVec3LengthSq(&(position - *(*it).second->Vertices[(*it).second->Indices[i+0]].Position.toD3DXVECTOR3())) < range2
-							|| D3DXVec3LengthSq(&(position - *(*it).second->Vertices[(*it).second->Indices[i+1]].Position.toD3DXVECTOR3())) < range2
-							|| D3DXVec3LengthSq(&(position - *(*it).second->Vertices[(*it).second->Indices[i+2]].Position.toD3DXVECTOR3())) < range2)
-						{
-							for(int v=0;v<3;v++)
-								m->Vertices.push_back((*it).second->Vertices[(*it).second->Indices[i+v]]);
-						}
-					}
-				}
+		for(unsigned int i=0;i<source->Indices.size();i+=3)
+		{
+			// Check if one of them is in range
+			float range2 = range*range;
+			if(D3DXVec3LengthSq(&(position - *source->Vertices[source->Indices[i+0]].Position.toD3DXVECTOR3())) < range2
+				|| D3DXVec3LengthSq(&(position - *source->Vertices[source->Indices[i+1]].Position.toD3DXVECTOR3())) < range2
+				|| D3DXVec3LengthSq(&(position - *source->Vertices[source->Indices[i+2]].Position.toD3DXVECTOR3())) < range2)
+			{
+				for(int v=0;v<3;v++)
+					m->Vertices.push_back(source->Vertices[source->Indices[i+v]]);
 			}
 		}
 	}
 
 	// Index all meshes
-	for(auto it=outMeshes.begin();it!=outMeshes.end();it++)
+	for(auto it=outMeshes.begin();it!=outMeshes.end();)
 	{
 		if((*it).second->Vertices.empty())
 		{
+			delete (*it).second;
 			it = outMeshes.erase(it);
 			continue;
 		}
@@ -106,6 +121,9 @@ void WorldConverter::WorldMeshCollectPolyRange(const D3DXVECTOR3& position, floa
 		(*it).second->Vertices = vertices;
 		(*it).second->Indices = indices;
 
+		// Group the triangles by cube-face, so the shadow-pass can skip the faces a group isn't in
+		SortIndicesByCubeFace(position, (*it).second);
+
 		// Create the buffers
 		Engine::GraphicsEngine->CreateVertexBuffer(&(*it).second->MeshVertexBuffer);
 		Engine::GraphicsEngine->CreateVertexBuffer(&(*it).second->MeshIndexBuffer);
@@ -113,24 +131,97 @@ void WorldConverter::WorldMeshCollectPolyRange(const D3DXVECTOR3& position, floa
 		// Init and fill them
 		(*it).second->MeshVertexBuffer->Init(&(*it).second->Vertices[0], (*it).second->Vertices.size() * sizeof(ExVertexStruct), D3D11VertexBuffer::B_VERTEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
 		(*it).second->MeshIndexBuffer->Init(&(*it).second->Indices[0], (*it).second->Indices.size() * sizeof(VERTEX_INDEX), D3D11VertexBuffer::B_INDEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
+
+		it++;
+	}
+}
+
+/** Sorts the triangles of the given mesh by the face of a shadow-cube at position they mostly lie in */
+void WorldConverter::SortIndicesByCubeFace(const D3DXVECTOR3& position, WorldMeshInfo* mesh)
+{
+	std::vector<VERTEX_INDEX> faceIndices[6];
+	D3DXVECTOR3 faceMin[6];
+	D3DXVECTOR3 faceMax[6];
+	for(int f=0;f<6;f++)
+	{
+		faceMin[f] = D3DXVECTOR3(FLT_MAX, FLT_MAX, FLT_MAX);
+		faceMax[f] = D3DXVECTOR3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	}
+
+	for(unsigned int i=0;i<mesh->Indices.size();i+=3)
+	{
+		D3DXVECTOR3 v[3];
+		for(int j=0;j<3;j++)
+			v[j] = *mesh->Vertices[mesh->Indices[i+j]].Position.toD3DXVECTOR3();
+
+		// The largest axis of the direction to the triangle decides its face
+		D3DXVECTOR3 d = (v[0] + v[1] + v[2]) / 3.0f - position;
+		float ax = fabs(d.x), ay = fabs(d.y), az = fabs(d.z);
+
+		int face;
+		if(ax >= ay && ax >= az)
+			face = d.x >= 0.0f ? 0 : 1;
+		else if(ay >= az)
+			face = d.y >= 0.0f ? 2 : 3;
+		else
+			face = d.z >= 0.0f ? 4 : 5;
+
+		for(int j=0;j<3;j++)
+		{
+			faceIndices[face].push_back(mesh->Indices[i+j]);
+			D3DXVec3Minimize(&faceMin[face], &faceMin[face], &v[j]);
+			D3DXVec3Maximize(&faceMax[face], &faceMax[face], &v[j]);
+		}
+	}
+
+	mesh->Indices.clear();
+	mesh->CubeFaceRanges.clear();
+
+	for(int f=0;f<6;f++)
+	{
+		if(faceIndices[f].empty())
+			continue;
+
+		// Triangles crossing the border can reach into the neighbouring faces, so keep the bounds of the whole range
+		CubeFaceIndexRange r;
+		r.IndexOffset = mesh->Indices.size();
+		r.NumIndices = faceIndices[f].size();
+		r.Center = (faceMin[f] + faceMax[f]) * 0.5f;
+		r.Radius = D3DXVec3Length(&(faceMax[f] - r.Center));
+		mesh->CubeFaceRanges.push_back(r);
+
+		mesh->Indices.insert(mesh->Indices.end(), faceIndices[f].begin(), faceIndices[f].end());
 	}
 }
 
 /** Converts a loaded custommesh to be the worldmesh */
-XRESULT WorldConverter::LoadWorldMeshFromFile(const std::string& file, std::map<int, std::map<int, WorldMeshSectionInfo>>* outSections, WorldInfo* info, MeshInfo** outWrappedMesh)
+XRESULT WorldConverter::LoadWorldMeshFromFile(const std::string& file, WorldSectionGrid* outSections, WorldInfo* info, MeshInfo** outWrappedMesh)
 {
 	GMesh* mesh = new GMesh();
 
 	const float worldScale = 100.0f;
+	std::string cacheFile = file + ".mcache";
 
-	// Check if we have this file cached
-	if(Toolbox::FileExists((file + ".mcache").c_str()))
+	// Check if we have this file cached and if the cache was built from the current file
+	unsigned __int64 sourceHash = MeshCacheFile::HashFile(file);
+	bool cacheLoaded = false;
+	if(Toolbox::FileExists(cacheFile))
 	{
-		// Load the meshfile, cached
-		mesh->LoadMesh((file + ".mcache").c_str(), worldScale);
-	}else
+		if(MeshCacheFile::IsUpToDate(cacheFile, sourceHash))
+		{
+			// Load the meshfile, cached
+			cacheLoaded = mesh->LoadMesh(cacheFile, worldScale) == XR_SUCCESS;
+		}else
+		{
+			LogInfo() << "Cache file is out of date: " << cacheFile;
+		}
+	}
+	
+	if(!cacheLoaded)
 	{
 		// Create cache-file
+		delete mesh;
+		mesh = new GMesh();
 		mesh->LoadMesh(file, worldScale);
 
 		std::vector<MeshInfo *>& meshes = mesh->GetMeshes();
@@ -144,12 +235,11 @@ XRESULT WorldConverter::LoadWorldMeshFromFile(const std::string& file, std::map<
 			meshData.push_back(std::make_pair(meshes[m]->Vertices, meshes[m]->Indices));
 		}
 
-		CacheMesh(gm, file + ".mcache");
+		CacheMesh(gm, cacheFile, sourceHash);
 	}
 	
-
-	std::vector<MeshInfo *>& meshes = mesh->GetMeshes();
-	std::vector<std::string>& textures = mesh->GetTextures();
+	// These point right into the mapped cache-file if we loaded one
+	const std::vector<MeshCacheSection>& meshes = mesh->GetMeshSections();
 	std::map<std::string, D3D11Texture*> loadedTextures;
 	std::set<std::string> missingTextures;
 
@@ -157,7 +247,7 @@ XRESULT WorldConverter::LoadWorldMeshFromFile(const std::string& file, std::map<
 	for(unsigned int m = 0;m<meshes.size();m++)
 	{
 		D3D11Texture* customTexture = NULL;
-		zCMaterial* mat = Engine::GAPI->GetMaterialByTextureName(textures[m]);
+		zCMaterial* mat = Engine::GAPI->GetMaterialByTextureName(meshes[m].Texture);
 		MeshKey key;
 		key.Material = mat;
 		key.Texture = mat != NULL ? mat->GetTexture() : NULL;
@@ -165,7 +255,7 @@ XRESULT WorldConverter::LoadWorldMeshFromFile(const std::string& file, std::map<
 		// Save missing textures
 		if(!mat)
 		{
-			missingTextures.insert(textures[m]);
+			missingTextures.insert(meshes[m].Texture);
 		}else
 		{
 			if(mat->GetMatGroup() == zMAT_GROUP_WATER)
@@ -182,48 +272,45 @@ XRESULT WorldConverter::LoadWorldMeshFromFile(const std::string& file, std::map<
 
 		//key.Lightmap = poly->GetLightmap();
 
-		for(unsigned int i=0;i<meshes[m]->Vertices.size();i++)
-		{
-			// Mesh needs to be rotated differently
-			meshes[m]->Vertices[i].Position = float3(meshes[m]->Vertices[i].Position.x, 
-				meshes[m]->Vertices[i].Position.y,
-				-meshes[m]->Vertices[i].Position.z);
-
-			// Fix disoriented texcoords
-			meshes[m]->Vertices[i].TexCoord = float2(meshes[m]->Vertices[i].TexCoord.x, -meshes[m]->Vertices[i].TexCoord.y);
-		}
-
-		for(unsigned int i=0;i<meshes[m]->Indices.size();i+=3)
+		for(unsigned int i=0;i + 2<meshes[m].NumIndices;i+=3)
 		{
 
-			if(meshes[m]->Indices[i] > meshes[m]->Vertices.size() || 
-				meshes[m]->Indices[i+1] > meshes[m]->Vertices.size() || 
-				meshes[m]->Indices[i+2] > meshes[m]->Vertices.size())
+			if(meshes[m].Indices[i] >= meshes[m].NumVertices || 
+				meshes[m].Indices[i+1] >= meshes[m].NumVertices || 
+				meshes[m].Indices[i+2] >= meshes[m].NumVertices)
 				break; // Catch broken meshes
 			
-			ExVertexStruct* v[3] = {   &meshes[m]->Vertices[meshes[m]->Indices[i]],
-										&meshes[m]->Vertices[meshes[m]->Indices[i+2]],
-										&meshes[m]->Vertices[meshes[m]->Indices[i+1]]};
+			ExVertexStruct v[3] = {	meshes[m].Vertices[meshes[m].Indices[i]],
+									meshes[m].Vertices[meshes[m].Indices[i+2]],
+									meshes[m].Vertices[meshes[m].Indices[i+1]]};
+
+			for(int n=0;n<3;n++)
+			{
+				// Mesh needs to be rotated differently
+				v[n].Position.z = -v[n].Position.z;
 
+				// Fix disoriented texcoords
+				v[n].TexCoord.y = -v[n].TexCoord.y;
+			}
 
 			// Calculate midpoint of this triange to get the section
-			D3DXVECTOR3 avgPos = (*v[0]->Position.toD3DXVECTOR3() + *v[1]->Position.toD3DXVECTOR3() + *v[2]->Position.toD3DXVECTOR3()) / 3.0f;
+			D3DXVECTOR3 avgPos = (*v[0].Position.toD3DXVECTOR3() + *v[1].Position.toD3DXVECTOR3() + *v[2].Position.toD3DXVECTOR3()) / 3.0f;
 			INT2 sxy = GetSectionOfPos(avgPos);
 
-			WorldMeshSectionInfo& section = (*outSections)[sxy.x][sxy.y];
+			WorldMeshSectionInfo& section = outSections->GetSection(sxy.x, sxy.y);
 			section.WorldCoordinates = sxy;
 
 			D3DXVECTOR3& bbmin = section.BoundingBox.Min;
 			D3DXVECTOR3& bbmax = section.BoundingBox.Max;
 
 			// Check bounding box
-			bbmin.x = bbmin.x > v[0]->Position.x ? v[0]->Position.x : bbmin.x;
-			bbmin.y = bbmin.y > v[0]->Position.y ? v[0]->Position.y : bbmin.y;
-			bbmin.z = bbmin.z > v[0]->Position.z ? v[0]->Position.z : bbmin.z;
+			bbmin.x = bbmin.x > v[0].Position.x ? v[0].Position.x : bbmin.x;
+			bbmin.y = bbmin.y > v[0].Position.y ? v[0].Position.y : bbmin.y;
+			bbmin.z = bbmin.z > v[0].Position.z ? v[0].Position.z : bbmin.z;
 
-			bbmax.x = bbmax.x < v[0]->Position.x ? v[0]->Position.x : bbmax.x;
-			bbmax.y = bbmax.y < v[0]->Position.y ? v[0]->Position.y : bbmax.y;
-			bbmax.z = bbmax.z < v[0]->Position.z ? v[0]->Position.z : bbmax.z;
+			bbmax.x = bbmax.x < v[0].Position.x ? v[0].Position.x : bbmax.x;
+			bbmax.y = bbmax.y < v[0].Position.y ? v[0].Position.y : bbmax.y;
+			bbmax.z = bbmax.z < v[0].Position.z ? v[0].Position.z : bbmax.z;
 
 			if(section.WorldMeshes.find(key) == section.WorldMeshes.end())
 			{
@@ -264,7 +351,7 @@ XRESULT WorldConverter::LoadWorldMeshFromFile(const std::string& file, std::map<
 
 			for(int i=0;i<3;i++)
 			{
-				section.WorldMeshes[key]->Vertices.push_back(*v[i]);
+				section.WorldMeshes[key]->Vertices.push_back(v[i]);
 			}
 		}
 	}
@@ -292,49 +379,46 @@ XRESULT WorldConverter::LoadWorldMeshFromFile(const std::string& file, std::map<
 	std::list<std::vector<VERTEX_INDEX>*> indexBuffers;
 
 	// Create the vertexbuffers for every material
-	for(std::map<int, std::map<int, WorldMeshSectionInfo>>::iterator itx = (*outSections).begin(); itx != (*outSections).end(); itx++)
+	for(std::vector<WorldMeshSectionInfo*>::const_iterator its = outSections->GetSections().begin(); its != outSections->GetSections().end(); its++)
 	{
-		for(std::map<int, WorldMeshSectionInfo>::iterator ity = (*itx).second.begin(); ity != (*itx).second.end(); ity++)
+		WorldMeshSectionInfo& section = **its;
+		numSections++;
+		avgSections += D3DXVECTOR2((float)section.WorldCoordinates.x, (float)section.WorldCoordinates.y);
+
+		for(std::map<MeshKey, WorldMeshInfo*>::iterator it = section.WorldMeshes.begin(); it != section.WorldMeshes.end();it++)
 		{
-			WorldMeshSectionInfo& section = (*ity).second;
-			numSections++;
-			avgSections += D3DXVECTOR2((float)(*itx).first, (float)(*ity).first);
+			std::vector<ExVertexStruct> indexedVertices;
+			std::vector<VERTEX_INDEX> indices;
+			IndexVertices(&(*it).second->Vertices[0], (*it).second->Vertices.size(), indexedVertices, indices);
 
-			for(std::map<MeshKey, WorldMeshInfo*>::iterator it = section.WorldMeshes.begin(); it != section.WorldMeshes.end();it++)
-			{
-				std::vector<ExVertexStruct> indexedVertices;
-				std::vector<VERTEX_INDEX> indices;
-				IndexVertices(&(*it).second->Vertices[0], (*it).second->Vertices.size(), indexedVertices, indices);
-
-				(*it).second->Vertices = indexedVertices;
-				(*it).second->Indices = indices;
-
-				// Create the buffers
-				Engine::GraphicsEngine->CreateVertexBuffer(&(*it).second->MeshVertexBuffer);
-				Engine::GraphicsEngine->CreateVertexBuffer(&(*it).second->MeshIndexBuffer);
-
-				// Optimize faces
-				(*it).second->MeshVertexBuffer->OptimizeFaces(&(*it).second->Indices[0],
-					(byte *)&(*it).second->Vertices[0], 
-					(*it).second->Indices.size(), 
-					(*it).second->Vertices.size(), 
-					sizeof(ExVertexStruct));
-
-				// Then optimize vertices
-				(*it).second->MeshVertexBuffer->OptimizeVertices(&(*it).second->Indices[0],
-					(byte *)&(*it).second->Vertices[0], 
-					(*it).second->Indices.size(), 
-					(*it).second->Vertices.size(), 
-					sizeof(ExVertexStruct));
-
-				// Init and fill them
-				(*it).second->MeshVertexBuffer->Init(&(*it).second->Vertices[0], (*it).second->Vertices.size() * sizeof(ExVertexStruct), D3D11VertexBuffer::B_VERTEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
-				(*it).second->MeshIndexBuffer->Init(&(*it).second->Indices[0], (*it).second->Indices.size() * sizeof(VERTEX_INDEX), D3D11VertexBuffer::B_INDEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
-
-				// Remember them, to wrap then up later
-				vertexBuffers.push_back(&(*it).second->Vertices);
-				indexBuffers.push_back(&(*it).second->Indices);
-			}
+			(*it).second->Vertices = indexedVertices;
+			(*it).second->Indices = indices;
+
+			// Create the buffers
+			Engine::GraphicsEngine->CreateVertexBuffer(&(*it).second->MeshVertexBuffer);
+			Engine::GraphicsEngine->CreateVertexBuffer(&(*it).second->MeshIndexBuffer);
+
+			// Optimize faces
+			(*it).second->MeshVertexBuffer->OptimizeFaces(&(*it).second->Indices[0],
+				(byte *)&(*it).second->Vertices[0], 
+				(*it).second->Indices.size(), 
+				(*it).second->Vertices.size(), 
+				sizeof(ExVertexStruct));
+
+			// Then optimize vertices
+			(*it).second->MeshVertexBuffer->OptimizeVertices(&(*it).second->Indices[0],
+				(byte *)&(*it).second->Vertices[0], 
+				(*it).second->Indices.size(), 
+				(*it).second->Vertices.size(), 
+				sizeof(ExVertexStruct));
+
+			// Init and fill them
+			(*it).second->MeshVertexBuffer->Init(&(*it).second->Vertices[0], (*it).second->Vertices.size() * sizeof(ExVertexStruct), D3D11VertexBuffer::B_VERTEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
+			(*it).second->MeshIndexBuffer->Init(&(*it).second->Indices[0], (*it).second->Indices.size() * sizeof(VERTEX_INDEX), D3D11VertexBuffer::B_INDEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
+
+			// Remember them, to wrap then up later
+			vertexBuffers.push_back(&(*it).second->Vertices);
+			indexBuffers.push_back(&(*it).second->Indices);
 		}
 	}
 
@@ -347,26 +431,23 @@ XRESULT WorldConverter::LoadWorldMeshFromFile(const std::string& file, std::map<
 
 	// Propergate the offsets
 	int i=0;
-	for(std::map<int, std::map<int, WorldMeshSectionInfo>>::iterator itx = (*outSections).begin(); itx != (*outSections).end(); itx++)
+	for(std::vector<WorldMeshSectionInfo*>::const_iterator its = outSections->GetSections().begin(); its != outSections->GetSections().end(); its++)
 	{
-		for(std::map<int, WorldMeshSectionInfo>::iterator ity = (*itx).second.begin(); ity != (*itx).second.end(); ity++)
-		{
-			WorldMeshSectionInfo& section = (*ity).second;
+		WorldMeshSectionInfo& section = **its;
 
-			int numIndices = 0;
-			for(std::map<MeshKey, WorldMeshInfo*>::iterator it = section.WorldMeshes.begin(); it != section.WorldMeshes.end();it++)
-			{
-				(*it).second->BaseIndexLocation = offsets[i];
-				numIndices += (*it).second->Indices.size();
+		int numIndices = 0;
+		for(std::map<MeshKey, WorldMeshInfo*>::iterator it = section.WorldMeshes.begin(); it != section.WorldMeshes.end();it++)
+		{
+			(*it).second->BaseIndexLocation = offsets[i];
+			numIndices += (*it).second->Indices.size();
 
-				i++;
-			}
+			i++;
+		}
 
-			section.NumIndices = numIndices;
+		section.NumIndices = numIndices;
 
-			if(!section.WorldMeshes.empty())
-				section.BaseIndexLocation = (*section.WorldMeshes.begin()).second->BaseIndexLocation;
-		}
+		if(!section.WorldMeshes.empty())
+			section.BaseIndexLocation = (*section.WorldMeshes.begin()).second->BaseIndexLocation;
 	}
 
 	// Create the buffers for wrapped mesh
@@ -398,7 +479,7 @@ XRESULT WorldConverter::LoadWorldMeshFromFile(const std::string& file, std::map<
 }
 
 /** Converts the worldmesh into a PNAEN-buffer */
-HRESULT WorldConverter::ConvertWorldMeshPNAEN(zCPolygon** polys, unsigned int numPolygons, std::map<int, std::map<int, WorldMeshSectionInfo>>* outSections, WorldInfo* info, MeshInfo** outWrappedMesh)
+HRESULT WorldConverter::ConvertWorldMeshPNAEN(zCPolygon** polys, unsigned int numPolygons, WorldSectionGrid* outSections, WorldInfo* info, MeshInfo** outWrappedMesh)
 {
 	// Go through every polygon and put it into it's section
 	for(unsigned int i=0;i<numPolygons;i++)
@@ -415,16 +496,16 @@ HRESULT WorldConverter::ConvertWorldMeshPNAEN(zCPolygon** polys, unsigned int nu
 
 		// Use the section of the first point for the whole polygon
 		INT2 section = GetSectionOfPos(*poly->getVertices()[0]->Position.toD3DXVECTOR3());
-		(*outSections)[section.x][section.y].WorldCoordinates = section;
+		outSections->GetSection(section.x, section.y).WorldCoordinates = section;
 
 		if(poly->GetMaterial() && poly->GetMaterial()->GetMatGroup() == zMAT_GROUP_WATER)
 		{
-			//(*outSections)[section.x][section.y].OceanPoints.push_back(*poly->getVertices()[0]->Position.toD3DXVECTOR3());
+			//outSections->GetSection(section.x, section.y).OceanPoints.push_back(*poly->getVertices()[0]->Position.toD3DXVECTOR3());
 			//continue;
 		}
 
-		D3DXVECTOR3& bbmin = (*outSections)[section.x][section.y].BoundingBox.Min;
-		D3DXVECTOR3& bbmax = (*outSections)[section.x][section.y].BoundingBox.Max;
+		D3DXVECTOR3& bbmin = outSections->GetSection(section.x, section.y).BoundingBox.Min;
+		D3DXVECTOR3& bbmax = outSections->GetSection(section.x, section.y).BoundingBox.Max;
 
 		DWORD sectionColor = float4((section.x % 2) + 0.5f, (section.x % 2) + 0.5f, 1, 1).ToDWORD();
 
@@ -485,10 +566,10 @@ HRESULT WorldConverter::ConvertWorldMeshPNAEN(zCPolygon** polys, unsigned int nu
 		
 		//key.Lightmap = poly->GetLightmap();
 
-		if((*outSections)[section.x][section.y].WorldMeshes.count(key) == 0)
+		if(outSections->GetSection(section.x, section.y).WorldMeshes.count(key) == 0)
 		{
 			key.Info = Engine::GAPI->GetMaterialInfoFrom(key.Texture);
-			(*outSections)[section.x][section.y].WorldMeshes[key] = new WorldMeshInfo;
+			outSections->GetSection(section.x, section.y).WorldMeshes[key] = new WorldMeshInfo;
 		}
 
 		//std::vector<ExVertexStruct> TriangleVertices;
@@ -534,7 +615,7 @@ HRESULT WorldConverter::ConvertWorldMeshPNAEN(zCPolygon** polys, unsigned int nu
 		}
 
 		for(unsigned int v=0;v<finalVertices.size();v++)
-			(*outSections)[section.x][section.y].WorldMeshes[key]->Vertices.push_back(finalVertices[v]);
+			outSections->GetSection(section.x, section.y).WorldMeshes[key]->Vertices.push_back(finalVertices[v]);
 	}
 	
 	D3DXVECTOR2 avgSections = D3DXVECTOR2(0,0);
@@ -544,41 +625,38 @@ HRESULT WorldConverter::ConvertWorldMeshPNAEN(zCPolygon** polys, unsigned int nu
 	std::list<std::vector<VERTEX_INDEX>*> indexBuffers;
 
 	// Create the vertexbuffers for every material
-	for(std::map<int, std::map<int, WorldMeshSectionInfo>>::iterator itx = (*outSections).begin(); itx != (*outSections).end(); itx++)
+	for(std::vector<WorldMeshSectionInfo*>::const_iterator its = outSections->GetSections().begin(); its != outSections->GetSections().end(); its++)
 	{
-		for(std::map<int, WorldMeshSectionInfo>::iterator ity = (*itx).second.begin(); ity != (*itx).second.end(); ity++)
-		{
-			WorldMeshSectionInfo& section = (*ity).second;
-			numSections++;
-			avgSections += D3DXVECTOR2((float)(*itx).first, (float)(*ity).first);
+		WorldMeshSectionInfo& section = **its;
+		numSections++;
+		avgSections += D3DXVECTOR2((float)section.WorldCoordinates.x, (float)section.WorldCoordinates.y);
 
-			for(std::map<MeshKey, WorldMeshInfo*>::iterator it = section.WorldMeshes.begin(); it != section.WorldMeshes.end();it++)
-			{
-				std::vector<ExVertexStruct> indexedVertices;
-				std::vector<VERTEX_INDEX> indices;
-				IndexVertices(&(*it).second->Vertices[0], (*it).second->Vertices.size(), indexedVertices, indices);
+		for(std::map<MeshKey, WorldMeshInfo*>::iterator it = section.WorldMeshes.begin(); it != section.WorldMeshes.end();it++)
+		{
+			std::vector<ExVertexStruct> indexedVertices;
+			std::vector<VERTEX_INDEX> indices;
+			IndexVertices(&(*it).second->Vertices[0], (*it).second->Vertices.size(), indexedVertices, indices);
 
-				// Generate normals
-				GenerateVertexNormals((*it).second->Vertices, (*it).second->Indices);
+			// Generate normals
+			GenerateVertexNormals((*it).second->Vertices, (*it).second->Indices);
 
-				std::vector<VERTEX_INDEX> indicesPNAEN; // Use PNAEN to detect the borders of the mesh
-				MeshModifier::ComputePNAEN18Indices(indexedVertices, indices, indicesPNAEN);
+			std::vector<VERTEX_INDEX> indicesPNAEN; // Use PNAEN to detect the borders of the mesh
+			MeshModifier::ComputePNAEN18Indices(indexedVertices, indices, indicesPNAEN);
 
-				(*it).second->Vertices = indexedVertices;
-				(*it).second->Indices = indicesPNAEN;
+			(*it).second->Vertices = indexedVertices;
+			(*it).second->Indices = indicesPNAEN;
 
-				// Create the buffers
-				Engine::GraphicsEngine->CreateVertexBuffer(&(*it).second->MeshVertexBuffer);
-				Engine::GraphicsEngine->CreateVertexBuffer(&(*it).second->MeshIndexBuffer);
+			// Create the buffers
+			Engine::GraphicsEngine->CreateVertexBuffer(&(*it).second->MeshVertexBuffer);
+			Engine::GraphicsEngine->CreateVertexBuffer(&(*it).second->MeshIndexBuffer);
 
-				// Init and fill them
-				(*it).second->MeshVertexBuffer->Init(&(*it).second->Vertices[0], (*it).second->Vertices.size() * sizeof(ExVertexStruct), D3D11VertexBuffer::B_VERTEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
-				(*it).second->MeshIndexBuffer->Init(&(*it).second->Indices[0], (*it).second->Indices.size() * sizeof(VERTEX_INDEX), D3D11VertexBuffer::B_INDEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
+			// Init and fill them
+			(*it).second->MeshVertexBuffer->Init(&(*it).second->Vertices[0], (*it).second->Vertices.size() * sizeof(ExVertexStruct), D3D11VertexBuffer::B_VERTEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
+			(*it).second->MeshIndexBuffer->Init(&(*it).second->Indices[0], (*it).second->Indices.size() * sizeof(VERTEX_INDEX), D3D11VertexBuffer::B_INDEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
 
-				// Remember them, to wrap then up later
-				vertexBuffers.push_back(&(*it).second->Vertices);
-				indexBuffers.push_back(&(*it).second->Indices);
-			}
+			// Remember them, to wrap then up later
+			vertexBuffers.push_back(&(*it).second->Vertices);
+			indexBuffers.push_back(&(*it).second->Indices);
 		}
 	}
 
@@ -603,21 +681,18 @@ HRESULT WorldConverter::ConvertWorldMeshPNAEN(zCPolygon** polys, unsigned int nu
 
 	// Propergate the offsets
 	int i=0;
-	for(std::map<int, std::map<int, WorldMeshSectionInfo>>::iterator itx = (*outSections).begin(); itx != (*outSections).end(); itx++)
+	for(std::vector<WorldMeshSectionInfo*>::const_iterator its = outSections->GetSections().begin(); its != outSections->GetSections().end(); its++)
 	{
-		for(std::map<int, WorldMeshSectionInfo>::iterator ity = (*itx).second.begin(); ity != (*itx).second.end(); ity++)
-		{
-			WorldMeshSectionInfo& section = (*ity).second;
+		WorldMeshSectionInfo& section = **its;
 
-			for(std::map<MeshKey, WorldMeshInfo*>::iterator it = section.WorldMeshes.begin(); it != section.WorldMeshes.end();it++)
-			{
-				MaterialInfo* info = Engine::GAPI->GetMaterialInfoFrom((*it).first.Texture);
-				info->TesselationShaderPair = "PNAEN_Tesselation";
+		for(std::map<MeshKey, WorldMeshInfo*>::iterator it = section.WorldMeshes.begin(); it != section.WorldMeshes.end();it++)
+		{
+			MaterialInfo* info = Engine::GAPI->GetMaterialInfoFrom((*it).first.Texture);
+			info->TesselationShaderPair = "PNAEN_Tesselation";
 
-				(*it).second->BaseIndexLocation = offsets[i];
+			(*it).second->BaseIndexLocation = offsets[i];
 
-				i++;
-			}
+			i++;
 		}
 	}
 
@@ -645,11 +720,44 @@ HRESULT WorldConverter::ConvertWorldMeshPNAEN(zCPolygon** polys, unsigned int nu
 	return XR_SUCCESS;
 }
 
-/** Converts the worldmesh into a more usable format */
-HRESULT WorldConverter::ConvertWorldMesh(zCPolygon** polys, unsigned int numPolygons, std::map<int, std::map<int, WorldMeshSectionInfo>>* outSections, WorldInfo* info, MeshInfo** outWrappedMesh)
+/** Polygons of a range of the world, sorted into their sections. Filled in parallel by ConvertWorldMesh. */
+struct WorldConversionChunk
 {
-	// Go through every polygon and put it into it's section
-	for(unsigned int i=0;i<numPolygons;i++)
+	struct Section
+	{
+		Section()
+		{
+			BoundingBox.Min = D3DXVECTOR3(FLT_MAX, FLT_MAX, FLT_MAX);
+			BoundingBox.Max = D3DXVECTOR3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		}
+
+		zTBBox3D BoundingBox;
+		std::map<MeshKey, std::vector<ExVertexStruct>, cmpMeshKey> Meshes;
+		std::map<MeshKey, unsigned int, cmpMeshKey> FirstPolygons; // Index of the first polygon of each mesh, for the world-cache
+	};
+
+	std::map<int, std::map<int, Section>> Sections;
+};
+
+/** Runs fn for every index in [0, num). The work is distributed over the worker-pool, the calling thread helps out. */
+static void ParallelForEach(unsigned int num, const std::function<void(unsigned int)>& fn)
+{
+	if(!Engine::WorkerThreadPool)
+	{
+		for(unsigned int i=0;i<num;i++)
+			fn(i);
+
+		return;
+	}
+
+	// One index per job, the callers already pass in coarse work-items
+	Engine::WorkerThreadPool->parallel_for(0, num, 1, fn);
+}
+
+/** Puts the polygons in [start, end) into the sections of the given chunk */
+static void BucketWorldPolygons(zCPolygon** polys, unsigned int start, unsigned int end, const std::unordered_map<zCMaterial*, zCTexture*>& materialTextures, WorldConversionChunk& chunk)
+{
+	for(unsigned int i=start;i<end;i++)
 	{
 		zCPolygon* poly = polys[i];
 
@@ -658,35 +766,28 @@ HRESULT WorldConverter::ConvertWorldMesh(zCPolygon** polys, unsigned int numPoly
 			poly->GetPolyFlags()->PortalPoly)
 			continue;
 
-		//if(polygons[i]->GetNumPolyVertices() != 3)
-		//	continue;
-
 		// Calculate midpoint of this triange to get the section
 		D3DXVECTOR3 avgPos = (*poly->getVertices()[0]->Position.toD3DXVECTOR3() + *poly->getVertices()[1]->Position.toD3DXVECTOR3() + *poly->getVertices()[2]->Position.toD3DXVECTOR3()) / 3.0f;
-		INT2 section = GetSectionOfPos(avgPos);
-		(*outSections)[section.x][section.y].WorldCoordinates = section;
-
-		if(poly->GetMaterial() && poly->GetMaterial()->GetMatGroup() == zMAT_GROUP_WATER)
-		{
-			//(*outSections)[section.x][section.y].OceanPoints.push_back(*poly->getVertices()[0]->Position.toD3DXVECTOR3());
-			//continue;
-		}
+		INT2 sxy = WorldConverter::GetSectionOfPos(avgPos);
+		WorldConversionChunk::Section& section = chunk.Sections[sxy.x][sxy.y];
 
-		D3DXVECTOR3& bbmin = (*outSections)[section.x][section.y].BoundingBox.Min;
-		D3DXVECTOR3& bbmax = (*outSections)[section.x][section.y].BoundingBox.Max;
-
-		DWORD sectionColor = float4((section.x % 2) + 0.5f, (section.x % 2) + 0.5f, 1, 1).ToDWORD();
+		D3DXVECTOR3& bbmin = section.BoundingBox.Min;
+		D3DXVECTOR3& bbmax = section.BoundingBox.Max;
 
 		if(poly->GetNumPolyVertices() < 3)
 		{
 			LogWarn() << "Poly with less than 3 vertices!";
 		}
 
+		zCMaterial* mat = poly->GetMaterial();
+		bool isWater = mat && mat->GetMatGroup() == zMAT_GROUP_WATER;
+
 		// Extract poly vertices
-		std::vector<ExVertexStruct> polyVertices;
-		for(int v=0;v<poly->GetNumPolyVertices();v++)
+		ExVertexStruct polyVertices[256];
+		int numPolyVertices = poly->GetNumPolyVertices();
+		for(int v=0;v<numPolyVertices;v++)
 		{
-			ExVertexStruct t;
+			ExVertexStruct& t = polyVertices[v];
 			t.Position = poly->getVertices()[v]->Position;
 			t.TexCoord = poly->getFeatures()[v]->texCoord;
 			t.Normal = poly->getFeatures()[v]->normal;
@@ -707,131 +808,371 @@ HRESULT WorldConverter::ConvertWorldMesh(zCPolygon** polys, unsigned int numPoly
 				t.Color = DEFAULT_LIGHTMAP_POLY_COLOR;
 			}else
 			{
-				//t.Color = 0xFFFFFFFF;
 				t.TexCoord2.x = 0.0f;
 				t.TexCoord2.y = 0.0f;
 
-				if(poly->GetMaterial() && poly->GetMaterial()->GetMatGroup() == zMAT_GROUP_WATER)
+				if(isWater)
 				{
 					t.Normal = float3(0,1,0); // Get rid of ugly shadows on water
 				}
-
-				/*if((poly->GetMaterial() && poly->GetMaterial()->GetMatGroup() == zMAT_GROUP_WATER) ||
-					(poly->GetMaterial() && (poly->GetMaterial()->GetAlphaFunc() != zMAT_ALPHA_FUNC_FUNC_MAT_DEFAULT ||
-											 poly->GetMaterial()->GetAlphaFunc() != zMAT_ALPHA_FUNC_FUNC_NONE)))
-					t.Color = 0xFFFFFFFF; // Get rid of ugly shadows on water*/
 			}
-
-			polyVertices.push_back(t);
-		}		
+		}
 
 		// Use the map to put the polygon to those using the same material
-
-		zCMaterial* mat = poly->GetMaterial();
 		MeshKey key;
-		key.Texture = mat != NULL ? mat->GetTexture() : NULL;
+		key.Texture = mat != NULL ? materialTextures.at(mat) : NULL;
 		key.Material = mat;
-		
-		//key.Lightmap = poly->GetLightmap();
+		key.Info = NULL; // Filled when merging, GetMaterialInfoFrom isn't threadsafe
+
+		std::vector<ExVertexStruct>& meshVertices = section.Meshes[key];
+		section.FirstPolygons.insert(std::make_pair(key, i));
+		if(numPolyVertices >= 3)
+			TriangleFanToList(polyVertices, numPolyVertices, &meshVertices);
+	}
+}
+
+/** Number of polygons hashed as one job. Fixed, so the hash doesn't depend on the number of threads. */
+static const unsigned int WORLD_HASH_POLYS_PER_JOB = 4096;
 
-		if((*outSections)[section.x][section.y].WorldMeshes.count(key) == 0)
+/** Resolves the textures of all materials used by the world and gives water surfaces their shader.
+	zCMaterial::GetTexture calls into the game, so this has to run on the main thread. */
+static void ResolveWorldMaterials(zCPolygon** polys, unsigned int numPolygons, std::unordered_map<zCMaterial*, zCTexture*>& materialTextures, std::unordered_map<zCMaterial*, unsigned __int64>& materialHashes)
+{
+	for(unsigned int i=0;i<numPolygons;i++)
+	{
+		if(polys[i]->GetPolyFlags()->GhostOccluder || 
+			polys[i]->GetPolyFlags()->PortalPoly)
+			continue;
+
+		zCMaterial* mat = polys[i]->GetMaterial();
+		if(!mat || materialTextures.find(mat) != materialTextures.end())
+			continue;
+
+		zCTexture* tex = mat->GetTexture();
+		materialTextures[mat] = tex;
+
+		// Identify the material by what ends up in the converted mesh, pointers change with every start
+		std::string name = tex ? tex->GetNameWithoutExt() : "";
+		int matGroup = mat->GetMatGroup();
+		int alphaFunc = mat->GetAlphaFunc();
+		unsigned __int64 hash = Toolbox::HashData(name.data(), name.size());
+		hash = Toolbox::HashData(&matGroup, sizeof(matGroup), hash);
+		hash = Toolbox::HashData(&alphaFunc, sizeof(alphaFunc), hash);
+		materialHashes[mat] = hash;
+
+		if(mat->GetMatGroup() == zMAT_GROUP_WATER // Check for water
+			&& mat->GetAlphaFunc() != zMAT_ALPHA_FUNC_TEST) // Fix foam on waterfalls
 		{
-			key.Info = Engine::GAPI->GetMaterialInfoFrom(key.Texture);
-			(*outSections)[section.x][section.y].WorldMeshes[key] = new WorldMeshInfo;
+			// Give water surfaces a water-shader
+			MaterialInfo* info = Engine::GAPI->GetMaterialInfoFrom(tex);
+			if(info)
+			{
+				info->PixelShader = "PS_Water";
+				info->MaterialType = MaterialInfo::MT_Water;
+			}
 		}
+	}
+}
 
-		std::vector<ExVertexStruct> finalVertices;
-		TriangleFanToList(&polyVertices[0], polyVertices.size(), &finalVertices);
+/** Hashes everything ConvertWorldMesh reads from the polygons */
+static unsigned __int64 HashWorldPolygons(zCPolygon** polys, unsigned int numPolygons, const std::unordered_map<zCMaterial*, unsigned __int64>& materialHashes)
+{
+	unsigned int numJobs = (numPolygons + WORLD_HASH_POLYS_PER_JOB - 1) / WORLD_HASH_POLYS_PER_JOB;
+	std::vector<unsigned __int64> jobHashes(numJobs);
 
-		if(finalVertices.size() == 3)
+	ParallelForEach(numJobs, [&](unsigned int j)
+	{
+		unsigned int start = j * WORLD_HASH_POLYS_PER_JOB;
+		unsigned int end = std::min(start + WORLD_HASH_POLYS_PER_JOB, numPolygons);
+		unsigned __int64 hash = Toolbox::HASH_DATA_SEED;
+
+		for(unsigned int i=start;i<end;i++)
 		{
-			if(mat && mat->GetTexture())
+			zCPolygon* poly = polys[i];
+
+			unsigned char skipped = (poly->GetPolyFlags()->GhostOccluder || poly->GetPolyFlags()->PortalPoly) ? 1 : 0;
+			hash = Toolbox::HashData(&skipped, sizeof(skipped), hash);
+			if(skipped)
+				continue;
+
+			zCMaterial* mat = poly->GetMaterial();
+			unsigned __int64 matHash = mat ? materialHashes.at(mat) : 0;
+			hash = Toolbox::HashData(&matHash, sizeof(matHash), hash);
+
+			int numPolyVertices = poly->GetNumPolyVertices();
+			hash = Toolbox::HashData(&numPolyVertices, sizeof(numPolyVertices), hash);
+			for(int v=0;v<numPolyVertices;v++)
 			{
-				/*if(strnicmp(mat->GetTexture()->GetNameWithoutExt().c_str(), "NW_Harbour_Stairs", strlen("NW_Harbour_Stairs")) == 0)
-				{
-					ExVertexStruct vx[3];
-					memcpy(vx, &finalVertices[0], sizeof(ExVertexStruct) * 3);
-					finalVertices.clear();
+				zCVertFeature* feature = poly->getFeatures()[v];
+				hash = Toolbox::HashData(&poly->getVertices()[v]->Position, sizeof(float3), hash);
+				hash = Toolbox::HashData(&feature->normal, sizeof(float3), hash);
+				hash = Toolbox::HashData(&feature->lightStatic, sizeof(DWORD), hash);
+				hash = Toolbox::HashData(&feature->texCoord, sizeof(float2), hash);
+			}
 
-					TesselateTriangle(vx, finalVertices, 5);
-				}*/
+			zCLightmap* lightmap = poly->GetLightmap();
+			unsigned char hasLightmap = lightmap ? 1 : 0;
+			hash = Toolbox::HashData(&hasLightmap, sizeof(hasLightmap), hash);
+			if(lightmap)
+			{
+				hash = Toolbox::HashData(&lightmap->LightmapOrigin, sizeof(D3DXVECTOR3), hash);
+				hash = Toolbox::HashData(&lightmap->LightmapUVUp, sizeof(D3DXVECTOR3), hash);
+				hash = Toolbox::HashData(&lightmap->LightmapUVRight, sizeof(D3DXVECTOR3), hash);
 			}
 		}
 
-		//if(mat && mat->GetTexture())
-		//	LogInfo() << "Got texture name: " << mat->GetTexture()->GetName();
+		jobHashes[j] = hash;
+	});
+
+	unsigned __int64 hash = Toolbox::HashData(&numPolygons, sizeof(numPolygons));
+	if(!jobHashes.empty())
+		hash = Toolbox::HashData(&jobHashes[0], jobHashes.size() * sizeof(unsigned __int64), hash);
+
+	return hash;
+}
+
+/** Returns the file the converted world of the given level is cached in */
+static std::string GetWorldCacheFile(const std::string& worldName)
+{
+	return "system\\GD3D11\\cache\\WLD_" + worldName + ".wcache";
+}
+
+/** Fills the sections and the wrapped mesh from the given world-cache. Returns false if the cache doesn't fit the polygons. */
+static bool LoadCachedWorldMesh(WorldCacheFile& cache, zCPolygon** polys, unsigned int numPolygons, const std::unordered_map<zCMaterial*, zCTexture*>& materialTextures, WorldSectionGrid* outSections, WorldInfo* info, MeshInfo** outWrappedMesh)
+{
+	const WorldCacheSectionEntry* sections = cache.GetSections();
+	const WorldCacheMeshEntry* meshEntries = cache.GetMeshes();
 
-		if(poly->GetMaterial() && poly->GetMaterial()->GetMatGroup() == zMAT_GROUP_WATER // Check for water
-			&& poly->GetMaterial()->GetAlphaFunc() != zMAT_ALPHA_FUNC_TEST) // Fix foam on waterfalls
+	D3DXVECTOR2 avgSections = D3DXVECTOR2(0,0);
+
+	// Rebuild the sections and their keys first, so no buffers get created if the cache turns out not to fit
+	std::vector<WorldMeshInfo*> meshes;
+	for(unsigned int s=0;s<cache.GetNumSections();s++)
+	{
+		const WorldCacheSectionEntry& se = sections[s];
+		WorldMeshSectionInfo& section = outSections->GetSection(se.X, se.Y);
+		section.WorldCoordinates = INT2(se.X, se.Y);
+		section.BoundingBox.Min = *se.BoundingBoxMin.toD3DXVECTOR3();
+		section.BoundingBox.Max = *se.BoundingBoxMax.toD3DXVECTOR3();
+		avgSections += D3DXVECTOR2((float)se.X, (float)se.Y);
+
+		for(unsigned int m=se.FirstMesh;m<se.FirstMesh + se.NumMeshes;m++)
 		{
-			// Give water surfaces a water-shader
-			MaterialInfo* info = Engine::GAPI->GetMaterialInfoFrom(poly->GetMaterial()->GetTexture());
-			if(info)
+			const WorldCacheMeshEntry& me = meshEntries[m];
+
+			zCMaterial* mat = me.FirstPolygon < numPolygons ? polys[me.FirstPolygon]->GetMaterial() : NULL;
+			auto tex = mat ? materialTextures.find(mat) : materialTextures.end();
+			if(me.FirstPolygon >= numPolygons || (mat && tex == materialTextures.end()))
 			{
-				info->PixelShader = "PS_Water";
-				info->MaterialType = MaterialInfo::MT_Water;
+				outSections->Clear();
+				return false;
+			}
+
+			// Same key the conversion would have made from the first polygon
+			MeshKey key;
+			key.Texture = mat ? (*tex).second : NULL;
+			key.Material = mat;
+			key.Info = Engine::GAPI->GetMaterialInfoFrom(key.Texture);
+
+			WorldMeshInfo* mesh = new WorldMeshInfo;
+			if(!section.WorldMeshes.insert(std::make_pair(key, mesh)).second)
+			{
+				delete mesh;
+				outSections->Clear();
+				return false;
 			}
+
+			mesh->Vertices.assign(cache.GetMeshVertices(me), cache.GetMeshVertices(me) + me.NumVertices);
+			mesh->Indices.assign(cache.GetMeshIndices(me), cache.GetMeshIndices(me) + me.NumIndices);
+			mesh->BaseIndexLocation = me.BaseIndexLocation;
+			meshes.push_back(mesh);
 		}
+	}
 
-		for(unsigned int v=0;v<finalVertices.size();v++)
-			(*outSections)[section.x][section.y].WorldMeshes[key]->Vertices.push_back(finalVertices[v]);
+	// Create the vertexbuffers for every material
+	for(unsigned int m=0;m<meshes.size();m++)
+	{
+		WorldMeshInfo* mesh = meshes[m];
+
+		Engine::GraphicsEngine->CreateVertexBuffer(&mesh->MeshVertexBuffer);
+		Engine::GraphicsEngine->CreateVertexBuffer(&mesh->MeshIndexBuffer);
+
+		mesh->MeshVertexBuffer->Init(&mesh->Vertices[0], mesh->Vertices.size() * sizeof(ExVertexStruct), D3D11VertexBuffer::B_VERTEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
+		mesh->MeshIndexBuffer->Init(&mesh->Indices[0], mesh->Indices.size() * sizeof(VERTEX_INDEX), D3D11VertexBuffer::B_INDEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
 	}
-	
-	D3DXVECTOR2 avgSections = D3DXVECTOR2(0,0);
-	int numSections = 0;
 
-	std::list<std::vector<ExVertexStruct>*> vertexBuffers;
-	std::list<std::vector<VERTEX_INDEX>*> indexBuffers;
+	// The wrapped mesh is already smoothed, upload it straight from the file
+	MeshInfo* wmi = new MeshInfo;
+	Engine::GraphicsEngine->CreateVertexBuffer(&wmi->MeshVertexBuffer);
+	Engine::GraphicsEngine->CreateVertexBuffer(&wmi->MeshIndexBuffer);
+	wmi->MeshVertexBuffer->Init((void*)cache.GetWrappedVertices(), cache.GetNumWrappedVertices() * sizeof(ExVertexStruct), D3D11VertexBuffer::B_VERTEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
+	wmi->MeshIndexBuffer->Init((void*)cache.GetWrappedIndices(), cache.GetNumWrappedIndices() * sizeof(unsigned int), D3D11VertexBuffer::B_INDEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
 
-	// Create the vertexbuffers for every material
-	for(std::map<int, std::map<int, WorldMeshSectionInfo>>::iterator itx = (*outSections).begin(); itx != (*outSections).end(); itx++)
+	*outWrappedMesh = wmi;
+
+	// Calculate the approx midpoint of the world
+	avgSections /= (float)cache.GetNumSections();
+
+	if(info)
+	{
+		info->MidPoint = avgSections * WORLD_SECTION_SIZE;
+		info->LowestVertex = 0;
+		info->HighestVertex = 0;	
+	}
+
+	return true;
+}
+
+/** Converts the worldmesh into a more usable format. The result is cached per level and reused as long as the polygons don't change. */
+HRESULT WorldConverter::ConvertWorldMesh(zCPolygon** polys, unsigned int numPolygons, WorldSectionGrid* outSections, WorldInfo* info, MeshInfo** outWrappedMesh)
+{
+	DWORD convStart = timeGetTime();
+
+	// Resolve the textures of all materials first
+	std::unordered_map<zCMaterial*, zCTexture*> materialTextures;
+	std::unordered_map<zCMaterial*, unsigned __int64> materialHashes;
+	ResolveWorldMaterials(polys, numPolygons, materialTextures, materialHashes);
+
+	// Try to skip the conversion completely
+	std::string cacheFile = info && !info->WorldName.empty() ? GetWorldCacheFile(info->WorldName) : "";
+	unsigned __int64 polygonHash = HashWorldPolygons(polys, numPolygons, materialHashes);
+	if(!cacheFile.empty())
 	{
-		for(std::map<int, WorldMeshSectionInfo>::iterator ity = (*itx).second.begin(); ity != (*itx).second.end(); ity++)
+		WorldCacheFile cache;
+		if(XR_SUCCESS == cache.Open(cacheFile, polygonHash))
 		{
-			WorldMeshSectionInfo& section = (*ity).second;
-			numSections++;
-			avgSections += D3DXVECTOR2((float)(*itx).first, (float)(*ity).first);
+			if(LoadCachedWorldMesh(cache, polys, numPolygons, materialTextures, outSections, info, outWrappedMesh))
+			{
+				LogInfo() << "Loaded worldmesh from cache in " << timeGetTime() - convStart << "ms (" << cache.GetNumSections() << " sections, " << cache.GetNumMeshes() << " meshes)";
+				return XR_SUCCESS;
+			}
 
-			for(std::map<MeshKey, WorldMeshInfo*>::iterator it = section.WorldMeshes.begin(); it != section.WorldMeshes.end();it++)
+			LogWarn() << "World cache doesn't fit the loaded world, converting again: " << cacheFile;
+		}
+	}
+
+	// Go through every polygon and put it into it's section. Every worker gets a continuous range of polygons,
+	// so appending the chunks in order results in the same vertex-order as going through them one by one.
+	unsigned int numChunks = (Engine::WorkerThreadPool ? Engine::WorkerThreadPool->getNumThreads() : 0) + 1;
+	unsigned int polysPerChunk = (numPolygons + numChunks - 1) / numChunks;
+	std::vector<WorldConversionChunk> chunks(numChunks);
+
+	ParallelForEach(numChunks, [&](unsigned int c)
+	{
+		unsigned int start = std::min(c * polysPerChunk, numPolygons);
+		unsigned int end = std::min(start + polysPerChunk, numPolygons);
+		BucketWorldPolygons(polys, start, end, materialTextures, chunks[c]);
+	});
+
+	// Merge the chunks
+	std::unordered_map<WorldMeshInfo*, unsigned int> firstPolygons;
+	for(unsigned int c=0;c<chunks.size();c++)
+	{
+		for(auto itx = chunks[c].Sections.begin(); itx != chunks[c].Sections.end(); itx++)
+		{
+			for(auto ity = (*itx).second.begin(); ity != (*itx).second.end(); ity++)
 			{
-				std::vector<ExVertexStruct> indexedVertices;
-				std::vector<VERTEX_INDEX> indices;
-				IndexVertices(&(*it).second->Vertices[0], (*it).second->Vertices.size(), indexedVertices, indices);
-
-				(*it).second->Vertices = indexedVertices;
-				(*it).second->Indices = indices;
-
-				// Create the buffers
-				Engine::GraphicsEngine->CreateVertexBuffer(&(*it).second->MeshVertexBuffer);
-				Engine::GraphicsEngine->CreateVertexBuffer(&(*it).second->MeshIndexBuffer);
-
-				// Generate normals
-				GenerateVertexNormals((*it).second->Vertices, (*it).second->Indices);
-
-				// Optimize faces
-				(*it).second->MeshVertexBuffer->OptimizeFaces(&(*it).second->Indices[0],
-					(byte *)&(*it).second->Vertices[0], 
-					(*it).second->Indices.size(), 
-					(*it).second->Vertices.size(), 
-					sizeof(ExVertexStruct));
-
-				// Then optimize vertices
-				(*it).second->MeshVertexBuffer->OptimizeVertices(&(*it).second->Indices[0],
-					(byte *)&(*it).second->Vertices[0], 
-					(*it).second->Indices.size(), 
-					(*it).second->Vertices.size(), 
-					sizeof(ExVertexStruct));
-
-				// Init and fill them
-				(*it).second->MeshVertexBuffer->Init(&(*it).second->Vertices[0], (*it).second->Vertices.size() * sizeof(ExVertexStruct), D3D11VertexBuffer::B_VERTEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
-				(*it).second->MeshIndexBuffer->Init(&(*it).second->Indices[0], (*it).second->Indices.size() * sizeof(VERTEX_INDEX), D3D11VertexBuffer::B_INDEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
-
-
-				// Remember them, to wrap then up later
-				vertexBuffers.push_back(&(*it).second->Vertices);
-				indexBuffers.push_back(&(*it).second->Indices);
+				WorldMeshSectionInfo& section = outSections->GetSection((*itx).first, (*ity).first);
+				section.WorldCoordinates = INT2((*itx).first, (*ity).first);
+
+				const zTBBox3D& bb = (*ity).second.BoundingBox;
+				D3DXVec3Minimize(&section.BoundingBox.Min, &section.BoundingBox.Min, &bb.Min);
+				D3DXVec3Maximize(&section.BoundingBox.Max, &section.BoundingBox.Max, &bb.Max);
+
+				for(auto it = (*ity).second.Meshes.begin(); it != (*ity).second.Meshes.end(); it++)
+				{
+					auto wm = section.WorldMeshes.find((*it).first);
+					if(wm == section.WorldMeshes.end())
+					{
+						// First chunk having this texture, so this also holds the material of the first polygon using it
+						MeshKey key = (*it).first;
+						key.Info = Engine::GAPI->GetMaterialInfoFrom(key.Texture);
+						wm = section.WorldMeshes.insert(std::make_pair(key, new WorldMeshInfo)).first;
+						firstPolygons[(*wm).second] = (*ity).second.FirstPolygons[(*it).first];
+					}
+
+					std::vector<ExVertexStruct>& vx = (*wm).second->Vertices;
+					if(vx.empty())
+						vx.swap((*it).second);
+					else
+						vx.insert(vx.end(), (*it).second.begin(), (*it).second.end());
+				}
 			}
 		}
+
+		chunks[c].Sections.clear();
+	}
+
+	DWORD bucketTime = timeGetTime() - convStart;
+	DWORD indexStart = timeGetTime();
+
+	D3DXVECTOR2 avgSections = D3DXVECTOR2(0,0);
+	int numSections = 0;
+
+	// Collect the meshes in section-order
+	std::vector<WorldMeshInfo*> meshes;
+	for(std::vector<WorldMeshSectionInfo*>::const_iterator its = outSections->GetSections().begin(); its != outSections->GetSections().end(); its++)
+	{
+		WorldMeshSectionInfo& section = **its;
+		numSections++;
+		avgSections += D3DXVECTOR2((float)section.WorldCoordinates.x, (float)section.WorldCoordinates.y);
+
+		for(std::map<MeshKey, WorldMeshInfo*>::iterator it = section.WorldMeshes.begin(); it != section.WorldMeshes.end();it++)
+			meshes.push_back((*it).second);
+	}
+
+	// Index the meshes and generate their normals. Every mesh is independent, so fan them out.
+	ParallelForEach(meshes.size(), [&](unsigned int m)
+	{
+		WorldMeshInfo* mesh = meshes[m];
+
+		std::vector<ExVertexStruct> indexedVertices;
+		std::vector<VERTEX_INDEX> indices;
+		IndexVertices(&mesh->Vertices[0], mesh->Vertices.size(), indexedVertices, indices);
+
+		mesh->Vertices.swap(indexedVertices);
+		mesh->Indices.swap(indices);
+
+		// Generate normals
+		GenerateVertexNormals(mesh->Vertices, mesh->Indices);
+	});
+
+	DWORD indexTime = timeGetTime() - indexStart;
+	DWORD bufferStart = timeGetTime();
+
+	std::list<std::vector<ExVertexStruct>*> vertexBuffers;
+	std::list<std::vector<VERTEX_INDEX>*> indexBuffers;
+
+	// Create the vertexbuffers for every material. This has to stay on this thread.
+	for(unsigned int m=0;m<meshes.size();m++)
+	{
+		WorldMeshInfo* mesh = meshes[m];
+
+		// Create the buffers
+		Engine::GraphicsEngine->CreateVertexBuffer(&mesh->MeshVertexBuffer);
+		Engine::GraphicsEngine->CreateVertexBuffer(&mesh->MeshIndexBuffer);
+
+		// Optimize faces
+		mesh->MeshVertexBuffer->OptimizeFaces(&mesh->Indices[0],
+			(byte *)&mesh->Vertices[0], 
+			mesh->Indices.size(), 
+			mesh->Vertices.size(), 
+			sizeof(ExVertexStruct));
+
+		// Then optimize vertices
+		mesh->MeshVertexBuffer->OptimizeVertices(&mesh->Indices[0],
+			(byte *)&mesh->Vertices[0], 
+			mesh->Indices.size(), 
+			mesh->Vertices.size(), 
+			sizeof(ExVertexStruct));
+
+		// Init and fill them
+		mesh->MeshVertexBuffer->Init(&mesh->Vertices[0], mesh->Vertices.size() * sizeof(ExVertexStruct), D3D11VertexBuffer::B_VERTEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
+		mesh->MeshIndexBuffer->Init(&mesh->Indices[0], mesh->Indices.size() * sizeof(VERTEX_INDEX), D3D11VertexBuffer::B_INDEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
+
+		// Remember them, to wrap then up later
+		vertexBuffers.push_back(&mesh->Vertices);
+		indexBuffers.push_back(&mesh->Indices);
 	}
 
 	std::vector<ExVertexStruct> wrappedVertices;
@@ -842,26 +1183,17 @@ HRESULT WorldConverter::ConvertWorldMesh(zCPolygon** polys, unsigned int numPoly
 	WorldConverter::WrapVertexBuffers(vertexBuffers, indexBuffers, wrappedVertices, wrappedIndices, offsets);
 
 	// Propergate the offsets
-	int i=0;
-	for(std::map<int, std::map<int, WorldMeshSectionInfo>>::iterator itx = (*outSections).begin(); itx != (*outSections).end(); itx++)
+	for(unsigned int m=0;m<meshes.size();m++)
 	{
-		for(std::map<int, WorldMeshSectionInfo>::iterator ity = (*itx).second.begin(); ity != (*itx).second.end(); ity++)
-		{
-			WorldMeshSectionInfo& section = (*ity).second;
-
-			for(std::map<MeshKey, WorldMeshInfo*>::iterator it = section.WorldMeshes.begin(); it != section.WorldMeshes.end();it++)
-			{
-				(*it).second->BaseIndexLocation = offsets[i];
-
-				i++;
-			}
-		}
+		meshes[m]->BaseIndexLocation = offsets[m];
 	}
 
 	// Create the buffers for wrapped mesh
 	MeshInfo* wmi = new MeshInfo;
 	Engine::GraphicsEngine->CreateVertexBuffer(&wmi->MeshVertexBuffer);
 	Engine::GraphicsEngine->CreateVertexBuffer(&wmi->MeshIndexBuffer);
+
+	DWORD bufferTime = timeGetTime() - bufferStart;
 	
 	LogInfo() << "Smoothing worldmesh normals...";
 	DWORD sStart = timeGetTime();
@@ -869,31 +1201,40 @@ HRESULT WorldConverter::ConvertWorldMesh(zCPolygon** polys, unsigned int numPoly
 	// Generate smooth normals
 	MeshModifier::ComputeSmoothNormals(wrappedVertices);
 
-	LogInfo() << "Process took " << timeGetTime() - sStart << "ms";
+	DWORD smoothTime = timeGetTime() - sStart;
+	LogInfo() << "Process took " << smoothTime << "ms";
 
 	// Init and fill them
+	DWORD uploadStart = timeGetTime();
 	wmi->MeshVertexBuffer->Init(&wrappedVertices[0], wrappedVertices.size() * sizeof(ExVertexStruct), D3D11VertexBuffer::B_VERTEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
 	wmi->MeshIndexBuffer->Init(&wrappedIndices[0], wrappedIndices.size() * sizeof(unsigned int), D3D11VertexBuffer::B_INDEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
+	bufferTime += timeGetTime() - uploadStart;
 
 	*outWrappedMesh = wmi;
 
+	// Remember the result, so the next load of this level can skip all of the above
+	if(!cacheFile.empty())
+	{
+		CreateDirectory("system\\GD3D11\\cache", NULL);
+		WorldCacheFile::Write(cacheFile, polygonHash, *outSections, firstPolygons, wrappedVertices, wrappedIndices);
+	}
+
 	// Calculate the approx midpoint of the world
 	avgSections /= (float)numSections;
 
 	if(info)
 	{
-		/*WorldInfo i;
-		i.MidPoint = avgSections * WORLD_SECTION_SIZE;
-		i.LowestVertex = 0;
-		i.HighestVertex = 0;
-
-		memcpy(info, &i, sizeof(WorldInfo));*/
-
 		info->MidPoint = avgSections * WORLD_SECTION_SIZE;
 		info->LowestVertex = 0;
 		info->HighestVertex = 0;	
 	}
-	//SaveSectionsToObjUnindexed("Test.obj", (*outSections));
+
+	LogInfo() << "Converted worldmesh in " << timeGetTime() - convStart << "ms ("
+		<< numPolygons << " polygons, " << numSections << " sections, " << meshes.size() << " meshes, " << numChunks << " threads)"
+		<< " - Bucketing: " << bucketTime << "ms"
+		<< ", Indexing/Normals: " << indexTime << "ms"
+		<< ", Buffers: " << bufferTime << "ms"
+		<< ", Smoothing: " << smoothTime << "ms";
 
 	return XR_SUCCESS;
 }
@@ -1017,7 +1358,7 @@ void WorldConverter::TriangleFanToList(ExVertexStruct* input, unsigned int numIn
 }
 
 /** Saves the given section-array to an obj file */
-void WorldConverter::SaveSectionsToObjUnindexed(const char* file, const std::map<int, std::map<int, WorldMeshSectionInfo>>& sections)
+void WorldConverter::SaveSectionsToObjUnindexed(const char* file, const WorldSectionGrid& sections)
 {
 	FILE* f = fopen(file, "w");
 
@@ -1029,24 +1370,21 @@ void WorldConverter::SaveSectionsToObjUnindexed(const char* file, const std::map
 
 	fputs("o World\n", f);
 
-	for(std::map<int, std::map<int, WorldMeshSectionInfo>>::const_iterator itx = sections.begin(); itx != sections.end(); itx++)
+	for(std::vector<WorldMeshSectionInfo*>::const_iterator its = sections.GetSections().begin(); its != sections.GetSections().end(); its++)
 	{
-		for(std::map<int, WorldMeshSectionInfo>::const_iterator ity = (*itx).second.begin(); ity != (*itx).second.end(); ity++)
-		{
-			const WorldMeshSectionInfo& section = (*ity).second;
+		const WorldMeshSectionInfo& section = **its;
 
-			for(std::map<MeshKey, WorldMeshInfo*>::const_iterator it = section.WorldMeshes.begin(); it != section.WorldMeshes.end();it++)
+		for(std::map<MeshKey, WorldMeshInfo*>::const_iterator it = section.WorldMeshes.begin(); it != section.WorldMeshes.end();it++)
+		{
+			for(unsigned int i=0;i<(*it).second->Vertices.size();i++)
 			{
-				for(unsigned int i=0;i<(*it).second->Vertices.size();i++)
-				{
-					std::string ln = "v " + std::to_string((*it).second->Vertices[i].Position.x) + " " + std::to_string((*it).second->Vertices[i].Position.y) + " " + std::to_string((*it).second->Vertices[i].Position.z) + "\n";
-					fputs(ln.c_str(), f);
+				std::string ln = "v " + std::to_string((*it).second->Vertices[i].Position.x) + " " + std::to_string((*it).second->Vertices[i].Position.y) + " " + std::to_string((*it).second->Vertices[i].Position.z) + "\n";
+				fputs(ln.c_str(), f);
 
-					//if(i % 3 == 0)
-					//	fputs("f -3 -2 -1\n", f);
-					//ln = "vn " + std::to_string((*it).second.Vertices[i].Normal.x) + " " + std::to_string((*it).second.Vertices[i].Normal.y) + " " + std::to_string((*it).second.Vertices[i].Normal.z) + "\n";
-					//fputs(ln.c_str(), f);
-				}
+				//if(i % 3 == 0)
+				//	fputs("f -3 -2 -1\n", f);
+				//ln = "vn " + std::to_string((*it).second.Vertices[i].Normal.x) + " " + std::to_string((*it).second.Vertices[i].Normal.y) + " " + std::to_string((*it).second.Vertices[i].Normal.z) + "\n";
+				//fputs(ln.c_str(), f);
 			}
 		}
 	}
@@ -1784,194 +2122,261 @@ void WorldConverter::Extract3DSMeshFromVisual2(zCProgMeshProto* visual, MeshVisu
 	// Try to load saved settings for this mesh
 	meshInfo->LoadMeshVisualInfo(meshInfo->VisualName);
 
+	// Coarser versions for vobs far away
+	CreateLODsFor(meshInfo);
+
 	// Create additional information
 	if(meshInfo->TesselationInfo.buffer.VT_TesselationFactor > 0.0f)
 		meshInfo->CreatePNAENInfo(meshInfo->TesselationInfo.buffer.VT_DisplacementStrength > 0.0f);
 }
 
 
-const float eps = 0.001f;
+/** Version of the LOD-cache files */
+const int MESHLOD_VERSION = 1;
 
+/** Meshes with less triangles than this don't get any LODs */
+const unsigned int MESHLOD_MIN_TRIANGLES = 64;
 
-struct CmpClass // class comparing vertices in the set
-{
-    bool operator() (const std::pair<ExVertexStruct, int>& p1, const std::pair<ExVertexStruct, int>& p2) const
-    {
-		/*if(p1.first.Position.x < p2.first.Position.x)
-			return true;
-		if(p1.first.Position.y < p2.first.Position.y)
-			return true;
-		if(p1.first.Position.z < p2.first.Position.z)
-			return true;
+/** Error allowed for the first LOD, relative to the size of the visual. Doubles with each level. */
+const float MESHLOD_ERROR_SCALE = 1.0f / 300.0f;
 
-		if(p1.first.TexCoord.x < p2.first.TexCoord.x)
-			return true;
+/** A LOD is only kept if it has at most this much of the triangles of the level before */
+const float MESHLOD_MIN_REDUCTION = 0.75f;
 
-		if(p1.first.TexCoord.y < p2.first.TexCoord.y)
-			return true;
+/** Geometry of the LODs of one mesh */
+struct MeshLODData
+{
+	std::vector<std::pair<std::vector<ExVertexStruct>, std::vector<VERTEX_INDEX>>> LODs;
+};
 
-		return false;*/
+/** Returns the hash of the geometry the LODs are made from */
+static unsigned __int64 HashLODSource(const MeshInfo* mesh)
+{
+	unsigned __int64 hash = Toolbox::HashData(&mesh->Vertices[0], mesh->Vertices.size() * sizeof(ExVertexStruct));
+	return Toolbox::HashData(&mesh->Indices[0], mesh->Indices.size() * sizeof(VERTEX_INDEX), hash);
+}
 
-        if (fabs(p1.first.Position.x-p2.first.Position.x) > eps) return p1.first.Position.x < p2.first.Position.x;
-        if (fabs(p1.first.Position.y-p2.first.Position.y) > eps) return p1.first.Position.y < p2.first.Position.y;
-        if (fabs(p1.first.Position.z-p2.first.Position.z) > eps) return p1.first.Position.z < p2.first.Position.z;
+/** Decimates the given mesh down level by level. Stops once a level doesn't get any smaller. */
+static void ComputeLODsFor(const MeshInfo* mesh, float meshSize, MeshLODData& outData)
+{
+	const std::vector<ExVertexStruct>* vertices = &mesh->Vertices;
+	const std::vector<VERTEX_INDEX>* indices = &mesh->Indices;
 
-		if (fabs(p1.first.TexCoord.x-p2.first.TexCoord.x) > eps) return p1.first.TexCoord.x < p2.first.TexCoord.x;
-		if (fabs(p1.first.TexCoord.y-p2.first.TexCoord.y) > eps) return p1.first.TexCoord.y < p2.first.TexCoord.y;
+	float maxError = meshSize * MESHLOD_ERROR_SCALE;
+	for(unsigned int l=1;l<MESH_NUM_LOD_LEVELS;l++)
+	{
+		unsigned int numTris = indices->size() / 3;
 
-        return false;
-    }
-};
+		std::pair<std::vector<ExVertexStruct>, std::vector<VERTEX_INDEX>> lod;
+		MeshModifier::Decimate(*vertices, *indices, numTris / 2, maxError, lod.first, lod.second);
 
+		if(lod.second.empty() || lod.second.size() / 3 > numTris * MESHLOD_MIN_REDUCTION)
+			break;
 
+		outData.LODs.push_back(lod);
+		vertices = &outData.LODs.back().first;
+		indices = &outData.LODs.back().second;
+		maxError *= 2.0f;
+	}
+}
 
-/** Indexes the given vertex array */
-void WorldConverter::IndexVertices(ExVertexStruct* input, unsigned int numInputVertices, std::vector<ExVertexStruct>& outVertices, std::vector<VERTEX_INDEX>& outIndices)
+/** Loads the LODs of the meshes from the given cache-file, by the hashes of the meshes they were made from */
+static bool LoadLODCache(const std::string& file, std::unordered_map<unsigned __int64, MeshLODData>& outData)
 {
-	std::set<std::pair<ExVertexStruct, int>, CmpClass> vertices;
-	int index = 0;
-
-    for (unsigned int i=0; i<numInputVertices; i++)
-    {
-        std::set<std::pair<ExVertexStruct, int>>::iterator it = vertices.find(std::make_pair(input[i], 0/*this value doesn't matter*/));
-        if (it!=vertices.end()) outIndices.push_back(it->second);
-        else
-        {
-			/*char* c = (char *)&input[i].color;
-			c[0] = rand() % 255;
-			c[1] = rand() % 255;
-			c[2] = rand() % 255;*/
-
-            vertices.insert(std::make_pair(input[i], index));
-            outIndices.push_back(index++);
-        }
-    }
-
-	// TODO: Remove this and fix it properly!
-	/*for (std::set<std::pair<ExVertexStruct, int>>::iterator it=vertices.begin(); it!=vertices.end(); it++)
-	{
-		if((unsigned int)it->second >= vertices.size())
+	FILE* f = fopen(file.c_str(), "rb");
+	if(!f)
+		return false;
+
+	int version = 0;
+	unsigned int numMeshes = 0;
+	bool valid = fread(&version, sizeof(version), 1, f) == 1
+		&& version == MESHLOD_VERSION
+		&& fread(&numMeshes, sizeof(numMeshes), 1, f) == 1;
+
+	for(unsigned int m=0;valid && m<numMeshes;m++)
+	{
+		unsigned __int64 hash;
+		unsigned int numLODs;
+		valid = fread(&hash, sizeof(hash), 1, f) == 1
+			&& fread(&numLODs, sizeof(numLODs), 1, f) == 1
+			&& numLODs < MESH_NUM_LOD_LEVELS;
+
+		MeshLODData& data = outData[hash];
+		data.LODs.resize(valid ? numLODs : 0);
+		for(unsigned int l=0;valid && l<data.LODs.size();l++)
 		{
-			 // TODO: Investigate!
-			it = vertices.erase(it);
-			continue;
+			unsigned int numVertices, numIndices;
+			valid = fread(&numVertices, sizeof(numVertices), 1, f) == 1 && numVertices > 0 && numVertices <= 0xFFFF;
+			if(!valid)
+				break;
+
+			data.LODs[l].first.resize(numVertices);
+			valid = fread(&data.LODs[l].first[0], sizeof(ExVertexStruct), numVertices, f) == numVertices
+				&& fread(&numIndices, sizeof(numIndices), 1, f) == 1 && numIndices > 0 && numIndices % 3 == 0;
+			if(!valid)
+				break;
+
+			data.LODs[l].second.resize(numIndices);
+			valid = fread(&data.LODs[l].second[0], sizeof(VERTEX_INDEX), numIndices, f) == numIndices;
+
+			for(unsigned int i=0;valid && i<numIndices;i++)
+				valid = data.LODs[l].second[i] < numVertices;
 		}
 	}
 
-	for (std::vector<VERTEX_INDEX>::iterator it=outIndices.begin(); it!=outIndices.end(); it++)
+	fclose(f);
+
+	if(!valid)
+	{
+		LogWarn() << "LOD-cache file is corrupt: " << file;
+		outData.clear();
+	}
+
+	return valid;
+}
+
+/** Writes the LODs of the meshes to the given cache-file */
+static void SaveLODCache(const std::string& file, const std::vector<unsigned __int64>& hashes, const std::vector<MeshLODData>& data)
+{
+	FILE* f = fopen(file.c_str(), "wb");
+	if(!f)
+	{
+		LogWarn() << "Failed to write LOD-cache file: " << file;
+		return;
+	}
+
+	fwrite(&MESHLOD_VERSION, sizeof(MESHLOD_VERSION), 1, f);
+
+	unsigned int numMeshes = hashes.size();
+	fwrite(&numMeshes, sizeof(numMeshes), 1, f);
+
+	for(unsigned int m=0;m<numMeshes;m++)
 	{
-		if((unsigned int)(*it) >= vertices.size())
+		unsigned int numLODs = data[m].LODs.size();
+		fwrite(&hashes[m], sizeof(hashes[m]), 1, f);
+		fwrite(&numLODs, sizeof(numLODs), 1, f);
+
+		for(unsigned int l=0;l<numLODs;l++)
 		{
-			 // TODO: Investigate!
-			it = outIndices.erase(it);
-			continue;
+			const std::vector<ExVertexStruct>& vertices = data[m].LODs[l].first;
+			const std::vector<VERTEX_INDEX>& indices = data[m].LODs[l].second;
+
+			unsigned int numVertices = vertices.size();
+			unsigned int numIndices = indices.size();
+			fwrite(&numVertices, sizeof(numVertices), 1, f);
+			fwrite(&vertices[0], sizeof(ExVertexStruct), numVertices, f);
+			fwrite(&numIndices, sizeof(numIndices), 1, f);
+			fwrite(&indices[0], sizeof(VERTEX_INDEX), numIndices, f);
 		}
-	}*/
+	}
 
-	// Check for overlaying triangles and throw them out
-	// Some mods do that for the worldmesh for example
-	std::set<std::tuple<VERTEX_INDEX,VERTEX_INDEX,VERTEX_INDEX>> triangles;
-	for(size_t i=0;i<outIndices.size();i+=3)
+	fclose(f);
+}
+
+/** Creates the LOD-chain for all meshes of the given visual, or loads it from the cache next to the mesh-infos */
+void WorldConverter::CreateLODsFor(MeshVisualInfo* visual)
+{
+	std::vector<MeshInfo*> meshes;
+	for(std::map<MeshKey, std::vector<MeshInfo*>, cmpMeshKey>::iterator it = visual->MeshesByTexture.begin(); it != visual->MeshesByTexture.end(); it++)
 	{
-		// Insert every combination of indices here. Duplicates will be ignored
-		triangles.insert(std::make_tuple(outIndices[i+0], outIndices[i+1], outIndices[i+2]));
+		for(unsigned int i=0;i<(*it).second.size();i++)
+		{
+			if((*it).second[i]->Indices.size() / 3 >= MESHLOD_MIN_TRIANGLES)
+				meshes.push_back((*it).second[i]);
+		}
 	}
 
-	//if(triangles.size() != outIndices.size() / 3)
-	//	LogWarn() << "Found mesh with " << (outIndices.size() / 3) - triangles.size() << " overlaying Triangles!";
+	if(meshes.empty())
+		return;
+
+	std::vector<unsigned __int64> hashes(meshes.size());
+	for(unsigned int i=0;i<meshes.size();i++)
+		hashes[i] = HashLODSource(meshes[i]);
 
-	// Extract the cleaned triangles to the indices vector
-	outIndices.clear();
-	for(auto it = triangles.begin(); it != triangles.end(); it++)
+	std::string file = "system\\GD3D11\\meshes\\infos\\" + visual->VisualName + ".lod";
+	std::unordered_map<unsigned __int64, MeshLODData> cached;
+	LoadLODCache(file, cached);
+
+	// Only decimate what isn't in the cache
+	std::vector<MeshLODData> data(meshes.size());
+	std::vector<unsigned int> missing;
+	for(unsigned int i=0;i<meshes.size();i++)
 	{
-		outIndices.push_back(std::get<0>((*it)));
-		outIndices.push_back(std::get<1>((*it)));
-		outIndices.push_back(std::get<2>((*it)));
+		std::unordered_map<unsigned __int64, MeshLODData>::iterator c = cached.find(hashes[i]);
+		if(c != cached.end())
+			data[i] = (*c).second;
+		else
+			missing.push_back(i);
 	}
 
-    // Notice that the vertices in the set are not sorted by the index
-    // so you'll have to rearrange them like this:
-	outVertices.clear();
-    outVertices.resize(vertices.size());
-    for (std::set<std::pair<ExVertexStruct, int>>::iterator it=vertices.begin(); it!=vertices.end(); it++)
+	if(!missing.empty())
 	{
-		if((unsigned int)it->second >= vertices.size())
+		float meshSize = visual->MeshSize;
+		ParallelForEach(missing.size(), [&](unsigned int i)
 		{
-			continue;
+			ComputeLODsFor(meshes[missing[i]], meshSize, data[missing[i]]);
+		});
+
+		SaveLODCache(file, hashes, data);
+	}
+
+	for(unsigned int i=0;i<meshes.size();i++)
+	{
+		for(unsigned int l=0;l<data[i].LODs.size();l++)
+		{
+			MeshInfo* lod = new MeshInfo;
+			lod->Vertices = data[i].LODs[l].first;
+			lod->Indices = data[i].LODs[l].second;
+
+			Engine::GraphicsEngine->CreateVertexBuffer(&lod->MeshVertexBuffer);
+			Engine::GraphicsEngine->CreateVertexBuffer(&lod->MeshIndexBuffer);
+
+			lod->MeshVertexBuffer->OptimizeFaces(&lod->Indices[0],
+				(byte *)&lod->Vertices[0], 
+				lod->Indices.size(), 
+				lod->Vertices.size(), 
+				sizeof(ExVertexStruct));
+
+			lod->MeshVertexBuffer->OptimizeVertices(&lod->Indices[0],
+				(byte *)&lod->Vertices[0], 
+				lod->Indices.size(), 
+				lod->Vertices.size(), 
+				sizeof(ExVertexStruct));
+
+			lod->MeshVertexBuffer->Init(&lod->Vertices[0], lod->Vertices.size() * sizeof(ExVertexStruct), D3D11VertexBuffer::B_VERTEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
+			lod->MeshIndexBuffer->Init(&lod->Indices[0], lod->Indices.size() * sizeof(VERTEX_INDEX), D3D11VertexBuffer::B_INDEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
+
+			Engine::GAPI->GetRendererState()->RendererInfo.VOBVerticesDataSize += lod->Vertices.size() * sizeof(ExVertexStruct);
+			Engine::GAPI->GetRendererState()->RendererInfo.VOBVerticesDataSize += lod->Indices.size() * sizeof(VERTEX_INDEX);
+
+			meshes[i]->LODs.push_back(lod);
 		}
 
-        outVertices[it->second] = it->first;
+		visual->NumLODs = std::max(visual->NumLODs, (unsigned int)meshes[i]->LODs.size() + 1);
 	}
 }
 
-void WorldConverter::IndexVertices(ExVertexStruct* input, unsigned int numInputVertices, std::vector<ExVertexStruct>& outVertices, std::vector<unsigned int>& outIndices)
+/** Indexes the given vertex array */
+void WorldConverter::IndexVertices(ExVertexStruct* input, unsigned int numInputVertices, std::vector<ExVertexStruct>& outVertices, std::vector<VERTEX_INDEX>& outIndices)
 {
-	std::set<std::pair<ExVertexStruct, int>, CmpClass> vertices;
-	unsigned int index = 0;
-
-    for (unsigned int i=0; i<numInputVertices; i++)
-    {
-        std::set<std::pair<ExVertexStruct, int>>::iterator it = vertices.find(std::make_pair(input[i], 0/*this value doesn't matter*/));
-        if (it!=vertices.end()) outIndices.push_back(it->second);
-        else
-        {
-            vertices.insert(std::make_pair(input[i], index));
-            outIndices.push_back(index++);
-        }
-    }
-
-    // Notice that the vertices in the set are not sorted by the index
-    // so you'll have to rearrange them like this:
-	outVertices.clear();
-    outVertices.resize(vertices.size());
-    for (std::set<std::pair<ExVertexStruct, int>>::iterator it=vertices.begin(); it!=vertices.end(); it++)
-        outVertices[it->second] = it->first;
+	VertexWelder<ExVertexStruct> welder;
+	welder.Weld(input, numInputVertices, outVertices, outIndices);
+
+	// Check for overlaying triangles and throw them out
+	// Some mods do that for the worldmesh for example
+	RemoveDuplicateTriangles(outIndices);
 }
 
-struct CmpClassSkel // class comparing vertices in the set
+void WorldConverter::IndexVertices(ExVertexStruct* input, unsigned int numInputVertices, std::vector<ExVertexStruct>& outVertices, std::vector<unsigned int>& outIndices)
 {
-    bool operator() (const std::pair<ExSkelVertexStruct, int>& p1, const std::pair<ExSkelVertexStruct, int>& p2) const
-    {
-		for(int i=0;i<4;i++)
-		{
-			if (fabs(p1.first.Position[i].x-p2.first.Position[i].x) > eps) return p1.first.Position[i].x < p2.first.Position[i].x;
-			if (fabs(p1.first.Position[i].y-p2.first.Position[i].y) > eps) return p1.first.Position[i].y < p2.first.Position[i].y;
-			if (fabs(p1.first.Position[i].z-p2.first.Position[i].z) > eps) return p1.first.Position[i].z < p2.first.Position[i].z;
-		}
-
-		if (fabs(p1.first.TexCoord.x-p2.first.TexCoord.x) > eps) return p1.first.TexCoord.x < p2.first.TexCoord.x;
-		if (fabs(p1.first.TexCoord.y-p2.first.TexCoord.y) > eps) return p1.first.TexCoord.y < p2.first.TexCoord.y;
-
-        return false;
-    }
-};
+	VertexWelder<ExVertexStruct> welder;
+	welder.Weld(input, numInputVertices, outVertices, outIndices);
+}
 
 void WorldConverter::IndexVertices(ExSkelVertexStruct* input, unsigned int numInputVertices, std::vector<ExSkelVertexStruct>& outVertices, std::vector<VERTEX_INDEX>& outIndices)
 {
-	std::set<std::pair<ExSkelVertexStruct, int>, CmpClassSkel> vertices;
-	int index = 0;
-
-    for (unsigned int i=0; i<numInputVertices; i++)
-    {
-        std::set<std::pair<ExSkelVertexStruct, int>>::iterator it = vertices.find(std::make_pair(input[i], 0/*this value doesn't matter*/));
-        if (it!=vertices.end()) outIndices.push_back(it->second);
-        else
-        {
-			/*char* c = (char *)&input[i].color;
-			c[0] = rand() % 255;
-			c[1] = rand() % 255;
-			c[2] = rand() % 255;*/
-
-            vertices.insert(std::make_pair(input[i], index));
-            outIndices.push_back(index++);
-        }
-    }
-
-    // Notice that the vertices in the set are not sorted by the index
-    // so you'll have to rearrange them like this:
-    outVertices.resize(vertices.size());
-    for (std::set<std::pair<ExSkelVertexStruct, int>>::iterator it=vertices.begin(); it!=vertices.end(); it++)
-        outVertices[it->second] = it->first;
+	VertexWelder<ExSkelVertexStruct> welder;
+	welder.Weld(input, numInputVertices, outVertices, outIndices);
 }
 
 /** Computes vertex normals for a mesh with face normals */
@@ -2097,45 +2502,9 @@ void WorldConverter::WrapVertexBuffers( const std::list<std::vector<ExVertexStru
 }
 
 /** Caches a mesh */
-void WorldConverter::CacheMesh(const std::map<std::string, std::vector<std::pair<std::vector<ExVertexStruct>, std::vector<VERTEX_INDEX>>>> geometry, const std::string& file)
+void WorldConverter::CacheMesh(const std::map<std::string, std::vector<std::pair<std::vector<ExVertexStruct>, std::vector<VERTEX_INDEX>>>>& geometry, const std::string& file, unsigned __int64 sourceHash)
 {
-	FILE* f = fopen(file.c_str(), "wb");
-	// Write version
-	int Version = 1;
-	fwrite(&Version, sizeof(Version), 1, f);
-
-	// Write num textures
-	int numTextures = geometry.size();
-	fwrite(&numTextures, sizeof(numTextures), 1, f);
-
-	for(std::map<std::string, std::vector<std::pair<std::vector<ExVertexStruct>, std::vector<VERTEX_INDEX>>>>::const_iterator it = geometry.begin();
-		it != geometry.end();
-		it++)
-	{
-		// Save texture name
-		unsigned char numTxNameChars = (*it).first.size();
-		fwrite(&numTxNameChars, sizeof(numTxNameChars), 1, f);
-		fwrite(&(*it).first[0], numTxNameChars, 1, f);
-
-		// Save num submeshes
-		unsigned char numSubmeshes = (*it).second.size();
-		fwrite(&numSubmeshes, sizeof(numSubmeshes), 1, f);
-
-		for(int i=0;i<numSubmeshes;i++)
-		{
-			// Save vertices
-			int numVertices = (*it).second[i].first.size();
-			fwrite(&numVertices, sizeof(numVertices), 1, f);
-			fwrite(&(*it).second[i].first[0], sizeof(ExVertexStruct) * (*it).second[i].first.size(), 1, f);
-
-			// Save indices
-			int numIndices = (*it).second[i].second.size();
-			fwrite(&numIndices, sizeof(numIndices), 1, f);
-			fwrite(&(*it).second[i].second[0], sizeof(VERTEX_INDEX) * (*it).second[i].second.size(), 1, f);
-		}
-	}
-
-	fclose(f);
+	MeshCacheFile::Write(geometry, file, sourceHash);
 }
 
 /** Updates a quadmark info */
@@ -2188,24 +2557,16 @@ void WorldConverter::UpdateQuadMarkInfo(QuadMarkInfo* info, zCQuadMark* mark, co
 	info->Position = position;
 }
 
-/** Turns a MeshInfo into PNAEN */
-void WorldConverter::CreatePNAENInfoFor(MeshInfo* mesh, bool softNormals)
+/** Computes the PNAEN-indices and -vertices of the given mesh. Only touches the mesh, so this can run on any thread. */
+static void ComputePNAENInfoFor(MeshInfo* mesh, bool softNormals)
 {
-	delete mesh->MeshIndexBufferPNAEN;
-	Engine::GraphicsEngine->CreateVertexBuffer(&mesh->MeshIndexBufferPNAEN);
-
-	delete mesh->MeshVertexBuffer;
-	Engine::GraphicsEngine->CreateVertexBuffer(&mesh->MeshVertexBuffer);
-
 	mesh->VerticesPNAEN = mesh->Vertices;
 
 	MeshModifier::ComputePNAEN18Indices(mesh->VerticesPNAEN, mesh->Indices, mesh->IndicesPNAEN, true, softNormals);
-	mesh->MeshIndexBufferPNAEN->Init(&mesh->IndicesPNAEN[0], mesh->IndicesPNAEN.size() * sizeof(VERTEX_INDEX), D3D11VertexBuffer::B_INDEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
-	mesh->MeshVertexBuffer->Init(&mesh->VerticesPNAEN[0], mesh->VerticesPNAEN.size() * sizeof(ExVertexStruct), D3D11VertexBuffer::B_VERTEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
 }
 
-
-void WorldConverter::CreatePNAENInfoFor(WorldMeshInfo* mesh, bool softNormals)
+/** Creates the buffers for what ComputePNAENInfoFor put into the mesh */
+static void CreatePNAENBuffersFor(MeshInfo* mesh)
 {
 	delete mesh->MeshIndexBufferPNAEN;
 	Engine::GraphicsEngine->CreateVertexBuffer(&mesh->MeshIndexBufferPNAEN);
@@ -2213,15 +2574,27 @@ void WorldConverter::CreatePNAENInfoFor(WorldMeshInfo* mesh, bool softNormals)
 	delete mesh->MeshVertexBuffer;
 	Engine::GraphicsEngine->CreateVertexBuffer(&mesh->MeshVertexBuffer);
 
-	mesh->VerticesPNAEN = mesh->Vertices;
-
-	MeshModifier::ComputePNAEN18Indices(mesh->VerticesPNAEN, mesh->Indices, mesh->IndicesPNAEN, true, softNormals);
 	mesh->MeshIndexBufferPNAEN->Init(&mesh->IndicesPNAEN[0], mesh->IndicesPNAEN.size() * sizeof(VERTEX_INDEX), D3D11VertexBuffer::B_INDEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
 	mesh->MeshVertexBuffer->Init(&mesh->VerticesPNAEN[0], mesh->VerticesPNAEN.size() * sizeof(ExVertexStruct), D3D11VertexBuffer::B_VERTEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
 }
 
-/** Turns a MeshInfo into PNAEN */
-void WorldConverter::CreatePNAENInfoFor(SkeletalMeshInfo* mesh, MeshInfo* bindPoseMesh, bool softNormals)
+/** Computes the PNAEN-info of a skeletal mesh, using the vertices of its bind pose */
+static void ComputePNAENInfoFor(SkeletalMeshInfo* mesh, MeshInfo* bindPoseMesh, bool softNormals)
+{
+	bindPoseMesh->VerticesPNAEN = bindPoseMesh->Vertices;
+
+	MeshModifier::ComputePNAEN18Indices(bindPoseMesh->VerticesPNAEN, mesh->Indices, mesh->IndicesPNAEN, true, softNormals);
+	bindPoseMesh->IndicesPNAEN = mesh->IndicesPNAEN;
+
+	for(unsigned int i=0;i<mesh->Vertices.size();i++)
+	{
+		// Transfer the normals, in case they changed
+		mesh->Vertices[i].Normal = bindPoseMesh->VerticesPNAEN[i].Normal;
+	}
+}
+
+/** Creates the buffers for what ComputePNAENInfoFor put into the skeletal mesh */
+static void CreatePNAENBuffersFor(SkeletalMeshInfo* mesh, MeshInfo* bindPoseMesh)
 {
 	delete mesh->MeshIndexBufferPNAEN;
 	Engine::GraphicsEngine->CreateVertexBuffer(&mesh->MeshIndexBufferPNAEN);
@@ -2235,28 +2608,188 @@ void WorldConverter::CreatePNAENInfoFor(SkeletalMeshInfo* mesh, MeshInfo* bindPo
 	delete bindPoseMesh->MeshVertexBuffer;
 	Engine::GraphicsEngine->CreateVertexBuffer(&bindPoseMesh->MeshVertexBuffer);
 
-	bindPoseMesh->VerticesPNAEN = bindPoseMesh->Vertices;
-
-	MeshModifier::ComputePNAEN18Indices(bindPoseMesh->VerticesPNAEN, mesh->Indices, mesh->IndicesPNAEN, true, softNormals);
-	bindPoseMesh->IndicesPNAEN = mesh->IndicesPNAEN;
-
 	mesh->MeshIndexBufferPNAEN->Init(&mesh->IndicesPNAEN[0], mesh->IndicesPNAEN.size() * sizeof(VERTEX_INDEX), D3D11VertexBuffer::B_INDEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
 	bindPoseMesh->MeshIndexBufferPNAEN->Init(&bindPoseMesh->IndicesPNAEN[0], bindPoseMesh->IndicesPNAEN.size() * sizeof(VERTEX_INDEX), D3D11VertexBuffer::B_INDEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
 
-	
-	for(unsigned int i=0;i<mesh->Vertices.size();i++)
+	mesh->MeshVertexBuffer->Init(&mesh->Vertices[0], mesh->Vertices.size() * sizeof(ExSkelVertexStruct), D3D11VertexBuffer::B_VERTEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
+	bindPoseMesh->MeshVertexBuffer->Init(&bindPoseMesh->VerticesPNAEN[0], bindPoseMesh->VerticesPNAEN.size() * sizeof(ExVertexStruct), D3D11VertexBuffer::B_VERTEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
+}
+
+/** Turns a MeshInfo into PNAEN */
+void WorldConverter::CreatePNAENInfoFor(MeshInfo* mesh, bool softNormals)
+{
+	ComputePNAENInfoFor(mesh, softNormals);
+	CreatePNAENBuffersFor(mesh);
+}
+
+void WorldConverter::CreatePNAENInfoFor(WorldMeshInfo* mesh, bool softNormals)
+{
+	ComputePNAENInfoFor(mesh, softNormals);
+	CreatePNAENBuffersFor(mesh);
+}
+
+/** Turns a MeshInfo into PNAEN */
+void WorldConverter::CreatePNAENInfoFor(SkeletalMeshInfo* mesh, MeshInfo* bindPoseMesh, bool softNormals)
+{
+	ComputePNAENInfoFor(mesh, bindPoseMesh, softNormals);
+	CreatePNAENBuffersFor(mesh, bindPoseMesh);
+}
+
+/** Turns all given meshes into PNAEN. The meshes are computed in parallel, the buffers are created on this thread. */
+void WorldConverter::CreatePNAENInfoFor(const std::vector<MeshInfo*>& meshes, bool softNormals)
+{
+	ParallelForEach(meshes.size(), [&](unsigned int i)
 	{
-		// Transfer the normals, in case they changed
-		mesh->Vertices[i].Normal = bindPoseMesh->VerticesPNAEN[i].Normal;
+		ComputePNAENInfoFor(meshes[i], softNormals);
+	});
+
+	for(unsigned int i=0;i<meshes.size();i++)
+		CreatePNAENBuffersFor(meshes[i]);
+}
+
+void WorldConverter::CreatePNAENInfoFor(const std::vector<SkeletalMeshInfo*>& meshes, const std::vector<MeshInfo*>& bindPoseMeshes, bool softNormals)
+{
+	ParallelForEach(meshes.size(), [&](unsigned int i)
+	{
+		ComputePNAENInfoFor(meshes[i], bindPoseMeshes[i], softNormals);
+	});
+
+	for(unsigned int i=0;i<meshes.size();i++)
+		CreatePNAENBuffersFor(meshes[i], bindPoseMeshes[i]);
+}
+
+/** Turns all given world meshes into PNAEN. Meshes with displacement get soft normals. */
+void WorldConverter::CreatePNAENInfoFor(const std::vector<WorldMeshInfo*>& meshes)
+{
+	if(meshes.empty())
+		return;
+
+	DWORD start = timeGetTime();
+
+	ParallelForEach(meshes.size(), [&](unsigned int i)
+	{
+		ComputePNAENInfoFor(meshes[i], meshes[i]->TesselationSettings.buffer.VT_DisplacementStrength > 0.0f);
+	});
+
+	DWORD computeTime = timeGetTime() - start;
+
+	for(unsigned int i=0;i<meshes.size();i++)
+		CreatePNAENBuffersFor(meshes[i]);
+
+	LogInfo() << "Created PNAEN-info for " << meshes.size() << " world meshes in " << timeGetTime() - start << "ms (indices: " << computeTime << "ms)";
+}
+
+/** Returns true if both vertex-lists are the same, apart from the border ids in TexCoord2.y */
+static bool PNAENVerticesMatch(const std::vector<ExVertexStruct>& a, const std::vector<ExVertexStruct>& b)
+{
+	if(a.size() != b.size())
+		return false;
+
+	for(unsigned int i=0;i<a.size();i++)
+	{
+		ExVertexStruct va = a[i];
+		ExVertexStruct vb = b[i];
+		va.TexCoord2.y = 0.0f;
+		vb.TexCoord2.y = 0.0f;
+
+		if(memcmp(&va, &vb, sizeof(ExVertexStruct)) != 0)
+			return false;
 	}
 
-	/*for(int i=0;i<mesh->IndicesPNAEN.size();i+=18)
+	return true;
+}
+
+/** Runs the PNAEN-index generation on copies of the given meshes, once on this thread and once spread over the
+	worker-pool, and compares the result against the unordered_map-based reference. The meshes themselves are not changed. */
+void WorldConverter::BenchmarkPNAEN(const std::vector<WorldMeshInfo*>& meshes)
+{
+	unsigned int numTriangles = 0;
+	for(unsigned int i=0;i<meshes.size();i++)
+		numTriangles += meshes[i]->Indices.size() / 3;
+
+	std::vector<std::vector<ExVertexStruct>> vertices(meshes.size());
+	std::vector<std::vector<VERTEX_INDEX>> serialIndices(meshes.size());
+	std::vector<std::vector<VERTEX_INDEX>> parallelIndices(meshes.size());
+
+	// Same settings the meshes get their PNAEN-info with
+	std::vector<bool> softNormals(meshes.size());
+	for(unsigned int i=0;i<meshes.size();i++)
+		softNormals[i] = meshes[i]->TesselationSettings.buffer.VT_DisplacementStrength > 0.0f;
+
+	// The reference only takes 32-bit indices
+	std::vector<std::vector<unsigned int>> indices32(meshes.size());
+	for(unsigned int i=0;i<meshes.size();i++)
+		indices32[i].assign(meshes[i]->Indices.begin(), meshes[i]->Indices.end());
+
+	std::vector<std::vector<ExVertexStruct>> referenceVertices(meshes.size());
+	std::vector<std::vector<unsigned int>> referenceIndices(meshes.size());
+	for(unsigned int i=0;i<meshes.size();i++)
+		referenceVertices[i] = meshes[i]->Vertices;
+
+	DWORD referenceStart = timeGetTime();
+	for(unsigned int i=0;i<meshes.size();i++)
+		MeshModifier::ComputePNAEN18IndicesReference(referenceVertices[i], indices32[i], referenceIndices[i], true, softNormals[i]);
+
+	DWORD referenceTime = timeGetTime() - referenceStart;
+
+	for(unsigned int i=0;i<meshes.size();i++)
+		vertices[i] = meshes[i]->Vertices;
+
+	DWORD serialStart = timeGetTime();
+	for(unsigned int i=0;i<meshes.size();i++)
+		MeshModifier::ComputePNAEN18Indices(vertices[i], meshes[i]->Indices, serialIndices[i], true, softNormals[i]);
+
+	DWORD serialTime = timeGetTime() - serialStart;
+
+	// Compare against the reference: Indices have to be exactly the same, vertices apart from the border ids
+	unsigned int numIndexMismatches = 0;
+	unsigned int numVertexMismatches = 0;
+	for(unsigned int i=0;i<meshes.size();i++)
 	{
+		std::vector<VERTEX_INDEX> reference(referenceIndices[i].begin(), referenceIndices[i].end());
+		if(reference != serialIndices[i])
+			numIndexMismatches++;
 
-	}*/
+		if(!PNAENVerticesMatch(referenceVertices[i], vertices[i]))
+			numVertexMismatches++;
+	}
 
-	mesh->MeshVertexBuffer->Init(&mesh->Vertices[0], mesh->Vertices.size() * sizeof(ExSkelVertexStruct), D3D11VertexBuffer::B_VERTEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
-	bindPoseMesh->MeshVertexBuffer->Init(&bindPoseMesh->VerticesPNAEN[0], bindPoseMesh->VerticesPNAEN.size() * sizeof(ExVertexStruct), D3D11VertexBuffer::B_VERTEXBUFFER, D3D11VertexBuffer::U_IMMUTABLE);
+	// The 9-index variant
+	unsigned int numAdjacencyMismatches = 0;
+	for(unsigned int i=0;i<meshes.size();i++)
+	{
+		std::vector<unsigned int> reference, adjacency;
+		MeshModifier::ComputePNAENIndicesReference(meshes[i]->Vertices, indices32[i], reference);
+		MeshModifier::ComputePNAENIndices(meshes[i]->Vertices, indices32[i], adjacency);
+
+		if(reference != adjacency)
+			numAdjacencyMismatches++;
+	}
+
+	for(unsigned int i=0;i<meshes.size();i++)
+		vertices[i] = meshes[i]->Vertices;
+
+	DWORD parallelStart = timeGetTime();
+	ParallelForEach(meshes.size(), [&](unsigned int i)
+	{
+		MeshModifier::ComputePNAEN18Indices(vertices[i], meshes[i]->Indices, parallelIndices[i], true, softNormals[i]);
+	});
+
+	DWORD parallelTime = timeGetTime() - parallelStart;
+
+	LogInfo() << "PNAEN-benchmark: " << meshes.size() << " world meshes, " << numTriangles << " triangles. Reference: " << referenceTime << "ms, serial: " << serialTime << "ms, parallel: " << parallelTime << "ms"
+		<< (serialIndices == parallelIndices ? "" : " (PARALLEL RESULTS DIFFER!)");
+
+	if(numIndexMismatches || numVertexMismatches || numAdjacencyMismatches)
+	{
+		// The reference compares positions with a tolerance whenever they share a hash-bucket, so meshes with nearly
+		// equal positions may legitimately come out different
+		LogWarn() << "PNAEN-benchmark: Differs from the reference in " << numIndexMismatches << " index-lists, " << numVertexMismatches
+			<< " vertex-lists and " << numAdjacencyMismatches << " adjacency-lists of " << meshes.size() << " meshes";
+	}else
+	{
+		LogInfo() << "PNAEN-benchmark: All meshes match the reference";
+	}
 }
 
 /** Converts ExVertexStruct into a zCPolygon*-Attay */
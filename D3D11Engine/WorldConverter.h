@@ -19,6 +19,15 @@ const DWORD DEFAULT_LIGHTMAP_POLY_COLOR = DEFAULT_LIGHTMAP_POLY_COLOR_F.ToDWORD(
 const float3 DEFAULT_INDOOR_VOB_AMBIENT = float3(0.15f, 0.15f, 0.15f);
 
 
+/** A worldmesh WorldMeshCollectPolyRange takes its polygons from. Gathered on the main thread, so the polygons
+	can be collected on a worker without walking the sections while they change. */
+struct WorldMeshRangeSource
+{
+	MeshKey Key;
+	WorldMeshInfo* Mesh;
+	bool AlphaTested; // Gets an own mesh in the output
+};
+
 class zCProgMeshProto;
 class zCModel;
 class zCModelPrototype;
@@ -30,17 +39,24 @@ public:
 	WorldConverter(void);
 	virtual ~WorldConverter(void);
 
-	/** Collects all world-polys in the specific range. Drops all materials that have no alphablending */
-	static void WorldMeshCollectPolyRange(const D3DXVECTOR3& position, float range, std::map<int,std::map<int, WorldMeshSectionInfo>>& inSections, std::map<MeshKey, WorldMeshInfo*, cmpMeshKey>& outMeshes);
+	/** Gathers the worldmeshes WorldMeshCollectPolyRange needs for the given position. Main thread only. */
+	static void WorldMeshGetRangeSources(const D3DXVECTOR3& position, WorldSectionGrid& inSections, std::vector<WorldMeshRangeSource>& outSources);
+
+	/** Collects all world-polys in the specific range. Drops all materials that have no alphablending.
+		Hold GothicAPI::GetWorldMeshMutex while calling this from a worker. */
+	static void WorldMeshCollectPolyRange(const D3DXVECTOR3& position, float range, const std::vector<WorldMeshRangeSource>& inSources, std::map<MeshKey, WorldMeshInfo*, cmpMeshKey>& outMeshes);
+
+	/** Sorts the triangles of the given mesh by the face of a shadow-cube at position they mostly lie in and fills its CubeFaceRanges */
+	static void SortIndicesByCubeFace(const D3DXVECTOR3& position, WorldMeshInfo* mesh);
 
 	/** Converts the worldmesh into a more usable format */
-	static HRESULT ConvertWorldMesh(zCPolygon** polys, unsigned int numPolygons, std::map<int, std::map<int, WorldMeshSectionInfo>>* outSections, WorldInfo* info, MeshInfo** outWrappedMesh);
+	static HRESULT ConvertWorldMesh(zCPolygon** polys, unsigned int numPolygons, WorldSectionGrid* outSections, WorldInfo* info, MeshInfo** outWrappedMesh);
 
 	/** Converts the worldmesh into a PNAEN-buffer */
-	static HRESULT ConvertWorldMeshPNAEN(zCPolygon** polys, unsigned int numPolygons, std::map<int, std::map<int, WorldMeshSectionInfo>>* outSections, WorldInfo* info, MeshInfo** outWrappedMesh);
+	static HRESULT ConvertWorldMeshPNAEN(zCPolygon** polys, unsigned int numPolygons, WorldSectionGrid* outSections, WorldInfo* info, MeshInfo** outWrappedMesh);
 
 	/** Converts a loaded custommesh to be the worldmesh */
-	static XRESULT LoadWorldMeshFromFile(const std::string& file, std::map<int, std::map<int, WorldMeshSectionInfo>>* outSections, WorldInfo* info, MeshInfo** outWrappedMesh);
+	static XRESULT LoadWorldMeshFromFile(const std::string& file, WorldSectionGrid* outSections, WorldInfo* info, MeshInfo** outWrappedMesh);
 
 	/** Returns what section the given position is in */
 	static INT2 GetSectionOfPos(const D3DXVECTOR3& pos);
@@ -49,7 +65,7 @@ public:
 	static void TriangleFanToList(ExVertexStruct* input, unsigned int numInputVertices, std::vector<ExVertexStruct>* outVertices);
 
 	/** Saves the given section-array to an obj file */
-	static void SaveSectionsToObjUnindexed(const char* file, const std::map<int, std::map<int, WorldMeshSectionInfo>>& sections);
+	static void SaveSectionsToObjUnindexed(const char* file, const WorldSectionGrid& sections);
 
 	/** Saves the given prog mesh to an obj-file */
 	//static void SaveProgMeshToOBj(
@@ -61,6 +77,9 @@ public:
 	static void Extract3DSMeshFromVisual2(zCProgMeshProto* visual, MeshVisualInfo* meshInfo);
 	static void Extract3DSMeshFromVisual2PNAEN(zCProgMeshProto* visual, MeshVisualInfo* meshInfo);
 
+	/** Creates the LOD-chain for all meshes of the given visual, or loads it from the cache */
+	static void CreateLODsFor(MeshVisualInfo* visual);
+
 	/** Extracts a skeletal mesh from a zCModel */
 	static void ExtractSkeletalMeshFromVob(zCModel* model, SkeletalMeshVisualInfo* skeletalMeshInfo);
 	
@@ -94,14 +113,25 @@ public:
 	/** Builds a big vertexbuffer from the world sections */
 	static void WrapVertexBuffers(const std::list<std::vector<ExVertexStruct>*>& vertexBuffers, const std::list<std::vector<VERTEX_INDEX>*>& indexBuffers, std::vector<ExVertexStruct>& outVertices, std::vector<unsigned int>& outIndices, std::vector<unsigned int>& outOffsets);
 
-	/** Caches a mesh */
-	static void CacheMesh(const std::map<std::string, std::vector<std::pair<std::vector<ExVertexStruct>, std::vector<VERTEX_INDEX>>>> geometry, const std::string& file);
+	/** Caches a mesh. The hash of the source file is stored to detect stale caches. */
+	static void CacheMesh(const std::map<std::string, std::vector<std::pair<std::vector<ExVertexStruct>, std::vector<VERTEX_INDEX>>>>& geometry, const std::string& file, unsigned __int64 sourceHash = 0);
 
 	/** Turns a MeshInfo into PNAEN */
 	static void CreatePNAENInfoFor(MeshInfo* mesh, bool softNormals = false);
 	static void CreatePNAENInfoFor(SkeletalMeshInfo* mesh, MeshInfo* bindPoseMesh, bool softNormals = false);
 	static void CreatePNAENInfoFor(WorldMeshInfo* mesh, bool softNormals = false);
 
+	/** Turns all given meshes into PNAEN. The meshes are computed in parallel, the buffers are created on this thread. */
+	static void CreatePNAENInfoFor(const std::vector<MeshInfo*>& meshes, bool softNormals = false);
+	static void CreatePNAENInfoFor(const std::vector<SkeletalMeshInfo*>& meshes, const std::vector<MeshInfo*>& bindPoseMeshes, bool softNormals = false);
+
+	/** Turns all given world meshes into PNAEN. Meshes with displacement get soft normals. */
+	static void CreatePNAENInfoFor(const std::vector<WorldMeshInfo*>& meshes);
+
+	/** Times the PNAEN-index generation for the given meshes, serial and in parallel, and compares it with the old
+		unordered_map-based version. Doesn't change the meshes. */
+	static void BenchmarkPNAEN(const std::vector<WorldMeshInfo*>& meshes);
+
 	/** Converts ExVertexStruct into a zCPolygon*-Attay */
 	static void ConvertExVerticesTozCPolygons(const std::vector<ExVertexStruct>& vertices, const std::vector<VERTEX_INDEX>& indices, zCMaterial* material, std::vector<zCPolygon *>& polyArray);
 
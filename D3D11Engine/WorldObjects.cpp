@@ -54,11 +54,7 @@ void WorldMeshInfo::LoadWorldMeshInfo(const std::string& name)
 
 	TesselationSettings.UpdateConstantbuffer();
 
-	// Create actual PNAEN-Info if needed
-	if(TesselationSettings.buffer.VT_TesselationFactor > 0.0f)
-	{
-		WorldConverter::CreatePNAENInfoFor(this, TesselationSettings.buffer.VT_DisplacementStrength > 0.0f);
-	}
+	// The actual PNAEN-Info is created by GothicAPI::LoadSectionInfos, for all meshes at once
 
 	fclose(f);
 }
@@ -71,7 +67,15 @@ void VobInfo::UpdateVobConstantBuffer()
 
 	VobConstantBuffer->UpdateBuffer(&cb);
 
-	LastRenderPosition = Vob->GetPositionWorld();
+	D3DXVECTOR3 position = Vob->GetPositionWorld();
+	if(position != LastRenderPosition)
+	{
+		// The nodes cull with a copy of the position
+		for(size_t i=0;i<ParentBSPNodes.size();i++)
+			ParentBSPNodes[i]->VobPositionsDirty = true;
+	}
+
+	LastRenderPosition = position;
 	WorldMatrix = cb.World;
 
 	// Colorize the vob according to the underlaying polygon
@@ -85,6 +89,16 @@ void VobInfo::UpdateVobConstantBuffer()
 		GroundColor = Vob->GetGroundPoly() ? Vob->GetGroundPoly()->getFeatures()[0]->lightStatic : 0xFFFFFFFF;
 	}
 
+	// Only this slot needs to go to the GPU again
+	if(InstanceSlot != VOB_INSTANCE_NO_SLOT)
+	{
+		VobInstanceInfo vii;
+		ZeroMemory(&vii, sizeof(vii));
+		vii.world = WorldMatrix;
+		vii.color = GroundColor;
+		Engine::GAPI->GetVobInstanceStore().SetInstance(InstanceSlot, vii);
+	}
+
 	//D3DXMatrixTranspose(&WorldMatrix, &cb.World);
 }
 
@@ -118,14 +132,21 @@ void VisualTesselationSettings::UpdateConstantbuffer()
 /** Creates PNAEN-Info for all meshes if not already there */
 void SkeletalMeshVisualInfo::CreatePNAENInfo(bool softNormals)
 {
+	std::vector<SkeletalMeshInfo*> meshes;
+	std::vector<MeshInfo*> bindPoseMeshes;
 	for(std::map<zCMaterial *, std::vector<SkeletalMeshInfo*>>::iterator it = SkeletalMeshes.begin(); it != SkeletalMeshes.end(); it++)
 	{
 		for(unsigned int i=0;i<(*it).second.size();i++)
 		{
 			if((*it).second[i]->IndicesPNAEN.empty())
-				WorldConverter::CreatePNAENInfoFor((*it).second[i], Meshes[(*it).first][i], softNormals);
+			{
+				meshes.push_back((*it).second[i]);
+				bindPoseMeshes.push_back(Meshes[(*it).first][i]);
+			}
 		}
 	}
+
+	WorldConverter::CreatePNAENInfoFor(meshes, bindPoseMeshes, softNormals);
 }
 
 /** Removes PNAEN info from this visual */
@@ -148,14 +169,17 @@ void SkeletalMeshVisualInfo::ClearPNAENInfo()
 /** Creates PNAEN-Info for all meshes if not already there */
 void MeshVisualInfo::CreatePNAENInfo(bool softNormals)
 {
+	std::vector<MeshInfo*> meshes;
 	for(std::map<zCMaterial *, std::vector<MeshInfo*>>::iterator it = Meshes.begin(); it != Meshes.end(); it++)
 	{
 		for(unsigned int i=0;i<(*it).second.size();i++)
 		{
 			if((*it).second[i]->IndicesPNAEN.empty())
-				WorldConverter::CreatePNAENInfoFor((*it).second[i], softNormals);
+				meshes.push_back((*it).second[i]);
 		}
 	}
+
+	WorldConverter::CreatePNAENInfoFor(meshes, softNormals);
 }
 
 /** Removes PNAEN info from this visual */
@@ -174,6 +198,39 @@ void BaseVisualInfo::ClearPNAENInfo()
 	}
 }
 
+/** Returns the BVH over all meshes of this visual. Built on first use. */
+const MeshBVH* BaseVisualInfo::GetTraceBVH()
+{
+	if(TraceBVH)
+		return TraceBVH;
+
+	TraceBVH = new MeshBVH;
+	TraceBVHMaterials.clear();
+	for(std::map<zCMaterial *, std::vector<MeshInfo*>>::iterator it = Meshes.begin(); it != Meshes.end(); it++)
+	{
+		for(unsigned int i=0;i<(*it).second.size();i++)
+		{
+			MeshInfo* mesh = (*it).second[i];
+			if(mesh->Indices.empty())
+				continue;
+
+			TraceBVH->AddMesh(&mesh->Vertices[0], &mesh->Indices[0], mesh->Indices.size(), TraceBVHMaterials.size());
+			TraceBVHMaterials.push_back((*it).first);
+		}
+	}
+
+	TraceBVH->Build();
+	return TraceBVH;
+}
+
+/** Throws away the BVH */
+void BaseVisualInfo::InvalidateTraceBVH()
+{
+	delete TraceBVH;
+	TraceBVH = NULL;
+	TraceBVHMaterials.clear();
+}
+
 /** Saves the info for this visual */
 void BaseVisualInfo::SaveMeshVisualInfo(const std::string& name)
 {
@@ -238,6 +295,8 @@ MeshInfo::~MeshInfo()
 	delete MeshIndexBuffer;
 	delete MeshIndexBufferPNAEN;
 
+	for(unsigned int i=0;i<LODs.size();i++)
+		delete LODs[i];
 }
 
 SkeletalMeshInfo::~SkeletalMeshInfo()
@@ -262,6 +321,36 @@ void SectionInstanceCache::ClearCacheForStatic(MeshVisualInfo* pm)
 	}
 }
 
+/** Returns the BVH over all worldmeshes of this section. Built on first use. */
+const MeshBVH* WorldMeshSectionInfo::GetTraceBVH()
+{
+	if(TraceBVH)
+		return TraceBVH;
+
+	TraceBVH = new MeshBVH;
+	TraceBVHMeshes.clear();
+	for(std::map<MeshKey, WorldMeshInfo*, cmpMeshKey>::iterator it = WorldMeshes.begin(); it != WorldMeshes.end(); it++)
+	{
+		WorldMeshInfo* mesh = (*it).second;
+		if(mesh->Indices.empty())
+			continue;
+
+		TraceBVH->AddMesh(&mesh->Vertices[0], &mesh->Indices[0], mesh->Indices.size(), TraceBVHMeshes.size());
+		TraceBVHMeshes.push_back(*it);
+	}
+
+	TraceBVH->Build();
+	return TraceBVH;
+}
+
+/** Throws away the BVH */
+void WorldMeshSectionInfo::InvalidateTraceBVH()
+{
+	delete TraceBVH;
+	TraceBVH = NULL;
+	TraceBVHMeshes.clear();
+}
+
 /** Saves this sections mesh to a file */
 void WorldMeshSectionInfo::SaveSectionMeshToFile(const std::string& name)
 {
@@ -330,3 +419,136 @@ XRESULT MeshInfo::Create(ExVertexStruct* vertices, unsigned int numVertices, VER
 
 	return XR_SUCCESS;
 }
+
+/** Sorts sections by x, then y */
+static bool CompareSectionCoords(const WorldMeshSectionInfo* a, const WorldMeshSectionInfo* b)
+{
+	if(a->WorldCoordinates.x != b->WorldCoordinates.x)
+		return a->WorldCoordinates.x < b->WorldCoordinates.x;
+
+	return a->WorldCoordinates.y < b->WorldCoordinates.y;
+}
+
+WorldSectionGrid::WorldSectionGrid()
+{
+	MinX = 0;
+	MinY = 0;
+	Width = 0;
+	Height = 0;
+	MaxOverhang = -1;
+}
+
+/** Returns the section at the given cell, creating it if it doesn't exist yet */
+WorldMeshSectionInfo& WorldSectionGrid::GetSection(int x, int y)
+{
+	WorldMeshSectionInfo* section = FindSection(x, y);
+	if(section)
+		return *section;
+
+	GrowToInclude(x, y);
+
+	Storage.emplace_back();
+	section = &Storage.back();
+	section->WorldCoordinates = INT2(x, y);
+
+	Cells[(x - MinX) * Height + (y - MinY)] = section;
+	Occupied.insert(std::lower_bound(Occupied.begin(), Occupied.end(), section, CompareSectionCoords), section);
+
+	return *section;
+}
+
+/** Returns the section at the given cell, or NULL if there is none */
+WorldMeshSectionInfo* WorldSectionGrid::FindSection(int x, int y) const
+{
+	if(x < MinX || x >= MinX + Width || y < MinY || y >= MinY + Height)
+		return NULL;
+
+	return Cells[(x - MinX) * Height + (y - MinY)];
+}
+
+/** Deletes all sections */
+void WorldSectionGrid::Clear()
+{
+	Occupied.clear();
+	Cells.clear();
+	Storage.clear();
+
+	MinX = 0;
+	MinY = 0;
+	Width = 0;
+	Height = 0;
+	MaxOverhang = -1;
+}
+
+/** Makes the grid big enough to hold the given cell */
+void WorldSectionGrid::GrowToInclude(int x, int y)
+{
+	if(Width > 0 && x >= MinX && x < MinX + Width && y >= MinY && y < MinY + Height)
+		return;
+
+	int minX = Width > 0 ? std::min(MinX, x) : x;
+	int minY = Height > 0 ? std::min(MinY, y) : y;
+	int maxX = Width > 0 ? std::max(MinX + Width - 1, x) : x;
+	int maxY = Height > 0 ? std::max(MinY + Height - 1, y) : y;
+
+	MinX = minX;
+	MinY = minY;
+	Width = maxX - minX + 1;
+	Height = maxY - minY + 1;
+
+	// Put the existing sections into their new cells
+	Cells.assign(Width * Height, NULL);
+	for(unsigned int i=0;i<Occupied.size();i++)
+	{
+		const INT2& c = Occupied[i]->WorldCoordinates;
+		Cells[(c.x - MinX) * Height + (c.y - MinY)] = Occupied[i];
+	}
+}
+
+/** Collects the sections ForEachSectionInRange would visit */
+void WorldSectionGrid::GetSectionsInRange(const INT2& center, int radius, std::vector<WorldMeshSectionInfo*>& out) const
+{
+	ForEachSectionInRange(center, radius, [&](WorldMeshSectionInfo& section)
+	{
+		out.push_back(&section);
+	});
+}
+
+/** Collects every section whose bounding box could touch the given box */
+void WorldSectionGrid::GetSectionsNearBox(const D3DXVECTOR3& min, const D3DXVECTOR3& max, std::vector<WorldMeshSectionInfo*>& out) const
+{
+	if(MaxOverhang < 0)
+	{
+		out.insert(out.end(), Occupied.begin(), Occupied.end());
+		return;
+	}
+
+	INT2 c0 = WorldConverter::GetSectionOfPos(min);
+	INT2 c1 = WorldConverter::GetSectionOfPos(max);
+
+	ForEachSectionInCells(c0.x - MaxOverhang, c0.y - MaxOverhang, c1.x + MaxOverhang, c1.y + MaxOverhang, [&](WorldMeshSectionInfo& section)
+	{
+		out.push_back(&section);
+	});
+}
+
+/** Computes how many cells the bounding boxes of the sections reach into their neighbours */
+void WorldSectionGrid::UpdateSectionExtents()
+{
+	MaxOverhang = 0;
+	for(unsigned int i=0;i<Occupied.size();i++)
+	{
+		const WorldMeshSectionInfo& section = *Occupied[i];
+
+		// Sections without geometry can't be hit
+		if(section.BoundingBox.Min.x > section.BoundingBox.Max.x)
+			continue;
+
+		INT2 c0 = WorldConverter::GetSectionOfPos(section.BoundingBox.Min);
+		INT2 c1 = WorldConverter::GetSectionOfPos(section.BoundingBox.Max);
+		const INT2& c = section.WorldCoordinates;
+
+		MaxOverhang = std::max(MaxOverhang, std::max(c.x - c0.x, c1.x - c.x));
+		MaxOverhang = std::max(MaxOverhang, std::max(c.y - c0.y, c1.y - c.y));
+	}
+}
@@ -8,6 +8,9 @@
 #include "zCPolygon.h"
 #include "BaseShadowedPointLight.h"
 #include "D3D11VertexBuffer.h"
+#include "MeshBVH.h"
+#include "VobInstanceStore.h"
+#include <deque>
 
 class zCMaterial;
 class zCPolygon;
@@ -94,6 +97,9 @@ struct VisualTesselationSettings
 	Buffer buffer;
 };
 
+/** Levels of detail a mesh can have, including the full mesh */
+const unsigned int MESH_NUM_LOD_LEVELS = 4;
+
 /** Holds information about a mesh, ready to be loaded into the renderer */
 struct MeshInfo
 {
@@ -113,6 +119,15 @@ struct MeshInfo
 	/** Creates buffers for this mesh info */
 	XRESULT Create(ExVertexStruct* vertices, unsigned int numVertices, VERTEX_INDEX* indices, unsigned int numIndices);
 
+	/** Returns the mesh for the given level of detail. Levels this mesh doesn't have fall back to the coarsest one. */
+	MeshInfo* GetLOD(unsigned int lod)
+	{
+		if(!lod || LODs.empty())
+			return this;
+
+		return LODs[std::min(lod, (unsigned int)LODs.size()) - 1];
+	}
+
 	D3D11VertexBuffer* MeshVertexBuffer;
 	D3D11VertexBuffer* MeshIndexBuffer;
 	std::vector<ExVertexStruct> Vertices;
@@ -127,6 +142,20 @@ struct MeshInfo
 	unsigned int IndexBufferOffset;
 	D3D11VertexBuffer* WrappedVB;
 	D3D11VertexBuffer* WrappedIB;
+
+	/** Decimated versions of this mesh, getting coarser with each level */
+	std::vector<MeshInfo*> LODs;
+};
+
+/** Range of indices whose triangles lie mostly in one face of a shadow-cube */
+struct CubeFaceIndexRange
+{
+	unsigned int IndexOffset;
+	unsigned int NumIndices;
+
+	/** Bounding sphere of the triangles, to find the faces they can be seen in */
+	D3DXVECTOR3 Center;
+	float Radius;
 };
 
 struct WorldMeshInfo : public MeshInfo
@@ -146,6 +175,9 @@ struct WorldMeshInfo : public MeshInfo
 
 	/** If true we will save an info-file on next zen-resource-save */
 	bool SaveInfo;
+
+	/** Indices of this mesh, split by the shadow-cube faces they lie in. Only filled for the caches of pointlights. */
+	std::vector<CubeFaceIndexRange> CubeFaceRanges;
 };
 
 struct QuadMarkInfo
@@ -200,6 +232,7 @@ struct BaseVisualInfo
 	BaseVisualInfo()
 	{
 		Visual = NULL;
+		TraceBVH = NULL;
 	}
 
 	virtual ~BaseVisualInfo()
@@ -209,8 +242,16 @@ struct BaseVisualInfo
 			for(unsigned int i=0;i<(*it).second.size();i++)
 				delete (*it).second[i];
 		}
+
+		delete TraceBVH;
 	}
 
+	/** Returns the BVH over all meshes of this visual. Built on first use. */
+	const MeshBVH* GetTraceBVH();
+
+	/** Throws away the BVH. Must be called when the meshes change. */
+	void InvalidateTraceBVH();
+
 	/** Creates PNAEN-Info for all meshes if not already there */
 	virtual void CreatePNAENInfo(bool softNormals = false){}
 
@@ -242,6 +283,12 @@ struct BaseVisualInfo
 
 	/** Name of this visual */
 	std::string VisualName;
+
+	/** BVH for ray-tracing, NULL until first needed */
+	MeshBVH* TraceBVH;
+
+	/** Material of each mesh in the BVH, by the number the mesh was added with */
+	std::vector<zCMaterial*> TraceBVHMaterials;
 };
 
 /** Holds the converted mesh of a VOB */
@@ -253,8 +300,10 @@ struct MeshVisualInfo : public BaseVisualInfo
 	{
 		Visual = NULL;
 		UnloadedSomething = false;
-		StartInstanceNum = 0;
 		FullMesh = NULL;
+		NumLODs = 1;
+
+		StartNewFrame();
 	}
 
 	~MeshVisualInfo()
@@ -265,7 +314,8 @@ struct MeshVisualInfo : public BaseVisualInfo
 	/** Starts a new frame for this mesh */
 	void StartNewFrame()
 	{
-		Instances.clear();
+		for(unsigned int i=0;i<MESH_NUM_LOD_LEVELS;i++)
+			InstanceBatch[i] = VOB_INSTANCE_NO_SLOT;
 	}
 
 	/** Creates PNAEN-Info for all meshes if not already there */
@@ -277,8 +327,12 @@ struct MeshVisualInfo : public BaseVisualInfo
 	std::vector<std::pair<MeshKey, std::vector<MeshInfo*>>> MeshesCached;
 
 	//zCProgMeshProto* Visual;
-	std::vector<VobInstanceInfo> Instances;
-	unsigned int StartInstanceNum;
+
+	/** Batch this visual got for each level of detail while grouping the visible vobs. Only valid during the grouping. */
+	unsigned int InstanceBatch[MESH_NUM_LOD_LEVELS];
+
+	/** Levels of detail the meshes of this visual have, including the full one */
+	unsigned int NumLODs;
 
 	/** Full mesh of this */
 	MeshInfo* FullMesh;
@@ -340,6 +394,7 @@ struct VobInfo : public BaseVobInfo
 		IsIndoorVob = false;
 		VisibleInRenderPass = false;
 		VobSection = NULL;
+		InstanceSlot = VOB_INSTANCE_NO_SLOT;
 	}
 
 	~VobInfo()
@@ -374,6 +429,9 @@ struct VobInfo : public BaseVobInfo
 
 	/** Color the underlaying polygon has */
 	DWORD GroundColor;
+
+	/** Slot in the VobInstanceStore, if this is a vob of the main world */
+	unsigned int InstanceSlot;
 };
 
 class zCVobLight;
@@ -491,6 +549,7 @@ struct WorldMeshSectionInfo
 		BoundingBox.Min = D3DXVECTOR3(FLT_MAX, FLT_MAX, FLT_MAX);
 		BoundingBox.Max = D3DXVECTOR3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
 		FullStaticMesh = NULL;
+		TraceBVH = NULL;
 	}
 
 	~WorldMeshSectionInfo()
@@ -528,8 +587,15 @@ struct WorldMeshSectionInfo
 		
 
 		delete FullStaticMesh;
+		delete TraceBVH;
 	}
 
+	/** Returns the BVH over all worldmeshes of this section. Built on first use. */
+	const MeshBVH* GetTraceBVH();
+
+	/** Throws away the BVH. Must be called when the worldmeshes change. */
+	void InvalidateTraceBVH();
+
 	/** Saves this sections mesh to a file */
 	void SaveSectionMeshToFile(const std::string& name);
 
@@ -564,6 +630,87 @@ struct WorldMeshSectionInfo
 
 	unsigned int BaseIndexLocation;
 	unsigned int NumIndices;
+
+	/** BVH for ray-tracing, NULL until first needed */
+	MeshBVH* TraceBVH;
+
+	/** Mesh of each number in the BVH, with the key it is stored at */
+	std::vector<std::pair<MeshKey, WorldMeshInfo*>> TraceBVHMeshes;
+};
+
+/** Dense 2D-grid of world-sections. Cells are looked up directly, the sections themselves are stored
+	in a few big blocks and never move, so pointers to them stay valid until Clear() is called. */
+class WorldSectionGrid
+{
+public:
+	WorldSectionGrid();
+
+	/** Returns the section at the given cell, creating it if it doesn't exist yet */
+	WorldMeshSectionInfo& GetSection(int x, int y);
+
+	/** Returns the section at the given cell, or NULL if there is none */
+	WorldMeshSectionInfo* FindSection(int x, int y) const;
+
+	/** Returns all existing sections, sorted by x, then y */
+	const std::vector<WorldMeshSectionInfo*>& GetSections() const {return Occupied;}
+
+	/** Calls fn for every existing section inside the given cells, including the last ones. Sorted like GetSections. */
+	template<typename F> void ForEachSectionInCells(int x0, int y0, int x1, int y1, F fn) const
+	{
+		x0 = std::max(x0, MinX);
+		x1 = std::min(x1, MinX + Width - 1);
+		y0 = std::max(y0, MinY);
+		y1 = std::min(y1, MinY + Height - 1);
+
+		for(int x=x0;x<=x1;x++)
+		{
+			WorldMeshSectionInfo* const* column = &Cells[(x - MinX) * Height];
+			for(int y=y0;y<=y1;y++)
+			{
+				if(column[y - MinY])
+					fn(*column[y - MinY]);
+			}
+		}
+	}
+
+	/** Calls fn for every existing section with abs(x - center.x) < radius and abs(y - center.y) < radius. Only the cells inside that range are visited. */
+	template<typename F> void ForEachSectionInRange(const INT2& center, int radius, F fn) const
+	{
+		ForEachSectionInCells(center.x - radius + 1, center.y - radius + 1, center.x + radius - 1, center.y + radius - 1, fn);
+	}
+
+	/** Collects the sections ForEachSectionInRange would visit */
+	void GetSectionsInRange(const INT2& center, int radius, std::vector<WorldMeshSectionInfo*>& out) const;
+
+	/** Collects every section whose bounding box could touch the given box, sorted like GetSections. The boxes themselves aren't tested.
+		Without an up to date UpdateSectionExtents, this returns all sections. */
+	void GetSectionsNearBox(const D3DXVECTOR3& min, const D3DXVECTOR3& max, std::vector<WorldMeshSectionInfo*>& out) const;
+
+	/** Computes how many cells the bounding boxes of the sections reach into their neighbours. Call this after the boxes have changed. */
+	void UpdateSectionExtents();
+
+	/** Deletes all sections */
+	void Clear();
+
+private:
+	/** Makes the grid big enough to hold the given cell */
+	void GrowToInclude(int x, int y);
+
+	/** Storage for the sections, a deque doesn't move its elements when growing */
+	std::deque<WorldMeshSectionInfo> Storage;
+
+	/** Sections of the existing cells, sorted by x, then y */
+	std::vector<WorldMeshSectionInfo*> Occupied;
+
+	/** Section per cell or NULL, stored column by column */
+	std::vector<WorldMeshSectionInfo*> Cells;
+	int MinX;
+	int MinY;
+	int Width;
+	int Height;
+
+	/** Cells the bounding box of any section reaches out of its own cell, -1 if unknown */
+	int MaxOverhang;
 };
 
 class zCBspTree;
@@ -32,9 +32,14 @@
 #endif
 
 // Set to 1 or 2 when building squish to use SSE or SSE2 instructions.
+// Defaults to SSE2 whenever the compiler targets it, which /arch:SSE2 (the default since VS2012) and x64 do.
 #ifndef SQUISH_USE_SSE
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define SQUISH_USE_SSE 2
+#else
 #define SQUISH_USE_SSE 0
 #endif
+#endif
 
 // Internally et SQUISH_USE_SIMD when either Altivec or SSE is available.
 #if SQUISH_USE_ALTIVEC && SQUISH_USE_SSE